@@ -1,8 +1,20 @@
 #pragma once
 #include "Util.h"
 
-// Hard-coded k to 32
-#define _K 32
+// k is fixed at build time, 32 by default. Smaller k's (25-31) build plots with proportionally
+// smaller buffers, for quick smoke tests and machines with less memory. See BB_K in CMakeLists.txt.
+#ifndef _K
+    #define _K 32
+#endif
+
+#if _K < 25
+    #error "k must be between 25 and 32."
+#elif _K > 32
+    // Entry indices (Pair, t1XBuffer, the Phase 3 maps) are 32 bits, line points are stored in 64 bits
+    // and Meta4 holds 128 bits, which caps k at 32: a k33 line point takes 66 bits and its Meta4 132 bits.
+    #error "k above 32 is not supported: entry indices are 32 bits, and line points 64 bits."
+#endif
+
 #define ENTRIES_PER_TABLE ( 1ull << _K )
 
 enum class TableId
@@ -82,6 +94,14 @@ const double kRValues[7] = { 4.7, 2.75, 2.75, 2.7, 2.6, 2.45 };
 #define kPOSMagic          "Proof of Space Plot"
 #define kFormatDescription "v1.0"
 
+// Plots whose table 1 x's have their low bits dropped (see --drop-x-bits) are described by this,
+// followed by the number of bits dropped, ex. "v1.0-dx4". chiapos does not read them.
+#define kDroppedXFormatPrefix "v1.0-dx"
+#define BB_MAX_DROPPED_X_BITS 8
+
+// The ANS encoding R value for the deltas of a table 1 with dropped x bits
+#define kDroppedXR 4.7
+
 // Initializes L_targets table
 //-----------------------------------------------------------
 inline void LoadLTargets()
@@ -133,6 +153,24 @@ inline size_t CalculateParkSize( TableId tableId )
     //         CalculateMaxDeltasSize(k, table_index);
 }
 
+// Stub size of the deltas of a table 1 with dropped x bits. Its line points have 2 bits less per bit dropped,
+// and as many entries, so its stubs are 2 bits shorter per bit dropped, and its small deltas are as large as table 1's.
+//-----------------------------------------------------------
+inline uint DroppedXStubBits( uint droppedBits )
+{
+    return _K - 2 * droppedBits - kStubMinusBits;
+}
+
+// Park size of a table 1 with dropped x bits
+//-----------------------------------------------------------
+inline size_t CalculateDroppedXParkSize( uint droppedBits )
+{
+    return
+        CDiv( ( _K - droppedBits ) * 2, 8 ) +
+        CDiv( (kEntriesPerPark - 1) * DroppedXStubBits( droppedBits ), 8 ) +
+        CalculateMaxDeltasSize( TableId::Table1 );
+}
+
 // Calculates the size of one C3 park. This will store bits for each f7 between
 // two C1 checkpoints, depending on how many times that f7 is present. For low
 // values of k, we need extra space to account for the additional variability.
@@ -1,8 +1,8 @@
 
 // Maximum number of supported threads. 
-// Jobs will be stack allocated to this size.
-// #TODO: This should perhaps be named max jobs.
-#define MAX_THREADS 256
+// Jobs are allocated for the threads that run them, so this only bounds
+// the thread count given to the phases' templated kernels.
+#define MAX_THREADS 1024
 
 // Perform Y sorts at the block level.
 // Unrolling loops by chacha block size.
@@ -25,19 +25,7 @@
 #define DBG_TEST_PROOF_RANGE { 167000899, 3 }
 // #define DBG_DUMP_PROOFS 1
 
-// #define DBG_WRITE_PHASE_1_TABLES 1
-#if !DBG_WRITE_PHASE_1_TABLES
-    // #define DBG_READ_PHASE_1_TABLES 1
-#endif
-
-// #define DBG_WRITE_MARKED_TABLES 1
-#if !DBG_WRITE_MARKED_TABLES 
-    // #define DBG_READ_MARKED_TABLES 1
-#endif
-
 // #define DBG_WRITE_LINE_POINTS 1
 // #define DBG_WRITE_SORTED_F7_TABLE 1
 
-// Enable to test plotting times without writing to disk
-// #define BB_BENCHMARK_MODE 1
 
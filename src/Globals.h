@@ -48,6 +48,19 @@
 #endif
 
 
+// Hint that ptr will be read soon
+#if defined( _MSC_VER )
+    #if defined( _M_ARM ) || defined( _M_ARM64 )
+        #define BB_PREFETCH( ptr ) __prefetch( (const void*)(ptr) )
+    #else
+        #include <xmmintrin.h>
+        #define BB_PREFETCH( ptr ) _mm_prefetch( (const char*)(ptr), _MM_HINT_T0 )
+    #endif
+#else
+    #define BB_PREFETCH( ptr ) __builtin_prefetch( (ptr), 0, 3 )
+#endif
+
+
 #define TimerBegin() std::chrono::steady_clock::now()
 #define TimerEnd( startTime ) \
     (std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::steady_clock::now() - (startTime) ).count() / 1000.0)
@@ -0,0 +1,58 @@
+#pragma once
+#include "Platform.h"
+
+// Most instances that may share a host
+#define BB_MAX_HOST_INSTANCES       64
+
+// Size of each throttled write, when the host's write bandwidth is capped
+#define BB_HOST_WRITE_CHUNK_SIZE    ( 8ull * 1024 * 1024 )
+
+struct HostCoordinatorShared;
+
+/**
+ * Coordinates several bladebit instances on the same host, so that they can
+ * be packed on it without pinning each of them by hand.
+ *
+ * Instances of the same group register in a shared memory segment named after it,
+ * each taking the first free one of the group's slots. Each slot gets its share of
+ * the host's cpus: whole NUMA nodes if there are at least as many nodes as slots,
+ * otherwise whole cores of one node, or of the host if it's not NUMA.
+ * The process is then restricted to its share, and to the memory of its nodes,
+ * before any of its threads are started.
+ *
+ * The plot writers of the instances take turns writing their tables, so that their
+ * flushes don't collide, and share a write bandwidth budget. The slot count and the
+ * budget are those of the first instance to join. The slots of instances that exited
+ * are freed, even if they crashed.
+ */
+class HostCoordinator
+{
+public:
+    // Joins a group, setting it up with the given slot count and write bandwidth, in bytes per second
+    // (0 for unlimited), if it has no instances yet. Returns null if it could not be joined.
+    // The process stays in the group until it exits.
+    static HostCoordinator* Join( const char* group, uint instanceCount, uint64 writeBandwidth );
+
+    // Restricts the process to the cpus of its slot. Returns false if they could not be restricted.
+    bool TakeCpuShare();
+
+    // Waits for the host's write turn. Only one instance writes at a time.
+    void BeginWrite();
+    void EndWrite();
+
+    // Blocks until size bytes can be written within the host's write bandwidth budget
+    void Throttle( size_t size );
+
+    inline uint   Slot()           const { return _slot; }
+    inline uint   InstanceCount()  const { return _instanceCount; }
+    inline uint64 WriteBandwidth() const { return _writeBandwidth; }
+
+private:
+    HostCoordinator() = default;
+
+private:
+    HostCoordinatorShared* _shared         = nullptr;
+    uint                   _slot           = 0;
+    uint                   _instanceCount  = 0;
+    uint64                 _writeBandwidth = 0;
+};
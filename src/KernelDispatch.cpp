@@ -0,0 +1,138 @@
+#include "KernelDispatch.h"
+#include "util/Log.h"
+#include <cstring>
+#include <string>
+
+#if defined( __x86_64__ ) || defined( _M_X64 )
+    #define DISPATCH_X86 1
+    #if defined( _MSC_VER ) && !defined( __clang__ )
+        #include <intrin.h>
+    #endif
+#elif defined( __aarch64__ ) || defined( _M_ARM64 )
+    #define DISPATCH_ARM64 1
+    #if defined( __linux__ )
+        #include <sys/auxv.h>
+        #include <asm/hwcap.h>
+    #endif
+#endif
+
+struct KernelEntry
+{
+    const char* name;
+    SimdLevel   (*select)( SimdLevel maxLevel );
+    SimdLevel   level;      // Level of the selected variant, once resolved
+};
+
+static KernelEntry _kernels[] = {
+    { "chacha8"     , SelectChaCha8Kernel    , SimdLevel::Scalar },
+    { "blake3_lanes", SelectBlake3LanesKernel, SimdLevel::Scalar },
+    { "kbc_match"   , SelectKBCMatchKernel   , SimdLevel::Scalar },
+    { "park_stubs"  , SelectParkStubsKernel  , SimdLevel::Scalar },
+};
+
+static const char* LEVEL_NAMES[] = { "scalar", "sse2", "avx2", "avx512", "neon" };
+
+//-----------------------------------------------------------
+static SimdLevel DetectLevel()
+{
+#if DISPATCH_X86
+    #if defined( _MSC_VER ) && !defined( __clang__ )
+        int info[4];
+        __cpuid( info, 0 );
+        if( info[0] < 7 )
+            return SimdLevel::SSE2;
+
+        __cpuid( info, 1 );
+        if( !( info[2] & ( 1 << 27 ) ) )  // OSXSAVE
+            return SimdLevel::SSE2;
+
+        const unsigned long long xcr0 = _xgetbv( 0 );
+        __cpuidex( info, 7, 0 );
+
+        const bool avx2   = ( info[1] & ( 1 << 5  ) ) && ( xcr0 & 0x6  ) == 0x6;
+        const bool avx512 = ( info[1] & ( 1 << 16 ) ) && ( xcr0 & 0xE6 ) == 0xE6;
+
+        return avx512 ? SimdLevel::AVX512 : avx2 ? SimdLevel::AVX2 : SimdLevel::SSE2;
+    #else
+        __builtin_cpu_init();
+
+        if( __builtin_cpu_supports( "avx512f" ) )
+            return SimdLevel::AVX512;
+        if( __builtin_cpu_supports( "avx2" ) )
+            return SimdLevel::AVX2;
+
+        return SimdLevel::SSE2;
+    #endif
+#elif DISPATCH_ARM64
+    // Advanced SIMD is part of the ARMv8-A base, but Linux can still report it missing
+    #if defined( __linux__ )
+        return ( getauxval( AT_HWCAP ) & HWCAP_ASIMD ) ? SimdLevel::NEON : SimdLevel::Scalar;
+    #else
+        return SimdLevel::NEON;
+    #endif
+#else
+    return SimdLevel::Scalar;
+#endif
+}
+
+//-----------------------------------------------------------
+SimdLevel KernelDispatch::Detect()
+{
+    static const SimdLevel level = DetectLevel();
+    return level;
+}
+
+//-----------------------------------------------------------
+bool KernelDispatch::IsSupported( SimdLevel level )
+{
+    if( level == SimdLevel::Scalar )
+        return true;
+
+#if DISPATCH_X86
+    return level != SimdLevel::NEON && level <= Detect();
+#else
+    return level == Detect();
+#endif
+}
+
+//-----------------------------------------------------------
+void KernelDispatch::Resolve( SimdLevel maxLevel )
+{
+    ASSERT( IsSupported( maxLevel ) );
+
+    for( KernelEntry& kernel : _kernels )
+        kernel.level = kernel.select( maxLevel );
+}
+
+//-----------------------------------------------------------
+void KernelDispatch::LogSelected()
+{
+    std::string kernels;
+
+    for( const KernelEntry& kernel : _kernels )
+        kernels += std::string( " " ) + kernel.name + "=" + LevelName( kernel.level );
+
+    Log::Line( "SIMD kernels:%s (CPU supports %s)", kernels.c_str(), LevelName( Detect() ) );
+}
+
+//-----------------------------------------------------------
+const char* KernelDispatch::LevelName( SimdLevel level )
+{
+    ASSERT( (uint)level < sizeof( LEVEL_NAMES ) / sizeof( LEVEL_NAMES[0] ) );
+    return LEVEL_NAMES[(uint)level];
+}
+
+//-----------------------------------------------------------
+bool KernelDispatch::ParseLevel( const char* name, SimdLevel& outLevel )
+{
+    for( uint i = 0; i < sizeof( LEVEL_NAMES ) / sizeof( LEVEL_NAMES[0] ); i++ )
+    {
+        if( strcmp( name, LEVEL_NAMES[i] ) == 0 )
+        {
+            outLevel = (SimdLevel)i;
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include "Platform.h"
+
+// Instruction sets the SIMD kernels are built for, narrowest first on each architecture
+enum class SimdLevel : uint
+{
+    Scalar = 0,
+    SSE2,           // x86-64 baseline
+    AVX2,
+    AVX512,         // AVX-512F
+    NEON            // AArch64 baseline
+};
+
+/**
+ * Selects the variant of each SIMD kernel (ChaCha8 keystream, BLAKE3 lanes,
+ * kBC matching and park stub packing) from the CPU's features at runtime,
+ * so that a single binary runs the widest kernels each host supports.
+ *
+ * Each kernel resolves itself to the widest level the CPU supports before main,
+ * in a static initializer, so that callers other than the plotter get it too.
+ * The plotter resolves them all again when it's constructed, capped by --simd,
+ * so that the kernels can be compared against each other on the same host,
+ * before any of its threads run them.
+ */
+class KernelDispatch
+{
+public:
+    // Widest level supported by the CPU and the OS, detected once:
+    // CPUID and XCR0 on x86-64, HWCAP on ARM64 Linux.
+    static SimdLevel Detect();
+
+    // Whether the CPU can run kernels of this level
+    static bool IsSupported( SimdLevel level );
+
+    // Selects the widest variant of each kernel at or below maxLevel,
+    // or its narrowest one if it has none. maxLevel must be supported.
+    static void Resolve( SimdLevel maxLevel );
+
+    // Logs the variant selected for each kernel
+    static void LogSelected();
+
+    static const char* LevelName( SimdLevel level );
+
+    // Parses a level by its name, as given to --simd. Returns false if it's not a known level.
+    static bool ParseLevel( const char* name, SimdLevel& outLevel );
+};
+
+// Selectors of each kernel. They return the level of the variant they selected.
+SimdLevel SelectChaCha8Kernel    ( SimdLevel maxLevel );
+SimdLevel SelectBlake3LanesKernel( SimdLevel maxLevel );
+SimdLevel SelectKBCMatchKernel   ( SimdLevel maxLevel );
+SimdLevel SelectParkStubsKernel  ( SimdLevel maxLevel );
@@ -4,12 +4,25 @@
 #include "threading/ThreadPool.h"
 #include "PlotWriter.h"
 
+struct NumaInfo;
+
+class TableSpiller;
+class PlotMover;
+class PlotCheckpoint;
+class ThreadPolicy;
+class Profiler;
+class GpuCompute;
+struct PlotMetrics;
+
 struct PlotRequest
 {
     const byte* plotId;       // Id of the plot we want to create       
-    const char* outPath;      // Output plot path
+    const char* fileName;     // Output plot file name. The plotter places it in one of its output directories.
     const byte* memo;         // Plot memo
     uint16      memoSize;
+    const byte* nextPlotId;   // Id of the plot that will be requested after this one, if known
+    const char* nextFileName; // File name of the next plot, if known. Its file may be prepared while this plot is made.
+    const char* outputDir;    // If set, the plot goes to this directory instead of one of the plotter's
     bool        IsFinalPlot;  
 };
 
@@ -20,6 +33,48 @@ struct Pair
 };
 static_assert( sizeof( Pair ) == 8, "Invalid Pair struct." );
 
+// Compact pair in which tables 2-6 are stored.
+// Right entries are always found in the kBC group adjacent to the left entry's group,
+// so they are stored as a small offset from the left entry.
+#pragma pack( push, 1 )
+struct PackedPair
+{
+    uint32 left;
+    uint16 rightOffset;
+
+    inline uint32 Right() const { return left + rightOffset; }
+};
+#pragma pack( pop )
+static_assert( sizeof( PackedPair ) == 6, "Invalid PackedPair struct." );
+
+//-----------------------------------------------------------
+inline PackedPair PackPair( const Pair& pair )
+{
+    ASSERT( pair.right > pair.left && pair.right - pair.left <= 0xFFFF );
+    return { pair.left, (uint16)( pair.right - pair.left ) };
+}
+
+//-----------------------------------------------------------
+inline Pair UnpackPair( const PackedPair& pair )
+{
+    return { pair.left, pair.Right() };
+}
+
+//-----------------------------------------------------------
+inline const Pair& UnpackPair( const Pair& pair )
+{
+    return pair;
+}
+
+//-----------------------------------------------------------
+inline void StorePair( PackedPair& dst, const Pair& src ) { dst = PackPair( src ); }
+inline void StorePair( Pair&       dst, const Pair& src ) { dst = src; }
+
+/// Type in which the final L/R pairs of each table are stored.
+/// Table 7 is kept unpacked as Phase 3 converts it in-place to 64-bit line points.
+template<TableId table> struct TablePair                   { using Type = PackedPair; };
+template<>              struct TablePair<TableId::Table7>  { using Type = Pair;       };
+
 
 ///
 /// Context for a in-memory plotting
@@ -39,18 +94,86 @@ struct MemPlotContext
     // Thread pool to use when running jobs
     ThreadPool* threadPool;
 
+    // Picks the thread count of each parallel kernel, which may be less than the pool's
+    ThreadPolicy* threadPolicy;
+
+    // If set, Phase 3 encodes each table's parks on this pool, in the background,
+    // while the next table is pruned and converted to line points
+    ThreadPool*   parkPool;
+
+    // If set, records the time spent by, and the hardware counters of, each phase, table and kernel
+    Profiler*     profiler;
+
+    // If set, the plot's progress is published here, for the metrics server
+    PlotMetrics*  metrics;
+
+    // NUMA nodes on which to keep the sorts' work node-local.
+    // Only set if the system has more than one node, and the pool threads are pinned to their cpus.
+    const NumaInfo* numa;
+
+    // If set, F1 and Fx are computed on this GPU
+    GpuCompute* gpu;
+
+    // Generate F1 directly into the buckets of the first y sort pass
+    bool        fusedF1;
+
+    // Sort forward propagated tables in cache-sized y buckets
+    bool        bucketedFp;
+
+    // Sort forward propagated tables with y packed with its index, instead of generating a sort key
+    bool        packedFxSort;
+
+    // Map forward propagated metadata and pairs in cache-sized blocks, with prefetching
+    bool        blockedMap;
+
+    // Sort Phase 3's line points and f7 in place, so that yBuffer1 is not needed as a temporary buffer
+    bool        inPlaceSort;
+
+    // Prune Phase 3's tables straight into line points, without an intermediate pruned pair pass
+    bool        fusedPrune;
+
+    // Sort Phase 3's line points by distributing them into buckets by their top bits as they are converted
+    bool        bucketedLpSort;
+
+    // Write Phase 3's lookup tables by binning the new indices by destination range first
+    bool        binnedLookup;
+
+    // Stream Phase 3's parks to the plot writer in chunks as they are encoded
+    bool        streamParks;
+
+    // Build the C1, C2 and C3 tables in Phase 3, in a single pass after the f7 sort
+    bool        fusedCheckpoints;
+
+    // Don't use the async I/O backend (io_uring) to write the plot file
+    bool        noAsyncIO;
+
+    // Generate the next plot's F1 in the background, while this plot is in Phases 3 and 4
+    bool        pipeline;
+
+    // Preallocate the plot file to its predicted size, so that it's laid out contiguously
+    bool        preallocatePlot;
+
+    // Digest the plot as it's written, and write the digest to a file next to it
+    bool        digestPlot;
+
+    // Low bits dropped from table 1's x's in its line points, for a smaller plot, or 0 (see kDroppedXFormatPrefix)
+    uint        droppedXBits;
+
+    // Seconds spent encoding table 1's parks, for the benchmark
+    double      table1ParkTime;
+
     ///
     /// Buffers
     ///
     // Permanent table data buffers
-    uint32* t1XBuffer ;       // 16 GiB
-    Pair*   t2LRBuffer;       // 32 GiB
-    Pair*   t3LRBuffer;       // 32 GiB
-    Pair*   t4LRBuffer;       // 32 GiB
-    Pair*   t5LRBuffer;       // 32 GiB
-    Pair*   t6LRBuffer;       // 32 GiB
-    Pair*   t7LRBuffer;       // 32 GiB
-    uint32* t7YBuffer ;       // 16 GiB
+    uint32*     t1XBuffer ;   // 16 GiB
+    PackedPair* t2LRBuffer;   // 24 GiB
+    PackedPair* t3LRBuffer;   // 24 GiB
+    PackedPair* t4LRBuffer;   // 24 GiB
+    PackedPair* t5LRBuffer;   // 24 GiB
+    PackedPair* t6LRBuffer;   // 24 GiB
+    Pair*       t7LRBuffer;   // 32 GiB
+    uint32*     t7YBuffer ;   // 16 GiB
 
     // Temporary read/write y buffers
     uint64* yBuffer0;         // 32GiB each
@@ -60,26 +183,62 @@ struct MemPlotContext
     uint64* metaBuffer0;      // 64GiB each
     uint64* metaBuffer1;
 
-    uint64  maxKBCGroups;
+    // When pipelining, the next plot's F1 is generated into yBuffer0, with yBuffer1 as its
+    // y sort buffer. Its x values go into nextT1XBuffer, which is swapped with t1XBuffer
+    // once the next plot starts.
+    uint32* nextT1XBuffer;    // 16 GiB
+    uint32* nextT1XTmp;       // 16 GiB. Only alive during Phases 3 and 4.
+    bool    t1Pregenerated;   // F1 was already generated into yBuffer0 and t1XBuffer for this plot
+
+    // Phase 3 buffers
+    uint64* lpBuffer0;        // 32 GiB. Line points, then table 6's parks while they're written to disk
+    uint64* lpBuffer1;        // 32 GiB. Line points of every other table, when their parks are encoded in the background
+    uint32* lookupMap;        // 32 GiB. The line points' sort key, followed by its temporary buffer
+    uint64* p3TmpBuffer;      // 32 GiB. Line point and f7 sort buffer. Not used when sorting in place.
+
     uint64  maxPairs;         // Max total pairs our buffer can hold
     
     // Number of entries per-table
     uint64 entryCount[7];
 
     // Added by Phase 2:
-    byte* usedEntries[6];   // Used entries per each table.
-                            // These are only used for tables 2-6 (inclusive).
-                            // These buffers map to regions in yBuffer0.
+    uint64* usedEntries[6];     // Used entries per each table, as bitfields.
+                                // These are only used for tables 2-6 (inclusive).
+                                // These buffers map to regions in usedEntriesBuffer.
+    uint32* usedEntryRanks[6];  // Rank index of each bitfield (see RankIndex.h), built as it's marked,
+                                // so that Phase 3 knows where each entry goes once pruned.
+                                // These follow the bitfields in usedEntriesBuffer.
+    uint64* usedEntriesBuffer;  // Alive during Phases 2 and 3
+    uint64* markingScratch;     // Phase 2's marks, binned by destination range before they're marked (32 GiB).
+                                // Only alive during Phase 2.
 
     DiskPlotWriter* plotWriter;
 
-    // The buffer used to write to disk the Phase 4 data.
-    // This may be metaBuffer0 or a an L/R buffer from
-    // table 3 and up, the highest one available to use.
+    // The buffer Phase 4 writes P7 and the C tables from, sized by GetP4TableBufferSize().
+    byte* p4TableBuffer;
+
+    // The buffer used to write to disk the Phase 4 data, while the plot is being written.
     // If null, then no buffer is in use.
     byte* p4WriteBuffer;
     byte* p4WriteBufferWriter;
 
+    // C1, C2 and C3 tables built by Phase 3 when fusedCheckpoints is set,
+    // in the Phase 4 write buffer. Phase 4 only has to write them.
+    bool   cTablesBuilt;
+    byte*  cTableBuffers[3];
+    size_t cTableSizes  [3];
+
+    // If set, tables 2-6 share a single staging buffer
+    // and are spilled to disk while they're not in use.
+    TableSpiller* spill;
+
+    // If set, finished plots are queued to be moved to their final destination.
+    PlotMover* plotMover;
+
+    // If set, plots are checkpointed after Phases 1 and 2,
+    // and the checkpoint is removed once the plot is on disk.
+    PlotCheckpoint* checkpoint;
+
     // How many plots we've made so far
     uint64 plotCount;
 };
@@ -0,0 +1,351 @@
+#include "PlotDigest.h"
+#include "Util.h"
+#include "util/Log.h"
+#include "io/FileStream.h"
+#include <string>
+#include <vector>
+
+struct DigestJob
+{
+    const byte* segments;       // First segment to hash
+    uint64      segmentCount;
+    byte*       digests;        // One digest per segment
+};
+
+static void HashSegmentsJob( DigestJob* job );
+
+static const char* RegionNames[BB_DIGEST_REGION_COUNT] = {
+    "header", "table1", "table2", "table3", "table4", "table5", "table6", "table7", "c1", "c2", "c3"
+};
+
+//-----------------------------------------------------------
+PlotDigest::PlotDigest( uint threadCount )
+    // Hashing runs alongside the plotter's threads, so we don't pin ours
+    : _pool( std::max( threadCount, 1u ), ThreadPool::Mode::Fixed, true )
+{
+    _segmentDigests = (byte*)malloc( (size_t)_pool.ThreadCount() * BB_DIGEST_BATCH_SEGMENTS * 32 );
+    blake3_hasher_init( &_regionHasher );
+}
+
+//-----------------------------------------------------------
+PlotDigest::~PlotDigest()
+{
+    free( _segmentDigests );
+}
+
+//-----------------------------------------------------------
+void PlotDigest::Update( const byte* region, size_t readySize )
+{
+    ASSERT( region );
+
+    const uint64 readySegments = readySize / BB_DIGEST_SEGMENT_SIZE;
+    ASSERT( readySegments >= _segmentsHashed );
+
+    const uint64 segmentCount = readySegments - _segmentsHashed;
+
+    if( segmentCount >= _pool.ThreadCount() )
+        HashSegments( region + _segmentsHashed * BB_DIGEST_SEGMENT_SIZE, segmentCount );
+}
+
+//-----------------------------------------------------------
+void PlotDigest::EndRegion( const byte* region, size_t size, size_t paddedSize, byte digest[32] )
+{
+    ASSERT( region );
+    ASSERT( size <= paddedSize );
+
+    // Whole segments
+    const uint64 segmentCount = size / BB_DIGEST_SEGMENT_SIZE - _segmentsHashed;
+
+    if( segmentCount )
+        HashSegments( region + _segmentsHashed * BB_DIGEST_SEGMENT_SIZE, segmentCount );
+
+    // The rest of the data and the padding, which may spill into one more segment
+    size_t offset   = (size_t)( _segmentsHashed * BB_DIGEST_SEGMENT_SIZE );
+    size_t dataLeft = size - offset;
+
+    while( offset < paddedSize )
+    {
+        const size_t segmentSize = std::min( paddedSize - offset, (size_t)BB_DIGEST_SEGMENT_SIZE );
+        const size_t dataSize    = std::min( dataLeft, segmentSize );
+
+        HashPaddedSegment( region + offset, dataSize, segmentSize );
+
+        offset   += segmentSize;
+        dataLeft -= dataSize;
+    }
+
+    blake3_hasher_finalize( &_regionHasher, digest, 32 );
+
+    // Begin the next region
+    blake3_hasher_init( &_regionHasher );
+    _segmentsHashed = 0;
+}
+
+//-----------------------------------------------------------
+void PlotDigest::HashSegments( const byte* segments, uint64 segmentCount )
+{
+    const uint   threadCount = _pool.ThreadCount();
+    const uint64 batchSize   = (uint64)threadCount * BB_DIGEST_BATCH_SEGMENTS;
+
+    std::vector<DigestJob> jobs( threadCount );
+
+    while( segmentCount )
+    {
+        const uint64 batchCount = std::min( segmentCount, batchSize );
+        const uint64 perThread  = CDiv( batchCount, (int)threadCount );
+
+        uint   jobCount = 0;
+        uint64 done     = 0;
+
+        for( ; done < batchCount; jobCount++ )
+        {
+            DigestJob& job = jobs[jobCount];
+
+            job.segments     = segments + done * BB_DIGEST_SEGMENT_SIZE;
+            job.segmentCount = std::min( perThread, batchCount - done );
+            job.digests      = _segmentDigests + done * 32;
+
+            done += job.segmentCount;
+        }
+
+        _pool.RunJob( HashSegmentsJob, jobs.data(), jobCount );
+
+        // Segment digests are hashed in order
+        blake3_hasher_update( &_regionHasher, _segmentDigests, (size_t)( batchCount * 32 ) );
+
+        _segmentsHashed += batchCount;
+        segmentCount    -= batchCount;
+        segments        += batchCount * BB_DIGEST_SEGMENT_SIZE;
+    }
+}
+
+//-----------------------------------------------------------
+void HashSegmentsJob( DigestJob* job )
+{
+    const byte* segment = job->segments;
+    byte*       digest  = job->digests;
+
+    for( uint64 i = 0; i < job->segmentCount; i++ )
+    {
+        blake3_hasher hasher;
+        blake3_hasher_init( &hasher );
+        blake3_hasher_update( &hasher, segment, BB_DIGEST_SEGMENT_SIZE );
+        blake3_hasher_finalize( &hasher, digest, 32 );
+
+        segment += BB_DIGEST_SEGMENT_SIZE;
+        digest  += 32;
+    }
+}
+
+//-----------------------------------------------------------
+void PlotDigest::HashPaddedSegment( const byte* data, size_t dataSize, size_t segmentSize )
+{
+    static const byte zeroes[4096] = { 0 };
+
+    blake3_hasher hasher;
+    blake3_hasher_init( &hasher );
+
+    if( dataSize )
+        blake3_hasher_update( &hasher, data, dataSize );
+
+    for( size_t padding = segmentSize - dataSize; padding; )
+    {
+        const size_t size = std::min( padding, sizeof( zeroes ) );
+        blake3_hasher_update( &hasher, zeroes, size );
+        padding -= size;
+    }
+
+    byte digest[32];
+    blake3_hasher_finalize( &hasher, digest, 32 );
+
+    blake3_hasher_update( &_regionHasher, digest, 32 );
+    _segmentsHashed++;
+}
+
+//-----------------------------------------------------------
+void PlotDigest::PlotHash( const byte regionDigests[BB_DIGEST_REGION_COUNT][32], byte digest[32] )
+{
+    blake3_hasher hasher;
+    blake3_hasher_init( &hasher );
+    blake3_hasher_update( &hasher, regionDigests, BB_DIGEST_REGION_COUNT * 32 );
+    blake3_hasher_finalize( &hasher, digest, 32 );
+}
+
+//-----------------------------------------------------------
+bool PlotDigest::WriteDigestFile( const char* path, const uint64 offsets[BB_DIGEST_REGION_COUNT],
+                                  const uint64 sizes[BB_DIGEST_REGION_COUNT],
+                                  const byte regionDigests[BB_DIGEST_REGION_COUNT][32] )
+{
+    ASSERT( path );
+
+    FILE* file = fopen( path, "w" );
+    if( !file )
+        return false;
+
+    char   hex[65];
+    size_t numEncoded = 0;
+
+    byte plotDigest[32];
+    PlotHash( regionDigests, plotDigest );
+
+    fprintf( file, "bladebit-digest 1\n" );
+    fprintf( file, "segment-size %llu\n", (unsigned long long)BB_DIGEST_SEGMENT_SIZE );
+
+    BytesToHexStr( plotDigest, 32, hex, sizeof( hex ), numEncoded );
+    hex[64] = 0;
+    fprintf( file, "plot %s\n", hex );
+
+    for( uint i = 0; i < BB_DIGEST_REGION_COUNT; i++ )
+    {
+        BytesToHexStr( regionDigests[i], 32, hex, sizeof( hex ), numEncoded );
+        hex[64] = 0;
+        fprintf( file, "%s %llu %llu %s\n", RegionNames[i], (unsigned long long)offsets[i], (unsigned long long)sizes[i], hex );
+    }
+
+    const bool ok = !ferror( file );
+    return fclose( file ) == 0 && ok;
+}
+
+//-----------------------------------------------------------
+bool PlotDigest::VerifyFile( const char* plotPath, const char* digestPath )
+{
+    ASSERT( plotPath );
+    ASSERT( digestPath );
+
+    // Read the expected digests
+    FILE* digestFile = fopen( digestPath, "r" );
+    if( !digestFile )
+    {
+        Log::Error( "Failed to open digest file %s with error %d.", digestPath, errno );
+        return false;
+    }
+
+    uint   version      = 0;
+    uint64 segmentSize  = 0;
+    char   plotHex[65]  = { 0 };
+    char   names  [BB_DIGEST_REGION_COUNT][16];
+    char   hexes  [BB_DIGEST_REGION_COUNT][65];
+    uint64 offsets[BB_DIGEST_REGION_COUNT];
+    uint64 sizes  [BB_DIGEST_REGION_COUNT];
+
+    bool parsed = fscanf( digestFile, "bladebit-digest %u segment-size %llu plot %64s",
+                          &version, (unsigned long long*)&segmentSize, plotHex ) == 3;
+
+    for( uint i = 0; parsed && i < BB_DIGEST_REGION_COUNT; i++ )
+    {
+        parsed = fscanf( digestFile, "%15s %llu %llu %64s", names[i], (unsigned long long*)&offsets[i],
+                         (unsigned long long*)&sizes[i], hexes[i] ) == 4 &&
+                 strcmp( names[i], RegionNames[i] ) == 0;
+    }
+
+    fclose( digestFile );
+
+    if( !parsed || version != 1 || segmentSize != BB_DIGEST_SEGMENT_SIZE )
+    {
+        Log::Error( "%s is not a version 1 bladebit digest file.", digestPath );
+        return false;
+    }
+
+    FileStream file;
+    if( !file.Open( plotPath, FileMode::Open, FileAccess::Read ) )
+    {
+        Log::Error( "Failed to open plot %s with error %d.", plotPath, file.GetError() );
+        return false;
+    }
+
+    // The regions cover the whole file
+    const int64  fileSize = file.Size();
+    const uint64 last     = BB_DIGEST_REGION_COUNT - 1;
+
+    if( fileSize < 0 || (uint64)fileSize != offsets[last] + sizes[last] )
+    {
+        Log::Error( "Plot %s is %lld bytes, but its digest covers %llu bytes.", plotPath,
+            (long long)fileSize, (unsigned long long)( offsets[last] + sizes[last] ) );
+        return false;
+    }
+
+    // Read a batch of whole segments at a time
+    const size_t bufferSize = (size_t)_pool.ThreadCount() * BB_DIGEST_BATCH_SEGMENTS * BB_DIGEST_SEGMENT_SIZE;
+    byte*        buffer     = (byte*)malloc( bufferSize );
+    FatalIf( !buffer, "Failed to allocate a %llu bytes read buffer.", (unsigned long long)bufferSize );
+
+    byte regionDigests[BB_DIGEST_REGION_COUNT][32];
+    char   hex[65];
+    size_t numEncoded = 0;
+    bool   ok         = true;
+
+    for( uint i = 0; i < BB_DIGEST_REGION_COUNT; i++ )
+    {
+        blake3_hasher_init( &_regionHasher );
+        _segmentsHashed = 0;
+
+        for( uint64 offset = 0; offset < sizes[i]; )
+        {
+            const size_t size = (size_t)std::min( sizes[i] - offset, (uint64)bufferSize );
+
+            for( size_t read = 0; read < size && ok; )
+            {
+                const ssize_t r = file.ReadAt( buffer + read, size - read, (int64)( offsets[i] + offset + read ) );
+
+                if( r <= 0 )
+                {
+                    Log::Error( "Failed to read plot %s with error %d.", plotPath, r < 0 ? file.GetError() : 0 );
+                    ok = false;
+                }
+                else
+                    read += (size_t)r;
+            }
+
+            if( !ok )
+                break;
+
+            // Only the region's last segment may be partial
+            const uint64 segmentCount = size / BB_DIGEST_SEGMENT_SIZE;
+            const size_t remainder    = size - (size_t)( segmentCount * BB_DIGEST_SEGMENT_SIZE );
+
+            if( segmentCount )
+                HashSegments( buffer, segmentCount );
+
+            if( remainder )
+                HashPaddedSegment( buffer + segmentCount * BB_DIGEST_SEGMENT_SIZE, remainder, remainder );
+
+            offset += size;
+        }
+
+        if( !ok )
+            break;
+
+        blake3_hasher_finalize( &_regionHasher, regionDigests[i], 32 );
+
+        BytesToHexStr( regionDigests[i], 32, hex, sizeof( hex ), numEncoded );
+        hex[64] = 0;
+
+        if( strcmp( hex, hexes[i] ) != 0 )
+        {
+            Log::Error( "Region %s of plot %s does not match its digest.", RegionNames[i], plotPath );
+            ok = false;
+        }
+    }
+
+    free( buffer );
+
+    blake3_hasher_init( &_regionHasher );
+    _segmentsHashed = 0;
+
+    if( !ok )
+        return false;
+
+    byte plotDigest[32];
+    PlotHash( regionDigests, plotDigest );
+
+    BytesToHexStr( plotDigest, 32, hex, sizeof( hex ), numEncoded );
+    hex[64] = 0;
+
+    if( strcmp( hex, plotHex ) != 0 )
+    {
+        Log::Error( "The plot digest in %s does not match its regions' digests.", digestPath );
+        return false;
+    }
+
+    return true;
+}
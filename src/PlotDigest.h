@@ -0,0 +1,80 @@
+#pragma once
+#include "threading/ThreadPool.h"
+#include "b3/blake3.h"
+
+// Size of the segments hashed independently, measured from the start of each region
+#define BB_DIGEST_SEGMENT_SIZE  ( 16ull * 1024 * 1024 )
+
+// Threads used to hash segments, by default
+#define BB_DIGEST_THREADS       4
+
+// Segments hashed per parallel batch, per thread
+#define BB_DIGEST_BATCH_SEGMENTS 4
+
+// The header and the 10 tables
+#define BB_DIGEST_REGION_COUNT  11
+
+#define BB_DIGEST_FILE_EXT      ".b3"
+
+/**
+ * Computes the integrity digest of a plot file while it is being written.
+ *
+ * The file is digested region by region: the header, then the 10 tables.
+ * A region covers its bytes in the file, including the zero padding
+ * that aligns it to the file's block size.
+ *
+ * Each region is split into BB_DIGEST_SEGMENT_SIZE segments, hashed in parallel
+ * with BLAKE3. The region's digest is the BLAKE3 hash of its segments' digests,
+ * in order. The plot's digest is the BLAKE3 hash of the header's digest followed
+ * by the tables' digests.
+ *
+ * This is not a plain BLAKE3 hash of the file, so b3sum can't check it, as the header is
+ * written last and the bundled BLAKE3 is sequential. Use --verify-digest instead.
+ *
+ * Regions are digested one at a time, and may be fed as they are filled.
+ * Not thread-safe, it's meant to be used by the writer thread only.
+ */
+class PlotDigest
+{
+public:
+    PlotDigest( uint threadCount = BB_DIGEST_THREADS );
+    ~PlotDigest();
+
+    // Hashes the whole segments within the first readySize bytes of the current region.
+    // The region's buffer must be the same until the region is ended.
+    // Segments are only hashed once there are enough of them to keep all threads busy.
+    void Update( const byte* region, size_t readySize );
+
+    // Hashes the rest of the region, zero-padded to paddedSize, and outputs its digest.
+    // The next region begins once this returns.
+    void EndRegion( const byte* region, size_t size, size_t paddedSize, byte digest[32] );
+
+    // Outputs the digest of the whole plot, from the digests of its regions: the header, then the tables.
+    static void PlotHash( const byte regionDigests[BB_DIGEST_REGION_COUNT][32], byte digest[32] );
+
+    // Writes the text digest file of a plot:
+    //  bladebit-digest 1
+    //  segment-size <bytes>
+    //  plot <hex digest>
+    //  <region name> <file offset> <padded size> <hex digest>   (one line per region)
+    static bool WriteDigestFile( const char* path, const uint64 offsets[BB_DIGEST_REGION_COUNT],
+                                 const uint64 sizes[BB_DIGEST_REGION_COUNT],
+                                 const byte regionDigests[BB_DIGEST_REGION_COUNT][32] );
+
+    // Reads a plot back, and checks it against its digest file, region by region.
+    // Logs the regions that don't match. Returns true if they all do.
+    bool VerifyFile( const char* plotPath, const char* digestPath );
+
+private:
+    // Hashes segmentCount whole segments, which are the next segments of the region
+    void HashSegments( const byte* segments, uint64 segmentCount );
+
+    // Hashes a single segment of dataSize bytes, followed by zeroes up to segmentSize
+    void HashPaddedSegment( const byte* data, size_t dataSize, size_t segmentSize );
+
+private:
+    ThreadPool     _pool;
+    blake3_hasher  _regionHasher;                   // Hashes the region's segment digests
+    uint64         _segmentsHashed  = 0;            // Segments of the current region already hashed
+    byte*          _segmentDigests  = nullptr;      // Digests of the segments being hashed in parallel
+};
@@ -0,0 +1,87 @@
+#pragma once
+#include "Platform.h"
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class Thread;
+
+struct PlotJob
+{
+    uint32      id;
+    int32       priority;           // Jobs of higher priority are plotted first
+    uint32      plotCount;
+    std::string farmerKey;          // Empty to use the daemon's keys
+    std::string poolKey;
+    std::string contractAddress;
+    std::string outputDir;          // Empty to let the plotter pick one of its output directories
+};
+
+// Checks a submitted job's keys. Returns false with a reason if the job can't be plotted.
+typedef std::function<bool( const PlotJob& job, std::string& error )> PlotJobValidator;
+
+/**
+ * Queues plot jobs submitted to a plot daemon over a Unix socket.
+ *
+ * Each connection sends one command line and gets a text reply, so any tool that
+ * can write to a Unix socket can drive the daemon. For example, with socat:
+ *
+ *   echo "plot farmer=<key> contract=<address> dir=/mnt/hdd1 count=4 priority=1" | socat - UNIX-CONNECT:<path>
+ *
+ * Commands:
+ *   plot [farmer=<key>] [pool=<key> | contract=<address>] [dir=<path>] [count=<n>] [priority=<p>]
+ *              Queues a job. Replies 'queued <id>'. Keys not given are the daemon's own.
+ *   status     Replies with the running job, then each queued job, in the order they will run.
+ *   cancel <id>
+ *              Removes a queued job. The running job is not interrupted.
+ *   stop       The daemon exits once its current plot is finished. Queued jobs are dropped.
+ *
+ * Errors are replied as 'error <reason>'.
+ * Commands are served one at a time by a single background thread.
+ */
+class PlotJobServer
+{
+public:
+    PlotJobServer( const PlotJobValidator& validator );
+    ~PlotJobServer();
+
+    // Listens on a Unix socket at the given path
+    bool Start( const char* socketPath );
+
+    // Waits for the next job, by priority, then by submission order, and removes it from the queue.
+    // Returns false once the daemon has been asked to stop.
+    bool NextJob( PlotJob& job );
+
+    // Whether any job is waiting to be plotted
+    bool HasQueuedJobs();
+
+    // Whether the daemon has been asked to stop
+    bool StopRequested();
+
+    // Sets the progress of the running job, as reported by status
+    void SetProgress( const PlotJob* job, uint32 plotsDone );
+
+private:
+    void Serve();
+    std::string RunCommand( const char* line );
+
+private:
+    PlotJobValidator        _validator;
+    Thread*                 _thread   = nullptr;
+    int                     _listener = -1;
+    std::string             _socketPath;            // Removed when the server stops
+    std::atomic<bool>       _stop     = false;
+
+    std::mutex              _lock;                  // Guards the queue, the progress and the stop request
+    std::condition_variable _queueSignal;
+    std::vector<PlotJob>    _queue;
+    uint32                  _nextJobId  = 1;
+    bool                    _stopRequested = false;
+
+    PlotJob                 _runningJob;
+    bool                    _running    = false;
+    uint32                  _plotsDone  = 0;
+};
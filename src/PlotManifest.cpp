@@ -0,0 +1,125 @@
+#include "PlotManifest.h"
+#include "util/Log.h"
+#include "io/NetSink.h"
+#include <cstdio>
+#include <cstring>
+
+// Longest line of a manifest. Keys and addresses are about 100 characters each.
+#define BB_MANIFEST_MAX_LINE 4096
+
+//-----------------------------------------------------------
+bool ReadPlotManifest( const char* path, std::vector<PlotManifestEntry>& entries )
+{
+    FILE* file = fopen( path, "r" );
+    if( !file )
+    {
+        Log::Error( "Error: Failed to open plot manifest '%s'.", path );
+        return false;
+    }
+
+    char   line[BB_MANIFEST_MAX_LINE];
+    uint32 lineNumber = 0;
+    bool   ok         = true;
+
+    auto fail = [&]( const std::string& reason ) {
+
+        Log::Error( "Error: %s:%u: %s.", path, lineNumber, reason.c_str() );
+        ok = false;
+    };
+
+    while( ok && fgets( line, sizeof( line ), file ) )
+    {
+        lineNumber++;
+
+        const size_t length = strlen( line );
+        if( length == sizeof( line ) - 1 && line[length-1] != '\n' && !feof( file ) )
+        {
+            fail( "Line too long" );
+            break;
+        }
+
+        PlotManifestEntry entry;
+        entry.line = lineNumber;
+
+        // Split the line in whitespace-separated <name>=<value> fields
+        const char* c = line;
+        bool        empty = true;
+
+        for( ;; )
+        {
+            while( *c == ' ' || *c == '\t' || *c == '\r' || *c == '\n' )
+                c++;
+
+            if( !*c || ( *c == '#' && empty ) )
+                break;
+
+            const char* start = c;
+            while( *c && *c != ' ' && *c != '\t' && *c != '\r' && *c != '\n' )
+                c++;
+
+            const std::string field( start, c );
+            const size_t      sep = field.find( '=' );
+            empty = false;
+
+            if( sep == std::string::npos )
+            {
+                fail( "Expected <name>=<value>, got '" + field + "'" );
+                break;
+            }
+
+            const std::string name  = field.substr( 0, sep );
+            const std::string value = field.substr( sep + 1 );
+
+            if( name == "farmer" )
+                entry.farmerKey = value;
+            else if( name == "pool" )
+                entry.poolKey = value;
+            else if( name == "contract" )
+                entry.contractAddress = value;
+            else if( name == "dir" )
+            {
+            #if !PLATFORM_IS_UNIX
+                if( strncmp( value.c_str(), BB_NET_PATH_PREFIX, BB_NET_PATH_PREFIX_LEN ) == 0 )
+                {
+                    fail( "Streaming plots to a plot receiver is not supported on this platform" );
+                    break;
+                }
+            #endif
+                entry.outputDir = value;
+            }
+            else if( name == "id" )
+                entry.plotId = value;
+            else if( name == "memo" )
+                entry.memo = value;
+            else
+            {
+                fail( "Unknown field '" + name + "'" );
+                break;
+            }
+        }
+
+        if( ok && !empty )
+        {
+            if( !entry.poolKey.empty() && !entry.contractAddress.empty() )
+                fail( "Expected either a pool key or a pool contract address, got both" );
+            else
+                entries.push_back( std::move( entry ) );
+        }
+    }
+
+    if( ok && ferror( file ) )
+    {
+        Log::Error( "Error: Failed to read plot manifest '%s'.", path );
+        ok = false;
+    }
+
+    fclose( file );
+
+    if( ok && entries.empty() )
+    {
+        Log::Error( "Error: Plot manifest '%s' has no plots.", path );
+        ok = false;
+    }
+
+    return ok;
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include "Platform.h"
+#include <string>
+#include <vector>
+
+// One plot of a manifest
+struct PlotManifestEntry
+{
+    uint32      line;               // Line of the manifest the plot is on, for errors
+    std::string farmerKey;          // Empty to use the command line's keys
+    std::string poolKey;
+    std::string contractAddress;
+    std::string outputDir;          // Empty to let the plotter pick one of its output directories
+    std::string plotId;             // Hex. Empty to derive it from the keys.
+    std::string memo;               // Hex. Empty to derive it from the keys.
+};
+
+/**
+ * Reads a batch of plots, one per line, each with its own keys and destination,
+ * so that mixed batches can be plotted by a single process, on the same buffers:
+ *
+ *   [farmer=<key>] [pool=<key> | contract=<address>] [dir=<path>] [id=<hex>] [memo=<hex>]
+ *
+ * Keys not given are the ones of the command line. Empty lines, and lines
+ * starting with '#', are skipped. Values can't contain whitespace.
+ *
+ * The entries are only parsed here, their keys are checked by the caller.
+ * Fails on the first malformed line, after logging it.
+ */
+bool ReadPlotManifest( const char* path, std::vector<PlotManifestEntry>& entries );
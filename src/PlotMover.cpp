@@ -0,0 +1,435 @@
+#include "PlotMover.h"
+#include "PlotDigest.h"
+#include "io/FileStream.h"
+#include "SysHost.h"
+#include "Util.h"
+#include "util/Log.h"
+#include "b3/blake3.h"
+
+// Room left on a destination after a plot is moved to it
+#define BB_MOVE_FREE_SPACE_MARGIN   ( 64ull * 1024 * 1024 )
+
+static std::string GetFileName( const std::string& path );
+static std::string JoinPath( const char* dir, const std::string& name );
+static bool        CopySmallFile( const char* srcPath, const char* dstPath );
+
+//-----------------------------------------------------------
+PlotMover::PlotMover( const char** destDirs, uint destCount, uint64 bandwidthLimit )
+    : _bandwidthLimit( bandwidthLimit )
+    , _nextCopyTime  ( std::chrono::steady_clock::now() )
+    , _queueSignal   ( 0 )
+    , _doneSignal    ( 0 )
+{
+    ASSERT( destDirs  );
+    ASSERT( destCount );
+
+    _moverCount = destCount;
+    _movers     = new Mover[destCount];
+
+    _activeMovers.store( destCount, std::memory_order_release );
+
+    for( uint i = 0; i < destCount; i++ )
+    {
+        Mover& mover = _movers[i];
+        mover.owner = this;
+        mover.dir   = destDirs[i];
+
+        for( uint j = 0; j < 2; j++ )
+        {
+            mover.buffers[j] = (byte*)SysHost::VirtualAlloc( BB_MOVE_CHUNK_SIZE );
+
+            if( !mover.buffers[j] )
+                Fatal( "Failed to allocate plot mover buffers." );
+
+            SysHost::NumaAssignIoPages( mover.buffers[j], BB_MOVE_CHUNK_SIZE );
+        }
+
+        mover.thread.Run( MoverMain, &mover );
+    }
+}
+
+//-----------------------------------------------------------
+PlotMover::~PlotMover()
+{
+    WaitForMoves();
+
+    _terminate.store( true, std::memory_order_release );
+
+    for( uint i = 0; i < _moverCount; i++ )
+        _queueSignal.Release();
+
+    for( uint i = 0; i < _moverCount; i++ )
+    {
+        _movers[i].thread.WaitForExit();
+
+        SysHost::VirtualFree( _movers[i].buffers[0] );
+        SysHost::VirtualFree( _movers[i].buffers[1] );
+    }
+
+    delete[] _movers;
+}
+
+//-----------------------------------------------------------
+void PlotMover::Enqueue( const char* plotPath )
+{
+    ASSERT( plotPath );
+
+    {
+        std::lock_guard<std::mutex> lock( _lock );
+        _queue.push_back( plotPath );
+    }
+
+    _pending++;
+    _queueSignal.Release();
+}
+
+//-----------------------------------------------------------
+void PlotMover::WaitForMoves()
+{
+    if( _pending.load( std::memory_order_acquire ) && _activeMovers.load( std::memory_order_acquire ) )
+        Log::Line( "Waiting for %u plot(s) to be moved...", _pending.load( std::memory_order_relaxed ) );
+
+    while( _pending.load( std::memory_order_acquire ) && _activeMovers.load( std::memory_order_acquire ) )
+        _doneSignal.Wait();
+
+    const uint stranded = _pending.load( std::memory_order_acquire );
+
+    if( stranded )
+        Log::Error( "Warning: %u plot(s) could not be moved, as all destinations are full.", stranded );
+}
+
+//-----------------------------------------------------------
+void PlotMover::MoverMain( void* data )
+{
+    ASSERT( data );
+    Mover& mover = *(Mover*)data;
+
+    SysHost::SetCurrentThreadIoAffinity();
+    SysHost::SetCurrentThreadQoS( ThreadQoS::IO );
+    mover.owner->MoverThread( mover );
+}
+
+//-----------------------------------------------------------
+void PlotMover::MoverThread( Mover& mover )
+{
+    std::string srcPath;
+
+    while( TakePlot( srcPath ) )
+    {
+        // Make sure the plot fits, or let another destination take it
+        const uint64 freeSpace = SysHost::GetFreeDiskSpace( mover.dir );
+
+        FileStream src;
+        const int64 plotSize = src.Open( srcPath.c_str(), FileMode::Open, FileAccess::Read ) ? src.Size() : -1;
+        src.Close();
+
+        if( plotSize < 0 )
+        {
+            Log::Error( "Error: Failed to open plot %s for moving.", srcPath.c_str() );
+            FinishPlot();
+            continue;
+        }
+
+        if( (uint64)plotSize + BB_MOVE_FREE_SPACE_MARGIN > freeSpace )
+        {
+            Log::Line( "Plot destination %s is full.", mover.dir );
+
+            {
+                std::lock_guard<std::mutex> lock( _lock );
+                _queue.push_front( srcPath );
+            }
+
+            _queueSignal.Release();
+            break;
+        }
+
+        MovePlot( mover, srcPath, (uint64)plotSize );
+        FinishPlot();
+    }
+
+    _activeMovers--;
+    _doneSignal.Release();
+}
+
+//-----------------------------------------------------------
+bool PlotMover::TakePlot( std::string& outPath )
+{
+    _queueSignal.Wait();
+
+    if( _terminate.load( std::memory_order_acquire ) )
+        return false;
+
+    std::lock_guard<std::mutex> lock( _lock );
+
+    ASSERT( !_queue.empty() );
+    outPath = _queue.front();
+    _queue.pop_front();
+
+    return true;
+}
+
+//-----------------------------------------------------------
+void PlotMover::FinishPlot()
+{
+    _pending--;
+    _doneSignal.Release();
+}
+
+//-----------------------------------------------------------
+bool PlotMover::MovePlot( Mover& mover, const std::string& srcPath, uint64 size )
+{
+    const std::string name     = GetFileName( srcPath );
+    const std::string dstPath  = JoinPath( mover.dir, name );
+    const std::string tmpPath  = dstPath + ".tmp";
+
+    Log::Line( "Moving plot %s to %s.", srcPath.c_str(), mover.dir );
+    const auto timer = TimerBegin();
+
+    byte srcHash[32], dstHash[32];
+
+    if( !CopyPlot( mover, srcPath.c_str(), tmpPath.c_str(), size, srcHash ) )
+    {
+        remove( tmpPath.c_str() );
+        return false;
+    }
+
+    // Only trust what actually made it to the disk
+    if( !HashPlot( mover, tmpPath.c_str(), size, dstHash ) || memcmp( srcHash, dstHash, 32 ) != 0 )
+    {
+        Log::Error( "Error: Plot %s failed verification after being copied to %s. Keeping the source plot.",
+            srcPath.c_str(), mover.dir );
+
+        remove( tmpPath.c_str() );
+        return false;
+    }
+
+    if( rename( tmpPath.c_str(), dstPath.c_str() ) != 0 )
+    {
+        Log::Error( "Error: Failed to rename moved plot %s. Keeping the source plot.", tmpPath.c_str() );
+        remove( tmpPath.c_str() );
+        return false;
+    }
+
+    // Bring the plot's digest along, if it has one
+    const std::string srcDigest = srcPath + BB_DIGEST_FILE_EXT;
+
+    if( FileStream::Exists( srcDigest.c_str() ) )
+    {
+        const std::string dstDigest = dstPath + BB_DIGEST_FILE_EXT;
+
+        if( CopySmallFile( srcDigest.c_str(), dstDigest.c_str() ) )
+            remove( srcDigest.c_str() );
+        else
+            Log::Error( "Warning: Failed to move plot digest %s.", srcDigest.c_str() );
+    }
+
+    if( remove( srcPath.c_str() ) != 0 )
+        Log::Error( "Warning: Failed to delete plot %s after moving it.", srcPath.c_str() );
+
+    const double elapsed = TimerEnd( timer );
+    Log::Line( "Moved plot %s to %s in %.2lf seconds (%.2lf MiB/s).", name.c_str(), mover.dir,
+        elapsed, (double)size / ( 1024.0 * 1024.0 ) / std::max( elapsed, 0.001 ) );
+
+    return true;
+}
+
+//-----------------------------------------------------------
+bool PlotMover::CopyPlot( Mover& mover, const char* srcPath, const char* dstPath, uint64 srcSize, byte hash[32] )
+{
+    FileStream src, dst;
+
+    if( !src.Open( srcPath, FileMode::Open, FileAccess::Read, FileFlags::NoBuffering | FileFlags::LargeFile ) )
+    {
+        Log::Error( "Error: Failed to open plot %s for moving with error %d.", srcPath, src.GetError() );
+        return false;
+    }
+
+    if( !dst.Open( dstPath, FileMode::Create, FileAccess::Write,
+                   FileFlags::NoBuffering | FileFlags::LargeFile | FileFlags::AsyncIO ) )
+    {
+        Log::Error( "Error: Failed to create plot %s with error %d.", dstPath, dst.GetError() );
+        return false;
+    }
+
+    const size_t dstBlockSize = dst.BlockSize();
+    ASSERT( BB_MOVE_CHUNK_SIZE % dstBlockSize == 0 );
+
+    // Lay the plot out contiguously on the destination.
+    // Not fatal if unsupported, the file just grows as it's written.
+    if( !dst.Reserve( (ssize_t)RoundUpToNextBoundary( srcSize, (int)dstBlockSize ) ) )
+        dst.GetError();
+
+    blake3_hasher hasher;
+    blake3_hasher_init( &hasher );
+
+    // While a chunk is being written, the next one is read into the other buffer
+    uint   bufferIndex = 0;
+    uint64 copied      = 0;
+
+    while( copied < srcSize )
+    {
+        byte*        buffer    = mover.buffers[bufferIndex];
+        const size_t chunkSize = (size_t)std::min( srcSize - copied, (uint64)BB_MOVE_CHUNK_SIZE );
+
+        Throttle( chunkSize );
+
+        size_t sizeRead = 0;
+
+        while( sizeRead < chunkSize )
+        {
+            const ssize_t r = src.Read( buffer + sizeRead, BB_MOVE_CHUNK_SIZE - sizeRead );
+
+            if( r < 1 )
+            {
+                Log::Error( "Error: Failed to read plot %s with error %d.", srcPath, src.GetError() );
+                return false;
+            }
+
+            sizeRead += (size_t)r;
+        }
+
+        blake3_hasher_update( &hasher, buffer, chunkSize );
+
+        // The other buffer must be written before we read into it
+        if( !dst.WaitForWrites() )
+        {
+            Log::Error( "Error: Failed to write plot %s with error %d.", dstPath, dst.GetError() );
+            return false;
+        }
+
+        // The last chunk is padded to the block size, and the file is truncated to the plot's size after
+        const size_t writeSize = RoundUpToNextBoundary( chunkSize, (int)dstBlockSize );
+
+        if( writeSize > chunkSize )
+            memset( buffer + chunkSize, 0, writeSize - chunkSize );
+
+        if( !dst.WriteAsync( buffer, writeSize ) )
+        {
+            Log::Error( "Error: Failed to write plot %s with error %d.", dstPath, dst.GetError() );
+            return false;
+        }
+
+        copied      += chunkSize;
+        bufferIndex ^= 1;
+    }
+
+    blake3_hasher_finalize( &hasher, hash, 32 );
+
+    // (A stale file we overwrote may also have been larger.)
+    const bool written = dst.WaitForWrites() && dst.Truncate( (int64)srcSize ) && dst.Flush();
+    if( !written )
+    {
+        Log::Error( "Error: Failed to write plot %s with error %d.", dstPath, dst.GetError() );
+        return false;
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------
+bool PlotMover::HashPlot( Mover& mover, const char* path, uint64 size, byte hash[32] )
+{
+    // Unbuffered, so that we read what's on the disk, not what's cached
+    FileStream file;
+    if( !file.Open( path, FileMode::Open, FileAccess::Read, FileFlags::NoBuffering | FileFlags::LargeFile ) )
+        return false;
+
+    if( file.Size() != (int64)size )
+        return false;
+
+    blake3_hasher hasher;
+    blake3_hasher_init( &hasher );
+
+    byte*  buffer = mover.buffers[0];
+    uint64 read   = 0;
+
+    while( read < size )
+    {
+        const size_t  chunkSize = (size_t)std::min( size - read, (uint64)BB_MOVE_CHUNK_SIZE );
+        const ssize_t r         = file.Read( buffer, BB_MOVE_CHUNK_SIZE );
+
+        if( r < (ssize_t)chunkSize )
+            return false;
+
+        blake3_hasher_update( &hasher, buffer, chunkSize );
+        read += chunkSize;
+    }
+
+    blake3_hasher_finalize( &hasher, hash, 32 );
+    return true;
+}
+
+//-----------------------------------------------------------
+void PlotMover::Throttle( size_t size )
+{
+    if( !_bandwidthLimit )
+        return;
+
+    using namespace std::chrono;
+
+    const auto chunkTime = nanoseconds( (int64)( (double)size / (double)_bandwidthLimit * 1e9 ) );
+
+    steady_clock::time_point copyTime;
+    {
+        // Each chunk gets the next slot of the shared budget, in turn
+        std::lock_guard<std::mutex> lock( _lock );
+
+        const auto now = steady_clock::now();
+        copyTime       = std::max( now, _nextCopyTime );
+        _nextCopyTime  = copyTime + chunkTime;
+    }
+
+    const auto wait = duration_cast<milliseconds>( copyTime - steady_clock::now() ).count();
+
+    if( wait > 0 )
+        Thread::Sleep( (long)wait );
+}
+
+//-----------------------------------------------------------
+std::string GetFileName( const std::string& path )
+{
+    const size_t sep = path.find_last_of( "/\\" );
+    return sep == std::string::npos ? path : path.substr( sep + 1 );
+}
+
+//-----------------------------------------------------------
+std::string JoinPath( const char* dir, const std::string& name )
+{
+    std::string path = dir;
+
+    if( !path.empty() && path.back() != '/' && path.back() != '\\' )
+        path += '/';
+
+    return path + name;
+}
+
+//-----------------------------------------------------------
+bool CopySmallFile( const char* srcPath, const char* dstPath )
+{
+    FileStream src, dst;
+
+    if( !src.Open( srcPath, FileMode::Open, FileAccess::Read ) ||
+        !dst.Open( dstPath, FileMode::Create, FileAccess::Write ) )
+        return false;
+
+    byte   buffer[4096];
+    size_t size = 0;
+
+    for( ;; )
+    {
+        const ssize_t r = src.Read( buffer, sizeof( buffer ) );
+
+        if( r < 0 )
+            return false;
+
+        if( r == 0 )
+            break;
+
+        if( dst.Write( buffer, (size_t)r ) != r )
+            return false;
+
+        size += (size_t)r;
+    }
+
+    return dst.Truncate( (int64)size ) && dst.Flush();
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include "threading/Thread.h"
+#include "threading/Semaphore.h"
+#include <atomic>
+#include <mutex>
+#include <deque>
+#include <string>
+#include <chrono>
+
+#define BB_MAX_MOVE_DIRS        64
+
+// Size of each read from the source and write to the destination.
+// Two of these are in flight per destination, one being read while the other is written.
+#define BB_MOVE_CHUNK_SIZE      ( 8ull * 1024 * 1024 )
+
+/**
+ * Moves finished plots from the output directories to their final destinations,
+ * ie. from fast scratch drives to a farm of HDDs, in the background.
+ *
+ * Each destination has its own mover thread, and each queued plot is taken
+ * by the first idle mover whose destination has room for it, so that
+ * several destinations are written concurrently.
+ *
+ * Plots are copied with unbuffered I/O, in large aligned chunks, and hashed while
+ * they are copied. The copy is then read back and its hash compared, before it
+ * gets its final name and the source plot is deleted. A failed move leaves
+ * the source plot where it is.
+ *
+ * An optional bandwidth cap, shared by all movers, throttles the copies,
+ * so that the plotter's own writes are not starved.
+ */
+class PlotMover
+{
+public:
+    // bandwidthLimit is in bytes per second. 0 means unlimited.
+    PlotMover( const char** destDirs, uint destCount, uint64 bandwidthLimit );
+
+    // Waits for all queued plots to be moved.
+    ~PlotMover();
+
+    // Queues a finished plot to be moved.
+    void Enqueue( const char* plotPath );
+
+    // Waits until all queued plots have been moved, or can't be moved.
+    void WaitForMoves();
+
+    // Plots queued or being moved.
+    inline uint Pending() const { return _pending.load( std::memory_order_acquire ); }
+
+private:
+    struct Mover
+    {
+        PlotMover*  owner;
+        const char* dir;
+        Thread      thread;
+        byte*       buffers[2];
+    };
+
+    static void MoverMain( void* data );
+    void MoverThread( Mover& mover );
+
+    // Takes the next queued plot. Returns false if the mover should exit.
+    bool TakePlot( std::string& outPath );
+
+    bool MovePlot( Mover& mover, const std::string& srcPath, uint64 size );
+
+    // Copies the file, while hashing what was read
+    bool CopyPlot( Mover& mover, const char* srcPath, const char* dstPath, uint64 srcSize, byte hash[32] );
+
+    // Hashes a file by reading it back
+    bool HashPlot( Mover& mover, const char* path, uint64 size, byte hash[32] );
+
+    // Blocks until size bytes can be copied within the bandwidth cap
+    void Throttle( size_t size );
+
+    void FinishPlot();
+
+private:
+    Mover*                  _movers          = nullptr;
+    uint                    _moverCount      = 0;
+    uint64                  _bandwidthLimit  = 0;
+
+    std::mutex              _lock;                      // Guards the queue and the throttle
+    std::deque<std::string> _queue;
+    std::chrono::steady_clock::time_point _nextCopyTime;    // When the next throttled chunk may be copied
+
+    Semaphore               _queueSignal;               // Released once per plot queued, and to wake the movers to exit
+    Semaphore               _doneSignal;                // Released whenever a plot is done, or a mover exits
+    std::atomic<uint>       _pending         = 0;
+    std::atomic<uint>       _activeMovers    = 0;       // Movers whose destination still has room
+    std::atomic<bool>       _terminate       = false;
+};
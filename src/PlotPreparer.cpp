@@ -0,0 +1,257 @@
+#include "PlotPreparer.h"
+#include "io/NetSink.h"
+#include "SysHost.h"
+#include "Util.h"
+#include "util/Log.h"
+
+// Room left on a directory after a plot is written to it
+#define BB_PREPARE_FREE_SPACE_MARGIN ( 64ull * 1024 * 1024 )
+
+using Clock = std::chrono::steady_clock;
+
+static std::string JoinPath( const char* dir, const std::string& name );
+
+//-----------------------------------------------------------
+PlotPreparer::PlotPreparer( const char** dirs, uint dirCount, FileFlags flags )
+    : _dirs     ( dirs     )
+    , _dirCount ( dirCount )
+    , _flags    ( flags    )
+    , _pool     ( 1, ThreadPool::Mode::Stealing, true )
+{
+    ASSERT( dirs );
+    ASSERT( dirCount && dirCount <= BB_MAX_PREPARE_DIRS );
+
+    for( uint i = 0; i < BB_MAX_PREPARE_DIRS; i++ )
+        _slowUntil[i] = Clock::time_point();
+}
+
+//-----------------------------------------------------------
+PlotPreparer::~PlotPreparer()
+{
+    if( _task.IsValid() )
+        _pool.Wait( _task );
+
+    if( _state == State::Ready )
+        Discard( _file, _path );
+}
+
+//-----------------------------------------------------------
+void PlotPreparer::Prepare( const char* fileName, uint64 plotSize, uint avoidDir )
+{
+    ASSERT( fileName );
+
+    {
+        std::lock_guard<std::mutex> lock( _lock );
+
+        // An abandoned file is still being prepared, so this plot's is opened when it starts
+        if( _state == State::Preparing )
+            return;
+
+        if( _state == State::Ready )
+            Discard( _file, _path );
+
+        _state     = State::Preparing;
+        _abandoned = false;
+        _fileName  = fileName;
+        _plotSize  = plotSize;
+        _avoidDir  = avoidDir;
+        _file      = nullptr;
+    }
+
+    _task = _pool.Submit( PrepareTask, this );
+}
+
+//-----------------------------------------------------------
+FileStream* PlotPreparer::Take( const char* fileName, uint& outDir, std::string& outPath )
+{
+    ASSERT( fileName );
+    std::lock_guard<std::mutex> lock( _lock );
+
+    if( _state == State::Idle || _fileName != fileName )
+        return nullptr;
+
+    if( _state == State::Preparing )
+    {
+        Log::Line( "The file of plot %s was not ready in time. Opening it elsewhere.", fileName );
+        _abandoned = true;
+        return nullptr;
+    }
+
+    const State state = _state;
+    _state = State::Idle;
+
+    if( state == State::Failed )
+        return nullptr;
+
+    outDir  = _dir;
+    outPath = _path;
+    return _file;
+}
+
+//-----------------------------------------------------------
+void PlotPreparer::MarkSlow( uint dir )
+{
+    ASSERT( dir < _dirCount );
+    std::lock_guard<std::mutex> lock( _lock );
+
+    Log::Line( "Output directory %s is slow. Avoiding it for %u minutes.", _dirs[dir], BB_PREPARE_SLOW_HOLD_MS / 60000 );
+    _slowUntil[dir] = Clock::now() + std::chrono::milliseconds( BB_PREPARE_SLOW_HOLD_MS );
+}
+
+//-----------------------------------------------------------
+bool PlotPreparer::IsSlow( uint dir )
+{
+    if( dir >= _dirCount )
+        return false;
+
+    std::lock_guard<std::mutex> lock( _lock );
+    return Clock::now() < _slowUntil[dir];
+}
+
+//-----------------------------------------------------------
+void PlotPreparer::PrepareTask( PlotPreparer* self )
+{
+    ASSERT( self );
+
+    SysHost::SetCurrentThreadIoAffinity();
+    SysHost::SetCurrentThreadQoS( ThreadQoS::IO );
+    self->PrepareNext();
+}
+
+//-----------------------------------------------------------
+void PlotPreparer::PrepareNext()
+{
+    std::string fileName;
+    uint64      plotSize;
+    uint        avoidDir;
+
+    {
+        std::lock_guard<std::mutex> lock( _lock );
+        fileName = _fileName;
+        plotSize = _plotSize;
+        avoidDir = _avoidDir;
+    }
+
+    const auto  timeStart = Clock::now();
+    uint        dir       = 0;
+    std::string path;
+
+    FileStream* file = PrepareFile( fileName, plotSize, avoidDir, dir, path );
+
+    const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>( Clock::now() - timeStart ).count();
+
+    bool abandoned;
+    {
+        std::lock_guard<std::mutex> lock( _lock );
+        abandoned = _abandoned;
+
+        if( abandoned || !file )
+            _state = abandoned ? State::Idle : State::Failed;
+        else
+        {
+            _state = State::Ready;
+            _file  = file;
+            _path  = path;
+            _dir   = dir;
+        }
+    }
+
+    if( file && ( abandoned || elapsed > BB_PREPARE_SLOW_MS ) )
+        MarkSlow( dir );
+
+    if( file && abandoned )
+        Discard( file, path );
+}
+
+//-----------------------------------------------------------
+FileStream* PlotPreparer::PrepareFile( const std::string& fileName, uint64 plotSize, uint avoidDir, uint& outDir, std::string& outPath )
+{
+    // Each directory is tried at most once, from the one with the most free space.
+    // Slow ones and the one being written to go last.
+    bool tried[BB_MAX_PREPARE_DIRS] = {};
+
+    for( ;; )
+    {
+        int    selected     = -1;
+        bool   selectedLast = false;
+        uint64 selectedFree = 0;
+
+        for( uint i = 1; i <= _dirCount; i++ )
+        {
+            const uint dir = ( avoidDir + i ) % _dirCount;
+
+            if( tried[dir] || strncmp( _dirs[dir], BB_NET_PATH_PREFIX, BB_NET_PATH_PREFIX_LEN ) == 0 )
+                continue;
+
+            const uint64 free = SysHost::GetFreeDiskSpace( _dirs[dir] );
+            const bool   last = dir == avoidDir || IsSlow( dir );
+
+            if( free < plotSize + BB_PREPARE_FREE_SPACE_MARGIN )
+            {
+                tried[dir] = true;
+                continue;
+            }
+
+            if( selected < 0 || ( !last && selectedLast ) || ( last == selectedLast && free > selectedFree ) )
+            {
+                selected     = (int)dir;
+                selectedLast = last;
+                selectedFree = free;
+            }
+        }
+
+        if( selected < 0 )
+        {
+            Log::Error( "Warning: No output directory has room for plot %s.", fileName.c_str() );
+            return nullptr;
+        }
+
+        const uint  dir  = (uint)selected;
+        std::string path = JoinPath( _dirs[dir], fileName );
+
+        tried[dir] = true;
+
+        FileStream* file = new FileStream();
+
+        if( !file->Open( path.c_str(), FileMode::Create, FileAccess::Write, _flags ) )
+        {
+            Log::Error( "Warning: Failed to create plot file %s with error %d.", path.c_str(), file->GetError() );
+            delete file;
+            continue;
+        }
+
+        // Platforms that can't preallocate fail without an error, and keep the file as it is.
+        // Otherwise the directory filled up since its free space was read.
+        if( !file->Reserve( (ssize_t)plotSize ) && file->GetError() )
+        {
+            Log::Error( "Warning: Failed to preallocate plot file %s with error %d.", path.c_str(), file->GetError() );
+            Discard( file, path );
+            continue;
+        }
+
+        outDir  = dir;
+        outPath = path;
+        return file;
+    }
+}
+
+//-----------------------------------------------------------
+void PlotPreparer::Discard( FileStream* file, const std::string& path )
+{
+    ASSERT( file );
+
+    file->Close();
+    delete file;
+    remove( path.c_str() );
+}
+
+//-----------------------------------------------------------
+std::string JoinPath( const char* dir, const std::string& name )
+{
+    std::string path = dir;
+
+    if( !path.empty() && path.back() != '/' && path.back() != '\\' )
+        path += '/';
+
+    return path + name;
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include "threading/ThreadPool.h"
+#include "io/FileStream.h"
+#include <mutex>
+#include <string>
+#include <chrono>
+
+#define BB_MAX_PREPARE_DIRS     64
+
+// A directory whose file took longer than this to be created and preallocated is slow
+#define BB_PREPARE_SLOW_MS      ( 10 * 1000 )
+
+// How long a slow directory is avoided for
+#define BB_PREPARE_SLOW_HOLD_MS ( 15 * 60 * 1000 )
+
+/**
+ * Prepares the file of the next plot in the background, while the current one is plotted.
+ *
+ * It picks the output directory with the most free space that has room for the plot,
+ * avoiding the one the current plot is written to, and those that were found to be slow.
+ * The plot's .tmp file is then created there and preallocated, so that the plotter
+ * takes a ready file when the plot starts, instead of opening one itself.
+ *
+ * A directory that has no room left is skipped for the next plot, and one that
+ * is slow to prepare a file is avoided for a while, as long as others have room.
+ * If the file is not ready when its plot starts, it's discarded and the plotter
+ * opens one itself on another directory, instead of waiting for it.
+ *
+ * Receivers are never prepared for, as their files are not ours.
+ *
+ * Each file is prepared by a task, on a single-threaded pool of the preparer's own.
+ */
+class PlotPreparer
+{
+public:
+    // dirs are indexed as the plotter's output directories. They must outlive the preparer.
+    PlotPreparer( const char** dirs, uint dirCount, FileFlags flags );
+
+    // Removes the prepared file if it was never taken.
+    ~PlotPreparer();
+
+    // Starts preparing the file of an upcoming plot, of about plotSize bytes,
+    // preferably not in avoidDir. A file prepared before and not taken is removed.
+    void Prepare( const char* fileName, uint64 plotSize, uint avoidDir );
+
+    // Takes the prepared file of the plot, and the directory it's in.
+    // Returns nullptr if it was not prepared, or could not be.
+    // If it's still being prepared, its directory is marked as slow, and the file is removed once it's ready.
+    FileStream* Take( const char* fileName, uint& outDir, std::string& outPath );
+
+    // Avoids the directory for a while, as long as others have room.
+    void MarkSlow( uint dir );
+
+    bool IsSlow( uint dir );
+
+private:
+    enum class State
+    {
+        Idle = 0,
+        Preparing,
+        Ready,
+        Failed
+    };
+
+    static void PrepareTask( PlotPreparer* self );
+    void PrepareNext();
+
+    // Creates and preallocates the file in the best directory that has room for it
+    FileStream* PrepareFile( const std::string& fileName, uint64 plotSize, uint avoidDir, uint& outDir, std::string& outPath );
+
+    static void Discard( FileStream* file, const std::string& path );
+
+private:
+    const char**            _dirs     = nullptr;
+    uint                    _dirCount = 0;
+    FileFlags               _flags    = FileFlags::None;
+    ThreadPool              _pool;
+    TaskHandle              _task;                      // Preparing the last file requested
+
+    std::mutex              _lock;                      // Guards the job and its result
+    State                   _state     = State::Idle;
+    bool                    _abandoned = false;         // The plot started before its file was ready
+    std::string             _fileName;
+    uint64                  _plotSize  = 0;
+    uint                    _avoidDir  = 0;
+    FileStream*             _file      = nullptr;       // Prepared file, once ready
+    std::string             _path;
+    uint                    _dir       = 0;
+    std::chrono::steady_clock::time_point _slowUntil[BB_MAX_PREPARE_DIRS];
+};
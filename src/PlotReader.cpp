@@ -0,0 +1,524 @@
+#include "PlotReader.h"
+#include "Util.h"
+#include "util/Log.h"
+
+#define FSE_STATIC_LINKING_ONLY
+#include "fse/fse.h"
+#include "memplot/FseTables.h"
+
+#include <algorithm>
+#include <vector>
+
+// Largest park of tables 1-6, which is table 1's, as its deltas are given the most room
+static constexpr size_t MAX_PARK_SIZE =
+    CDiv( (size_t)_K * 2, 8 ) +
+    CDiv( (size_t)( kEntriesPerPark - 1 ) * ( _K - kStubMinusBits ), 8 ) +
+    CDiv( (size_t)( ( kEntriesPerPark - 1 ) * kMaxAverageDeltaTable1 ), 8 );
+
+static constexpr size_t P7_PARK_SIZE = CDiv( (size_t)( _K + 1 ) * kEntriesPerPark, 8 );
+
+static void* CreateDTable( double R );
+
+// Reads bitCount bits at the given bit of a big-endian bitstream, from the 8 bytes the bits start in.
+// Up to 57 bits can be read, or 64 from the start of a byte.
+//-----------------------------------------------------------
+inline static uint64 ReadBits( const byte* src, const uint64 bit, const uint bitCount )
+{
+    uint64 field;
+    memcpy( &field, src + bit / 8, sizeof( field ) );
+
+    return ( Swap64( field ) << ( bit % 8 ) ) >> ( 64 - bitCount );
+}
+
+//-----------------------------------------------------------
+PlotReader::PlotReader()
+{}
+
+//-----------------------------------------------------------
+PlotReader::~PlotReader()
+{
+    _file.Close();
+
+    free( _c1 );
+    free( _c2 );
+
+    for( void* dTable : _dTables )
+        free( dTable );
+}
+
+//-----------------------------------------------------------
+bool PlotReader::Open( const char* path )
+{
+    ASSERT( !_file.IsOpen() );
+
+    if( !_file.Open( path, FileMode::Open, FileAccess::Read ) )
+    {
+        Log::Error( "Error: Failed to open plot '%s' with error %d.", path, _file.GetError() );
+        return false;
+    }
+
+    const int64 fileSize = _file.Size();
+
+    ///
+    /// Header
+    ///
+    byte header[1024];
+    const ssize_t headerSize = _file.ReadAt( header, sizeof( header ), 0 );
+
+    const size_t magicSize = sizeof( kPOSMagic ) - 1;
+
+    if( headerSize < (ssize_t)( magicSize + 32 + 1 + 2 ) || memcmp( header, kPOSMagic, magicSize ) != 0 )
+    {
+        Log::Error( "Error: '%s' is not a plot.", path );
+        return false;
+    }
+
+    const byte* reader = header + magicSize;
+
+    memcpy( _plotId, reader, 32 );
+    reader += 32;
+
+    const uint k = *reader++;
+    if( k != _K )
+    {
+        Log::Error( "Error: '%s' is a k%u plot, but this build only reads k%u plots.", path, k, (uint)_K );
+        return false;
+    }
+
+    // Plots that dropped x bits give their count in the format description. The memo is skipped.
+    for( uint i = 0; i < 2; i++ )
+    {
+        if( reader + 2 > header + headerSize )
+            break;
+
+        uint16 size;
+        memcpy( &size, reader, 2 );
+        size = Swap16( size );
+        reader += 2;
+
+        constexpr size_t prefixLength = sizeof( kDroppedXFormatPrefix ) - 1;
+
+        if( i == 0 && size > prefixLength && size < 16 && reader + size <= header + headerSize &&
+            memcmp( reader, kDroppedXFormatPrefix, prefixLength ) == 0 )
+        {
+            char bits[16] = {};
+            memcpy( bits, reader + prefixLength, size - prefixLength );
+
+            _droppedXBits = (uint)strtoul( bits, nullptr, 10 );
+
+            if( _droppedXBits < 1 || _droppedXBits > BB_MAX_DROPPED_X_BITS )
+            {
+                Log::Error( "Error: Plot '%s' is of an unknown format.", path );
+                return false;
+            }
+        }
+
+        reader += size;
+    }
+
+    if( reader + sizeof( _tablePointers ) > header + headerSize )
+    {
+        Log::Error( "Error: The header of plot '%s' is invalid.", path );
+        return false;
+    }
+
+    for( uint i = 0; i < (uint)PlotTable::_Count; i++ )
+    {
+        memcpy( &_tablePointers[i], reader, 8 );
+        _tablePointers[i] = Swap64( _tablePointers[i] );
+        reader += 8;
+
+        const uint64 prev = i > 0 ? _tablePointers[i-1] : (uint64)( reader - header );
+
+        if( _tablePointers[i] < prev || _tablePointers[i] > (uint64)fileSize )
+        {
+            Log::Error( "Error: The table pointers of plot '%s' are invalid.", path );
+            return false;
+        }
+    }
+
+    ///
+    /// C1 & C2
+    ///
+    // Their regions may have trailing padding, so the entries are read up to their end markers.
+    // C1 ends with a 0 entry, C2 with an entry of all 1 bits (see WriteC12Parallel()).
+    auto loadCTable = [&]( PlotTable table, uint32*& entries, uint64& count, bool isC2 ) {
+
+        const uint64 address = _tablePointers[(int)table];
+        const uint64 end     = (int)table + 1 < (int)PlotTable::_Count ? _tablePointers[(int)table + 1] : (uint64)fileSize;
+        const uint64 maxCount = ( end - address ) / sizeof( uint32 );
+
+        entries = (uint32*)malloc( std::max( maxCount, (uint64)1 ) * sizeof( uint32 ) );
+
+        if( !ReadAt( entries, maxCount * sizeof( uint32 ), address ) )
+            return false;
+
+        for( count = 0; count < maxCount; count++ )
+        {
+            const uint32 entry = entries[count];
+
+            if( isC2 ? entry == 0xFFFFFFFF : ( entry == 0 && count > 0 ) )
+                break;
+
+            entries[count] = Swap32( entry ) >> ( 32 - _K );
+        }
+
+        return true;
+    };
+
+    if( !loadCTable( PlotTable::C1, _c1, _c1Count, false ) ||
+        !loadCTable( PlotTable::C2, _c2, _c2Count, true  ) )
+    {
+        Log::Error( "Error: Failed to read the checkpoint tables of plot '%s'.", path );
+        return false;
+    }
+
+    if( _c1Count == 0 )
+    {
+        Log::Error( "Error: Plot '%s' has no entries.", path );
+        return false;
+    }
+
+    ///
+    /// Decoding tables
+    ///
+    for( uint i = 0; i < 6; i++ )
+        _dTables[i] = CreateDTable( i == 0 && _droppedXBits ? kDroppedXR : kRValues[i] );
+
+    _dTables[6] = CreateDTable( kC3R );
+
+    return true;
+}
+
+//-----------------------------------------------------------
+bool PlotReader::ReadAt( void* buffer, size_t size, uint64 address ) const
+{
+    byte* dst = (byte*)buffer;
+
+    while( size )
+    {
+        const ssize_t sizeRead = _file.ReadAt( dst, size, (int64)address );
+        if( sizeRead <= 0 )
+            return false;
+
+        dst     += sizeRead;
+        address += (uint64)sizeRead;
+        size    -= (size_t)sizeRead;
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------
+int PlotReader::GetP7Positions( const uint64 f7, uint64* positions, const int maxPositions ) const
+{
+    // Narrow down the C1 entries to search with C2, which has a C1 entry every kCheckpoint2Interval
+    uint64 c1Start = 0;
+    uint64 c1End   = _c1Count;
+
+    {
+        const uint64 c2Index = (uint64)( std::lower_bound( _c2, _c2 + _c2Count, (uint32)f7 ) - _c2 );
+
+        if( c2Index > 0 )
+            c1Start = ( c2Index - 1 ) * kCheckpoint2Interval;
+
+        if( c2Index < _c2Count )
+            c1End = std::min( c1End, ( c2Index + 1 ) * kCheckpoint2Interval );
+    }
+
+    // Entries of the f7 may start in the last C3 park whose C1 entry is less than it,
+    // and span the following parks whose C1 entry is equal to it.
+    uint64 park = (uint64)( std::lower_bound( _c1 + c1Start, _c1 + c1End, (uint32)f7 ) - _c1 );
+    if( park > 0 )
+        park--;
+
+    int count = 0;
+
+    for( ; park < _c1Count && _c1[park] <= f7; park++ )
+    {
+        uint64 curF7    = _c1[park];
+        uint64 position = park * kCheckpoint1Interval;
+
+        if( curF7 == f7 && count < maxPositions )
+            positions[count++] = position;
+
+        byte deltas[kCheckpoint1Interval];
+
+        const int deltaCount = ReadC3Park( park, deltas );
+        if( deltaCount < 0 )
+            return -1;
+
+        for( int i = 0; i < deltaCount; i++ )
+        {
+            curF7 += deltas[i];
+            position++;
+
+            if( curF7 > f7 )
+                return count;
+
+            if( curF7 == f7 && count < maxPositions )
+                positions[count++] = position;
+        }
+    }
+
+    return count;
+}
+
+//-----------------------------------------------------------
+int PlotReader::ReadC3Park( const uint64 parkIndex, byte deltas[kCheckpoint1Interval] ) const
+{
+    const size_t parkSize = CalculateC3Size();
+    const uint64 address  = _tablePointers[(int)PlotTable::C3] + parkIndex * parkSize;
+
+    // A final park of a single entry is only stored in C1, so its C3 park may be missing
+    byte park[CalculateC3Size()];
+
+    const ssize_t sizeRead = _file.ReadAt( park, parkSize, (int64)address );
+
+    if( sizeRead < 2 )
+        return parkIndex + 1 == _c1Count ? 0 : -1;
+
+    const size_t compressedSize = Swap16( *(uint16*)park );
+
+    if( compressedSize == 0 )
+        return 0;
+
+    if( compressedSize + 2 > (size_t)sizeRead )
+        return -1;
+
+    return DecodeDeltas( _dTables[6], park + 2, compressedSize, deltas, kCheckpoint1Interval );
+}
+
+//-----------------------------------------------------------
+bool PlotReader::ReadP7Entry( const uint64 position, uint64& outEntry ) const
+{
+    const uint64 park = position / kEntriesPerPark;
+    const uint64 bit  = ( position % kEntriesPerPark ) * ( _K + 1 );
+
+    // The entry's bits are read with the 8 bytes they start in.
+    // The last entries of a park may read into the next one, which is always followed by C1.
+    byte field[8];
+
+    if( !ReadAt( field, sizeof( field ), _tablePointers[(int)PlotTable::Table7] + park * P7_PARK_SIZE + bit / 8 ) )
+        return false;
+
+    outEntry = ReadBits( field, bit % 8, _K + 1 );
+    return true;
+}
+
+//-----------------------------------------------------------
+size_t PlotReader::ParkSize( const TableId table ) const
+{
+    ASSERT( table < TableId::Table7 );
+
+    return table == TableId::Table1 && _droppedXBits ? CalculateDroppedXParkSize( _droppedXBits ) : CalculateParkSize( table );
+}
+
+//-----------------------------------------------------------
+bool PlotReader::ReadLinePoint( const TableId table, const uint64 position, uint64& outLinePoint ) const
+{
+    ASSERT( table < TableId::Table7 );
+
+    const size_t parkSize = ParkSize( table );
+    const uint64 index    = position % kEntriesPerPark;
+
+    // 8 extra bytes, so that bits can be read 8 bytes at a time
+    byte park[MAX_PARK_SIZE + 8] = {};
+
+    if( !ReadAt( park, parkSize, _tablePointers[(int)table] + ( position / kEntriesPerPark ) * parkSize ) )
+        return false;
+
+    // The first line point is stored in full, followed by
+    // the stubs of the other entries' deltas, and then their FSE-compressed small deltas.
+    // Table 1's line points are shorter if x bits were dropped, and so are its stubs.
+    const uint   droppedBits      = table == TableId::Table1 ? _droppedXBits : 0;
+    const uint   lpBits           = ( _K - droppedBits ) * 2;
+    const uint   stubBits         = droppedBits ? DroppedXStubBits( droppedBits ) : _K - kStubMinusBits;
+    const size_t stubSectionBytes = CDiv( (size_t)( kEntriesPerPark - 1 ) * stubBits, 8 );
+
+    const byte* stubs       = park  + CDiv( lpBits, 8 );
+    const byte* deltaStream = stubs + stubSectionBytes;
+
+    uint64 linePoint = ReadBits( park, 0, lpBits );
+
+    if( index > 0 )
+    {
+        // The size of the small deltas is little-endian, with its high bit set if they are not compressed
+        uint16 deltasSize;
+        memcpy( &deltasSize, deltaStream, 2 );
+        deltaStream += 2;
+
+        const size_t maxDeltasSize = (size_t)( park + parkSize - deltaStream );
+
+        byte deltas[kEntriesPerPark];
+        int  deltaCount;
+
+        if( deltasSize & 0x8000 )
+        {
+            deltaCount = deltasSize & 0x7FFF;
+
+            if( (size_t)deltaCount > maxDeltasSize || deltaCount > kEntriesPerPark - 1 )
+                return false;
+
+            memcpy( deltas, deltaStream, (size_t)deltaCount );
+        }
+        else
+        {
+            if( deltasSize > maxDeltasSize )
+                return false;
+
+            deltaCount = DecodeDeltas( _dTables[(int)table], deltaStream, deltasSize, deltas, kEntriesPerPark - 1 );
+        }
+
+        if( deltaCount < (int)index )
+            return false;
+
+        uint64 sumDeltas = 0;
+        uint64 sumStubs  = 0;
+
+        for( uint64 i = 0; i < index; i++ )
+        {
+            sumStubs  += ReadBits( stubs, i * stubBits, stubBits );
+            sumDeltas += deltas[i];
+        }
+
+        linePoint += ( sumDeltas << stubBits ) + sumStubs;
+    }
+
+    outLinePoint = linePoint;
+    return true;
+}
+
+//-----------------------------------------------------------
+bool PlotReader::FetchProof( const uint64 p7Position, uint64 xs[64] ) const
+{
+    if( !ReadP7Entry( p7Position, xs[0] ) )
+        return false;
+
+    // Each line point is split into its 2 back pointers in the previous table, the smaller one first,
+    // doubling the positions with every table. Table 1's line points are made of x's.
+    uint64 count = 1;
+
+    for( int table = (int)TableId::Table6; table >= (int)TableId::Table1; table-- )
+    {
+        // Expand in place, from the end, so that positions are not overwritten before they are read
+        for( int64 i = (int64)count - 1; i >= 0; i-- )
+        {
+            uint64 linePoint, x, y;
+
+            if( !ReadLinePoint( (TableId)table, xs[i], linePoint ) )
+                return false;
+
+            SplitLinePoint( (TableId)table, linePoint, x, y );
+
+            xs[i*2  ] = y;
+            xs[i*2+1] = x;
+        }
+
+        count *= 2;
+    }
+
+    ASSERT( count == 64 );
+    return true;
+}
+
+//-----------------------------------------------------------
+bool PlotReader::FetchQualityXs( const uint64 p7Position, const byte challenge[32], uint64& outX1, uint64& outX2 ) const
+{
+    uint64 position;
+    if( !ReadP7Entry( p7Position, position ) )
+        return false;
+
+    // Bit n of the last 5 bits of the challenge picks the back pointer followed in table n+2
+    const uint last5Bits = challenge[31] & 0x1F;
+    uint64     linePoint, x, y;
+
+    for( int table = (int)TableId::Table6; table > (int)TableId::Table1; table-- )
+    {
+        if( !ReadLinePoint( (TableId)table, position, linePoint ) )
+            return false;
+
+        LinePointToSquare( linePoint, x, y );
+
+        position = ( ( last5Bits >> ( table - 1 ) ) & 1 ) ? x : y;
+    }
+
+    if( !ReadLinePoint( TableId::Table1, position, linePoint ) )
+        return false;
+
+    SplitLinePoint( TableId::Table1, linePoint, x, y );
+
+    outX1 = y;
+    outX2 = x;
+    return true;
+}
+
+//-----------------------------------------------------------
+void PlotReader::LinePointToSquare( const uint64 linePoint, uint64& outX, uint64& outY )
+{
+    // Back pointers are less than 2^k, so x is found one bit at a time, from bit k-1,
+    // without GetXEnc() overflowing.
+    auto getXEnc = []( uint64 x ) {
+        uint64 a = x, b = x - 1;
+
+        if( ( a & 1 ) == 0 )
+            a >>= 1;
+        else
+            b >>= 1;
+
+        return a * b;
+    };
+
+    uint64 x = 0;
+
+    for( int i = _K - 1; i >= 0; i-- )
+    {
+        const uint64 newX = x + ( 1ull << i );
+
+        if( getXEnc( newX ) <= linePoint )
+            x = newX;
+    }
+
+    outX = x;
+    outY = linePoint - getXEnc( x );
+}
+
+//-----------------------------------------------------------
+void PlotReader::SplitLinePoint( const TableId table, const uint64 linePoint, uint64& outX, uint64& outY ) const
+{
+    LinePointToSquare( linePoint, outX, outY );
+
+    if( table == TableId::Table1 && _droppedXBits )
+        outX--;
+}
+
+//-----------------------------------------------------------
+int PlotReader::DecodeDeltas( const void* dTable, const byte* src, const size_t srcSize, byte* deltas, const size_t maxCount )
+{
+    const size_t count = FSE_decompress_usingDTable( deltas, maxCount, src, srcSize, (const FSE_DTable*)dTable );
+
+    if( FSE_isError( count ) )
+        return -1;
+
+    // 0xFF is never encoded, chiapos rejects it as well
+    for( size_t i = 0; i < count; i++ )
+    {
+        if( deltas[i] == 0xFF )
+            return -1;
+    }
+
+    return (int)count;
+}
+
+//-----------------------------------------------------------
+void* CreateDTable( const double R )
+{
+    std::vector<short> normalizedCount = CreateNormalizedCount( R );
+
+    FSE_DTable* dTable = (FSE_DTable*)malloc( FSE_DTABLE_SIZE( PLOT_FSE_TABLE_LOG ) );
+
+    const size_t r = FSE_buildDTable( dTable, normalizedCount.data(), (uint)normalizedCount.size() - 1, PLOT_FSE_TABLE_LOG );
+    FatalIf( FSE_isError( r ), "Failed to build an FSE decoding table." );
+
+    return dTable;
+}
@@ -0,0 +1,106 @@
+#pragma once
+#include "ChiaConsts.h"
+#include "io/FileStream.h"
+
+// Most proofs a single challenge may have in a plot, as in chiapos
+#define BB_PLOT_MAX_PROOFS_PER_CHALLENGE 32
+
+enum class PlotTable : uint32
+{
+    Table1 = 0,
+    Table2,
+    Table3,
+    Table4,
+    Table5,
+    Table6,
+    Table7,
+    C1,
+    C2,
+    C3
+
+    ,_Count
+};
+
+/**
+ * Reads the proofs of a plot written by DiskPlotWriter (see its description of the file format).
+ *
+ * Opening a plot reads its header and loads its C1 and C2 tables to memory.
+ * Everything else, the parks of tables 1-7 and C3, is read from the file as needed,
+ * with positional reads, so a PlotReader may be used from multiple threads at once.
+ *
+ * Only plots of the k the plotter was built with can be read.
+ * Plots whose table 1 x's had their low bits dropped (see kDroppedXFormatPrefix) are read as well,
+ * but their proofs only hold the x's without those bits, which have to be recovered (see PlotValidator).
+ */
+class PlotReader
+{
+public:
+    PlotReader();
+    ~PlotReader();
+
+    // Logs an error and returns false if the plot can't be read, or its k is not _K.
+    bool Open( const char* path );
+
+    inline const byte* PlotId() const { return _plotId; }
+    inline uint64 TableAddress( PlotTable table ) const { return _tablePointers[(int)table]; }
+
+    // Number of C1 entries, which is the number of C3 parks
+    inline uint64 C1EntryCount() const { return _c1Count; }
+
+    // Low bits dropped from table 1's x's, or 0 for the standard format
+    inline uint DroppedXBits() const { return _droppedXBits; }
+
+    // Size of the parks of tables 1-6
+    size_t ParkSize( TableId table ) const;
+
+    // Gets the positions in table 7 of the entries with the given f7.
+    // Returns how many were found, up to maxPositions, or -1 if the plot could not be read.
+    int GetP7Positions( uint64 f7, uint64* positions, int maxPositions ) const;
+
+    // Reads the table 7 entry at the given position, which is the position of its pair in table 6
+    bool ReadP7Entry( uint64 position, uint64& outEntry ) const;
+
+    // Reads the line point of the entry at the given position in tables 1-6
+    bool ReadLinePoint( TableId table, uint64 position, uint64& outLinePoint ) const;
+
+    // Walks back from the table 7 entry at p7Position to table 1, and gets the 64 x's of its proof.
+    // The x's are in plot order: the pairs of each table are not ordered by their y's.
+    // If x bits were dropped, the x's are without them.
+    bool FetchProof( uint64 p7Position, uint64 xs[64] ) const;
+
+    // Walks back from the table 7 entry at p7Position to table 1 along the single path chosen
+    // by the last 5 bits of the challenge, and gets the 2 x's the entry's quality is made from, as chiapos does.
+    // The quality string is the SHA-256 hash of the challenge followed by x1 and x2, of k bits each.
+    bool FetchQualityXs( uint64 p7Position, const byte challenge[32], uint64& outX1, uint64& outX2 ) const;
+
+    // Evicts the plot from the OS page cache (see FileStream::EvictCache())
+    inline bool EvictCache() { return _file.EvictCache(); }
+
+    // Splits a line point into the 2 back pointers it was made from, x > y (see SquareToLinePoint()).
+    static void LinePointToSquare( uint64 linePoint, uint64& outX, uint64& outY );
+
+    // Same, for the line points of the given table of this plot, which in table 1 may be of x's
+    // without their dropped bits, where x >= y (see DroppedXLinePoint()).
+    void SplitLinePoint( TableId table, uint64 linePoint, uint64& outX, uint64& outY ) const;
+
+private:
+    bool ReadAt( void* buffer, size_t size, uint64 address ) const;
+
+    // Decodes the f7 deltas of C3 park parkIndex, returns their count, or -1 on failure
+    int  ReadC3Park( uint64 parkIndex, byte deltas[kCheckpoint1Interval] ) const;
+
+    // Decodes up to maxCount FSE-compressed deltas with one of the tables' decoding tables,
+    // returns their count, or -1 on failure
+    static int DecodeDeltas( const void* dTable, const byte* src, size_t srcSize, byte* deltas, size_t maxCount );
+
+private:
+    mutable FileStream _file;
+    byte               _plotId[32]                            = {};
+    uint64             _tablePointers[(int)PlotTable::_Count] = {};
+    uint32*            _c1                                    = nullptr;  // f7 of the C1 entries
+    uint64             _c1Count                               = 0;
+    uint32*            _c2                                    = nullptr;  // f7 of the C2 entries
+    uint64             _c2Count                               = 0;
+    uint               _droppedXBits                          = 0;
+    void*              _dTables[7]                            = {};       // FSE decoding tables of the parks of tables 1-6, and of C3
+};
@@ -0,0 +1,411 @@
+#include "PlotValidator.h"
+#include "PlotReader.h"
+#include "SysHost.h"
+#include "Util.h"
+#include "util/Log.h"
+#include "threading/ThreadPool.h"
+#include "pos/chacha8.h"
+#include "b3/blake3.h"
+
+// Challenges handed out to a thread at a time
+#define VALIDATE_CHUNK_SIZE 4
+
+// Most matching candidates kept for a pair of x's whose dropped bits are recovered,
+// and most combinations of them verified for a proof
+#define VALIDATE_MAX_X_CANDIDATES   8
+#define VALIDATE_MAX_X_COMBINATIONS 256
+
+struct ValidateStats
+{
+    uint64 proofs        = 0;
+    uint64 invalidProofs = 0;
+    uint64 readFailures  = 0;   // Challenges or proofs that could not be read from the plot
+};
+
+// Metadata of up to 4k bits. hi holds the bits above the low 64 bits.
+struct ProofMeta
+{
+    uint64 hi;
+    uint64 lo;
+};
+
+// A y, and its metadata, of a table entry of a proof
+struct ProofEntry
+{
+    uint64    y;
+    ProofMeta meta;
+};
+
+// Serializes fields of up to 64 bits as a big-endian bitstream, to hash them with BLAKE3
+//-----------------------------------------------------------
+struct ProofBitWriter
+{
+    uint64 words[5] = {};
+    uint   bit      = 0;
+
+    // value must fit in bitCount bits
+    inline void Write( const uint64 value, const uint bitCount )
+    {
+        const uint word  = bit / 64;
+        const uint shift = bit % 64;
+
+        words[word] |= ( value << ( 64 - bitCount ) ) >> shift;
+
+        if( shift + bitCount > 64 )
+            words[word+1] |= value << ( 128 - shift - bitCount );
+
+        bit += bitCount;
+    }
+
+    inline void WriteMeta( const ProofMeta& meta, const uint bitCount )
+    {
+        if( bitCount > 64 )
+        {
+            Write( meta.hi, bitCount - 64 );
+            Write( meta.lo, 64 );
+        }
+        else
+            Write( meta.lo, bitCount );
+    }
+};
+
+// Reads bitCount bits, up to 64, at the given bit of a big-endian hash
+//-----------------------------------------------------------
+inline static uint64 ReadHashBits( const uint64 h[4], const uint start, const uint bitCount )
+{
+    const uint word  = start / 64;
+    const uint shift = start % 64;
+
+    uint64 value = h[word] << shift;
+
+    if( shift + bitCount > 64 )
+        value |= h[word+1] >> ( 64 - shift );
+
+    return value >> ( 64 - bitCount );
+}
+
+//-----------------------------------------------------------
+inline static bool IsMatch( const uint64 yL, const uint64 yR )
+{
+    const uint64 groupL = yL / kBC;
+    const uint64 groupR = yR / kBC;
+
+    if( groupR != groupL + 1 )
+        return false;
+
+    const uint16 parity = (uint16)( groupL & 1 );
+    const uint16 localL = (uint16)( yL % kBC );
+    const uint16 localR = (uint16)( yR % kBC );
+
+    for( uint m = 0; m < kExtraBitsPow; m++ )
+    {
+        if( L_targets[parity][localL][m] == localR )
+            return true;
+    }
+
+    return false;
+}
+
+//-----------------------------------------------------------
+static void InitF1( const byte plotId[32], chacha8_ctx& chacha )
+{
+    // First byte is the table index
+    byte key[32] = { 1 };
+    memcpy( key + 1, plotId, 31 );
+
+    ZeroMem( &chacha );
+    chacha8_keysetup( &chacha, key, 256, NULL );
+}
+
+// y of table 1's entry for x: its f1, followed by the top kExtraBits bits of x
+//-----------------------------------------------------------
+static uint64 GetF1Y( const chacha8_ctx& chacha, const uint64 x )
+{
+    constexpr uint k = _K;
+
+    const uint64 bit = x * k;
+
+    // The k bits of x may span 2 blocks, and are read 8 bytes at a time
+    byte blocks[kF1BlockSizeBits / 8 * 2 + 8] = {};
+    chacha8_get_keystream( &chacha, bit / kF1BlockSizeBits, 2, blocks );
+
+    const uint64 start = bit % kF1BlockSizeBits;
+    uint64 field;
+    memcpy( &field, blocks + start / 8, sizeof( field ) );
+
+    const uint64 f1 = ( Swap64( field ) << ( start % 8 ) ) >> ( 64 - k );
+
+    return ( f1 << kExtraBits ) | ( x >> ( k - kExtraBits ) );
+}
+
+//-----------------------------------------------------------
+bool PlotValidator::Run( const PlotValidateConfig& cfg )
+{
+    ASSERT( cfg.plotPath );
+
+    PlotReader plot;
+    if( !plot.Open( cfg.plotPath ) )
+        return false;
+
+    LoadLTargets();
+
+    const uint maxThreads  = SysHost::GetLogicalCPUCount();
+    const uint threadCount = cfg.threadCount ? std::min( cfg.threadCount, maxThreads ) : SysHost::GetCpuQuotaCount();
+
+    ThreadPool pool( threadCount );
+
+    Log::Line( "Validating plot %s with %u challenges on %u threads.", cfg.plotPath, cfg.challengeCount, threadCount );
+
+    const uint droppedXBits = plot.DroppedXBits();
+    if( droppedXBits )
+        Log::Line( "The plot dropped %u bits from table 1's x's. They are recovered for each proof.", droppedXBits );
+
+    // A challenge is 32 bytes, of which the f7 looked up is the first k bits
+    byte* challenges = (byte*)malloc( (size_t)cfg.challengeCount * 32 );
+    SysHost::Random( challenges, (size_t)cfg.challengeCount * 32 );
+
+    auto timer = TimerBegin();
+
+    const ValidateStats stats = pool.ParallelReduce( cfg.challengeCount, VALIDATE_CHUNK_SIZE, ValidateStats(),
+        [&]( uint64 begin, uint64 end, ValidateStats& stats ) {
+
+        for( uint64 i = begin; i < end; i++ )
+        {
+            const byte*  challenge = challenges + i * 32;
+            const uint64 f7        = Swap64( *(uint64*)challenge ) >> ( 64 - _K );
+
+            char challengeStr[65];
+            size_t numEncoded;
+            BytesToHexStr( challenge, 32, challengeStr, sizeof( challengeStr ), numEncoded );
+            challengeStr[64] = 0;
+
+            uint64 positions[BB_PLOT_MAX_PROOFS_PER_CHALLENGE];
+
+            const int proofCount = plot.GetP7Positions( f7, positions, BB_PLOT_MAX_PROOFS_PER_CHALLENGE );
+            if( proofCount < 0 )
+            {
+                Log::Error( "Error: Failed to look up challenge %s.", challengeStr );
+                stats.readFailures++;
+                continue;
+            }
+
+            for( int p = 0; p < proofCount; p++ )
+            {
+                uint64 xs[64];
+
+                if( !plot.FetchProof( positions[p], xs ) )
+                {
+                    Log::Error( "Error: Failed to read the proof at table 7 position %llu, for challenge %s.",
+                                positions[p], challengeStr );
+                    stats.readFailures++;
+                    continue;
+                }
+
+                stats.proofs++;
+
+                const bool valid = droppedXBits ? VerifyDroppedXProof( plot.PlotId(), xs, f7, droppedXBits ) :
+                                                  VerifyProof( plot.PlotId(), xs, f7 );
+                if( !valid )
+                {
+                    Log::Error( "Error: Invalid proof at table 7 position %llu, for challenge %s.",
+                                positions[p], challengeStr );
+                    stats.invalidProofs++;
+                }
+            }
+        }
+    },
+    []( ValidateStats& acc, const ValidateStats& stats ) {
+        acc.proofs        += stats.proofs;
+        acc.invalidProofs += stats.invalidProofs;
+        acc.readFailures  += stats.readFailures;
+    });
+
+    const double elapsed = TimerEnd( timer );
+
+    free( challenges );
+
+    Log::Line( "Finished validating in %.2lf seconds.", elapsed );
+    Log::Line( " Challenges     : %u", cfg.challengeCount );
+    Log::Line( " Proofs         : %llu (%.3lf per challenge)", stats.proofs,
+               cfg.challengeCount ? stats.proofs / (double)cfg.challengeCount : 0.0 );
+    Log::Line( " Invalid proofs : %llu", stats.invalidProofs );
+    Log::Line( " Read failures  : %llu", stats.readFailures );
+
+    return stats.invalidProofs == 0 && stats.readFailures == 0;
+}
+
+//-----------------------------------------------------------
+bool PlotValidator::VerifyProof( const byte plotId[32], const uint64 xs[64], const uint64 f7 )
+{
+    constexpr uint k     = _K;
+    constexpr uint ySize = k + kExtraBits;
+
+    ProofEntry entries[64];
+
+    ///
+    /// F1
+    ///
+    {
+        chacha8_ctx chacha;
+        InitF1( plotId, chacha );
+
+        for( uint i = 0; i < 64; i++ )
+        {
+            entries[i].y       = GetF1Y( chacha, xs[i] );
+            entries[i].meta.hi = 0;
+            entries[i].meta.lo = xs[i];
+        }
+    }
+
+    ///
+    /// F2-F7
+    ///
+    // Each pair of entries must match, and is ordered by y, before its f is computed
+    uint count = 64;
+
+    for( uint table = (uint)TableId::Table2; table <= (uint)TableId::Table7; table++ )
+    {
+        const uint metaInBits  = k * kVectorLens[table];
+        const uint metaOutBits = table < (uint)TableId::Table7 ? k * kVectorLens[table+1] : 0;
+
+        for( uint i = 0; i < count; i += 2 )
+        {
+            ProofEntry l = entries[i];
+            ProofEntry r = entries[i+1];
+
+            if( l.y > r.y )
+                std::swap( l, r );
+
+            if( !IsMatch( l.y, r.y ) )
+                return false;
+
+            ProofBitWriter input;
+            input.Write( l.y, ySize );
+            input.WriteMeta( l.meta, metaInBits );
+            input.WriteMeta( r.meta, metaInBits );
+
+            for( uint w = 0; w < 5; w++ )
+                input.words[w] = Swap64( input.words[w] );
+
+            uint64 hash[4];
+
+            blake3_hasher hasher;
+            blake3_hasher_init( &hasher );
+            blake3_hasher_update( &hasher, input.words, CDiv( input.bit, 8 ) );
+            blake3_hasher_finalize( &hasher, (uint8_t*)hash, sizeof( hash ) );
+
+            for( uint w = 0; w < 4; w++ )
+                hash[w] = Swap64( hash[w] );
+
+            ProofEntry& out = entries[i/2];
+            out.y = hash[0] >> ( 64 - ySize );
+
+            // Tables 2 and 3 take the metadata of both entries, the others take it from the hash, right after y
+            if( table <= (uint)TableId::Table3 )
+            {
+                ASSERT( metaInBits <= 64 );
+
+                out.meta.hi = metaInBits == 64 ? l.meta.lo : l.meta.lo >> ( 64 - metaInBits );
+                out.meta.lo = metaInBits == 64 ? r.meta.lo : l.meta.lo << metaInBits | r.meta.lo;
+            }
+            else if( metaOutBits > 64 )
+            {
+                out.meta.hi = ReadHashBits( hash, ySize, metaOutBits - 64 );
+                out.meta.lo = ReadHashBits( hash, ySize + metaOutBits - 64, 64 );
+            }
+            else if( metaOutBits > 0 )
+            {
+                out.meta.hi = 0;
+                out.meta.lo = ReadHashBits( hash, ySize, metaOutBits );
+            }
+        }
+
+        count /= 2;
+    }
+
+    // f7 is the first k bits of table 7's y
+    return ( entries[0].y >> kExtraBits ) == f7;
+}
+
+//-----------------------------------------------------------
+uint PlotValidator::RecoverXPair( const byte plotId[32], const uint64 x1, const uint64 x2, const uint droppedBits,
+                                  uint64* outXs, const uint maxCandidates )
+{
+    ASSERT( droppedBits >= 1 && droppedBits <= BB_MAX_DROPPED_X_BITS );
+    ASSERT( outXs );
+
+    const uint64 candidateCount = 1ull << droppedBits;
+
+    chacha8_ctx chacha;
+    InitF1( plotId, chacha );
+
+    uint64 ys2[1u << BB_MAX_DROPPED_X_BITS];
+    for( uint64 c = 0; c < candidateCount; c++ )
+        ys2[c] = GetF1Y( chacha, ( x2 << droppedBits ) | c );
+
+    uint count = 0;
+
+    for( uint64 c1 = 0; c1 < candidateCount && count < maxCandidates; c1++ )
+    {
+        const uint64 full1 = ( x1 << droppedBits ) | c1;
+        const uint64 y1    = GetF1Y( chacha, full1 );
+
+        for( uint64 c2 = 0; c2 < candidateCount && count < maxCandidates; c2++ )
+        {
+            const uint64 y2 = ys2[c2];
+
+            if( !IsMatch( std::min( y1, y2 ), std::max( y1, y2 ) ) )
+                continue;
+
+            outXs[count*2  ] = full1;
+            outXs[count*2+1] = ( x2 << droppedBits ) | c2;
+            count++;
+        }
+    }
+
+    return count;
+}
+
+//-----------------------------------------------------------
+bool PlotValidator::VerifyDroppedXProof( const byte plotId[32], const uint64 xs[64], const uint64 f7, const uint droppedBits )
+{
+    uint64 candidates[32][VALIDATE_MAX_X_CANDIDATES * 2];
+    uint   counts    [32];
+    uint64 combinations = 1;
+
+    for( uint i = 0; i < 32; i++ )
+    {
+        counts[i] = RecoverXPair( plotId, xs[i*2], xs[i*2+1], droppedBits, candidates[i], VALIDATE_MAX_X_CANDIDATES );
+
+        if( counts[i] == 0 )
+            return false;
+
+        combinations = std::min( combinations * counts[i], (uint64)VALIDATE_MAX_X_COMBINATIONS );
+    }
+
+    // Nearly every pair has a single match, so the first combination is almost always the proof
+    uint   choices[32] = {};
+    uint64 fullXs [64];
+
+    for( uint64 n = 0; n < combinations; n++ )
+    {
+        for( uint i = 0; i < 32; i++ )
+        {
+            fullXs[i*2  ] = candidates[i][choices[i]*2  ];
+            fullXs[i*2+1] = candidates[i][choices[i]*2+1];
+        }
+
+        if( VerifyProof( plotId, fullXs, f7 ) )
+            return true;
+
+        for( uint i = 0; i < 32; i++ )
+        {
+            if( ++choices[i] < counts[i] )
+                break;
+
+            choices[i] = 0;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+struct PlotValidateConfig
+{
+    const char* plotPath       = nullptr;
+    uint        challengeCount = 100;
+    uint        threadCount    = 0;     // 0 to use all logical CPUs
+};
+
+/**
+ * Validates a plot the way a harvester uses it: random challenges are looked up in its
+ * C1, C2 and C3 tables, and every proof found for them is fetched from its parks
+ * and verified against the challenge, by recomputing its f1 through f7.
+ *
+ * A valid plot has one proof per challenge on average, and no invalid proofs.
+ * Challenges are validated in parallel.
+ *
+ * Plots whose table 1 x's had their low bits dropped are validated by recovering those bits first,
+ * as a harvester would: each pair of x's has 2^bits candidates per x, of which only matching ones are kept.
+ */
+class PlotValidator
+{
+public:
+    // Returns false if the plot could not be read, or any of its proofs were invalid.
+    static bool Run( const PlotValidateConfig& cfg );
+
+    // Verifies a proof of the plot for the given f7. The x's are in plot order, as PlotReader::FetchProof() gets them.
+    static bool VerifyProof( const byte plotId[32], const uint64 xs[64], uint64 f7 );
+
+    // Recovers the droppedBits low bits of a pair of table 1 x's, by finding the candidates whose f1 match.
+    // Writes up to maxCandidates pairs of full x's to outXs, in the order of x1 and x2, and returns their count.
+    static uint RecoverXPair( const byte plotId[32], uint64 x1, uint64 x2, uint droppedBits, uint64* outXs, uint maxCandidates );
+
+    // Verifies a proof whose x's are without their droppedBits low bits. Pairs of x's with more than one
+    // matching candidate are resolved by verifying each combination of them.
+    static bool VerifyDroppedXProof( const byte plotId[32], const uint64 xs[64], uint64 f7, uint droppedBits );
+};
@@ -1,16 +1,23 @@
 #include "PlotWriter.h"
+#include "PlotDigest.h"
 #include "ChiaConsts.h"
 #include "SysHost.h"
 #include "Config.h"
+#include "util/Log.h"
+#include "util/Metrics.h"
+#include "util/Trace.h"
+#include "HostCoordinator.h"
 
 //-----------------------------------------------------------
-DiskPlotWriter::DiskPlotWriter()
-    : _writeSignal       ( 0 )
+DiskPlotWriter::DiskPlotWriter( bool nullSink )
+    : _nullSink          ( nullSink )
+    , _formatDescription ( kFormatDescription )
+    , _writeSignal       ( 0 )
     , _plotFinishedSignal( 0 )
 {
-    #if BB_BENCHMARK_MODE
+    if( _nullSink )
         return;
-    #endif
+
     // Start writer thread
     _writerThread.Run( WriterMain, this );
 }
@@ -18,9 +25,8 @@ DiskPlotWriter::DiskPlotWriter()
 //-----------------------------------------------------------
 DiskPlotWriter::~DiskPlotWriter()
 {
-    #if BB_BENCHMARK_MODE
+    if( _nullSink )
         return;
-    #endif
 
     // Signal writer thread to exit, if it hasn't already
     _terminateSignal.store( true, std::memory_order_release );
@@ -34,15 +40,31 @@ DiskPlotWriter::~DiskPlotWriter()
 
     if( _file )
         delete _file;
+
+    if( _digest )
+        delete _digest;
+}
+
+//-----------------------------------------------------------
+void DiskPlotWriter::EnableDigest( uint threadCount )
+{
+    ASSERT( !_file );
+
+    if( !_digest )
+        _digest = new PlotDigest( threadCount );
 }
 
 //-----------------------------------------------------------
-bool DiskPlotWriter::BeginPlot( const char* plotFilePath, FileStream& file, const byte plotId[32], const byte* plotMemo, const uint16 plotMemoSize )
+bool DiskPlotWriter::BeginPlot( const char* plotFilePath, FileStream& file, const byte plotId[32], const byte* plotMemo, const uint16 plotMemoSize,
+                                const size_t* predictedTableSizes )
 {
-    #if BB_BENCHMARK_MODE
+    // Nothing is written, but the writer owns the file all the same
+    if( _nullSink )
+    {
+        delete &file;
         _filePath = plotFilePath;
         return true;
-    #endif
+    }
 
     ASSERT( plotMemo     );
     ASSERT( plotMemoSize );
@@ -55,8 +77,8 @@ bool DiskPlotWriter::BeginPlot( const char* plotFilePath, FileStream& file, cons
         ( sizeof( kPOSMagic ) - 1 ) +
         32 +            // plot id
         1  +            // k
-        2  +            // kFormatDescription length
-        ( sizeof( kFormatDescription ) - 1 ) +
+        2  +            // Format description length
+        _formatDescription.length() +
         2  +            // Memo length
         plotMemoSize +  // Memo
         80              // Table pointers
@@ -64,6 +86,7 @@ bool DiskPlotWriter::BeginPlot( const char* plotFilePath, FileStream& file, cons
 
     ASSERT( plotFilePath );
     _filePath = plotFilePath;
+    _remote   = file.IsRemote();
 
 
     const size_t paddedHeaderSize = RoundUpToNextBoundary( headerSize, (int)file.BlockSize() );
@@ -88,6 +111,7 @@ bool DiskPlotWriter::BeginPlot( const char* plotFilePath, FileStream& file, cons
     if( !header )
     {
         header = (byte*)SysHost::VirtualAlloc( paddedHeaderSize );
+        SysHost::NumaAssignIoPages( header, paddedHeaderSize );
 
         // Zero-out padded portion and table pointers
         memset( header+headerSize-80, 0, paddedHeaderSize-headerSize-80 );
@@ -109,10 +133,10 @@ bool DiskPlotWriter::BeginPlot( const char* plotFilePath, FileStream& file, cons
         *headerWriter++ = (byte)_K;
 
         // Format description
-        *((uint16*)headerWriter) = Swap16( (uint16)(sizeof( kFormatDescription ) - 1) );
+        *((uint16*)headerWriter) = Swap16( (uint16)_formatDescription.length() );
         headerWriter += 2;
-        memcpy( headerWriter, kFormatDescription, sizeof( kFormatDescription ) - 1 );
-        headerWriter += sizeof( kFormatDescription ) - 1;
+        memcpy( headerWriter, _formatDescription.c_str(), _formatDescription.length() );
+        headerWriter += _formatDescription.length();
 
         // Memo
         *((uint16*)headerWriter) = Swap16( plotMemoSize );
@@ -123,6 +147,25 @@ bool DiskPlotWriter::BeginPlot( const char* plotFilePath, FileStream& file, cons
         // Tables will be copied at the end.
     }
 
+    // Preallocate the whole plot, so that it doesn't have to grow with every write.
+    // (A receiver's file is not ours to preallocate.)
+    // A file prepared ahead of its plot may be preallocated already, and is trimmed all the same.
+    const int64 preparedSize = file.IsRemote() ? 0 : file.Size();
+    _reservedSize = preparedSize > 0 ? (size_t)preparedSize : 0;
+
+    if( predictedTableSizes && !file.IsRemote() )
+    {
+        size_t plotSize = paddedHeaderSize;
+
+        for( uint i = 0; i < 10; i++ )
+            plotSize += RoundUpToNextBoundary( predictedTableSizes[i], (int)file.BlockSize() );
+
+        if( file.Reserve( (ssize_t)plotSize ) )
+            _reservedSize = std::max( _reservedSize, plotSize );
+        else
+            Log::Line( "Warning: Failed to preallocate plot file %s with error %d.", plotFilePath, file.GetError() );
+    }
+
     // Seek to the aligned position after the header
     if( !file.Seek( (int64)paddedHeaderSize, SeekOrigin::Begin ) )
     {
@@ -140,6 +183,7 @@ bool DiskPlotWriter::BeginPlot( const char* plotFilePath, FileStream& file, cons
 
     // Give ownership of the file to the writer thread and signal it
     _tableIndex = 0;
+    _lastTableIndexWritten.store( 0, std::memory_order_release );
     _file       = &file;
     _writeSignal.Release();
 
@@ -147,13 +191,12 @@ bool DiskPlotWriter::BeginPlot( const char* plotFilePath, FileStream& file, cons
 }
 
 //-----------------------------------------------------------
-bool DiskPlotWriter::WriteTable( const void* buffer, size_t size )
+bool DiskPlotWriter::WriteTable( const void* buffer, size_t size, PlotWriteCallback callback, void* userData )
 {
-    #if BB_BENCHMARK_MODE
+    if( _nullSink )
         return true;
-    #endif
 
-    if( !SubmitTable( buffer, size ) )
+    if( !SubmitTable( buffer, size, callback, userData ) )
         return false;
 
     // Signal the writer thread that there is a new table to write
@@ -163,32 +206,206 @@ bool DiskPlotWriter::WriteTable( const void* buffer, size_t size )
 }
 
 //-----------------------------------------------------------
-bool DiskPlotWriter::SubmitTable( const void* buffer, size_t size )
+bool DiskPlotWriter::SubmitTable( const void* buffer, size_t size, PlotWriteCallback callback, void* userData )
 {
-    #if BB_BENCHMARK_MODE
+    if( _nullSink )
+        return true;
+
+    ASSERT( _tableIndex < 10 );
+
+    // Can't overflow tables
+    if( _tableIndex >= 10 )
+        return false;
+
+    ASSERT( buffer );
+    ASSERT( size   );
+
+    PlotWriteCommand cmd;
+    cmd.type     = PlotWriteCommandType::Table;
+    cmd.buffer   = (const byte*)buffer;
+    cmd.size     = size;
+    cmd.offset   = 0;
+    cmd.callback = callback;
+    cmd.userData = userData;
+
+    if( !Submit( cmd, false ) )
+        return false;
+
+    _tableIndex++;
+    return true;
+}
+
+//-----------------------------------------------------------
+bool DiskPlotWriter::WritePatch( const void* buffer, size_t size, uint64 offset, PlotWriteCallback callback, void* userData )
+{
+    if( _nullSink )
+        return true;
+
+    ASSERT( buffer );
+    ASSERT( size   );
+
+    // Once the last table is in, the writer thread may finish the plot any time
+    if( !_file || _tableIndex >= 10 )
+        return false;
+
+    const size_t blockSize = _file->BlockSize();
+
+    // The file may be unbuffered
+    ASSERT( (uintptr_t)buffer % blockSize == 0 && size % blockSize == 0 && offset % blockSize == 0 );
+    if( (uintptr_t)buffer % blockSize || size % blockSize || offset % blockSize )
+        return false;
+
+    PlotWriteCommand cmd;
+    cmd.type     = PlotWriteCommandType::Patch;
+    cmd.buffer   = (const byte*)buffer;
+    cmd.size     = size;
+    cmd.offset   = offset;
+    cmd.callback = callback;
+    cmd.userData = userData;
+
+    return Submit( cmd, true );
+}
+
+//-----------------------------------------------------------
+bool DiskPlotWriter::TrySubmit( const PlotWriteCommand& command, bool signal )
+{
+    if( _nullSink )
         return true;
-    #endif
 
     // Make sure the thread has already started.
     // We must have no errors
     if( !_file || _error )
         return false;
 
-    const uint tableIndex = _tableIndex.load( std::memory_order_relaxed );
-    ASSERT( tableIndex < 10 );
+    if( !_queue.TryPush( command ) )
+        return false;
 
-    // Can't overflow tables
-    if( tableIndex >= 10 )
+    if( _metrics )
+        _metrics->writerQueueDepth.store( _queue.Count(), std::memory_order_relaxed );
+
+    if( signal )
+        _writeSignal.Release();
+
+    return true;
+}
+
+//-----------------------------------------------------------
+bool DiskPlotWriter::Submit( const PlotWriteCommand& command, bool signal )
+{
+    if( !_file || _error )
+        return false;
+
+    while( !_queue.TryPush( command ) )
+    {
+        _queueStalls++;
+
+        // Let the writer thread know we're waiting, then check again,
+        // in case it made room before it could see that.
+        _producerWaiting.store( true, std::memory_order_seq_cst );
+
+        if( _queue.TryPush( command ) )
+            break;
+
+        // The queue may be full of commands that were only submitted
+        _writeSignal.Release();
+        _queueSpaceSignal.Wait();
+
+        // The writer thread stops picking up commands once it fails
+        if( _error )
+            return false;
+    }
+
+    if( _metrics )
+        _metrics->writerQueueDepth.store( _queue.Count(), std::memory_order_relaxed );
+
+    if( signal )
+        _writeSignal.Release();
+
+    return true;
+}
+
+//-----------------------------------------------------------
+bool DiskPlotWriter::BeginStreamedTable( const void* buffer, PlotWriteCallback callback, void* userData )
+{
+    if( _nullSink )
+        return true;
+
+    ASSERT( _tableIndex < 10 );
+
+    if( _tableIndex >= 10 )
         return false;
 
     ASSERT( buffer );
-    ASSERT( size   );
 
-    _tablebuffers[tableIndex].buffer = (byte*)buffer;
-    _tablebuffers[tableIndex].size   = size;
+    // Tables have their own progress, as the writer thread may still be writing the previous one
+    StreamedTable& table = _streamedTables[_tableIndex];
+    table.size = 0;
+    table.readySize.store( 0, std::memory_order_relaxed );
+    table.ended    .store( false, std::memory_order_relaxed );
+
+    _streamTableIndex = _tableIndex;
+
+    PlotWriteCommand cmd;
+    cmd.type     = PlotWriteCommandType::StreamedTable;
+    cmd.buffer   = (const byte*)buffer;
+    cmd.size     = 0;
+    cmd.offset   = 0;
+    cmd.callback = callback;
+    cmd.userData = userData;
+
+    // The writer thread can pick the table up now,
+    // it will wait on it until its first blocks are ready.
+    if( !Submit( cmd, true ) )
+        return false;
 
-    // Store the value
-    _tableIndex.store( tableIndex + 1, std::memory_order_release );
+    _tableIndex++;
+    return true;
+}
+
+//-----------------------------------------------------------
+void DiskPlotWriter::StreamTableProgress( size_t readySize )
+{
+    if( _nullSink )
+        return;
+
+    StreamedTable& table = _streamedTables[_streamTableIndex];
+
+    // Keep the largest size reported, and only signal the
+    // writer thread when a new whole block became ready.
+    size_t prevSize = table.readySize.load( std::memory_order_relaxed );
+
+    while( prevSize < readySize )
+    {
+        if( table.readySize.compare_exchange_weak( prevSize, readySize, 
+                std::memory_order_release, std::memory_order_relaxed ) )
+        {
+            const size_t blockSize = _file->BlockSize();
+
+            if( readySize / blockSize > prevSize / blockSize )
+                _writeSignal.Release();
+
+            break;
+        }
+    }
+}
+
+//-----------------------------------------------------------
+bool DiskPlotWriter::EndStreamedTable( size_t size )
+{
+    if( _nullSink )
+        return true;
+
+    StreamedTable& table = _streamedTables[_streamTableIndex];
+    ASSERT( size );
+    ASSERT( table.readySize.load( std::memory_order_relaxed ) <= size );
+
+    if( _error )
+        return false;
+
+    table.size = size;
+    table.ended.store( true, std::memory_order_release );
+
+    _writeSignal.Release();
 
     return true;
 }
@@ -216,9 +433,8 @@ bool DiskPlotWriter::SubmitTable( const void* buffer, size_t size )
 //-----------------------------------------------------------
 bool DiskPlotWriter::WaitUntilFinishedWriting()
 {
-#if BB_BENCHMARK_MODE
-    return true;
-#else
+    if( _nullSink )
+        return true;
 
     // For re-entry checks
     if( !_file && _plotFinishedSignal.GetCount() == 0 )
@@ -231,7 +447,6 @@ bool DiskPlotWriter::WaitUntilFinishedWriting()
     ASSERT( _file == nullptr );
 
     return _error == 0;
-#endif
 }
 
 
@@ -241,7 +456,13 @@ bool DiskPlotWriter::WaitUntilFinishedWriting()
 //-----------------------------------------------------------
 void DiskPlotWriter::WriterMain( void* data )
 {
-    SysHost::SetCurrentThreadAffinityCpuId( 0 );
+    // Run on the I/O cores, if any were reserved
+    if( !SysHost::SetCurrentThreadIoAffinity() )
+        SysHost::SetCurrentThreadAffinityCpuId( 0 );
+
+    SysHost::SetCurrentThreadQoS( ThreadQoS::IO );
+
+    Trace::NameThread( "plot writer" );
     
     ASSERT( data );
     DiskPlotWriter* self = reinterpret_cast<DiskPlotWriter*>( data );
@@ -259,6 +480,12 @@ void DiskPlotWriter::WriterThread()
 
     uint tableIndex = 0;    // Local table index
 
+    PlotWriteCommand cmd;               // Command being written
+    bool             hasCommand = false;
+    Trace::TimePoint cmdStart;          // When the command was picked up, if tracing
+
+    size_t streamWritten = 0;   // Bytes of the current streamed table already written
+
     // Buffer for writing 
     size_t blockBufferSize = 0;
     byte*  blockBuffer     = nullptr;
@@ -299,74 +526,151 @@ void DiskPlotWriter::WriterThread()
 
                 if( !blockBuffer )
                     Fatal( "Failed to allocate buffer for writing to disk." );
+
+                SysHost::NumaAssignIoPages( blockBuffer, blockBufferSize );
             }
-        }
 
-        // See if we have a new table to write (should always be the case when we're signaled)
-        uint newIndex = _tableIndex.load( std::memory_order_acquire );
+            // The remainder of every table is written from the block buffer
+            file->RegisterBuffer( blockBuffer, blockBufferSize );
+        }
 
-        while( tableIndex < newIndex )
+        // Write the commands queued so far, in order
+        for( ;; )
         {
-            TableBuffer& table       = _tablebuffers[tableIndex];
+            if( !hasCommand )
+            {
+                if( !_queue.TryPop( cmd ) )
+                    break;
 
-            const byte*  writeBuffer = table.buffer;
+                hasCommand = true;
 
-            // Write as many blocks as we can, 
-            // then write the remainder by copying it to our own block-aligned buffer
-            const size_t blockCount  = table.size / blockSize;
-            size_t       sizeToWrite = blockCount * blockSize;
+                if( Trace::Enabled() )
+                    cmdStart = Trace::Now();
 
-            const size_t remainder   = table.size - sizeToWrite;
+                if( _metrics )
+                    _metrics->writerQueueDepth.store( _queue.Count(), std::memory_order_relaxed );
 
-            while( sizeToWrite )
+                // Let the main thread know there's room, if it's waiting for it
+                if( _producerWaiting.exchange( false, std::memory_order_seq_cst ) )
+                    _queueSpaceSignal.Release();
+            }
+
+            if( cmd.type == PlotWriteCommandType::Patch )
             {
-                ssize_t sizeWritten = file->Write( writeBuffer, sizeToWrite );
-                if( sizeWritten < 1 )
-                {
-                    // Error occurred, stop writing.
-                    _error = file->GetError();
+                if( !WritePatchCommand( *file, cmd ) )
                     break;
+
+                if( Trace::Enabled() )
+                    Trace::Record( "write_patch", -1, cmdStart, Trace::Now() );
+
+                CompleteCommand( cmd, true );
+                hasCommand = false;
+                continue;
+            }
+
+            ASSERT( tableIndex < 10 );
+
+            const bool   streamed    = cmd.type == PlotWriteCommandType::StreamedTable;
+            const byte*  writeBuffer = cmd.buffer;
+
+            // Streamed tables are written as their blocks become ready
+            if( streamed )
+            {
+                StreamedTable& table = _streamedTables[tableIndex];
+
+                const bool   ended    = table.ended.load( std::memory_order_acquire );
+                const size_t ready    = ended ? table.size : table.readySize.load( std::memory_order_acquire );
+                const size_t readyEnd = ready / blockSize * blockSize;
+
+                if( readyEnd > streamWritten )
+                {
+                    if( !WriteBlocks( *file, writeBuffer + streamWritten, readyEnd - streamWritten ) )
+                        break;
+
+                    streamWritten = readyEnd;
+
+                    // Hash what was just queued while it's being written
+                    if( _digest )
+                        _digest->Update( cmd.buffer, readyEnd );
                 }
-                ASSERT( (size_t)sizeWritten <= sizeToWrite );
 
-                sizeToWrite -= (size_t)sizeWritten;
-                writeBuffer += sizeWritten;
-            };
+                // Wait to be signalled that more of the table is ready
+                if( !ended )
+                    break;
 
-            // Break out if we got a write error
-            if( _error )
-                break;
+                cmd.size = table.size;
+            }
+
+            const size_t tableSize = cmd.size - streamWritten;
+            writeBuffer  += streamWritten;
+            streamWritten = 0;
+
+            // Write as many blocks as we can, 
+            // then write the remainder by copying it to our own block-aligned buffer
+            const size_t blockCount  = tableSize / blockSize;
+            size_t       sizeToWrite = blockCount * blockSize;
+
+            const size_t remainder   = tableSize - sizeToWrite;
+
+            // Other instances on the host wait for their turn until the table is flushed.
+            // (Streamed tables only take it for their last blocks.)
+            if( _coordinator )
+                _coordinator->BeginWrite();
+
+            bool tableDone = WriteBlocks( *file, writeBuffer, sizeToWrite );
+
+            writeBuffer += sizeToWrite;
 
             // Write remainder, if we have any
-            if( remainder )
+            if( tableDone && remainder )
             {
                 memset( blockBuffer, 0, blockSize );
                 memcpy( blockBuffer, writeBuffer, remainder );
 
-                ssize_t sizeWritten = file->Write( blockBuffer, blockSize );
-                if( sizeWritten < 1 )
-                {
-                    _error = file->GetError();
-                    break;   
-                }
+                tableDone = WriteBlocks( *file, blockBuffer, blockSize );
+            }
+
+            const size_t paddedTableSize = RoundUpToNextBoundary( cmd.size, (int)blockSize );
 
-                ASSERT( (size_t)sizeWritten == blockSize );
+            // The table is hashed from its own buffer, while its writes are in flight
+            if( tableDone && _digest )
+            {
+                _regionOffsets[tableIndex+1] = _position;
+                _regionSizes  [tableIndex+1] = paddedTableSize;
+                _digest->EndRegion( cmd.buffer, cmd.size, paddedTableSize, _regionDigests[tableIndex+1] );
             }
 
-            if( !file->Flush() )
+            // The table's buffer can only be re-used once all its writes completed.
+            // Async writes are not synchronous to the device,
+            // they are made durable when the plot is flushed at the end.
+            if( tableDone && !( file->IsAsync() ? file->WaitForWrites() : file->Flush() ) )
             {
-                _error = file->GetError();
-                break;
+                _error    = file->GetError();
+                tableDone = false;
             }
 
+            if( _coordinator )
+                _coordinator->EndWrite();
+
+            // Break out if we got a write error
+            if( !tableDone )
+                break;
+
+            if( Trace::Enabled() )
+                Trace::Record( "write_table", (int)tableIndex+1, cmdStart, Trace::Now() );
+
             // Go to the next table
             tableIndex ++;
             _lastTableIndexWritten.store( tableIndex, std::memory_order_release );
 
-            _position += RoundUpToNextBoundary( table.size, (int)blockSize );
+            _position += paddedTableSize;
 
             // Save the table pointer
-            _tablePointers[tableIndex] = _position;
+            if( tableIndex < 10 )
+                _tablePointers[tableIndex] = _position;
+
+            CompleteCommand( cmd, true );
+            hasCommand = false;
         }
         
         if( _error )
@@ -377,6 +681,13 @@ void DiskPlotWriter::WriterThread()
         {
             ASSERT( tableIndex == 10 );
 
+            // Release the preallocated space we didn't need
+            if( _reservedSize > _position && !file->Truncate( (int64)_position ) )
+                _error = file->GetError();
+
+            if( _coordinator )
+                _coordinator->BeginWrite();
+
             // We now need to seek to the beginning so that we can write the header
             // with the table pointers set
             if( file->Seek( 0, SeekOrigin::Begin ) )
@@ -391,6 +702,13 @@ void DiskPlotWriter::WriterThread()
 
                 if( file->Write( _headerBuffer, alignedHeaderSize ) != (ssize_t)alignedHeaderSize )
                     _error = file->GetError();
+
+                if( _digest )
+                {
+                    _regionOffsets[0] = 0;
+                    _regionSizes  [0] = alignedHeaderSize;
+                    _digest->EndRegion( _headerBuffer, alignedHeaderSize, alignedHeaderSize, _regionDigests[0] );
+                }
             }
             else
                 _error = file->GetError();
@@ -398,13 +716,19 @@ void DiskPlotWriter::WriterThread()
             // Plot data cleanup
             if( !file->Flush() )
                 _error = file->GetError();
+
+            if( _coordinator )
+                _coordinator->EndWrite();
             
             file->Close();
             delete file;
             file = nullptr;
-            _file = nullptr;
 
-            _tableIndex = 0;
+            // A receiver's file system is not ours to write to
+            if( _digest && !_error && !_remote )
+                WriteDigestFile();
+
+            _file = nullptr;
 
             // Signal that we've finished writing the plot
             _plotFinishedSignal.Release();
@@ -425,18 +749,100 @@ void DiskPlotWriter::WriterThread()
         delete file;
     }
 
+    // Fail whatever was still queued, and release the main thread if it's waiting for room
+    if( hasCommand )
+        CompleteCommand( cmd, false );
+
+    while( _queue.TryPop( cmd ) )
+        CompleteCommand( cmd, false );
+
+    _producerWaiting.store( false, std::memory_order_relaxed );
+    _queueSpaceSignal.Release();
+
     _file = nullptr;
 
     // Signal that this thread is finished
     _plotFinishedSignal.Release();
 }
 
+//-----------------------------------------------------------
+bool DiskPlotWriter::WritePatchCommand( FileStream& file, const PlotWriteCommand& command )
+{
+    // Everything before the patch has completed by now, as tables wait for their writes
+    if( !file.Seek( (int64)command.offset, SeekOrigin::Begin ) )
+    {
+        _error = file.GetError();
+        return false;
+    }
+
+    if( !WriteBlocks( file, command.buffer, command.size ) )
+        return false;
+
+    // Patches are done once written, like tables. And we go back to the end of the last table.
+    if( !( file.IsAsync() ? file.WaitForWrites() : file.Flush() ) ||
+        !file.Seek( (int64)_position, SeekOrigin::Begin ) )
+    {
+        _error = file.GetError();
+        return false;
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------
+void DiskPlotWriter::WriteDigestFile()
+{
+    // Named after the final plot file
+    std::string path = _filePath;
+
+    if( path.size() > 4 && path.compare( path.size() - 4, 4, ".tmp" ) == 0 )
+        path.resize( path.size() - 4 );
+
+    path += BB_DIGEST_FILE_EXT;
+
+    // The plot itself is fine, so this is not a plot error
+    if( !PlotDigest::WriteDigestFile( path.c_str(), _regionOffsets, _regionSizes, _regionDigests ) )
+        Log::Error( "Warning: Failed to write plot digest file %s with error %d.", path.c_str(), errno );
+}
+
+//-----------------------------------------------------------
+bool DiskPlotWriter::WriteBlocks( FileStream& file, const byte* buffer, size_t size )
+{
+    if( size == 0 )
+        return true;
+
+    // With an async backend, this only queues the writes.
+    // We wait for them when the table is done, so that we can write
+    // the rest of a streamed table while its first blocks are in flight.
+    // Within the host's bandwidth budget, the blocks are queued in chunks, each when its time comes.
+    const size_t chunkSize = _coordinator && _coordinator->WriteBandwidth() ? BB_HOST_WRITE_CHUNK_SIZE : size;
+
+    for( size_t offset = 0; offset < size; offset += chunkSize )
+    {
+        const size_t chunk = std::min( chunkSize, size - offset );
+
+        if( _coordinator )
+            _coordinator->Throttle( chunk );
+
+        if( !file.WriteAsync( buffer + offset, chunk ) )
+        {
+            // Error occurred, stop writing.
+            _error = file.GetError();
+            return false;
+        }
+    }
+
+    if( _metrics )
+        _metrics->bytesWritten.fetch_add( size, std::memory_order_relaxed );
+
+    return true;
+}
+
 //-----------------------------------------------------------
 size_t DiskPlotWriter::AlignToBlockSize( size_t size )
 {
-    #if BB_BENCHMARK_MODE
+    if( _nullSink )
         return RoundUpToNextBoundary( size, 4096 );
-    #endif
 
     ASSERT( _file );
 
@@ -2,6 +2,35 @@
 #include "io/FileStream.h"
 #include "threading/Thread.h"
 #include "threading/Semaphore.h"
+#include "threading/SPSCQueue.h"
+
+// Write commands that can be queued to a plot writer
+#define BB_PLOT_WRITER_QUEUE_SIZE 64
+
+class PlotDigest;
+struct PlotMetrics;
+class HostCoordinator;
+
+// Called by the writer thread once a write command has been written, or has failed.
+// Commands still queued when writing fails are called back as failed as well.
+typedef void (*PlotWriteCallback)( void* userData, bool succeeded );
+
+enum class PlotWriteCommandType : uint32
+{
+    Table = 0,      // Whole table. Written at the end of the previous table.
+    StreamedTable,  // Table that is still being filled (see BeginStreamedTable()).
+    Patch,          // Block-aligned write at an explicit file offset.
+};
+
+struct PlotWriteCommand
+{
+    PlotWriteCommandType type;
+    const byte*          buffer;
+    size_t               size;          // Unused for streamed tables, their size is given when they end
+    uint64               offset;        // Patches only
+    PlotWriteCallback    callback;      // Optional
+    void*                userData;
+};
 
 /**
  * Handles writing the final plot to disk
@@ -31,22 +60,73 @@
 class DiskPlotWriter
 {
 public:
-    DiskPlotWriter();
+    // A null sink accepts plots and tables, but discards them without writing anything,
+    // and without starting its writer thread. Used to benchmark the plotter without the disk.
+    DiskPlotWriter( bool nullSink = false );
     ~DiskPlotWriter();
 
-    // Begins writing a new plot. Any previous plot must have finished before calling this
+    // Begins writing a new plot. Any previous plot must have finished before calling this.
+    // If the sizes of the 10 tables are predicted, the whole file is preallocated up front,
+    // so that the tables can be laid out contiguously. The prediction may only overestimate them,
+    // the file is truncated to its final size once written.
     bool BeginPlot( const char* plotFilePath, FileStream& file, const byte plotId[32],
-                    const byte* plotMemo, const uint16 plotMemoSize );
+                    const byte* plotMemo, const uint16 plotMemoSize, const size_t* predictedTableSizes = nullptr );
 
     // Submits and signals the writing thread to write a table
-    bool WriteTable( const void* buffer, size_t size );
+    bool WriteTable( const void* buffer, size_t size, PlotWriteCallback callback = nullptr, void* userData = nullptr );
 
     // Submits the table for writing, but does not actually write it to disk yet
-    bool SubmitTable( const void* buffer, size_t size );
+    bool SubmitTable( const void* buffer, size_t size, PlotWriteCallback callback = nullptr, void* userData = nullptr );
+
+    // Writes size bytes at the given file offset, once everything submitted before it has been written.
+    // The buffer, its size and the offset must be aligned to the block size.
+    // Must be submitted before the last table. The header is written last,
+    // with the table pointers, so any patch to it is overwritten.
+    bool WritePatch( const void* buffer, size_t size, uint64 offset,
+                     PlotWriteCallback callback = nullptr, void* userData = nullptr );
+
+    // Queues a write command without waiting. Returns false if the queue is full,
+    // or if the command can't be queued (ie. no plot has begun, or there was an error).
+    // The other submissions wait for room in the queue instead.
+    bool TrySubmit( const PlotWriteCommand& command, bool signal = true );
+
+    // Write commands queued, but not yet picked up by the writer thread.
+    inline uint32 QueuedCommands() const { return _queue.Count(); }
+
+    // Number of times a submission had to wait for room in the queue.
+    inline uint64 QueueStalls() const { return _queueStalls; }
+
+    // Begins writing a table whose buffer is still being filled.
+    // The writer thread writes its blocks as they are reported ready with StreamTableProgress,
+    // and the remainder once the table is ended with EndStreamedTable.
+    // Only one table may be streamed at a time.
+    bool BeginStreamedTable( const void* buffer, PlotWriteCallback callback = nullptr, void* userData = nullptr );
+
+    // Reports that the first readySize bytes of the streamed table are ready to be written.
+    // Can be called from any thread, and out of order.
+    void StreamTableProgress( size_t readySize );
+
+    // Ends the streamed table with its final size. All of it must be ready by now.
+    bool EndStreamedTable( size_t size );
 
     // Flush pending tables to write
     // bool FlushTables();
 
+    // Digests the plots as they are written, and writes each plot's digest to
+    // a file next to it, named after the plot, with BB_DIGEST_FILE_EXT appended.
+    // (See PlotDigest.) Must be called before beginning a plot.
+    void EnableDigest( uint threadCount );
+
+    // Publishes the bytes written and the queue depth here. May be null.
+    inline void SetMetrics( PlotMetrics* metrics ) { _metrics = metrics; }
+
+    // Takes turns writing tables with the other instances on the host, within their
+    // shared write bandwidth. May be null.
+    inline void SetHostCoordinator( HostCoordinator* coordinator ) { _coordinator = coordinator; }
+
+    // Format description written to the header of the next plots. kFormatDescription by default.
+    inline void SetFormatDescription( const char* description ) { _formatDescription = description; }
+
     // Returns true if there's no errors.
     // If there are any errors, call GetError() to obtain the file write error.
     bool WaitUntilFinishedWriting();
@@ -68,6 +148,12 @@ public:
 
     inline const std::string& FilePath() { return _filePath; }
 
+    // Returns true if the plot is being streamed to a plot receiver,
+    // which renames it once it's finished.
+    inline bool IsRemote() { return _remote; }
+
+    inline bool IsNullSink() const { return _nullSink; }
+
     // Number of tables written
     inline uint TablesWritten() { return _lastTableIndexWritten.load( std::memory_order_acquire ); }
 
@@ -76,22 +162,60 @@ private:
     void WriterThread();
     size_t AlignToBlockSize( size_t size );
 
-    struct TableBuffer
+    // Writes whole blocks, asynchronously if the file supports it.
+    // Returns false and sets the error if the write failed.
+    bool WriteBlocks( FileStream& file, const byte* buffer, size_t size );
+
+    // Writes the digest file of the plot that was just written
+    void WriteDigestFile();
+
+    // Blocks until there's room in the queue for the command
+    bool Submit( const PlotWriteCommand& command, bool signal );
+
+    // Writes a patch command, and returns to the current write position
+    bool WritePatchCommand( FileStream& file, const PlotWriteCommand& command );
+
+    struct StreamedTable
     {
-        const byte*  buffer;
-        size_t size;
+        std::atomic<size_t> readySize;      // Bytes ready to be written
+        std::atomic<bool>   ended;          // Set once size is the final size
+        size_t              size;
     };
 
+    static inline void CompleteCommand( const PlotWriteCommand& command, bool succeeded )
+    {
+        if( command.callback )
+            command.callback( command.userData, succeeded );
+    }
+
 private:
+    bool        _nullSink;                          // Discards the plots instead of writing them
     FileStream* _file              = nullptr;
     std::string _filePath;
+    std::string _formatDescription;
+    bool        _remote            = false;
     size_t      _headerSize        = 0;
     byte*       _headerBuffer      = nullptr;
     size_t      _position          = 0;             // Current write position
+    size_t      _reservedSize      = 0;             // Size preallocated for the file, if any
     uint64      _tablePointers[10] = { 0 };         // Pointers to the table begin position
-    TableBuffer _tablebuffers [10];                 // Table buffers passed to us for writing.
 
-    std::atomic<uint> _tableIndex             = 0;  // Next table index to write
+    SPSCQueue<PlotWriteCommand, BB_PLOT_WRITER_QUEUE_SIZE> _queue;  // Write commands submitted by the main thread
+    std::atomic<bool>   _producerWaiting   = false; // Set while the main thread waits for room in the queue
+    Semaphore           _queueSpaceSignal;          // Writer thread signals the main thread that it made room in the queue
+    uint64              _queueStalls       = 0;
+
+    StreamedTable       _streamedTables[10];        // Progress of streamed tables, by table index
+    uint                _streamTableIndex  = 0;     // Index of the table being streamed. (Owned by main thread.)
+
+    PlotDigest* _digest            = nullptr;       // Set if plots are digested as they are written
+    PlotMetrics* _metrics          = nullptr;
+    HostCoordinator* _coordinator  = nullptr;
+    uint64      _regionOffsets[11];                 // File offset and padded size of the header and tables. (Owned by writer thread.)
+    uint64      _regionSizes  [11];
+    byte        _regionDigests[11][32];
+
+    uint              _tableIndex             = 0;  // Tables submitted for the current plot. (Owned by main thread.)
     std::atomic<uint> _lastTableIndexWritten  = 10; // Index of the latest table that was fully written to disk. (Owned by writer thread.)
                                                     //  That is, index-1 is the index of the last table written.
                                                     //  We start it at 10 (all tables written), to denote that we have
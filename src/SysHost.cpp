@@ -1 +1,147 @@
-#include "SysHost.h"
\ No newline at end of file
+#include "SysHost.h"
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+// Cpus reserved for the I/O threads, and their node.
+// The count is published last, as the async logger's thread may already be running.
+static std::vector<uint> _ioCpus;
+static int               _ioNode = -1;
+static std::atomic<uint> _ioCpuCount( 0 );
+static std::atomic<uint> _nextIoCpu ( 0 );
+
+//-----------------------------------------------------------
+static bool IsIoCpu( uint cpuId )
+{
+    return std::find( _ioCpus.begin(), _ioCpus.end(), cpuId ) != _ioCpus.end();
+}
+
+//-----------------------------------------------------------
+uint SysHost::GetCpuAffinityOrder( uint* cpuIds )
+{
+    const CpuTopology& topo     = *GetCpuTopology();
+    const uint         cpuCount = GetLogicalCPUCount();
+
+    // Tier 0: Primary threads of performance cores (or of any core on non-hybrid CPUs)
+    // Tier 1: Primary threads of efficiency cores
+    // Tier 2+: SMT siblings, by their index in their core
+    uint maxTier = 1;
+    for( uint i = 0; i < topo.cpuCount; i++ )
+        maxTier = std::max( maxTier, topo.cpus[i].smtIndex + 1 );
+
+    uint count = 0;
+
+    for( uint tier = 0; tier <= maxTier; tier++ )
+    {
+        for( uint i = 0; i < cpuCount; i++ )
+        {
+            uint cpuTier = 0;
+
+            if( i < topo.cpuCount )
+            {
+                const CpuInfo& cpu = topo.cpus[i];
+
+                if( cpu.smtIndex > 0 )
+                    cpuTier = 1 + cpu.smtIndex;
+                else if( cpu.type == CpuCoreType::Efficiency )
+                    cpuTier = 1;
+            }
+
+            if( cpuTier == tier && !IsIoCpu( i ) )
+                cpuIds[count++] = i;
+        }
+    }
+
+    ASSERT( count == cpuCount - _ioCpus.size() );
+    return count;
+}
+
+//-----------------------------------------------------------
+bool SysHost::ReserveIoCores( uint coreCount, int node )
+{
+    ASSERT( coreCount > 0 );
+    ASSERT( _ioCpus.empty() );
+
+    const CpuTopology& topo     = *GetCpuTopology();
+    const NumaInfo*    numa     = GetNUMAInfo();
+    const uint         cpuCount = GetLogicalCPUCount();
+
+    ASSERT( !numa || node < (int)numa->nodeCount );
+
+    auto coreOf = [&]( uint cpuId ) {
+        return cpuId < topo.cpuCount ? topo.cpus[cpuId].coreId : topo.coreCount + cpuId;
+    };
+
+    std::vector<uint> cpus;
+
+    if( numa && node >= 0 )
+    {
+        const Span<uint>& nodeCpus = numa->cpuIds[node];
+        cpus.assign( nodeCpus.values, nodeCpus.values + nodeCpus.length );
+    }
+    else
+    {
+        for( uint i = 0; i < cpuCount; i++ )
+            cpus.push_back( i );
+    }
+
+    // The last cores are taken, so that the first ones, which the
+    // thread pools fill first, stay with them. SMT siblings go together.
+    std::vector<uint> cores;
+
+    for( auto cpu = cpus.rbegin(); cpu != cpus.rend() && cores.size() < coreCount; cpu++ )
+    {
+        if( std::find( cores.begin(), cores.end(), coreOf( *cpu ) ) == cores.end() )
+            cores.push_back( coreOf( *cpu ) );
+    }
+
+    if( cores.size() < coreCount )
+        return false;
+
+    std::vector<uint> ioCpus;
+
+    for( uint i = 0; i < cpuCount; i++ )
+    {
+        if( std::find( cores.begin(), cores.end(), coreOf( i ) ) != cores.end() )
+            ioCpus.push_back( i );
+    }
+
+    if( ioCpus.size() >= cpuCount )
+        return false;
+
+    _ioCpus = std::move( ioCpus );
+    _ioNode = numa ? NumaGetNodeFromCpu( *numa, _ioCpus[0] ) : -1;
+    _ioCpuCount.store( (uint)_ioCpus.size(), std::memory_order_release );
+
+    return true;
+}
+
+//-----------------------------------------------------------
+uint SysHost::GetIoCpuCount()
+{
+    return _ioCpuCount.load( std::memory_order_acquire );
+}
+
+//-----------------------------------------------------------
+int SysHost::GetIoNode()
+{
+    return _ioNode;
+}
+
+//-----------------------------------------------------------
+bool SysHost::SetCurrentThreadIoAffinity()
+{
+    const uint count = GetIoCpuCount();
+    if( count == 0 )
+        return false;
+
+    const uint i = _nextIoCpu.fetch_add( 1, std::memory_order_relaxed ) % count;
+    return SetCurrentThreadAffinityCpuId( _ioCpus[i] );
+}
+
+//-----------------------------------------------------------
+void SysHost::NumaAssignIoPages( void* ptr, size_t size )
+{
+    if( _ioNode >= 0 )
+        NumaAssignPages( ptr, size, (uint)_ioNode );
+}
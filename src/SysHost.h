@@ -12,6 +12,27 @@ enum class VProtect : uint
 };
 ImplementFlagOps( VProtect );
 
+/// The kind of pages backing a virtual memory allocation
+enum class PageBacking : uint
+{
+    Regular = 0,    // Regular system pages (usually 4 KiB)
+    Transparent,    // Regular pages, with transparent huge pages requested (Linux only)
+    Large,          // Explicit large pages (2 MiB on x86)
+    Huge            // Explicit huge pages  (1 GiB on x86)
+};
+
+//-----------------------------------------------------------
+inline const char* PageBackingToString( PageBacking backing )
+{
+    switch( backing )
+    {
+        case PageBacking::Transparent: return "transparent huge";
+        case PageBacking::Large      : return "2 MiB large";
+        case PageBacking::Huge       : return "1 GiB huge";
+        default                      : return "regular";
+    }
+}
+
 struct NumaInfo
 {
     uint        nodeCount;  // How many NUMA nodes in the system
@@ -23,6 +44,39 @@ struct NumaInfo
     #endif
 };
 
+/// Kind of core a logical CPU belongs to, on hybrid CPUs
+enum class CpuCoreType : uint8
+{
+    Unknown     = 0,    // Not a hybrid CPU, or we could not tell
+    Performance = 1,    // Big core (ie. Intel P-core, ARM big)
+    Efficiency  = 2     // Little core (ie. Intel E-core, ARM LITTLE)
+};
+
+struct CpuInfo
+{
+    uint        coreId;     // Physical core this CPU belongs to, in [0, coreCount)
+    uint        smtIndex;   // Index of this CPU among the SMT siblings of its core. 0 for the primary thread.
+    uint        l3Id;       // Last-level cache shared by this CPU, in [0, l3Count)
+    CpuCoreType type;
+};
+
+/// Scheduling class of a thread, on platforms that place threads on cores by their class
+/// instead of letting them be pinned (macOS)
+enum class ThreadQoS : uint
+{
+    Compute = 0,    // Thread pool workers and the plotter thread, on the performance cores
+    IO              // Plot writers, the plot mover and preparer, and the async logger
+};
+
+struct CpuTopology
+{
+    uint     cpuCount;      // Logical CPUs
+    uint     coreCount;     // Physical cores
+    uint     l3Count;       // Last-level caches
+    bool     isHybrid;      // Has both performance and efficiency cores
+    CpuInfo* cpus;          // Indexed by cpu id
+};
+
 class SysHost
 {
 public:
@@ -30,22 +84,49 @@ public:
     // Get the system page size in bytes
     static size_t GetPageSize();
 
-    // Get total physical system ram in bytes
+    // Get total physical system ram in bytes, or the memory limit of the process' container if lower
     static size_t GetTotalSystemMemory();
 
-    /// Gets the currently available (unused) system ram in bytes
+    /// Gets the currently available (unused) system ram in bytes, or what is left of the process' container limit if lower
     static size_t GetAvailableSystemMemory();
 
-    /// Get the total number of logical CPUs in the system
+    /// Get the total number of logical CPUs the process may run on.
+    /// A container's cpuset may allow fewer than the system has. Cpu ids are always 0 to this count - 1.
     static uint GetLogicalCPUCount();
 
+    /// Get the number of CPUs' worth of time the process may use, which a container's CPU quota
+    /// may limit below GetLogicalCPUCount(). Default thread counts should not be above it.
+    static uint GetCpuQuotaCount();
+
+    /// Get the number of logical CPUs of the performance cores, on hybrid CPUs whose threads can't be pinned,
+    /// so that a thread pool does not wait on the threads left on the efficiency cores (Apple Silicon).
+    /// Where threads are pinned to the performance cores first, all logical CPUs are returned.
+    static uint GetPerformanceCPUCount();
+
+    /// Gets the disk space available to us in the file system that holds the given path, in bytes.
+    /// Returns 0 if it could not be queried.
+    static uint64 GetFreeDiskSpace( const char* path );
+
     /// Create an allocation in the virtual memory space
     /// If initialize == true, then all pages are touched so that
     /// the pages are actually assigned.
     static void* VirtualAlloc( size_t size, bool initialize = false );
     
+    /// Create an allocation backed by pages bigger than the regular page size, if possible.
+    /// Page sizes are tried from maxBacking downwards, falling back finally to regular pages.
+    /// outBacking is set to the backing that was actually used, and
+    /// outSize to the size of the allocation, rounded up to its page size.
+    /// Explicit large page allocations are already faulted on Windows.
+    static void* VirtualAllocLargePages( size_t size, PageBacking maxBacking, PageBacking& outBacking, size_t& outSize );
+
     static void VirtualFree( void* ptr );
 
+    /// Release the physical pages of a range of an allocation, which stays allocated.
+    /// The pages are faulted again when they're touched, with undefined contents.
+    /// The range must be aligned to the allocation's page size.
+    /// Returns false if its pages could not be released (ex. explicit large pages on Windows).
+    static bool VirtualDiscard( void* ptr, size_t size );
+
     static bool VirtualProtect( void* ptr, size_t size, VProtect flags = VProtect::NoAccess );
 
     /// Set the processor affinity mask for the current process
@@ -57,6 +138,59 @@ public:
     /// Set the processor affinity mask to a specific cpu id for the current thread
     static bool   SetCurrentThreadAffinityCpuId( uint32 cpuId );
 
+    /// Restrict the process to a subset of the cpus it may run on, by their cpu ids, and its memory
+    /// to the NUMA nodes of those cpus. Cpu ids are then renumbered from 0 within the subset,
+    /// so this must be called before any thread is pinned, or any buffer is bound to a node.
+    /// Only the threads started afterwards, and the calling thread, are restricted.
+    /// Returns false if the platform does not support it.
+    static bool   RestrictCpus( const uint* cpuIds, uint count );
+
+    /// Allow the current thread to run on any cpu of the processor group of a cpu id, modulo the cpu count,
+    /// without pinning it. Windows runs threads within a single group of up to 64 cpus unless told otherwise,
+    /// so unpinned threads use this to spread over all of them. A no-op on other platforms.
+    static bool   SetCurrentThreadProcessorGroup( uint32 cpuId );
+
+    /// Set the scheduling class of the current thread. Threads are created in the Compute class.
+    /// Returns false if the platform does not schedule threads by class, where this is a no-op.
+    static bool   SetCurrentThreadQoS( ThreadQoS qos );
+
+    /// Get the physical core, SMT sibling, cache and core type of each logical cpu.
+    /// Never returns null: If the topology can't be queried, each cpu is reported
+    /// as its own core, sharing a single cache.
+    static const CpuTopology* GetCpuTopology();
+
+    /// Fills cpuIds with the GetLogicalCPUCount() cpu ids, in the order in which threads
+    /// should be pinned to them: The primary thread of each performance core first,
+    /// then the efficiency cores, and then the remaining SMT siblings.
+    /// Cpus in each of those tiers are kept in cpu id order.
+    /// The cpus reserved for I/O are left out. Returns how many cpu ids were written.
+    static uint GetCpuAffinityOrder( uint* cpuIds );
+
+    /// Reserve whole cores for the I/O threads: The plot writers, the plot mover and the async logger.
+    /// They are taken from the last cores of the given NUMA node, or of the process if node is negative.
+    /// Thread pools created afterwards don't pin their threads to them, so this is called once,
+    /// before any of them. Returns false if there are too few cores to reserve them,
+    /// and leave at least one to the thread pools.
+    static bool ReserveIoCores( uint coreCount, int node );
+
+    /// Number of cpus reserved for I/O, which is 0 unless ReserveIoCores() was called
+    static uint GetIoCpuCount();
+
+    /// NUMA node of the cpus reserved for I/O. Negative if none are reserved, or the system is not NUMA.
+    static int  GetIoNode();
+
+    /// Pin the current thread to the next of the cpus reserved for I/O, in turn.
+    /// Returns false if none are reserved.
+    static bool SetCurrentThreadIoAffinity();
+
+    /// Assign the pages of an I/O buffer to the node of the cpus reserved for I/O, if there is one.
+    /// NOTE: Pages must not yet be faulted.
+    static void NumaAssignIoPages( void* ptr, size_t size );
+
+    /// Get the NUMA node of the device that holds the given path.
+    /// Returns a negative value if it is not known.
+    static int  GetPathNumaNode( const char* path );
+
     /// Install a crash handler to dump stack traces upon crash
     static void InstallCrashHandler();
 
@@ -70,6 +204,15 @@ public:
     /// Assign memory pages to a NUMA node
     static void NumaAssignPages( void* ptr, size_t size, uint node );
 
+    /// Use the NUMA nodes that have memory but no cpus, such as CXL memory expanders, as a far memory tier.
+    /// Memory is then only interleaved across the other nodes, unless it's placed on the far tier.
+    /// Returns the number of far nodes. If there are none, nothing changes.
+    static uint EnableFarMemoryTier();
+
+    /// Interleave memory regions across the nodes of the far memory tier. Returns false if it's not enabled.
+    /// NOTE: Pages must not yet be faulted.
+    static bool NumaSetMemoryFarMode( void* ptr, size_t size );
+
     /// Set interleave NUMA mode for allocations in the calling thread
     static bool NumaSetThreadInterleavedMode();
 
@@ -82,4 +225,29 @@ public:
     /// NOTE: Pages must first be faulted on linuz.
     static int NumaGetNodeFromPage( void* ptr );
 
-};
\ No newline at end of file
+    /// Get the nodes a batch of memory pages belong to, without logging the pages that are not faulted yet.
+    /// Their node is set to a negative value. Returns false if the pages could not be queried.
+    static bool NumaGetNodesFromPages( void** pages, uint count, int* outNodes );
+
+    /// Get the node a cpu belongs to.
+    /// Returns a negative value if it does not belong to any node.
+    static int NumaGetNodeFromCpu( const NumaInfo& numa, uint cpuId );
+
+};
+
+//-----------------------------------------------------------
+inline int SysHost::NumaGetNodeFromCpu( const NumaInfo& numa, uint cpuId )
+{
+    for( uint node = 0; node < numa.nodeCount; node++ )
+    {
+        const Span<uint>& cpus = numa.cpuIds[node];
+
+        for( size_t i = 0; i < cpus.length; i++ )
+        {
+            if( cpus.values[i] == cpuId )
+                return (int)node;
+        }
+    }
+
+    return -1;
+}
\ No newline at end of file
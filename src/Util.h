@@ -80,6 +80,59 @@ inline T RoundUpToNextBoundary( T value, int boundary )
     return CeildDiv( value, (T)boundary );
 }
 
+// Index of the lowest set bit. x must not be 0.
+//-----------------------------------------------------------
+inline uint32 Ctz64( uint64 x )
+{
+    ASSERT( x );
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64( &index, x );
+    return (uint32)index;
+#else
+    return (uint32)__builtin_ctzll( x );
+#endif
+}
+
+// Number of set bits
+//-----------------------------------------------------------
+inline uint32 Popcnt64( uint64 x )
+{
+#ifdef _MSC_VER
+    return (uint32)__popcnt64( x );
+#else
+    return (uint32)__builtin_popcountll( x );
+#endif
+}
+
+// Test whether a bit is set in a bitfield of 64-bit words
+//-----------------------------------------------------------
+inline bool BitFieldGet( const uint64* bits, uint64 index )
+{
+    return ( bits[index >> 6] >> ( index & 63 ) ) & 1;
+}
+
+//-----------------------------------------------------------
+inline void BitFieldSet( uint64* bits, uint64 index )
+{
+    bits[index >> 6] |= 1ull << ( index & 63 );
+}
+
+// Hint to the CPU that we're in a spin-wait loop
+//-----------------------------------------------------------
+inline void CpuPause()
+{
+#if defined( _MSC_VER ) && ( defined( _M_X64 ) || defined( _M_IX86 ) )
+    _mm_pause();
+#elif defined( _MSC_VER ) && defined( _M_ARM64 )
+    __yield();
+#elif defined( __x86_64__ ) || defined( __i386__ )
+    __builtin_ia32_pause();
+#elif defined( __aarch64__ ) || defined( __arm__ )
+    __asm__ __volatile__( "yield" );
+#endif
+}
+
 const char HEX_TO_BIN[256] = {
     0,   // 0	00	NUL
     0,   // 1	01	SOH
@@ -0,0 +1,189 @@
+#pragma once
+#include "threading/ThreadPool.h"
+#include "Util.h"
+#include <cstring>
+#include <vector>
+
+/**
+ * Parallel scatter binned by destination range.
+ *
+ * Writing items to random destinations directly from many threads is latency-bound,
+ * and makes threads contend on the same cache lines. Instead, the items are scattered in two passes:
+ *  - Each thread produces the items of its own slice of the source, and bins them by destination.
+ *    There is one bin per thread, each covering a contiguous, aligned range of the destination.
+ *  - Each thread then writes the items of its own bin, which all fall within its own range,
+ *    so no two threads ever write to the same cache line (or bitfield word).
+ *
+ * The items are produced twice: once to count them per bin, and once to bin them.
+ *
+ * TProduce is called as produce( srcStart, srcEnd, emit ), and must call emit( dstIndex, item )
+ * for each item produced by the source entries in [srcStart, srcEnd).
+ * The items must be produced in the same order both times.
+ *
+ * TConsume is called as consume( items, count ) with the items of a bin, in the order they were produced,
+ * for each thread's slice of the source in order.
+ */
+class ParallelScatter
+{
+    template<typename TItem, typename TProduce, typename TConsume>
+    struct ScatterJob
+    {
+        const TProduce* produce;
+        const TConsume* consume;
+
+        uint64  srcStart;           // This thread's slice of the source
+        uint64  srcEnd;
+
+        uint    binCount;
+        uint64  dstPerBin;          // Range of the destination covered by each bin
+        uint64* counts;             // This thread's item count per bin
+        uint64* offsets;            // This thread's write offset per bin
+        TItem*  bins;               // Binned items, for all threads
+
+        // Used in the consume pass
+        uint64  binStart;           // Offset of this thread's bin
+        uint64  binLength;
+    };
+
+    // Counts or bins the items produced, depending on the pass
+    template<typename TItem, bool Fill>
+    struct Emitter
+    {
+        uint64* binCounters;
+        TItem*  bins;
+        uint64  dstPerBin;
+
+        //-----------------------------------------------------------
+        inline void operator()( const uint64 dstIndex, const TItem& item ) const
+        {
+            const uint64 bin = dstIndex / dstPerBin;
+
+            if constexpr ( Fill )
+                bins[binCounters[bin]++] = item;
+            else
+                binCounters[bin]++;
+        }
+    };
+
+public:
+    // Scatters the items produced by srcLength source entries to a destination of dstLength entries.
+    // Each bin covers a multiple of dstAlignment destination entries.
+    // bins must be able to hold all the items produced (maxItems).
+    template<typename TItem, typename TProduce, typename TConsume>
+    static void Scatter( ThreadPool& pool, uint threadCount,
+                         uint64 srcLength, uint64 dstLength, uint64 dstAlignment,
+                         TItem* bins, uint64 maxItems,
+                         const TProduce& produce, const TConsume& consume );
+
+    // Destination range covered by each bin
+    //-----------------------------------------------------------
+    inline static uint64 DstPerBin( uint threadCount, uint64 dstLength, uint64 dstAlignment )
+    {
+        return RoundUpToNextBoundary( CDiv( dstLength, (int)threadCount ), (int)dstAlignment );
+    }
+
+private:
+    template<typename TItem, typename TProduce, typename TConsume>
+    static void CountThread( ScatterJob<TItem, TProduce, TConsume>* job );
+
+    template<typename TItem, typename TProduce, typename TConsume>
+    static void FillThread( ScatterJob<TItem, TProduce, TConsume>* job );
+
+    template<typename TItem, typename TProduce, typename TConsume>
+    static void ConsumeThread( ScatterJob<TItem, TProduce, TConsume>* job );
+};
+
+//-----------------------------------------------------------
+template<typename TItem, typename TProduce, typename TConsume>
+inline void ParallelScatter::Scatter( ThreadPool& pool, uint threadCount,
+                                      uint64 srcLength, uint64 dstLength, uint64 dstAlignment,
+                                      TItem* bins, uint64 maxItems,
+                                      const TProduce& produce, const TConsume& consume )
+{
+    ASSERT( threadCount );
+    ASSERT( bins );
+
+    using Job = ScatterJob<TItem, TProduce, TConsume>;
+
+    const uint   binCount       = threadCount;
+    const uint64 dstPerBin      = DstPerBin( threadCount, dstLength, dstAlignment );
+    const uint64 srcPerThread   = srcLength / threadCount;
+
+    // A row of bins per thread
+    std::vector<uint64> counts ( (size_t)threadCount * binCount );
+    std::vector<uint64> offsets( (size_t)threadCount * binCount );
+
+    std::vector<Job> jobs( threadCount );
+
+    for( uint i = 0; i < threadCount; i++ )
+    {
+        auto& job = jobs[i];
+
+        job.produce   = &produce;
+        job.consume   = &consume;
+        job.srcStart  = i * srcPerThread;
+        job.srcEnd    = job.srcStart + srcPerThread;
+        job.binCount  = binCount;
+        job.dstPerBin = dstPerBin;
+        job.counts    = counts .data() + i * binCount;
+        job.offsets   = offsets.data() + i * binCount;
+        job.bins      = bins;
+    }
+
+    // Add trailing entries to the last job
+    jobs[threadCount-1].srcEnd = srcLength;
+
+    // 1st pass: Count how many items each thread will write to each bin
+    pool.RunJob( CountThread<TItem, TProduce, TConsume>, jobs.data(), threadCount );
+
+    // Lay out the bins contiguously, with each thread's portion of a bin after the previous thread's
+    uint64 offset = 0;
+
+    for( uint b = 0; b < binCount; b++ )
+    {
+        jobs[b].binStart = offset;
+
+        for( uint t = 0; t < threadCount; t++ )
+        {
+            offsets[t * binCount + b] = offset;
+            offset += counts[t * binCount + b];
+        }
+
+        jobs[b].binLength = offset - jobs[b].binStart;
+    }
+
+    FatalIf( offset > maxItems, "Parallel scatter produced more items than its bins can hold." );
+
+    // Bin the items
+    pool.RunJob( FillThread<TItem, TProduce, TConsume>, jobs.data(), threadCount );
+
+    // 2nd pass: Each thread writes the items of its own bin
+    pool.RunJob( ConsumeThread<TItem, TProduce, TConsume>, jobs.data(), threadCount );
+}
+
+//-----------------------------------------------------------
+template<typename TItem, typename TProduce, typename TConsume>
+inline void ParallelScatter::CountThread( ScatterJob<TItem, TProduce, TConsume>* job )
+{
+    memset( job->counts, 0, sizeof( uint64 ) * job->binCount );
+
+    const Emitter<TItem, false> emit = { job->counts, nullptr, job->dstPerBin };
+    (*job->produce)( job->srcStart, job->srcEnd, emit );
+}
+
+//-----------------------------------------------------------
+template<typename TItem, typename TProduce, typename TConsume>
+inline void ParallelScatter::FillThread( ScatterJob<TItem, TProduce, TConsume>* job )
+{
+    const Emitter<TItem, true> emit = { job->offsets, job->bins, job->dstPerBin };
+    (*job->produce)( job->srcStart, job->srcEnd, emit );
+}
+
+//-----------------------------------------------------------
+template<typename TItem, typename TProduce, typename TConsume>
+inline void ParallelScatter::ConsumeThread( ScatterJob<TItem, TProduce, TConsume>* job )
+{
+    // All the items in our bin fall within our own range of the destination
+    if( job->binLength )
+        (*job->consume)( job->bins + job->binStart, job->binLength );
+}
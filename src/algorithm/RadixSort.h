@@ -1,6 +1,25 @@
 #pragma once
 #include "threading/ThreadPool.h"
 #include <cstring>
+#include <algorithm>
+#include <type_traits>
+#include <vector>
+
+#if defined( __SSE2__ ) || defined( _M_X64 )
+    #include <emmintrin.h>
+#endif
+
+// Widest digit sorted per pass when sorting on a known key width.
+// The per-thread counts and prefix sums of a 2^11 radix take 32KiB, sized to stay in L2,
+// while keeping few enough scatter destinations per pass.
+#define RADIX_MAX_DIGIT_BITS 11
+
+// Size of the lines staged per bucket by the write-combining scatter
+#define RADIX_WC_LINE_SIZE 64
+
+// Write-combining is only worth it when each thread scatters at least
+// this many entries per bucket on average, so that most lines are written whole.
+#define RADIX_WC_MIN_BUCKET_ENTRIES 32
 
 class RadixSort256
 {
@@ -15,8 +34,10 @@ class RadixSort256
         std::atomic<uint>* finishedCount;
         std::atomic<uint>* releaseLock;
 
-        uint64* counts;             // Counts array for each thread
-        uint64* pfxSums;            // Prefix sums for each thread. We use a different buffers to avoid copying to tmp buffers.
+        SortJob* jobs;              // All of the sort's jobs
+
+        uint64* counts;             // Counts array for this thread. This is set by the thread itself, on its stack.
+        uint64* pfxSums;            // Prefix sums for this thread. We use a different buffers to avoid copying to tmp buffers.
 
         uint64 startIndex;          // Scan start index
         uint64 length;              // entry count in our scan region
@@ -49,13 +70,45 @@ public:
     template<uint32 ThreadCount>
     static void SortYWithKey( ThreadPool& pool, uint64* input, uint64* tmp, uint32* keyInput, uint32* keyTmp, uint64 length );
 
+    // Sorts on the low KeyBits bits of the input only, with digits of up to RADIX_MAX_DIGIT_BITS,
+    // so that fewer passes are needed than with 8-bit digits (ex. 6 instead of 8 for line points).
+    // The bits above KeyBits must be 0.
+    template<uint32 ThreadCount, uint32 KeyBits, typename T1>
+    static void SortBits( ThreadPool& pool, T1* input, T1* tmp, uint64 length );
+
+    template<uint32 ThreadCount, uint32 KeyBits, typename T1, typename TK>
+    static void SortBitsWithKey( ThreadPool& pool, T1* input, T1* tmp, TK* keyInput, TK* keyTmp, uint64 length );
+
 private:
 
-    template<uint32 ThreadCount, SortMode Mode, typename T1, typename TK, int MaxIter = sizeof( T1 )>
+    // #NOTE: With an odd MaxIter, the output is left in tmp, unless OutputToInput is set.
+    template<uint32 ThreadCount, SortMode Mode, typename T1, typename TK, int MaxIter = sizeof( T1 ), uint32 DigitBits = 8, bool OutputToInput = false>
     static void DoSort( ThreadPool& pool, T1* input, T1* tmp, TK* keyInput, TK* keyTmp, uint64 length );
 
-    template<typename T1, typename T2, bool IsKeyed, int MaxIter = 0>
+    template<typename T1, typename T2, bool IsKeyed, int MaxIter = 0, uint32 DigitBits = 8, bool OutputToInput = false>
     static void RadixSortThread( SortJob<T1,T2>* job );
+
+    // Stages an entry in its bucket's line, and flushes the line once it is full.
+    // Lines that are shared with another thread's (or bucket's) entries are written with regular stores,
+    // whole lines with non-temporal stores.
+    template<typename T>
+    static void WCWrite( T* dst, T* line, uint64 dstIdx, uint64 bucketEnd, T value );
+
+    // Writes out what's left of a bucket's line once all its entries have been staged
+    template<typename T>
+    static void WCFlush( T* dst, const T* line, uint64 bucketStart, uint64 bucketEnd );
+
+    static void StreamLine( void* dst, const void* src );
+
+    // Passes and digit width needed to sort KeyBits bits
+    template<uint32 KeyBits>
+    struct DigitsForBits
+    {
+        static_assert( KeyBits > 0 && KeyBits <= 64, "Invalid key bit count." );
+
+        static constexpr uint32 Passes = ( KeyBits + RADIX_MAX_DIGIT_BITS - 1 ) / RADIX_MAX_DIGIT_BITS;
+        static constexpr uint32 Bits   = ( KeyBits + Passes - 1 ) / Passes;
+    };
 };
 
 
@@ -88,24 +141,36 @@ inline void RadixSort256::SortYWithKey( ThreadPool& pool, uint64* input, uint64*
 }
 
 //-----------------------------------------------------------
-template<uint32 ThreadCount, RadixSort256::SortMode Mode, typename T1, typename TK, int MaxIter>
+template<uint32 ThreadCount, uint32 KeyBits, typename T1>
+inline void RadixSort256::SortBits( ThreadPool& pool, T1* input, T1* tmp, uint64 length )
+{
+    static_assert( KeyBits <= sizeof( T1 ) * 8 );
+    using Digits = DigitsForBits<KeyBits>;
+
+    DoSort<ThreadCount, ModeSingle, T1, void, Digits::Passes, Digits::Bits, true>( pool, input, tmp, nullptr, nullptr, length );
+}
+
+//-----------------------------------------------------------
+template<uint32 ThreadCount, uint32 KeyBits, typename T1, typename TK>
+inline void RadixSort256::SortBitsWithKey( ThreadPool& pool, T1* input, T1* tmp, TK* keyInput, TK* keyTmp, uint64 length )
+{
+    static_assert( KeyBits <= sizeof( T1 ) * 8 );
+    using Digits = DigitsForBits<KeyBits>;
+
+    DoSort<ThreadCount, SortAndGenKey, T1, TK, Digits::Passes, Digits::Bits, true>( pool, input, tmp, keyInput, keyTmp, length );
+}
+
+//-----------------------------------------------------------
+template<uint32 ThreadCount, RadixSort256::SortMode Mode, typename T1, typename TK, int MaxIter, uint32 DigitBits, bool OutputToInput>
 void inline RadixSort256::DoSort( ThreadPool& pool, T1* input, T1* tmp, TK* keyInput, TK* keyTmp, uint64 length )
 {
     const uint   threadCount      = ThreadCount > pool.ThreadCount() ? pool.ThreadCount() : ThreadCount;
     const uint64 entriesPerThread = length / threadCount;
     const uint64 trailingEntries  = length - ( entriesPerThread * threadCount ); 
-    
-    // #TODO: Make sure we have enough stack space for this.
-    //        Create a large stack, or allocate this on the heap...
-    //        In which case, make this an instance method and have preallocated buffers for the jobs too
-    //        Since we don't know the thread count ahead of time, maybe we should just make sure we allocate enough space for the jobs
-    //        and use an instance instead...
-    uint64 counts    [ThreadCount*256]; 
-    uint64 prefixSums[ThreadCount*256]; 
 
     std::atomic<uint> finishedCount = 0;
     std::atomic<uint> releaseLock   = 0;
-    SortJob<T1, TK> jobs[ThreadCount];
+    std::vector<SortJob<T1, TK>> jobs( threadCount );
     
     for( uint i = 0; i < threadCount; i++ )
     {
@@ -115,8 +180,9 @@ void inline RadixSort256::DoSort( ThreadPool& pool, T1* input, T1* tmp, TK* keyI
         job.threadCount   = threadCount;
         job.finishedCount = &finishedCount;
         job.releaseLock   = &releaseLock;
-        job.counts        = counts;
-        job.pfxSums       = prefixSums;
+        job.jobs          = jobs.data();
+        job.counts        = nullptr;
+        job.pfxSums       = nullptr;
         job.startIndex    = i * entriesPerThread;
         job.length        = entriesPerThread;
         job.input         = input;
@@ -129,22 +195,29 @@ void inline RadixSort256::DoSort( ThreadPool& pool, T1* input, T1* tmp, TK* keyI
     jobs[threadCount-1].length += trailingEntries;
     
     if constexpr ( Mode == SortAndGenKey )
-        pool.RunJob( RadixSortThread<T1, TK, true, MaxIter>, jobs, threadCount );
+        pool.RunJob( RadixSortThread<T1, TK, true, MaxIter, DigitBits, OutputToInput>, jobs.data(), threadCount );
     else
-        pool.RunJob( RadixSortThread<T1, TK, false, MaxIter>, jobs, threadCount );
+        pool.RunJob( RadixSortThread<T1, TK, false, MaxIter, DigitBits, OutputToInput>, jobs.data(), threadCount );
 }
 
 #pragma GCC diagnostic push 
 #pragma GCC diagnostic ignored "-Wunused-but-set-variable"
+#if defined( __GNUC__ ) && !defined( __clang__ ) && __GNUC__ >= 12
+    // The counts and prefix sums are shared through the job while they are on the thread's stack,
+    // but they're only read while the thread is waiting in the sort.
+    #pragma GCC diagnostic ignored "-Wdangling-pointer"
+#endif
 
 //-----------------------------------------------------------
-template<typename T1, typename T2, bool IsKeyed, int MaxIter>
+template<typename T1, typename T2, bool IsKeyed, int MaxIter, uint32 DigitBits, bool OutputToInput>
 void RadixSort256::RadixSortThread( SortJob<T1, T2>* job )
 {
-    constexpr uint Radix = 256;
+    constexpr uint   Radix = 1u << DigitBits;
+    constexpr uint64 Mask  = Radix - 1;
 
-    constexpr uint32 iterations = MaxIter > 0 ? MaxIter : sizeof( T1 );
-    const     uint32 shiftBase  = 8;
+    constexpr uint32 iterations = MaxIter > 0 ? MaxIter : ( sizeof( T1 ) * 8 + DigitBits - 1 ) / DigitBits;
+    constexpr bool   copyBack   = OutputToInput && ( iterations & 1 ) != 0;
+    const     uint32 shiftBase  = DigitBits;
     
     uint32 shift = 0;
 
@@ -153,8 +226,21 @@ void RadixSort256::RadixSortThread( SortJob<T1, T2>* job )
     std::atomic<uint>& finishedCount = *job->finishedCount;
     std::atomic<uint>& releaseLock   = *job->releaseLock;
 
-    uint64*      counts    = job->counts  + id * Radix;
-    uint64*      prefixSum = job->pfxSums + id * Radix;
+    uint64 counts   [Radix];
+    uint64 prefixSum[Radix];
+
+    // Write-combining buffers, one line per bucket
+    using TKey = std::conditional_t<IsKeyed, T2, byte>;
+
+    constexpr uint32 WCLineEntries    = RADIX_WC_LINE_SIZE / sizeof( T1 );
+    constexpr uint32 WCKeyLineEntries = RADIX_WC_LINE_SIZE / sizeof( TKey );
+
+    uint64 bucketEnds[Radix];
+    alignas( RADIX_WC_LINE_SIZE ) T1   wcLines   [Radix][WCLineEntries];
+    alignas( RADIX_WC_LINE_SIZE ) TKey wcKeyLines[IsKeyed ? Radix : 1][WCKeyLineEntries];
+
+    job->counts  = counts;
+    job->pfxSums = prefixSum;
     const uint64 length    = job->length;
     const uint64 offset    = job->startIndex;
     T1*          input     = job->input;
@@ -169,6 +255,8 @@ void RadixSort256::RadixSortThread( SortJob<T1, T2>* job )
         keyTmp   = job->keyTmp;
     }
 
+    const bool writeCombine = length >= (uint64)Radix * RADIX_WC_MIN_BUCKET_ENTRIES;
+
     for( uint32 iter = 0; iter < iterations ; iter++, shift += shiftBase )
     {
         // Zero-out the counts
@@ -184,7 +272,7 @@ void RadixSort256::RadixSortThread( SortJob<T1, T2>* job )
 
         // Store the occurrences of the current 'digit' 
         for( uint64 i = 0; i < length; i++ )
-            counts[(src[i] >> shift) & 0xFF]++;
+            counts[(src[i] >> shift) & Mask]++;
         
         // Synchronize with other threads to comput the correct prefix sum
         if( id == 0 )
@@ -194,12 +282,11 @@ void RadixSort256::RadixSortThread( SortJob<T1, T2>* job )
             // Wait for all threads to finish
             while( finishedCount.load( std::memory_order_relaxed ) != threadCount-1 );
 
-            uint64* allCounts  = job->counts;
-            uint64* allPfxSums = job->pfxSums;
+            SortJob<T1, T2>* jobs = job->jobs;
 
             // Use the last thread's prefix sum buffer as it will use
             // it does not require a second pass
-            uint64* prefixSumBuffer = allPfxSums + (threadCount - 1) * Radix;
+            uint64* prefixSumBuffer = jobs[threadCount - 1].pfxSums;
 
             // First sum all the counts. Start by copying ours to the last
             memcpy( prefixSumBuffer, counts, sizeof( uint64 ) * Radix );
@@ -207,7 +294,7 @@ void RadixSort256::RadixSortThread( SortJob<T1, T2>* job )
             // Now add the rest of the thread's counts
             for( uint i = 1; i < threadCount; i++ )
             {
-                uint64* tCounts = allCounts + i * Radix;
+                const uint64* tCounts = jobs[i].counts;
 
                 for( uint32 j = 0; j < Radix; j++ )
                     prefixSumBuffer[j] += tCounts[j];
@@ -218,22 +305,20 @@ void RadixSort256::RadixSortThread( SortJob<T1, T2>* job )
             // equivalent to the last thread's prefix sum
             for( uint32 j = 1; j < Radix; j++ )
                 prefixSumBuffer[j] += prefixSumBuffer[j-1];
-            
-            const uint64* nextThreadCountBuffer = allCounts + (threadCount - 1) * Radix;
 
             // Now assign the adjusted prefix sum to each thread below the last thread
             // NOTE: We are traveling backwards from the last thread
-            for( uint i = 1; i < threadCount; i++ )
+            for( uint i = threadCount - 1; i > 0; i-- )
             {
-                uint64* tPrefixSum = prefixSumBuffer - Radix;
+                uint64*       tPrefixSum            = jobs[i-1].pfxSums;
+                const uint64* nextThreadCountBuffer = jobs[i].counts;
 
                 // This thread's prefix sum is equal to the next thread's
                 // prefix sum minus the next thread's count
                 for( uint32 j = 0; j < Radix; j++ )
                     tPrefixSum[j] = prefixSumBuffer[j] - nextThreadCountBuffer[j];
 
-                prefixSumBuffer       = tPrefixSum;
-                nextThreadCountBuffer -= Radix;
+                prefixSumBuffer = tPrefixSum;
             }
 
             // Finished, init release lock & signal other threads
@@ -262,12 +347,45 @@ void RadixSort256::RadixSortThread( SortJob<T1, T2>* job )
         // This can cause false sharing, but given that our inputs are
         // extremely large, and the accesses are random, we don't expect
         // a lot of this to be happening.
-        for( uint64 i = length; i > 0; )
+        if( writeCombine )
+        {
+            // Stage the entries in per-bucket cache lines so that full lines
+            // are streamed to memory, instead of keeping Radix destinations open in the cache.
+            memcpy( bucketEnds, prefixSum, sizeof( uint64 ) * Radix );
+
+            for( uint64 i = length; i > 0; )
+            {
+                const T1 value = src[--i];
+
+                const uint64 idx    = (value >> shift) & Mask;
+                const uint64 dstIdx = --prefixSum[idx];
+
+                WCWrite( tmp, wcLines[idx], dstIdx, bucketEnds[idx], value );
+
+                if constexpr ( IsKeyed )
+                    WCWrite( keyTmp, wcKeyLines[idx], dstIdx, bucketEnds[idx], keySrc[i] );
+            }
+
+            for( uint32 b = 0; b < Radix; b++ )
+            {
+                WCFlush( tmp, wcLines[b], prefixSum[b], bucketEnds[b] );
+
+                if constexpr ( IsKeyed )
+                    WCFlush( keyTmp, wcKeyLines[b], prefixSum[b], bucketEnds[b] );
+            }
+
+            // Non-temporal stores are weakly ordered,
+            // make them visible before the other threads read our output
+            #if defined( __SSE2__ ) || defined( _M_X64 )
+                _mm_sfence();
+            #endif
+        }
+        else for( uint64 i = length; i > 0; )
         {
             // Read the value & prefix sum index
             const T1 value = src[--i];
 
-            const uint64 idx = (value >> shift) & 0xFF;
+            const uint64 idx = (value >> shift) & Mask;
 
             // Store it at the right location by reading the count
             const uint64 dstIdx = --prefixSum[idx];
@@ -291,7 +409,8 @@ void RadixSort256::RadixSortThread( SortJob<T1, T2>* job )
 
         // If not the last iteration, signal we've finished so we can
         // safely read from the arrays after swapped. (all threads must finish writing)
-        if( (iter+1) < iterations )
+        // When copying back the output, we also have to wait after the last one.
+        if( (iter+1) < iterations || copyBack )
         {
             if( id == 0 )
             {
@@ -319,8 +438,83 @@ void RadixSort256::RadixSortThread( SortJob<T1, T2>* job )
             }
         }
     }
+
+    // After an odd number of passes the sorted output is in the tmp buffer (now input).
+    // Copy our section back to the caller's input buffer.
+    if constexpr ( copyBack )
+    {
+        memcpy( tmp + offset, input + offset, sizeof( T1 ) * length );
+
+        if constexpr ( IsKeyed )
+            memcpy( keyTmp + offset, keyInput + offset, sizeof( T2 ) * length );
+    }
 }
 
 #pragma GCC diagnostic pop
 
+//-----------------------------------------------------------
+template<typename T>
+inline void RadixSort256::WCWrite( T* dst, T* line, uint64 dstIdx, uint64 bucketEnd, T value )
+{
+    constexpr uint64 LineEntries = RADIX_WC_LINE_SIZE / sizeof( T );
+
+    // Entries are written in descending order, so a line is complete once its first slot is written
+    const uint64 slot = ( (uintptr_t)( dst + dstIdx ) % RADIX_WC_LINE_SIZE ) / sizeof( T );
+    line[slot] = value;
+
+    if( slot == 0 )
+    {
+        if( dstIdx + LineEntries <= bucketEnd )
+            StreamLine( dst + dstIdx, line );
+        else
+            memcpy( dst + dstIdx, line, sizeof( T ) * ( bucketEnd - dstIdx ) );
+    }
+}
+
+//-----------------------------------------------------------
+template<typename T>
+inline void RadixSort256::WCFlush( T* dst, const T* line, uint64 bucketStart, uint64 bucketEnd )
+{
+    constexpr uint64 LineEntries = RADIX_WC_LINE_SIZE / sizeof( T );
+
+    if( bucketStart >= bucketEnd )
+        return;
+
+    // The first line of the bucket was only flushed if the bucket starts at a line boundary
+    const uint64 slot = ( (uintptr_t)( dst + bucketStart ) % RADIX_WC_LINE_SIZE ) / sizeof( T );
+    if( slot == 0 )
+        return;
+
+    const uint64 end = std::min( bucketStart + LineEntries - slot, bucketEnd );
+    memcpy( dst + bucketStart, line + slot, sizeof( T ) * ( end - bucketStart ) );
+}
+
+//-----------------------------------------------------------
+inline void RadixSort256::StreamLine( void* dst, const void* src )
+{
+    static_assert( RADIX_WC_LINE_SIZE == 64 );
+    ASSERT( ( (uintptr_t)dst & ( RADIX_WC_LINE_SIZE - 1 ) ) == 0 );
+
+#if defined( __SSE2__ ) || defined( _M_X64 )
+    const __m128i* s = (const __m128i*)src;
+          __m128i* d = (__m128i*)dst;
+
+    _mm_stream_si128( d + 0, _mm_load_si128( s + 0 ) );
+    _mm_stream_si128( d + 1, _mm_load_si128( s + 1 ) );
+    _mm_stream_si128( d + 2, _mm_load_si128( s + 2 ) );
+    _mm_stream_si128( d + 3, _mm_load_si128( s + 3 ) );
+#elif defined( __aarch64__ )
+    __asm__ volatile(
+        "ldp q0, q1, [%1]      \n"
+        "stnp q0, q1, [%0]     \n"
+        "ldp q0, q1, [%1, #32] \n"
+        "stnp q0, q1, [%0, #32]\n"
+        :
+        : "r"( dst ), "r"( src )
+        : "v0", "v1", "memory" );
+#else
+    memcpy( dst, src, RADIX_WC_LINE_SIZE );
+#endif
+}
+
 
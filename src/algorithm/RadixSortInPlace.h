@@ -0,0 +1,498 @@
+#pragma once
+#include "threading/ThreadPool.h"
+#include <cstring>
+#include <atomic>
+#include <algorithm>
+#include <type_traits>
+#include <vector>
+
+// Buckets of at most this many entries are insertion-sorted instead of being partitioned further
+#define RADIX_IN_PLACE_SMALL_SORT 32
+
+// The parallel partitioning rounds stop once fewer than this many entries
+// per thread are left misplaced, and the rest are placed by a single thread.
+#define RADIX_IN_PLACE_MIN_PARALLEL_ENTRIES ( 64ull * 1024 )
+
+/**
+ * In-place parallel MSD radix sort with 8-bit digits, which needs no temporary buffers.
+ *
+ * The top digit is partitioned by all threads in rounds (as in PARADIS): each bucket's
+ * misplaced region is split in stripes, one per thread, and each thread permutes its
+ * entries between its own stripes. The entries that don't fit are repaired to the
+ * end of their region, and are left for the next round.
+ * The top buckets are then sorted independently by the threads, American flag style.
+ *
+ * The sort is not stable. Equal values are ordered by their key instead, so the result
+ * matches a stable sort when the key is the entries' original index (ex. a generated sort key).
+ *
+ * Only the low KeyBits bits of the input are sorted on, the bits above them must be 0.
+ */
+class RadixSortInPlace
+{
+    static constexpr uint32 Radix = 256;
+
+    template<typename T1, typename TK>
+    struct SortJob
+    {
+        uint id;
+        uint threadCount;
+
+        T1*    input;
+        TK*    keyInput;
+        uint64 length;
+        uint32 shift;                       // Shift of the top digit
+        uint32 digitBits;                   // Bits of the top digit
+
+        // Counting
+        uint64 counts[Radix];
+
+        // Partitioning round: the thread's stripe of each bucket's misplaced region
+        uint64 stripeStart[Radix];
+        uint64 stripeHead [Radix];          // Entries before the head are placed
+        uint64 stripeTail [Radix];          // Entries from the tail on are misplaced
+
+        // Shared
+        uint64*             bucketHeads;    // Start of each bucket's region still misplaced
+        uint64*             bucketTails;    // End of each bucket's region
+        const uint64*       placed;         // Entries placed in each bucket by a round
+        std::atomic<uint>*  nextBucket;     // For distributing buckets between threads
+    };
+
+public:
+    template<uint32 ThreadCount, uint32 KeyBits, typename T1>
+    static void Sort( ThreadPool& pool, T1* input, uint64 length );
+
+    template<uint32 ThreadCount, uint32 KeyBits, typename T1, typename TK>
+    static void SortWithKey( ThreadPool& pool, T1* input, TK* keyInput, uint64 length );
+
+private:
+    template<uint32 ThreadCount, bool IsKeyed, typename T1, typename TK>
+    static void DoSort( ThreadPool& pool, uint32 keyBits, T1* input, TK* keyInput, uint64 length );
+
+    template<typename T1, typename TK>
+    static void CountThread( SortJob<T1, TK>* job );
+
+    template<bool IsKeyed, typename T1, typename TK>
+    static void PermuteThread( SortJob<T1, TK>* job );
+
+    template<bool IsKeyed, typename T1, typename TK>
+    static void RepairThread( SortJob<T1, TK>* job );
+
+    template<bool IsKeyed, typename T1, typename TK>
+    static void SortBucketsThread( SortJob<T1, TK>* job );
+
+    // Places the misplaced entries of all buckets with a single thread
+    template<bool IsKeyed, typename T1, typename TK>
+    static void Permute( T1* input, TK* keyInput, uint32 shift, uint64 mask, uint64* heads, const uint64* tails );
+
+    // Sorts a range on its low bitCount bits, with a single thread
+    template<bool IsKeyed, typename T1, typename TK>
+    static void SortRange( T1* input, TK* keyInput, uint64 length, uint32 bitCount );
+
+    template<bool IsKeyed, typename T1, typename TK>
+    static void InsertionSort( T1* input, TK* keyInput, uint64 length );
+
+    template<bool IsKeyed, typename T1, typename TK>
+    static inline void SwapEntry( T1* input, TK* keyInput, uint64 index, T1& value, TK& key )
+    {
+        std::swap( input[index], value );
+
+        if constexpr ( IsKeyed )
+            std::swap( keyInput[index], key );
+    }
+};
+
+
+//-----------------------------------------------------------
+template<uint32 ThreadCount, uint32 KeyBits, typename T1>
+inline void RadixSortInPlace::Sort( ThreadPool& pool, T1* input, uint64 length )
+{
+    static_assert( KeyBits > 0 && KeyBits <= sizeof( T1 ) * 8 );
+    DoSort<ThreadCount, false, T1, byte>( pool, KeyBits, input, nullptr, length );
+}
+
+//-----------------------------------------------------------
+template<uint32 ThreadCount, uint32 KeyBits, typename T1, typename TK>
+inline void RadixSortInPlace::SortWithKey( ThreadPool& pool, T1* input, TK* keyInput, uint64 length )
+{
+    static_assert( KeyBits > 0 && KeyBits <= sizeof( T1 ) * 8 );
+    DoSort<ThreadCount, true, T1, TK>( pool, KeyBits, input, keyInput, length );
+}
+
+//-----------------------------------------------------------
+template<uint32 ThreadCount, bool IsKeyed, typename T1, typename TK>
+inline void RadixSortInPlace::DoSort( ThreadPool& pool, uint32 keyBits, T1* input, TK* keyInput, uint64 length )
+{
+    const uint threadCount = ThreadCount > pool.ThreadCount() ? pool.ThreadCount() : ThreadCount;
+
+    if( length <= RADIX_IN_PLACE_SMALL_SORT || threadCount < 2 )
+    {
+        SortRange<IsKeyed>( input, keyInput, length, keyBits );
+        return;
+    }
+
+    const uint32 digitBits = std::min( keyBits, 8u );
+    const uint32 shift     = keyBits - digitBits;
+    const uint64 mask      = ( 1ull << digitBits ) - 1;
+
+    uint64 bucketHeads[Radix];
+    uint64 bucketTails[Radix];
+    uint64 placed     [Radix];
+
+    std::atomic<uint> nextBucket = 0;
+
+    std::vector<SortJob<T1, TK>> jobs( threadCount );
+
+    for( uint i = 0; i < threadCount; i++ )
+    {
+        auto& job = jobs[i];
+
+        job.id          = i;
+        job.threadCount = threadCount;
+        job.input       = input;
+        job.keyInput    = keyInput;
+        job.length      = length;
+        job.shift       = shift;
+        job.digitBits   = digitBits;
+        job.bucketHeads = bucketHeads;
+        job.bucketTails = bucketTails;
+        job.placed      = placed;
+        job.nextBucket  = &nextBucket;
+    }
+
+    // Count the top digit
+    pool.RunJob( CountThread<T1, TK>, jobs.data(), threadCount );
+
+    uint64 bucketStarts[Radix];
+    {
+        uint64 offset = 0;
+        for( uint32 b = 0; b < Radix; b++ )
+        {
+            uint64 count = 0;
+            for( uint i = 0; i < threadCount; i++ )
+                count += jobs[i].counts[b];
+
+            bucketStarts[b] = offset;
+            bucketHeads [b] = offset;
+
+            offset += count;
+            bucketTails[b] = offset;
+        }
+        ASSERT( offset == length );
+    }
+
+    // Partition on the top digit in rounds, until few enough entries are left misplaced
+    for( ;; )
+    {
+        uint64 remaining = 0;
+        for( uint32 b = 0; b < Radix; b++ )
+            remaining += bucketTails[b] - bucketHeads[b];
+
+        if( remaining < RADIX_IN_PLACE_MIN_PARALLEL_ENTRIES * threadCount )
+            break;
+
+        for( uint i = 0; i < threadCount; i++ )
+        {
+            auto& job = jobs[i];
+
+            for( uint32 b = 0; b < Radix; b++ )
+            {
+                const uint64 head = bucketHeads[b];
+                const uint64 size = bucketTails[b] - head;
+
+                job.stripeStart[b] = head + size * i       / threadCount;
+                job.stripeHead [b] = job.stripeStart[b];
+                job.stripeTail [b] = head + size * (i + 1) / threadCount;
+            }
+        }
+
+        pool.RunJob( PermuteThread<IsKeyed, T1, TK>, jobs.data(), threadCount );
+
+        uint64 totalPlaced = 0;
+        for( uint32 b = 0; b < Radix; b++ )
+        {
+            placed[b] = 0;
+            for( uint i = 0; i < threadCount; i++ )
+                placed[b] += jobs[i].stripeHead[b] - jobs[i].stripeStart[b];
+
+            totalPlaced += placed[b];
+        }
+
+        if( totalPlaced == 0 )
+            break;
+
+        nextBucket = 0;
+        pool.RunJob( RepairThread<IsKeyed, T1, TK>, jobs.data(), threadCount );
+
+        for( uint32 b = 0; b < Radix; b++ )
+            bucketHeads[b] += placed[b];
+    }
+
+    // Place what's left
+    Permute<IsKeyed>( input, keyInput, shift, mask, bucketHeads, bucketTails );
+
+    // Sort each bucket on the remaining digits
+    if( shift > 0 || IsKeyed )
+    {
+        for( uint32 b = 0; b < Radix; b++ )
+            bucketHeads[b] = bucketStarts[b];
+
+        nextBucket = 0;
+        pool.RunJob( SortBucketsThread<IsKeyed, T1, TK>, jobs.data(), threadCount );
+    }
+}
+
+//-----------------------------------------------------------
+template<typename T1, typename TK>
+inline void RadixSortInPlace::CountThread( SortJob<T1, TK>* job )
+{
+    const uint64 offset = job->length * job->id       / job->threadCount;
+    const uint64 end    = job->length * (job->id + 1) / job->threadCount;
+    const T1*    input  = job->input;
+    const uint32 shift  = job->shift;
+
+    uint64* counts = job->counts;
+    memset( counts, 0, sizeof( job->counts ) );
+
+    for( uint64 i = offset; i < end; i++ )
+        counts[(uint64)input[i] >> shift]++;
+}
+
+//-----------------------------------------------------------
+template<bool IsKeyed, typename T1, typename TK>
+inline void RadixSortInPlace::PermuteThread( SortJob<T1, TK>* job )
+{
+    T1*          input    = job->input;
+    TK*          keyInput = job->keyInput;
+    const uint32 shift    = job->shift;
+    const uint32 digits   = 1u << job->digitBits;
+
+    uint64* heads = job->stripeHead;
+    uint64* tails = job->stripeTail;
+
+    // Only our own stripes are accessed. When an entry's stripe is full,
+    // it is moved to the tail of the stripe being processed, and left misplaced.
+    for( uint32 i = 0; i < digits; i++ )
+    {
+        while( heads[i] < tails[i] )
+        {
+            const uint64 hole = heads[i];
+
+            T1 value = input[hole];
+            TK key;
+            if constexpr ( IsKeyed )
+                key = keyInput[hole];
+
+            for( ;; )
+            {
+                const uint32 k = (uint32)( (uint64)value >> shift );
+
+                if( k == i )
+                {
+                    input[hole] = value;
+                    if constexpr ( IsKeyed )
+                        keyInput[hole] = key;
+
+                    heads[i]++;
+                    break;
+                }
+
+                if( heads[k] < tails[k] )
+                {
+                    SwapEntry<IsKeyed>( input, keyInput, heads[k]++, value, key );
+                    continue;
+                }
+
+                // Target stripe is full
+                if( --tails[i] == hole )
+                {
+                    input[hole] = value;
+                    if constexpr ( IsKeyed )
+                        keyInput[hole] = key;
+
+                    break;
+                }
+
+                SwapEntry<IsKeyed>( input, keyInput, tails[i], value, key );
+            }
+        }
+    }
+}
+
+//-----------------------------------------------------------
+template<bool IsKeyed, typename T1, typename TK>
+inline void RadixSortInPlace::RepairThread( SortJob<T1, TK>* job )
+{
+    T1*          input    = job->input;
+    TK*          keyInput = job->keyInput;
+    const uint32 shift    = job->shift;
+    const uint32 digits   = 1u << job->digitBits;
+
+    std::atomic<uint>& nextBucket = *job->nextBucket;
+
+    // Move the entries placed in each bucket's stripes to the front of its region,
+    // so that its misplaced entries are left contiguous at the end.
+    for( uint32 b = nextBucket++; b < digits; b = nextBucket++ )
+    {
+        const uint64 head = job->bucketHeads[b];
+        const uint64 tail = job->bucketTails[b];
+        const uint64 mid  = head + job->placed[b];
+
+        uint64 i = head;
+        uint64 j = tail;
+
+        for( ;; )
+        {
+            while( i < mid && (uint32)( (uint64)input[i] >> shift ) == b )
+                i++;
+
+            while( j > mid && (uint32)( (uint64)input[j-1] >> shift ) != b )
+                j--;
+
+            if( i >= mid || j <= mid )
+                break;
+
+            --j;
+            std::swap( input[i], input[j] );
+            if constexpr ( IsKeyed )
+                std::swap( keyInput[i], keyInput[j] );
+            i++;
+        }
+
+        ASSERT( i >= mid && j <= mid );
+    }
+}
+
+//-----------------------------------------------------------
+template<bool IsKeyed, typename T1, typename TK>
+inline void RadixSortInPlace::SortBucketsThread( SortJob<T1, TK>* job )
+{
+    std::atomic<uint>& nextBucket = *job->nextBucket;
+    const uint32       digits     = 1u << job->digitBits;
+
+    for( uint32 b = nextBucket++; b < digits; b = nextBucket++ )
+    {
+        const uint64 start = job->bucketHeads[b];
+        const uint64 end   = job->bucketTails[b];
+
+        if( end - start > 1 )
+            SortRange<IsKeyed>( job->input + start, IsKeyed ? job->keyInput + start : nullptr, end - start, job->shift );
+    }
+}
+
+//-----------------------------------------------------------
+template<bool IsKeyed, typename T1, typename TK>
+inline void RadixSortInPlace::Permute( T1* input, TK* keyInput, uint32 shift, uint64 mask, uint64* heads, const uint64* tails )
+{
+    for( uint32 b = 0; b <= mask; b++ )
+    {
+        while( heads[b] < tails[b] )
+        {
+            const uint64 hole = heads[b];
+
+            T1 value = input[hole];
+            TK key;
+            if constexpr ( IsKeyed )
+                key = keyInput[hole];
+
+            for( uint32 k = (uint32)( ( (uint64)value >> shift ) & mask ); k != b; k = (uint32)( ( (uint64)value >> shift ) & mask ) )
+                SwapEntry<IsKeyed>( input, keyInput, heads[k]++, value, key );
+
+            input[hole] = value;
+            if constexpr ( IsKeyed )
+                keyInput[hole] = key;
+
+            heads[b]++;
+        }
+    }
+}
+
+//-----------------------------------------------------------
+template<bool IsKeyed, typename T1, typename TK>
+void RadixSortInPlace::SortRange( T1* input, TK* keyInput, uint64 length, uint32 bitCount )
+{
+    if( length <= RADIX_IN_PLACE_SMALL_SORT )
+    {
+        InsertionSort<IsKeyed>( input, keyInput, length );
+        return;
+    }
+
+    if( bitCount == 0 )
+    {
+        // All values are equal, order them by their key
+        if constexpr ( IsKeyed )
+            std::sort( keyInput, keyInput + length );
+        return;
+    }
+
+    const uint32 digitBits = std::min( bitCount, 8u );
+    const uint32 shift     = bitCount - digitBits;
+    const uint64 mask      = ( 1ull << digitBits ) - 1;
+
+    uint64 counts[Radix] = {};
+    for( uint64 i = 0; i < length; i++ )
+        counts[( (uint64)input[i] >> shift ) & mask]++;
+
+    uint64 heads[Radix];
+    uint64 tails[Radix];
+    {
+        uint64 offset = 0;
+        for( uint32 b = 0; b <= mask; b++ )
+        {
+            heads[b] = offset;
+            offset  += counts[b];
+            tails[b] = offset;
+        }
+    }
+
+    // Skip the permutation if all entries share this digit
+    if( counts[( (uint64)input[0] >> shift ) & mask] != length )
+        Permute<IsKeyed>( input, keyInput, shift, mask, heads, tails );
+
+    for( uint32 b = 0; b <= mask; b++ )
+    {
+        const uint64 start = tails[b] - counts[b];
+
+        if( counts[b] > 1 )
+            SortRange<IsKeyed>( input + start, IsKeyed ? keyInput + start : nullptr, counts[b], shift );
+    }
+}
+
+//-----------------------------------------------------------
+template<bool IsKeyed, typename T1, typename TK>
+inline void RadixSortInPlace::InsertionSort( T1* input, TK* keyInput, uint64 length )
+{
+    for( uint64 i = 1; i < length; i++ )
+    {
+        const T1 value = input[i];
+        TK       key;
+
+        if constexpr ( IsKeyed )
+            key = keyInput[i];
+
+        uint64 j = i;
+        for( ; j > 0; j-- )
+        {
+            const T1 prev = input[j-1];
+
+            if constexpr ( IsKeyed )
+            {
+                if( prev < value || ( prev == value && keyInput[j-1] <= key ) )
+                    break;
+
+                keyInput[j] = keyInput[j-1];
+            }
+            else
+            {
+                if( prev <= value )
+                    break;
+            }
+
+            input[j] = prev;
+        }
+
+        input[j] = value;
+        if constexpr ( IsKeyed )
+            keyInput[j] = key;
+    }
+}
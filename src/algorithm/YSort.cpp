@@ -1,36 +1,40 @@
 #include "YSort.h"
 #include "SysHost.h"
 #include "threading/ThreadPool.h"
+#include "threading/Barrier.h"
 #include "Util.h"
 #include "util/Log.h"
 #include "Config.h"
 #include "ChiaConsts.h"
+#include <vector>
 
 
+// Buckets distributed by the first pass of the sort
+#define Y_SORT_BUCKETS ( 1u << kExtraBits )
+
+// The low 32 bits of y are sorted within each bucket in 3 passes of up to 11-bit digits.
+// The per-thread counts and prefix sums of an 11-bit radix take 16KiB, which stays in L1/L2.
+#define Y_SORT_DIGIT_BITS 11
+#define Y_SORT_RADIX      ( 1u << Y_SORT_DIGIT_BITS )
+
 template<typename JobT>
 struct SortYBaseJob
 {
-    JobT* jobs;
+    JobT** jobs;        // Jobs of all the threads in this thread's group
 
-    std::atomic<uint>* finishedCount;
-    std::atomic<uint>* releaseLock;
+    Barrier* barrier;   // Barrier of this thread's group
 
-    // #TODO: Convert these to a pointer of pointers so that we don't have to
-    //        load to iterate on the job struct itself, which is really heavy,
-    //        and will load more data than we need in the cache.
     uint32* counts;    // Counts array for each thread. This is set by the thread itself
     void*   pfxSum;
 
-    uint    id;
-    uint    threadCount;
+    uint    id;             // Index of the thread within its group
+    uint    threadCount;    // Thread count of the group
 
 protected:
     template<uint Radix, typename TPrefix>
     void CalculatePrefixSum( uint id, uint32* counts, TPrefix* pfxSum );
 
     void SyncThreads();
-    void LockThreads();
-    void ReleaseThreads();
 
 };
 
@@ -43,12 +47,43 @@ struct SortYJob : SortYBaseJob<SortYJob>
 
     uint32* sortKey;
     uint32* sortKeyTmp;
-    
+
+    uint32  firstPassCounts[Y_SORT_BUCKETS];    // Entries this thread distributed into each bucket
+
+    // Digit counts and prefix sums of the bucket passes. They are read by the other threads
+    // of the group, so they're kept in the job rather than on the sorting thread's stack.
+    uint32  bucketCounts[Y_SORT_RADIX];
+    uint32  bucketPfxSum[Y_SORT_RADIX];
+
+    // Each bucket is sorted by a single group of threads.
+    // On NUMA systems, there is a group per node.
+    const uint32* bucketLengths;
+    const uint64* bucketOffsets;
+    const uint*   bucketGroups;
+    uint          group;
+
+    // When Packed, the entries are distributed as the low 32 bits of y above their index
+    template<bool HasSortKey, bool Packed = false>
+    static void FirstPassThread( SortYJob* job );
+
+    template<bool HasSortKey>
+    static void SortBucketsThread( SortYJob* job );
+
     template<bool HasSortKey>
-    static void SortYThread( SortYJob* job );
+    static void ExpandBucketsThread( SortYJob* job );
+
+    static void SortPackedBucketsThread( SortYJob* job );
 
 private:
-    template<bool HasSortKey, uint shift, typename YT>
+    // Sorts packed (y, index) entries on a digit of y.
+    // When Expand is set, y is unpacked and expanded with its bucket, and the index written to sortKey.
+    template<uint shift, uint bits, bool Expand>
+    void SortPackedBucket( const uint64 bucket, const uint offset, 
+                           const uint bucketOffset, const uint32 length, 
+                           uint32* counts, uint32* pfxSum,
+                           const uint64* input, uint64* tmp, uint32* sortKey );
+
+    template<bool HasSortKey, uint shift, uint bits, typename YT>
     void SortBucket( const uint64 bucket, const uint offset, 
                      const uint bucketOffset, const uint32 length, 
                      uint32* counts, uint32* pfxSum,
@@ -56,41 +91,12 @@ private:
                      uint32* sortKey, uint32* sortKeyTmp );
 };
 
-struct NumaSortJob
-{
-    uint id;
-    uint threadCount;
-    uint node;
-    uint nodeCount;
-    uint threadGroup;
-
-    uint pageCount;
-    uint pageStart;
-    uint trailers;
-
-    std::atomic<uint>* finishedCount;
-    std::atomic<uint>* releaseLock;
-
-    byte* pages;
-    byte* tmpPages;
-
-    byte* sortKeyPages;
-    byte* tmpSortKeyPages;
-
-    byte* countsPerPage;  // Count buffer, which is kept per page
-    
-    uint32* counts;       // Counts array for each thread.
-    uint64* pfxSum;       // Prefix sums for each thread. We use a different buffers to avoid copying to tmp buffers.
-};
-
 
 //-----------------------------------------------------------
-YSorter::YSorter( ThreadPool& pool )
+YSorter::YSorter( ThreadPool& pool, const NumaInfo* numa )
     : _pool( pool )
+    , _numa( numa && numa->nodeCount > 1 ? numa : nullptr )
 {
-    // const NumaInfo* numa = SysHost::GetNUMAInfo();
-    // if( !numa )
-    //     Fatal( "Cannot use NUMA y-sort on non-NUMA info." );
 }
 
 //-----------------------------------------------------------
@@ -115,10 +121,34 @@ void YSorter::Sort(
     DoSort( true, length, yBuffer, yTmp, sortKey, sortKeyTmp );
 }
 
+//-----------------------------------------------------------
+void YSorter::SortBucketed(
+        uint64 length, const uint32* bucketLengths,
+        uint64* yBuffer, uint64* yTmp,
+        uint32* sortKey, uint32* sortKeyTmp )
+{
+    ASSERT( bucketLengths );
+    ASSERT( sortKey && sortKeyTmp );
+    DoSort( true, length, yBuffer, yTmp, sortKey, sortKeyTmp, bucketLengths );
+}
+
+//-----------------------------------------------------------
+void YSorter::SortPacked( 
+        uint64 length, 
+        uint64* yBuffer, uint64* yTmp,
+        uint32* sortKey )
+{
+    ASSERT( sortKey );
+    ASSERT( length <= 0xFFFFFFFFull );
+    DoSort( false, length, yBuffer, yTmp, sortKey, nullptr, nullptr, true );
+}
+
 //-----------------------------------------------------------
 void YSorter::DoSort( bool useSortKey, uint64 length, 
                       uint64* yBuffer, uint64* yTmp,
-                      uint32* sortKey, uint32* sortKeyTmp )
+                      uint32* sortKey, uint32* sortKeyTmp,
+                      const uint32* bucketLengths,
+                      bool packed )
 {
     ASSERT( length );
     ASSERT( yBuffer && yTmp );
@@ -126,19 +156,18 @@ void YSorter::DoSort( bool useSortKey, uint64 length,
     ThreadPool& pool        = _pool;
     const uint  threadCount = pool.ThreadCount();
 
-    SortYJob jobs[MAX_THREADS];
+    std::vector<SortYJob>  jobs   ( threadCount );
+    std::vector<SortYJob*> jobPtrs( threadCount );
 
-    std::atomic<uint> finishedCount = 0;
-    std::atomic<uint> releaseLock   = 0;
+    // One barrier per NUMA node the threads are grouped by
+    std::vector<Barrier> groupBarriers( pool.NodeCount() );
 
-    for( uint i = 0; i < MAX_THREADS; i++ )
+    for( uint i = 0; i < threadCount; i++ )
     {
         SortYJob& job = jobs[i];
 
-        job.jobs          = jobs;
-        job.finishedCount = &finishedCount;
-        job.releaseLock   = &releaseLock;
-        job.length        = length;
+        job.jobs          = jobPtrs.data();
+        job.barrier       = &groupBarriers[0];
         job.counts        = nullptr;
         job.pfxSum        = nullptr;
         job.id            = i;
@@ -146,23 +175,133 @@ void YSorter::DoSort( bool useSortKey, uint64 length,
         job.length        = length;
         job.input         = yBuffer;
         job.tmp           = yTmp;
+        job.group         = 0;
         
         job.sortKey       = sortKey;
         job.sortKeyTmp    = sortKeyTmp;
+
+        jobPtrs[i] = &job;
+    }
+
+    groupBarriers[0].Init( threadCount );
+
+    // Distribute the entries into buckets by the bits above their low 32 bits.
+    // This is the only pass that needs to move entries accross the whole buffer.
+    uint32 lengths[Y_SORT_BUCKETS];
+
+    if( bucketLengths )
+    {
+        memcpy( lengths, bucketLengths, sizeof( lengths ) );
+    }
+    else
+    {
+        if( packed )
+            pool.RunJob( SortYJob::FirstPassThread<false, true>, jobs.data(), threadCount );
+        else if( useSortKey )
+            pool.RunJob( SortYJob::FirstPassThread<true>, jobs.data(), threadCount );
+        else
+            pool.RunJob( SortYJob::FirstPassThread<false>, jobs.data(), threadCount );
+
+        memset( lengths, 0, sizeof( lengths ) );
+
+        for( uint i = 0; i < threadCount; i++ )
+            for( uint b = 0; b < Y_SORT_BUCKETS; b++ )
+                lengths[b] += jobs[i].firstPassCounts[b];
+    }
+
+    // On NUMA systems, the threads of each node sort the buckets that lie
+    // within the slices of the buffers owned by them, synchronizing only with each other.
+    // The buffers are placed on the nodes of the threads that own each slice
+    // when NUMA first-touch placement is used.
+    uint groupCount = 1;
+
+    if( _numa && pool.NodeCount() > 1 )
+    {
+        groupCount = pool.NodeCount();
+
+        std::vector<uint> groupSizes ( groupCount );
+        std::vector<uint> groupStarts( groupCount );
+
+        for( uint i = 0; i < threadCount; i++ )
+        {
+            jobs[i].group = pool.ThreadNode( i );
+            jobs[i].id    = groupSizes[jobs[i].group]++;
+        }
+
+        uint start = 0;
+        for( uint g = 0; g < groupCount; g++ )
+        {
+            groupStarts[g] = start;
+            start += groupSizes[g];
+
+            if( groupSizes[g] )
+                groupBarriers[g].Init( groupSizes[g] );
+        }
+
+        for( uint i = 0; i < threadCount; i++ )
+        {
+            SortYJob& job = jobs[i];
+
+            job.jobs          = jobPtrs.data() + groupStarts[job.group];
+            job.threadCount   = groupSizes[job.group];
+            job.barrier       = &groupBarriers[job.group];
+
+            job.jobs[job.id] = &job;
+        }
+    }
+
+    uint64 bucketOffsets[Y_SORT_BUCKETS];
+    uint   bucketGroups [Y_SORT_BUCKETS];
+    {
+        const uint64 entriesPerThread = std::max( length / threadCount, (uint64)1 );
+
+        uint64 offset = 0;
+        for( uint b = 0; b < Y_SORT_BUCKETS; b++ )
+        {
+            bucketOffsets[b] = offset;
+
+            // Assign the bucket to the group of the thread owning its middle entry
+            const uint owner = (uint)std::min( ( offset + lengths[b] / 2 ) / entriesPerThread, (uint64)threadCount - 1 );
+            bucketGroups[b] = jobs[owner].group;
+
+            offset += lengths[b];
+        }
+        ASSERT( offset == length );
     }
 
-    if( useSortKey )
-        pool.RunJob( SortYJob::SortYThread<true>, jobs, threadCount );
+    for( uint i = 0; i < threadCount; i++ )
+    {
+        jobs[i].bucketLengths = lengths;
+        jobs[i].bucketOffsets = bucketOffsets;
+        jobs[i].bucketGroups  = bucketGroups;
+    }
+
+    // Radix sort each bucket, then expand it back to 64-bit entries.
+    // #NOTE: The expansion has to wait until all buckets have been sorted,
+    //        as the expanded entries overwrite the 32-bit entries of the buckets after them.
+    //        Packed entries are already 64-bit, so each bucket is sorted and expanded at once.
+    if( packed )
+    {
+        pool.RunJob( SortYJob::SortPackedBucketsThread, jobs.data(), threadCount );
+    }
+    else if( useSortKey )
+    {
+        pool.RunJob( SortYJob::SortBucketsThread<true>  , jobs.data(), threadCount );
+        pool.RunJob( SortYJob::ExpandBucketsThread<true>, jobs.data(), threadCount );
+    }
     else
-        pool.RunJob( SortYJob::SortYThread<false>, jobs, threadCount );
+    {
+        pool.RunJob( SortYJob::SortBucketsThread<false>  , jobs.data(), threadCount );
+        pool.RunJob( SortYJob::ExpandBucketsThread<false>, jobs.data(), threadCount );
+    }
 }
 
 //-----------------------------------------------------------
-template<bool HasSortKey>
-void SortYJob::SortYThread( SortYJob* job )
+template<bool HasSortKey, bool Packed>
+void SortYJob::FirstPassThread( SortYJob* job )
 {
     constexpr uint Radix    = 256;
-    constexpr uint Buckets  = (1u << kExtraBits);
+    constexpr uint Buckets  = Y_SORT_BUCKETS;
 
     const uint id          = job->id;
     const uint threadCount = job->threadCount;
@@ -178,137 +317,204 @@ void SortYJob::SortYThread( SortYJob* job )
 
     // Sort the last most significant byte first, yielding 256 buckets and
     // stripping out that byte, leaving us with a 32-bit element size for the radix sort.
+    uint64 pfxSum[Buckets];
+
+    memset( counts, 0, sizeof( counts ) );
+    memset( pfxSum, 0, sizeof( pfxSum ) );
+
+          uint64 length = job->length / threadCount;
+    const uint64 offset = length * id;
+
+    if( id == threadCount - 1 )
+        length += job->length - ( length * threadCount );
+
+          uint64* src = input + offset;
+    const uint64* end = src   + length;
+
+    uint32* sortKeySrc;
+    if constexpr ( HasSortKey )
+        sortKeySrc = sortKey + offset;
+
+    // Get counts
+#if !Y_SORT_BLOCK_MODE
+    do { counts[*src >> 32]++; } 
+    while( ++src < end );
+#else
+    const uint64  numBlocks = length / 8;
+    const uint64* blockEnd  = src + numBlocks * 8;
+    do
     {
-        uint64 pfxSum[Buckets];
+        counts[src[0] >> 32]++;
+        counts[src[1] >> 32]++;
+        counts[src[2] >> 32]++;
+        counts[src[3] >> 32]++;
+
+        counts[src[4] >> 32]++;
+        counts[src[5] >> 32]++;
+        counts[src[6] >> 32]++;
+        counts[src[7] >> 32]++;
+        
+        src += 8;
+    } while( src < blockEnd );
+    
+    while( src < end )
+        counts[*src++ >> 32]++;
+#endif
 
-        memset( counts, 0, sizeof( counts ) );
-        memset( pfxSum, 0, sizeof( pfxSum ) );
+    memcpy( job->firstPassCounts, counts, sizeof( job->firstPassCounts ) );
 
-              uint64 length = job->length / threadCount;
-        const uint64 offset = length * id;
+    // Get prefix sum
+    job->pfxSum = pfxSum;
+    job->CalculatePrefixSum<Buckets>( id, counts, pfxSum );
 
-        if( id == threadCount - 1 )
-            length += job->length - ( length * threadCount );
+    // Sort into buckets
+    src = input + offset;
+    uint32* tmp32 = (uint32*)tmp;
+    // do
+    for( uint64 i = length; i > 0; )
+    {
+        const uint64 value  = src[--i]; //*src;
+        const byte   bucket = (byte)( value >> 32 );
 
-              uint64* src = input + offset;
-        const uint64* end = src   + length;
+        const uint64 idx = --pfxSum[bucket];
 
-        uint32* sortKeySrc;
-        if constexpr ( HasSortKey )
-            sortKeySrc = sortKey + offset;
-
-        // Get counts
-    #if !Y_SORT_BLOCK_MODE
-        do { counts[*src >> 32]++; } 
-        while( ++src < end );
-    #else
-        const uint64  numBlocks = length / 8;
-        const uint64* blockEnd  = src + numBlocks * 8;
-        do
+        if constexpr ( Packed )
         {
-            counts[src[0] >> 32]++;
-            counts[src[1] >> 32]++;
-            counts[src[2] >> 32]++;
-            counts[src[3] >> 32]++;
-
-            counts[src[4] >> 32]++;
-            counts[src[5] >> 32]++;
-            counts[src[6] >> 32]++;
-            counts[src[7] >> 32]++;
-            
-            src += 8;
-        } while( src < blockEnd );
-        
-        while( src < end )
-            counts[*src++ >> 32]++;
-    #endif
-
-        // Get prefix sum
-        job->pfxSum = pfxSum;
-        job->CalculatePrefixSum<Buckets>( id, counts, pfxSum );
-
-        // Sort into buckets
-        src = input + offset;
-        uint32* tmp32 = (uint32*)tmp;
-        // do
-        for( uint64 i = length; i > 0; )
+            tmp[idx] = ( value << 32 ) | ( offset + i );
+        }
+        else
         {
-            const uint64 value  = src[--i]; //*src;
-            const byte   bucket = (byte)( value >> 32 );
-
-            const uint64 idx = --pfxSum[bucket];
             tmp32[idx] = (uint32)value;
 
             if constexpr ( HasSortKey )
                 sortKeyTmp[idx] = sortKeySrc[i];
         }
-        // } while( ++src < end );
+    }
+    // } while( ++src < end );
+}
 
-        std::swap( input, tmp );
+//-----------------------------------------------------------
+template<bool HasSortKey>
+void SortYJob::SortBucketsThread( SortYJob* job )
+{
+    const uint id          = job->id;
+    const uint threadCount = job->threadCount;
 
-        if constexpr ( HasSortKey )
-            std::swap( sortKey, sortKeyTmp );
-    }
+    // The first pass wrote the 32-bit entries to the lower half of tmp, and their keys to sortKeyTmp.
+    // With only 2 passes before the expansion, the 32-bit entries and keys are ping-ponged
+    // through the unused upper halves of the 64-bit buffers, so that the expansion
+    // still ends up in tmp and sortKeyTmp.
+    const uint64 entryCount = job->length;
+
+    uint32* yLo     = (uint32*)job->tmp;
+    uint32* yHi     = (uint32*)job->tmp + entryCount;
+    uint32* yOut    = (uint32*)job->input;
+    uint32* keyLo   = job->sortKeyTmp;
+    uint32* keyHi   = (uint32*)job->input + entryCount;
+    uint32* keyOut  = job->sortKey;
+
+    // Now do a radix sort on the lower digits of each 32-bit entry stored in each bucket.
+    uint32* counts = job->bucketCounts;
+    uint32* pfxSum = job->bucketPfxSum;
+    job->counts = counts;
+    job->pfxSum = pfxSum;
 
-    // Get lengths for each bucket
+    for( uint bucket = 0; bucket < Y_SORT_BUCKETS; bucket++ )
     {
-        SortYJob* jobs = job->jobs;
+        if( job->bucketGroups[bucket] != job->group )
+            continue;
 
-        uint bucketLengths[Buckets];
-        memset( bucketLengths, 0, sizeof( bucketLengths ) );
+        const uint bucketOffset = (uint)job->bucketOffsets[bucket];
+        const uint bucketLength = job->bucketLengths[bucket];
 
-        for( uint i = 0; i < threadCount; i++ )
-        {
-            const uint32* tCounts = jobs[i].counts;
+        uint       length = bucketLength / threadCount;
+        const uint offset = bucketOffset + length * id;
 
-            for( uint j = 0; j < Buckets; j++ )
-                bucketLengths[j] += tCounts[j];
-        }
+        // Add the remainder if we're the last thread
+        if( id == threadCount-1 )
+            length += bucketLength - (threadCount * length);
 
-        // Ensure all threads have finished writing to tmp
-        job->SyncThreads();
+        job->SortBucket<HasSortKey, 0                , Y_SORT_DIGIT_BITS>( bucket, offset, bucketOffset, length, counts, pfxSum, yLo, yHi , keyLo, keyHi  );
+        job->SortBucket<HasSortKey, Y_SORT_DIGIT_BITS, Y_SORT_DIGIT_BITS>( bucket, offset, bucketOffset, length, counts, pfxSum, yHi, yOut, keyHi, keyOut );
+    }
+}
 
+//-----------------------------------------------------------
+template<bool HasSortKey>
+void SortYJob::ExpandBucketsThread( SortYJob* job )
+{
+    constexpr uint ShiftLast = Y_SORT_DIGIT_BITS * 2;
+
+    const uint id          = job->id;
+    const uint threadCount = job->threadCount;
 
-        // Now do a radix sort on the 3/4 bytes for each 32-bit entries stored in each bucket.
-        uint pfxSum[Radix];
-        job->pfxSum = pfxSum;
+    uint32* ySrc   = (uint32*)job->input;
+    uint64* yDst   = job->tmp;
+    uint32* keySrc = job->sortKey;
+    uint32* keyDst = job->sortKeyTmp;
 
-        uint bucketOffset = 0;
-        for( uint bucket = 0; bucket < Buckets; bucket++ )
-        {
-            uint       length = bucketLengths[bucket] / threadCount;
-            const uint offset = bucketOffset + length * id;
+    uint32* counts = job->bucketCounts;
+    uint32* pfxSum = job->bucketPfxSum;
+    job->counts = counts;
+    job->pfxSum = pfxSum;
 
-            // Add the remainder if we're the last thread
-            if( id == threadCount-1 )
-                length += bucketLengths[bucket] - (threadCount * length);
+    // Now do a final expansion sort for the most significant digit of the 32-bit entries.
+    for( uint bucket = 0; bucket < Y_SORT_BUCKETS; bucket++ )
+    {
+        if( job->bucketGroups[bucket] != job->group )
+            continue;
 
-            job->SortBucket<HasSortKey, 0 >( bucket, offset, bucketOffset, length, counts, pfxSum, (uint32*)input, (uint32*)tmp  , sortKey,    sortKeyTmp );
-            job->SortBucket<HasSortKey, 8 >( bucket, offset, bucketOffset, length, counts, pfxSum, (uint32*)tmp  , (uint32*)input, sortKeyTmp, sortKey    );
-            job->SortBucket<HasSortKey, 16>( bucket, offset, bucketOffset, length, counts, pfxSum, (uint32*)input, (uint32*)tmp  , sortKey,    sortKeyTmp );
+        const uint bucketOffset = (uint)job->bucketOffsets[bucket];
+        const uint bucketLength = job->bucketLengths[bucket];
 
-            bucketOffset += bucketLengths[bucket];
-        }
+        uint       length = bucketLength / threadCount;
+        const uint offset = bucketOffset + length * id;
 
-        // Now do a final expansion sort for the MSB of the 32-bit entries.
-        // NOTE: This has to be done as a last step, because if we do it within each
-        //       bucket in the previous step, we would overwrite adjacent buckets during the expansion.
+        // Add the remainder if we're the last thread
+        if( id == threadCount-1 )
+            length += bucketLength - (threadCount * length);
 
-        bucketOffset = 0;
+        job->SortBucket<HasSortKey, ShiftLast, 32 - ShiftLast>( ((uint64)bucket) << 32, offset, bucketOffset, length, counts, pfxSum, ySrc, yDst, keySrc, keyDst );
+    }
+}
 
-        for( uint bucket = 0; bucket < Buckets; bucket++ )
-        {
-            uint       length = bucketLengths[bucket] / threadCount;
-            const uint offset = bucketOffset + length * id;
+//-----------------------------------------------------------
+void SortYJob::SortPackedBucketsThread( SortYJob* job )
+{
+    constexpr uint ShiftLast = 32 + Y_SORT_DIGIT_BITS * 2;
 
-            // Add the remainder if we're the last thread
-            if( id == threadCount-1 )
-                length += bucketLengths[bucket] - (threadCount * length);
+    const uint id          = job->id;
+    const uint threadCount = job->threadCount;
 
-            job->SortBucket<HasSortKey, 24>( ((uint64)bucket) << 32, offset, bucketOffset, length, counts, pfxSum, (uint32*)tmp, input, sortKeyTmp, sortKey );
+    // The first pass wrote the packed entries to tmp.
+    // They are ping-ponged through input, and the last pass unpacks them back into input.
+    uint64* input   = job->input;
+    uint64* tmp     = job->tmp;
+    uint32* sortKey = job->sortKey;
 
-            bucketOffset += bucketLengths[bucket];
-        }
+    uint32* counts = job->bucketCounts;
+    uint32* pfxSum = job->bucketPfxSum;
+    job->counts = counts;
+    job->pfxSum = pfxSum;
+
+    for( uint bucket = 0; bucket < Y_SORT_BUCKETS; bucket++ )
+    {
+        if( job->bucketGroups[bucket] != job->group )
+            continue;
+
+        const uint bucketOffset = (uint)job->bucketOffsets[bucket];
+        const uint bucketLength = job->bucketLengths[bucket];
+
+        uint       length = bucketLength / threadCount;
+        const uint offset = bucketOffset + length * id;
+
+        // Add the remainder if we're the last thread
+        if( id == threadCount-1 )
+            length += bucketLength - (threadCount * length);
+
+        job->SortPackedBucket<32                    , Y_SORT_DIGIT_BITS, false>( 0, offset, bucketOffset, length, counts, pfxSum, tmp  , input, nullptr );
+        job->SortPackedBucket<32 + Y_SORT_DIGIT_BITS, Y_SORT_DIGIT_BITS, false>( 0, offset, bucketOffset, length, counts, pfxSum, input, tmp  , nullptr );
+        job->SortPackedBucket<ShiftLast, 64 - ShiftLast, true>( ((uint64)bucket) << 32, offset, bucketOffset, length, counts, pfxSum, tmp, input, sortKey );
     }
 }
 
@@ -316,14 +522,59 @@ void SortYJob::SortYThread( SortYJob* job )
 #pragma GCC diagnostic ignored "-Wattributes"
 
 //-----------------------------------------------------------
-template<bool HasSortKey, uint shift, typename YT>
+template<uint shift, uint bits, bool Expand>
+FORCE_INLINE void SortYJob::SortPackedBucket( const uint64 bucket, const uint offset,
+                                              const uint bucketOffset, const uint32 length, 
+                                              uint32* counts, uint32* pfxSum,
+                                              const uint64* input, uint64* tmp, uint32* sortKey )
+{
+    constexpr uint   Radix = 1u << bits;
+    constexpr uint32 Mask  = Radix - 1;
+    static_assert( Radix <= Y_SORT_RADIX, "Radix too large for the counts buffer." );
+
+    const uint64* src = input + offset;
+
+    // Get counts
+    memset( counts, 0, sizeof( uint32 ) * Radix );
+
+    for( uint32 i = 0; i < length; i++ )
+        counts[(uint32)( src[i] >> shift ) & Mask]++;
+
+    // Get prefix sum
+    CalculatePrefixSum<Radix>( id, counts, pfxSum );
+
+    // Store in new location, iterating backwards
+    uint64* dst    = tmp + bucketOffset;
+    uint32* keyDst = Expand ? sortKey + bucketOffset : nullptr;
+
+    for( uint32 i = length; i > 0; )
+    {
+        const uint64 value  = src[--i];
+        const uint32 dstIdx = --pfxSum[(uint32)( value >> shift ) & Mask];
+
+        if constexpr ( Expand )
+        {
+            dst   [dstIdx] = bucket | ( value >> 32 );
+            keyDst[dstIdx] = (uint32)value;
+        }
+        else
+            dst[dstIdx] = value;
+    }
+
+    SyncThreads();
+}
+
+//-----------------------------------------------------------
+template<bool HasSortKey, uint shift, uint bits, typename YT>
 FORCE_INLINE void SortYJob::SortBucket( const uint64 bucket, const uint offset,
                                         const uint bucketOffset, const uint32 length, 
                                         uint32* counts, uint32* pfxSum,
                                         uint32* input, YT* tmp,
                                         uint32* sortKey, uint32* sortKeyTmp )
 {
-    const uint Radix = 256;
+    constexpr uint   Radix = 1u << bits;
+    constexpr uint32 Mask  = Radix - 1;
+    static_assert( Radix <= Y_SORT_RADIX, "Radix too large for the counts buffer." );
 
     const uint32* start = input + offset;
     const uint32* end   = start + length;
@@ -339,7 +590,7 @@ FORCE_INLINE void SortYJob::SortBucket( const uint64 bucket, const uint offset,
     memset( counts, 0, sizeof( uint32 ) * Radix );
 
 #if !Y_SORT_BLOCK_MODE
-    do { counts[(*src >> shift) & 0xFF]++; }
+    do { counts[(*src >> shift) & Mask]++; }
     while( ++src < end );
 #else
     // Assume block size = 64 bytes
@@ -347,29 +598,29 @@ FORCE_INLINE void SortYJob::SortBucket( const uint64 bucket, const uint offset,
     const uint32* blockEnd  = src + numBlocks * 16;
     do
     {
-        counts[(src[0] >> shift) & 0xFF]++;
-        counts[(src[1] >> shift) & 0xFF]++;
-        counts[(src[2] >> shift) & 0xFF]++;
-        counts[(src[3] >> shift) & 0xFF]++;
-        counts[(src[4] >> shift) & 0xFF]++;
-        counts[(src[5] >> shift) & 0xFF]++;
-        counts[(src[6] >> shift) & 0xFF]++;
-        counts[(src[7] >> shift) & 0xFF]++;
-
-        counts[(src[8 ] >> shift) & 0xFF]++;
-        counts[(src[9 ] >> shift) & 0xFF]++;
-        counts[(src[10] >> shift) & 0xFF]++;
-        counts[(src[11] >> shift) & 0xFF]++;
-        counts[(src[12] >> shift) & 0xFF]++;
-        counts[(src[13] >> shift) & 0xFF]++;
-        counts[(src[14] >> shift) & 0xFF]++;
-        counts[(src[15] >> shift) & 0xFF]++;
+        counts[(src[0] >> shift) & Mask]++;
+        counts[(src[1] >> shift) & Mask]++;
+        counts[(src[2] >> shift) & Mask]++;
+        counts[(src[3] >> shift) & Mask]++;
+        counts[(src[4] >> shift) & Mask]++;
+        counts[(src[5] >> shift) & Mask]++;
+        counts[(src[6] >> shift) & Mask]++;
+        counts[(src[7] >> shift) & Mask]++;
+
+        counts[(src[8 ] >> shift) & Mask]++;
+        counts[(src[9 ] >> shift) & Mask]++;
+        counts[(src[10] >> shift) & Mask]++;
+        counts[(src[11] >> shift) & Mask]++;
+        counts[(src[12] >> shift) & Mask]++;
+        counts[(src[13] >> shift) & Mask]++;
+        counts[(src[14] >> shift) & Mask]++;
+        counts[(src[15] >> shift) & Mask]++;
         
         src += 16;
     } while( src < blockEnd );
     
     while( src < end )
-        counts[(*src++ >> shift) & 0xFF]++;
+        counts[(*src++ >> shift) & Mask]++;
 #endif
 
     // Get prefix sum
@@ -386,7 +637,7 @@ FORCE_INLINE void SortYJob::SortBucket( const uint64 bucket, const uint offset,
     for( uint64 i = length; i > 0; )
     {
         YT value = src[--i];
-        const byte cIdx = (byte)( value >> shift );
+        const uint32 cIdx = (uint32)( value >> shift ) & Mask;
 
         const uint32 dstIdx = --pfxSum[cIdx];
 
@@ -406,13 +657,6 @@ FORCE_INLINE void SortYJob::SortBucket( const uint64 bucket, const uint offset,
 
 
 
-//-----------------------------------------------------------
-void SortYNumaThread( NumaSortJob* job )
-{
-    // Count entries for this radix in each page & store counts in that page's count buffer
-    
-}
-
 //-----------------------------------------------------------
 template<typename JobT>
 template<uint Radix, typename TPrefix>
@@ -428,7 +672,7 @@ FORCE_INLINE void SortYBaseJob<JobT>::CalculatePrefixSum( uint id, uint32* count
 
     for( uint t = 0; t < threadCount; t++ )
     {
-        const uint* tCounts = jobs[t].counts;
+        const uint* tCounts = jobs[t]->counts;
 
         for( uint i = 0; i < Radix; i++ )
             pfxSum[i] += tCounts[i];
@@ -441,7 +685,7 @@ FORCE_INLINE void SortYBaseJob<JobT>::CalculatePrefixSum( uint id, uint32* count
     // Substract the count from all threads after ours
     for( uint t = id+1; t < threadCount; t++ )
     {
-        const uint* tCounts = jobs[t].counts;
+        const uint* tCounts = jobs[t]->counts;
 
         for( uint i = 0; i < Radix; i++ )
             pfxSum[i] -= tCounts[i];
@@ -452,58 +696,7 @@ FORCE_INLINE void SortYBaseJob<JobT>::CalculatePrefixSum( uint id, uint32* count
 template<typename JobT>
 FORCE_INLINE void SortYBaseJob<JobT>::SyncThreads()
 {
-    auto& finishedCount        = *this->finishedCount;
-    auto& releaseLock          = *this->releaseLock;
-    const uint threadThreshold = this->threadCount - 1;
-
-    // Reset the release lock
-    if( id == 0 ) 
-    {
-        // Wait for all threads to finish
-        while( finishedCount.load( std::memory_order_relaxed ) != threadThreshold );
-
-        // Finished, initialize release lock & signal other threads
-        releaseLock  .store( 0, std::memory_order_release );
-        finishedCount.store( 0, std::memory_order_release );
-    }
-    else
-    {
-        // Signal we've finished so we can calculate the shared prefix sum
-        uint count = finishedCount.load( std::memory_order_acquire );
-
-        while( !finishedCount.compare_exchange_weak( count, count+1, std::memory_order_release, std::memory_order_relaxed ) );
-        
-        // Wait for the control thread (id == 0 ) to signal us
-        while( finishedCount.load( std::memory_order_relaxed ) != 0 );
-
-        // Ensure all threads have been released
-        count = releaseLock.load( std::memory_order_acquire );
-        while( !releaseLock.compare_exchange_weak( count, count+1, std::memory_order_release, std::memory_order_relaxed ) );
-        while( releaseLock.load( std::memory_order_relaxed ) != threadThreshold );
-    }
-}
-
-//-----------------------------------------------------------
-template<typename JobT>
-FORCE_INLINE void SortYBaseJob<JobT>::LockThreads()
-{
-    auto& finishedCount        = *this->finishedCount;
-    const uint threadThreshold = this->threadCount - 1;
-    
-    // Wait for all threads to finish
-    while( finishedCount.load( std::memory_order_relaxed ) != threadThreshold );
-}
-
-//-----------------------------------------------------------
-template<typename JobT>
-FORCE_INLINE void SortYBaseJob<JobT>::ReleaseThreads()
-{
-    auto& finishedCount = *this->finishedCount;
-    auto& releaseLock   = *this->releaseLock;
-
-    // Finished, init release lock & signal other threads
-    releaseLock  .store( 0, std::memory_order_release );
-    finishedCount.store( 0, std::memory_order_release );
+    barrier->Wait( id );
 }
 
 #pragma GCC diagnostic pop
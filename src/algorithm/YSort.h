@@ -2,12 +2,15 @@
 
 
 class ThreadPool;
+struct NumaInfo;
 
 
 class YSorter
 {
 public:
-    YSorter( ThreadPool& pool );
+    // If the system has more than one NUMA node, each node's threads
+    // sort the buckets that lie within their own slices of the buffers.
+    YSorter( ThreadPool& pool, const NumaInfo* numa = nullptr );
     ~YSorter();
     
     // template<uint MaxJobs>
@@ -20,13 +23,34 @@ public:
         uint64* yBuffer, uint64* yTmp,
         uint32* sortKey, uint32* sortKeyTmp );
 
+    // Same as Sort, but the first pass, which distributes the entries into
+    // buckets by the bits above the low 32 bits of y, has already been performed
+    // by the caller: yTmp and sortKeyTmp contain the low 32 bits of each y, 
+    // and its sort key, ordered by bucket. yBuffer and sortKey are used as scratch.
+    // The sorted entries end up in yTmp and sortKeyTmp, as with Sort.
+    void SortBucketed(
+        uint64 length, const uint32* bucketLengths,
+        uint64* yBuffer, uint64* yTmp,
+        uint32* sortKey, uint32* sortKeyTmp );
+
+    // Sorts y and generates its sort key (the original index of each entry) at the same time.
+    // While sorting, the low 32 bits of each y are packed with its index in a single 64-bit entry,
+    // so no key has to be generated beforehand, nor carried as a separate stream by the passes.
+    // Unlike Sort, the sorted y end up in yBuffer, and the key in sortKey. yTmp is used as scratch.
+    void SortPacked( 
+        uint64 length, 
+        uint64* yBuffer, uint64* yTmp,
+        uint32* sortKey );
+
 private:
     void DoSort( bool useSortKey, uint64 length, 
                 uint64* yBuffer, uint64* yTmp,
-                uint32* sortKey, uint32* sortKeyTmp );
+                uint32* sortKey, uint32* sortKeyTmp,
+                const uint32* bucketLengths = nullptr,
+                bool packed = false );
 private:
-    ThreadPool& _pool;
-    // byte*       _pageCounts;
+    ThreadPool&     _pool;
+    const NumaInfo* _numa;
 };
 
 
@@ -0,0 +1,77 @@
+#pragma once
+#include "PlotContext.h"
+#include "KernelDispatch.h"
+
+class MemPhase1;
+class MemPhase2;
+
+#define BB_BENCH_MAX_THREAD_COUNTS 32
+
+struct BenchConfig
+{
+    uint        log2Entries  = 24;          // Scale: Entries per table, as a power of 2
+    uint        iterations   = 3;           // Timed runs of each kernel per thread count
+    uint        threadCounts[BB_BENCH_MAX_THREAD_COUNTS];
+    uint        threadCountCount = 0;
+    const char* filter       = nullptr;     // Comma-separated kernels to run. All of them if null.
+    const char* outDir       = nullptr;     // Where the plot writer writes. It's skipped if null.
+    const char* csvPath      = nullptr;     // Write the results as CSV here, if set
+    const char* baselinePath = nullptr;     // Compare the results against this baseline, or record it if it does not exist
+    bool        saveBaseline = false;       // Record the baseline even if it exists
+    double      threshold    = 0.05;        // Relative slowdown over the baseline tolerated before a kernel is flagged
+    const char* plotPath     = nullptr;     // Benchmark lookups against this plot instead of the kernels, if set
+    uint        challengeCount = 1000;      // Random challenges looked up per lookup pass
+    const char* simd         = nullptr;     // Widest SIMD kernels to run, by level name. The CPU's widest if null.
+};
+
+/**
+ * Buffers and state shared by the kernels. The inputs are generated once, before any kernel runs,
+ * and are never written by the kernels, which write only to the scratch buffers.
+ */
+struct BenchContext
+{
+    const BenchConfig* cfg;
+
+    uint64          entryCount;     // 2^log2Entries
+    uint64          pairCount;      // Pairs in the pairs buffer, at most entryCount
+
+    MemPlotContext  cx;             // Only its thread pool, thread policy and maxPairs are set, for the phase kernels
+    MemPhase1*      phase1;
+    MemPhase2*      phase2;
+
+    // Inputs
+    uint64*         yRaw;           // F1's y, unsorted, scaled to the entry count
+    uint64*         ySorted;        // yRaw, sorted
+    Pair*           pairs;          // Pairs of ySorted
+    uint64*         meta;           // Random metadata with up to 4 words per entry
+    uint64*         linePoints;     // Sorted line points, with the deltas of a k32 table
+    uint32*         f7;             // Sorted f7 entries, with the deltas of a k32 table
+
+    // Scratch, 16 bytes per entry each, or 2 pairs
+    byte*           scratch[3];
+};
+
+// Runs a kernel once with the context's thread pool. Returns the elapsed seconds of the timed part,
+// and sets the entries and bytes processed, the latter being the size of the kernel's inputs and outputs.
+typedef double (*BenchFunc)( BenchContext& bx, uint64& entries, uint64& bytes );
+
+struct BenchKernel
+{
+    const char* name;
+    const char* description;
+    BenchFunc   run;
+    bool        threaded;       // Has a thread scaling curve. Otherwise it runs once, with any pool.
+};
+
+extern const BenchKernel BenchKernels[];
+extern const uint        BenchKernelCount;
+
+void BenchAllocBuffers( BenchContext& bx );
+void BenchFreeBuffers ( BenchContext& bx );
+
+// Generates the inputs with the context's thread pool
+void BenchGenInputs( BenchContext& bx );
+
+// Benchmarks harvester lookup latencies against the plot at cfg.plotPath, for each thread count.
+// Returns the process' exit code.
+int BenchLookups( const BenchConfig& cfg );
@@ -0,0 +1,458 @@
+#include "Bench.h"
+#include "memplot/MemPhase1.h"
+#include "memplot/MemPhase2.h"
+#include "memplot/MemPhase4.h"
+#include "memplot/FxSort.h"
+#include "memplot/ParkWriter.h"
+#include "memplot/LPGen.h"
+#include "algorithm/YSort.h"
+#include "algorithm/RadixSort.h"
+#include "pos/chacha8.h"
+#include "threading/ThreadPool.h"
+#include "io/FileStream.h"
+#include "PlotWriter.h"
+#include "SysHost.h"
+#include "Util.h"
+#include "util/Log.h"
+#include <cmath>
+
+
+static const byte BenchPlotId[32] = {
+    0x22, 0x24, 0x11, 0xa5, 0x41, 0x48, 0x01, 0x6e, 0x14, 0x1c, 0x31, 0x6e, 0x9a, 0xa5, 0x4d, 0x44,
+    0x36, 0x2b, 0x98, 0x31, 0x13, 0x1f, 0x55, 0x41, 0x3c, 0x9b, 0x5e, 0x43, 0x8f, 0xd3, 0x8c, 0x26
+};
+
+//-----------------------------------------------------------
+// Seconds since the given TimerBegin(). TimerEnd() only has millisecond resolution.
+inline static double BenchElapsed( const std::chrono::steady_clock::time_point& start )
+{
+    return std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+}
+
+//-----------------------------------------------------------
+// Deterministic random value for each index, so that the inputs don't depend on the thread count
+inline static uint64 BenchRand( uint64 i )
+{
+    uint64 z = ( i + 1 ) * 0x9E3779B97F4A7C15ull;
+    z = ( z ^ ( z >> 30 ) ) * 0xBF58476D1CE4E5B9ull;
+    z = ( z ^ ( z >> 27 ) ) * 0x94D049BB133111EBull;
+    return z ^ ( z >> 31 );
+}
+
+//-----------------------------------------------------------
+static void GenF1( ThreadPool& pool, uint64 entryCount, uint64* yBuffer, uint32* xBuffer, byte* blocks )
+{
+    byte key[32] = { 1 };
+    memcpy( key + 1, BenchPlotId, 31 );
+
+    const uint64 groupCount = entryCount / F1_GROUP_ENTRIES;
+
+    pool.ParallelFor( groupCount, 0, [=]( uint64 begin, uint64 end, uint ) {
+
+        const uint64 x          = begin * F1_GROUP_ENTRIES;
+        const uint64 count      = ( end - begin ) * F1_GROUP_ENTRIES;
+        const uint64 blockStart = begin * F1_GROUP_BLOCKS;
+
+        uint32* threadBlocks = (uint32*)( blocks + blockStart * ( kF1BlockSizeBits / 8 ) );
+
+        chacha8_ctx chacha;
+        ZeroMem( &chacha );
+
+        chacha8_keysetup( &chacha, key, 256, NULL );
+        chacha8_get_keystream( &chacha, blockStart, (uint32)( ( end - begin ) * F1_GROUP_BLOCKS ), (byte*)threadBlocks );
+
+        // As in F1JobThread
+        for( uint64 i = 0; i < count; i++ )
+        {
+            const uint64 y = GetF1Value( threadBlocks, i );
+            yBuffer[x+i] = ( y << kExtraBits ) | ( (x+i) >> (_K - kExtraBits) );
+        }
+
+        for( uint64 i = 0; i < count; i++ )
+            xBuffer[x+i] = (uint32)( x + i );
+    });
+}
+
+//-----------------------------------------------------------
+void BenchAllocBuffers( BenchContext& bx )
+{
+    const uint64 n = bx.entryCount;
+
+    auto alloc = []( size_t size ) {
+        void* ptr = SysHost::VirtualAlloc( size, true );
+        FatalIf( !ptr, "Failed to allocate %llu bytes for the benchmark buffers.", (uint64)size );
+        return ptr;
+    };
+
+    bx.yRaw       = (uint64*)alloc( n * sizeof( uint64 ) );
+    bx.ySorted    = (uint64*)alloc( n * sizeof( uint64 ) );
+    bx.pairs      = (Pair*  )alloc( n * sizeof( Pair   ) );
+    bx.meta       = (uint64*)alloc( n * sizeof( Meta4  ) );
+    bx.linePoints = (uint64*)alloc( n * sizeof( uint64 ) );
+    bx.f7         = (uint32*)alloc( n * sizeof( uint32 ) );
+
+    for( uint i = 0; i < 3; i++ )
+        bx.scratch[i] = (byte*)alloc( n * 16 );
+
+    bx.cx.maxPairs = n * 2;
+}
+
+//-----------------------------------------------------------
+void BenchFreeBuffers( BenchContext& bx )
+{
+    SysHost::VirtualFree( bx.yRaw       );
+    SysHost::VirtualFree( bx.ySorted    );
+    SysHost::VirtualFree( bx.pairs      );
+    SysHost::VirtualFree( bx.meta       );
+    SysHost::VirtualFree( bx.linePoints );
+    SysHost::VirtualFree( bx.f7         );
+
+    for( uint i = 0; i < 3; i++ )
+        SysHost::VirtualFree( bx.scratch[i] );
+
+    if( bx.cx.markingScratch )
+    {
+        SysHost::VirtualFree( bx.cx.markingScratch );
+        SysHost::VirtualFree( bx.cx.usedEntriesBuffer );
+    }
+}
+
+//-----------------------------------------------------------
+void BenchGenInputs( BenchContext& bx )
+{
+    ThreadPool&  pool = *bx.cx.threadPool;
+    const uint64 n    = bx.entryCount;
+
+    // F1's y, scaled down to the entry count, so that the kBC groups
+    // have as many entries as those of a full k32 table.
+    GenF1( pool, n, (uint64*)bx.scratch[0], (uint32*)bx.scratch[1], bx.scratch[2] );
+
+    const uint    shift = _K - bx.cfg->log2Entries;
+    const uint64* f1Y   = (const uint64*)bx.scratch[0];
+    uint64*       ySort = (uint64*)bx.scratch[1];
+
+    pool.ParallelFor( n, 0, [&]( uint64 begin, uint64 end, uint ) {
+        for( uint64 i = begin; i < end; i++ )
+        {
+            bx.yRaw[i] = f1Y[i] >> shift;
+            ySort  [i] = bx.yRaw[i];
+        }
+    });
+
+    // The sorted y end up in the temporary buffer
+    {
+        YSorter sorter( pool );
+        sorter.Sort( n, ySort, bx.ySorted );
+    }
+
+    // Pairs
+    const uint64 pairCount = bx.phase1->BenchPair( n, bx.ySorted, (Pair*)bx.scratch[0], (Pair*)bx.scratch[1] );
+    bx.pairCount = std::min( pairCount, n );
+    memcpy( bx.pairs, bx.scratch[1], bx.pairCount * sizeof( Pair ) );
+
+    // Metadata
+    pool.ParallelFor( n * 2, 0, [&]( uint64 begin, uint64 end, uint ) {
+        for( uint64 i = begin; i < end; i++ )
+            bx.meta[i] = BenchRand( i );
+    });
+
+    // Line points of a k32 table are spread accross [0, 2^63), so their deltas average 2^31.
+    // Exponentially distributed deltas of that mean give the same park encoding as sorted line points.
+    uint64* deltas = (uint64*)bx.scratch[0];
+
+    pool.ParallelFor( n, 0, [&]( uint64 begin, uint64 end, uint ) {
+        for( uint64 i = begin; i < end; i++ )
+        {
+            const double u = ( ( BenchRand( i ^ 0x5A5A5A5Aull ) >> 11 ) + 1 ) * ( 1.0 / 9007199254740992.0 );
+            deltas[i] = (uint64)( -std::log( u ) * (double)( 1ull << ( _K - 1 ) ) );
+        }
+    });
+
+    pool.ParallelPrefixSum( deltas, bx.linePoints, n );
+
+    // f7 holds a k32 table's 2^32 entries, which range over [0, 2^32), so its deltas average 1
+    uint32* f7Deltas = (uint32*)bx.scratch[0];
+
+    pool.ParallelFor( n, 0, [&]( uint64 begin, uint64 end, uint ) {
+        for( uint64 i = begin; i < end; i++ )
+            f7Deltas[i] = (uint32)( BenchRand( i ^ 0xF7F7F7F7ull ) % 3 );
+    });
+
+    pool.ParallelPrefixSum( f7Deltas, bx.f7, n );
+}
+
+
+///
+/// Kernels
+///
+//-----------------------------------------------------------
+static double BenchF1( BenchContext& bx, uint64& entries, uint64& bytes )
+{
+    const uint64 n = bx.entryCount;
+
+    auto timer = TimerBegin();
+    GenF1( *bx.cx.threadPool, n, (uint64*)bx.scratch[0], (uint32*)bx.scratch[1], bx.scratch[2] );
+    const double elapsed = BenchElapsed( timer );
+
+    entries = n;
+    bytes   = n * ( sizeof( uint32 ) + sizeof( uint64 ) + sizeof( uint32 ) );
+    return elapsed;
+}
+
+//-----------------------------------------------------------
+template<bool UseYSorter>
+static double BenchSortY( BenchContext& bx, uint64& entries, uint64& bytes )
+{
+    ThreadPool&  pool = *bx.cx.threadPool;
+    const uint64 n    = bx.entryCount;
+
+    uint64* y       = (uint64*)bx.scratch[0];
+    uint64* yTmp    = (uint64*)bx.scratch[1];
+    uint32* sortKey = (uint32*)bx.scratch[2];
+
+    memcpy( y, bx.yRaw, n * sizeof( uint64 ) );
+
+    auto timer = TimerBegin();
+
+    if constexpr( UseYSorter )
+    {
+        SortFx<MAX_THREADS>( pool, n, y, yTmp, sortKey, sortKey + n );
+    }
+    else
+    {
+        GenSortKey<MAX_THREADS>( pool, n, sortKey );
+        RadixSort256::SortYWithKey<MAX_THREADS>( pool, y, yTmp, sortKey, sortKey + n, n );
+    }
+
+    const double elapsed = BenchElapsed( timer );
+
+    // y and the key are read and written once
+    entries = n;
+    bytes   = n * ( sizeof( uint64 ) + sizeof( uint32 ) ) * 2;
+    return elapsed;
+}
+
+//-----------------------------------------------------------
+static double BenchPair( BenchContext& bx, uint64& entries, uint64& bytes )
+{
+    const uint64 n = bx.entryCount;
+
+    auto timer = TimerBegin();
+    const uint64 pairCount = bx.phase1->BenchPair( n, bx.ySorted, (Pair*)bx.scratch[0], (Pair*)bx.scratch[1] );
+    const double elapsed   = BenchElapsed( timer );
+
+    entries = n;
+    bytes   = n * sizeof( uint64 ) + pairCount * sizeof( Pair ) * 2;
+    return elapsed;
+}
+
+//-----------------------------------------------------------
+template<TableId tableId>
+static double BenchFx( BenchContext& bx, uint64& entries, uint64& bytes )
+{
+    using TMetaIn  = typename TableMetaType<tableId>::MetaIn;
+    using TMetaOut = typename TableMetaType<tableId>::MetaOut;
+
+    const uint64 count = bx.pairCount;
+
+    auto timer = TimerBegin();
+    bx.phase1->BenchComputeFx<tableId>( count, bx.pairs, bx.ySorted, bx.meta, (uint64*)bx.scratch[0], bx.scratch[1] );
+    const double elapsed = BenchElapsed( timer );
+
+    // Each pair reads the y and metadata of both of its entries
+    entries = count;
+    bytes   = count * ( sizeof( Pair ) + ( sizeof( uint64 ) + sizeof( TMetaIn ) ) * 2 +
+                        sizeof( typename YOut<tableId>::Type ) + SizeForMeta<TMetaOut>::Value * _K / 8 );
+    return elapsed;
+}
+
+//-----------------------------------------------------------
+template<bool Blocked>
+static double BenchMapFx( BenchContext& bx, uint64& entries, uint64& bytes )
+{
+    ThreadPool&  pool  = *bx.cx.threadPool;
+    const uint64 count = bx.pairCount;
+
+    uint64* y       = (uint64*)bx.scratch[0];
+    uint32* sortKey = (uint32*)bx.scratch[2];
+
+    // The sort key of table 3's y, as Phase 1 has it once the y are sorted.
+    // The sorted key ends up in the second key buffer.
+    memcpy( y, bx.yRaw, count * sizeof( uint64 ) );
+    SortFx<MAX_THREADS>( pool, count, y, (uint64*)bx.scratch[1], sortKey + count, sortKey );
+
+    auto timer = TimerBegin();
+
+    MapFxWithSortKey<Meta4, MAX_THREADS, PackedPair>( pool, count, sortKey,
+        (const Meta4*)bx.meta, (Meta4*)bx.scratch[0],
+        bx.pairs, (PackedPair*)bx.scratch[1], Blocked );
+
+    const double elapsed = BenchElapsed( timer );
+
+    entries = count;
+    bytes   = count * ( sizeof( uint32 ) + sizeof( Meta4 ) * 2 + sizeof( Pair ) + sizeof( PackedPair ) );
+    return elapsed;
+}
+
+//-----------------------------------------------------------
+static double BenchMark( BenchContext& bx, uint64& entries, uint64& bytes )
+{
+    MemPlotContext& cx = bx.cx;
+
+    // The left table's bitfield is always that of a full table, and the bins hold both indices of each of its pairs
+    const size_t fieldSize = ( 1ull << _K ) / 8;
+    const size_t binsSize  = 2 * ENTRIES_PER_TABLE * sizeof( uint32 );
+
+    if( !cx.markingScratch )
+    {
+        cx.markingScratch    = (uint64*)SysHost::VirtualAlloc( binsSize, true );
+        cx.usedEntriesBuffer = (uint64*)SysHost::VirtualAlloc( fieldSize, true );
+
+        FatalIf( !cx.markingScratch || !cx.usedEntriesBuffer, "Failed to allocate the marking bitfields." );
+    }
+
+    const uint64 count = bx.pairCount;
+
+    auto timer = TimerBegin();
+    bx.phase2->BenchMarkTable( bx.pairs, count, cx.usedEntriesBuffer );
+    const double elapsed = BenchElapsed( timer );
+
+    // The pairs are read twice, and each index is written to its bin, then read back to be marked
+    entries = count;
+    bytes   = count * ( 2 * sizeof( Pair ) + 4 * sizeof( uint32 ) ) + fieldSize;
+    return elapsed;
+}
+
+//-----------------------------------------------------------
+static double BenchLinePoints( BenchContext& bx, uint64& entries, uint64& bytes )
+{
+    ThreadPool&  pool  = *bx.cx.threadPool;
+    const uint64 count = bx.pairCount;
+
+    const uint32* x     = (const uint32*)bx.meta;
+    const Pair*   pairs = bx.pairs;
+    uint64*       lps   = (uint64*)bx.scratch[0];
+    uint32*       map   = (uint32*)bx.scratch[1];
+
+    auto timer = TimerBegin();
+
+    // Table 2 is converted from the x values of table 1's entries
+    pool.ParallelFor( count, 0, [=]( uint64 begin, uint64 end, uint ) {
+        for( uint64 i = begin; i < end; i++ )
+        {
+            lps[i] = SquareToLinePoint( x[pairs[i].left], x[pairs[i].right] );
+            map[i] = (uint32)i;
+        }
+    });
+
+    RadixSort256::SortBitsWithKey<MAX_THREADS, _K*2>( pool, lps, (uint64*)bx.scratch[2], map, map + count, count );
+
+    const double elapsed = BenchElapsed( timer );
+
+    entries = count;
+    bytes   = count * ( sizeof( Pair ) + sizeof( uint32 ) * 2 + ( sizeof( uint64 ) + sizeof( uint32 ) ) * 2 );
+    return elapsed;
+}
+
+//-----------------------------------------------------------
+static double BenchParks( BenchContext& bx, uint64& entries, uint64& bytes )
+{
+    const uint64 n = bx.entryCount;
+
+    // The line points are encoded in place
+    uint64* lps = (uint64*)bx.scratch[0];
+    memcpy( lps, bx.linePoints, n * sizeof( uint64 ) );
+
+    auto timer = TimerBegin();
+    const size_t sizeWritten = WriteParks<MAX_THREADS>( *bx.cx.threadPool, n, lps, bx.scratch[1], TableId::Table1 );
+    const double elapsed     = BenchElapsed( timer );
+
+    entries = n;
+    bytes   = n * sizeof( uint64 ) + sizeWritten;
+    return elapsed;
+}
+
+//-----------------------------------------------------------
+static double BenchC3( BenchContext& bx, uint64& entries, uint64& bytes )
+{
+    const uint64 n = bx.entryCount;
+
+    uint32* f7 = (uint32*)bx.scratch[0];
+    memcpy( f7, bx.f7, n * sizeof( uint32 ) );
+
+    auto timer = TimerBegin();
+    const size_t sizeWritten = WriteC3Parallel<MAX_THREADS>( *bx.cx.threadPool, n, f7, bx.scratch[1] );
+    const double elapsed     = BenchElapsed( timer );
+
+    entries = n;
+    bytes   = n * sizeof( uint32 ) + sizeWritten;
+    return elapsed;
+}
+
+//-----------------------------------------------------------
+static double BenchPlotWriter( BenchContext& bx, uint64& entries, uint64& bytes )
+{
+    const uint64 n = bx.entryCount;
+
+    std::string path = bx.cfg->outDir;
+    if( path.back() != '/' && path.back() != '\\' )
+        path += '/';
+    path += "bladebit_bench.plot";
+
+    // The writer deletes the file once it's done with it
+    FileStream* file = new FileStream();
+    if( !file->Open( path.c_str(), FileMode::Create, FileAccess::Write, FileFlags::NoBuffering | FileFlags::LargeFile ) )
+        Fatal( "Failed to open benchmark plot file '%s'.", path.c_str() );
+
+    // As many tables as a plot has, of 8 bytes per entry each
+    const size_t tableSize = n * sizeof( uint64 );
+
+    DiskPlotWriter writer;
+
+    auto timer = TimerBegin();
+
+    if( !writer.BeginPlot( path.c_str(), *file, BenchPlotId, BenchPlotId, 32 ) )
+        Fatal( "Failed to begin writing the benchmark plot." );
+
+    for( uint i = 0; i < 10; i++ )
+    {
+        if( !writer.WriteTable( bx.scratch[i % 3], tableSize ) )
+            Fatal( "Failed to write a benchmark plot table." );
+    }
+
+    if( !writer.WaitUntilFinishedWriting() )
+        Fatal( "Failed to write the benchmark plot." );
+
+    const double elapsed = BenchElapsed( timer );
+
+    remove( path.c_str() );
+
+    entries = 0;
+    bytes   = tableSize * 10;
+    return elapsed;
+}
+
+///
+/// Registry
+///
+const BenchKernel BenchKernels[] = {
+    { "f1"         , "F1: ChaCha8 keystream into y and x"                 , BenchF1                         , true  },
+    { "ysort"      , "y sort with a sort key: YSorter"                    , BenchSortY<true>                , true  },
+    { "radix"      , "y sort with a sort key: RadixSort256"               , BenchSortY<false>               , true  },
+    { "pair"       , "Phase 1: FpPair, scanning and pairing kBC groups"   , BenchPair                       , true  },
+    { "fx2"        , "Phase 1: ComputeFx for table 2"                     , BenchFx<TableId::Table2>        , true  },
+    { "fx3"        , "Phase 1: ComputeFx for table 3"                     , BenchFx<TableId::Table3>        , true  },
+    { "fx4"        , "Phase 1: ComputeFx for table 4"                     , BenchFx<TableId::Table4>        , true  },
+    { "fx5"        , "Phase 1: ComputeFx for table 5"                     , BenchFx<TableId::Table5>        , true  },
+    { "fx6"        , "Phase 1: ComputeFx for table 6"                     , BenchFx<TableId::Table6>        , true  },
+    { "fx7"        , "Phase 1: ComputeFx for table 7"                     , BenchFx<TableId::Table7>        , true  },
+    { "map"        , "Phase 1: MapFxWithSortKey, 4-word metadata"         , BenchMapFx<false>               , true  },
+    { "map_blocked", "Phase 1: MapFxWithSortKey, blocked"                 , BenchMapFx<true>                , true  },
+    { "mark"       , "Phase 2: MarkEntriesThread and the bitfield merge"  , BenchMark                       , true  },
+    { "lp"         , "Phase 3: Line point conversion and sort"            , BenchLinePoints                 , true  },
+    { "park"       , "Phase 3: WritePark, table 1"                        , BenchParks                      , true  },
+    { "c3"         , "Phase 4: WriteC3Parallel"                           , BenchC3                         , true  },
+    { "writer"     , "DiskPlotWriter throughput"                          , BenchPlotWriter                 , false },
+};
+
+const uint BenchKernelCount = sizeof( BenchKernels ) / sizeof( BenchKernels[0] );
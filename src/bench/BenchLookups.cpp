@@ -0,0 +1,291 @@
+#include "Bench.h"
+#include "PlotReader.h"
+#include "PlotValidator.h"
+#include "threading/ThreadPool.h"
+#include "SysHost.h"
+#include "Util.h"
+#include "util/Log.h"
+#include <vector>
+#include <algorithm>
+#include <chrono>
+
+struct LookupResult
+{
+    const char* lookup;         // "quality" or "proof"
+    bool        cold;
+    uint        threadCount;
+    uint64      challenges;     // Challenges looked up
+    uint64      count;          // Lookups timed
+    uint64      failures;       // Lookups that could not be read from the plot
+    double      p50;            // Latencies, in seconds
+    double      p99;
+    double      mean;
+    double      seconds;        // Wall time of the whole pass, over all challenges
+};
+
+// TimerEnd() has millisecond resolution, lookups take microseconds
+inline static double LookupSeconds( const std::chrono::steady_clock::time_point start )
+{
+    return std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+}
+
+static void         PrintLayout( const PlotReader& plot, const char* path );
+static LookupResult RunLookups( ThreadPool& pool, const PlotReader& plot, const byte* challenges, uint count, bool proofs, bool cold );
+static void         PrintLookupResults( const std::vector<LookupResult>& results );
+static void         WriteLookupCsv( const char* path, const std::vector<LookupResult>& results );
+
+/**
+ * Measures the latency of harvester lookups against a finished plot, to see how the layout
+ * DiskPlotWriter gives the parks and checkpoint tables performs when farming.
+ *
+ * A quality lookup is what a harvester does for every challenge that passes the plot filter:
+ * its f7 is looked up in C1, C2 and C3, and the 2 x's of each of its qualities are read,
+ * following a single path of back pointers from table 7 to table 1.
+ * A proof lookup is what it does for a winning quality: the same f7 lookup, and the 64 x's of its first proof.
+ * Challenges that have no proof are not timed as proof lookups.
+ *
+ * Each kind of lookup is run over the same challenges twice: after evicting the plot from the page cache (cold),
+ * then again with whatever the first pass cached (warm). Eviction is only supported on Linux.
+ */
+//-----------------------------------------------------------
+int BenchLookups( const BenchConfig& cfg )
+{
+    ASSERT( cfg.plotPath );
+
+    PlotReader plot;
+    if( !plot.Open( cfg.plotPath ) )
+        return 1;
+
+    PrintLayout( plot, cfg.plotPath );
+
+    const bool canEvict = plot.EvictCache();
+    if( !canEvict )
+        Log::Line( "Evicting the plot from the page cache is not supported here. Only warm lookups are run." );
+
+    // A challenge is 32 bytes, of which the f7 looked up is the first k bits
+    byte* challenges = (byte*)malloc( (size_t)cfg.challengeCount * 32 );
+    SysHost::Random( challenges, (size_t)cfg.challengeCount * 32 );
+
+    std::vector<LookupResult> results;
+
+    for( uint t = 0; t < cfg.threadCountCount; t++ )
+    {
+        const uint threadCount = cfg.threadCounts[t];
+        ThreadPool pool( threadCount );
+
+        for( const bool proofs : { false, true } )
+        {
+            for( const bool cold : { true, false } )
+            {
+                if( cold && !canEvict )
+                    continue;
+
+                Log::Line( "Running %s %s lookups with %u threads...", cold ? "cold" : "warm", proofs ? "proof" : "quality", threadCount );
+                results.push_back( RunLookups( pool, plot, challenges, cfg.challengeCount, proofs, cold ) );
+            }
+        }
+    }
+
+    free( challenges );
+
+    Log::Line( "" );
+    PrintLookupResults( results );
+
+    if( cfg.csvPath )
+        WriteLookupCsv( cfg.csvPath, results );
+
+    uint64 failures = 0;
+    for( const LookupResult& r : results )
+        failures += r.failures;
+
+    if( failures )
+        Log::Error( "%llu lookups failed to be read from the plot.", failures );
+
+    return failures ? 1 : 0;
+}
+
+// Logs each table's park size, and how many pages a park read spans on average,
+// given where DiskPlotWriter placed the table, as each of them is a separate read.
+//-----------------------------------------------------------
+void PrintLayout( const PlotReader& plot, const char* path )
+{
+    const uint64 pageSize = SysHost::GetPageSize();
+
+    if( plot.DroppedXBits() )
+        Log::Line( "Plot %s, with %u x bits dropped:", path, plot.DroppedXBits() );
+    else
+        Log::Line( "Plot %s:", path );
+    Log::Line( "  Table      Address   Park size      Parks  Pages/park" );
+
+    for( uint i = 0; i <= (uint)PlotTable::C3; i++ )
+    {
+        const PlotTable table = (PlotTable)i;
+
+        if( table == PlotTable::C1 || table == PlotTable::C2 )
+            continue;
+
+        const uint64 address  = plot.TableAddress( table );
+        const uint64 parkSize = table == PlotTable::Table7 ? CDiv( (uint64)( _K + 1 ) * kEntriesPerPark, 8 ) :
+                                table == PlotTable::C3     ? (uint64)CalculateC3Size() :
+                                                             (uint64)plot.ParkSize( (TableId)i );
+
+        const uint64 parkCount = table == PlotTable::C3 ? plot.C1EntryCount() :
+                                 ( plot.TableAddress( (PlotTable)( i + 1 ) ) - address ) / parkSize;
+
+        uint64 pages = 0;
+        for( uint64 p = 0; p < parkCount; p++ )
+        {
+            const uint64 start = address + p * parkSize;
+            pages += ( start + parkSize - 1 ) / pageSize - start / pageSize + 1;
+        }
+
+        char name[8];
+        if( table == PlotTable::C3 )
+            sprintf( name, "C3" );
+        else
+            sprintf( name, "%u", i + 1 );
+
+        Log::Line( "  %5s  %11llu  %10llu  %9llu  %10.2lf", name, address, parkSize, parkCount,
+                   parkCount ? pages / (double)parkCount : 0.0 );
+    }
+
+    Log::Line( "  (%llu-byte pages)", pageSize );
+    Log::Line( "" );
+}
+
+//-----------------------------------------------------------
+LookupResult RunLookups( ThreadPool& pool, const PlotReader& plot, const byte* challenges, const uint count, const bool proofs, const bool cold )
+{
+    if( cold )
+        const_cast<PlotReader&>( plot ).EvictCache();
+
+    // Negative for challenges that were not timed
+    const double NOT_TIMED = -1.0;
+    const double FAILED    = -2.0;
+
+    std::vector<double> latencies( count, NOT_TIMED );
+
+    const uint droppedXBits = plot.DroppedXBits();
+
+    auto timer = TimerBegin();
+
+    pool.ParallelFor( count, 1, [&]( uint64 begin, uint64 end, uint ) {
+
+        for( uint64 i = begin; i < end; i++ )
+        {
+            const byte*  challenge = challenges + i * 32;
+            const uint64 f7        = Swap64( *(uint64*)challenge ) >> ( 64 - _K );
+
+            auto lookupTimer = TimerBegin();
+
+            uint64 positions[BB_PLOT_MAX_PROOFS_PER_CHALLENGE];
+            const int proofCount = plot.GetP7Positions( f7, positions, BB_PLOT_MAX_PROOFS_PER_CHALLENGE );
+
+            if( proofCount < 0 )
+            {
+                latencies[i] = FAILED;
+                continue;
+            }
+
+            bool ok = true;
+
+            if( proofs )
+            {
+                if( proofCount == 0 )
+                    continue;
+
+                uint64 xs[64];
+                ok = plot.FetchProof( positions[0], xs );
+
+                // A harvester has to recover the dropped x bits of every pair of the proof
+                for( uint j = 0; j < 32 && ok && droppedXBits; j++ )
+                {
+                    uint64 fullXs[2];
+                    ok = PlotValidator::RecoverXPair( plot.PlotId(), xs[j*2], xs[j*2+1], droppedXBits, fullXs, 1 ) > 0;
+                }
+            }
+            else
+            {
+                for( int p = 0; p < proofCount && ok; p++ )
+                {
+                    uint64 x1, x2;
+                    ok = plot.FetchQualityXs( positions[p], challenge, x1, x2 );
+
+                    if( ok && droppedXBits )
+                    {
+                        uint64 fullXs[2];
+                        ok = PlotValidator::RecoverXPair( plot.PlotId(), x1, x2, droppedXBits, fullXs, 1 ) > 0;
+                    }
+                }
+            }
+
+            latencies[i] = ok ? LookupSeconds( lookupTimer ) : FAILED;
+        }
+    });
+
+    LookupResult r;
+    r.lookup      = proofs ? "proof" : "quality";
+    r.cold        = cold;
+    r.threadCount = pool.ThreadCount();
+    r.challenges  = count;
+    r.seconds     = LookupSeconds( timer );
+    r.failures    = (uint64)std::count( latencies.begin(), latencies.end(), FAILED );
+
+    latencies.erase( std::remove_if( latencies.begin(), latencies.end(), []( double l ) { return l < 0; } ), latencies.end() );
+    std::sort( latencies.begin(), latencies.end() );
+
+    r.count = latencies.size();
+    r.p50   = 0;
+    r.p99   = 0;
+    r.mean  = 0;
+
+    if( r.count )
+    {
+        r.p50 = latencies[r.count / 2];
+        r.p99 = latencies[std::min( r.count - 1, r.count * 99 / 100 )];
+
+        for( const double l : latencies )
+            r.mean += l;
+
+        r.mean /= r.count;
+    }
+
+    return r;
+}
+
+//-----------------------------------------------------------
+void PrintLookupResults( const std::vector<LookupResult>& results )
+{
+    Log::Line( "  Lookup   Cache  Threads   Lookups   p50 (ms)   p99 (ms)  Mean (ms)   Challenges/s" );
+
+    for( const LookupResult& r : results )
+    {
+        Log::Line( "  %-7s  %5s  %7u  %8llu  %9.3lf  %9.3lf  %9.3lf  %12.1lf",
+                   r.lookup, r.cold ? "cold" : "warm", r.threadCount, r.count,
+                   r.p50 * 1000.0, r.p99 * 1000.0, r.mean * 1000.0, r.challenges / r.seconds );
+    }
+
+    Log::Line( "" );
+}
+
+//-----------------------------------------------------------
+void WriteLookupCsv( const char* path, const std::vector<LookupResult>& results )
+{
+    FILE* file = fopen( path, "w" );
+    if( !file )
+    {
+        const int err = errno;
+        Log::Error( "Warning: Failed to open CSV file '%s' with error %d.", path, err );
+        return;
+    }
+
+    fprintf( file, "lookup,cache,threads,lookups,p50_ms,p99_ms,mean_ms,challenges_per_second\n" );
+
+    for( const LookupResult& r : results )
+    {
+        fprintf( file, "%s,%s,%u,%llu,%.4lf,%.4lf,%.4lf,%.1lf\n", r.lookup, r.cold ? "cold" : "warm", r.threadCount,
+                 r.count, r.p50 * 1000.0, r.p99 * 1000.0, r.mean * 1000.0, r.challenges / r.seconds );
+    }
+
+    fclose( file );
+}
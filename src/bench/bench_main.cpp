@@ -0,0 +1,466 @@
+#include "Bench.h"
+#include "memplot/MemPhase1.h"
+#include "memplot/MemPhase2.h"
+#include "memplot/ThreadPolicy.h"
+#include "threading/ThreadPool.h"
+#include "SysHost.h"
+#include "Util.h"
+#include "util/Log.h"
+#include "util/Baseline.h"
+#include <vector>
+#include <algorithm>
+
+struct BenchResult
+{
+    uint   threadCount;
+    double seconds;         // Median of the iterations
+    uint64 entries;
+    uint64 bytes;
+    std::vector<double> times;  // Of each iteration
+};
+
+static void ParseCommandLine( int argc, const char* argv[], BenchConfig& cfg );
+static void PrintUsage();
+static bool KernelSelected( const BenchConfig& cfg, const char* name );
+static void PrintResults( const BenchKernel& kernel, const std::vector<BenchResult>& results );
+static void WriteCsv( const char* path, const std::vector<std::vector<BenchResult>>& results );
+static bool CheckBaseline( const BenchConfig& cfg, const std::vector<std::vector<BenchResult>>& results );
+
+//-----------------------------------------------------------
+int main( int argc, const char* argv[] )
+{
+    BenchConfig cfg;
+    ParseCommandLine( argc-1, argv+1, cfg );
+
+    // By default, powers of 2 up to all the system's threads
+    if( cfg.threadCountCount == 0 )
+    {
+        const uint maxThreads = std::min( SysHost::GetLogicalCPUCount(), (uint)MAX_THREADS );
+
+        for( uint t = 1; t < maxThreads && cfg.threadCountCount < BB_BENCH_MAX_THREAD_COUNTS - 1; t *= 2 )
+            cfg.threadCounts[cfg.threadCountCount++] = t;
+
+        cfg.threadCounts[cfg.threadCountCount++] = maxThreads;
+    }
+
+    // Cap the SIMD kernels, so that their levels can be compared on the same host
+    if( cfg.simd )
+    {
+        SimdLevel level;
+        FatalIf( !KernelDispatch::ParseLevel( cfg.simd, level ), "Unknown SIMD level '%s'.", cfg.simd );
+        FatalIf( !KernelDispatch::IsSupported( level ), "This CPU does not support %s.", cfg.simd );
+
+        KernelDispatch::Resolve( level );
+    }
+    else
+        KernelDispatch::Resolve( KernelDispatch::Detect() );
+
+    KernelDispatch::LogSelected();
+
+    if( cfg.plotPath )
+        return BenchLookups( cfg );
+
+    const uint maxThreads = *std::max_element( cfg.threadCounts, cfg.threadCounts + cfg.threadCountCount );
+
+    BenchContext bx;
+    ZeroMem( &bx );
+
+    bx.cfg        = &cfg;
+    bx.entryCount = 1ull << cfg.log2Entries;
+
+    MemPhase1 phase1( bx.cx );
+    MemPhase2 phase2( bx.cx );
+    bx.phase1 = &phase1;
+    bx.phase2 = &phase2;
+
+    Log::Line( "Benchmarking with 2^%u entries, %u iterations each.", cfg.log2Entries, cfg.iterations );
+    BenchAllocBuffers( bx );
+
+    {
+        Log::Line( "Generating inputs..." );
+        ThreadPool   pool  ( maxThreads );
+        ThreadPolicy policy( pool, nullptr, 0, false, nullptr );
+
+        bx.cx.threadPool   = &pool;
+        bx.cx.threadPolicy = &policy;
+        BenchGenInputs( bx );
+    }
+
+    std::vector<std::vector<BenchResult>> results( BenchKernelCount );
+
+    for( uint t = 0; t < cfg.threadCountCount; t++ )
+    {
+        const uint threadCount = cfg.threadCounts[t];
+
+        ThreadPool   pool  ( threadCount );
+        ThreadPolicy policy( pool, nullptr, 0, false, nullptr );
+
+        bx.cx.threadPool   = &pool;
+        bx.cx.threadPolicy = &policy;
+        bx.cx.threadCount  = threadCount;
+
+        for( uint k = 0; k < BenchKernelCount; k++ )
+        {
+            const BenchKernel& kernel = BenchKernels[k];
+
+            if( !KernelSelected( cfg, kernel.name ) )
+                continue;
+
+            // Kernels without a thread scaling curve run once
+            if( !kernel.threaded && t > 0 )
+                continue;
+
+            if( !kernel.threaded && !cfg.outDir )
+            {
+                Log::Line( "Skipping '%s', which needs an output directory.", kernel.name );
+                continue;
+            }
+
+            Log::Line( "Running '%s' with %u threads...", kernel.name, threadCount );
+
+            BenchResult result;
+            result.threadCount = kernel.threaded ? threadCount : 0;
+
+            for( uint i = 0; i < cfg.iterations; i++ )
+                result.times.push_back( kernel.run( bx, result.entries, result.bytes ) );
+
+            std::vector<double> sorted = result.times;
+            std::sort( sorted.begin(), sorted.end() );
+            result.seconds = sorted[sorted.size() / 2];
+
+            results[k].push_back( result );
+        }
+    }
+
+    Log::Line( "" );
+    for( uint k = 0; k < BenchKernelCount; k++ )
+    {
+        if( !results[k].empty() )
+            PrintResults( BenchKernels[k], results[k] );
+    }
+
+    if( cfg.csvPath )
+        WriteCsv( cfg.csvPath, results );
+
+    bool regressed = false;
+    if( cfg.baselinePath )
+        regressed = CheckBaseline( cfg, results );
+
+    BenchFreeBuffers( bx );
+    return regressed ? 1 : 0;
+}
+
+// Each kernel is measured per thread count, as '<kernel>@<threads>'.
+// Baselines are only comparable at the same scale, on the same machine.
+// Returns true if any kernel regressed.
+//-----------------------------------------------------------
+bool CheckBaseline( const BenchConfig& cfg, const std::vector<std::vector<BenchResult>>& results )
+{
+    char config[64];
+    sprintf( config, "bench-n%u-cpus%u", cfg.log2Entries, SysHost::GetLogicalCPUCount() );
+
+    // Capped kernels get their own baseline
+    if( cfg.simd )
+        sprintf( config + strlen( config ), "-%s", cfg.simd );
+
+    Baseline baseline( config );
+    const bool compare = !cfg.saveBaseline && baseline.Load( cfg.baselinePath );
+
+    if( compare )
+    {
+        Log::Line( "Comparing against the baseline '%s', with a %.1lf%% threshold:", cfg.baselinePath, cfg.threshold * 100.0 );
+        Baseline::LogHeader();
+    }
+
+    uint regressions = 0;
+
+    for( uint k = 0; k < BenchKernelCount; k++ )
+    {
+        for( const BenchResult& r : results[k] )
+        {
+            char name[64];
+            if( r.threadCount )
+                sprintf( name, "%s@%u", BenchKernels[k].name, r.threadCount );
+            else
+                sprintf( name, "%s", BenchKernels[k].name );
+
+            if( compare )
+            {
+                if( baseline.Compare( name, r.times, cfg.threshold ) == Baseline::Result::Slower )
+                    regressions++;
+            }
+            else
+                baseline.Set( name, r.times );
+        }
+    }
+
+    if( !compare )
+    {
+        if( baseline.Save( cfg.baselinePath ) )
+            Log::Line( "Recorded the baseline '%s'.", cfg.baselinePath );
+
+        return false;
+    }
+
+    Log::Line( "" );
+    if( regressions )
+        Log::Error( "%u kernel(s) regressed.", regressions );
+    else
+        Log::Line( "No regressions." );
+
+    return regressions > 0;
+}
+
+//-----------------------------------------------------------
+void PrintResults( const BenchKernel& kernel, const std::vector<BenchResult>& results )
+{
+    Log::Line( "%s: %s", kernel.name, kernel.description );
+    Log::Line( "  Threads   Time (ms)   M entries/s       GB/s   Speedup  Efficiency" );
+
+    const BenchResult& base = results[0];
+
+    for( const BenchResult& r : results )
+    {
+        const double speedup    = base.seconds / r.seconds;
+        const double efficiency = r.threadCount ? speedup * base.threadCount / r.threadCount : 1.0;
+
+        char threads[16] = "-", rate[32] = "-";
+
+        if( r.threadCount )
+            sprintf( threads, "%u", r.threadCount );
+
+        if( r.entries )
+            sprintf( rate, "%.2lf", r.entries / r.seconds / 1e6 );
+
+        Log::Line( "  %7s  %10.3lf  %12s  %9.3lf  %7.2lfx  %9.1lf%%",
+                   threads, r.seconds * 1000.0, rate, r.bytes / r.seconds / 1e9, speedup, efficiency * 100.0 );
+    }
+
+    Log::Line( "" );
+}
+
+//-----------------------------------------------------------
+void WriteCsv( const char* path, const std::vector<std::vector<BenchResult>>& results )
+{
+    FILE* file = fopen( path, "w" );
+    if( !file )
+    {
+        const int err = errno;
+        Log::Error( "Warning: Failed to open CSV file '%s' with error %d.", path, err );
+        return;
+    }
+
+    fprintf( file, "kernel,threads,seconds,entries_per_second,gb_per_second\n" );
+
+    for( uint k = 0; k < BenchKernelCount; k++ )
+    {
+        for( const BenchResult& r : results[k] )
+        {
+            fprintf( file, "%s,%u,%.6lf,%.1lf,%.4lf\n", BenchKernels[k].name, r.threadCount,
+                     r.seconds, r.entries / r.seconds, r.bytes / r.seconds / 1e9 );
+        }
+    }
+
+    fclose( file );
+}
+
+//-----------------------------------------------------------
+bool KernelSelected( const BenchConfig& cfg, const char* name )
+{
+    if( !cfg.filter )
+        return true;
+
+    const size_t length = strlen( name );
+
+    for( const char* s = cfg.filter; *s; )
+    {
+        const char* end = strchr( s, ',' );
+        if( !end )
+            end = s + strlen( s );
+
+        if( (size_t)( end - s ) == length && strncmp( s, name, length ) == 0 )
+            return true;
+
+        s = *end ? end + 1 : end;
+    }
+
+    return false;
+}
+
+//-----------------------------------------------------------
+void ParseCommandLine( int argc, const char* argv[], BenchConfig& cfg )
+{
+    #define check( a ) (strcmp( a, arg ) == 0)
+    int i;
+    const char* arg = nullptr;
+
+    auto value = [&](){
+
+        if( ++i >= argc )
+            Fatal( "Expected a value for parameter '%s'", arg );
+
+        return argv[i];
+    };
+
+    auto uvalue = [&]() {
+
+        const char* val = value();
+        char* end = nullptr;
+        const unsigned long v = strtoul( val, &end, 10 );
+
+        if( end == val || *end != '\0' || v > 0xFFFFFFFF )
+            Fatal( "Invalid value for argument '%s'.", arg );
+
+        return (uint32)v;
+    };
+
+    for( i = 0; i < argc; i++ )
+    {
+        arg = argv[i];
+
+        if( check( "-h" ) || check( "--help") )
+        {
+            PrintUsage();
+            exit( 0 );
+        }
+        else if( check( "-n" ) || check( "--entries" ) )
+        {
+            cfg.log2Entries = uvalue();
+            FatalIf( cfg.log2Entries < 16 || cfg.log2Entries > _K, "The entry count must be between 2^16 and 2^%u.", _K );
+        }
+        else if( check( "-i" ) || check( "--iterations" ) )
+        {
+            cfg.iterations = uvalue();
+            FatalIf( cfg.iterations < 1, "At least 1 iteration is required." );
+        }
+        else if( check( "-t" ) || check( "--threads" ) )
+        {
+            // Comma-separated list of thread counts
+            for( const char* s = value(); *s; )
+            {
+                char* end = nullptr;
+                const unsigned long count = strtoul( s, &end, 10 );
+
+                FatalIf( end == s || ( *end != ',' && *end != '\0' ) || count < 1 || count > MAX_THREADS,
+                         "Invalid thread count list '%s'.", argv[i] );
+                FatalIf( cfg.threadCountCount >= BB_BENCH_MAX_THREAD_COUNTS, "Too many thread counts. Max is %u.", BB_BENCH_MAX_THREAD_COUNTS );
+
+                cfg.threadCounts[cfg.threadCountCount++] = (uint)count;
+                s = *end ? end + 1 : end;
+            }
+        }
+        else if( check( "-k" ) || check( "--kernels" ) )
+        {
+            cfg.filter = value();
+        }
+        else if( check( "-o" ) || check( "--out" ) )
+        {
+            cfg.outDir = value();
+        }
+        else if( check( "--csv" ) )
+        {
+            cfg.csvPath = value();
+        }
+        else if( check( "--baseline" ) )
+        {
+            cfg.baselinePath = value();
+        }
+        else if( check( "--save-baseline" ) )
+        {
+            cfg.saveBaseline = true;
+        }
+        else if( check( "--threshold" ) )
+        {
+            cfg.threshold = uvalue() / 100.0;
+        }
+        else if( check( "-p" ) || check( "--plot" ) )
+        {
+            cfg.plotPath = value();
+        }
+        else if( check( "--challenges" ) )
+        {
+            cfg.challengeCount = uvalue();
+            FatalIf( cfg.challengeCount == 0, "--challenges must be greater than 0." );
+        }
+        else if( check( "--simd" ) )
+        {
+            cfg.simd = value();
+        }
+        else if( check( "-l" ) || check( "--list" ) )
+        {
+            for( uint k = 0; k < BenchKernelCount; k++ )
+                Log::Line( " %-12s: %s", BenchKernels[k].name, BenchKernels[k].description );
+            exit( 0 );
+        }
+        else
+            Fatal( "Unexpected argument '%s'.", arg );
+    }
+
+    #undef check
+}
+
+//-----------------------------------------------------------
+void PrintUsage()
+{
+    fputs(
+R"(bladebit_bench [OPTIONS]
+
+Runs each of the plotter's hot kernels in isolation, on synthetic inputs of
+the given scale, for each of the given thread counts, and prints the median
+time, entries/s and GB/s of each, with its thread scaling.
+GB/s counts the bytes of the kernel's inputs and outputs.
+
+[OPTIONS]:
+ -h, --help           : Shows this message and exits.
+
+ -n, --entries <n>    : Entries per table, as a power of 2. Default is 24.
+                        The inputs are scaled so that their kBC groups,
+                        parks and checkpoints have the density of a k32 plot's.
+
+ -i, --iterations <n> : Timed runs of each kernel per thread count,
+                        of which the median is reported. Default is 3.
+
+ -t, --threads <list> : Comma-separated thread counts to run each kernel with.
+                        Default is powers of 2 up to the system's thread count.
+
+ -k, --kernels <list> : Comma-separated kernels to run. Default is all of them.
+
+ -l, --list           : Lists the kernels and exits.
+
+ -o, --out <dir>      : Directory in which to benchmark the plot writer.
+                        The plot writer is skipped if not given.
+
+ --csv <file>         : Writes the results to the given file as CSV.
+
+ --baseline <file>    : Compares each kernel's times against the given
+                        per-machine baseline, and exits with 1 if any
+                        kernel regressed. If the file does not exist,
+                        it is recorded instead. Use -i 10 or more, so
+                        that noise can be told from regressions.
+
+ --save-baseline      : Records the baseline even if it exists.
+
+ --threshold <pct>    : Slowdown tolerated over the baseline, in percent.
+                        Kernels are flagged if they are slower by more than
+                        this, beyond their 95% confidence interval.
+                        Default is 5.
+
+ -p, --plot <file>    : Benchmarks harvester lookups against the given plot
+                        instead of the kernels. For each thread count,
+                        the quality and full proof lookups of random
+                        challenges are timed, with the plot evicted from
+                        the page cache (Linux only), then cached, and
+                        their p50 and p99 latencies are reported.
+                        Only -t and --csv apply.
+
+ --challenges <n>     : Challenges looked up per pass with --plot.
+                        Default is 1000.
+
+ --simd <level>       : Widest SIMD kernels to run: scalar, sse2, avx2 or
+                        avx512 on x86-64, scalar or neon on ARM64.
+                        Defaults to the widest the CPU supports.
+
+The 'mark' kernel uses the bitfields of a k32 table, whatever the scale:
+512 MiB per thread, plus one more.
+)", stdout );
+}
@@ -0,0 +1,21 @@
+#include "GpuCompute.h"
+#include "util/Log.h"
+
+//-----------------------------------------------------------
+GpuCompute* GpuCompute::Create( const int device )
+{
+#if BB_GPU
+    GpuCompute* gpu = CreateGpuBackend( device );
+
+    if( gpu )
+        Log::Line( "F1 and Fx are computed on GPU %d: %s.", device, gpu->Name() );
+    else
+        Log::Line( "GPU %d can't be used. F1 and Fx are computed on the CPU.", device );
+
+    return gpu;
+#else
+    (void)device;
+    Log::Line( "bladebit was built without a GPU backend (see BB_CUDA). F1 and Fx are computed on the CPU." );
+    return nullptr;
+#endif
+}
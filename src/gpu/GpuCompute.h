@@ -0,0 +1,50 @@
+#pragma once
+#include "ChiaConsts.h"
+#include <functional>
+
+struct Pair;
+
+// Called on the plotting thread each time the device's outputs up to readyCount entries
+// have been copied back to the host, while the device goes on with the next entries.
+typedef std::function<void( uint64 readyCount )> GpuReadyFunc;
+
+/**
+ * Offloads F1 generation and the Fx computation of tables 2-7 to a GPU.
+ *
+ * The device works on slices of the table, as large as its memory allows, with two slices in flight:
+ * while one is being computed, the next one's inputs are copied to the device, and the previous one's
+ * outputs are copied back to the host. The caller is notified as each slice lands in its output buffers,
+ * so that it can start sorting them on the CPU while the device computes the rest of the table.
+ *
+ * The outputs are the same as the CPU kernels', so the plot does not depend on where it was computed.
+ * A GpuCompute may be used from one thread at a time.
+ */
+class GpuCompute
+{
+public:
+    // Opens the given device. Logs why, and returns nullptr, if there is no such device,
+    // or bladebit was built without a GPU backend, in which case F1 and Fx are left to the CPU.
+    static GpuCompute* Create( int device );
+
+    virtual ~GpuCompute() {}
+
+    // Name of the device
+    virtual const char* Name() const = 0;
+
+    // Generates the y of each of the 2^k F1 entries into yOut, unsorted, in x order.
+    // key is the ChaCha8 key: the table index (1), followed by the first 31 bytes of the plot id.
+    virtual void GenerateF1( const byte key[32], uint64* yOut, const GpuReadyFunc& onReady ) = 0;
+
+    // Computes fx of entryCount L/R pairs of entries of the previous table, whose y and metadata are yIn
+    // and metaIn, into yOut and metaOut, in pair order. The pairs must be ordered by their left entry.
+    // The metadata types are the ones of TableMetaType<table>, and yOut is uint32 for table 7,
+    // uint64 otherwise, as with MemPhase1::FpComputeFx().
+    virtual void ComputeFx( TableId table, uint64 entryCount, const Pair* pairs,
+                            const uint64* yIn, const void* metaIn,
+                            void* yOut, void* metaOut, const GpuReadyFunc& onReady ) = 0;
+};
+
+#if BB_GPU
+    // Implemented by the backend selected at build time (see BB_CUDA and BB_HIP in CMakeLists.txt)
+    GpuCompute* CreateGpuBackend( int device );
+#endif
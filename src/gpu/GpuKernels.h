@@ -0,0 +1,325 @@
+#pragma once
+
+/**
+ * Per-entry F1 and Fx functions of the GPU backends.
+ *
+ * They compute the same values as F1JobThread() and ComputeFxChunk(), one entry at a time,
+ * with no host-only dependencies, so that they can be compiled for the device by a backend,
+ * and for the host, to check them against the CPU kernels.
+ *
+ * Metadata is read and written as the 32-bit words of its packed entry: 1 word for uint32 metadata,
+ * 2 for uint64, 3 for Meta3 (m0 followed by m1) and 4 for Meta4.
+ */
+
+#if defined( __CUDACC__ ) || defined( __HIPCC__ )
+    #define BB_GPU_FN __host__ __device__ inline
+#else
+    #define BB_GPU_FN inline
+#endif
+
+#ifndef _K
+    #define _K 32
+#endif
+
+// Mirrors ChiaConsts.h, which can't be included in device code
+#define BB_GPU_EXTRA_BITS      6
+#define BB_GPU_F1_BLOCK_BITS   512
+
+// Entries per ChaCha8 block group: each group of 512 entries spans exactly k blocks
+#define BB_GPU_F1_GROUP_ENTRIES BB_GPU_F1_BLOCK_BITS
+
+typedef unsigned int       gpu_uint32;
+typedef unsigned long long gpu_uint64;
+
+//-----------------------------------------------------------
+BB_GPU_FN gpu_uint32 GpuSwap32( const gpu_uint32 v )
+{
+    return ( v >> 24 ) | ( ( v >> 8 ) & 0xFF00 ) | ( ( v << 8 ) & 0xFF0000 ) | ( v << 24 );
+}
+
+//-----------------------------------------------------------
+BB_GPU_FN gpu_uint64 GpuSwap64( const gpu_uint64 v )
+{
+    return (gpu_uint64)GpuSwap32( (gpu_uint32)v ) << 32 | GpuSwap32( (gpu_uint32)( v >> 32 ) );
+}
+
+//-----------------------------------------------------------
+BB_GPU_FN gpu_uint32 GpuRotl32( const gpu_uint32 v, const gpu_uint32 n )
+{
+    return ( v << n ) | ( v >> ( 32 - n ) );
+}
+
+//-----------------------------------------------------------
+BB_GPU_FN gpu_uint32 GpuRotr32( const gpu_uint32 v, const gpu_uint32 n )
+{
+    return ( v >> n ) | ( v << ( 32 - n ) );
+}
+
+
+///
+/// F1
+///
+#define BB_GPU_CHACHA_QR( a, b, c, d )                   \
+    a += b; d = GpuRotl32( d ^ a, 16 );                  \
+    c += d; b = GpuRotl32( b ^ c, 12 );                  \
+    a += b; d = GpuRotl32( d ^ a, 8  );                  \
+    c += d; b = GpuRotl32( b ^ c, 7  )
+
+// Generates ChaCha8 keystream block blockIdx of the given 256-bit key, with a zero IV,
+// as chacha8_get_keystream() does. key holds the key's bytes as little-endian words.
+//-----------------------------------------------------------
+BB_GPU_FN void GpuChacha8Block( const gpu_uint32 key[8], const gpu_uint64 blockIdx, gpu_uint32 out[16] )
+{
+    // "expand 32-byte k"
+    gpu_uint32 j[16] = {
+        0x61707865, 0x3320646e, 0x79622d32, 0x6b206574,
+        key[0], key[1], key[2], key[3], key[4], key[5], key[6], key[7],
+        (gpu_uint32)blockIdx, (gpu_uint32)( blockIdx >> 32 ), 0, 0
+    };
+
+    gpu_uint32 x[16];
+    for( int i = 0; i < 16; i++ )
+        x[i] = j[i];
+
+    for( int i = 0; i < 8; i += 2 )
+    {
+        BB_GPU_CHACHA_QR( x[0], x[4], x[ 8], x[12] );
+        BB_GPU_CHACHA_QR( x[1], x[5], x[ 9], x[13] );
+        BB_GPU_CHACHA_QR( x[2], x[6], x[10], x[14] );
+        BB_GPU_CHACHA_QR( x[3], x[7], x[11], x[15] );
+        BB_GPU_CHACHA_QR( x[0], x[5], x[10], x[15] );
+        BB_GPU_CHACHA_QR( x[1], x[6], x[11], x[12] );
+        BB_GPU_CHACHA_QR( x[2], x[7], x[ 8], x[13] );
+        BB_GPU_CHACHA_QR( x[3], x[4], x[ 9], x[14] );
+    }
+
+    for( int i = 0; i < 16; i++ )
+        out[i] = x[i] + j[i];
+}
+
+#undef BB_GPU_CHACHA_QR
+
+// Returns the y of entry i of a keystream that starts at a block group boundary, of which x is the first entry,
+// as F1JobThread() does: the entry's k keystream bits, followed by the top kExtraBits of its x.
+//-----------------------------------------------------------
+BB_GPU_FN gpu_uint64 GpuF1Y( const gpu_uint32* blocks, const gpu_uint64 i, const gpu_uint64 x )
+{
+    const gpu_uint64 bit   = i * _K;
+    const gpu_uint64 word  = bit / 32;
+    const gpu_uint32 shift = (gpu_uint32)( bit % 32 );
+
+    // Only read the next word if the entry reaches into it, as it may be past the end of the keystream
+    gpu_uint64 bits = (gpu_uint64)GpuSwap32( blocks[word] ) << 32;
+    if( shift + _K > 32 )
+        bits |= GpuSwap32( blocks[word+1] );
+
+    const gpu_uint64 f1 = ( bits << shift ) >> ( 64 - _K );
+
+    return f1 << BB_GPU_EXTRA_BITS | ( x + i ) >> ( _K - BB_GPU_EXTRA_BITS );
+}
+
+
+///
+/// Fx
+///
+#define BB_GPU_B3_G( a, b, c, d, mx, my )                \
+    a = a + b + mx; d = GpuRotr32( d ^ a, 16 );          \
+    c = c + d;      b = GpuRotr32( b ^ c, 12 );          \
+    a = a + b + my; d = GpuRotr32( d ^ a, 8  );          \
+    c = c + d;      b = GpuRotr32( b ^ c, 7  )
+
+// Hashes a message of blockLen bytes, up to 64, that fits in a single BLAKE3 block, as blake3_hash_lanes() does.
+// The message words past blockLen must be zero. out gets the first 32 bytes of the hash.
+//-----------------------------------------------------------
+BB_GPU_FN void GpuBlake3Hash( const gpu_uint32 msg[16], const gpu_uint32 blockLen, gpu_uint32 out[8] )
+{
+    const gpu_uint32 IV0 = 0x6A09E667, IV1 = 0xBB67AE85, IV2 = 0x3C6EF372, IV3 = 0xA54FF53A,
+                     IV4 = 0x510E527F, IV5 = 0x9B05688C, IV6 = 0x1F83D9AB, IV7 = 0x5BE0CD19;
+
+    // CHUNK_START | CHUNK_END | ROOT
+    const gpu_uint32 flags = 1 | 2 | 8;
+
+    gpu_uint32 v[16] = {
+        IV0, IV1, IV2, IV3, IV4, IV5, IV6, IV7,
+        IV0, IV1, IV2, IV3, 0, 0, blockLen, flags
+    };
+
+    gpu_uint32 m[16];
+    for( int i = 0; i < 16; i++ )
+        m[i] = msg[i];
+
+    for( int r = 0; r < 7; r++ )
+    {
+        BB_GPU_B3_G( v[0], v[4], v[ 8], v[12], m[ 0], m[ 1] );
+        BB_GPU_B3_G( v[1], v[5], v[ 9], v[13], m[ 2], m[ 3] );
+        BB_GPU_B3_G( v[2], v[6], v[10], v[14], m[ 4], m[ 5] );
+        BB_GPU_B3_G( v[3], v[7], v[11], v[15], m[ 6], m[ 7] );
+        BB_GPU_B3_G( v[0], v[5], v[10], v[15], m[ 8], m[ 9] );
+        BB_GPU_B3_G( v[1], v[6], v[11], v[12], m[10], m[11] );
+        BB_GPU_B3_G( v[2], v[7], v[ 8], v[13], m[12], m[13] );
+        BB_GPU_B3_G( v[3], v[4], v[ 9], v[14], m[14], m[15] );
+
+        // Permute the message words for the next round
+        const gpu_uint32 p[16] = { m[2], m[6], m[ 3], m[10], m[ 7], m[ 0], m[ 4], m[13],
+                                   m[1], m[11], m[12], m[ 5], m[ 9], m[14], m[15], m[ 8] };
+        for( int i = 0; i < 16; i++ )
+            m[i] = p[i];
+    }
+
+    for( int i = 0; i < 8; i++ )
+        out[i] = v[i] ^ v[i+8];
+}
+
+#undef BB_GPU_B3_G
+
+// Serializes fields of up to 64 bits, most significant bit first, as FxBitWriter does
+//-----------------------------------------------------------
+struct GpuBitWriter
+{
+    gpu_uint64 words[5];
+    gpu_uint32 bit;
+
+    BB_GPU_FN GpuBitWriter() : words{ 0, 0, 0, 0, 0 }, bit( 0 ) {}
+
+    BB_GPU_FN void Write( const gpu_uint64 value, const gpu_uint32 bitCount )
+    {
+        const gpu_uint32 word  = bit / 64;
+        const gpu_uint32 shift = bit % 64;
+
+        words[word] |= ( value << ( 64 - bitCount ) ) >> shift;
+
+        if( shift + bitCount > 64 )
+            words[word+1] |= value << ( 128 - shift - bitCount );
+
+        bit += bitCount;
+    }
+};
+
+// Reads bitCount bits, up to 64, at the given bit of the big-endian hash output
+//-----------------------------------------------------------
+BB_GPU_FN gpu_uint64 GpuReadBits( const gpu_uint64 h[3], const gpu_uint32 start, const gpu_uint32 bitCount )
+{
+    const gpu_uint32 word  = start / 64;
+    const gpu_uint32 shift = start % 64;
+
+    gpu_uint64 value = h[word] << shift;
+
+    if( shift + bitCount > 64 )
+        value |= h[word+1] >> ( 64 - shift );
+
+    return value >> ( 64 - bitCount );
+}
+
+//-----------------------------------------------------------
+BB_GPU_FN gpu_uint64 GpuMetaWord64( const gpu_uint32* meta, const gpu_uint32 i )
+{
+    return (gpu_uint64)meta[i] | (gpu_uint64)meta[i+1] << 32;
+}
+
+//-----------------------------------------------------------
+BB_GPU_FN void GpuWriteMetaWord64( gpu_uint32* meta, const gpu_uint32 i, const gpu_uint64 v )
+{
+    meta[i  ] = (gpu_uint32)v;
+    meta[i+1] = (gpu_uint32)( v >> 32 );
+}
+
+// Writes a metadata entry of metaKMultiplier 32-bit words to the serialized input
+//-----------------------------------------------------------
+template<gpu_uint32 metaKMultiplier>
+BB_GPU_FN void GpuWriteMeta( GpuBitWriter& writer, const gpu_uint32* meta )
+{
+    if constexpr( metaKMultiplier == 1 )
+        writer.Write( meta[0], _K );
+    else if constexpr( metaKMultiplier == 2 )
+        writer.Write( GpuMetaWord64( meta, 0 ), _K * 2 );
+    else
+    {
+        // Meta3 and Meta4 hold their high bits in m0, and their low 32 or 64 bits in m1
+        constexpr gpu_uint32 lowBits  = metaKMultiplier == 3 ? 32 : 64;
+        constexpr gpu_uint32 highBits = _K * metaKMultiplier - lowBits;
+
+        writer.Write( GpuMetaWord64( meta, 0 ), highBits );
+
+        if constexpr( metaKMultiplier == 3 )
+            writer.Write( meta[2], lowBits );
+        else
+            writer.Write( GpuMetaWord64( meta, 2 ), lowBits );
+    }
+}
+
+// Computes fx of a pair of entries of the previous table, with y the left entry's y,
+// and writes its output metadata, if it has any.
+// Returns the new y, which is k + kExtraBits bits, or k bits for table 7 (metaKMultiplierOut == 0).
+//-----------------------------------------------------------
+template<gpu_uint32 metaKMultiplierIn, gpu_uint32 metaKMultiplierOut>
+BB_GPU_FN gpu_uint64 GpuFx( const gpu_uint64 y, const gpu_uint32* metaL, const gpu_uint32* metaR, gpu_uint32* metaOut )
+{
+    constexpr gpu_uint32 k         = _K;
+    constexpr gpu_uint32 ySize     = k + BB_GPU_EXTRA_BITS;
+    constexpr gpu_uint32 shiftBits = metaKMultiplierOut == 0 ? 0 : BB_GPU_EXTRA_BITS;
+    constexpr gpu_uint32 inputSize = ( ySize + k * metaKMultiplierIn * 2 + 7 ) / 8;
+    constexpr gpu_uint32 words64   = ( inputSize + 7 ) / 8;
+
+    // Serialize y, L and R
+    GpuBitWriter writer;
+    writer.Write( y, ySize );
+    GpuWriteMeta<metaKMultiplierIn>( writer, metaL );
+    GpuWriteMeta<metaKMultiplierIn>( writer, metaR );
+
+    // The input is hashed as bytes, which are read as little-endian words
+    gpu_uint32 msg[16] = {};
+    for( gpu_uint32 w = 0; w < words64; w++ )
+    {
+        const gpu_uint64 v = GpuSwap64( writer.words[w] );
+        msg[w*2  ] = (gpu_uint32)v;
+        msg[w*2+1] = (gpu_uint32)( v >> 32 );
+    }
+
+    gpu_uint32 hash[8];
+    GpuBlake3Hash( msg, inputSize, hash );
+
+    gpu_uint64 h[3];
+    for( gpu_uint32 w = 0; w < 3; w++ )
+        h[w] = GpuSwap64( (gpu_uint64)hash[w*2] | (gpu_uint64)hash[w*2+1] << 32 );
+
+    const gpu_uint64 f = h[0] >> ( 64 - ( k + shiftBits ) );
+
+    // Output metadata: L + R for tables 2 and 3, taken from the hash, right after y, for tables 4-6
+    if constexpr( metaKMultiplierIn == 1 && metaKMultiplierOut == 2 )
+    {
+        GpuWriteMetaWord64( metaOut, 0, (gpu_uint64)metaL[0] << k | metaR[0] );
+    }
+    else if constexpr( metaKMultiplierIn == 2 && metaKMultiplierOut == 4 )
+    {
+        // L + R is 4k bits, split into its high and low 64 bits
+        const gpu_uint64 l = GpuMetaWord64( metaL, 0 );
+        const gpu_uint64 r = GpuMetaWord64( metaR, 0 );
+
+        if constexpr( k * 2 == 64 )
+        {
+            GpuWriteMetaWord64( metaOut, 0, l );
+            GpuWriteMetaWord64( metaOut, 2, r );
+        }
+        else
+        {
+            GpuWriteMetaWord64( metaOut, 0, l >> ( 64 - k * 2 ) );
+            GpuWriteMetaWord64( metaOut, 2, l << ( k * 2 ) | r );
+        }
+    }
+    else if constexpr( metaKMultiplierOut == 2 )
+    {
+        GpuWriteMetaWord64( metaOut, 0, GpuReadBits( h, ySize, k * 2 ) );
+    }
+    else if constexpr( metaKMultiplierOut == 3 )
+    {
+        GpuWriteMetaWord64( metaOut, 0, GpuReadBits( h, ySize, k * 3 - 32 ) );
+        metaOut[2] = (gpu_uint32)GpuReadBits( h, ySize + k * 3 - 32, 32 );
+    }
+    else if constexpr( metaKMultiplierOut == 4 )
+    {
+        GpuWriteMetaWord64( metaOut, 0, GpuReadBits( h, ySize, k * 4 - 64 ) );
+        GpuWriteMetaWord64( metaOut, 2, GpuReadBits( h, ySize + k * 4 - 64, 64 ) );
+    }
+
+    return f;
+}
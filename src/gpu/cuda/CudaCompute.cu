@@ -0,0 +1,451 @@
+// CUDA backend of GpuCompute. It is also built for AMD GPUs with HIP (BB_HIP),
+// with the CUDA runtime calls it makes mapped to their HIP equivalents.
+#if defined( __HIPCC__ )
+    #include <hip/hip_runtime.h>
+
+    #define cudaError_t             hipError_t
+    #define cudaSuccess             hipSuccess
+    #define cudaGetErrorString      hipGetErrorString
+    #define cudaGetLastError        hipGetLastError
+    #define cudaGetDeviceCount      hipGetDeviceCount
+    #define cudaSetDevice           hipSetDevice
+    #define cudaDeviceProp          hipDeviceProp_t
+    #define cudaGetDeviceProperties hipGetDeviceProperties
+    #define cudaMemGetInfo          hipMemGetInfo
+    #define cudaMalloc              hipMalloc
+    #define cudaFree                hipFree
+    #define cudaMallocHost          hipHostMalloc
+    #define cudaFreeHost            hipHostFree
+    #define cudaStream_t            hipStream_t
+    #define cudaStreamCreate        hipStreamCreate
+    #define cudaStreamDestroy       hipStreamDestroy
+    #define cudaStreamSynchronize   hipStreamSynchronize
+    #define cudaMemcpyAsync         hipMemcpyAsync
+    #define cudaMemcpyHostToDevice  hipMemcpyHostToDevice
+    #define cudaMemcpyDeviceToHost  hipMemcpyDeviceToHost
+#else
+    #include <cuda_runtime.h>
+#endif
+
+#include "pch.h"
+#include "gpu/GpuCompute.h"
+#include "gpu/GpuKernels.h"
+#include "util/Log.h"
+#include <algorithm>
+
+#define BB_GPU_THREADS_PER_BLOCK 256
+
+// Slices in flight at once: one computing while the other is being copied to or from the device
+#define BB_GPU_SLOT_COUNT 2
+
+// Largest and smallest slices, in entries. Each slot takes BB_GPU_SLOT_BYTES_PER_ENTRY bytes
+// per entry of device memory, and as much pinned host memory for staging.
+#define BB_GPU_MAX_SLICE ( 1ull << 23 )
+#define BB_GPU_MIN_SLICE ( 1ull << 16 )
+
+// A slice of pairs reads the y and metadata of up to twice as many entries of the previous table,
+// as each right entry is at most a couple of kBC groups past its left entry.
+#define BB_GPU_IN_ENTRIES_PER_PAIR 2
+
+// Per slice entry: its pair (8 bytes), the y (8) and metadata (up to 16) of the entries it reads, and its y and metadata outputs
+#define BB_GPU_SLOT_IN_BYTES_PER_ENTRY  ( 8 + BB_GPU_IN_ENTRIES_PER_PAIR * ( 8 + 16 ) )
+#define BB_GPU_SLOT_OUT_BYTES_PER_ENTRY ( 8 + 16 )
+#define BB_GPU_SLOT_BYTES_PER_ENTRY     ( BB_GPU_SLOT_IN_BYTES_PER_ENTRY + BB_GPU_SLOT_OUT_BYTES_PER_ENTRY )
+
+#define CudaCheck( call )                                                                   \
+    {                                                                                       \
+        const cudaError_t err_ = ( call );                                                  \
+        FatalIf( err_ != cudaSuccess, "GPU error '%s' in %s at %s:%d.",                     \
+                 cudaGetErrorString( err_ ), #call, __FILE__, __LINE__ );                   \
+    }
+
+struct Chacha8Key
+{
+    gpu_uint32 words[8];
+};
+
+///
+/// Kernels
+///
+//-----------------------------------------------------------
+__global__ void F1KeystreamKernel( const Chacha8Key key, const gpu_uint64 firstBlock, const gpu_uint64 blockCount, gpu_uint32* blocks )
+{
+    const gpu_uint64 i = (gpu_uint64)blockIdx.x * blockDim.x + threadIdx.x;
+    if( i >= blockCount )
+        return;
+
+    GpuChacha8Block( key.words, firstBlock + i, blocks + i * 16 );
+}
+
+//-----------------------------------------------------------
+__global__ void F1Kernel( const gpu_uint32* blocks, const gpu_uint64 x, const gpu_uint64 entryCount, gpu_uint64* yOut )
+{
+    const gpu_uint64 i = (gpu_uint64)blockIdx.x * blockDim.x + threadIdx.x;
+    if( i >= entryCount )
+        return;
+
+    yOut[i] = GpuF1Y( blocks, i, x );
+}
+
+// pairs index the previous table's entries from inOffset, which are the first entries of yIn and metaIn
+//-----------------------------------------------------------
+template<gpu_uint32 metaKMultiplierIn, gpu_uint32 metaKMultiplierOut>
+__global__ void FxKernel( const gpu_uint32* pairs, const gpu_uint64 entryCount, const gpu_uint32 inOffset,
+                          const gpu_uint64* yIn, const gpu_uint32* metaIn, void* yOut, gpu_uint32* metaOut )
+{
+    const gpu_uint64 i = (gpu_uint64)blockIdx.x * blockDim.x + threadIdx.x;
+    if( i >= entryCount )
+        return;
+
+    const gpu_uint32 left  = pairs[i*2  ] - inOffset;
+    const gpu_uint32 right = pairs[i*2+1] - inOffset;
+
+    const gpu_uint64 y = GpuFx<metaKMultiplierIn, metaKMultiplierOut>( yIn[left],
+                            metaIn + (gpu_uint64)left  * metaKMultiplierIn,
+                            metaIn + (gpu_uint64)right * metaKMultiplierIn,
+                            metaOut + i * metaKMultiplierOut );
+
+    // Table 7 has 32-bit y's
+    if constexpr( metaKMultiplierOut == 0 )
+        ( (gpu_uint32*)yOut )[i] = (gpu_uint32)y;
+    else
+        ( (gpu_uint64*)yOut )[i] = y;
+}
+
+//-----------------------------------------------------------
+inline uint GridSize( const uint64 count )
+{
+    return (uint)CDiv( count, BB_GPU_THREADS_PER_BLOCK );
+}
+
+
+///
+/// Backend
+///
+class CudaCompute : public GpuCompute
+{
+public:
+    CudaCompute( int device, const char* name, uint64 sliceSize );
+    ~CudaCompute();
+
+    bool Init();
+
+    const char* Name() const override { return _name; }
+
+    void GenerateF1( const byte key[32], uint64* yOut, const GpuReadyFunc& onReady ) override;
+
+    void ComputeFx( TableId table, uint64 entryCount, const Pair* pairs,
+                    const uint64* yIn, const void* metaIn,
+                    void* yOut, void* metaOut, const GpuReadyFunc& onReady ) override;
+
+private:
+    // A slice in flight, with its own stream, device buffers and pinned staging buffers
+    struct Slot
+    {
+        cudaStream_t stream = nullptr;
+        byte*        dIn    = nullptr;
+        byte*        dOut   = nullptr;
+        byte*        hIn    = nullptr;
+        byte*        hOut   = nullptr;
+        uint64       offset = 0;        // First entry of the slice
+        uint64       count  = 0;        // Entries in the slice
+    };
+
+    // Runs entryCount entries through the slots in slices. enqueue( slot, offset ) queues the slice starting at offset
+    // on the slot's stream, and returns its entry count. retire( slot ) copies its outputs to the host once it's done.
+    template<typename TEnqueue, typename TRetire>
+    void RunSlices( uint64 entryCount, TEnqueue enqueue, TRetire retire, const GpuReadyFunc& onReady );
+
+    template<uint32 metaKMultiplierIn, uint32 metaKMultiplierOut>
+    void ComputeFxSlices( uint64 entryCount, const Pair* pairs, const uint64* yIn, const uint32* metaIn,
+                          void* yOut, uint32* metaOut, const GpuReadyFunc& onReady );
+
+private:
+    int    _device;
+    char   _name[256];
+    uint64 _sliceSize;
+    Slot   _slots[BB_GPU_SLOT_COUNT];
+};
+
+//-----------------------------------------------------------
+GpuCompute* CreateGpuBackend( const int device )
+{
+    int deviceCount = 0;
+    if( cudaGetDeviceCount( &deviceCount ) != cudaSuccess || deviceCount == 0 )
+    {
+        Log::Line( "No GPU was found." );
+        return nullptr;
+    }
+
+    if( device < 0 || device >= deviceCount )
+    {
+        Log::Error( "GPU %d does not exist. There are %d GPU(s).", device, deviceCount );
+        return nullptr;
+    }
+
+    cudaDeviceProp props;
+    size_t freeMem = 0, totalMem = 0;
+
+    if( cudaSetDevice( device ) != cudaSuccess ||
+        cudaGetDeviceProperties( &props, device ) != cudaSuccess ||
+        cudaMemGetInfo( &freeMem, &totalMem ) != cudaSuccess )
+    {
+        Log::Error( "Failed to query GPU %d: %s", device, cudaGetErrorString( cudaGetLastError() ) );
+        return nullptr;
+    }
+
+    // Leave a quarter of the device's free memory to the runtime
+    uint64 sliceSize = (uint64)freeMem / 4 * 3 / ( BB_GPU_SLOT_COUNT * BB_GPU_SLOT_BYTES_PER_ENTRY );
+    sliceSize = std::min( sliceSize, std::min( BB_GPU_MAX_SLICE, ENTRIES_PER_TABLE ) );
+
+    // F1 slices must be whole ChaCha8 block groups
+    sliceSize = sliceSize / BB_GPU_F1_GROUP_ENTRIES * BB_GPU_F1_GROUP_ENTRIES;
+
+    if( sliceSize < BB_GPU_MIN_SLICE )
+    {
+        Log::Error( "GPU %d does not have enough free memory (%llu MiB).", device, (uint64)freeMem >> 20 );
+        return nullptr;
+    }
+
+    CudaCompute* gpu = new CudaCompute( device, props.name, sliceSize );
+    if( !gpu->Init() )
+    {
+        delete gpu;
+        return nullptr;
+    }
+
+    return gpu;
+}
+
+//-----------------------------------------------------------
+CudaCompute::CudaCompute( const int device, const char* name, const uint64 sliceSize )
+    : _device   ( device    )
+    , _sliceSize( sliceSize )
+{
+    snprintf( _name, sizeof( _name ), "%s", name );
+}
+
+//-----------------------------------------------------------
+CudaCompute::~CudaCompute()
+{
+    cudaSetDevice( _device );
+
+    for( Slot& slot : _slots )
+    {
+        if( slot.stream ) cudaStreamDestroy( slot.stream );
+        if( slot.dIn    ) cudaFree( slot.dIn  );
+        if( slot.dOut   ) cudaFree( slot.dOut );
+        if( slot.hIn    ) cudaFreeHost( slot.hIn  );
+        if( slot.hOut   ) cudaFreeHost( slot.hOut );
+    }
+}
+
+//-----------------------------------------------------------
+bool CudaCompute::Init()
+{
+    const size_t inSize  = (size_t)_sliceSize * BB_GPU_SLOT_IN_BYTES_PER_ENTRY;
+    const size_t outSize = (size_t)_sliceSize * BB_GPU_SLOT_OUT_BYTES_PER_ENTRY;
+
+    for( Slot& slot : _slots )
+    {
+        if( cudaStreamCreate( &slot.stream ) != cudaSuccess ||
+            cudaMalloc( (void**)&slot.dIn , inSize  ) != cudaSuccess ||
+            cudaMalloc( (void**)&slot.dOut, outSize ) != cudaSuccess ||
+            cudaMallocHost( (void**)&slot.hIn , inSize  ) != cudaSuccess ||
+            cudaMallocHost( (void**)&slot.hOut, outSize ) != cudaSuccess )
+        {
+            Log::Error( "Failed to allocate GPU %d's buffers: %s", _device, cudaGetErrorString( cudaGetLastError() ) );
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------
+template<typename TEnqueue, typename TRetire>
+void CudaCompute::RunSlices( const uint64 entryCount, TEnqueue enqueue, TRetire retire, const GpuReadyFunc& onReady )
+{
+    // The device is selected per thread, and the pipelined F1 runs on its own thread
+    CudaCheck( cudaSetDevice( _device ) );
+
+    uint64 queued = 0;
+    uint   slots  = 0;
+
+    for( ; slots < BB_GPU_SLOT_COUNT && queued < entryCount; slots++ )
+    {
+        Slot& slot = _slots[slots];
+        slot.offset = queued;
+        slot.count  = enqueue( slot, queued );
+        queued += slot.count;
+    }
+
+    // Slices are retired in the order they were queued, and each retired slot
+    // gets the next slice before the caller is notified, so that the device is never idle
+    for( uint i = 0; ; i = ( i + 1 ) % slots )
+    {
+        Slot& slot = _slots[i];
+
+        CudaCheck( cudaStreamSynchronize( slot.stream ) );
+        retire( slot );
+
+        const uint64 ready = slot.offset + slot.count;
+
+        if( queued < entryCount )
+        {
+            slot.offset = queued;
+            slot.count  = enqueue( slot, queued );
+            queued += slot.count;
+        }
+
+        if( onReady )
+            onReady( ready );
+
+        if( ready == entryCount )
+            break;
+    }
+}
+
+//-----------------------------------------------------------
+void CudaCompute::GenerateF1( const byte key[32], uint64* yOut, const GpuReadyFunc& onReady )
+{
+    Chacha8Key chachaKey;
+    memcpy( chachaKey.words, key, sizeof( chachaKey.words ) );
+
+    auto enqueue = [&]( Slot& slot, const uint64 x ) {
+
+        const uint64 entryCount = std::min( _sliceSize, ENTRIES_PER_TABLE - x );
+
+        // The keystream is generated in the slot's input buffer, and y to its output buffer
+        const uint64 firstBlock = x * _K / kF1BlockSizeBits;
+        const uint64 blockCount = entryCount * _K / kF1BlockSizeBits;
+
+        gpu_uint32* blocks = (gpu_uint32*)slot.dIn;
+        gpu_uint64* y      = (gpu_uint64*)slot.dOut;
+
+        F1KeystreamKernel<<<GridSize( blockCount ), BB_GPU_THREADS_PER_BLOCK, 0, slot.stream>>>( chachaKey, firstBlock, blockCount, blocks );
+        F1Kernel<<<GridSize( entryCount ), BB_GPU_THREADS_PER_BLOCK, 0, slot.stream>>>( blocks, x, entryCount, y );
+        CudaCheck( cudaGetLastError() );
+
+        CudaCheck( cudaMemcpyAsync( slot.hOut, slot.dOut, entryCount * sizeof( uint64 ), cudaMemcpyDeviceToHost, slot.stream ) );
+
+        return entryCount;
+    };
+
+    auto retire = [&]( const Slot& slot ) {
+        memcpy( yOut + slot.offset, slot.hOut, slot.count * sizeof( uint64 ) );
+    };
+
+    RunSlices( ENTRIES_PER_TABLE, enqueue, retire, onReady );
+}
+
+//-----------------------------------------------------------
+void CudaCompute::ComputeFx( const TableId table, const uint64 entryCount, const Pair* pairs,
+                             const uint64* yIn, const void* metaIn,
+                             void* yOut, void* metaOut, const GpuReadyFunc& onReady )
+{
+    const uint32* mIn  = (const uint32*)metaIn;
+    uint32*       mOut = (uint32*)metaOut;
+
+    // Metadata multipliers of TableMetaType
+    switch( table )
+    {
+        case TableId::Table2: ComputeFxSlices<1, 2>( entryCount, pairs, yIn, mIn, yOut, mOut, onReady ); break;
+        case TableId::Table3: ComputeFxSlices<2, 4>( entryCount, pairs, yIn, mIn, yOut, mOut, onReady ); break;
+        case TableId::Table4: ComputeFxSlices<4, 4>( entryCount, pairs, yIn, mIn, yOut, mOut, onReady ); break;
+        case TableId::Table5: ComputeFxSlices<4, 3>( entryCount, pairs, yIn, mIn, yOut, mOut, onReady ); break;
+        case TableId::Table6: ComputeFxSlices<3, 2>( entryCount, pairs, yIn, mIn, yOut, mOut, onReady ); break;
+        case TableId::Table7: ComputeFxSlices<2, 0>( entryCount, pairs, yIn, mIn, yOut, mOut, onReady ); break;
+
+        default:
+            Fatal( "Invalid table %d for Fx.", (int)table + 1 );
+    }
+}
+
+//-----------------------------------------------------------
+template<uint32 metaKMultiplierIn, uint32 metaKMultiplierOut>
+void CudaCompute::ComputeFxSlices( const uint64 entryCount, const Pair* pairs, const uint64* yIn, const uint32* metaIn,
+                                   void* yOut, uint32* metaOut, const GpuReadyFunc& onReady )
+{
+    // A Pair is its left and right entry, as 32-bit indices
+    const uint32* lrPairs = (const uint32*)pairs;
+
+    const size_t yOutSize    = metaKMultiplierOut == 0 ? sizeof( uint32 ) : sizeof( uint64 );
+    const size_t metaInSize  = metaKMultiplierIn  * sizeof( uint32 );
+    const size_t metaOutSize = metaKMultiplierOut * sizeof( uint32 );
+
+    const uint64 maxInEntries = _sliceSize * BB_GPU_IN_ENTRIES_PER_PAIR;
+
+    auto enqueue = [&]( Slot& slot, const uint64 offset ) {
+
+        uint64 count = std::min( _sliceSize, entryCount - offset );
+
+        // The pairs are ordered by their left entry, so the slice reads the previous table's entries
+        // from its first left entry to its furthest right entry. Shrink the slice if they don't fit.
+        const uint32 inStart = lrPairs[offset*2];
+        uint32       inEnd;
+
+        for( ;; )
+        {
+            inEnd = inStart;
+            for( uint64 i = offset; i < offset + count; i++ )
+                inEnd = std::max( inEnd, lrPairs[i*2+1] );
+
+            if( inEnd - inStart + 1ull <= maxInEntries )
+                break;
+
+            count /= 2;
+        }
+
+        const uint64 inCount = inEnd - inStart + 1ull;
+
+        // Stage the inputs in pinned memory, so that they are copied to the device asynchronously
+        byte* hPairs = slot.hIn;
+        byte* hY     = hPairs + _sliceSize * 2 * sizeof( uint32 );
+        byte* hMeta  = hY     + maxInEntries * sizeof( uint64 );
+
+        const size_t pairsSize = count   * 2 * sizeof( uint32 );
+        const size_t ySize     = inCount * sizeof( uint64 );
+        const size_t metaSize  = inCount * metaInSize;
+
+        memcpy( hPairs, lrPairs + offset * 2, pairsSize );
+        memcpy( hY    , yIn + inStart, ySize );
+        memcpy( hMeta , (const byte*)metaIn + inStart * metaInSize, metaSize );
+
+        byte* dPairs = slot.dIn   + ( hPairs - slot.hIn );
+        byte* dY     = slot.dIn   + ( hY     - slot.hIn );
+        byte* dMeta  = slot.dIn   + ( hMeta  - slot.hIn );
+        byte* dYOut  = slot.dOut;
+        byte* dMOut  = slot.dOut  + _sliceSize * sizeof( uint64 );
+
+        CudaCheck( cudaMemcpyAsync( dPairs, hPairs, pairsSize, cudaMemcpyHostToDevice, slot.stream ) );
+        CudaCheck( cudaMemcpyAsync( dY    , hY    , ySize    , cudaMemcpyHostToDevice, slot.stream ) );
+        CudaCheck( cudaMemcpyAsync( dMeta , hMeta , metaSize , cudaMemcpyHostToDevice, slot.stream ) );
+
+        FxKernel<metaKMultiplierIn, metaKMultiplierOut><<<GridSize( count ), BB_GPU_THREADS_PER_BLOCK, 0, slot.stream>>>(
+            (const gpu_uint32*)dPairs, count, inStart,
+            (const gpu_uint64*)dY, (const gpu_uint32*)dMeta,
+            dYOut, (gpu_uint32*)dMOut );
+        CudaCheck( cudaGetLastError() );
+
+        CudaCheck( cudaMemcpyAsync( slot.hOut, dYOut, count * yOutSize, cudaMemcpyDeviceToHost, slot.stream ) );
+
+        if constexpr( metaKMultiplierOut != 0 )
+        {
+            CudaCheck( cudaMemcpyAsync( slot.hOut + _sliceSize * sizeof( uint64 ), dMOut,
+                                        count * metaOutSize, cudaMemcpyDeviceToHost, slot.stream ) );
+        }
+
+        return count;
+    };
+
+    auto retire = [&]( const Slot& slot ) {
+
+        memcpy( (byte*)yOut + slot.offset * yOutSize, slot.hOut, slot.count * yOutSize );
+
+        if constexpr( metaKMultiplierOut != 0 )
+            memcpy( (byte*)metaOut + slot.offset * metaOutSize, slot.hOut + _sliceSize * sizeof( uint64 ), slot.count * metaOutSize );
+    };
+
+    RunSlices( entryCount, enqueue, retire, onReady );
+}
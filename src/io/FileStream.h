@@ -1,6 +1,11 @@
 #pragma once
 #include "Platform.h"
 
+class IOUring;
+class OverlappedIO;
+class NetSink;
+struct NetKey;
+
 enum class FileAccess : uint16
 {
     None  = 0,
@@ -12,9 +17,10 @@ ImplementFlagOps( FileAccess );
 
 enum class FileMode : uint16
 {
-    Open   = 0,
-    Create = 1,
-    Append = 2
+    Open      = 0,
+    Create    = 1,
+    Append    = 2,
+    CreateNew = 3   // Fails if the file already exists
 };
 
 enum class FileFlags : uint32
@@ -22,6 +28,7 @@ enum class FileFlags : uint32
     None        = 0,
     NoBuffering = 1 << 0,
     LargeFile   = 1 << 1,
+    AsyncIO     = 1 << 2,   // Use the platform's async I/O backend for WriteAsync(), if available (io_uring on Linux, overlapped I/O on Windows)
 };
 ImplementFlagOps( FileFlags );
 
@@ -50,15 +57,54 @@ public:
     static bool Open( const char* path, FileStream& file, FileMode mode, FileAccess access, FileFlags flags = FileFlags::None );
     bool Open( const char* path, FileMode mode, FileAccess access, FileFlags flags = FileFlags::None );
 
+    // Opens a file for writing on a remote plot receiver at "host:port", which shares the secret of key (see NetSink).
+    // Only writing and seeking from the beginning or the current position are supported.
+    bool OpenRemote( const char* address, const NetKey& key, const char* fileName );
+
+    // Returns true if the file was opened with OpenRemote().
+    bool IsRemote() const;
+
     ssize_t Read( void* buffer, size_t size );
+
+    // Reads at the given offset, without moving the read position.
+    // As it doesn't change the stream's state, it may be called from multiple threads at once.
+    ssize_t ReadAt( void* buffer, size_t size, int64 offset );
     ssize_t Write( const void* buffer, size_t size );
 
+    // Queues a write of the whole buffer at the current write position, which is advanced right away.
+    // The buffer must remain valid until WaitForWrites() returns.
+    // Without an async I/O backend, the write completes synchronously.
+    bool WriteAsync( const void* buffer, size_t size );
+
+    // Waits for all writes queued with WriteAsync() to complete.
+    // Returns false if any of them failed.
+    bool WaitForWrites();
+
+    // Registers a buffer that is repeatedly used with WriteAsync(),
+    // so that the backend doesn't have to map it for every write.
+    // Returns false if not supported, which does not prevent writing from it.
+    bool RegisterBuffer( const void* buffer, size_t size );
+
+    // Returns true if WriteAsync() is backed by an async I/O backend.
+    bool IsAsync() const;
+
     bool Reserve( ssize_t size );
+
+    // Returns the size of the file, or -1 if it can't be obtained.
+    int64 Size();
+
+    // Sets the size of the file, releasing any space reserved past it.
+    // Does not move the current position.
+    bool Truncate( int64 size );
     
     bool Seek( int64 offset, SeekOrigin origin );
 
     bool Flush();
 
+    // Evicts the file's cached pages from the OS page cache, so that the next reads go to the device.
+    // Dirty pages are not evicted. Returns false if not supported on this platform.
+    bool EvictCache();
+
     inline size_t BlockSize()
     {
         return _blockSize;
@@ -99,4 +145,16 @@ private:
     #elif PLATFORM_IS_WINDOWS
         HANDLE _fd            = INVALID_HANDLE_VALUE;
     #endif
+
+    #if PLATFORM_IS_LINUX
+        IOUring* _uring       = nullptr;  // Backs WriteAsync() when opened with FileFlags::AsyncIO
+    #endif
+
+    #if PLATFORM_IS_WINDOWS
+        OverlappedIO* _overlapped = nullptr;  // Backs WriteAsync() when opened with FileFlags::AsyncIO
+    #endif
+
+    #if PLATFORM_IS_UNIX
+        NetSink* _net         = nullptr;  // Set when opened with OpenRemote()
+    #endif
 };
\ No newline at end of file
@@ -0,0 +1,97 @@
+#pragma once
+#include "Platform.h"
+
+// Maximum writes in flight on a ring.
+// The actual queue depth is taken from the device, up to this.
+#define BB_IO_URING_MAX_DEPTH   32
+
+// Large writes are split into chunks of this size, so that they can be in flight concurrently
+#define BB_IO_URING_CHUNK_SIZE  ( 4ull * 1024 * 1024 )
+
+/**
+ * Minimal io_uring write queue for a single file (Linux only).
+ *
+ * The file is registered as a fixed file, and writes to the registered buffer
+ * (if any) use fixed buffer writes. Writes are issued at explicit offsets,
+ * up to the queue depth in flight, and completions are reaped whenever a new
+ * write needs a free slot, or when waiting for all of them.
+ * Short writes are re-queued for their remainder.
+ *
+ * Not thread-safe: a ring must only be used by one thread at a time.
+ */
+class IOUring
+{
+public:
+    IOUring();
+    ~IOUring();
+
+    // Returns true if io_uring can be used in this system.
+    static bool IsSupported();
+
+    // Creates the ring for the given file. queueDepth == 0 uses the device's queue depth.
+    bool Init( int fd, uint queueDepth = 0 );
+
+    // Registers a buffer for fixed buffer writes. Replaces any previously registered buffer.
+    // Waits for any pending writes first. Fails if the buffer can't be pinned.
+    bool RegisterBuffer( const void* buffer, size_t size );
+
+    // Queues a write of size bytes at the given file offset.
+    // buffer must remain valid until the write completes.
+    bool Write( const void* buffer, size_t size, uint64 offset );
+
+    // Waits for all queued writes to complete.
+    // Returns false if any of them failed.
+    bool WaitForWrites();
+
+    inline uint QueueDepth() const { return _depth; }
+
+    // Error of the first failed write or call, as an errno value.
+    inline int GetError() const { return _error; }
+
+private:
+    struct Request
+    {
+        const byte* buffer;
+        uint64      offset;
+        uint32      size;
+        bool        fixed;
+    };
+
+    bool MapRings( const void* ringParams );
+    void Destroy();
+    bool Queue( uint slot );
+    bool WaitForCompletion();
+    void Reap();
+
+private:
+    int       _ringFd     = -1;
+    uint      _depth      = 0;
+    int       _error      = 0;
+
+    // Submission ring
+    void*     _sqRing     = nullptr;
+    size_t    _sqRingSize = 0;
+    uint*     _sqHead     = nullptr;
+    uint*     _sqTail     = nullptr;
+    uint      _sqMask     = 0;
+    uint*     _sqArray    = nullptr;
+    void*     _sqes       = nullptr;
+    size_t    _sqesSize   = 0;
+
+    // Completion ring (may share the submission ring's mapping)
+    void*     _cqRing     = nullptr;
+    size_t    _cqRingSize = 0;
+    uint*     _cqHead     = nullptr;
+    uint*     _cqTail     = nullptr;
+    uint      _cqMask     = 0;
+    void*     _cqes       = nullptr;
+
+    // In-flight requests, indexed by their user data
+    Request   _requests [BB_IO_URING_MAX_DEPTH];
+    uint      _freeSlots[BB_IO_URING_MAX_DEPTH];
+    uint      _freeCount  = 0;
+
+    // Registered buffer
+    const byte* _fixedBuffer = nullptr;
+    size_t      _fixedSize   = 0;
+};
@@ -0,0 +1,151 @@
+#pragma once
+#include "Platform.h"
+#include <string>
+
+// Output directories of this form stream plots to a plot receiver (see PlotReceiver)
+#define BB_NET_PATH_PREFIX      "tcp://"
+#define BB_NET_PATH_PREFIX_LEN  ( sizeof( BB_NET_PATH_PREFIX ) - 1 )
+
+#define BB_NET_MAGIC            0x4E425042u  // 'BPBN'
+#define BB_NET_VERSION          2
+
+// Size of the key derived from a shared secret, of a server's nonce, and of a client's proof of the secret
+#define BB_NET_KEY_SIZE         32
+
+// Writes smaller than this are copied into the socket, as pinning their pages costs more
+#define BB_NET_ZEROCOPY_MIN     ( 64ull * 1024 )
+
+///
+/// Plot streaming protocol
+///
+/// On connection, the receiver sends a NetChallenge. The sender opens a file with a Hello frame
+/// followed by the file name and its proof of the shared secret (see NetChallenge).
+/// The receiver creates the file, if it does not exist yet, and replies with its block size. All Data frames
+/// must then be aligned to it, and are followed by their payload.
+/// Sync waits for everything to be written to disk, and is replied to.
+/// End closes the file. The receiver only keeps the file if it was synced
+/// after its last write, and its header was written.
+/// Fields are in the host's byte order, both ends are expected to be little-endian.
+///
+enum class NetFrameType : uint32
+{
+    Hello = 1,
+    Data,
+    Sync,
+    End
+};
+
+struct NetFrame
+{
+    uint32       magic;
+    NetFrameType type;
+    uint64       offset;    // File offset of a Data frame
+    uint64       size;      // Payload size
+};
+
+struct NetReply
+{
+    int32  error;           // errno-style error, or 0
+    uint32 blockSize;       // Replied to Hello only
+};
+
+static_assert( sizeof( NetFrame ) == 24, "Unexpected NetFrame size." );
+
+// Key derived from the secret shared by a server and its clients (see NetSink::LoadKey())
+struct NetKey
+{
+    byte bytes[BB_NET_KEY_SIZE];
+};
+
+// Sent by plot receivers and memory servers on connection, with their protocol's magic and version.
+// The client follows its first request with its proof of the shared secret: the BLAKE3 hash
+// of the nonce, keyed with the secret's key. The secret itself is never sent.
+struct NetChallenge
+{
+    uint32 magic;
+    uint32 version;
+    byte   nonce[BB_NET_KEY_SIZE];
+};
+
+/**
+ * Writes a file remotely, to a plot receiver, over TCP.
+ *
+ * Writes are framed with their file offset, so the file can be written
+ * out of order, just like a local one. The plot writer writes the header
+ * last, with the table pointers set, so the receiver needs no extra fix-ups.
+ *
+ * On Linux, large writes are sent with MSG_ZEROCOPY, straight from the
+ * table buffers. As with asynchronous file writes, their buffers must
+ * not be modified until WaitForWrites() returns.
+ *
+ * Not thread-safe.
+ */
+class NetSink
+{
+public:
+    NetSink();
+    ~NetSink();
+
+    // Connects to a receiver at "host:port" and has it create fileName.
+    bool Connect( const char* address, const NetKey& key, const char* fileName );
+
+    // Sends a write of size bytes at the given offset.
+    // If copy is false, the buffer may still be in use by the network stack until WaitForWrites().
+    bool Write( const void* buffer, size_t size, uint64 offset, bool copy );
+
+    // Waits until the network stack is done with all zero-copy writes' buffers.
+    bool WaitForWrites();
+
+    // Waits until the receiver has written all data to disk.
+    bool Sync();
+
+    // Ends the file and disconnects.
+    void Close();
+
+    inline size_t BlockSize() const { return _blockSize; }
+
+    inline int    GetError()  const { return _error; }
+
+    // Connects a TCP socket to "host:port". Returns -1, and sets error, on failure.
+    static int  ConnectSocket( const char* address, int& error );
+
+    // Listens on a TCP socket bound to host, a name or an address, and port. Returns -1, and sets error, on failure.
+    // If given, outLoopback is set if the address is a loopback one.
+    static int  ListenSocket( const char* host, uint16 port, int backlog, int& error, bool* outLoopback = nullptr );
+
+    // Accepts a connection, and sets peer to its numeric address. Returns -1, with errno set, on failure.
+    static int  Accept( int listener, std::string& peer );
+
+    // Derives the key of the secret in the file at secretPath, ignoring trailing whitespace.
+    // Without a file, the key is that of an empty secret, which is only used on loopback addresses.
+    static bool LoadKey( const char* secretPath, NetKey& outKey );
+
+    // Sends a challenge with a new random nonce. Servers send it as soon as they accept a connection.
+    static bool SendChallenge( int socket, uint32 magic, uint32 version, byte outNonce[BB_NET_KEY_SIZE] );
+
+    // Receives a server's challenge, and computes the proof to follow the first request with.
+    // The error is EPROTO if the server speaks another protocol, or another version of it.
+    static bool RecvChallenge( int socket, uint32 magic, uint32 version, const NetKey& key,
+                               byte outProof[BB_NET_KEY_SIZE], int& error );
+
+    // Whether proof is the one of the key for the nonce. Compared in constant time.
+    static bool CheckProof( const NetKey& key, const byte nonce[BB_NET_KEY_SIZE], const byte proof[BB_NET_KEY_SIZE] );
+
+    // Sends or receives exactly size bytes on a socket.
+    static bool SendAll( int socket, const void* buffer, size_t size, int flags = 0 );
+    static bool RecvAll( int socket, void* buffer, size_t size );
+
+private:
+    bool SendFrame( NetFrameType type, uint64 offset, uint64 size, bool more );
+
+    // Releases the buffers of completed zero-copy writes. If wait is set, waits until all are completed.
+    bool ReapZeroCopy( bool wait );
+
+private:
+    int    _socket    = -1;
+    size_t _blockSize = 0;
+    int    _error     = 0;
+
+    bool   _zeroCopy  = false;  // Set if the socket supports MSG_ZEROCOPY
+    uint32 _zcPending = 0;      // Zero-copy sends whose buffers are still in use
+};
@@ -0,0 +1,70 @@
+#pragma once
+#include "Platform.h"
+
+// Maximum writes in flight on a file
+#define BB_OVERLAPPED_MAX_DEPTH     32
+
+// Large writes are split into chunks of this size, so that they can be in flight concurrently
+#define BB_OVERLAPPED_CHUNK_SIZE    ( 4ull * 1024 * 1024 )
+
+/**
+ * Minimal overlapped I/O write queue for a single file (Windows only).
+ *
+ * The file must have been opened with FILE_FLAG_OVERLAPPED. Writes are issued
+ * at explicit offsets, up to the queue depth in flight, each with its own event.
+ * Completions are reaped whenever a new write needs a free slot, or when
+ * waiting for all of them. Short writes are re-queued for their remainder.
+ *
+ * Not thread-safe: a queue must only be used by one thread at a time.
+ */
+class OverlappedIO
+{
+public:
+    OverlappedIO();
+    ~OverlappedIO();
+
+    // Creates the queue for the given file.
+    bool Init( HANDLE file, uint queueDepth = BB_OVERLAPPED_MAX_DEPTH );
+
+    // Queues a write of size bytes at the given file offset.
+    // buffer must remain valid until the write completes.
+    bool Write( const void* buffer, size_t size, uint64 offset );
+
+    // Waits for all queued writes to complete.
+    // Returns false if any of them failed.
+    bool WaitForWrites();
+
+    inline uint QueueDepth() const { return _depth; }
+
+    // Error of the first failed write or call, as a Win32 error code.
+    inline int GetError() const { return _error; }
+
+    // Synchronously reads or writes at the given offset on an overlapped file handle.
+    static bool TransferSync( HANDLE file, bool write, void* buffer, DWORD size, uint64 offset, DWORD& transferred );
+
+private:
+    struct Request
+    {
+        OVERLAPPED  overlapped;
+        const byte* buffer;
+        uint64      offset;
+        uint32      size;
+    };
+
+    void Destroy();
+    bool Queue( uint slot );
+    bool WaitForCompletion();
+    void Complete( uint slot );
+
+private:
+    HANDLE    _file       = INVALID_HANDLE_VALUE;
+    uint      _depth      = 0;
+    int       _error      = 0;
+
+    // In-flight requests, indexed by slot
+    Request   _requests [BB_OVERLAPPED_MAX_DEPTH];
+    HANDLE    _events   [BB_OVERLAPPED_MAX_DEPTH];  // Signaled when the slot's request completes
+    bool      _pending  [BB_OVERLAPPED_MAX_DEPTH];
+    uint      _freeSlots[BB_OVERLAPPED_MAX_DEPTH];
+    uint      _freeCount  = 0;
+};
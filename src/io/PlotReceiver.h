@@ -0,0 +1,37 @@
+#pragma once
+#include "Platform.h"
+
+// Receive buffer size per connection
+#define BB_NET_RECV_BUFFER_SIZE ( 8ull * 1024 * 1024 )
+
+// Most plots received at once. Connections past them are refused until one is done.
+#define BB_NET_RECV_MAX_CONNECTIONS 16
+
+// Largest file a receiver writes. Plots take about 25.4 bytes per table entry.
+#define BB_NET_RECV_MAX_FILE_SIZE ( ENTRIES_PER_TABLE * 32 )
+
+struct PlotReceiverConfig
+{
+    const char*  bindAddress = "127.0.0.1";  // Address listened on. Only loopback addresses may be used without a secret.
+    uint16       port        = 0;
+    const char** dirs        = nullptr;      // If no directories are given, the current directory is used
+    uint         dirCount    = 0;
+    const char*  secretPath  = nullptr;      // File holding the secret shared with the plotters (see NetSink::LoadKey())
+};
+
+/**
+ * Receives plots streamed by plotters with a NetSink, and writes them to disk.
+ *
+ * Each connection writes one plot file, and is served by its own thread.
+ * The file goes to whichever of the directories has the most free space.
+ * Files are written with their .tmp suffix, and are renamed to their
+ * final name only once the plotter has synced them, and closed them.
+ * Neither the .tmp file nor the plot may exist already: nothing is overwritten.
+ * Only plotters that prove they know the receiver's secret are served.
+ */
+class PlotReceiver
+{
+public:
+    // Listens until the process is terminated.
+    static bool Run( const PlotReceiverConfig& cfg );
+};
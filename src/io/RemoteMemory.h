@@ -0,0 +1,114 @@
+#pragma once
+#include "Platform.h"
+#include "io/NetSink.h"
+
+#define BB_MEM_MAGIC            0x4D425042u  // 'BPBM'
+#define BB_MEM_VERSION          2
+
+// Longest region name accepted by a memory server
+#define BB_MEM_MAX_NAME         127
+
+///
+/// Remote memory protocol
+///
+/// On connection, the server sends a NetChallenge. Every request the client makes
+/// is followed by its proof of the shared secret (see NetChallenge).
+/// The server replies EACCES to a wrong proof, and closes the connection.
+///
+/// The client opens a region of a memory server with an Open frame, whose offset is
+/// the size the region needs, followed by the region's name and the proof. The server creates the
+/// region, or grows it if no other connection has it open, and replies.
+/// Write frames are followed by their payload, which is stored at their offset.
+/// Read frames are replied to, and on success, the reply is followed by the data.
+/// End closes the region, and is replied to once all previous writes are stored.
+/// Free, sent instead of Open, followed by a region name and the proof, releases the region.
+/// Fields are in the host's byte order, both ends are expected to be little-endian.
+///
+enum class MemFrameType : uint32
+{
+    Open = 1,
+    Write,
+    Read,
+    End,
+    Free
+};
+
+struct MemFrame
+{
+    uint32       magic;
+    MemFrameType type;
+    uint64       offset;    // Region offset of a Write or Read, or the region size on Open
+    uint64       size;      // Payload size, or size read
+};
+
+struct MemReply
+{
+    int32  error;           // errno-style error, or 0
+    uint32 reserved;
+};
+
+static_assert( sizeof( MemFrame ) == 24, "Unexpected MemFrame size." );
+
+/**
+ * Reads and writes a region of another host's memory, over TCP, served by a MemoryServer.
+ *
+ * Regions are named, and outlive connections: a region can be written by several connections
+ * at once, at different offsets, and read back later by others. They are released with Free().
+ *
+ * Not thread-safe. Use one RemoteMemory per thread.
+ */
+class RemoteMemory
+{
+public:
+    RemoteMemory();
+    ~RemoteMemory();
+
+    // Connects to a memory server at "host:port" and opens the region,
+    // which is created if needed, with room for at least size bytes.
+    bool Open( const char* address, const NetKey& key, const char* regionName, uint64 size );
+
+    bool Write( const void* buffer, size_t size, uint64 offset );
+    bool Read ( void* buffer, size_t size, uint64 offset );
+
+    // Waits until the server has stored all writes, and disconnects.
+    bool Close();
+
+    inline int GetError() const { return _error; }
+
+    // Releases a region on the memory server at "host:port".
+    // Succeeds if the region did not exist, so it can be used to check that the server is reachable.
+    static bool Free( const char* address, const NetKey& key, const char* regionName, int& error );
+
+private:
+    bool Connect( const char* address, const NetKey& key );
+    bool SendRequest( MemFrameType type, uint64 size, const char* regionName );
+    bool SendFrame( MemFrameType type, uint64 offset, uint64 size );
+    bool RecvReply();
+
+private:
+    int  _socket = -1;
+    int  _error  = 0;
+    byte _proof[BB_NET_KEY_SIZE];
+};
+
+struct MemoryServerConfig
+{
+    const char* bindAddress = "127.0.0.1";  // Address listened on. Only loopback addresses may be used without a secret.
+    uint16      port        = 0;
+    uint64      maxSize     = 0;            // Most memory all regions may hold together, or 0 for the memory available on start
+    const char* secretPath  = nullptr;      // File holding the secret shared with the clients (see NetSink::LoadKey())
+};
+
+/**
+ * Holds regions of memory for RemoteMemory clients on other hosts.
+ *
+ * Each connection is served by its own thread. The regions live
+ * in the server's memory until they are freed, or the server exits.
+ * Only clients that prove they know the server's secret are served.
+ */
+class MemoryServer
+{
+public:
+    // Listens until the process is terminated.
+    static bool Run( const MemoryServerConfig& cfg );
+};
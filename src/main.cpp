@@ -8,6 +8,19 @@
 #include "util/Log.h"
 #include "SysHost.h"
 #include "memplot/MemPlotter.h"
+#include "memplot/TableSpiller.h"
+#include "memplot/ThreadPolicy.h"
+#include "memplot/PlotCheckpoint.h"
+#include "PlotMover.h"
+#include "PlotValidator.h"
+#include "PlotDigest.h"
+#include "io/NetSink.h"
+#include "io/PlotReceiver.h"
+#include "io/RemoteMemory.h"
+#include "PlotJobServer.h"
+#include "PlotManifest.h"
+#include "HostCoordinator.h"
+#include "KernelDispatch.h"
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wreturn-type"
@@ -33,25 +46,118 @@ extern "C" {
 #define PLOT_FILE_FMT_LEN (sizeof( "/plot-k32-2021-08-05-18-55-77a011fc20f0003c3adcc739b615041ae56351a22b690fd854ccb6726e5f43b7.plot.tmp" ))
 
 /// Internal Data Structures
+struct ManifestPlot;
+
 struct Config
 {
     uint            threads            = 0;
     uint            plotCount          = 1;
     bool            warmStart          = false;
+    bool            releaseMemory      = false;
     bool            disableNuma        = false;
     bool            disableCpuAffinity = false;
+    bool            hugePages          = false;
+    bool            autoMode           = false;
+    bool            numaFirstTouch     = false;
+    bool            numaPerBuffer      = false;
+    bool            farMemory          = false;
+    bool            numaReport         = false;
+    uint            ioCores            = 0;         // Cores reserved for the I/O threads
+    int             ioNode             = -1;        // Node to reserve them on, -1 to pick it from the output drive
+    bool            fusedF1            = false;
+    bool            bucketedFp         = false;
+    bool            packedFxSort       = false;
+    bool            blockedMap         = false;
+    bool            inPlaceSort        = false;
+    bool            fusedPrune         = false;
+    bool            bucketedLpSort     = false;
+    bool            binnedLookup       = false;
+    bool            streamParks        = false;
+    bool            fusedCheckpoints   = false;
+    bool            overlapParks       = false;
+    bool            noAsyncIO          = false;
+    bool            pipeline           = false;
+    bool            preallocatePlot    = false;
+    bool            prepareOutput      = false;
+    bool            digestPlot         = false;
+    uint            droppedXBits       = 0;
+    uint            selfCheckProofs    = 0;
+    int             gpuDevice          = -1;
+    uint            spinTime           = BB_THREAD_POOL_SPIN_TIME_US;
+    const char*     simd               = nullptr;   // Widest SIMD kernels to run, by level name
+    const char*     kernelThreads[BB_MAX_KERNEL_THREAD_SETTINGS];
+    uint            kernelThreadCount  = 0;
+    bool            tuneThreads        = false;
+    const char*     threadCachePath    = nullptr;
+    const char*     profileDir         = nullptr;
+    bool            perfCounters       = false;
+    bool            memBandwidth       = false;
+    bool            logJson            = false;
+    uint            benchmarkCount     = 0;
+    uint            benchFirstPhase    = 1;
+    uint            benchLastPhase     = 4;
+    const char*     benchCacheDir      = nullptr;
+    const char*     benchBaseline      = nullptr;
+    bool            benchSaveBaseline  = false;
+    uint            benchThreshold     = 5;
+    const char*     metricsAddress     = nullptr;
+    const char*     traceDir           = nullptr;
+    uint16          receivePort        = 0;
+    uint16          memoryServerPort   = 0;
+    uint64          memoryServerSize   = 0;
+    const char*     bindAddress        = "127.0.0.1";
+    const char*     netSecretPath      = nullptr;
+    const char*     daemonSocket       = nullptr;
+    const char*     validatePath       = nullptr;
+    const char*     verifyDigestPath   = nullptr;
+    uint            challengeCount     = 100;
 
     bls::G1Element  farmerPublicKey;
+    bool            hasFarmerKey       = false;
     bls::G1Element* poolPublicKey      = nullptr;
     
     ByteSpan*       contractPuzzleHash = nullptr;
-    const char*     outputFolder       = nullptr;
+    const char*     outputFolders[BB_MAX_OUTPUT_DIRS];
+    uint            outputFolderCount  = 0;
 
     int             maxFailCount       = 100;
 
     const char*     plotId             = nullptr;
     const char*     plotMemo           = nullptr;
     bool            showMemo           = false;
+
+    const char*     manifestPath       = nullptr;
+    std::vector<ManifestPlot>* manifest = nullptr;  // The manifest's plots, with their ids and memos generated
+
+    const char*     spillPaths[BB_MAX_SPILL_PATHS];
+    uint            spillPathCount     = 0;
+    bool            compressTables     = false;
+
+    const char*     moveDirs[BB_MAX_MOVE_DIRS];
+    uint            moveDirCount       = 0;
+    uint            moveBandwidth      = 0;
+
+    const char*     checkpointDir      = nullptr;
+
+    // Instances of the host plotting together
+    const char*     coordinateGroup    = nullptr;
+    uint            instanceCount      = 0;         // 0 to pick it from the host's NUMA nodes
+    uint            writeBandwidth     = 0;         // Cap on the host's plot writes, in MiB/s. 0 means unlimited.
+    HostCoordinator* coordinator       = nullptr;
+};
+
+// A plot of the manifest, with its keys parsed
+struct ManifestPlot
+{
+    uint32          line;
+    std::string     outputDir;
+    bls::G1Element  farmerPublicKey;
+    bls::G1Element* poolPublicKey      = nullptr;   // The plot's own keys, or the command line's
+    ByteSpan*       contractPuzzleHash = nullptr;
+
+    byte            plotId[32];
+    byte            memo[48+48+32];
+    uint16          memoSize;
 };
 
 /// Internal Functions
@@ -59,6 +165,11 @@ void            ParseCommandLine( int argc, const char* argv[], Config& cfg );
 bool            HexPKeyToG1Element( const char* hexKey, bls::G1Element& pkey );
 
 ByteSpan        DecodePuzzleHash( const char* poolContractAddress );
+bool            IsValidContractAddress( const char* poolContractAddress );
+void            MakePlotFileName( const byte plotId[32], char plotFileName[], char plotIdStr[65] );
+int             RunDaemon( Config& cfg, MemPlotter& plotter );
+void            LoadManifest( Config& cfg );
+int             RunManifest( Config& cfg, MemPlotter& plotter );
 void            GeneratePlotIdAndMemo( Config& cfg, byte plotId[32], byte plotMemo[48+48+32], uint16& outMemoSize );
 bls::PrivateKey MasterSkToLocalSK( bls::PrivateKey& sk );
 bls::G1Element  GeneratePlotPublicKey( const bls::G1Element& localPk, bls::G1Element& farmerPk, const bool includeTaproot );
@@ -78,10 +189,16 @@ void PrintUsage();
 #endif
 
 //-----------------------------------------------------------
-const char* USAGE = "bladebit [<OPTIONS>] [<out_dir>]\n"
+const char* USAGE = "bladebit [<OPTIONS>] [<out_dir>...]\n"
 R"(
 <out_dir>: Output directory in which to output the plots.
            This directory must exist.
+           Several directories can be given, each one gets its own
+           writer thread. Each plot is written to a directory that is
+           not busy writing the previous plot, with the most free space.
+           A directory of the form tcp://<host>:<port> streams plots
+           to a bladebit instance running with --receive on that host
+           (not supported on Windows). See --secret.
 
 OPTIONS:
 
@@ -105,6 +222,12 @@ OPTIONS:
 
  -w, --warm-start     : Touch all pages of buffer allocations before starting to plot.
 
+ --release-memory     : Release the memory of the buffers that each phase
+                        does not use while it runs (ex. the y buffers after
+                        Phase 1), so that other processes on the host can
+                        use it, and fault it back in, in parallel, before
+                        the phase that uses it next starts.
+
  -i, --plot-id        : Specify a plot id for debugging.
 
  --memo               : Specify a plot memo for debugging.
@@ -113,15 +236,373 @@ OPTIONS:
 
  -v, --verbose        : Enable verbose output.
 
+ --log-json           : Write each line of output as a JSON object, with
+                        its time, level and thread, for log collectors.
+
  -m, --no-numa        : Disable automatic NUMA aware memory binding.
                         If you set this parameter in a NUMA system you
                         will likely get degraded performance.
 
  --no-cpu-affinity    : Disable assigning automatic thread affinity.
+                        By default, threads are pinned to the performance
+                        cores first, then to the efficiency cores, and
+                        only then to the SMT siblings of the cores in use.
                         This is useful when running multiple simultaneous
                         instances of bladebit as you can manually
                         assign thread affinity yourself when launching bladebit.
  
+ --numa-first-touch   : Instead of interleaving buffers across NUMA nodes,
+                        place each thread's slice of every buffer on the
+                        thread's own node. Pages are faulted in parallel
+                        at startup, as with --warm-start.
+
+ --numa-per-buffer    : Place each buffer across NUMA nodes by how it is
+                        accessed: the sort and scatter targets, which each
+                        thread splits by its index, are bound per node, as
+                        with --numa-first-touch, while the tables, Phase 2's
+                        marks and Phase 3's lookup map, which are accessed
+                        at random, are interleaved.
+
+ --numa-report        : After each plot, log the NUMA nodes a sample of
+                        each buffer's pages are actually on (Linux only).
+
+ --far-memory         : Place tables 2-6 on the NUMA nodes that have memory
+                        but no cpus, such as CXL memory expanders, and keep
+                        the other buffers off them (Linux only). The tables
+                        are written once in Phase 1, and only read back by
+                        Phases 2 and 3, so the lower bandwidth of the far
+                        memory costs little. Can't be used with --spill or
+                        --compress-tables.
+
+ --io-cores <n>       : Reserve n cores for the plot writer, the plot mover
+                        and the logger, so that they don't compete with the
+                        plotting threads, which are kept off them. The cores
+                        are taken from the NUMA node of the first output
+                        directory's drive (Linux only), where the I/O buffers
+                        are allocated too.
+
+ --io-node <node>     : NUMA node to reserve the --io-cores on instead, ex.
+                        the node of the network card when sending plots to
+                        a remote host.
+
+ --huge-pages         : Back buffers with huge pages to reduce TLB pressure.
+                        1 GiB pages are tried first, then 2 MiB pages, then
+                        transparent huge pages. Explicit huge pages must be
+                        reserved beforehand (ex. via vm.nr_hugepages on Linux,
+                        or the 'Lock pages in memory' privilege on Windows).
+
+ --auto               : Select the fastest configuration that fits in the
+                        available memory at startup: pipelining if enabled,
+                        then the default, then sorting in place, then
+                        spilling to the --spill paths, which are only used
+                        if nothing else fits. Huge pages are used if any
+                        are available. Reports the memory each needs, and
+                        the predicted plot time of the selected one.
+
+ --fused-f1           : Write F1 entries directly into the buckets of the
+                        first sort pass as they are generated, instead of
+                        writing them out and sorting them afterwards.
+                        This saves a full pass over F1's memory.
+
+ --bucketed-fp        : Sort each forward propagated table in y buckets
+                        small enough to be sorted in cache, instead of
+                        sorting the whole table and then gathering its
+                        metadata and pairs accross all of memory.
+
+ --packed-fx-sort     : Sort each forward propagated table on its y values
+                        packed with their index in a single 64-bit entry.
+                        This skips generating the sort key, and carrying it
+                        as a separate buffer through every sort pass.
+                        Has no effect with --bucketed-fp.
+
+ --blocked-map        : Gather the metadata and pairs of each sorted forward
+                        propagated table in cache-sized blocks, reading each
+                        block's sources in address order, with prefetching.
+                        Has no effect with --bucketed-fp.
+
+ --in-place-sort      : Sort line points and f7 in place in Phase 3,
+                        instead of using a temporary sort buffer.
+                        This frees 32 GiB during Phase 3 for other
+                        buffers, at the cost of slower Phase 3 sorts.
+
+ --fused-prune        : Prune tables 2-6 straight into line points in Phase 3,
+                        walking only the marked entries of each table,
+                        instead of copying the pruned pairs to a temporary
+                        buffer and converting them in a separate pass.
+
+ --bucketed-lp-sort  : Sort the line points of each table in Phase 3 by
+                        distributing them into buckets by their top bits
+                        as they are generated, then sorting each bucket in
+                        cache, instead of sorting the whole table with
+                        multiple passes over it.
+                        Has no effect with --in-place-sort.
+
+ --binned-lookup      : Bin the new index of each line point by the range of
+                        the lookup table it is written to in Phase 3, so that
+                        each thread writes only to its own range of it,
+                        instead of all threads writing at random accross it.
+                        Has no effect with --in-place-sort.
+
+ --stream-parks      : Write the parks of each table in Phase 3 to the plot
+                        file as they are encoded, in park order, instead
+                        of writing the table once all its parks are done.
+
+ --fused-checkpoints  : Build the C1, C2 and C3 tables in Phase 3, in a
+                        single pass right after sorting f7, so that Phase 4
+                        only has to write them.
+
+ --overlap-parks      : Encode the parks of each table in Phase 3 on a
+                        quarter of the threads, in the background, while
+                        the next table is pruned and converted to line
+                        points. Can't be used with --spill or
+                        --compress-tables.
+
+ --no-io-uring        : Write the plot file with blocking writes. By default,
+                        the plot file is written with several writes in
+                        flight, through io_uring on Linux (if available),
+                        or overlapped I/O on Windows.
+
+ --pipeline           : Generate the next plot's F1 in the background while
+                        the current plot is in Phases 3 and 4, in the y
+                        buffers, which are free by then. This needs up to
+                        32GiB of extra memory, and implies --in-place-sort.
+                        Only helps when creating more than one plot.
+
+ --preallocate        : Preallocate each plot file to its final size, as
+                        predicted after Phase 2, before writing it. The
+                        tables are then laid out contiguously, and written
+                        in order, followed by a single header update.
+                        Recommended for SMR drives and network filesystems.
+
+ --prepare-output     : Create and preallocate the next plot's file in the
+                        background, while the current plot is made, in the
+                        output directory with the most free space that has
+                        room for it. Directories that are full are skipped,
+                        and those that are slow to prepare a file are avoided
+                        for a while. Only helps when creating more than one
+                        plot to more than one directory.
+
+ --digest             : Compute a digest of each plot as it's written, and
+                        write it to a .b3 file next to the plot. Tables are
+                        hashed from memory, so the plot is not re-read.
+                        It is not a plain BLAKE3 hash that b3sum can check:
+                        the header and each table are split in 16 MiB
+                        segments, hashed with BLAKE3 in parallel, and the
+                        file lists the BLAKE3 hash of each one's segment
+                        hashes, and the BLAKE3 hash of those. Check a plot
+                        against it with --verify-digest.
+                        Not written for plots sent to a plot receiver.
+
+ --self-check         : Verify the given number of proofs (ex. 16) of each plot
+                        in memory after Phase 2, by walking them back from
+                        table 7 to their x values, and recomputing their f1
+                        through f7. A plot with an invalid proof is discarded
+                        before it's written, as its tables were corrupted,
+                        which is usually a sign of faulty memory. Takes well
+                        under a second, unless tables are spilled or
+                        compressed, as tables 3-6 are then read back again.
+
+ --drop-x-bits        : Drop the given number of low bits (1-8) from table 1's
+                        x values, for smaller plots: each bit saves 2 bits per
+                        table 1 entry, about 0.8 GiB (0.8%) of a k32 plot.
+                        The plots are in the 'v1.0-dx<bits>' format, which
+                        chiapos does not read. --validate and the lookup
+                        benchmark recover the dropped bits by trying each of
+                        their values, at the cost of 2^bits f1 per x.
+
+ --gpu                : Compute F1 and the Fx of each table on the given GPU
+                        (ex. 0), while the CPU sorts. Falls back to the CPU
+                        if the GPU can't be used, or bladebit was built
+                        without a GPU backend (BB_CUDA or BB_HIP).
+
+ --spin-time          : Time, in microseconds, that idle threads spin waiting
+                        for work before they go to sleep. Lowers the latency
+                        of handing out work, at the cost of busy CPUs.
+                        0 disables spinning. Defaults to 50.
+
+ --simd               : Widest SIMD kernels to run: scalar, sse2, avx2 or
+                        avx512 on x86-64, scalar or neon on ARM64. Kernels
+                        without a variant at that level run their next
+                        narrower one. Defaults to the widest the CPU
+                        supports. Use it with --benchmark to compare them.
+
+ --kernel-threads     : Thread count for one of the parallel kernels, as
+                        <kernel>=<count>. Memory-bound kernels may be faster
+                        with fewer threads than the whole pool. The count may
+                        be 'cores', for one thread per physical core, or
+                        'auto' to tune it. Can be specified multiple times.
+                        Kernels: pair, fx, clear, mark, lp.
+
+ --tune-threads       : Tune the thread count of each kernel without one,
+                        by trying a few counts over the first calls to it.
+
+ --thread-cache       : File in which tuned thread counts are cached, so that
+                        they are only tuned on the first run. Implies
+                        --tune-threads.
+
+ --profile            : Directory to which a JSON profile of each plot is
+                        written, with the time spent in each phase, table
+                        and kernel, and by each thread.
+
+ --perf-counters      : Add hardware counters to the profiles: cycles,
+                        instructions, LLC and dTLB misses, and DRAM loads,
+                        local and remote. (Linux only)
+
+ --mem-bandwidth      : Add the DRAM bandwidth of each NUMA node to the
+                        profiles, from the memory controllers' counters,
+                        and log it after each phase, with the share of
+                        loads served by a remote node. Needs --profile,
+                        and implies --perf-counters. Counts the traffic
+                        of every process. Needs an Intel uncore IMC or a
+                        Zen 2/3 data fabric, and perf_event_paranoid at 0
+                        or lower. (Linux only)
+
+ --benchmark          : Plot the given number of plots without writing them,
+                        all with the same plot id, and report the median
+                        and 95th percentile time of each phase. No plotting
+                        keys are needed, and no plot files are created.
+
+ --bench-phases       : Range of phases to benchmark, as <first>-<last>,
+                        ex. 2-3, or a single phase.
+                        Starting after Phase 1 needs --bench-cache.
+
+ --bench-cache        : Directory in which a snapshot of the output of each of
+                        Phases 1-3 is written when they are benchmarked, and
+                        from which it is loaded when benchmarking from a later
+                        phase. It needs up to 200 GiB. Can't be used with --spill.
+
+ --bench-baseline     : Compare the phase times against the given per-machine
+                        baseline file, and exit with 1 if any phase regressed.
+                        If the file does not exist, it is recorded instead.
+                        Benchmark 5 plots or more, so that noise can be told
+                        from regressions.
+
+ --save-bench-baseline: Record the baseline even if it exists.
+
+ --bench-threshold    : Slowdown tolerated over the baseline, in percent.
+                        Phases are flagged if they are slower by more than
+                        this, beyond their 95% confidence interval. Default is 5.
+
+ --metrics            : Serve the plotter's progress over HTTP, in the
+                        Prometheus text format, on the given [host:]port,
+                        or on a Unix socket given as unix:<path>. A port
+                        alone listens on 127.0.0.1 only. It includes
+                        the current plot, phase and table, each table's
+                        entry count, each phase's duration, the plot
+                        writer's queue depth, the bytes written, and the
+                        plots per hour. (Not supported on Windows)
+
+ --trace              : Directory to which a Chrome trace of each plot is
+                        written, with every job run by each pool thread,
+                        the plotter's phases and kernels, barrier waits
+                        and the plot writer's writes. Open it with
+                        chrome://tracing or https://ui.perfetto.dev.
+
+ --receive            : Run as a plot receiver on the given port, instead of
+                        plotting. Plots streamed to it by other plotters
+                        with a tcp:// output directory are written to the
+                        output directories. Existing plots are never
+                        overwritten. No plotting keys are needed.
+
+ --validate           : Validate the given plot, instead of plotting. Random
+                        challenges are looked up in the plot, and each of
+                        their proofs is read and verified. Reports the invalid
+                        proofs, and the proofs per challenge, which is 1 on
+                        average for a valid plot. Exits with 1 if any proof
+                        is invalid. No plotting keys are needed.
+
+ --verify-digest      : Check the given plot against the .b3 digest file
+                        written next to it with --digest, instead of plotting.
+                        Reports the tables that don't match. Exits with 1 if
+                        any doesn't. No plotting keys are needed.
+
+ --challenges         : Number of challenges looked up with --validate.
+                        Defaults to 100.
+
+ --spill              : Scratch directory to which tables 2-6 are spilled
+                        while they are not in use. This lowers the memory
+                        required by 128 GiB. Can be specified multiple times
+                        to stripe the tables across multiple devices.
+                        Fast NVMe drives are recommended.
+                        A path of the form tcp://<host>:<port> spills the
+                        tables to the memory of another host, running with
+                        --memory-server on that port (not supported on
+                        Windows). See --secret.
+
+ --compress-tables    : Compress tables 2-6 in memory while they are not in
+                        use, instead of spilling them. Each table is bit-packed
+                        to about (k+9)/48 of its size, which lowers the memory
+                        required by about 14 GiB, at the cost of compressing
+                        and decompressing them. Can't be used with --spill.
+
+ --daemon             : Run as a plot daemon, accepting plot jobs on the Unix
+                        socket at the given path. The buffers and threads are
+                        set up once, and kept for every job. Jobs give their
+                        keys, output directory, plot count and priority, and
+                        use the command line's keys and output directories
+                        by default. See the README for its commands.
+
+ --manifest           : Plot the batch of plots listed in the given file,
+                        one per line, each with its own keys, output
+                        directory and, optionally, plot id and memo:
+                          [farmer=<key>] [pool=<key> | contract=<address>]
+                          [dir=<path>] [id=<hex>] [memo=<hex>]
+                        Keys not given are the command line's. The ids and
+                        memos of all plots are generated up front, so that
+                        the plotter goes straight from one plot to the next.
+                        Overrides --count. Lines starting with '#' are skipped.
+
+ --memory-server      : Run as a memory server on the given port, instead of
+                        plotting. Holds the tables spilled to it by other
+                        plotters with a tcp:// spill path, in memory.
+                        No plotting keys are needed.
+
+ --memory-server-size : Most memory, in GiB, the memory server holds for all
+                        plotters together. Defaults to the memory available
+                        when it starts.
+
+ --bind               : Address the plot receiver or memory server listens
+                        on. Defaults to 127.0.0.1. Any other address than a
+                        loopback one needs a --secret.
+
+ --secret             : File holding a secret shared by the plot receivers
+                        and memory servers, and the plotters using them,
+                        which must prove that they know it to connect.
+                        The secret is never sent. Keep the file readable by
+                        its owner only.
+
+ --checkpoint         : Directory to which the state of each plot is
+                        checkpointed after Phases 1 and 2, so that a plot
+                        killed afterwards is resumed from its last completed
+                        phase on the next run, with the same directory.
+                        It needs up to 190 GiB, on a fast local drive.
+                        Can't be used with --spill or --daemon.
+
+ --coordinate         : Name of a group of bladebit instances running on the
+                        same host. Each instance of the group takes a slot,
+                        and is restricted to its share of the CPUs and of
+                        the NUMA nodes, instead of pinning its threads
+                        across the whole host. Their plot writers take
+                        turns, so that their writes don't collide.
+                        Not supported on Windows.
+
+ --instances          : Number of slots of the --coordinate group.
+                        Defaults to the number of NUMA nodes, or 2 if the
+                        host is not NUMA. Set by the group's first instance.
+
+ --write-bandwidth    : Cap on the total bandwidth used by the plot writers
+                        of the --coordinate group, in MiB/s.
+                        Defaults to unlimited. Set by the group's first instance.
+
+ --move               : Destination directory to which finished plots are moved
+                        in the background, ie. on a HDD. Can be specified
+                        multiple times: each destination is written
+                        concurrently, until it's full. Plots are verified
+                        after being copied, before the source is deleted.
+
+ --move-bandwidth     : Cap on the total bandwidth used to move plots,
+                        in MiB/s. Defaults to unlimited.
+
  --memory             : Display system memory available, in bytes, and the 
                         required memory to run Bladebit, in bytes.
  
@@ -141,75 +622,209 @@ int main( int argc, const char* argv[] )
     Config cfg;
     ParseCommandLine( argc-1, argv+1, cfg );
 
-    // Create the plot output path
-    size_t outputFolderLen = strlen( cfg.outputFolder );
-    
-    char* plotOutPath = new char[outputFolderLen + PLOT_FILE_FMT_LEN];
+    if( cfg.receivePort )
+    {
+    #if PLATFORM_IS_UNIX
+        PlotReceiverConfig receiverCfg;
+        receiverCfg.bindAddress = cfg.bindAddress;
+        receiverCfg.port        = cfg.receivePort;
+        receiverCfg.dirs        = cfg.outputFolders;
+        receiverCfg.dirCount    = cfg.outputFolderCount;
+        receiverCfg.secretPath  = cfg.netSecretPath;
+
+        return PlotReceiver::Run( receiverCfg ) ? 0 : 1;
+    #else
+        Fatal( "Receiving plots is not supported on this platform." );
+    #endif
+    }
+
+    if( cfg.memoryServerPort )
+    {
+    #if PLATFORM_IS_UNIX
+        MemoryServerConfig serverCfg;
+        serverCfg.bindAddress = cfg.bindAddress;
+        serverCfg.port        = cfg.memoryServerPort;
+        serverCfg.maxSize     = cfg.memoryServerSize;
+        serverCfg.secretPath  = cfg.netSecretPath;
+
+        return MemoryServer::Run( serverCfg ) ? 0 : 1;
+    #else
+        Fatal( "Serving memory is not supported on this platform." );
+    #endif
+    }
 
-    if( outputFolderLen )
+    if( cfg.validatePath )
     {
-        memcpy( plotOutPath, cfg.outputFolder, outputFolderLen );
+        PlotValidateConfig validateCfg;
+        validateCfg.plotPath       = cfg.validatePath;
+        validateCfg.challengeCount = cfg.challengeCount;
+        validateCfg.threadCount    = cfg.threads;
 
-        // Add a trailing slash, if we need one.
-        if( plotOutPath[outputFolderLen-1] != '/' )
-            plotOutPath[outputFolderLen++] = '/';
+        return PlotValidator::Run( validateCfg ) ? 0 : 1;
     }
 
+    if( cfg.verifyDigestPath )
+    {
+        const std::string digestPath = std::string( cfg.verifyDigestPath ) + BB_DIGEST_FILE_EXT;
+
+        PlotDigest digest( cfg.threads ? cfg.threads : BB_DIGEST_THREADS );
+        const bool ok = digest.VerifyFile( cfg.verifyDigestPath, digestPath.c_str() );
+
+        Log::Line( "Plot %s %s its digest.", cfg.verifyDigestPath, ok ? "matches" : "does not match" );
+        return ok ? 0 : 1;
+    }
+
+    // The plotter picks the output directory for each plot, we only name them.
+    // When their files are prepared ahead, plots are named along with the plot before them.
+    char plotFileName[PLOT_FILE_FMT_LEN];
+    char nextPlotFileName[PLOT_FILE_FMT_LEN];
+    char nextPlotIdStr[65] = { 0 };
+
     // Begin plotting
     PlotRequest req;
     ZeroMem( &req );
 
     // #TODO: Don't let this config to permanently remain on the stack
     MemPlotConfig plotCfg;
-    plotCfg.threadCount   = cfg.threads;
-    plotCfg.noNUMA        = cfg.disableNuma;
-    plotCfg.noCPUAffinity = cfg.disableCpuAffinity;
-    plotCfg.warmStart     = cfg.warmStart;
+    plotCfg.threadCount    = cfg.threads;
+    plotCfg.noNUMA         = cfg.disableNuma;
+    plotCfg.noCPUAffinity  = cfg.disableCpuAffinity;
+    plotCfg.warmStart      = cfg.warmStart;
+    plotCfg.releaseMemory  = cfg.releaseMemory;
+    plotCfg.hugePages      = cfg.hugePages;
+    plotCfg.autoMode       = cfg.autoMode;
+    plotCfg.numaFirstTouch = cfg.numaFirstTouch;
+    plotCfg.numaPerBuffer  = cfg.numaPerBuffer;
+    plotCfg.farMemory      = cfg.farMemory;
+    plotCfg.numaReport     = cfg.numaReport;
+    plotCfg.fusedF1        = cfg.fusedF1;
+    plotCfg.bucketedFp     = cfg.bucketedFp;
+    plotCfg.packedFxSort   = cfg.packedFxSort;
+    plotCfg.blockedMap     = cfg.blockedMap;
+    plotCfg.inPlaceSort    = cfg.inPlaceSort;
+    plotCfg.fusedPrune     = cfg.fusedPrune;
+    plotCfg.bucketedLpSort = cfg.bucketedLpSort;
+    plotCfg.binnedLookup   = cfg.binnedLookup;
+    plotCfg.streamParks    = cfg.streamParks;
+    plotCfg.fusedCheckpoints = cfg.fusedCheckpoints;
+    plotCfg.overlapParks   = cfg.overlapParks;
+    plotCfg.noAsyncIO      = cfg.noAsyncIO;
+    plotCfg.pipeline       = cfg.pipeline;
+    plotCfg.preallocatePlot = cfg.preallocatePlot;
+    plotCfg.prepareOutput = cfg.prepareOutput;
+    plotCfg.digestPlot = cfg.digestPlot;
+    plotCfg.droppedXBits = cfg.droppedXBits;
+    plotCfg.selfCheckProofs = cfg.selfCheckProofs;
+    plotCfg.gpuDevice = cfg.gpuDevice;
+    plotCfg.spinTime = cfg.spinTime;
+    plotCfg.simdLevel = KernelDispatch::Detect();
+
+    if( cfg.simd )
+    {
+        FatalIf( !KernelDispatch::ParseLevel( cfg.simd, plotCfg.simdLevel ), "Unknown SIMD level '%s'.", cfg.simd );
+        FatalIf( !KernelDispatch::IsSupported( plotCfg.simdLevel ), "This CPU does not support %s.", cfg.simd );
+    }
+    plotCfg.kernelThreads = cfg.kernelThreads;
+    plotCfg.kernelThreadCount = cfg.kernelThreadCount;
+    plotCfg.tuneThreads = cfg.tuneThreads || cfg.threadCachePath;
+    plotCfg.threadCachePath = cfg.threadCachePath;
+    plotCfg.profileDir = cfg.profileDir;
+    plotCfg.perfCounters = cfg.perfCounters;
+    plotCfg.memBandwidth = cfg.memBandwidth;
+    plotCfg.benchmark = cfg.benchmarkCount > 0;
+    plotCfg.benchFirstPhase = cfg.benchFirstPhase;
+    plotCfg.benchLastPhase = cfg.benchLastPhase;
+    plotCfg.benchCacheDir = cfg.benchCacheDir;
+    plotCfg.benchBaseline = cfg.benchBaseline;
+    plotCfg.benchSaveBaseline = cfg.benchSaveBaseline;
+    plotCfg.benchThreshold = cfg.benchThreshold / 100.0;
+    plotCfg.metricsAddress = cfg.metricsAddress;
+    plotCfg.traceDir = cfg.traceDir;
+    plotCfg.outputDirs     = cfg.outputFolders;
+    plotCfg.outputDirCount = cfg.outputFolderCount;
+    plotCfg.spillPaths     = cfg.spillPaths;
+    plotCfg.spillPathCount = cfg.spillPathCount;
+    plotCfg.netSecretPath    = cfg.netSecretPath;
+    plotCfg.compressTables = cfg.compressTables;
+    plotCfg.moveDirs = cfg.moveDirs;
+    plotCfg.moveDirCount = cfg.moveDirCount;
+    plotCfg.moveBandwidth = cfg.moveBandwidth;
+    plotCfg.checkpointDir = cfg.checkpointDir;
+    plotCfg.coordinator = cfg.coordinator;
 
     MemPlotter plotter( plotCfg );
 
-    byte   plotId[32];
-    byte   memo  [48+48+32];
-    uint16 memoSize;
+    if( cfg.daemonSocket )
+        return RunDaemon( cfg, plotter );
+
+    if( cfg.manifest )
+        return RunManifest( cfg, plotter );
+
+    // Plot ids are generated one plot ahead, so that the plotter
+    // can start on the next plot before the current one is finished.
+    byte   plotIds  [2][32];
+    byte   memos    [2][48+48+32];
+    uint16 memoSizes[2];
     char   plotIdStr[65] = { 0 };
 
-    int failCount = 0;
-    for( uint i = 0; i < cfg.plotCount; i++ )
-    {
-        // Generate a new plot id
-        GeneratePlotIdAndMemo( cfg, plotId, memo, memoSize );
+    auto genPlotId = [&]( const uint slot ) {
+
+        // Generate a new plot id.
+        // When benchmarking, every plot gets the same id, and the memo is not needed.
+        if( cfg.benchmarkCount )
+        {
+            for( uint i = 0; i < 32; i++ )
+                plotIds[slot][i] = (byte)i;
+
+            memset( memos[slot], 0, sizeof( memos[slot] ) );
+            memoSizes[slot] = (uint16)sizeof( memos[slot] );
+        }
+        else
+            GeneratePlotIdAndMemo( cfg, plotIds[slot], memos[slot], memoSizes[slot] );
 
         // Apply debug plot id and/or memo
         if( cfg.plotId )
-            HexStrToBytes( cfg.plotId, 64, plotId, 32 );
+            HexStrToBytes( cfg.plotId, 64, plotIds[slot], 32 );
 
         if( cfg.plotMemo )
         {
             const size_t memoLen = strlen( cfg.plotMemo );
-            HexStrToBytes( cfg.plotMemo, memoLen, memo, memoLen/2 );
+            HexStrToBytes( cfg.plotMemo, memoLen, memos[slot], memoLen/2 );
         }
-        
-        // Convert plot id to string
-        {
-            size_t numEncoded = 0;
-            BytesToHexStr( plotId, sizeof( plotId), plotIdStr, sizeof( plotIdStr ), numEncoded );
+    };
 
-            ASSERT( numEncoded == 32 );
-            plotIdStr[64] = 0;
-        }
+    // A plot killed on the last run is resumed first, under its own id and file name
+    const PlotCheckpointInfo* resumed = plotter.GetCheckpoint();
+
+    if( resumed )
+    {
+        memcpy( plotIds[0], resumed->plotId, 32 );
+        memcpy( memos[0], resumed->memo, resumed->memoSize );
+        memoSizes[0] = (uint16)resumed->memoSize;
+    }
+    else if( cfg.plotCount > 0 )
+        genPlotId( 0 );
+
+    int failCount = 0;
+    for( uint i = 0; i < cfg.plotCount; i++ )
+    {
+        const uint   slot     = i & 1;
+        const byte*  plotId   = plotIds  [slot];
+        const byte*  memo     = memos    [slot];
+        const uint16 memoSize = memoSizes[slot];
+        const bool   hasNext  = i+1 < cfg.plotCount;
+
+        if( hasNext )
+            genPlotId( slot ^ 1 );
 
         // Set the output path
-        {
-            time_t     now = time( nullptr  );
-            struct tm* t   = localtime( &now ); ASSERT( t );
-            
-            const size_t r = strftime( plotOutPath + outputFolderLen, PLOT_FILE_FMT_LEN, "plot-k32-%Y-%m-%d-%H-%M-", t );
-            if( r != PLOT_FILE_PREFIX_LEN )
-                Fatal( "Failed to generate plot file." );
+        MakePlotFileName( plotId, plotFileName, plotIdStr );
 
-            memcpy( plotOutPath + outputFolderLen + PLOT_FILE_PREFIX_LEN     , plotIdStr, 64 );
-            memcpy( plotOutPath + outputFolderLen + PLOT_FILE_PREFIX_LEN + 64, ".plot.tmp", sizeof( ".plot.tmp" ) );
-        }
+        if( cfg.prepareOutput && i > 0 )
+            memcpy( plotFileName, nextPlotFileName, sizeof( plotFileName ) );
+
+        if( cfg.prepareOutput && hasNext )
+            MakePlotFileName( plotIds[slot ^ 1], nextPlotFileName, nextPlotIdStr );
 
         Log::Line( "Generating plot %d / %d: %s", i+1, cfg.plotCount, plotIdStr );
         if( cfg.showMemo )
@@ -225,10 +840,12 @@ int main( int argc, const char* argv[] )
         Log::Line( "" );
 
         // Prepare the request
-        req.outPath     = plotOutPath;
+        req.fileName    = resumed && i == 0 ? resumed->fileName : plotFileName;
         req.plotId      = plotId;
         req.memo        = memo;
         req.memoSize    = memoSize;
+        req.nextPlotId  = hasNext ? plotIds[slot ^ 1] : nullptr;
+        req.nextFileName = cfg.prepareOutput && hasNext ? nextPlotFileName : nullptr;
         req.IsFinalPlot = i+1 == cfg.plotCount;
 
         // Plot it
@@ -245,6 +862,374 @@ int main( int argc, const char* argv[] )
         Log::Line( "" );
     }
     
+    Log::Flush();
+    return plotter.BenchmarkRegressed() ? 1 : 0;
+}
+
+//-----------------------------------------------------------
+void MakePlotFileName( const byte plotId[32], char plotFileName[], char plotIdStr[65] )
+{
+    // Convert plot id to string
+    {
+        size_t numEncoded = 0;
+        BytesToHexStr( plotId, 32, plotIdStr, 65, numEncoded );
+
+        ASSERT( numEncoded == 32 );
+        plotIdStr[64] = 0;
+    }
+
+    time_t     now = time( nullptr  );
+    struct tm* t   = localtime( &now ); ASSERT( t );
+    
+    const size_t r = strftime( plotFileName, PLOT_FILE_FMT_LEN, "plot-k" STR( _K ) "-%Y-%m-%d-%H-%M-", t );
+    if( r != PLOT_FILE_PREFIX_LEN )
+        Fatal( "Failed to generate plot file." );
+
+    memcpy( plotFileName + PLOT_FILE_PREFIX_LEN     , plotIdStr, 64 );
+    memcpy( plotFileName + PLOT_FILE_PREFIX_LEN + 64, ".plot.tmp", sizeof( ".plot.tmp" ) );
+}
+
+//-----------------------------------------------------------
+int RunDaemon( Config& cfg, MemPlotter& plotter )
+{
+#if PLATFORM_IS_UNIX
+    auto isHexKey = []( const std::string& key ) {
+
+        const char* hex = key.c_str();
+        if( hex[0] == '0' && hex[1] == 'x' )
+            hex += 2;
+
+        if( strlen( hex ) != bls::G1Element::SIZE*2 )
+            return false;
+
+        for( ; *hex; hex++ )
+            if( !isxdigit( (unsigned char)*hex ) )
+                return false;
+
+        return true;
+    };
+
+    // Jobs are checked as they are submitted, so that their submitter gets the error.
+    // The keys are only parsed on the plotting thread.
+    auto validate = [&]( const PlotJob& job, std::string& error ) {
+
+        if( job.farmerKey.empty() ? !cfg.hasFarmerKey : !isHexKey( job.farmerKey ) )
+        {
+            error = job.farmerKey.empty() ? "a farmer key is required" : "invalid farmer key";
+            return false;
+        }
+
+        if( !job.poolKey.empty() && !isHexKey( job.poolKey ) )
+        {
+            error = "invalid pool key";
+            return false;
+        }
+
+        if( !job.contractAddress.empty() && !IsValidContractAddress( job.contractAddress.c_str() ) )
+        {
+            error = "invalid pool contract address";
+            return false;
+        }
+
+        if( job.poolKey.empty() && job.contractAddress.empty() && !cfg.poolPublicKey && !cfg.contractPuzzleHash )
+        {
+            error = "a pool key or a pool contract address is required";
+            return false;
+        }
+
+        return true;
+    };
+
+    PlotJobServer server( validate );
+    if( !server.Start( cfg.daemonSocket ) )
+        return 1;
+
+    char plotFileName[PLOT_FILE_FMT_LEN];
+    char plotIdStr[65] = { 0 };
+
+    byte   plotIds  [2][32];
+    byte   memos    [2][48+48+32];
+    uint16 memoSizes[2];
+
+    PlotJob job;
+
+    for( ;; )
+    {
+        // Don't keep the last plot waiting on the next job to be renamed
+        if( !server.HasQueuedJobs() )
+            plotter.FinishWriting();
+
+        if( !server.NextJob( job ) )
+            break;
+
+        // Each job may have its own keys, falling back to ours
+        Config         jobCfg     = cfg;
+        bls::G1Element poolKey;
+        ByteSpan       puzzleHash( nullptr, 0 );
+        bool           validKeys  = true;
+
+        try
+        {
+            if( !job.farmerKey.empty() )
+                validKeys = HexPKeyToG1Element( job.farmerKey.c_str(), jobCfg.farmerPublicKey );
+
+            if( validKeys && !job.poolKey.empty() )
+            {
+                validKeys = HexPKeyToG1Element( job.poolKey.c_str(), poolKey );
+                jobCfg.poolPublicKey      = &poolKey;
+                jobCfg.contractPuzzleHash = nullptr;
+            }
+            else if( validKeys && !job.contractAddress.empty() )
+            {
+                puzzleHash = DecodePuzzleHash( job.contractAddress.c_str() );
+                jobCfg.poolPublicKey      = nullptr;
+                jobCfg.contractPuzzleHash = &puzzleHash;
+            }
+        }
+        catch( const std::exception& )
+        {
+            validKeys = false;
+        }
+
+        if( !validKeys )
+        {
+            Log::Error( "Error: Plot job %u has an invalid key. Skipping it.", job.id );
+            continue;
+        }
+
+        Log::Line( "Running plot job %u: %u plot(s).", job.id, job.plotCount );
+
+        // Plot ids are generated one plot ahead, as with the command line's plots
+        GeneratePlotIdAndMemo( jobCfg, plotIds[0], memos[0], memoSizes[0] );
+
+        for( uint32 i = 0; i < job.plotCount; i++ )
+        {
+            const uint slot    = i & 1;
+            const bool hasNext = i+1 < job.plotCount;
+
+            if( hasNext )
+                GeneratePlotIdAndMemo( jobCfg, plotIds[slot^1], memos[slot^1], memoSizes[slot^1] );
+
+            MakePlotFileName( plotIds[slot], plotFileName, plotIdStr );
+
+            Log::Line( "Generating plot %u / %u of job %u: %s", i+1, job.plotCount, job.id, plotIdStr );
+            Log::Line( "" );
+
+            PlotRequest req;
+            ZeroMem( &req );
+            req.fileName    = plotFileName;
+            req.plotId      = plotIds[slot];
+            req.memo        = memos[slot];
+            req.memoSize    = memoSizes[slot];
+            req.nextPlotId  = hasNext ? plotIds[slot^1] : nullptr;
+            req.outputDir   = job.outputDir.empty() ? nullptr : job.outputDir.c_str();
+            req.IsFinalPlot = false;    // Plots are finished by FinishWriting() once the daemon is idle
+
+            if( !plotter.Run( req ) )
+                Log::Error( "Error: Plot %s of job %u failed.", plotIdStr, job.id );
+
+            server.SetProgress( &job, i+1 );
+            Log::Line( "" );
+
+            if( server.StopRequested() )
+                break;
+        }
+
+        free( puzzleHash.values );
+        Log::Line( "Finished plot job %u.", job.id );
+    }
+
+    plotter.FinishWriting();
+    Log::Line( "Plot daemon stopped." );
+    Log::Flush();
+    return 0;
+#else
+    (void)cfg;
+    (void)plotter;
+    Fatal( "The plot daemon is not supported on this platform." );
+    return 1;
+#endif
+}
+
+//-----------------------------------------------------------
+void LoadManifest( Config& cfg )
+{
+    std::vector<PlotManifestEntry> entries;
+    if( !ReadPlotManifest( cfg.manifestPath, entries ) )
+        Fatal( "Failed to read the plot manifest." );
+
+    cfg.manifest = new std::vector<ManifestPlot>( entries.size() );
+    auto& plots  = *cfg.manifest;
+
+    auto parseKey = []( const std::string& hexKey, bls::G1Element& key ) {
+
+        try
+        {
+            return HexPKeyToG1Element( hexKey.c_str(), key );
+        }
+        catch( const std::exception& )
+        {
+            return false;
+        }
+    };
+
+    auto parseHex = []( std::string hex, const size_t minSize, const size_t maxSize, byte* dst, size_t& outSize ) {
+
+        if( hex.size() > 2 && hex[0] == '0' && hex[1] == 'x' )
+            hex = hex.substr( 2 );
+
+        if( ( hex.size() != minSize*2 && hex.size() != maxSize*2 ) )
+            return false;
+
+        for( const char c : hex )
+            if( !isxdigit( (unsigned char)c ) )
+                return false;
+
+        outSize = hex.size() / 2;
+        HexStrToBytes( hex.c_str(), hex.size(), dst, outSize );
+        return true;
+    };
+
+    for( size_t i = 0; i < entries.size(); i++ )
+    {
+        const PlotManifestEntry& entry = entries[i];
+        ManifestPlot&            plot  = plots[i];
+        const uint32             line  = entry.line;
+
+        plot.line      = line;
+        plot.outputDir = entry.outputDir;
+
+        if( !entry.farmerKey.empty() )
+        {
+            if( !parseKey( entry.farmerKey, plot.farmerPublicKey ) )
+                Fatal( "%s:%u: Failed to parse farmer public key '%s'.", cfg.manifestPath, line, entry.farmerKey.c_str() );
+        }
+        else if( cfg.hasFarmerKey )
+            plot.farmerPublicKey = cfg.farmerPublicKey;
+        else
+            Fatal( "%s:%u: A farmer public key is required.", cfg.manifestPath, line );
+
+        if( !entry.poolKey.empty() )
+        {
+            plot.poolPublicKey = new bls::G1Element();
+
+            if( !parseKey( entry.poolKey, *plot.poolPublicKey ) )
+                Fatal( "%s:%u: Failed to parse pool public key '%s'.", cfg.manifestPath, line, entry.poolKey.c_str() );
+        }
+        else if( !entry.contractAddress.empty() )
+        {
+            if( !IsValidContractAddress( entry.contractAddress.c_str() ) )
+                Fatal( "%s:%u: Invalid pool contract address '%s'.", cfg.manifestPath, line, entry.contractAddress.c_str() );
+
+            plot.contractPuzzleHash = new ByteSpan( std::move( DecodePuzzleHash( entry.contractAddress.c_str() ) ) );
+        }
+        else if( cfg.poolPublicKey || cfg.contractPuzzleHash )
+        {
+            plot.poolPublicKey      = cfg.poolPublicKey;
+            plot.contractPuzzleHash = cfg.poolPublicKey ? nullptr : cfg.contractPuzzleHash;
+        }
+        else
+            Fatal( "%s:%u: Either a pool public key or a pool contract address must be specified.", cfg.manifestPath, line );
+    }
+
+    // The ids and memos of all plots are generated up front, before the plotter is set up,
+    // so that no plot waits on the key derivation of the next one.
+    // #NOTE: The keys are only ever used on the main thread, as relic's context is per thread.
+    const auto timer = TimerBegin();
+
+    for( size_t i = 0; i < entries.size(); i++ )
+    {
+        const PlotManifestEntry& entry = entries[i];
+        ManifestPlot&            plot  = plots[i];
+
+        Config plotCfg = cfg;
+        plotCfg.farmerPublicKey    = plot.farmerPublicKey;
+        plotCfg.poolPublicKey      = plot.poolPublicKey;
+        plotCfg.contractPuzzleHash = plot.contractPuzzleHash;
+
+        GeneratePlotIdAndMemo( plotCfg, plot.plotId, plot.memo, plot.memoSize );
+
+        size_t size = 0;
+
+        if( !entry.plotId.empty() && !parseHex( entry.plotId, 32, 32, plot.plotId, size ) )
+            Fatal( "%s:%u: Invalid plot id '%s'.", cfg.manifestPath, plot.line, entry.plotId.c_str() );
+
+        if( !entry.memo.empty() )
+        {
+            if( !parseHex( entry.memo, 32+48+32, 48+48+32, plot.memo, size ) )
+                Fatal( "%s:%u: Invalid plot memo '%s'.", cfg.manifestPath, plot.line, entry.memo.c_str() );
+
+            plot.memoSize = (uint16)size;
+        }
+    }
+
+    Log::Line( "Generated the ids of %u plots in %.2lf seconds.", (uint)plots.size(), TimerEnd( timer ) );
+}
+
+//-----------------------------------------------------------
+int RunManifest( Config& cfg, MemPlotter& plotter )
+{
+    auto& plots = *cfg.manifest;
+
+    char plotFileName[PLOT_FILE_FMT_LEN];
+    char plotIdStr[65] = { 0 };
+
+    // A plot whose file is prepared ahead is named along with the plot before it.
+    // Plots with their own output directory open their files themselves.
+    char nextPlotFileName[PLOT_FILE_FMT_LEN];
+    char nextPlotIdStr[65] = { 0 };
+    bool nextPrepared = false;
+
+    int failCount = 0;
+    for( size_t i = 0; i < plots.size(); i++ )
+    {
+        const ManifestPlot& plot    = plots[i];
+        const bool          hasNext = i+1 < plots.size();
+
+        MakePlotFileName( plot.plotId, plotFileName, plotIdStr );
+
+        if( nextPrepared )
+            memcpy( plotFileName, nextPlotFileName, sizeof( plotFileName ) );
+
+        nextPrepared = cfg.prepareOutput && hasNext && plots[i+1].outputDir.empty();
+
+        if( nextPrepared )
+            MakePlotFileName( plots[i+1].plotId, nextPlotFileName, nextPlotIdStr );
+
+        Log::Line( "Generating plot %u / %u (line %u): %s", (uint)i+1, (uint)plots.size(), plot.line, plotIdStr );
+        if( cfg.showMemo )
+        {
+            char memoStr[(48+48+32)*2 + 1];
+
+            size_t numEncoded = 0;
+            BytesToHexStr( plot.memo, plot.memoSize, memoStr, sizeof( memoStr ) - 1, numEncoded );
+            memoStr[numEncoded*2] = 0;
+
+            Log::Line( "Plot Memo: %s", memoStr );
+        }
+        Log::Line( "" );
+
+        PlotRequest req;
+        ZeroMem( &req );
+        req.fileName    = plotFileName;
+        req.plotId      = plot.plotId;
+        req.memo        = plot.memo;
+        req.memoSize    = plot.memoSize;
+        req.nextPlotId  = hasNext ? plots[i+1].plotId : nullptr;
+        req.nextFileName = nextPrepared ? nextPlotFileName : nullptr;
+        req.outputDir   = plot.outputDir.empty() ? nullptr : plot.outputDir.c_str();
+        req.IsFinalPlot = !hasNext;
+
+        if( !plotter.Run( req ) )
+        {
+            Log::Error( "Error: Plot %s failed... Trying next plot.", plotIdStr );
+            if( cfg.maxFailCount > 0 && ++failCount >= cfg.maxFailCount )
+                Fatal( "Maximum number of plot failures reached. Exiting." );
+        }
+
+        Log::Line( "" );
+    }
+
     Log::Flush();
     return 0;
 }
@@ -330,6 +1315,10 @@ void ParseCommandLine( int argc, const char* argv[], Config& cfg )
         {
             cfg.warmStart = true;
         }
+        else if( check( "--release-memory" ) )
+        {
+            cfg.releaseMemory = true;
+        }
         else if( check( "-i" ) || check( "--plot-id" ) )
         {
             cfg.plotId = value();
@@ -372,14 +1361,306 @@ void ParseCommandLine( int argc, const char* argv[], Config& cfg )
         {
             cfg.disableCpuAffinity = true;
         }
+        else if( check( "--numa-first-touch" ) )
+        {
+            cfg.numaFirstTouch = true;
+        }
+        else if( check( "--numa-per-buffer" ) )
+        {
+            cfg.numaPerBuffer = true;
+        }
+        else if( check( "--numa-report" ) )
+        {
+            cfg.numaReport = true;
+        }
+        else if( check( "--far-memory" ) )
+        {
+            cfg.farMemory = true;
+        }
+        else if( check( "--io-cores" ) )
+        {
+            cfg.ioCores = uvalue();
+            FatalIf( cfg.ioCores < 1, "--io-cores must be at least 1." );
+        }
+        else if( check( "--io-node" ) )
+        {
+            cfg.ioNode = (int)uvalue();
+        }
+        else if( check( "--huge-pages" ) )
+        {
+            cfg.hugePages = true;
+        }
+        else if( check( "--auto" ) )
+        {
+            cfg.autoMode = true;
+        }
+        else if( check( "--fused-f1" ) )
+        {
+            cfg.fusedF1 = true;
+        }
+        else if( check( "--bucketed-fp" ) )
+        {
+            cfg.bucketedFp = true;
+        }
+        else if( check( "--packed-fx-sort" ) )
+        {
+            cfg.packedFxSort = true;
+        }
+        else if( check( "--blocked-map" ) )
+        {
+            cfg.blockedMap = true;
+        }
+        else if( check( "--in-place-sort" ) )
+        {
+            cfg.inPlaceSort = true;
+        }
+        else if( check( "--fused-prune" ) )
+        {
+            cfg.fusedPrune = true;
+        }
+        else if( check( "--bucketed-lp-sort" ) )
+        {
+            cfg.bucketedLpSort = true;
+        }
+        else if( check( "--binned-lookup" ) )
+        {
+            cfg.binnedLookup = true;
+        }
+        else if( check( "--stream-parks" ) )
+        {
+            cfg.streamParks = true;
+        }
+        else if( check( "--fused-checkpoints" ) )
+        {
+            cfg.fusedCheckpoints = true;
+        }
+        else if( check( "--overlap-parks" ) )
+        {
+            cfg.overlapParks = true;
+        }
+        else if( check( "--no-io-uring" ) )
+        {
+            cfg.noAsyncIO = true;
+        }
+        else if( check( "--pipeline" ) )
+        {
+            cfg.pipeline = true;
+        }
+        else if( check( "--preallocate" ) )
+        {
+            cfg.preallocatePlot = true;
+        }
+        else if( check( "--prepare-output" ) )
+        {
+            cfg.prepareOutput = true;
+        }
+        else if( check( "--digest" ) )
+        {
+            cfg.digestPlot = true;
+        }
+        else if( check( "--self-check" ) )
+        {
+            cfg.selfCheckProofs = uvalue();
+        }
+        else if( check( "--drop-x-bits" ) )
+        {
+            cfg.droppedXBits = uvalue();
+        }
+        else if( check( "--gpu" ) )
+        {
+            cfg.gpuDevice = (int)uvalue();
+        }
+        else if( check( "--spin-time" ) )
+        {
+            cfg.spinTime = uvalue();
+        }
+        else if( check( "--simd" ) )
+        {
+            cfg.simd = value();
+        }
+        else if( check( "--kernel-threads" ) )
+        {
+            if( cfg.kernelThreadCount >= BB_MAX_KERNEL_THREAD_SETTINGS )
+                Fatal( "Too many kernel thread counts specified. A maximum of %u is supported.", BB_MAX_KERNEL_THREAD_SETTINGS );
+
+            cfg.kernelThreads[cfg.kernelThreadCount++] = value();
+        }
+        else if( check( "--tune-threads" ) )
+        {
+            cfg.tuneThreads = true;
+        }
+        else if( check( "--thread-cache" ) )
+        {
+            cfg.threadCachePath = value();
+        }
+        else if( check( "--profile" ) )
+        {
+            cfg.profileDir = value();
+        }
+        else if( check( "--perf-counters" ) )
+        {
+            cfg.perfCounters = true;
+        }
+        else if( check( "--mem-bandwidth" ) )
+        {
+            cfg.memBandwidth = true;
+        }
+        else if( check( "--benchmark" ) )
+        {
+            cfg.benchmarkCount = uvalue();
+            if( cfg.benchmarkCount < 1 )
+                Fatal( "At least 1 plot must be benchmarked." );
+        }
+        else if( check( "--bench-phases" ) )
+        {
+            const char* range = value();
+            char*       end   = nullptr;
+
+            cfg.benchFirstPhase = (uint)strtoul( range, &end, 10 );
+            cfg.benchLastPhase  = cfg.benchFirstPhase;
+
+            if( *end == '-' )
+                cfg.benchLastPhase = (uint)strtoul( end + 1, &end, 10 );
+
+            if( *end != '\0' || cfg.benchFirstPhase < 1 || cfg.benchFirstPhase > 4 ||
+                cfg.benchLastPhase < cfg.benchFirstPhase || cfg.benchLastPhase > 4 )
+                Fatal( "Invalid phase range '%s'.", range );
+        }
+        else if( check( "--bench-cache" ) )
+        {
+            cfg.benchCacheDir = value();
+        }
+        else if( check( "--bench-baseline" ) )
+        {
+            cfg.benchBaseline = value();
+        }
+        else if( check( "--save-bench-baseline" ) )
+        {
+            cfg.benchSaveBaseline = true;
+        }
+        else if( check( "--bench-threshold" ) )
+        {
+            cfg.benchThreshold = uvalue();
+        }
+        else if( check( "--metrics" ) )
+        {
+            cfg.metricsAddress = value();
+        }
+        else if( check( "--trace" ) )
+        {
+            cfg.traceDir = value();
+        }
+        else if( check( "--receive" ) )
+        {
+            const uint32 port = uvalue();
+            if( port == 0 || port > 0xFFFF )
+                Fatal( "Invalid port for argument '%s'.", arg );
+
+            cfg.receivePort = (uint16)port;
+        }
+        else if( check( "--daemon" ) )
+        {
+            cfg.daemonSocket = value();
+        }
+        else if( check( "--manifest" ) )
+        {
+            cfg.manifestPath = value();
+        }
+        else if( check( "--memory-server" ) )
+        {
+            const uint32 port = uvalue();
+            if( port == 0 || port > 0xFFFF )
+                Fatal( "Invalid port for argument '%s'.", arg );
+
+            cfg.memoryServerPort = (uint16)port;
+        }
+        else if( check( "--memory-server-size" ) )
+        {
+            const uint32 size = uvalue();
+            if( size == 0 )
+                Fatal( "Invalid size for argument '%s'.", arg );
+
+            cfg.memoryServerSize = (uint64)size GB;
+        }
+        else if( check( "--bind" ) )
+        {
+            cfg.bindAddress = value();
+        }
+        else if( check( "--secret" ) )
+        {
+            cfg.netSecretPath = value();
+        }
+        else if( check( "--validate" ) )
+        {
+            cfg.validatePath = value();
+        }
+        else if( check( "--verify-digest" ) )
+        {
+            cfg.verifyDigestPath = value();
+        }
+        else if( check( "--challenges" ) )
+        {
+            cfg.challengeCount = uvalue();
+            if( cfg.challengeCount < 1 )
+                Fatal( "At least 1 challenge must be looked up." );
+        }
+        else if( check( "--spill" ) )
+        {
+            if( cfg.spillPathCount >= BB_MAX_SPILL_PATHS )
+                Fatal( "Too many spill paths specified. A maximum of %u is supported.", BB_MAX_SPILL_PATHS );
+
+            cfg.spillPaths[cfg.spillPathCount++] = value();
+
+        #if !PLATFORM_IS_UNIX
+            if( strncmp( cfg.spillPaths[cfg.spillPathCount-1], BB_NET_PATH_PREFIX, BB_NET_PATH_PREFIX_LEN ) == 0 )
+                Fatal( "Spilling to remote memory (%s) is not supported on this platform.", cfg.spillPaths[cfg.spillPathCount-1] );
+        #endif
+        }
+        else if( check( "--compress-tables" ) )
+        {
+            cfg.compressTables = true;
+        }
+        else if( check( "--move" ) )
+        {
+            if( cfg.moveDirCount >= BB_MAX_MOVE_DIRS )
+                Fatal( "Too many move directories specified. A maximum of %u is supported.", BB_MAX_MOVE_DIRS );
+
+            cfg.moveDirs[cfg.moveDirCount++] = value();
+        }
+        else if( check( "--checkpoint" ) )
+        {
+            cfg.checkpointDir = value();
+        }
+        else if( check( "--move-bandwidth" ) )
+        {
+            cfg.moveBandwidth = uvalue();
+        }
+        else if( check( "--coordinate" ) )
+        {
+            cfg.coordinateGroup = value();
+        }
+        else if( check( "--instances" ) )
+        {
+            cfg.instanceCount = uvalue();
+            FatalIf( cfg.instanceCount < 1 || cfg.instanceCount > BB_MAX_HOST_INSTANCES,
+                     "--instances must be between 1 and %u.", BB_MAX_HOST_INSTANCES );
+        }
+        else if( check( "--write-bandwidth" ) )
+        {
+            cfg.writeBandwidth = uvalue();
+        }
         else if( check( "-v" ) || check( "--verbose" ) )
         {
             Log::SetVerbose( true );
         }
+        else if( check( "--log-json" ) )
+        {
+            cfg.logJson = true;
+        }
         else if( check( "--memory" ) )
         {
             // #TODO: Get this value from Memplotter
-            const size_t requiredMem  = 416ull GB;
+            const size_t requiredMem  = ( 416ull GB ) >> ( 32 - _K );
             const size_t availableMem = SysHost::GetAvailableSystemMemory();
             const size_t totalMem     = SysHost::GetTotalSystemMemory();
 
@@ -392,7 +1673,7 @@ void ParseCommandLine( int argc, const char* argv[], Config& cfg )
         else if( check( "--memory-json" ) )
         {
             // #TODO: Get this value from Memplotter
-            const size_t requiredMem  = 416ull GB;
+            const size_t requiredMem  = ( 416ull GB ) >> ( 32 - _K );
             const size_t availableMem = SysHost::GetAvailableSystemMemory();
             const size_t totalMem     = SysHost::GetTotalSystemMemory();
 
@@ -408,28 +1689,54 @@ void ParseCommandLine( int argc, const char* argv[], Config& cfg )
         }
         else
         {
-            if( i+1 < argc )
+            // All remaining arguments are output directories
+            for( ; i < argc; i++ )
             {
-                Fatal( "Unexpected argument '%s'.", arg );
-                exit( 1 );
-            }
+                arg = argv[i];
+
+                if( arg[0] == '-' )
+                {
+                    Fatal( "Unexpected argument '%s'.", arg );
+                    exit( 1 );
+                }
+
+                if( cfg.outputFolderCount >= BB_MAX_OUTPUT_DIRS )
+                    Fatal( "Too many output directories specified. A maximum of %u is supported.", BB_MAX_OUTPUT_DIRS );
 
-            cfg.outputFolder = arg;
+            #if !PLATFORM_IS_UNIX
+                if( strncmp( arg, BB_NET_PATH_PREFIX, BB_NET_PATH_PREFIX_LEN ) == 0 )
+                    Fatal( "Streaming plots to a plot receiver (%s) is not supported on this platform.", arg );
+            #endif
+
+                cfg.outputFolders[cfg.outputFolderCount++] = arg;
+            }
         }
     }
     #undef check
 
+    // Don't let the plotter's threads wait on the terminal
+    Log::StartAsync( cfg.logJson );
+
+    // The receiver, the memory server and the validators don't plot
+    if( cfg.receivePort || cfg.memoryServerPort || cfg.validatePath || cfg.verifyDigestPath )
+        return;
+
+    // Benchmarks discard their plots, so they need no keys
+    if( cfg.benchmarkCount )
+        cfg.plotCount = cfg.benchmarkCount;
 
     if( farmerPublicKey )
     {
         if( !HexPKeyToG1Element( farmerPublicKey, cfg.farmerPublicKey ) )
             Fatal( "Failed to parse farmer public key '%s'.", farmerPublicKey );
+
+        cfg.hasFarmerKey = true;
         
         // Remove 0x prefix for printing
         if( farmerPublicKey[0] == '0' && farmerPublicKey[1] == 'x' )
             farmerPublicKey += 2;
     }
-    else
+    else if( !cfg.benchmarkCount && !cfg.daemonSocket && !cfg.manifestPath )
         Fatal( "A farmer public key is required. Please specify a farmer public key." );
 
     if( poolPublicKey )
@@ -452,14 +1759,118 @@ void ParseCommandLine( int argc, const char* argv[], Config& cfg )
     {
         cfg.contractPuzzleHash = new ByteSpan( std::move( DecodePuzzleHash( poolContractAddress ) ) );
     }
-    else
+    else if( !cfg.benchmarkCount && !cfg.daemonSocket && !cfg.manifestPath )
         Fatal( "Error: Either a pool public key or a pool contract address must be specified." );
 
+    // The daemon's keys are optional, they're only the default keys of its jobs
+    FatalIf( cfg.daemonSocket && cfg.benchmarkCount, "--daemon can't be used with --benchmark." );
+    FatalIf( cfg.daemonSocket && cfg.checkpointDir, "--checkpoint can't be used with --daemon." );
+
+    // The manifest's keys are optional too, each plot can have its own
+    if( cfg.manifestPath )
+    {
+        FatalIf( cfg.daemonSocket || cfg.benchmarkCount, "--manifest can't be used with --daemon or --benchmark." );
+        FatalIf( cfg.checkpointDir, "--checkpoint can't be used with --manifest." );
+        FatalIf( cfg.plotId || cfg.plotMemo, "Use the id and memo fields of the manifest to set the plot id or memo of its plots." );
+
+        LoadManifest( cfg );
+        cfg.plotCount = (uint)cfg.manifest->size();
+    }
+    FatalIf( cfg.compressTables && cfg.spillPathCount, "--compress-tables can't be used with --spill." );
+    FatalIf( cfg.numaPerBuffer && cfg.numaFirstTouch, "--numa-per-buffer can't be used with --numa-first-touch." );
+    FatalIf( cfg.numaPerBuffer && cfg.disableCpuAffinity, "--numa-per-buffer needs the threads pinned, it can't be used with --no-cpu-affinity." );
+    FatalIf( cfg.overlapParks && ( cfg.spillPathCount || cfg.compressTables ), "--overlap-parks can't be used with --spill or --compress-tables." );
+    FatalIf( cfg.farMemory && ( cfg.spillPathCount || cfg.compressTables ), "--far-memory can't be used with --spill or --compress-tables." );
+
+    // The instance takes its share of the host before the cpus are counted
+    if( cfg.coordinateGroup )
+    {
+        if( cfg.instanceCount == 0 )
+        {
+            // One instance per NUMA node with cpus by default, or two per host
+            const NumaInfo* numa = SysHost::GetNUMAInfo();
+            uint nodeCount = 0;
+
+            for( uint node = 0; numa && node < numa->nodeCount; node++ )
+            {
+                if( numa->cpuIds[node].length )
+                    nodeCount++;
+            }
+
+            cfg.instanceCount = nodeCount > 1 ? std::min( nodeCount, (uint)BB_MAX_HOST_INSTANCES ) :
+                                                std::min( SysHost::GetCpuTopology()->coreCount, 2u );
+        }
+
+        cfg.coordinator = HostCoordinator::Join( cfg.coordinateGroup, cfg.instanceCount,
+                                                 (uint64)cfg.writeBandwidth * 1024 * 1024 );
+        FatalIf( !cfg.coordinator, "Failed to join instance group '%s'.", cfg.coordinateGroup );
+
+        if( !cfg.coordinator->TakeCpuShare() )
+            Log::Line( "Warning: Failed to restrict this instance to its share of the CPUs." );
+    }
+    else
+        FatalIf( cfg.instanceCount || cfg.writeBandwidth, "--instances and --write-bandwidth require --coordinate." );
+
+    // The I/O cores come out of the instance's share, before any thread is pinned
+    if( cfg.ioCores )
+    {
+        FatalIf( cfg.disableCpuAffinity, "--io-cores needs the threads pinned, it can't be used with --no-cpu-affinity." );
+
+        const NumaInfo* numa = SysHost::GetNUMAInfo();
+
+        if( numa )
+        {
+            FatalIf( cfg.ioNode >= (int)numa->nodeCount, "--io-node must be below the NUMA node count of %u.", numa->nodeCount );
+
+            // Take them near the drive the plots are written to, if its node has cpus
+            if( cfg.ioNode < 0 )
+            {
+                const int node = SysHost::GetPathNumaNode( cfg.outputFolderCount ? cfg.outputFolders[0] : "." );
+
+                if( node >= 0 && node < (int)numa->nodeCount && numa->cpuIds[node].length )
+                    cfg.ioNode = node;
+            }
+        }
+        else if( cfg.ioNode >= 0 )
+        {
+            Log::Line( "Warning: --io-node is ignored, this system is not NUMA." );
+            cfg.ioNode = -1;
+        }
+
+        if( !SysHost::ReserveIoCores( cfg.ioCores, cfg.ioNode ) )
+        {
+            if( cfg.ioNode >= 0 )
+                Fatal( "Not enough cores on NUMA node %d to reserve %u of them for I/O.", cfg.ioNode, cfg.ioCores );
+            else
+                Fatal( "Not enough cores to reserve %u of them for I/O.", cfg.ioCores );
+        }
+    }
+    else
+        FatalIf( cfg.ioNode >= 0, "--io-node requires --io-cores." );
+
+
+    // The plotter thread computes along with the thread pool's
+    SysHost::SetCurrentThreadQoS( ThreadQoS::Compute );
 
-    const uint threadCount = SysHost::GetLogicalCPUCount();
+    // The cpus reserved for I/O are not plotted on
+    const uint threadCount = SysHost::GetLogicalCPUCount() - SysHost::GetIoCpuCount();
+    const uint quotaCount  = std::min( SysHost::GetCpuQuotaCount(), threadCount );
+    const uint perfCount   = SysHost::GetPerformanceCPUCount();
 
     if( cfg.threads == 0 )
-        cfg.threads = threadCount;
+    {
+        cfg.threads = quotaCount;
+
+        if( quotaCount < threadCount )
+            Log::Line( "Using %u threads, the CPU quota of this container, out of its %u CPUs.", quotaCount, threadCount );
+
+        // Threads that can't be pinned would otherwise be left on the efficiency cores, and hold up the others
+        if( perfCount < cfg.threads )
+        {
+            cfg.threads = perfCount;
+            Log::Line( "Using %u threads, one per CPU of the performance cores.", perfCount );
+        }
+    }
     else if( cfg.threads > threadCount )
     {
         Log::Write( "Warning: Lowering thread count from %d to %d, the native maximum.", 
@@ -467,28 +1878,73 @@ void ParseCommandLine( int argc, const char* argv[], Config& cfg )
 
         cfg.threads = threadCount;
     }
+
+    if( cfg.threads > MAX_THREADS )
+    {
+        Log::Line( "Warning: Lowering thread count from %u to %u, the supported maximum.", cfg.threads, (uint)MAX_THREADS );
+        cfg.threads = MAX_THREADS;
+    }
     
     if( cfg.plotCount < 1 )
         cfg.plotCount = 1;
 
-    if( cfg.outputFolder == nullptr )
-    {
+    if( cfg.outputFolderCount == 0 )
         Log::Line( "Warning: No output folder specified. Using current directory." );
-        cfg.outputFolder = "";
-    }
 
-    Log::Line( "Creating %d plots:", cfg.plotCount );
-    
-    if( cfg.outputFolder )
-        Log::Line( " Output path           : %s", cfg.outputFolder );
+    if( cfg.daemonSocket )
+        Log::Line( "Running as a plot daemon:" );
     else
+        Log::Line( "Creating %d plots:", cfg.plotCount );
+
+    if( cfg.manifestPath )
+        Log::Line( " Manifest              : %s", cfg.manifestPath );
+    
+    if( cfg.outputFolderCount == 0 )
         Log::Line( " Output path           : Current directory." );
 
+    for( uint i = 0; i < cfg.outputFolderCount; i++ )
+        Log::Line( " Output path           : %s", cfg.outputFolders[i] );
+
     Log::Line( " Thread count          : %d", cfg.threads );
+
+    if( cfg.coordinator )
+    {
+        Log::Line( " Instance group        : %s, slot %u of %u", cfg.coordinateGroup,
+                   cfg.coordinator->Slot() + 1, cfg.coordinator->InstanceCount() );
+    }
+
+    {
+        const CpuTopology& topo = *SysHost::GetCpuTopology();
+        Log::Line( " CPU topology          : %u cores, %u threads, %u L3 caches%s",
+                   topo.coreCount, topo.cpuCount, topo.l3Count, topo.isHybrid ? ", hybrid" : "" );
+    }
+
+    if( cfg.ioCores )
+    {
+        if( SysHost::GetIoNode() >= 0 )
+            Log::Line( " I/O cores             : %u (%u cpus) on NUMA node %d", cfg.ioCores, SysHost::GetIoCpuCount(), SysHost::GetIoNode() );
+        else
+            Log::Line( " I/O cores             : %u (%u cpus)", cfg.ioCores, SysHost::GetIoCpuCount() );
+    }
     Log::Line( " Warm start enabled    : %s", cfg.warmStart ? "true" : "false" );
+    Log::Line( " Huge pages enabled    : %s", cfg.hugePages ? "true" : "false" );
+    Log::Line( " Auto configuration    : %s", cfg.autoMode ? "true" : "false" );
+
+    for( uint i = 0; i < cfg.spillPathCount; i++ )
+        Log::Line( " Spill path            : %s", cfg.spillPaths[i] );
 
+    if( cfg.compressTables )
+        Log::Line( " Compressed tables     : true" );
 
-    Log::Line( " Farmer public key     : %s", farmerPublicKey );
+    for( uint i = 0; i < cfg.moveDirCount; i++ )
+        Log::Line( " Move path             : %s", cfg.moveDirs[i] );
+
+    if( cfg.checkpointDir )
+        Log::Line( " Checkpoint path       : %s", cfg.checkpointDir );
+
+
+    if( farmerPublicKey )
+        Log::Line( " Farmer public key     : %s", farmerPublicKey );
 
     if( poolPublicKey )
         Log::Line( " Pool public key       : %s", poolPublicKey   );
@@ -674,6 +2130,20 @@ ByteSpan DecodePuzzleHash( const char* poolContractAddress )
     return ByteSpan( decoded, bitsLen );
 }
 
+//-----------------------------------------------------------
+bool IsValidContractAddress( const char* poolContractAddress )
+{
+    const size_t length = strlen( poolContractAddress );
+    if( length < 9 )
+        return false;
+
+    std::vector<char> hrp ( length - 6 );
+    std::vector<byte> data( length - 8 );
+
+    size_t dataLength = 0;
+    return bech32_decode( hrp.data(), data.data(), &dataLength, poolContractAddress ) != BECH32_ENCODING_NONE && dataLength > 0;
+}
+
 //-----------------------------------------------------------
 bool HexPKeyToG1Element( const char* hexKey, bls::G1Element& pkey )
 {
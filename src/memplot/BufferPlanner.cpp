@@ -0,0 +1,327 @@
+#include "BufferPlanner.h"
+#include "Util.h"
+#include "util/Log.h"
+#include <algorithm>
+
+// Shuffled placement orders tried after the sorted ones
+#define BB_PLAN_SHUFFLES 2048
+
+//-----------------------------------------------------------
+BufferPlanner::BufferPlanner( size_t alignment )
+    : _alignment( alignment )
+{
+    ASSERT( alignment );
+}
+
+//-----------------------------------------------------------
+void BufferPlanner::Add( const char* name, size_t size, StageMask lifetime, void** outBuffer, NumaPolicy policy )
+{
+    FatalIf( _count >= BB_MAX_PLANNED_BUFFERS, "Too many planned buffers." );
+    ASSERT( name );
+    ASSERT( lifetime );
+    ASSERT( outBuffer );
+
+    Entry& e    = _entries[_count++];
+    e.name      = name;
+    e.size      = size;
+    e.offset    = 0;
+    e.lifetime  = lifetime;
+    e.outBuffer = outBuffer;
+    e.policy    = policy;
+    e.partCount = 0;
+    e.address   = nullptr;
+
+    _plannedSize = 0;
+}
+
+//-----------------------------------------------------------
+void BufferPlanner::Extend( const char* name, size_t size, StageMask lifetime )
+{
+    FatalIf( _count >= BB_MAX_PLANNED_BUFFERS, "Too many planned buffers." );
+    ASSERT( _count );
+    ASSERT( name );
+    ASSERT( lifetime );
+
+    uint buffer = _count - 1;
+    while( _entries[buffer].outBuffer == nullptr )
+        buffer--;
+
+    // The next part starts right after this one
+    ASSERT( _entries[_count-1].size == RoundUpToNextBoundary( _entries[_count-1].size, (int)_alignment ) );
+
+    _entries[buffer].partCount++;
+
+    Entry& e    = _entries[_count++];
+    e.name      = name;
+    e.size      = size;
+    e.offset    = 0;
+    e.lifetime  = lifetime;
+    e.outBuffer = nullptr;
+    e.policy    = _entries[buffer].policy;
+    e.partCount = 0;
+    e.address   = nullptr;
+
+    _plannedSize = 0;
+}
+
+//-----------------------------------------------------------
+size_t BufferPlanner::Plan()
+{
+    // The buffers are placed greedily in several orders, and the smallest plan is kept:
+    // biggest first, longest-lived first, and biggest by size times lifetime first.
+    uint   orders[3][BB_MAX_PLANNED_BUFFERS];
+    size_t spans[BB_MAX_PLANNED_BUFFERS];
+    uint   stages[BB_MAX_PLANNED_BUFFERS];
+    uint   bufferCount = 0;
+
+    for( uint i = 0; i < _count; i++ )
+    {
+        if( !_entries[i].outBuffer )
+            continue;
+
+        void* buffer;
+        GetSpan( i, buffer, spans[i] );
+
+        StageMask lifetime = 0;
+        for( uint p = i; p <= i + _entries[i].partCount; p++ )
+            lifetime |= _entries[p].lifetime;
+
+        stages[i] = 0;
+        for( ; lifetime; lifetime &= lifetime - 1 )
+            stages[i]++;
+
+        for( uint o = 0; o < 3; o++ )
+            orders[o][bufferCount] = i;
+
+        bufferCount++;
+    }
+
+    std::stable_sort( orders[0], orders[0] + bufferCount, [&]( uint a, uint b ) {
+        return spans[a] > spans[b];
+    });
+
+    std::stable_sort( orders[1], orders[1] + bufferCount, [&]( uint a, uint b ) {
+        return stages[a] != stages[b] ? stages[a] > stages[b] : spans[a] > spans[b];
+    });
+
+    std::stable_sort( orders[2], orders[2] + bufferCount, [&]( uint a, uint b ) {
+        return spans[a] * stages[a] > spans[b] * stages[b];
+    });
+
+    uint   bestOrder[BB_MAX_PLANNED_BUFFERS];
+    size_t bestPeak = (size_t)-1;
+
+    auto tryOrder = [&]( const uint* order ) {
+
+        const size_t peak = Place( order, bufferCount );
+
+        if( peak < bestPeak )
+        {
+            bestPeak = peak;
+            memcpy( bestOrder, order, bufferCount * sizeof( uint ) );
+        }
+    };
+
+    for( uint o = 0; o < 3; o++ )
+        tryOrder( orders[o] );
+
+    // Greedy placement misses the packings where a buffer's short-lived parts share memory with
+    // buffers that are born after them, so shuffled orders are tried too. The shuffles are
+    // seeded with a constant, so that the same buffers are always planned the same way.
+    uint   shuffled[BB_MAX_PLANNED_BUFFERS];
+    uint64 seed = 0x9E3779B97F4A7C15ull;
+
+    memcpy( shuffled, orders[0], bufferCount * sizeof( uint ) );
+
+    for( uint s = 0; s < BB_PLAN_SHUFFLES && bufferCount > 1; s++ )
+    {
+        for( uint i = bufferCount - 1; i > 0; i-- )
+        {
+            seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+            std::swap( shuffled[i], shuffled[( seed >> 33 ) % ( i + 1 )] );
+        }
+
+        tryOrder( shuffled );
+    }
+
+    _plannedSize = Place( bestOrder, bufferCount );
+
+    #if _DEBUG
+        FatalIf( !ValidatePlan(), "Invalid buffer plan: Overlapping live buffers." );
+    #endif
+
+    return _plannedSize;
+}
+
+//-----------------------------------------------------------
+size_t BufferPlanner::Place( const uint* order, const uint bufferCount )
+{
+    // Each buffer is placed, along with its parts, at the lowest offset where
+    // none of them overlap any already-placed buffer that is alive at the same time.
+    bool   placed[BB_MAX_PLANNED_BUFFERS] = {};
+    size_t peak = 0;
+
+    for( uint i = 0; i < bufferCount; i++ )
+    {
+        const uint   index = order[i];
+        const Entry& e     = _entries[index];
+
+        // Candidate offsets are the start of the reservation, or those
+        // that place any of the parts at the end of a conflicting buffer
+        size_t bestOffset = (size_t)-1;
+
+        if( Fits( index, 0, placed ) )
+            bestOffset = 0;
+
+        size_t partOffset = 0;
+
+        for( uint p = index; p <= index + e.partCount; p++ )
+        {
+            const Entry& part = _entries[p];
+
+            for( uint j = 0; j < _count; j++ )
+            {
+                const Entry& other = _entries[j];
+                if( !placed[j] || !( other.lifetime & part.lifetime ) )
+                    continue;
+
+                const size_t end = RoundUpToNextBoundary( other.offset + other.size, (int)_alignment );
+                if( end < partOffset )
+                    continue;
+
+                const size_t candidate = end - partOffset;
+
+                if( candidate < bestOffset && Fits( index, candidate, placed ) )
+                    bestOffset = candidate;
+            }
+
+            partOffset += part.size;
+        }
+
+        ASSERT( bestOffset != (size_t)-1 );
+
+        // Place the buffer and its parts
+        size_t offset = bestOffset;
+
+        for( uint p = index; p <= index + e.partCount; p++ )
+        {
+            _entries[p].offset = offset;
+            placed[p] = true;
+
+            offset += _entries[p].size;
+        }
+
+        peak = std::max( peak, RoundUpToNextBoundary( offset, (int)_alignment ) );
+    }
+
+    return peak;
+}
+
+//-----------------------------------------------------------
+bool BufferPlanner::Fits( uint index, size_t offset, const bool placed[] ) const
+{
+    const uint last = index + _entries[index].partCount;
+
+    for( uint p = index; p <= last; p++ )
+    {
+        const Entry& part = _entries[p];
+
+        for( uint j = 0; j < _count; j++ )
+        {
+            const Entry& other = _entries[j];
+            if( !placed[j] || !( other.lifetime & part.lifetime ) )
+                continue;
+
+            if( offset < other.offset + other.size && other.offset < offset + part.size )
+                return false;
+        }
+
+        offset += part.size;
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------
+void BufferPlanner::Assign( void* base )
+{
+    ASSERT( base );
+    ASSERT( _plannedSize );
+
+    byte* bytes = (byte*)base;
+
+    for( uint i = 0; i < _count; i++ )
+    {
+        Entry& e = _entries[i];
+        e.address = bytes + e.offset;
+
+        if( e.outBuffer )
+            *e.outBuffer = e.address;
+    }
+}
+
+//-----------------------------------------------------------
+void BufferPlanner::GetSpan( uint index, void*& outBuffer, size_t& outSize ) const
+{
+    ASSERT( index < _count );
+    ASSERT( _entries[index].outBuffer );
+
+    const Entry& e = _entries[index];
+
+    outBuffer = e.address;
+    outSize   = 0;
+
+    for( uint p = index; p <= index + e.partCount; p++ )
+        outSize += _entries[p].size;
+}
+
+//-----------------------------------------------------------
+size_t BufferPlanner::UnpackedSize() const
+{
+    size_t size = 0;
+    for( uint i = 0; i < _count; i++ )
+        size += RoundUpToNextBoundary( _entries[i].size, (int)_alignment );
+
+    return size;
+}
+
+//-----------------------------------------------------------
+void BufferPlanner::PrintPlan() const
+{
+    Log::Verbose( "Buffer plan: %llu GiB ( %llu GiB unpacked ).", _plannedSize BtoGB, UnpackedSize() BtoGB );
+
+    for( uint i = 0; i < _count; i++ )
+    {
+        const Entry& e = _entries[i];
+        Log::Verbose( "  %-12s: offset %16llu size %16llu stages 0x%03x %s", e.name, e.offset, e.size, e.lifetime,
+                      e.policy == NumaPolicy::Partitioned ? "partitioned" : "interleaved" );
+    }
+}
+
+//-----------------------------------------------------------
+bool BufferPlanner::ValidatePlan() const
+{
+    for( uint i = 0; i < _count; i++ )
+    {
+        const Entry& a = _entries[i];
+
+        if( a.offset + a.size > _plannedSize )
+            return false;
+
+        for( uint j = i+1; j < _count; j++ )
+        {
+            const Entry& b = _entries[j];
+
+            if( !( a.lifetime & b.lifetime ) )
+                continue;
+
+            if( a.offset < b.offset + b.size && b.offset < a.offset + a.size )
+            {
+                Log::Error( "Buffers %s and %s overlap.", a.name, b.name );
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
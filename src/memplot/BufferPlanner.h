@@ -0,0 +1,154 @@
+#pragma once
+
+#define BB_MAX_PLANNED_BUFFERS 32
+
+/// The stages of a plot at which buffers can be alive.
+enum class PlotStage : uint32
+{
+    F1 = 0,         // Phase 1 F1 generation
+    Table2,         // Phase 1 forward propagation for each table
+    Table2Sort,     // Table 2's sort, once the previous plot has been written to disk
+    Table3,
+    Table4,
+    Table5,
+    Table6,
+    Table7,
+    Phase2,
+    Phase3,
+    Phase4
+
+    ,_Count
+};
+
+// Set of stages at which a buffer is alive
+typedef uint32 StageMask;
+
+/// How the pages of a buffer are placed across NUMA nodes
+enum class NumaPolicy : uint32
+{
+    Interleave = 0,     // Spread across all nodes, for buffers accessed at random
+    Partitioned,        // Each pool thread's slice on its own node, for buffers split by thread index
+    Far                 // On the far memory tier, for tables written once and only read back by Phases 2 and 3
+};
+
+//-----------------------------------------------------------
+constexpr inline StageMask StageBit( PlotStage stage )
+{
+    return 1u << (uint32)stage;
+}
+
+// Mask of all stages from first to last, inclusive
+//-----------------------------------------------------------
+constexpr inline StageMask StageRange( PlotStage first, PlotStage last )
+{
+    return ( ( 1u << ( (uint32)last + 1 ) ) - 1 ) & ~( ( 1u << (uint32)first ) - 1 );
+}
+
+/**
+ * Packs buffers with known lifetimes into a single memory reservation.
+ * Buffers that are never alive at the same stage are allowed to share memory.
+ *
+ * Usage:
+ *  - Add() all buffers with their lifetimes, and Extend() those with parts that live for fewer stages
+ *  - Plan() to obtain the required reservation size
+ *  - Allocate the reservation and Assign() it to set the buffer pointers
+ */
+class BufferPlanner
+{
+public:
+    BufferPlanner( size_t alignment );
+
+    void Add( const char* name, size_t size, StageMask lifetime, void** outBuffer,
+              NumaPolicy policy = NumaPolicy::Interleave );
+
+    template<typename T>
+    inline void Add( const char* name, size_t size, StageMask lifetime, T** outBuffer,
+                     NumaPolicy policy = NumaPolicy::Interleave )
+    {
+        Add( name, size, lifetime, (void**)outBuffer, policy );
+    }
+
+    // Adds a part to the last buffer added, right after its previous parts.
+    // The part is only alive at the stages of its own lifetime, so that other buffers can
+    // share its memory at the others. Every part but the last must be sized to the alignment.
+    void Extend( const char* name, size_t size, StageMask lifetime );
+
+    // Places all buffers and returns the size of the memory reservation required.
+    size_t Plan();
+
+    // Sets the buffer pointers given the beginning of the memory reservation.
+    void Assign( void* base );
+
+    // Size required if no buffers shared any memory
+    size_t UnpackedSize() const;
+
+    inline size_t PlannedSize() const { return _plannedSize; }
+
+    inline uint BufferCount() const { return _count; }
+
+    // Get an assigned buffer, or buffer part, and its size
+    inline void GetBuffer( uint index, void*& outBuffer, size_t& outSize ) const
+    {
+        ASSERT( index < _count );
+        outBuffer = _entries[index].address;
+        outSize   = _entries[index].size;
+    }
+
+    // Get an assigned buffer and the size of all of its parts
+    void GetSpan( uint index, void*& outBuffer, size_t& outSize ) const;
+
+    // Whether the buffer is a part added by Extend()
+    inline bool IsPart( uint index ) const
+    {
+        ASSERT( index < _count );
+        return _entries[index].outBuffer == nullptr;
+    }
+
+    inline const char* GetName( uint index ) const
+    {
+        ASSERT( index < _count );
+        return _entries[index].name;
+    }
+
+    inline NumaPolicy GetPolicy( uint index ) const
+    {
+        ASSERT( index < _count );
+        return _entries[index].policy;
+    }
+
+    inline StageMask GetLifetime( uint index ) const
+    {
+        ASSERT( index < _count );
+        return _entries[index].lifetime;
+    }
+
+    void PrintPlan() const;
+
+private:
+    // Ensure no two buffers that are alive at the same stage overlap.
+    bool ValidatePlan() const;
+
+    // Places the buffers in the given order, and returns the size required
+    size_t Place( const uint* order, uint bufferCount );
+
+    // Whether the buffer and its parts fit at offset, without overlapping any placed buffer they're alive with
+    bool Fits( uint index, size_t offset, const bool placed[] ) const;
+
+    struct Entry
+    {
+        const char* name;
+        size_t      size;
+        size_t      offset;
+        StageMask   lifetime;
+        void**      outBuffer;      // Null for parts, which are placed with their buffer
+        NumaPolicy  policy;
+        uint        partCount;      // Parts that follow the buffer
+        void*       address;
+    };
+
+private:
+    Entry  _entries[BB_MAX_PLANNED_BUFFERS];
+    uint   _count       = 0;
+    size_t _alignment;
+    size_t _plannedSize = 0;
+};
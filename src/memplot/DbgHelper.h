@@ -3,24 +3,10 @@
 #include "PlotContext.h"
 #include "util/Log.h"
 #include "io/FileStream.h"
+#include <vector>
 
 #define DBG_TABLES_PATH ".sandbox/"
 
-#define DBG_P1_TABLE1_FNAME   DBG_TABLES_PATH "p1.t1.tmp"
-#define DBG_P1_TABLE2_FNAME   DBG_TABLES_PATH "p1.t2.tmp"
-#define DBG_P1_TABLE3_FNAME   DBG_TABLES_PATH "p1.t3.tmp"
-#define DBG_P1_TABLE4_FNAME   DBG_TABLES_PATH "p1.t4.tmp"
-#define DBG_P1_TABLE5_FNAME   DBG_TABLES_PATH "p1.t5.tmp"
-#define DBG_P1_TABLE6_FNAME   DBG_TABLES_PATH "p1.t6.tmp"
-#define DBG_P1_TABLE7_FNAME   DBG_TABLES_PATH "p1.t7.tmp"
-#define DBG_P1_TABLE7_Y_FNAME DBG_TABLES_PATH "p1.t7.y.tmp"
-
-#define DBG_P2_TABLE2_FNAME   DBG_TABLES_PATH "p2.t2.tmp"
-#define DBG_P2_TABLE3_FNAME   DBG_TABLES_PATH "p2.t3.tmp"
-#define DBG_P2_TABLE4_FNAME   DBG_TABLES_PATH "p2.t4.tmp"
-#define DBG_P2_TABLE5_FNAME   DBG_TABLES_PATH "p2.t5.tmp"
-#define DBG_P2_TABLE6_FNAME   DBG_TABLES_PATH "p2.t6.tmp"
-
 #define DBG_PRUNED_TABLE2_FNAME   DBG_TABLES_PATH "pruned.t2.tmp"
 
 #define DBG_LP_TABLE1_FNAME   DBG_TABLES_PATH "lp.t1.tmp"
@@ -39,10 +25,6 @@ template<typename T>
 void DbgWriteTableToFile( ThreadPool& pool, const char* path, uint64 entryCount, const T* entries, bool unBuffered = false );
 
 void DumpTestProofs( const MemPlotContext& cx, const uint64 f7Index );
-void WritePhaseTableFiles( MemPlotContext& cx );
-
-void DbgReadPhase2MarkedEntries( MemPlotContext& cx );
-void DbgWritePhase2MarkedEntries( MemPlotContext& cx );
 
 FILE* CreateHashFile( const char* fileName );
 void PrintHash( FILE* file, uint64 index, const void* src, size_t size );
@@ -118,10 +100,9 @@ inline bool DbgReadTableFromFile( ThreadPool& pool, const char* path, uint64& ou
         bool       success;
     };
 
-    ReadJob jobs[MAX_THREADS] = {};
-
     const uint threadCount = pool.ThreadCount();
-    ASSERT( threadCount <= MAX_THREADS );
+
+    std::vector<ReadJob> jobs( threadCount );
 
     const size_t totalSize       = sizeof( T ) * entryCount;
     const size_t blockCount      = totalSize / blockSize;
@@ -185,7 +166,7 @@ inline bool DbgReadTableFromFile( ThreadPool& pool, const char* path, uint64& ou
 
         job.success = true;
 
-    }, jobs, threadCount, sizeof( ReadJob ) );
+    }, jobs.data(), threadCount, sizeof( ReadJob ) );
 
     for( uint i = 0; i < threadCount; i++ )
     {
@@ -314,21 +295,10 @@ inline void DbgWriteTableToFile( ThreadPool& pool, const char* path, uint64 entr
         size_t     writeSize;
         size_t     blockSize;
     };
-    
-    #if __GNUC__ > 7
-    #pragma GCC diagnostic push
-    #pragma GCC diagnostic ignored "-Wclass-memaccess"
-    #endif
-
-    WriteJob jobs[MAX_THREADS];
-    memset( jobs, 0, sizeof( jobs ) );
-
-    #if __GNUC__ > 7
-    #pragma GCC diagnostic pop
-    #endif
 
     const uint threadCount = pool.ThreadCount();
-    ASSERT( threadCount <= MAX_THREADS );
+
+    std::vector<WriteJob> jobs( threadCount );
    
     const size_t blocksPerThread = totalBlocks / threadCount;
     const size_t threadWriteSize = blocksPerThread * blockSize;
@@ -382,7 +352,7 @@ inline void DbgWriteTableToFile( ThreadPool& pool, const char* path, uint64 entr
 
         job.file.Close();
 
-    }, jobs, threadCount, sizeof( WriteJob ) );
+    }, jobs.data(), threadCount, sizeof( WriteJob ) );
     
     // Write any remainder
     const size_t totalThreadWrite = threadWriteSize * threadCount;
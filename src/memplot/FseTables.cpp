@@ -0,0 +1,74 @@
+#include "FseTables.h"
+#include "util/Log.h"
+
+#include <queue>
+#include <cmath>
+
+/// #NOTE: From chiapos (Encoding::CreateNormalizedCount).
+//-----------------------------------------------------------
+std::vector<short> CreateNormalizedCount( const double R )
+{
+    std::vector<double> dpdf;
+    int N = 0;
+    const double E                 = 2.71828182846;
+    const double MIN_PRB_THRESHOLD = 1e-50;
+    const int    TOTAL_QUANTA      = 1 << PLOT_FSE_TABLE_LOG;
+    double p = 1 - pow( ( E - 1 ) / E, 1.0 / R );
+
+    while( p > MIN_PRB_THRESHOLD && N < 255 )
+    {
+        dpdf.push_back( p );
+        N++;
+        p = ( pow( E, 1.0 / R ) - 1 ) * pow( E - 1, 1.0 / R );
+        p /= pow( E, ( ( N + 1 ) / R ) );
+    }
+
+    std::vector<short> ans( N, 1 );
+    auto cmp = [&dpdf, &ans]( int i, int j ) {
+        return dpdf[i] * ( log2( ans[i] + 1 ) - log2( ans[i] ) ) <
+               dpdf[j] * ( log2( ans[j] + 1 ) - log2( ans[j] ) );
+    };
+
+    // #NOTE: The counts are changed while they are in the queue, as chiapos does.
+    //        The tables only match chiapos' if this is kept as is.
+    std::priority_queue<int, std::vector<int>, decltype( cmp )> pq( cmp );
+    for( int i = 0; i < N; ++i )
+        pq.push( i );
+
+    for( int todo = 0; todo < TOTAL_QUANTA - N; ++todo )
+    {
+        int i = pq.top();
+        pq.pop();
+        ans[i]++;
+        pq.push( i );
+    }
+
+    for( int i = 0; i < N; ++i )
+    {
+        if( ans[i] == 1 )
+            ans[i] = (short)-1;
+    }
+
+    return ans;
+}
+
+//-----------------------------------------------------------
+static const FSE_CTable* BuildDroppedXCTable()
+{
+    std::vector<short> normalizedCount = CreateNormalizedCount( kDroppedXR );
+
+    const uint  maxSymbol = (uint)normalizedCount.size() - 1;
+    FSE_CTable* cTable    = FSE_createCTable( maxSymbol, PLOT_FSE_TABLE_LOG );
+
+    const size_t r = FSE_buildCTable( cTable, normalizedCount.data(), maxSymbol, PLOT_FSE_TABLE_LOG );
+    FatalIf( !cTable || FSE_isError( r ), "Failed to build an FSE encoding table." );
+
+    return cTable;
+}
+
+//-----------------------------------------------------------
+const FSE_CTable* GetDroppedXCTable()
+{
+    static const FSE_CTable* cTable = BuildDroppedXCTable();
+    return cTable;
+}
@@ -0,0 +1,15 @@
+#pragma once
+#include "ChiaConsts.h"
+#include "fse/fse.h"
+#include <vector>
+
+// Table log of the FSE tables used to compress the parks, as in chiapos
+#define PLOT_FSE_TABLE_LOG 14
+
+// Builds the normalized symbol counts the park deltas are encoded with, for the given R.
+// The CTables in CTables.h were built from the same counts.
+std::vector<short> CreateNormalizedCount( double R );
+
+// FSE table the deltas of a table 1 with dropped x bits are encoded with, built from kDroppedXR.
+// CTables.h only holds the tables of the standard format, so this one is built on first use.
+const FSE_CTable* GetDroppedXCTable();
@@ -3,10 +3,31 @@
 #include "algorithm/RadixSort.h"
 #include "algorithm/YSort.h"
 #include "threading/ThreadPool.h"
+#include "threading/ChunkScheduler.h"
 #include "ChiaConsts.h"
 #include "PlotContext.h"
+#include <vector>
 
-template<typename TMeta>
+// Buckets by the most significant bits of y, used when sorting Fx in buckets.
+// Each bucket holds 2^20 entries on average, so that it can be sorted in cache.
+#define FX_BUCKET_BITS  12
+#define FX_BUCKET_COUNT ( 1u << FX_BUCKET_BITS )
+#define FX_BUCKET_SHIFT ( _K + kExtraBits - FX_BUCKET_BITS )
+
+// Bits of y sorted on by each radix pass within a bucket
+#define FX_BUCKET_RADIX_BITS 9
+
+// Each chunk of Fx entries stores the start of each of its buckets, plus its end
+#define FX_CHUNK_BUCKET_STRIDE ( FX_BUCKET_COUNT + 1 )
+
+// Blocked mapping: destination entries mapped per block, so that the block's metadata and pairs stay in L2
+#define FX_MAP_BLOCK_SIZE       4096
+// Source ranges each block is partitioned in before gathering it, so that its reads go through memory in order
+#define FX_MAP_SRC_RANGE_BITS   6
+// Entries ahead of the current one whose sources are prefetched
+#define FX_MAP_PREFETCH_DIST    16
+
+template<typename TMeta, typename TPair>
 struct MapFxJob
 {
     uint64        offset;
@@ -15,7 +36,8 @@ struct MapFxJob
     const TMeta*  metaSrc;
     TMeta*        metaDst;
     const Pair*   pairSrc;
-    Pair*         pairDst;
+    TPair*        pairDst;
+    uint32        srcRangeShift;    // Shift of a source index that yields its range, for blocked mapping
 };
 
 struct GenSortKeyJob
@@ -25,11 +47,38 @@ struct GenSortKeyJob
     uint32* keyBuffer;
 };
 
+template<typename TMeta, typename TPair>
+struct FxBucketJob
+{
+    ChunkScheduler* scheduler;
+    uint            threadId;
+
+    uint            chunkCount;
+    uint64          chunkSize;
+    const uint32*   chunkBuckets;   // Bucket starts within each chunk. FX_CHUNK_BUCKET_STRIDE per chunk.
+    const uint64*   bucketStarts;   // First entry of each bucket in the sorted output. FX_BUCKET_COUNT + 1 entries.
+
+    const uint64*   ySrc;           // Entries distributed in buckets within each chunk
+    const TMeta*    metaSrc;
+    const Pair*     pairSrc;
+    uint64*         yDst;
+    TMeta*          metaDst;
+    TPair*          pairDst;
+
+    uint32*         sortTmp;        // This thread's bucket sort scratch
+};
+
 template<size_t MAX_JOBS>
 void GenSortKey( ThreadPool& pool, uint64 length, uint32* keyBuffer );
 
-template<typename TMeta>
-void MapFxThread( MapFxJob<TMeta>* job );
+template<typename TMeta, typename TPair>
+void FxSortBucketsThread( FxBucketJob<TMeta, TPair>* job );
+
+template<typename TMeta, typename TPair>
+void MapFxThread( MapFxJob<TMeta, TPair>* job );
+
+template<typename TMeta, typename TPair>
+void MapFxBlockedThread( MapFxJob<TMeta, TPair>* job );
 void GenSortKeyThread( GenSortKeyJob* job );
 
 //-----------------------------------------------------------
@@ -37,30 +86,55 @@ template<size_t MAX_JOBS>
 inline void SortFx(
     ThreadPool&   pool,    uint64  length,  
     uint64*       yBuffer, uint64* yTmp,
-    uint32*       sortKey, uint32* sortKeyTmp )
+    uint32*       sortKey, uint32* sortKeyTmp,
+    const NumaInfo* numa = nullptr )
 {
     // Generate a sort key
     GenSortKey<MAX_JOBS>( pool, length, sortKey );
 
-    YSorter sorter( pool );
+    YSorter sorter( pool, numa );
     sorter.Sort( length, yBuffer, yTmp, sortKey, sortKeyTmp );
 }
 
+// Same as SortFx, but the sort key is generated by the sort itself, from y packed with each entry's index.
+// The sorted y end up in yBuffer, and no temporary key buffer is needed.
+//-----------------------------------------------------------
+inline void SortFxPacked(
+    ThreadPool&   pool,    uint64  length,  
+    uint64*       yBuffer, uint64* yTmp,
+    uint32*       sortKey,
+    const NumaInfo* numa = nullptr )
+{
+    YSorter sorter( pool, numa );
+    sorter.SortPacked( length, yBuffer, yTmp, sortKey );
+}
+
 
+// Pairs are stored in the destination's pair format (packed or not).
+// When blocked is set, the destination is mapped in cache-sized blocks, whose sources
+// are gathered ordered by source range, and prefetched ahead.
 //-----------------------------------------------------------
-template<typename TMeta, size_t MAX_JOBS>
+template<typename TMeta, size_t MAX_JOBS, typename TPair>
 inline void MapFxWithSortKey(
     ThreadPool&   pool,    uint64  length,  
     const uint32* sortKey,
     const TMeta*  metaSrc, TMeta*  metaDst,
-    const Pair*   pairSrc, Pair*   pairDst )
+    const Pair*   pairSrc, TPair*  pairDst,
+    bool          blocked = false )
 {
+    // Bits needed to index the source, of which the range is the top FX_MAP_SRC_RANGE_BITS
+    uint32 srcBits = 0;
+    while( srcBits < 64 && ( 1ull << srcBits ) < length )
+        srcBits++;
+
+    const uint32 srcRangeShift = srcBits > FX_MAP_SRC_RANGE_BITS ? srcBits - FX_MAP_SRC_RANGE_BITS : 0;
+
     // Sort metadata and pairs on y via the sort key
     const uint32 threadCount      = pool.ThreadCount();
     const uint64 entriesPerThread = length / threadCount;
     const uint64 trailingEntries  = length - ( entriesPerThread * threadCount );
 
-    MapFxJob<TMeta> jobs[MAX_JOBS];
+    std::vector<MapFxJob<TMeta, TPair>> jobs( threadCount );
 
     for( uint32 i = 0; i < threadCount; i++ )
     {
@@ -73,16 +147,21 @@ inline void MapFxWithSortKey(
         job.metaDst = metaDst;
         job.pairSrc = pairSrc;
         job.pairDst = pairDst;
+
+        job.srcRangeShift = srcRangeShift;
     }
 
     jobs[threadCount-1].length += trailingEntries;
 
-    pool.RunJob( MapFxThread<TMeta>, jobs, threadCount );
+    if( blocked )
+        pool.RunJob( MapFxBlockedThread<TMeta, TPair>, jobs.data(), threadCount );
+    else
+        pool.RunJob( MapFxThread<TMeta, TPair>, jobs.data(), threadCount );
 }
 
 //-----------------------------------------------------------
-template<typename TMeta>
-void MapFxThread( MapFxJob<TMeta>* job )
+template<typename TMeta, typename TPair>
+void MapFxThread( MapFxJob<TMeta, TPair>* job )
 {
     const uint64 length   = job->length;
     const uint64 offset   = job->offset;
@@ -98,12 +177,269 @@ void MapFxThread( MapFxJob<TMeta>* job )
 
     // Map pairs
     const Pair*  pairSrc  = job->pairSrc;
-    Pair*        pairDst  = job->pairDst + offset;
+    TPair*       pairDst  = job->pairDst + offset;
+
+    for( uint64 i = 0; i < length; i++ )
+        StorePair( pairDst[i], pairSrc[sortKey[i]] );
+}
+
+//-----------------------------------------------------------
+template<typename TMeta, typename TPair>
+void MapFxBlockedThread( MapFxJob<TMeta, TPair>* job )
+{
+    constexpr uint32 SrcRanges = 1u << FX_MAP_SRC_RANGE_BITS;
+    static_assert( FX_MAP_BLOCK_SIZE <= 0x10000, "Block indices must fit in 16 bits." );
+
+    const uint64 length        = job->length;
+    const uint64 offset        = job->offset;
+    const uint32 srcRangeShift = job->srcRangeShift;
+
+    const TMeta* metaSrc = job->metaSrc;
+    const Pair*  pairSrc = job->pairSrc;
+
+    uint16 order[FX_MAP_BLOCK_SIZE];
+
+    for( uint64 blockStart = 0; blockStart < length; blockStart += FX_MAP_BLOCK_SIZE )
+    {
+        const uint32 blockLength = (uint32)std::min( length - blockStart, (uint64)FX_MAP_BLOCK_SIZE );
+
+        const uint32* sortKey = job->sortKey + offset + blockStart;
+        TMeta*        metaDst = job->metaDst + offset + blockStart;
+        TPair*        pairDst = job->pairDst + offset + blockStart;
+
+        // Partition the block's entries by the range of their source
+        uint32 counts[SrcRanges] = {};
+        for( uint32 i = 0; i < blockLength; i++ )
+            counts[sortKey[i] >> srcRangeShift]++;
+
+        uint32 pfxSum = 0;
+        for( uint32 r = 0; r < SrcRanges; r++ )
+        {
+            const uint32 c = counts[r];
+            counts[r] = pfxSum;
+            pfxSum += c;
+        }
+
+        for( uint32 i = 0; i < blockLength; i++ )
+            order[counts[sortKey[i] >> srcRangeShift]++] = (uint16)i;
+
+        // Gather in source order. The destination block stays in cache.
+        for( uint32 j = 0; j < blockLength; j++ )
+        {
+            if( j + FX_MAP_PREFETCH_DIST < blockLength )
+            {
+                const uint32 next = sortKey[order[j + FX_MAP_PREFETCH_DIST]];
+                BB_PREFETCH( metaSrc + next );
+                BB_PREFETCH( pairSrc + next );
+            }
+
+            const uint32 i   = order[j];
+            const uint32 src = sortKey[i];
+
+            metaDst[i] = metaSrc[src];
+            StorePair( pairDst[i], pairSrc[src] );
+        }
+    }
+}
+
+
+/// Distributes a chunk of Fx entries, in order, in buckets by y's most significant bits.
+/// The bucketed entries are written to the chunk's own range of the destination buffers,
+/// so that chunks can be distributed as soon as they are computed, without knowing
+/// the size of the table's buckets.
+/// bucketCounts : Entries in each bucket of the chunk.
+/// bucketStarts : Outputs the start of each bucket within the chunk. FX_CHUNK_BUCKET_STRIDE entries.
+//-----------------------------------------------------------
+template<typename TMeta>
+inline void FxBucketChunk( uint64 length, const uint32* bucketCounts,
+                           const uint64* ySrc, const TMeta* metaSrc, const Pair* pairSrc,
+                           uint64*       yDst, TMeta*       metaDst, Pair*       pairDst,
+                           uint32* bucketStarts )
+{
+    uint32 offsets[FX_BUCKET_COUNT];
+    uint32 offset = 0;
+
+    for( uint b = 0; b < FX_BUCKET_COUNT; b++ )
+    {
+        bucketStarts[b] = offset;
+        offsets     [b] = offset;
+        offset += bucketCounts[b];
+    }
+
+    bucketStarts[FX_BUCKET_COUNT] = offset;
+    ASSERT( offset == length );
 
     for( uint64 i = 0; i < length; i++ )
-        pairDst[i] = pairSrc[sortKey[i]];
+    {
+        const uint64 y   = ySrc[i];
+        const uint32 dst = offsets[y >> FX_BUCKET_SHIFT]++;
+
+        yDst   [dst] = y;
+        metaDst[dst] = metaSrc[i];
+        pairDst[dst] = pairSrc[i];
+    }
+}
+
+/// Sorts y, along with its metadata and pairs, whose chunks have already been distributed with FxBucketChunk().
+/// Each bucket is gathered from all of the chunks, in chunk order, and radix sorted in cache,
+/// so that the result is the same as a stable sort of the whole table on y.
+/// chunkBuckets : The bucket starts output by FxBucketChunk() for each chunk
+/// sortTmp      : sortTmpSize uint32 entries
+//-----------------------------------------------------------
+template<typename TMeta, size_t MAX_JOBS, typename TPair>
+inline void SortFxBucketed(
+    ThreadPool&   pool,       uint64        length,
+    uint64        chunkSize,  const uint32* chunkBuckets,
+    const uint64* ySrc,       const TMeta*  metaSrc,    const Pair* pairSrc,
+    uint64*       yDst,       TMeta*        metaDst,    TPair*      pairDst,
+    uint32*       sortTmp,    uint64        sortTmpSize )
+{
+    const uint threadCount = pool.ThreadCount();
+    const uint chunkCount  = (uint)CDiv( length, (int)chunkSize );
+
+    // The buckets are output in order, each with its entries from all chunks
+    uint64 bucketStarts[FX_BUCKET_COUNT+1];
+    uint64 bucketMax = 0;
+    uint64 offset    = 0;
+
+    for( uint b = 0; b < FX_BUCKET_COUNT; b++ )
+    {
+        bucketStarts[b] = offset;
+
+        for( uint c = 0; c < chunkCount; c++ )
+        {
+            const uint32* buckets = chunkBuckets + (uint64)c * FX_CHUNK_BUCKET_STRIDE;
+            offset += buckets[b+1] - buckets[b];
+        }
+
+        bucketMax = std::max( bucketMax, offset - bucketStarts[b] );
+    }
+
+    bucketStarts[FX_BUCKET_COUNT] = offset;
+    ASSERT( offset == length );
+
+    // Each thread needs a key and a source index buffer, as well as their copies, to radix sort a bucket with
+    const uint64 sortTmpPerThread = bucketMax * 4;
+    FatalIf( sortTmpPerThread * threadCount > sortTmpSize,
+        "Fx bucket of %llu entries is too large to be sorted.", bucketMax );
+
+    std::vector<FxBucketJob<TMeta, TPair>> jobs( threadCount );
+
+    ChunkScheduler scheduler;
+    scheduler.Init( FX_BUCKET_COUNT, threadCount );
+
+    for( uint i = 0; i < threadCount; i++ )
+    {
+        auto& job = jobs[i];
+
+        job.scheduler    = &scheduler;
+        job.threadId     = i;
+        job.chunkCount   = chunkCount;
+        job.chunkSize    = chunkSize;
+        job.chunkBuckets = chunkBuckets;
+        job.bucketStarts = bucketStarts;
+        job.ySrc         = ySrc;
+        job.metaSrc      = metaSrc;
+        job.pairSrc      = pairSrc;
+        job.yDst         = yDst;
+        job.metaDst      = metaDst;
+        job.pairDst      = pairDst;
+        job.sortTmp      = sortTmp + sortTmpPerThread * i;
+    }
+
+    pool.RunJob( FxSortBucketsThread<TMeta, TPair>, jobs.data(), threadCount );
 }
 
+//-----------------------------------------------------------
+template<typename TMeta, typename TPair>
+void FxSortBucketsThread( FxBucketJob<TMeta, TPair>* job )
+{
+    constexpr uint64 yMask     = ( 1ull << FX_BUCKET_SHIFT ) - 1;
+    constexpr uint   Radix     = 1u << FX_BUCKET_RADIX_BITS;
+    constexpr uint   RadixMask = Radix - 1;
+    constexpr uint   Passes    = CDiv( FX_BUCKET_SHIFT, FX_BUCKET_RADIX_BITS );
+
+    const uint64* ySrc = job->ySrc;
+
+    uint32 counts[Radix];
+
+    uint bucket;
+    while( job->scheduler->Next( job->threadId, bucket ) )
+    {
+        const uint64 offset = job->bucketStarts[bucket];
+        const uint64 length = job->bucketStarts[bucket+1] - offset;
+
+        // The bucket's keys are sorted along with the index of their source entry
+        uint32* keys    = job->sortTmp;
+        uint32* keysTmp = job->sortTmp + length;
+        uint32* idx     = job->sortTmp + length * 2;
+        uint32* idxTmp  = job->sortTmp + length * 3;
+
+        // Gather the bucket from each chunk
+        uint64 count = 0;
+        for( uint c = 0; c < job->chunkCount; c++ )
+        {
+            const uint32* buckets   = job->chunkBuckets + (uint64)c * FX_CHUNK_BUCKET_STRIDE;
+            const uint64  chunkBase = (uint64)c * job->chunkSize;
+            const uint64  end       = chunkBase + buckets[bucket+1];
+
+            for( uint64 i = chunkBase + buckets[bucket]; i < end; i++ )
+            {
+                keys[count] = (uint32)( ySrc[i] & yMask );
+                idx [count] = (uint32)i;
+                count++;
+            }
+        }
+        ASSERT( count == length );
+
+        for( uint pass = 0; pass < Passes; pass++ )
+        {
+            const uint shift = pass * FX_BUCKET_RADIX_BITS;
+
+            memset( counts, 0, sizeof( counts ) );
+
+            for( uint64 i = 0; i < length; i++ )
+                counts[( keys[i] >> shift ) & RadixMask]++;
+
+            uint32 sum = 0;
+            for( uint i = 0; i < Radix; i++ )
+            {
+                const uint32 c = counts[i];
+                counts[i] = sum;
+                sum += c;
+            }
+
+            for( uint64 i = 0; i < length; i++ )
+            {
+                const uint32 dst = counts[( keys[i] >> shift ) & RadixMask]++;
+
+                keysTmp[dst] = keys[i];
+                idxTmp [dst] = idx [i];
+            }
+
+            std::swap( keys, keysTmp );
+            std::swap( idx , idxTmp  );
+        }
+
+        // Write the sorted entries to their final location
+        const uint64 bucketBits = (uint64)bucket << FX_BUCKET_SHIFT;
+        const TMeta* metaSrc    = job->metaSrc;
+        const Pair*  pairSrc    = job->pairSrc;
+
+        uint64* yDst    = job->yDst    + offset;
+        TMeta*  metaDst = job->metaDst + offset;
+        TPair*  pairDst = job->pairDst + offset;
+
+        for( uint64 i = 0; i < length; i++ )
+        {
+            const uint32 src = idx[i];
+
+            yDst   [i] = bucketBits | keys[i];
+            metaDst[i] = metaSrc[src];
+            StorePair( pairDst[i], pairSrc[src] );
+        }
+    }
+}
 
 //-----------------------------------------------------------
 template<size_t MAX_JOBS>
@@ -112,11 +448,11 @@ inline void GenSortKey(
     uint64 length,
     uint32* keyBuffer )
 {
-    GenSortKeyJob jobs[MAX_JOBS];
-    
     const uint threadCount = pool.ThreadCount();
     ASSERT( MAX_JOBS >= threadCount );
 
+    std::vector<GenSortKeyJob> jobs( threadCount );
+
     const uint64 entriesPerThread = length / threadCount;
     const uint64 tailingEntries   = length - ( entriesPerThread * threadCount );
 
@@ -131,7 +467,7 @@ inline void GenSortKey(
 
     jobs[threadCount-1].length += tailingEntries;
 
-    pool.RunJob( GenSortKeyThread, jobs, threadCount );
+    pool.RunJob( GenSortKeyThread, jobs.data(), threadCount );
 }
 
 
@@ -0,0 +1,268 @@
+#include "KBCMatch.h"
+#include "KernelDispatch.h"
+
+#if defined( __x86_64__ ) || defined( _M_X64 )
+    #define KBC_X86 1
+    #include <immintrin.h>
+
+    #if defined( _MSC_VER ) && !defined( __clang__ )
+        #include <intrin.h>
+        #define KBC_TARGET( t )
+    #else
+        #define KBC_TARGET( t ) __attribute__((target( t )))
+    #endif
+#else
+    #define KBC_X86 0
+#endif
+
+#if defined( __aarch64__ ) || defined( _M_ARM64 )
+    #define KBC_NEON 1
+    #include <arm_neon.h>
+#else
+    #define KBC_NEON 0
+#endif
+
+// #NOTE: The SIMD kernels gather the bitmap in 32-bit words,
+//        which is only equivalent to 64-bit words on little endian.
+
+// Per-m constants from which the match targets are computed.
+// Target m of local L value l is:
+//  ( ( l / kC + m ) % kB ) * kC + ( ( ( 2m + parity )^2 % kC ) + l % kC ) % kC
+struct KBCTargetConsts
+{
+    uint32 m            [kExtraBitsPow];
+    uint32 squareModC[2][kExtraBitsPow];
+
+    //-----------------------------------------------------------
+    constexpr KBCTargetConsts() : m(), squareModC()
+    {
+        for( uint32 i = 0; i < kExtraBitsPow; i++ )
+        {
+            m[i] = i;
+
+            for( uint32 parity = 0; parity < 2; parity++ )
+            {
+                const uint32 v = 2 * i + parity;
+                squareModC[parity][i] = ( v * v ) % (uint32)kC;
+            }
+        }
+    }
+};
+
+alignas( 64 ) static constexpr KBCTargetConsts KBC_CONSTS;
+
+//-----------------------------------------------------------
+static void MatchKBCGroupScalar( const uint64* yL, uint32 count, uint64 groupLRangeStart, uint32 parity,
+                                 const uint64* rMap, uint64* outMasks )
+{
+    for( uint32 i = 0; i < count; i++ )
+    {
+        const uint32 localL = (uint32)( yL[i] - groupLRangeStart );
+        uint64 mask = 0;
+
+        for( uint32 m = 0; m < kExtraBitsPow; m++ )
+            mask |= (uint64)BitFieldGet( rMap, KBCMatchTarget( localL, parity, m ) ) << m;
+
+        outMasks[i] = mask;
+    }
+}
+
+#if KBC_X86
+
+//-----------------------------------------------------------
+KBC_TARGET( "avx2" )
+static void MatchKBCGroupAVX2( const uint64* yL, uint32 count, uint64 groupLRangeStart, uint32 parity,
+                               const uint64* rMap, uint64* outMasks )
+{
+    const int*     map       = (const int*)rMap;
+    const uint32*  squareMod = KBC_CONSTS.squareModC[parity];
+
+    const __m256i vB  = _mm256_set1_epi32( (int)kB );
+    const __m256i vC  = _mm256_set1_epi32( (int)kC );
+    const __m256i v31 = _mm256_set1_epi32( 31 );
+
+    for( uint32 i = 0; i < count; i++ )
+    {
+        const uint32 localL = (uint32)( yL[i] - groupLRangeStart );
+        const __m256i indJ  = _mm256_set1_epi32( (int)( localL / (uint32)kC ) );
+        const __m256i modC  = _mm256_set1_epi32( (int)( localL % (uint32)kC ) );
+
+        uint64 mask = 0;
+
+        for( uint32 m = 0; m < kExtraBitsPow; m += 8 )
+        {
+            // Both sums are below 2x their modulus, so the
+            // modulo is the unsigned min of the sum and sum - modulus.
+            __m256i b = _mm256_add_epi32( indJ, _mm256_load_si256( (const __m256i*)( KBC_CONSTS.m + m ) ) );
+            __m256i c = _mm256_add_epi32( modC, _mm256_load_si256( (const __m256i*)( squareMod + m ) ) );
+
+            b = _mm256_min_epu32( b, _mm256_sub_epi32( b, vB ) );
+            c = _mm256_min_epu32( c, _mm256_sub_epi32( c, vC ) );
+
+            const __m256i target = _mm256_add_epi32( _mm256_mullo_epi32( b, vC ), c );
+            const __m256i words  = _mm256_i32gather_epi32( map, _mm256_srli_epi32( target, 5 ), 4 );
+            const __m256i bits   = _mm256_sllv_epi32( _mm256_srlv_epi32( words, _mm256_and_si256( target, v31 ) ), v31 );
+
+            mask |= (uint64)(uint32)_mm256_movemask_ps( _mm256_castsi256_ps( bits ) ) << m;
+        }
+
+        outMasks[i] = mask;
+    }
+}
+
+// #NOTE: GCC reports spurious uninitialized warnings in _mm512_min_epu32 and _mm512_srli_epi32
+#if defined( __GNUC__ ) && !defined( __clang__ )
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wuninitialized"
+    #pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+//-----------------------------------------------------------
+KBC_TARGET( "avx512f" )
+static void MatchKBCGroupAVX512( const uint64* yL, uint32 count, uint64 groupLRangeStart, uint32 parity,
+                                 const uint64* rMap, uint64* outMasks )
+{
+    const int*     map       = (const int*)rMap;
+    const uint32*  squareMod = KBC_CONSTS.squareModC[parity];
+
+    const __m512i vB  = _mm512_set1_epi32( (int)kB );
+    const __m512i vC  = _mm512_set1_epi32( (int)kC );
+    const __m512i v31 = _mm512_set1_epi32( 31 );
+    const __m512i v1  = _mm512_set1_epi32( 1 );
+
+    for( uint32 i = 0; i < count; i++ )
+    {
+        const uint32 localL = (uint32)( yL[i] - groupLRangeStart );
+        const __m512i indJ  = _mm512_set1_epi32( (int)( localL / (uint32)kC ) );
+        const __m512i modC  = _mm512_set1_epi32( (int)( localL % (uint32)kC ) );
+
+        uint64 mask = 0;
+
+        for( uint32 m = 0; m < kExtraBitsPow; m += 16 )
+        {
+            __m512i b = _mm512_add_epi32( indJ, _mm512_load_si512( KBC_CONSTS.m + m ) );
+            __m512i c = _mm512_add_epi32( modC, _mm512_load_si512( squareMod + m ) );
+
+            b = _mm512_min_epu32( b, _mm512_sub_epi32( b, vB ) );
+            c = _mm512_min_epu32( c, _mm512_sub_epi32( c, vC ) );
+
+            const __m512i target = _mm512_add_epi32( _mm512_mullo_epi32( b, vC ), c );
+            const __m512i words  = _mm512_i32gather_epi32( _mm512_srli_epi32( target, 5 ), map, 4 );
+            const __m512i bits   = _mm512_srlv_epi32( words, _mm512_and_si512( target, v31 ) );
+
+            mask |= (uint64)_mm512_test_epi32_mask( bits, v1 ) << m;
+        }
+
+        outMasks[i] = mask;
+    }
+}
+
+#if defined( __GNUC__ ) && !defined( __clang__ )
+    #pragma GCC diagnostic pop
+#endif
+
+#endif // KBC_X86
+
+#if KBC_NEON
+
+// It has no gathers: the targets are computed 4 at a time, their bitmap words are loaded
+// one by one, and their bits are tested and folded into the mask as vectors.
+//-----------------------------------------------------------
+static void MatchKBCGroupNEON( const uint64* yL, uint32 count, uint64 groupLRangeStart, uint32 parity,
+                               const uint64* rMap, uint64* outMasks )
+{
+    const uint32*  map       = (const uint32*)rMap;
+    const uint32*  squareMod = KBC_CONSTS.squareModC[parity];
+
+    alignas( 16 ) static const int32 LANE_SHIFTS[4] = { 0, 1, 2, 3 };
+
+    const uint32x4_t vB        = vdupq_n_u32( (uint32)kB );
+    const uint32x4_t vC        = vdupq_n_u32( (uint32)kC );
+    const uint32x4_t v31       = vdupq_n_u32( 31 );
+    const uint32x4_t v1        = vdupq_n_u32( 1 );
+    const int32x4_t  laneShift = vld1q_s32( LANE_SHIFTS );
+
+    alignas( 16 ) uint32 wordIdx[4];
+    alignas( 16 ) uint32 words  [4];
+
+    for( uint32 i = 0; i < count; i++ )
+    {
+        const uint32     localL = (uint32)( yL[i] - groupLRangeStart );
+        const uint32x4_t indJ   = vdupq_n_u32( localL / (uint32)kC );
+        const uint32x4_t modC   = vdupq_n_u32( localL % (uint32)kC );
+
+        uint64 mask = 0;
+
+        for( uint32 m = 0; m < kExtraBitsPow; m += 4 )
+        {
+            // Both sums are below 2x their modulus, so the
+            // modulo is the unsigned min of the sum and sum - modulus.
+            uint32x4_t b = vaddq_u32( indJ, vld1q_u32( KBC_CONSTS.m + m ) );
+            uint32x4_t c = vaddq_u32( modC, vld1q_u32( squareMod + m ) );
+
+            b = vminq_u32( b, vsubq_u32( b, vB ) );
+            c = vminq_u32( c, vsubq_u32( c, vC ) );
+
+            const uint32x4_t target = vmlaq_u32( c, b, vC );
+
+            vst1q_u32( wordIdx, vshrq_n_u32( target, 5 ) );
+            words[0] = map[wordIdx[0]];
+            words[1] = map[wordIdx[1]];
+            words[2] = map[wordIdx[2]];
+            words[3] = map[wordIdx[3]];
+
+            // Shift each target's bit down to bit 0, then up to its lane's bit of the mask
+            const int32x4_t  bitShift = vnegq_s32( vreinterpretq_s32_u32( vandq_u32( target, v31 ) ) );
+            const uint32x4_t bits     = vandq_u32( vshlq_u32( vld1q_u32( words ), bitShift ), v1 );
+
+            mask |= (uint64)vaddvq_u32( vshlq_u32( bits, laneShift ) ) << m;
+        }
+
+        outMasks[i] = mask;
+    }
+}
+
+#endif // KBC_NEON
+
+typedef void (*MatchKBCGroupFn)( const uint64* yL, uint32 count, uint64 groupLRangeStart, uint32 parity,
+                                 const uint64* rMap, uint64* outMasks );
+
+static MatchKBCGroupFn _matchKBCGroup = nullptr;
+
+//-----------------------------------------------------------
+SimdLevel SelectKBCMatchKernel( SimdLevel maxLevel )
+{
+#if KBC_X86
+    if( maxLevel == SimdLevel::AVX512 )
+    {
+        _matchKBCGroup = MatchKBCGroupAVX512;
+        return SimdLevel::AVX512;
+    }
+    if( maxLevel == SimdLevel::AVX2 )
+    {
+        _matchKBCGroup = MatchKBCGroupAVX2;
+        return SimdLevel::AVX2;
+    }
+#elif KBC_NEON
+    if( maxLevel == SimdLevel::NEON )
+    {
+        _matchKBCGroup = MatchKBCGroupNEON;
+        return SimdLevel::NEON;
+    }
+#endif
+
+    _matchKBCGroup = MatchKBCGroupScalar;
+    return SimdLevel::Scalar;
+}
+
+static const SimdLevel _defaultLevel = SelectKBCMatchKernel( KernelDispatch::Detect() );
+
+//-----------------------------------------------------------
+void MatchKBCGroup( const uint64* yL, uint32 count, uint64 groupLRangeStart, uint32 parity,
+                    const uint64* rMap, uint64* outMasks )
+{
+    ASSERT( count <= KBC_MATCH_BATCH );
+    ASSERT( parity < 2 );
+
+    _matchKBCGroup( yL, count, groupLRangeStart, parity, rMap, outMasks );
+}
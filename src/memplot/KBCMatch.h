@@ -0,0 +1,34 @@
+#pragma once
+#include "ChiaConsts.h"
+
+// Size of the bitmap of local y values present in a kBC group
+#define KBC_MAP_WORDS CDiv( kBC, 64 )
+
+// Max L entries matched in a single MatchKBCGroup call
+#define KBC_MATCH_BATCH 64
+
+/**
+ * Tests the kExtraBitsPow match targets of a batch of L group entries
+ * against a bitmap of the local y values present in the adjacent R group.
+ * Bit m of each entry's output mask is set if its m-th target
+ * (see KBCMatchTarget()) is present in the R group.
+ * The widest SIMD kernel the CPU supports is selected at runtime. See KernelDispatch.
+ *
+ * yL               : y values of the L entries
+ * count            : Number of entries. Up to KBC_MATCH_BATCH.
+ * groupLRangeStart : First y value of the L group's range (groupL * kBC)
+ * rMap             : Bitmap of size KBC_MAP_WORDS with the R group's y values present
+ */
+void MatchKBCGroup( const uint64* yL, uint32 count, uint64 groupLRangeStart, uint32 parity,
+                    const uint64* rMap, uint64* outMasks );
+
+// Local R group y value of the m-th match target of an L entry.
+// Equivalent to L_targets[parity][localL][m].
+//-----------------------------------------------------------
+inline uint32 KBCMatchTarget( uint32 localL, uint32 parity, uint32 m )
+{
+    const uint32 indJ = localL / (uint32)kC;
+    const uint32 v    = 2 * m + parity;
+
+    return ( ( indJ + m ) % (uint32)kB ) * (uint32)kC + ( v * v + localL ) % (uint32)kC;
+}
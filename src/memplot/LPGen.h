@@ -1,6 +1,9 @@
 #pragma once
 #include <atomic>
+#include <vector>
 #include "PlotContext.h"
+#include "threading/ChunkScheduler.h"
+#include "threading/Barrier.h"
 
 ///
 /// Job structs
@@ -10,39 +13,98 @@ struct SyncedJob
 {   
     uint               _threadId;
     uint               _threadCount;
-    std::atomic<uint>* _readyCount;
-    std::atomic<uint>* _releaseLock;
+    Barrier*           _barrier;
     
-    inline void Init( const uint threadId, const uint threadCount, std::atomic<uint>& signal, std::atomic<uint>& releaseLock );
+    inline void Init( const uint threadId, const uint threadCount, Barrier& barrier );
     inline void WaitForThreads();
 };
 
+// Chunks of the R table scheduled between all LP jobs
+struct LPChunks
+{
+    ChunkScheduler prune;       // Pruning marked entries
+    ChunkScheduler linePoint;   // Converting pruned entries to line points
+
+    uint64 size;                // R table entries per chunk
+    uint64 rTableCount;
+
+    // Where each chunk's pruned entries start in lpBuffer.
+    // The last entry is the total pruned length.
+    std::vector<uint64> offsets;
+};
+
+// Line points are spread evenly accross [0, 2^(2k-1)), so their top bits
+// split them into buckets of about the same size. With 2^14 buckets,
+// a bucket of a k32 table (~3 MiB with its map) stays in the cache while it's sorted.
+#define LP_SORT_BUCKET_BITS  14
+#define LP_SORT_BUCKETS      ( 1u << LP_SORT_BUCKET_BITS )
+#define LP_SORT_BUCKET_SHIFT ( _K * 2 - 1 - LP_SORT_BUCKET_BITS )
+
+// Digit size of the radix sort within each bucket
+#define LP_SORT_DIGIT_BITS   10
+
+// Per-thread state of the bucketed line point sort.
+// This lives in the stack of each thread.
+struct LPBucketThread
+{
+    uint32 counts [LP_SORT_BUCKETS];                     // Line points this thread converted into each bucket
+    uint64 offsets[LP_SORT_BUCKETS];                     // Where this thread's next entry of each bucket goes
+    std::vector<uint32> chunks;                          // Chunks this thread converted, in the order it did
+    uint32 chunkCount;
+};
+
+// Buckets of the line point sort shared by all LP jobs
+struct LPBuckets
+{
+    uint64* lpTmp;              // Where the line points are distributed into buckets
+    uint32* mapTmp;
+
+    std::vector<LPBucketThread*> threads;   // Set by each thread itself
+
+    ChunkScheduler sort;                    // Buckets, scheduled between the threads sorting them
+
+    // Where each bucket starts. The last entry is the total length.
+    uint64 starts[LP_SORT_BUCKETS + 1];
+};
+
 struct LPJob : public SyncedJob
 {
     uint32* lTable;             // Left table (x for Table 1, or lookup table to new indices otherwise)
     
     uint64  length;             // R Table length
     uint64  offset;             // Offset in R table to our entries
-    Pair*   rTable;             // R table
+    const PackedPair* rTable;   // R table
     uint64* lpBuffer;           // Where to store the pruned Pairs as line points
 
-    LPJob*  jobs;               // All threads participating in this job
+    LPChunks* chunks;           // Chunks shared by all threads participating in this job
 
-    const byte* markedEntries;  // Marked entries that will not be pruned
+    const uint64* markedEntries;  // Bitfield of marked entries that will not be pruned
     
     uint32* map;
+
+    bool fusedPrune;            // Prune straight into line points, skipping the pruned Pair pass
+
+    uint droppedXBits;          // Low bits dropped from the x's of table 1's line points, or 0
+
+    LPBuckets* buckets;         // If set, the line points are distributed into buckets as they are
+                                // converted, and each bucket sorted on its own, sorting the map with them.
 };
 
 template<bool PruneTable>
 void ProcessTableThread( LPJob* job );
 
-void PruneAndMapThread( LPJob* job );
-void ConverToLinePointThread( LPJob* job );
+template<bool ToLinePoint>
+void PruneAndMapThread( LPJob* job, LPBucketThread* bucketThread );
+void ConverToLinePointThread( LPJob* job, LPBucketThread* bucketThread );
+
+template<bool PruneTable>
+void SortLinePointBucketsThread( LPJob* job, LPBucketThread& bucketThread );
 void WriteLookupTableThread( LPJob* job );
 
 // Calculates x * (x-1) / 2. Division is done before multiplication.
 inline uint64 GetXEnc( uint64 x );
 inline uint64 SquareToLinePoint( uint64 x, uint64 y );
+inline uint64 DroppedXLinePoint( uint64 x, uint64 y );
 
 
 
@@ -84,50 +146,36 @@ FORCE_INLINE uint64 SquareToLinePoint( uint64 x, uint64 y )
 
     return GetXEnc( x ) + y;
 }
+
+// Encodes two table 1 x's whose low bits were dropped. Unlike full x's, they may be equal,
+// so the larger one is offset by 1, keeping y < x, and the line point unique.
+FORCE_INLINE uint64 DroppedXLinePoint( uint64 x, uint64 y )
+{
+    if( y > x )
+        std::swap( x, y );
+
+    // GetXEnc( x+1 ), which is x * (x+1) / 2
+    const uint64 xEnc = ( x & 1 ) ? x * ( ( x + 1 ) >> 1 ) : ( x >> 1 ) * ( x + 1 );
+
+    return xEnc + y;
+}
 #pragma GCC diagnostic pop
 
 
 //-----------------------------------------------------------
-inline void SyncedJob::Init( const uint threadId, const uint threadCount, std::atomic<uint>& signal, std::atomic<uint>& releaseLock )
+inline void SyncedJob::Init( const uint threadId, const uint threadCount, Barrier& barrier )
 {
+    ASSERT( barrier.ThreadCount() == threadCount );
+
     _threadId    = threadId;
     _threadCount = threadCount;
-    _readyCount  = &signal;
-    _releaseLock = &releaseLock;
+    _barrier     = &barrier;
 }
 
 //-----------------------------------------------------------
 inline void SyncedJob::WaitForThreads()
 {
-    std::atomic<uint>& readyCount  = *_readyCount;
-    std::atomic<uint>& releaseLock = *_releaseLock;
-
-    const uint targetCount = _threadCount - 1;
-
-    if( _threadId == 0 )
-    {
-        // Wait for all threads
-        while( readyCount.load( std::memory_order_relaxed ) != targetCount );
-        
-        // Signal all threads
-        releaseLock .store( 0, std::memory_order_release );
-        readyCount  .store( 0, std::memory_order_release );
-    }
-    else
-    {
-        // Signal control thread
-        uint count = readyCount.load( std::memory_order_acquire );
-
-        while( !readyCount.compare_exchange_weak( count, count+1, std::memory_order_release, std::memory_order_relaxed ) );
-
-        // Wait for control thread to signal us
-        while( readyCount.load( std::memory_order_relaxed ) != 0 );
-
-        // Ensure all threads have been released
-        count = releaseLock.load( std::memory_order_acquire );
-        while( !releaseLock.compare_exchange_weak( count, count+1, std::memory_order_release, std::memory_order_relaxed ) );
-        while( releaseLock.load( std::memory_order_relaxed ) != targetCount );
-    }
+    _barrier->Wait( _threadId );
 }
 
 
@@ -1,19 +1,29 @@
 #include "MemPhase1.h"
 #include "b3/blake3.h"
+#include "pos/blake3_lanes.h"
 #include "pos/chacha8.h"
 #include "Util.h"
 #include "util/Log.h"
 #include "FxSort.h"
 #include "algorithm/YSort.h"
 #include "SysHost.h"
+#include "ThreadPolicy.h"
+#include "util/Profiler.h"
+#include "util/Metrics.h"
 #include <cmath>
 
 #include "DbgHelper.h"
+#include "TableSpiller.h"
+#include "PlotMover.h"
+#include "PlotCheckpoint.h"
+#include "KBCMatch.h"
+#include "threading/ChunkScheduler.h"
+#include "gpu/GpuCompute.h"
+#include <vector>
     
     bool DbgVerifySortedY( const uint64 entryCount, const uint64* yBuffer );
     
 #if _DEBUG
-    // #define DBG_VALIDATE_KB_GROUPS 1
 
     #define DBG_FILE_T1_Y_PATH      DBG_TABLES_PATH "y.t1.tmp"
     #define DBG_FILE_T1_X_PATH      DBG_TABLES_PATH "x.t1.tmp"
@@ -44,51 +54,104 @@ struct F1GenJob
     uint32* xBuffer;
 };
 
+// Buckets of the first radix pass over F1's y values (y >> 32)
+#define F1_BUCKETS ( 1u << kExtraBits )
+
+struct F1BucketJob
+{
+    const byte* key;
+
+    uint32  blockCount;
+    uint32  entryCount;
+    uint32  x;
+    byte*   blocks;
+
+    uint32  counts [F1_BUCKETS];    // Entries this thread generated per bucket
+    uint64  offsets[F1_BUCKETS];    // Where this thread writes its entries for each bucket
+
+    uint32* yBuffer;                // Low 32 bits of y, ordered by bucket
+    uint32* xBuffer;
+};
+
 struct kBCJob
 {
     const uint64* yBuffer;
-    uint64        maxCount;         // Max group count for scan job, pair count for pair job.
-    uint64        groupCount;
-    uint32*       groupBoundaries;
-    uint64        startIndex;
-
-    // For scan job
-    uint64 endIndex;
+    uint64        entryCount;       // Total entries in yBuffer
+    uint64        maxCount;         // Max pair count
+    uint64        groupCount;       // Groups scanned
 
-    // For scan job
-    uint64 pairCount;        // Group count for scan job, pair count for pair job.
+    uint64 pairCount;
     Pair*  pairs;
-    Pair*  copyDst;          // For second pass
+    Pair*  copyDst;                 // For second pass
 
-#if DEBUG
-    uint32 jobIdx;
-#endif
+    ChunkScheduler* scheduler;
+    uint            threadId;
+
+    // Shared by all jobs, indexed by chunk
+    const uint64*   chunkStarts;    // First entry of the first L group to pair (chunkCount+1 entries)
+    Pair**          chunkPairs;     // Where the chunk's pairs were written
+    uint64*         chunkPairCounts;
+    uint64*         chunkOffsets;   // Where the chunk's pairs go in the destination buffer
 };
 
 
 template<typename TYOut, typename TMetaIn, typename TMetaOut>
 struct FpFxJob
 {
-    uint64         entryCount;
+    uint64         entryCount;      // Total entries accross all jobs
+    uint64         chunkSize;       // Entries per scheduled chunk
     const TMetaIn* inMetaBuffer;
     const uint64*  inYBuffer;
     const Pair*    lrPairs;
     TMetaOut*      outMetaBuffer;
     TYOut*         outYBuffer;
+    uint32*        chunkBuckets;    // If set, each chunk is distributed in Fx sort buckets once computed,
+                                    // and the start of its buckets are written here
+    byte*          bucketTmp;       // Staging for the chunk's outputs before they are distributed
+    uint64         bucketTmpStride; // Staging size per thread
+
+    ChunkScheduler* scheduler;
+    uint            threadId;
+    uint            firstChunk;     // Added to the chunks handed out by the scheduler
 };
 
 /// Internal Funcs forwards-declares
 void F1JobThread( F1GenJob* job );
 void F1NumaJobThread( F1GenJob* job );
+void F1BucketCountThread( F1BucketJob* job );
+void F1BucketScatterThread( F1BucketJob* job );
 
-void FpScanThread( kBCJob* job );
 void FpPairThread( kBCJob* job );
+uint64 FpFindGroupStart( const uint64* yBuffer, const uint64 entryCount, const uint64 idx );
+uint64 FpPairChunk( const uint64* yBuffer, const uint64 entryCount, const uint64 start, const uint64 end,
+                    Pair* pairs, const uint64 maxPairs, uint64& groupCount );
 
 template<typename TYOut, typename TMetaIn, typename TMetaOut>
 void ComputeFxJob( FpFxJob<TYOut, TMetaIn, TMetaOut>* job );
 
+template<typename TYOut, typename TMetaIn, typename TMetaOut>
+void ComputeFxChunk( const FpFxJob<TYOut, TMetaIn, TMetaOut>* job, const uint64 offset, const uint64 entryCount,
+                     TYOut* outYBuffer, TMetaOut* outMetaBuffer, uint32* bucketCounts );
+
+template<typename TYOut, typename TMetaIn, typename TMetaOut>
+void ComputeFxBucketedChunk( const FpFxJob<TYOut, TMetaIn, TMetaOut>* job, const uint chunk,
+                             const uint64 offset, const uint64 entryCount );
+
+template<typename TYOut, typename TMetaIn, typename TMetaOut>
+void BucketFxChunksJob( FpFxJob<TYOut, TMetaIn, TMetaOut>* job );
+
+template<size_t metaKMultiplierIn, size_t metaKMultiplierOut>
+FORCE_INLINE void ComputeFxInput( uint64 y, const uint64* metaData, uint64* metaOut, uint64 input[5] );
+
 template<size_t metaKMultiplierIn, size_t metaKMultiplierOut, uint ShiftBits>
-FORCE_INLINE uint64 ComputeFx( uint64 y, uint64* metaData, uint64* metaOut );
+FORCE_INLINE uint64 ComputeFxOutput( const uint64 output[3], uint64* metaOut );
+
+// Generic versions of the above, for k < 32
+template<size_t metaKMultiplierIn, size_t metaKMultiplierOut>
+FORCE_INLINE void ComputeFxInputBits( uint64 y, const uint64* metaData, uint64* metaOut, uint64 input[5] );
+
+template<size_t metaKMultiplierIn, size_t metaKMultiplierOut, uint ShiftBits>
+FORCE_INLINE uint64 ComputeFxOutputBits( const uint64 output[3], uint64* metaOut );
 
 
 
@@ -108,11 +171,26 @@ void MemPhase1::WaitForPreviousPlotWriter()
             _context.plotWriter->FilePath().c_str(),
             _context.plotWriter->GetError() );
 
-    const char* curname = _context.plotWriter->FilePath().c_str();
-    char* newname = new char[strlen(curname) - 3]();
-    memcpy(newname, curname, strlen(curname) - 4);
+    // Nothing was written when benchmarking
+    if( _context.plotWriter->IsNullSink() )
+        return;
+
+    // Remote plots are renamed by their receiver
+    if( !_context.plotWriter->IsRemote() )
+    {
+        const char* curname = _context.plotWriter->FilePath().c_str();
+        char* newname = new char[strlen(curname) - 3]();
+        memcpy(newname, curname, strlen(curname) - 4);
+
+        if( rename(curname, newname) == 0 && _context.plotMover )
+            _context.plotMover->Enqueue( newname );
+
+        delete[] newname;
+    }
 
-    rename(curname, newname);
+    // The plot is on disk, so it won't be resumed
+    if( _context.checkpoint )
+        _context.checkpoint->Remove();
 
     // Print final pointer offsets
     Log::Line( "" );
@@ -137,14 +215,14 @@ void MemPhase1::WaitForPreviousPlotWriter()
 //----------------------------------------------------------
 void MemPhase1::Run()
 {
-    const uint64 entryCount = GenerateF1();
-
-    ForwardPropagate( entryCount );
+    uint64 entryCount = 1ull << _K;
 
+    if( _context.t1Pregenerated )
+        Log::Line( "F1 was generated in the background." );
+    else
+        entryCount = GenerateF1();
 
-    #if DBG_WRITE_PHASE_1_TABLES
-        WritePhaseTableFiles( _context );
-    #endif
+    ForwardPropagate( entryCount );
 
     // Test Proofs
     #if DBG_DUMP_PROOFS
@@ -167,6 +245,31 @@ void MemPhase1::Run()
 
 //-----------------------------------------------------------
 uint64 MemPhase1::GenerateF1()
+{
+    MemPlotContext& cx = _context;
+
+    // Generate all of the y values to a metabuffer first
+    uint64* yTmp = cx.metaBuffer1;
+    uint32* xTmp = (uint32*)( yTmp + ( 1ull << _K ) );
+
+    return GenerateF1( *cx.threadPool, cx.plotId, cx.yBuffer0, cx.t1XBuffer, yTmp, xTmp );
+}
+
+//-----------------------------------------------------------
+void MemPhase1::GenerateNextF1( ThreadPool& pool, const byte* plotId )
+{
+    MemPlotContext& cx = _context;
+
+    // yBuffer0 and yBuffer1 are not used by Phases 3 and 4
+    ASSERT( cx.pipeline && cx.inPlaceSort );
+    ASSERT( cx.nextT1XBuffer && cx.nextT1XTmp );
+
+    GenerateF1( pool, plotId, cx.yBuffer0, cx.nextT1XBuffer, cx.yBuffer1, cx.nextT1XTmp );
+}
+
+//-----------------------------------------------------------
+uint64 MemPhase1::GenerateF1( ThreadPool& pool, const byte* plotId, uint64* yBuffer, uint32* xBuffer,
+                              uint64* yTmp, uint32* xTmp )
 {
     MemPlotContext& cx  = _context;
 
@@ -175,41 +278,65 @@ uint64 MemPhase1::GenerateF1()
     ///
     // First byte is the table index
     byte key[32] = { 1 };
-    memcpy( key + 1, cx.plotId, 31 );
+    memcpy( key + 1, plotId, 31 );
     
     ///
     /// Prepare jobs
     ///
     const uint   k                  = _K;
     const size_t CHACHA_BLOCK_SIZE  = kF1BlockSizeBits / 8;
-    const uint   numThreads         = cx.threadCount;
+    const uint   numThreads         = pool.ThreadCount();
 
     const uint64 totalEntries       = 1ull << k;
-    const uint64 entriesPerBlock    = CHACHA_BLOCK_SIZE / sizeof( uint32 );
-    const uint64 totalBlocks        = totalEntries / entriesPerBlock;
-    const uint64 blocksPerThread    = totalBlocks / numThreads;
-    const uint64 entriesPerThread   = blocksPerThread * entriesPerBlock;
+    const uint64 groupsPerThread    = totalEntries / F1_GROUP_ENTRIES / numThreads;
+    const uint64 blocksPerThread    = groupsPerThread * F1_GROUP_BLOCKS;
+    const uint64 entriesPerThread   = groupsPerThread * F1_GROUP_ENTRIES;
 
+    // The trailing entries are whole groups, as 2^k is a multiple of the group size
     const uint64 trailingEntries    = totalEntries - ( entriesPerThread * numThreads );
-    const uint64 trailingBlocks     = CDiv( trailingEntries, entriesPerBlock );
+    const uint64 trailingBlocks     = trailingEntries / F1_GROUP_ENTRIES * F1_GROUP_BLOCKS;
 
-    ASSERT( entriesPerBlock * sizeof( uint32 ) == CHACHA_BLOCK_SIZE );  // Must fit exactly within a block
+    // The ChaCha blocks are generated into the y output, which is not needed until the sort
+    byte* blocks = (byte*)yBuffer;
 
-    // Generate all of the y values to a metabuffer first
-    byte*   blocks  = (byte*)cx.yBuffer0;
-    uint64* yBuffer = cx.yBuffer0;
-    uint32* xBuffer = cx.t1XBuffer;
-    uint64* yTmp    = cx.metaBuffer1;
-    uint32* xTmp    = (uint32*)(yTmp + totalEntries);
+    // The pipeline's pool is not pinned, so its threads don't map to NUMA nodes.
+    // It also runs in the background, so it isn't profiled.
+    const NumaInfo* numa     = &pool == cx.threadPool ? cx.numa     : nullptr;
+    Profiler*       profiler = &pool == cx.threadPool ? cx.profiler : nullptr;
+
+    // The GPU generates F1 in slices, which are only sorted once all of them are done
+    if( cx.fusedF1 && !cx.gpu )
+    {
+        // Scatter y and x into the buckets of the sort's first pass as they are generated.
+        // The keystream is kept in the upper half of the sort's y scratch, which is unused until then.
+        ProfileScope scope( profiler, "f1" );
+        GenerateF1Bucketed( pool, key, (byte*)( (uint32*)yTmp + totalEntries ), (uint32*)yBuffer, xBuffer, yTmp, xTmp );
+
+        #if DBG_VERIFY_SORT_F1
+            FatalIf( !DbgVerifySortedY( totalEntries, yBuffer ), "F1 is not sorted." );
+        #endif
+
+        return totalEntries;
+    }
 
-    ASSERT( numThreads <= MAX_THREADS );
+    if( cx.gpu )
+    {
+        Log::Line( "Generating F1 on the GPU..." );
+        auto timeStart = TimerBegin();
+        ProfileScope scope( profiler, "f1" );
 
-    // const NumaInfo* numa = SysHost::GetNUMAInfo();
+        GenerateF1OnGpu( pool, key, yTmp, xTmp );
 
-    // Gen all raw f1 values
+        double elapsed = TimerEnd( timeStart );
+        Log::Line( "Finished F1 generation in %.2lf seconds.", elapsed );
+    }
+    else
     {
+        // Gen all raw f1 values.
+        // Each thread generates into its own slice of the buffers, so with NUMA first-touch
+        // placement, F1 is written node-locally, and the sort keeps working on each node's slice.
         // Prepare jobs
-        F1GenJob jobs[MAX_THREADS];
+        std::vector<F1GenJob> jobs( numThreads );
         for( uint i = 0; i < numThreads; i++ )
         {
             uint64 offset      = i * entriesPerThread;
@@ -231,45 +358,11 @@ uint64 MemPhase1::GenerateF1()
         jobs[numThreads-1].entryCount += (uint32)trailingEntries;
         jobs[numThreads-1].blockCount += (uint32)trailingBlocks;
 
-        // Initialize NUMA pages
-        // if( numa )
-        // {
-        //     const uint pageSize       = (uint)SysHost::GetPageSize();
-        //     const uint blocksPerPage  = (uint)( pageSize / CHACHA_BLOCK_SIZE );
-        //     const uint pageCount      = (uint)( totalBlocks / blocksPerPage );
-        //     const uint pagesPerThread = pageCount / numThreads;
-        //     const uint nodeStride     = numa->nodeCount;
-
-        //     for( uint i = 0; i < numa->nodeCount; i++ )
-        //     {
-        //         const auto& nodeCpus = numa->cpuIds[i];
-        //         const uint  cpuCount = nodeCpus.length;
-
-        //         // #TODO: Remove this. For now we hard-code it to
-        //         //        the node of the first page.
-        //         // const int pageOffset = (i + 1) & 1;
-
-        //         for( uint j = 0; j < cpuCount; j++ )
-        //         { 
-        //             const uint cpuId = nodeCpus[j];
-
-        //             auto& job = jobs[cpuId];
-
-        //             job.node      = i;
-        //             job.startPage = nodeStride * j;
-        //             job.pageCount = pagesPerThread;
-        //             job.blocks    = blocks;
-        //             job.yBuffer   = yBuffer;
-        //             job.xBuffer   = xBuffer;
-        //         }
-        //     }
-        // }
-
         Log::Line( "Generating F1..." );
         auto timeStart = TimerBegin();
+        ProfileScope scope( profiler, "f1" );
 
-        // cx.threadPool->RunJob( numa ? F1NumaJobThread : F1JobThread, jobs, numThreads );
-        cx.threadPool->RunJob( F1JobThread, jobs, numThreads );
+        pool.RunJob( F1JobThread, jobs.data(), numThreads );
 
         double elapsed = TimerEnd( timeStart );
         Log::Line( "Finished F1 generation in %.2lf seconds.", elapsed );
@@ -278,8 +371,12 @@ uint64 MemPhase1::GenerateF1()
     Log::Line( "Sorting F1..." );
     auto timeStart = TimerBegin();
 
-    YSorter sorter( *cx.threadPool );
-    sorter.Sort( totalEntries, yTmp, yBuffer, xTmp, xBuffer );
+    {
+        ProfileScope scope( profiler, "f1_sort" );
+
+        YSorter sorter( pool, numa );
+        sorter.Sort( totalEntries, yTmp, yBuffer, xTmp, xBuffer );
+    }
 
     double elapsed = TimerEnd( timeStart );
     Log::Line( "Finished F1 sort in %.2lf seconds.", elapsed );
@@ -303,6 +400,103 @@ uint64 MemPhase1::GenerateF1()
     return totalEntries;
 }
 
+// The device generates the y's, while the pool writes the x's of each slice that is done
+//-----------------------------------------------------------
+void MemPhase1::GenerateF1OnGpu( ThreadPool& pool, const byte* key, uint64* yTmp, uint32* xTmp )
+{
+    uint64 xCount = 0;
+
+    _context.gpu->GenerateF1( key, yTmp, [&]( const uint64 readyCount ) {
+
+        const uint64 x = xCount;
+
+        pool.ParallelFor( readyCount - x, 0, [=]( uint64 begin, uint64 end, uint ) {
+            for( uint64 i = x + begin; i < x + end; i++ )
+                xTmp[i] = (uint32)i;
+        });
+
+        xCount = readyCount;
+    });
+
+    ASSERT( xCount == ENTRIES_PER_TABLE );
+}
+
+//-----------------------------------------------------------
+void MemPhase1::GenerateF1Bucketed( ThreadPool& pool, const byte* key, byte* blocks, uint32* yBuckets, uint32* xBuckets,
+                                    uint64* yTmp, uint32* xTmp )
+{
+    MemPlotContext& cx  = _context;
+
+    const size_t CHACHA_BLOCK_SIZE  = kF1BlockSizeBits / 8;
+    const uint   numThreads         = pool.ThreadCount();
+
+    const uint64 totalEntries       = 1ull << _K;
+    const uint64 groupsPerThread    = totalEntries / F1_GROUP_ENTRIES / numThreads;
+    const uint64 blocksPerThread    = groupsPerThread * F1_GROUP_BLOCKS;
+    const uint64 entriesPerThread   = groupsPerThread * F1_GROUP_ENTRIES;
+
+    const uint64 trailingEntries    = totalEntries - ( entriesPerThread * numThreads );
+    const uint64 trailingBlocks     = trailingEntries / F1_GROUP_ENTRIES * F1_GROUP_BLOCKS;
+
+    std::vector<F1BucketJob> jobs( numThreads );
+
+    for( uint i = 0; i < numThreads; i++ )
+    {
+        const uint64 offset = i * entriesPerThread;
+
+        F1BucketJob& job = jobs[i];
+
+        job.key        = key;
+        job.blockCount = (uint32)blocksPerThread;
+        job.entryCount = (uint32)entriesPerThread;
+        job.x          = (uint32)offset;
+        job.blocks     = blocks + i * blocksPerThread * CHACHA_BLOCK_SIZE;
+        job.yBuffer    = yBuckets;
+        job.xBuffer    = xBuckets;
+    }
+
+    jobs[numThreads-1].entryCount += (uint32)trailingEntries;
+    jobs[numThreads-1].blockCount += (uint32)trailingBlocks;
+
+    Log::Line( "Generating F1..." );
+    auto timer = TimerBegin();
+
+    pool.RunJob( F1BucketCountThread, jobs.data(), numThreads );
+
+    // Each bucket holds the entries of all threads, in thread order,
+    // so that the entries keep their x order within a bucket.
+    uint32 bucketLengths[F1_BUCKETS];
+    uint64 offset = 0;
+
+    for( uint b = 0; b < F1_BUCKETS; b++ )
+    {
+        const uint64 bucketStart = offset;
+
+        for( uint i = 0; i < numThreads; i++ )
+        {
+            jobs[i].offsets[b] = offset;
+            offset += jobs[i].counts[b];
+        }
+
+        bucketLengths[b] = (uint32)( offset - bucketStart );
+    }
+    ASSERT( offset == totalEntries );
+
+    pool.RunJob( F1BucketScatterThread, jobs.data(), numThreads );
+
+    double elapsed = TimerEnd( timer );
+    Log::Line( "Finished F1 generation in %.2lf seconds.", elapsed );
+
+    Log::Line( "Sorting F1..." );
+    timer = TimerBegin();
+
+    YSorter sorter( pool, &pool == cx.threadPool ? cx.numa : nullptr );
+    sorter.SortBucketed( totalEntries, bucketLengths, yTmp, (uint64*)yBuckets, xTmp, xBuckets );
+
+    elapsed = TimerEnd( timer );
+    Log::Line( "Finished F1 sort in %.2lf seconds.", elapsed );
+}
+
 
 ///
 /// Perform forward propagation across all tables 
@@ -318,6 +512,8 @@ void MemPhase1::ForwardPropagate( uint64 table1EntryCount )
     ReadWriteBuffer<uint64> yBuffer   ( cx.yBuffer0,    cx.yBuffer1    );
     ReadWriteBuffer<uint64> metaBuffer( cx.metaBuffer0, cx.metaBuffer1 );
 
+    MetricsSetEntries( cx.metrics, 1, table1EntryCount );
+
     uint64 table2EntryCount = FpComputeTable<TableId::Table2>( table1EntryCount, yBuffer, metaBuffer );
     uint64 table3EntryCount = FpComputeTable<TableId::Table3>( table2EntryCount, yBuffer, metaBuffer );
     uint64 table4EntryCount = FpComputeTable<TableId::Table4>( table3EntryCount, yBuffer, metaBuffer );
@@ -344,7 +540,9 @@ uint64 MemPhase1::FpComputeTable( uint64 entryCount,
 
     MemPlotContext& cx  = _context;
 
-    Pair* pairBuffer;
+    using TPair = typename TablePair<tableId>::Type;
+
+    TPair* pairBuffer;
     if      constexpr ( tableId == TableId::Table2 ) pairBuffer = cx.t2LRBuffer;
     else if constexpr ( tableId == TableId::Table3 ) pairBuffer = cx.t3LRBuffer;
     else if constexpr ( tableId == TableId::Table4 ) pairBuffer = cx.t4LRBuffer;
@@ -352,14 +550,32 @@ uint64 MemPhase1::FpComputeTable( uint64 entryCount,
     else if constexpr ( tableId == TableId::Table6 ) pairBuffer = cx.t6LRBuffer;
     else if constexpr ( tableId == TableId::Table7 ) pairBuffer = cx.t7LRBuffer;
 
-    return FpComputeSingleTable<tableId>( entryCount, pairBuffer, yBuffer, metaBuffer );
+    // When compressing tables 2-6, the previous table is only compressed once its staging buffer is needed
+    if constexpr ( tableId > TableId::Table2 && tableId < TableId::Table7 )
+    {
+        if( cx.spill )
+            cx.spill->Evict( *cx.threadPool, pairBuffer );
+    }
+
+    const uint64 tableEntryCount = FpComputeSingleTable<tableId>( entryCount, pairBuffer, yBuffer, metaBuffer );
+    MetricsSetEntries( cx.metrics, (uint)tableId+1, tableEntryCount );
+
+    // Tables 2-6 won't be needed again until Phase 2,
+    // so move them out of the staging buffer, if we're spilling.
+    if constexpr ( tableId < TableId::Table7 )
+    {
+        if( cx.spill )
+            cx.spill->Spill( *cx.threadPool, tableId, pairBuffer, tableEntryCount );
+    }
+
+    return tableEntryCount;
 }
 
 //-----------------------------------------------------------
 template<TableId tableId>
 uint64 MemPhase1::FpComputeSingleTable(
     uint64 entryCount,
-    Pair*  pairBuffer,
+    typename TablePair<tableId>::Type* pairBuffer,
     ReadWriteBuffer<uint64>& yBuffer, 
     ReadWriteBuffer<uint64>& metaBuffer )
 {
@@ -369,6 +585,9 @@ uint64 MemPhase1::FpComputeSingleTable(
     MemPlotContext& cx  = _context;
     Log::Line( "Forward propagating to table %d...", (int)tableId+1 );
 
+    ProfileScope tableScope( cx.profiler, "table", (int)tableId+1 );
+    MetricsSetTable( cx.metrics, (uint)tableId+1 );
+
     // yBuffer.read amd metaBuffer.read should always point
     // to the y and meta values generated from the previous table, respectively
     // That is the values generated from the previous' tables fx(), but sorted.
@@ -378,27 +597,23 @@ uint64 MemPhase1::FpComputeSingleTable(
                                               // We can't use a metadata one as we need to keep
                                               // the temp pairs around for sorting (which require the meta buffers).
     
-    uint32* groupBoundaries = (uint32*)yBuffer.write;   // Temporarily use this buffer to store group boundaries
-
     if constexpr ( tableId == TableId::Table7 )
     {
         // Write y buffer to table 7's f7 buffer
         yBuffer.write = (uint64*)cx.t7YBuffer;
+
+        // Only the y buffer table 6 was sorted into is planned to be alive at table 7
+        ASSERT( yBuffer.read == ( cx.packedFxSort && !cx.bucketedFp ? cx.yBuffer1 : cx.yBuffer0 ) );
     }
 
     auto tableTimer = TimerBegin();
 
     uint64 pairCount;
     {
-        kBCJob jobs[MAX_THREADS];
-
-        // Scan for kBC groups
-        const uint64 groupCount = FpScan( entryCount, yBuffer.read, groupBoundaries, jobs );
-        
-        // Generate L/R pairs from kBC groups (writes to unsorted pair buffer)
+        // Scan for kBC groups and generate L/R pairs from them (writes to unsorted pair buffer)
         Pair* tmpPairBuffer = (Pair*)metaBuffer.write;
 
-        pairCount = FpPair( yBuffer.read, jobs, groupCount, tmpPairBuffer, unsortedPairBuffer );
+        pairCount = FpPair( entryCount, yBuffer.read, tmpPairBuffer, unsortedPairBuffer );
     }
 
     // Compute fx values for this new table
@@ -411,16 +626,35 @@ uint64 MemPhase1::FpComputeSingleTable(
         ASSERT( metaBuffer.read == cx.metaBuffer0 );
     }
 
-    FpComputeFx<tableId, TMetaIn, TMetaOut>( 
+    // When sorting in buckets, each Fx chunk is distributed in buckets as soon as it is computed.
+    // The chunks are staged in the final pair buffer, which is not written until the sort.
+    // The start of each chunk's buckets is kept in table 7's y buffer, followed by the bucket sort's scratch.
+    const uint64 fxChunkBucketsSize = (uint64)cx.threadPool->ThreadCount() * BB_CHUNKS_PER_THREAD * FX_CHUNK_BUCKET_STRIDE;
+
+    uint32* fxChunkBuckets = nullptr;
+    if( tableId != TableId::Table7 && cx.bucketedFp )
+    {
+        fxChunkBuckets = cx.t7YBuffer;
+
+        // The pair buffer may still hold the previous plot's tables
+        if( cx.p4WriteBuffer )
+        {
+            Log::Line( " Waiting for last plot to finish being written to disk..." );
+            WaitForPreviousPlotWriter();
+        }
+    }
+
+    const uint64 fxChunkSize = FpComputeFx<tableId, TMetaIn, TMetaOut>( 
         pairCount, unsortedPairBuffer, 
         (TMetaIn*)inMetaBuffer, yBuffer.read,
-        (TMetaOut*)metaBuffer.write, yBuffer.write );
+        (TMetaOut*)metaBuffer.write, yBuffer.write,
+        fxChunkBuckets, (byte*)pairBuffer, ENTRIES_PER_TABLE * sizeof( *pairBuffer ) );
 
     // DbgVerifyPairsKBCGroups( pairCount, yBuffer.read, unsortedPairBuffer );
 
     // If a previous plot was being written to disk, we need to ensure
-    // it finished as we are about to use meta0 which is used to write the
-    // last buffers written to disk.
+    // it finished as we are about to use meta0 and table 2's pair buffer,
+    // which the buffers it's written from may share memory with.
     if( cx.p4WriteBuffer )
     {
         Log::Line( " Waiting for last plot to finish being written to disk..." );
@@ -437,29 +671,70 @@ uint64 MemPhase1::FpComputeSingleTable(
         Log::Line( "  Sorting entries..." );
         auto timer = TimerBegin();
 
-        // Use table 7's buffers as a temporary buffer
-        uint32* sortKey    = cx.t7YBuffer;
-        uint32* sortKeyTmp = (uint32*)( metaBuffer.write + ENTRIES_PER_TABLE ); // Use the output metabuffer for now as 
-                                                                                // the temporary sortkey buffer.
-        SortFx<MAX_THREADS>(
-            *cx.threadPool,        pairCount,
-            (uint64*)yBuffer.read, yBuffer.write,
-            sortKeyTmp,            sortKey
-        );
-        yBuffer.Swap();
+        if( fxChunkBuckets )
+        {
+            ProfileScope scope( cx.profiler, "sort" );
+
+            SortFxBucketed<TMetaOut, MAX_THREADS>(
+                *cx.threadPool,     pairCount,
+                fxChunkSize,        fxChunkBuckets,
+                yBuffer.read,       (TMetaOut*)metaBuffer.read,  unsortedPairBuffer,
+                yBuffer.write,      (TMetaOut*)metaBuffer.write, pairBuffer,   // Write to the final pair buffer
+                cx.t7YBuffer + fxChunkBucketsSize, ENTRIES_PER_TABLE - fxChunkBucketsSize
+            );
+
+            // Use the sorted buffers as the read buffers for the next table
+            yBuffer   .Swap();
+            metaBuffer.Swap();
+        }
+        else
+        {
+            // Use table 7's buffers as a temporary buffer
+            uint32* sortKey = cx.t7YBuffer;
+
+            ProfileScope sortScope( cx.profiler, "sort" );
+
+            if( cx.packedFxSort )
+            {
+                // Sorted in place, so there's no need to swap the y buffers
+                SortFxPacked(
+                    *cx.threadPool,        pairCount,
+                    (uint64*)yBuffer.read, yBuffer.write,
+                    sortKey,
+                    cx.numa
+                );
+            }
+            else
+            {
+                uint32* sortKeyTmp = (uint32*)( metaBuffer.write + ENTRIES_PER_TABLE ); // Use the output metabuffer for now as 
+                                                                                        // the temporary sortkey buffer.
+                SortFx<MAX_THREADS>(
+                    *cx.threadPool,        pairCount,
+                    (uint64*)yBuffer.read, yBuffer.write,
+                    sortKeyTmp,            sortKey,
+                    cx.numa
+                );
+                yBuffer.Swap();
+            }
 
-        // DbgVerifyPairsKBCGroups( pairCount, yBuffer.write, unsortedPairBuffer );
+            // DbgVerifyPairsKBCGroups( pairCount, yBuffer.write, unsortedPairBuffer );
 
-        MapFxWithSortKey<TMetaOut, MAX_THREADS>(
-            *cx.threadPool, pairCount, sortKey,
-            (TMetaOut*)metaBuffer.read, (TMetaOut*)metaBuffer.write,
-            unsortedPairBuffer,         pairBuffer   // Write to the final pair buffer
-        );
+            {
+                ProfileScope scope( cx.profiler, "map" );
+
+                MapFxWithSortKey<TMetaOut, MAX_THREADS>(
+                    *cx.threadPool, pairCount, sortKey,
+                    (TMetaOut*)metaBuffer.read, (TMetaOut*)metaBuffer.write,
+                    unsortedPairBuffer,         pairBuffer,  // Write to the final pair buffer
+                    cx.blockedMap
+                );
+            }
 
-        // DbgVerifyPairsKBCGroups( pairCount, yBuffer.write, pairBuffer );
+            // DbgVerifyPairsKBCGroups( pairCount, yBuffer.write, pairBuffer );
 
-        // Use the sorted metabuffer as the read buffer for the next table
-        metaBuffer.Swap();
+            // Use the sorted metabuffer as the read buffer for the next table
+            metaBuffer.Swap();
+        }
 
         double elapsed = TimerEnd( timer );
         Log::Line( "  Finished sorting in %.2lf seconds.", elapsed );
@@ -518,7 +793,7 @@ void F1JobThread( F1GenJob* job )
     // chacha output is treated as big endian, therefore swap, as required by chiapos
     for( uint64 i = 0; i < entryCount; i++ )
     {
-        const uint64 y = Swap32( blocks[i] );
+        const uint64 y = GetF1Value( blocks, i );
         yBuffer[i] = ( y << kExtraBits ) | ( (x+i) >> (_K - kExtraBits) );
     }
 
@@ -528,6 +803,52 @@ void F1JobThread( F1GenJob* job )
         xBuffer[i] = (uint32)( x + i );
 }
 
+//-----------------------------------------------------------
+void F1BucketCountThread( F1BucketJob* job )
+{
+    const uint32 entryCount = job->entryCount;
+    const uint64 x          = job->x;
+
+    const uint32* blocks = (uint32*)job->blocks;
+    uint32*       counts = job->counts;
+
+    const uint64 blockIdx = x * _K / kF1BlockSizeBits;
+
+    chacha8_ctx chacha;
+    ZeroMem( &chacha );
+
+    chacha8_keysetup( &chacha, job->key, 256, NULL );
+    chacha8_get_keystream( &chacha, blockIdx, job->blockCount, (byte*)blocks );
+
+    memset( counts, 0, sizeof( job->counts ) );
+
+    for( uint64 i = 0; i < entryCount; i++ )
+    {
+        const uint64 y = ( GetF1Value( blocks, i ) << kExtraBits ) | ( (x+i) >> (_K - kExtraBits) );
+        counts[y >> 32]++;
+    }
+}
+
+//-----------------------------------------------------------
+void F1BucketScatterThread( F1BucketJob* job )
+{
+    const uint32 entryCount = job->entryCount;
+    const uint64 x          = job->x;
+
+    const uint32* blocks  = (uint32*)job->blocks;
+    uint64*       offsets = job->offsets;
+    uint32*       yBuffer = job->yBuffer;
+    uint32*       xBuffer = job->xBuffer;
+
+    for( uint64 i = 0; i < entryCount; i++ )
+    {
+        const uint64 y   = ( GetF1Value( blocks, i ) << kExtraBits ) | ( (x+i) >> (_K - kExtraBits) );
+        const uint64 dst = offsets[y >> 32]++;
+
+        yBuffer[dst] = (uint32)y;
+        xBuffer[dst] = (uint32)( x + i );
+    }
+}
 
 //-----------------------------------------------------------
 // void F1NumaJobThread( F1GenJob* job )
@@ -643,348 +964,256 @@ void F1JobThread( F1GenJob* job )
 /// kBC groups & matching
 ///
 
+// Scans kBC groups and creates pairs from adjacent groups in a single pass
 //-----------------------------------------------------------
-uint64 MemPhase1::FpScan( const uint64 entryCount, const uint64* yBuffer, uint32* groupBoundaries, kBCJob jobs[MAX_THREADS] )
+uint64 MemPhase1::FpPair( const uint64 entryCount, const uint64* yBuffer, Pair* tmpPairBuffer, Pair* outPairBuffer )
 {
-    MemPlotContext& cx  = _context;
-    const uint32 threadCount        = cx.threadCount;
-    const uint64 maxKBCGroups       = cx.maxKBCGroups;
-    const uint64 maxGroupsPerThread = maxKBCGroups / threadCount;
-    
-    uint64 groupCount = 0;
-
-    // auto timer = TimerBegin();
-    // Log::Line( "  Scanning kBC groups..." );
+    MemPlotContext& cx = _context;
 
-    jobs[0].groupBoundaries = groupBoundaries;
-    jobs[0].maxCount        = maxGroupsPerThread;
-    jobs[0].yBuffer         = yBuffer;
-    jobs[0].startIndex      = 0;
-    jobs[0].endIndex        = entryCount;
+    const uint32 threadCount = cx.threadPolicy->Begin( PlotKernel::FxPair );
 
-    #if DEBUG
-        jobs[0].jobIdx = 0;
-    #endif
+    uint64 pairCount = 0;
 
-    // Find a starting position for each thread
-    for( uint64 i = 1; i < threadCount; i++ )
-    {
-        auto& job = jobs[i];
+    Log::Line( "  Pairing L/R groups..." );
+    auto timer = TimerBegin();
+    ProfileScope scope( cx.profiler, "pair" );
 
-        job.yBuffer    = yBuffer;
-        job.groupCount = 0;
-        job.copyDst    = nullptr;
+    const uint64 maxTotalpairs     = cx.maxPairs;
+    const uint64 maxPairsPerThread = maxTotalpairs / threadCount;
 
-        const uint64 idx      = entryCount / threadCount * i;
-        const uint64 y        = yBuffer[idx];
-        const uint64 curGroup = y / kBC;
+    // The entries are split in chunks starting at group boundaries, which are
+    // scheduled dynamically, as pair density varies accross the table.
+    // Each chunk pairs the L groups that start in it. The last one is paired
+    // with the next chunk's first group, which both chunks read.
+    const uint chunkCount = threadCount * BB_CHUNKS_PER_THREAD;
 
-        const uint32 groupLocalIdx = (uint32)(y - curGroup * kBC);
+    std::vector<uint64> chunkStarts    ( chunkCount + 1 );
+    std::vector<Pair*>  chunkPairs     ( chunkCount );
+    std::vector<uint64> chunkPairCounts( chunkCount );
+    std::vector<uint64> chunkOffsets   ( chunkCount );
 
-        uint64 targetGroup;
+    chunkStarts[0] = 0;
 
-        // If we are already at the start of a group, just use this index
-        if( groupLocalIdx == 0 )
-        {
-            job.startIndex = idx;
-        }
-        else
-        {
-            // Choose if we should find the upper boundary or the lower boundary
-            const uint32 remainder = kBC - groupLocalIdx;
-            
-            #if _DEBUG
-                bool foundBoundary = false;
-            #endif
-            if( remainder <= kBC / 2 )
-            {
-                // Look for the upper boundary
-                for( uint64 j = idx+1; j < entryCount; j++ )
-                {
-                    targetGroup = yBuffer[j] / kBC;
-                    if( targetGroup != curGroup )
-                    {
-                        #if _DEBUG
-                            foundBoundary = true;
-                        #endif
-                        job.startIndex = j; break;
-                    }   
-                }
-            }
-            else
-            {
-                // Look for the lower boundary
-                for( uint64 j = idx-1; j >= 0; j-- )
-                {
-                    targetGroup = yBuffer[j] / kBC;
-                    if( targetGroup != curGroup )
-                    {
-                        #if _DEBUG
-                            foundBoundary = true;
-                        #endif
-                        job.startIndex = j+1; break;
-                    }  
-                }
-            }
+    for( uint i = 1; i < chunkCount; i++ )
+    {
+        chunkStarts[i] = FpFindGroupStart( yBuffer, entryCount, entryCount / chunkCount * i );
 
-            ASSERT( foundBoundary );
-        }
+        ASSERT( chunkStarts[i] > chunkStarts[i-1] );
+        ASSERT( yBuffer[chunkStarts[i]-1] / kBC != yBuffer[chunkStarts[i]] / kBC );
+    }
 
-        auto& lastJob = jobs[i-1];
+    chunkStarts[chunkCount] = entryCount;
 
-        ASSERT( job.startIndex > lastJob.startIndex );
+    // Chunks not taken by any thread keep this count
+    for( uint i = 0; i < chunkCount; i++ )
+        chunkPairCounts[i] = std::numeric_limits<uint64>::max();
 
-        lastJob.endIndex = job.startIndex+1;    // We must let it compare with
-                                                // the start of this group so that 
-                                                // the last job actually adds its last group.
-                                                // #NOTE: We add +1 so that the next group boundary is added to the list,
-                                                //        and we can tell where the R group ends.
+    ChunkScheduler scheduler;
+    scheduler.Init( chunkCount, threadCount );
 
-        ASSERT( yBuffer[job.startIndex-1] / kBC != yBuffer[job.startIndex] / kBC );
+    std::vector<kBCJob> jobs( threadCount );
 
-        job.groupBoundaries = groupBoundaries + maxGroupsPerThread * i;
-        job.maxCount        = maxGroupsPerThread;
+    for( uint32 i = 0; i < threadCount; i++ )
+    {
+        auto& job = jobs[i];
 
-        
-        #if DEBUG
-            job.jobIdx = (uint32)i;
-        #endif
+        job.yBuffer         = yBuffer;
+        job.entryCount      = entryCount;
+        job.pairs           = tmpPairBuffer + i * maxPairsPerThread;
+        job.maxCount        = maxPairsPerThread;
+        job.groupCount      = 0;
+        job.pairCount       = 0;
+        job.copyDst         = outPairBuffer;
+        job.scheduler       = &scheduler;
+        job.threadId        = i;
+        job.chunkStarts     = chunkStarts    .data();
+        job.chunkPairs      = chunkPairs     .data();
+        job.chunkPairCounts = chunkPairCounts.data();
+        job.chunkOffsets    = chunkOffsets   .data();
     }
 
-    // Fill in missing data for the last job
-    jobs[threadCount-1].endIndex = entryCount;
+    cx.threadPool->RunJob( FpPairThread, jobs.data(), threadCount );
 
-    // Run jobs
-    cx.threadPool->RunJob( FpScanThread, jobs, threadCount );
+    // Count the total pairs and place each chunk's pairs
+    // in chunk order in the actual destination pair buffer.
+    uint64 groupCount = 0;
 
-    // Determine group count
-    groupCount = 0;
+    for( uint32 i = 0; i < threadCount; i++ )
+        groupCount += jobs[i].groupCount;
 
-    for( uint32 i = 0; i < threadCount-1; i++ )
+    for( uint i = 0; i < chunkCount; i++ )
     {
-        auto& job = jobs[i];
+        FatalIf( chunkPairCounts[i] == std::numeric_limits<uint64>::max(),
+            "Ran out of space for kBC pairs." );
 
-        // Add a trailing end index so that we can test against it
-        job.groupBoundaries[job.groupCount] = jobs[i+1].groupBoundaries[0];
-        
-        groupCount += job.groupCount;
+        chunkOffsets[i] = pairCount;
+        pairCount      += chunkPairCounts[i];
     }
-    groupCount += jobs[threadCount-1].groupCount;
-        
-    // Let the last job know where its R group
-    auto& lastJob = jobs[threadCount-1];
-
-    // This is an overflow if the last group ends @ k^32, if so,
-    // then have it end just before that.
-    if( entryCount == ENTRIES_PER_TABLE )
-        lastJob.groupBoundaries[lastJob.groupCount] = (uint32)(entryCount-1);
-    else
-        lastJob.groupBoundaries[lastJob.groupCount] = (uint32)entryCount;
-
-    // double elapsed = TimerEnd( timer );
-    // Log::Line( "  Finished scanning kBC groups in %.2lf seconds.", elapsed );
-    // Log::Line( "  Found %llu kBC groups.", groupCount );
+    ASSERT( pairCount > 0 );
 
-    #if DBG_VALIDATE_KB_GROUPS
+    // Sometimes we get more pairs than we support, so cap it.
+    if( pairCount > ENTRIES_PER_TABLE )
     {
-        uint64 prevGroup = yBuffer[jobs[0].startIndex] / kBC;
+        uint64 overflowEntries = pairCount - ENTRIES_PER_TABLE;
 
-        for( uint32 t = 0; t < threadCount; t++ )
+        for( uint i = chunkCount; overflowEntries; i-- )
         {
-            const auto& job = jobs[t];
+            const uint64 dropped = std::min( overflowEntries, chunkPairCounts[i-1] );
+            
+            chunkPairCounts[i-1] -= dropped;
+            overflowEntries      -= dropped;
+        }
+       
+        pairCount = ENTRIES_PER_TABLE;
+    }
 
-            // Ensure groups are ordered
-            for( uint64 i = 0; i < job.groupCount; i++ )
-            {
-                const uint64 rIdx  = job.groupBoundaries[i];
-                const uint64 group = yBuffer[rIdx] / kBC;
+    scheduler.Init( chunkCount, threadCount );
 
-                if( group <= prevGroup )
-                {
-                    // ASSERT( group > prevGroup );
-                    ASSERT( 0 );
-                    Fatal( "Invalid group sequence. Job: %u Idx: %llu, Ridx: %llu, Group: %llu", t, i, rIdx, group );
-                }
-                prevGroup = group;
-            }
+    cx.threadPool->RunJob( (JobFunc)[]( void* pdata ) {
 
-            // Make sure all entries do belong to the same group
-            uint64 groupStartL = job.startIndex;
-            for( uint64 i = 0; i < job.groupCount; i++ )
-            {
-                const uint64 groupStartR = job.groupBoundaries[i];
+        auto* job = (kBCJob*)pdata;
+        Pair* dst = job->copyDst;
 
-                const uint64 groupL = yBuffer[groupStartL] / kBC;
-                const uint64 groupR = yBuffer[groupStartR] / kBC;
+        uint chunk;
+        while( job->scheduler->Next( job->threadId, chunk ) )
+            memcpy( dst + job->chunkOffsets[chunk], job->chunkPairs[chunk], job->chunkPairCounts[chunk] * sizeof( Pair ) );
 
-                const uint64 groupDiff = groupR - groupL;
-                if( groupDiff == 1 )
-                {
-                    for( uint64 j = groupStartL; j < groupStartR; j++ )
-                    {
-                        const uint64 group = yBuffer[j] / kBC;
-                        if( group != groupL )
-                        {
-                            ASSERT( 0 );
-                            Fatal( "Group validation failed @ job %llu index: %llu. L: %llu R: %llu", i, j, groupL, group );
-                        }
-                        ASSERT( group == groupL );
-                    }
-                }
+    }, jobs.data(), threadCount, sizeof( kBCJob ) );
 
-                groupStartL = groupStartR;
-            }
-        }
+    cx.threadPolicy->End( PlotKernel::FxPair, threadCount, entryCount );
 
-    }
-    #endif
+    auto elapsed = TimerEnd( timer );
+    Log::Line( "  Finished pairing L/R groups in %.4lf seconds. Created %llu pairs.", elapsed, pairCount );
+    Log::Line( "  Average of %.4lf pairs per group.", pairCount / (float64)groupCount );
 
-    return groupCount;
-}
+    ASSERT( pairCount <= ENTRIES_PER_TABLE );
 
+    #if DBG_TEST_PAIRS
+        DbgTestPairs( pairCount, outPairBuffer, yBuffer );
+    #endif
+
+    return pairCount;
+}
+
+// Returns the start of the group closest to the entry at idx
 //-----------------------------------------------------------
-void FpScanThread( kBCJob* job )
+uint64 FpFindGroupStart( const uint64* yBuffer, const uint64 entryCount, const uint64 idx )
 {
-    const uint64 maxGroups  = job->maxCount;
+    const uint64 y        = yBuffer[idx];
+    const uint64 curGroup = y / kBC;
 
-    uint32* groupBoundaries = job->groupBoundaries;
-    uint64  groupCount      = 0;
+    const uint32 groupLocalIdx = (uint32)(y - curGroup * kBC);
 
-    const uint64* yBuffer = job->yBuffer;
-    const uint64  start   = job->startIndex;
-    const uint64  end     = job->endIndex;
+    // If we are already at the start of a group, just use this index
+    if( groupLocalIdx == 0 )
+        return idx;
 
-    uint64 lastGroup = yBuffer[start] / kBC;
-
-    for( uint64 i = start+1; i < end; i++ )
+    // Choose if we should find the upper boundary or the lower boundary
+    const uint32 remainder = kBC - groupLocalIdx;
+    
+    if( remainder <= kBC / 2 )
     {
-        uint64 group = yBuffer[i] / kBC;
-        if( group != lastGroup )
+        // Look for the upper boundary
+        for( uint64 j = idx+1; j < entryCount; j++ )
         {
-            ASSERT( group > lastGroup );
-
-            groupBoundaries[groupCount++] = (uint32)i;
-            lastGroup = group;
-
-            if( groupCount == maxGroups )
-            {
-                ASSERT( 0 );    // We ought to always have enough space
-                                // So this should be an error
-                break;
-            }
+            if( yBuffer[j] / kBC != curGroup )
+                return j;
+        }
+    }
+    else
+    {
+        // Look for the lower boundary
+        for( uint64 j = idx; j > 0; j-- )
+        {
+            if( yBuffer[j-1] / kBC != curGroup )
+                return j;
         }
     }
 
-    job->groupCount = groupCount;
+    ASSERT( 0 );
+    Fatal( "Failed to find a kBC group boundary." );
+    return 0;
 }
 
-// Create pairs from y values
+// Returns the index one past the last entry of the group starting at groupStart
 //-----------------------------------------------------------
-uint64 MemPhase1::FpPair( const uint64* yBuffer, kBCJob jobs[MAX_THREADS],
-                          const uint64 groupCount, Pair* tmpPairBuffer, Pair* outPairBuffer )
+static inline FORCE_INLINE uint64 FpFindGroupEnd( const uint64* yBuffer, uint64 groupStart, const uint64 group, const uint64 entryCount )
 {
-    MemPlotContext& cx = _context;
-
-    const uint32 threadCount = cx.threadCount;
-
-    uint64 pairCount = 0;
-
-    Log::Line( "  Pairing L/R groups..." );
-    auto timer = TimerBegin();
-
-    const uint64 maxTotalpairs     = cx.maxPairs;
-    const uint64 maxPairsPerThread = maxTotalpairs / threadCount;
-
-    for( uint32 i = 0; i < threadCount; i++ )
-    {
-        auto& job = jobs[i];
-
-        job.pairs     = tmpPairBuffer + i * maxPairsPerThread;
-        job.maxCount  = maxPairsPerThread;
-        job.pairCount = 0;
-        job.copyDst   = nullptr;
+    uint64 i = groupStart + 1;
+    while( i < entryCount && yBuffer[i] / kBC == group )
+        i++;
 
-        // Test
-        // job.groupBoundariesIdx = i * groupsPerThread;
-        // job.jobIdx          = (uint32)i;
-    }
+    return i;
+}
 
-    cx.threadPool->RunJob( FpPairThread, jobs, threadCount );
+//-----------------------------------------------------------
+void FpPairThread( kBCJob* job )
+{
+    const uint64  maxPairs   = job->maxCount;
+    const uint64* yBuffer    = job->yBuffer;
+    const uint64  entryCount = job->entryCount;
 
-    // Count the total pairs and copy the pair buffers
-    // to the actual destination pair buffer.
-    pairCount = jobs[0].pairCount;
-    jobs[0].copyDst = outPairBuffer;
-    ASSERT( pairCount > 0 );
+    Pair*  pairs      = job->pairs;
+    uint64 pairCount  = 0;
+    uint64 groupCount = 0;
 
-    for( uint32 i = 1; i < threadCount; i++ )
+    uint chunk;
+    while( job->scheduler->Next( job->threadId, chunk ) )
     {
-        auto& job = jobs[i];
-        ASSERT( job.pairCount > 0 );
+        const uint64 start = job->chunkStarts[chunk];
+        const uint64 end   = job->chunkStarts[chunk+1];
 
-        job.copyDst = outPairBuffer + pairCount;
-        pairCount += job.pairCount;
-    }
+        const uint64 chunkPairCount = FpPairChunk( yBuffer, entryCount, start, end,
+                                                   pairs + pairCount, maxPairs - pairCount, groupCount );
 
-    // Sometimes we get more pairs than we support, so cap it.
-    if( pairCount > ENTRIES_PER_TABLE )
-    {
-        const uint64 overflowEntries = pairCount - ENTRIES_PER_TABLE;
+        job->chunkPairs     [chunk] = pairs + pairCount;
+        job->chunkPairCounts[chunk] = chunkPairCount;
+        pairCount += chunkPairCount;
 
-        auto& lastJob = jobs[threadCount-1];
-        ASSERT( lastJob.pairCount >= overflowEntries );
-        lastJob.pairCount -= overflowEntries;
-       
-        pairCount = ENTRIES_PER_TABLE;
+        // Leave the remaining chunks to other threads
+        // once we may not have enough space for another one.
+        if( maxPairs - pairCount < ( end - start ) * 2 )
+            break;
     }
 
-    cx.threadPool->RunJob( (JobFunc)[]( void* pdata ) {
-
-        auto* job = (kBCJob*)pdata;
-        memcpy( job->copyDst, job->pairs, job->pairCount * sizeof( Pair ) );
-
-    }, jobs, threadCount, sizeof( kBCJob ) );
-
-    auto elapsed = TimerEnd( timer );
-    Log::Line( "  Finished pairing L/R groups in %.4lf seconds. Created %llu pairs.", elapsed, pairCount );
-    Log::Line( "  Average of %.4lf pairs per group.", pairCount / (float64)groupCount );
-
-    ASSERT( pairCount <= ENTRIES_PER_TABLE );
-
-    #if DBG_TEST_PAIRS
-        DbgTestPairs( pairCount, outPairBuffer, yBuffer );
-    #endif
-
-    return pairCount;
+    job->groupCount = groupCount;
+    job->pairCount  = pairCount;
 }
 
+// Pairs the L groups starting in [start, end).
+// Returns the number of pairs written.
 //-----------------------------------------------------------
-void FpPairThread( kBCJob* job )
+uint64 FpPairChunk( const uint64* yBuffer, const uint64 entryCount, const uint64 start, const uint64 end,
+                    Pair* pairs, const uint64 maxPairs, uint64& groupCount )
 {
-    const uint64  maxPairs        = job->maxCount;
-    const uint32  groupCount      = (uint32)job->groupCount;
-    const uint32* groupBoundaries = job->groupBoundaries;
-    const uint64* yBuffer         = job->yBuffer;
-
-    Pair*  pairs     = job->pairs;
     uint64 pairCount = 0;
 
+    // Bitmap of the local y values present in the R group. Their count
+    // and first index are only valid for y values present in the bitmap.
+    uint64 rMap       [KBC_MAP_WORDS];
     uint8  rMapCounts [kBC];
     uint16 rMapIndices[kBC];
+    uint64 matchMasks [KBC_MATCH_BATCH];
 
-    uint64 groupLStart = job->startIndex;
+    uint64 groupLStart = start;
     uint64 groupL      = yBuffer[groupLStart] / kBC;
+    uint64 groupLEnd   = FpFindGroupEnd( yBuffer, groupLStart, groupL, entryCount );
 
-    for( uint32 i = 0; i < groupCount; i++ )
+    // Group boundaries are found as we go, so each group is only
+    // streamed in from memory once, then paired while still in cache.
+    while( groupLStart < end && groupLEnd < entryCount )
     {
-        const uint64 groupRStart = groupBoundaries[i];
+        const uint64 groupRStart = groupLEnd;
         const uint64 groupR      = yBuffer[groupRStart] / kBC;
+        const uint64 groupREnd   = FpFindGroupEnd( yBuffer, groupRStart, groupR, entryCount );
+
+        ASSERT( groupR > groupL );
+        groupCount++;
 
         if( groupR - groupL == 1 )
         {
             // Groups are adjacent, calculate matches
-            const uint16 parity           = groupL & 1;
-            const uint64 groupREnd        = groupBoundaries[i+1];
+            const uint32 parity           = groupL & 1;
 
             const uint64 groupLRangeStart = groupL * kBC;
             const uint64 groupRRangeStart = groupR * kBC;
@@ -993,48 +1222,57 @@ void FpPairThread( kBCJob* job )
             ASSERT( groupLRangeStart == groupRRangeStart - kBC );
 
             // Prepare a map of range kBC to store which indices from groupR are used
-            // For now just iterate our bGroup to find the pairs
-           
-            // #NOTE: memset(0) works faster on average than keeping a separate a clearing buffer
-            memset( rMapCounts, 0, sizeof( rMapCounts ) );
+            memset( rMap, 0, sizeof( rMap ) );
 
             for( uint64 iR = groupRStart; iR < groupREnd; iR++ )
             {
-                uint64 localRY = yBuffer[iR] - groupRRangeStart;
+                const uint32 localRY = (uint32)( yBuffer[iR] - groupRRangeStart );
                 ASSERT( yBuffer[iR] / kBC == groupR );
 
-                if( rMapCounts[localRY] == 0 )
+                if( !BitFieldGet( rMap, localRY ) )
+                {
+                    BitFieldSet( rMap, localRY );
                     rMapIndices[localRY] = (uint16)( iR - groupRStart );
+                    rMapCounts [localRY] = 0;
+                }
 
                 rMapCounts[localRY] ++;
             }
 
-            // For each group L entry
-            for( uint64 iL = groupLStart; iL < groupRStart; iL++ )
+            // Test all kExtraBitsPow targets of a batch of group L entries at a time
+            for( uint64 batchStart = groupLStart; batchStart < groupRStart; batchStart += KBC_MATCH_BATCH )
             {
-                const uint64 yL     = yBuffer[iL];
-                const uint64 localL = yL - groupLRangeStart;
+                const uint32 batchCount = (uint32)std::min( (uint64)KBC_MATCH_BATCH, groupRStart - batchStart );
+
+                MatchKBCGroup( yBuffer + batchStart, batchCount, groupLRangeStart, parity, rMap, matchMasks );
 
-                // Iterate kExtraBitsPow = 1 << kExtraBits = 1 << 6 == 64
-                // So iterate 64 times for each L entry.
-                for( int iK = 0; iK < kExtraBitsPow; iK++ )
+                for( uint32 b = 0; b < batchCount; b++ )
                 {
-                    const uint64 targetR = L_targets[parity][localL][iK];
+                    const uint64 iL     = batchStart + b;
+                    const uint32 localL = (uint32)( yBuffer[iL] - groupLRangeStart );
 
-                    for( uint j = 0; j < rMapCounts[targetR]; j++ )
+                    // Emit matches in target order
+                    for( uint64 mask = matchMasks[b]; mask; mask &= mask - 1 )
                     {
-                        const uint64 iR = groupRStart + rMapIndices[targetR] + j;
-
-                        ASSERT( iL < iR );
-
-                        // Add a new pair
-                        Pair& pair = pairs[pairCount++];
-                        pair.left  = (uint32)iL;
-                        pair.right = (uint32)iR;
-                        
-                        ASSERT( pairCount <= maxPairs );
-                        if( pairCount == maxPairs )
-                            goto RETURN;
+                        const uint32 m       = Ctz64( mask );
+                        const uint32 targetR = KBCMatchTarget( localL, parity, m );
+                        ASSERT( targetR == L_targets[parity][localL][m] );
+
+                        for( uint j = 0; j < rMapCounts[targetR]; j++ )
+                        {
+                            const uint64 iR = groupRStart + rMapIndices[targetR] + j;
+
+                            ASSERT( iL < iR );
+
+                            // Add a new pair
+                            Pair& pair = pairs[pairCount++];
+                            pair.left  = (uint32)iL;
+                            pair.right = (uint32)iR;
+                            
+                            ASSERT( pairCount <= maxPairs );
+                            if( pairCount == maxPairs )
+                                return pairCount;
+                        }
                     }
                 }
             }
@@ -1044,19 +1282,20 @@ void FpPairThread( kBCJob* job )
         // Go to next group
         groupL      = groupR;
         groupLStart = groupRStart;
+        groupLEnd   = groupREnd;
     }
 
-RETURN:
-    job->pairCount = pairCount;
+    return pairCount;
 }
 
 ///
 /// Fx Computation
 ///
 template<TableId tableId, typename TMetaIn, typename TMetaOut>
-void MemPhase1::FpComputeFx( const uint64 entryCount, const Pair* lrPairs,
-                             const TMetaIn* inMetaBuffer, const uint64* inYBuffer,
-                             TMetaOut* outMetaBuffer, uint64* outYBuffer )
+uint64 MemPhase1::FpComputeFx( const uint64 entryCount, const Pair* lrPairs,
+                               const TMetaIn* inMetaBuffer, const uint64* inYBuffer,
+                               TMetaOut* outMetaBuffer, uint64* outYBuffer,
+                               uint32* chunkBuckets, byte* bucketTmp, size_t bucketTmpSize )
 {
     using TYOut = typename YOut<tableId>::Type;
 
@@ -1065,44 +1304,220 @@ void MemPhase1::FpComputeFx( const uint64 entryCount, const Pair* lrPairs,
 
     Log::Line( "  Computing Fx..." );
     auto timer = TimerBegin();
+    ProfileScope scope( cx.profiler, "fx" );
     
-    const uint   threadCount     = cx.threadCount;
-    const uint64 entriesPerThred = entryCount / threadCount;
-    const uint64 trailingEntries = entryCount - (entriesPerThred * threadCount);
+    const uint threadCount = cx.threadPolicy->Begin( PlotKernel::ComputeFx );
+    ASSERT( entryCount );
+
+    // Entries are scheduled in chunks of whole hash batches
+    const uint64 chunkSize  = RoundUpToNextBoundary( CDiv( entryCount, (int)( threadCount * BB_CHUNKS_PER_THREAD ) ), BLAKE3_LANES );
+    const uint   chunkCount = (uint)CDiv( entryCount, (int)chunkSize );
+
+    ChunkScheduler scheduler;
+    scheduler.Init( chunkCount, threadCount );
+
+    // Each thread stages the y, metadata and pairs of the chunk it is distributing in buckets
+    const uint64 bucketTmpStride = chunkSize * ( sizeof( uint64 ) + sizeof( TMetaOut ) + sizeof( Pair ) );
+    if( chunkBuckets )
+        FatalIf( bucketTmpStride * threadCount > bucketTmpSize, "Insufficient space to stage Fx chunks." );
 
     // Table 7 needs 32-bit y outputs, so we have to change it here
     TYOut* tYOut = (TYOut*)outYBuffer;
 
     using Job = FpFxJob<TYOut, TMetaIn, TMetaOut>;
-    Job jobs[MAX_THREADS];
+    std::vector<Job> jobs( threadCount );
 
     for( uint i = 0; i < threadCount; i++ )
     {
         Job& job = jobs[i];
 
-        const size_t offset = entriesPerThred * i;
-
-        job.entryCount    = entriesPerThred;
+        job.entryCount    = entryCount;
+        job.chunkSize     = chunkSize;
         job.inMetaBuffer  = inMetaBuffer;             // These should NOT be offseted as we 
         job.inYBuffer     = inYBuffer;                // use them as lookup tables based on the lrPairs
-        job.lrPairs       = lrPairs       + offset;
-        job.outMetaBuffer = outMetaBuffer + offset;
-        job.outYBuffer    = tYOut         + offset;
+        job.lrPairs       = lrPairs;
+        job.outMetaBuffer = outMetaBuffer;
+        job.outYBuffer    = tYOut;
+        job.chunkBuckets    = chunkBuckets;
+        job.bucketTmp       = bucketTmp;
+        job.bucketTmpStride = bucketTmpStride;
+        job.scheduler     = &scheduler;
+        job.threadId      = i;
+        job.firstChunk    = 0;
     }
 
-    // Add trailing entries to the last job
-    jobs[threadCount-1].entryCount += trailingEntries;
-
     // Calculate Fx
-    cx.threadPool->RunJob( ComputeFxJob<TYOut, TMetaIn, TMetaOut>, jobs, threadCount );
+    if( cx.gpu )
+    {
+        // Sort the chunks the device is done with in buckets, while it computes the rest of the table
+        uint bucketedChunks = 0;
+
+        cx.gpu->ComputeFx( tableId, entryCount, lrPairs, inYBuffer, inMetaBuffer, tYOut, outMetaBuffer,
+            [&]( const uint64 readyCount ) {
+
+            if( !chunkBuckets )
+                return;
+
+            const uint readyChunks = readyCount == entryCount ? chunkCount : (uint)( readyCount / chunkSize );
+            if( readyChunks == bucketedChunks )
+                return;
+
+            scheduler.Init( readyChunks - bucketedChunks, threadCount );
+
+            for( uint i = 0; i < threadCount; i++ )
+                jobs[i].firstChunk = bucketedChunks;
+
+            cx.threadPool->RunJob( BucketFxChunksJob<TYOut, TMetaIn, TMetaOut>, jobs.data(), threadCount );
+            bucketedChunks = readyChunks;
+        });
+    }
+    else
+        cx.threadPool->RunJob( ComputeFxJob<TYOut, TMetaIn, TMetaOut>, jobs.data(), threadCount );
+
+    cx.threadPolicy->End( PlotKernel::ComputeFx, threadCount, entryCount );
 
     auto elapsed = TimerEnd( timer );
     Log::Line( "  Finished computing Fx in %.4lf seconds.", elapsed );
+
+    return chunkSize;
 }
 
+//-----------------------------------------------------------
+uint64 MemPhase1::BenchPair( uint64 entryCount, const uint64* yBuffer, Pair* tmpPairBuffer, Pair* outPairBuffer )
+{
+    return FpPair( entryCount, yBuffer, tmpPairBuffer, outPairBuffer );
+}
+
+//-----------------------------------------------------------
+template<TableId tableId>
+void MemPhase1::BenchComputeFx( uint64 entryCount, const Pair* lrPairs, const uint64* inYBuffer, const void* inMetaBuffer,
+                                uint64* outYBuffer, void* outMetaBuffer )
+{
+    using TMetaIn  = typename TableMetaType<tableId>::MetaIn;
+    using TMetaOut = typename TableMetaType<tableId>::MetaOut;
+
+    FpComputeFx<tableId, TMetaIn, TMetaOut>( entryCount, lrPairs,
+        (const TMetaIn*)inMetaBuffer, inYBuffer,
+        (TMetaOut*)outMetaBuffer, outYBuffer );
+}
+
+#define BB_INSTANTIATE_BENCH_FX( table ) \
+    template void MemPhase1::BenchComputeFx<table>( uint64, const Pair*, const uint64*, const void*, uint64*, void* )
+
+BB_INSTANTIATE_BENCH_FX( TableId::Table2 );
+BB_INSTANTIATE_BENCH_FX( TableId::Table3 );
+BB_INSTANTIATE_BENCH_FX( TableId::Table4 );
+BB_INSTANTIATE_BENCH_FX( TableId::Table5 );
+BB_INSTANTIATE_BENCH_FX( TableId::Table6 );
+BB_INSTANTIATE_BENCH_FX( TableId::Table7 );
+
+#undef BB_INSTANTIATE_BENCH_FX
+
 //-----------------------------------------------------------
 template<typename TYOut, typename TMetaIn, typename TMetaOut>
 void ComputeFxJob( FpFxJob<TYOut, TMetaIn, TMetaOut>* job )
+{
+    uint chunk;
+    while( job->scheduler->Next( job->threadId, chunk ) )
+    {
+        uint64 start, end;
+        GetChunkRange( chunk, job->chunkSize, job->entryCount, start, end );
+
+        if constexpr( SizeForMeta<TMetaOut>::Value != 0 )
+        {
+            if( job->chunkBuckets )
+            {
+                ComputeFxBucketedChunk( job, chunk, start, end - start );
+                continue;
+            }
+        }
+
+        ComputeFxChunk( job, start, end - start, job->outYBuffer + start, job->outMetaBuffer + start, nullptr );
+    }
+}
+
+// Computes a chunk into this thread's staging buffer, and then
+// distributes it in buckets into the chunk's place in the output buffers.
+// This keeps the memory-bound distribution interleaved with the hashing,
+// instead of in a pass of its own that would leave the cores waiting on memory.
+//-----------------------------------------------------------
+template<typename TYOut, typename TMetaIn, typename TMetaOut>
+void ComputeFxBucketedChunk( const FpFxJob<TYOut, TMetaIn, TMetaOut>* job, const uint chunk,
+                             const uint64 offset, const uint64 entryCount )
+{
+    byte* tmp = job->bucketTmp + job->bucketTmpStride * job->threadId;
+
+    uint64*   yTmp    = (uint64*)tmp;
+    TMetaOut* metaTmp = (TMetaOut*)( yTmp + job->chunkSize );
+    Pair*     pairTmp = (Pair*)( metaTmp + job->chunkSize );
+
+    uint32 bucketCounts[FX_BUCKET_COUNT];
+    memset( bucketCounts, 0, sizeof( bucketCounts ) );
+
+    ComputeFxChunk( job, offset, entryCount, yTmp, metaTmp, bucketCounts );
+
+    // The chunk's pairs are no longer needed in their input order,
+    // so they are distributed in place along with their entries.
+    Pair* pairs = const_cast<Pair*>( job->lrPairs ) + offset;
+    memcpy( pairTmp, pairs, sizeof( Pair ) * entryCount );
+
+    FxBucketChunk<TMetaOut>( entryCount, bucketCounts,
+        yTmp, metaTmp, pairTmp,
+        job->outYBuffer + offset, job->outMetaBuffer + offset, pairs,
+        job->chunkBuckets + (uint64)chunk * FX_CHUNK_BUCKET_STRIDE );
+}
+
+// Distributes the chunks the GPU has computed in buckets, as ComputeFxBucketedChunk() does
+// with the chunks it computes. The chunks are staged from their place in the output buffers.
+//-----------------------------------------------------------
+template<typename TYOut, typename TMetaIn, typename TMetaOut>
+void BucketFxChunksJob( FpFxJob<TYOut, TMetaIn, TMetaOut>* job )
+{
+    // Table 7 is not sorted in buckets
+    if constexpr( SizeForMeta<TMetaOut>::Value != 0 )
+    {
+        byte* tmp = job->bucketTmp + job->bucketTmpStride * job->threadId;
+
+        uint64*   yTmp    = (uint64*)tmp;
+        TMetaOut* metaTmp = (TMetaOut*)( yTmp + job->chunkSize );
+        Pair*     pairTmp = (Pair*)( metaTmp + job->chunkSize );
+
+        uint chunk;
+        while( job->scheduler->Next( job->threadId, chunk ) )
+        {
+            chunk += job->firstChunk;
+
+            uint64 start, end;
+            GetChunkRange( chunk, job->chunkSize, job->entryCount, start, end );
+
+            const uint64 entryCount = end - start;
+
+            uint64*   yOut    = job->outYBuffer    + start;
+            TMetaOut* metaOut = job->outMetaBuffer + start;
+            Pair*     pairs   = const_cast<Pair*>( job->lrPairs ) + start;
+
+            memcpy( yTmp   , yOut   , sizeof( uint64   ) * entryCount );
+            memcpy( metaTmp, metaOut, sizeof( TMetaOut ) * entryCount );
+            memcpy( pairTmp, pairs  , sizeof( Pair     ) * entryCount );
+
+            uint32 bucketCounts[FX_BUCKET_COUNT];
+            memset( bucketCounts, 0, sizeof( bucketCounts ) );
+
+            for( uint64 i = 0; i < entryCount; i++ )
+                bucketCounts[yTmp[i] >> FX_BUCKET_SHIFT]++;
+
+            FxBucketChunk<TMetaOut>( entryCount, bucketCounts,
+                yTmp, metaTmp, pairTmp,
+                yOut, metaOut, pairs,
+                job->chunkBuckets + (uint64)chunk * FX_CHUNK_BUCKET_STRIDE );
+        }
+    }
+}
+
+//-----------------------------------------------------------
+template<typename TYOut, typename TMetaIn, typename TMetaOut>
+void ComputeFxChunk( const FpFxJob<TYOut, TMetaIn, TMetaOut>* job, const uint64 offset, const uint64 entryCount,
+                     TYOut* outYBuffer, TMetaOut* outMetaBuffer, uint32* bucketCounts )
 {
     const size_t metaKMultiplierIn  = SizeForMeta<TMetaIn >::Value;
     const size_t metaKMultiplierOut = SizeForMeta<TMetaOut>::Value;
@@ -1111,93 +1526,146 @@ void ComputeFxJob( FpFxJob<TYOut, TMetaIn, TMetaOut>* job )
     // so we need to shift by 32 bits, instead of 26.
     constexpr size_t extraBitsShift = metaKMultiplierOut == 0 ? 0 : kExtraBits; 
 
-    const uint64   entryCount    = job->entryCount;
-    const Pair*    lrPairs       = job->lrPairs;
+    const Pair*    lrPairs       = job->lrPairs + offset;
     const TMetaIn* inMetaBuffer  = job->inMetaBuffer;
     const uint64*  inYBuffer     = job->inYBuffer;
-    TMetaOut*      outMetaBuffer = job->outMetaBuffer;
-    TYOut*         outYBuffer    = job->outYBuffer;
 
     #if _DEBUG
         uint64 lastLeft = 0;
     #endif
 
-    // Intermediate metadata holder
-    uint64 lrMetadata[4];
+    // Size of the serialized hash input
+    constexpr size_t bufferSize = CDiv( ( _K + kExtraBits ) + _K * metaKMultiplierIn * 2, 8 );
+    constexpr size_t inputWords = CDiv( bufferSize, 8 );
 
-    for( uint64 i = 0; i < entryCount; i++ )
-    {
-        const Pair& pair = lrPairs[i];
+    // The y and L/R metadata of a batch, gathered in a contiguous staging area before it's serialized.
+    // The metadata is read in whole 64-bit words, as ComputeFxInput() expects it.
+    uint64 batchY   [BLAKE3_LANES];
+    uint64 batchMeta[BLAKE3_LANES][4];
 
-        #if _DEBUG
-            ASSERT( pair.left >= lastLeft );
-            lastLeft = pair.left;
-        #endif
+    // Entries are serialized into lanes and hashed together.
+    // #NOTE: Message words past the input size must remain zero.
+    blake3_lanes_msg msg;
+    blake3_lanes_out hashes;
+    ZeroMem( &msg );
 
-        // Read y
-        const uint64 y = inYBuffer[pair.left];
+    for( uint64 batch = 0; batch < entryCount; batch += BLAKE3_LANES )
+    {
+        const uint32 laneCount = (uint32)std::min( (uint64)BLAKE3_LANES, entryCount - batch );
 
-        // Read metadata
-        if constexpr( metaKMultiplierIn == 1 )
+        // Gather the batch, while prefetching the entries of the pairs ahead of it.
+        // The left entries are read in order, but the right ones jump around the adjacent group,
+        // so the right metadata is what the hardware prefetcher misses.
+        for( uint32 lane = 0; lane < laneCount; lane++ )
         {
-            uint32* meta32 = (uint32*)lrMetadata;
+            #if FX_GATHER_PREFETCH_DIST > 0
+                if( batch + lane + FX_GATHER_PREFETCH_DIST < entryCount )
+                {
+                    const Pair& next = lrPairs[batch + lane + FX_GATHER_PREFETCH_DIST];
+
+                    BB_PREFETCH( inYBuffer    + next.left  );
+                    BB_PREFETCH( inMetaBuffer + next.left  );
+                    BB_PREFETCH( inMetaBuffer + next.right );
+
+                    // Packed Meta3 entries may straddle a cache line
+                    if constexpr( 64 % sizeof( TMetaIn ) != 0 )
+                        BB_PREFETCH( (const byte*)( inMetaBuffer + next.right + 1 ) - 1 );
+                }
+            #endif
+
+            const Pair& pair = lrPairs[batch + lane];
+
+            #if _DEBUG
+                ASSERT( pair.left >= lastLeft );
+                lastLeft = pair.left;
+            #endif
 
-            meta32[0] = inMetaBuffer[pair.left ];    // Metadata( l and r x's)
-            meta32[1] = inMetaBuffer[pair.right];
+            // Read y
+            batchY[lane] = inYBuffer[pair.left];
+
+            // Read metadata
+            uint64* lrMetadata = batchMeta[lane];
+
+            if constexpr( metaKMultiplierIn == 1 )
+            {
+                uint32* meta32 = (uint32*)lrMetadata;
+
+                meta32[0] = inMetaBuffer[pair.left ];    // Metadata( l and r x's)
+                meta32[1] = inMetaBuffer[pair.right];
+            }
+            else if constexpr( metaKMultiplierIn == 2 )
+            {
+                lrMetadata[0] = inMetaBuffer[pair.left ];
+                lrMetadata[1] = inMetaBuffer[pair.right];
+            }
+            else
+            {
+                // Meta3 is read from its packed 12 bytes, Meta4 from 16 bytes
+                const TMetaIn& metaL = inMetaBuffer[pair.left ];
+                const TMetaIn& metaR = inMetaBuffer[pair.right];
+
+                lrMetadata[0] = metaL.m0;
+                lrMetadata[1] = metaL.m1;
+                lrMetadata[2] = metaR.m0;
+                lrMetadata[3] = metaR.m1;
+            }
         }
-        else if constexpr( metaKMultiplierIn == 2 )
+
+        // Serialize the batch into the hash lanes
+        for( uint32 lane = 0; lane < laneCount; lane++ )
         {
-            lrMetadata[0] = inMetaBuffer[pair.left ];
-            lrMetadata[1] = inMetaBuffer[pair.right];
+            const uint64  y          = batchY[lane];
+            const uint64* lrMetadata = batchMeta[lane];
+
+            uint64 input[5];
+            if constexpr( _K == 32 )
+                ComputeFxInput<metaKMultiplierIn, metaKMultiplierOut>( y, lrMetadata, (uint64*)( outMetaBuffer + lane ), input );
+            else
+                ComputeFxInputBits<metaKMultiplierIn, metaKMultiplierOut>( y, lrMetadata, (uint64*)( outMetaBuffer + lane ), input );
+
+            for( size_t w = 0; w < inputWords; w++ )
+            {
+                msg.words[w*2  ][lane] = (uint32)input[w];
+                msg.words[w*2+1][lane] = (uint32)( input[w] >> 32 );
+            }
         }
-        else
+
+        blake3_hash_lanes( &msg, laneCount, (uint8)bufferSize, &hashes );
+
+        for( uint32 lane = 0; lane < laneCount; lane++ )
         {
-            // For 3 and 4 we just use 16 bytes (2 64-bit entries)
-            const Meta4* inMeta4 = static_cast<const Meta4*>( inMetaBuffer );
-            const Meta4& meta4L  = inMeta4[pair.left ];
-            const Meta4& meta4R  = inMeta4[pair.right];
-
-            lrMetadata[0] = meta4L.m0;
-            lrMetadata[1] = meta4L.m1;
-            lrMetadata[2] = meta4R.m0;
-            lrMetadata[3] = meta4R.m1;
-        }
+            uint64 output[3];
+            for( uint w = 0; w < 3; w++ )
+                output[w] = (uint64)hashes.words[w*2][lane] | ( (uint64)hashes.words[w*2+1][lane] << 32 );
+
+            uint64 y;
+            if constexpr( _K == 32 )
+                y = ComputeFxOutput<metaKMultiplierIn, metaKMultiplierOut, extraBitsShift>( output, (uint64*)( outMetaBuffer + lane ) );
+            else
+                y = ComputeFxOutputBits<metaKMultiplierIn, metaKMultiplierOut, extraBitsShift>( output, (uint64*)( outMetaBuffer + lane ) );
 
-        TYOut f = (TYOut)ComputeFx<metaKMultiplierIn, metaKMultiplierOut, extraBitsShift>( y, lrMetadata, (uint64*)outMetaBuffer );
+            outYBuffer[batch + lane] = (TYOut)y;
 
-        outYBuffer[i] = f;
+            if( bucketCounts )
+                bucketCounts[y >> FX_BUCKET_SHIFT]++;
+        }
 
         if constexpr( metaKMultiplierOut != 0 )
-            outMetaBuffer ++;
+            outMetaBuffer += laneCount;
     }
 }
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wattributes"
 
+// Serializes y and the L/R metadata into the hashing input (y + L + R).
+// Also writes the output metadata for the cases in which it is just L + R.
 //-----------------------------------------------------------
-template<size_t metaKMultiplierIn, size_t metaKMultiplierOut, uint ShiftBits>
-FORCE_INLINE uint64 ComputeFx( uint64 y, uint64* metaData, uint64* metaOut )
+template<size_t metaKMultiplierIn, size_t metaKMultiplierOut>
+FORCE_INLINE void ComputeFxInput( uint64 y, const uint64* metaData, uint64* metaOut, uint64 input[5] )
 {
     static_assert( metaKMultiplierIn != 0, "Invalid metaKMultiplier" );
 
-    // Helper consts
-    const uint   k           = _K;
-    const uint32 ySize       = k + kExtraBits;         // = 38
-    const uint32 yShift      = 64 - (k + ShiftBits);   // = 26 or 32
-    const size_t metaSize    = k * metaKMultiplierIn;
-    const size_t metaSizeLR  = metaSize * 2;
-
-    const size_t bufferSize  = CDiv( ySize + metaSizeLR, 8 );
-
-
-    // Hashing input and output buffers
-    uint64 input [5];       // y + L + R
-    uint64 output[4];       // blake3 hashed output
-
-    blake3_hasher hasher;
-
-
     // Prepare the input buffer depending on the metadata size
     if constexpr( metaKMultiplierIn == 1 )
     {
@@ -1211,8 +1679,8 @@ FORCE_INLINE uint64 ComputeFx( uint64 y, uint64* metaData, uint64* metaOut )
          *    0        1
          */
 
-        const uint64 l = reinterpret_cast<uint32*>( metaData )[0];
-        const uint64 r = reinterpret_cast<uint32*>( metaData )[1];
+        const uint64 l = reinterpret_cast<const uint32*>( metaData )[0];
+        const uint64 r = reinterpret_cast<const uint32*>( metaData )[1];
 
         input[0] = Swap64( y << 26 | l >> 6  );
         input[1] = Swap64( l << 58 | r << 26 );
@@ -1291,12 +1759,18 @@ FORCE_INLINE uint64 ComputeFx( uint64 y, uint64* metaData, uint64* metaOut )
         input[3] = Swap64( r0 << 26 | r1 >> 38 );
         input[4] = Swap64( r1 << 26 );
     }
+}
 
-
-    // Hash the input
-    blake3_hasher_init( &hasher );
-    blake3_hasher_update( &hasher, input, bufferSize );
-    blake3_hasher_finalize( &hasher, (uint8_t*)output, sizeof( output ) );
+// Obtains f (the new y) from the hashed input,
+// and the output metadata for the cases in which it is taken from the hash.
+//-----------------------------------------------------------
+template<size_t metaKMultiplierIn, size_t metaKMultiplierOut, uint ShiftBits>
+FORCE_INLINE uint64 ComputeFxOutput( const uint64 output[3], uint64* metaOut )
+{
+    // Helper consts
+    const uint   k           = _K;
+    const uint32 ySize       = k + kExtraBits;         // = 38
+    const uint32 yShift      = 64 - (k + ShiftBits);   // = 26 or 32
 
     uint64 f = Swap64( *output ) >> yShift;
 
@@ -1321,8 +1795,12 @@ FORCE_INLINE uint64 ComputeFx( uint64 y, uint64* metaData, uint64* metaOut )
         const uint64 h1 = Swap64( output[1] );
         const uint64 h2 = Swap64( output[2] );
 
-        metaOut[0] = h0 << ySize | h1 >> 26;
-        metaOut[1] = ((h1 << 6) & 0xFFFFFFC0) | h2 >> 58;
+        // Write to the packed 12-byte entry only,
+        // as the next entry may belong to another thread's chunk.
+        Meta3* meta3 = reinterpret_cast<Meta3*>( metaOut );
+
+        meta3->m0 = h0 << ySize | h1 >> 26;
+        meta3->m1 = (uint32)( ( ( h1 << 6 ) & 0xFFFFFFC0 ) | h2 >> 58 );
     }
     else if constexpr ( metaKMultiplierOut == 4 && metaKMultiplierIn != 2 ) // In = 2 is calculated above with L + R
     {
@@ -1337,6 +1815,130 @@ FORCE_INLINE uint64 ComputeFx( uint64 y, uint64* metaData, uint64* metaOut )
     return f;
 }
 
+// The layouts above are only valid for k32. For smaller k's, the fields are k, 2k, 3k or 4k bits,
+// so y and the metadata are serialized, and the hash read, field by field, most significant bit first.
+//-----------------------------------------------------------
+struct FxBitWriter
+{
+    uint64 words[5] = {};
+    uint   bit      = 0;
+
+    // value must fit in bitCount bits, of which there may be up to 64
+    FORCE_INLINE void Write( const uint64 value, const uint bitCount )
+    {
+        const uint word  = bit / 64;
+        const uint shift = bit % 64;
+
+        words[word] |= ( value << ( 64 - bitCount ) ) >> shift;
+
+        if( shift + bitCount > 64 )
+            words[word+1] |= value << ( 128 - shift - bitCount );
+
+        bit += bitCount;
+    }
+};
+
+// Reads bitCount bits, up to 64, at the given bit of the big-endian hash output
+//-----------------------------------------------------------
+FORCE_INLINE uint64 ReadFxBits( const uint64 h[3], const uint start, const uint bitCount )
+{
+    const uint word  = start / 64;
+    const uint shift = start % 64;
+
+    uint64 value = h[word] << shift;
+
+    if( shift + bitCount > 64 )
+        value |= h[word+1] >> ( 64 - shift );
+
+    return value >> ( 64 - bitCount );
+}
+
+//-----------------------------------------------------------
+template<size_t metaKMultiplierIn, size_t metaKMultiplierOut>
+FORCE_INLINE void ComputeFxInputBits( uint64 y, const uint64* metaData, uint64* metaOut, uint64 input[5] )
+{
+    static_assert( metaKMultiplierIn != 0, "Invalid metaKMultiplier" );
+
+    constexpr uint k = _K;
+
+    FxBitWriter writer;
+    writer.Write( y, k + kExtraBits );
+
+    if constexpr( metaKMultiplierIn == 1 )
+    {
+        const uint64 l = reinterpret_cast<const uint32*>( metaData )[0];
+        const uint64 r = reinterpret_cast<const uint32*>( metaData )[1];
+
+        writer.Write( l, k );
+        writer.Write( r, k );
+
+        if constexpr( metaKMultiplierOut == 2 )
+            metaOut[0] = l << k | r;
+    }
+    else if constexpr( metaKMultiplierIn == 2 )
+    {
+        const uint64 l = metaData[0];
+        const uint64 r = metaData[1];
+
+        writer.Write( l, k * 2 );
+        writer.Write( r, k * 2 );
+
+        // L + R is 4k bits, split into its high and low 64 bits
+        if constexpr( metaKMultiplierOut == 4 )
+        {
+            metaOut[0] = l >> ( 64 - k * 2 );
+            metaOut[1] = l << ( k * 2 ) | r;
+        }
+    }
+    else
+    {
+        // Meta3 and Meta4 hold their high bits in m0, and their low 32 or 64 bits in m1
+        constexpr uint lowBits  = metaKMultiplierIn == 3 ? 32 : 64;
+        constexpr uint highBits = k * metaKMultiplierIn - lowBits;
+
+        writer.Write( metaData[0], highBits );
+        writer.Write( metaData[1], lowBits  );
+        writer.Write( metaData[2], highBits );
+        writer.Write( metaData[3], lowBits  );
+    }
+
+    for( uint i = 0; i < 5; i++ )
+        input[i] = Swap64( writer.words[i] );
+}
+
+//-----------------------------------------------------------
+template<size_t metaKMultiplierIn, size_t metaKMultiplierOut, uint ShiftBits>
+FORCE_INLINE uint64 ComputeFxOutputBits( const uint64 output[3], uint64* metaOut )
+{
+    constexpr uint k     = _K;
+    constexpr uint ySize = k + kExtraBits;
+
+    const uint64 h[3] = { Swap64( output[0] ), Swap64( output[1] ), Swap64( output[2] ) };
+
+    const uint64 f = h[0] >> ( 64 - ( k + ShiftBits ) );
+
+    // As above, the output metadata of tables 4-6 is taken from the hash, right after y
+    if constexpr ( metaKMultiplierOut == 2 && metaKMultiplierIn == 3 )
+    {
+        metaOut[0] = ReadFxBits( h, ySize, k * 2 );
+    }
+    else if constexpr ( metaKMultiplierOut == 3 )
+    {
+        // Write to the packed 12-byte entry only
+        Meta3* meta3 = reinterpret_cast<Meta3*>( metaOut );
+
+        meta3->m0 = ReadFxBits( h, ySize, k * 3 - 32 );
+        meta3->m1 = (uint32)ReadFxBits( h, ySize + k * 3 - 32, 32 );
+    }
+    else if constexpr ( metaKMultiplierOut == 4 && metaKMultiplierIn != 2 )
+    {
+        metaOut[0] = ReadFxBits( h, ySize, k * 4 - 64 );
+        metaOut[1] = ReadFxBits( h, ySize + k * 4 - 64, 64 );
+    }
+
+    return f;
+}
+
 #pragma GCC diagnostic pop
 
 
@@ -1,8 +1,6 @@
 #pragma once
 #include "PlotContext.h"
 
-struct kBCJob;
-
 template<typename T>
 struct ReadWriteBuffer
 {
@@ -25,12 +23,57 @@ struct ReadWriteBuffer
 };
 
 
+///
+/// Fx
+///
+// Pairs ahead of the one being gathered whose y and metadata are prefetched by ComputeFx.
+// 0 disables it. The best distance depends on the memory latency, so it can be set at build time.
+#ifndef FX_GATHER_PREFETCH_DIST
+    #define FX_GATHER_PREFETCH_DIST 32
+#endif
+
+
+///
+/// F1
+///
+// Each F1 entry takes k bits of the ChaCha8 keystream, so every kF1BlockSizeBits entries
+// span exactly k blocks. F1 is split across threads in such groups.
+#define F1_GROUP_ENTRIES kF1BlockSizeBits
+#define F1_GROUP_BLOCKS  _K
+
+// Returns the k-bit F1 value of entry i of a keystream that starts at a group boundary.
+// The keystream is big endian, as required by chiapos.
+//-----------------------------------------------------------
+inline uint64 GetF1Value( const uint32* blocks, const uint64 i )
+{
+    if constexpr( _K == 32 )
+        return Swap32( blocks[i] );
+    else
+    {
+        const uint64 bit   = i * _K;
+        const uint64 word  = bit / 32;
+        const uint   shift = (uint)( bit % 32 );
+
+        // Only read the next word if the entry reaches into it, as it may be past the end of the keystream
+        uint64 bits = (uint64)Swap32( blocks[word] ) << 32;
+        if( shift + _K > 32 )
+            bits |= Swap32( blocks[word+1] );
+
+        return ( bits << shift ) >> ( 64 - _K );
+    }
+}
+
 ///
 /// Helpers for working with metadata
 ///
-struct Meta3 { uint64 m0, m1; };  // Used for when the metadata multiplier == 3
-struct Meta4 : Meta3 {};          // Used for when the metadata multiplier == 4
-struct NoMeta {};                 // Used for when the metadata multiplier == 0
+// Metadata is stored packed to its 32 * multiplier bits.
+// It holds its k * multiplier bit value, with Meta3 and Meta4 as its high 64 bits (m0),
+// followed by its low 32 or 64 bits (m1). At k32, the value takes all of the bits.
+#pragma pack( push, 4 )
+struct Meta3 { uint64 m0; uint32 m1; };  // Used for when the metadata multiplier == 3
+#pragma pack( pop )
+struct Meta4 { uint64 m0, m1; };         // Used for when the metadata multiplier == 4
+struct NoMeta {};                        // Used for when the metadata multiplier == 0
 
 template<typename TMeta>
 struct SizeForMeta;
@@ -41,6 +84,9 @@ template<> struct SizeForMeta<Meta3>  { static constexpr size_t Value = 3; };
 template<> struct SizeForMeta<Meta4>  { static constexpr size_t Value = 4; };
 template<> struct SizeForMeta<NoMeta> { static constexpr size_t Value = 0; };
 
+static_assert( sizeof( Meta3 ) * 8 == 32 * SizeForMeta<Meta3>::Value, "Meta3 must be packed" );
+static_assert( sizeof( Meta4 ) * 8 == 32 * SizeForMeta<Meta4>::Value, "Meta4 must be packed" );
+
 template<TableId Table>
 struct TableMetaType;
 
@@ -65,15 +111,35 @@ public:
 
     void Run();
 
+    // Generates and sorts F1 for the next plot into the pipeline buffers, using the given thread pool.
+    // Runs in the background while the current plot is in Phases 3 and 4.
+    void GenerateNextF1( ThreadPool& pool, const byte* plotId );
+
+    // Run a single kernel over the given buffers, so that it can be benchmarked in isolation by bladebit_bench.
+    // Only the context's thread pool, thread policy and maxPairs are used.
+    uint64 BenchPair( uint64 entryCount, const uint64* yBuffer, Pair* tmpPairBuffer, Pair* outPairBuffer );
+
+    template<TableId tableId>
+    void BenchComputeFx( uint64 entryCount, const Pair* lrPairs, const uint64* inYBuffer, const void* inMetaBuffer,
+                         uint64* outYBuffer, void* outMetaBuffer );
+
 private:
     uint64 GenerateF1();
 
+    uint64 GenerateF1( ThreadPool& pool, const byte* plotId, uint64* yBuffer, uint32* xBuffer,
+                       uint64* yTmp, uint32* xTmp );
+
+    // Generates the unsorted F1 y's and x's on the context's GPU
+    void GenerateF1OnGpu( ThreadPool& pool, const byte* key, uint64* yTmp, uint32* xTmp );
+
+    // Generates F1 directly into the buckets of the first y sort pass, then sorts it.
+    void GenerateF1Bucketed( ThreadPool& pool, const byte* key, byte* blocks, uint32* yBuckets, uint32* xBuckets,
+                             uint64* yTmp, uint32* xTmp );
+
     void ForwardPropagate( uint64 entryCount );
-    uint64 FpScan( const uint64 entryCount, const uint64* yBuffer, 
-                   uint32* groupBoundaries, kBCJob jobs[MAX_THREADS] );
 
-    uint64 FpPair( const uint64* yBuffer, kBCJob jobs[MAX_THREADS],
-                   const uint64 groupCount, Pair* tmpPairBuffer, Pair* outPairBuffer );
+    // Scans kBC groups and creates L/R pairs from adjacent groups in a single pass
+    uint64 FpPair( const uint64 entryCount, const uint64* yBuffer, Pair* tmpPairBuffer, Pair* outPairBuffer );
 
     template<TableId tableId>
     uint64 FpComputeTable( uint64 entryCount, 
@@ -81,14 +147,15 @@ private:
                            ReadWriteBuffer<uint64>& metaBuffer );
 
     template<TableId tableId>
-    uint64 FpComputeSingleTable( uint64 entryCount, Pair* pairBuffer,
+    uint64 FpComputeSingleTable( uint64 entryCount, typename TablePair<tableId>::Type* pairBuffer,
                                ReadWriteBuffer<uint64>& yBuffer, 
                                ReadWriteBuffer<uint64>& metaBuffer );
 
     template<TableId tableId, typename TMetaIn, typename TMetaOut>
-    void FpComputeFx( const uint64 entryCount, const Pair* lrPairs,
-                      const TMetaIn* inMetaBuffer, const uint64* inYBuffer,
-                      TMetaOut* outMetaBuffer, uint64* outYBuffer );
+    uint64 FpComputeFx( const uint64 entryCount, const Pair* lrPairs,
+                        const TMetaIn* inMetaBuffer, const uint64* inYBuffer,
+                        TMetaOut* outMetaBuffer, uint64* outYBuffer,
+                        uint32* chunkBuckets = nullptr, byte* bucketTmp = nullptr, size_t bucketTmpSize = 0 );
     
     
     void WaitForPreviousPlotWriter();
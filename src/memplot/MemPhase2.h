@@ -15,13 +15,20 @@ public:
 
     void Run();
 
+    // Marks the left table entries used by a table 7 style right table, for bladebit_bench.
+    // Needs the context's markingScratch, sized for the index bins of a full table.
+    void BenchMarkTable( const Pair* rightTable, uint64 rightEntryCount, uint64* lMarkingBuffer );
 
 private:
 
     void ClearMarkingBuffers();
+    void ClearBuffer( byte* buffer, size_t size );
 
-    template<bool HasRightTableMarkingBuffer>
-    void MarkTable( const Pair* rightTable, uint64 rightEntryCount, const byte* rMarkedEntries, byte* lMarkingBuffer );
+    // Marks by first binning the left indices by destination range,
+    // so that each thread then only marks its own range of the bitfield.
+    // Also builds the rank index of the left table's marks into lRanks, if given.
+    template<bool HasRightTableMarkingBuffer, typename TPair>
+    void MarkTable( const TPair* rightTable, uint64 rightEntryCount, const uint64* rMarkedEntries, uint64* lMarkingBuffer, uint32* lRanks );
 
 private:
     MemPlotContext& _context;
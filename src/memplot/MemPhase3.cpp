@@ -2,12 +2,21 @@
 #include "Util.h"
 #include "util/Log.h"
 #include "algorithm/RadixSort.h"
+#include "algorithm/RadixSortInPlace.h"
+#include "algorithm/ParallelScatter.h"
 #include "LPGen.h"
 #include "ParkWriter.h"
+#include "RankIndex.h"
+#include "MemPhase4.h"
 #include <cmath>
 
 #include "DbgHelper.h"
 #include "SysHost.h"
+#include "ThreadPolicy.h"
+#include "util/Profiler.h"
+#include "util/Metrics.h"
+#include "TableSpiller.h"
+#include "threading/Thread.h"
 
 
 //-----------------------------------------------------------
@@ -15,20 +24,27 @@ MemPhase3::MemPhase3( MemPlotContext& context )
     : _context( context )
 {}
 
+//-----------------------------------------------------------
+MemPhase3::~MemPhase3()
+{
+    EndParks();
+}
+
 //-----------------------------------------------------------
 void MemPhase3::Run()
 {
     MemPlotContext& cx = _context;
 
     // These will become the park buffer once processed.
-    Pair* rTables[7] = {
+    // #NOTE: Table 7 is not packed, so it's handled separately.
+    PackedPair* rTables[7] = {
         nullptr,
         cx.t2LRBuffer,
         cx.t3LRBuffer,
         cx.t4LRBuffer,
         cx.t5LRBuffer,
         cx.t6LRBuffer,
-        cx.t7LRBuffer,
+        nullptr,
     };
 
     // This table will always be used as the left table.
@@ -38,20 +54,45 @@ void MemPhase3::Run()
     // Use the same buffer for LPs, it will be serialized to 
     // park back in the rTable.
     // Therefore after each iteration rTable will be a park buffer
-    uint64* lpBuffer = cx.metaBuffer0;
+    uint64* lpBuffer = cx.lpBuffer0;
+
+    // When a table's parks are encoded while the next table is converted,
+    // the line points of consecutive tables alternate between the two line point buffers.
+    // Table 6 gets the first one, which holds its parks until they're written.
+    const bool overlapParks = cx.parkPool && !cx.spill;
 
     for( uint i = (uint)TableId::Table1; i < (uint)TableId::Table7; i++ )
     {
-        Pair*        rTable       = rTables[i+1];
+        if( overlapParks )
+            lpBuffer = i % 2 == 0 ? cx.lpBuffer1 : cx.lpBuffer0;
+
+        PackedPair*  rTable       = rTables[i+1];
         const uint64 rTableCount  = cx.entryCount[i+1];
-        const byte*  rUsedEntries = i < (uint)TableId::Table6 ? (byte*)cx.usedEntries[i+1] : nullptr;
+        const uint64* rUsedEntries = i < (uint)TableId::Table6 ? cx.usedEntries[i+1] : nullptr;
 
         Log::Line( "  Compressing tables %u and %u...", i+1, i+2 );
         auto tableTimer = TimerBegin();
+        ProfileScope scope( cx.profiler, "table", (int)i+1 );
+        MetricsSetTable( cx.metrics, i+1 );
+
+        if( cx.spill && i+1 < (uint)TableId::Table7 )
+        {
+            // The staging buffer holds the parks of the previous table until they
+            // are written to disk, so we have to wait for them before we can re-use it.
+            if( i > 0 )
+            {
+                cx.spill->Invalidate();
+
+                while( cx.plotWriter->TablesWritten() < i )
+                    Thread::Sleep( 1 );
+            }
+
+            cx.spill->Load( *cx.threadPool, (TableId)(i+1), rTable, rTableCount );
+        }
         
         uint64 newCount;
         if( i == (uint)TableId::Table6 )
-            newCount = ProcessTable<true> ( lTable, lpBuffer, rTable, rTableCount, rUsedEntries, (TableId)i );
+            newCount = ProcessTable<true> ( lTable, lpBuffer, cx.t7LRBuffer, rTableCount, rUsedEntries, (TableId)i );
         else
             newCount = ProcessTable<false>( lTable, lpBuffer, rTable, rTableCount, rUsedEntries, (TableId)i ); 
 
@@ -60,97 +101,210 @@ void MemPhase3::Run()
         Log::Line( "  Table %d now has %llu / %llu entries ( %.2lf%% ).", 
             i+1, newCount, rTableCount, (newCount / (double)rTableCount) * 100 );
     }
+
+    EndParks();
 }
 
 //-----------------------------------------------------------
-template<bool IsTable6>
-uint64 MemPhase3::ProcessTable( uint32* lEntries, uint64* lpBuffer, Pair* rTable,
-                                const uint64 rTableCount, const byte* markedEntries, TableId tableId )
+template<bool IsTable6, typename TPair>
+uint64 MemPhase3::ProcessTable( uint32* lEntries, uint64* lpBuffer, TPair* rTable,
+                                const uint64 rTableCount, const uint64* markedEntries, TableId tableId )
 {
     auto& cx = _context;
 
-    const uint   threadCount      = cx.threadCount;
+    // The previous table's parks are still being encoded by the park pool's threads,
+    // so this table is converted on the rest of them.
+    uint threadCount = cx.threadPolicy->Begin( PlotKernel::LinePoints );
+
+    if( _parkTask.IsValid() )
+        threadCount = std::max( 1u, threadCount - std::min( threadCount, cx.parkPool->ThreadCount() ) );
+
     const uint64 entriesPerThread = rTableCount / threadCount;
     const uint64 trailingEntries  = rTableCount - ( entriesPerThread * threadCount );
 
-    if constexpr ( IsTable6 )
+    // Pruning and line point conversion are scheduled dynamically in chunks
+    // of whole bitfield words, as marked entry density varies accross the table.
+    LPChunks chunks;
+    chunks.size        = RoundUpToNextBoundary( CDiv( rTableCount, (int)( threadCount * BB_CHUNKS_PER_THREAD ) ), 64 );
+    chunks.rTableCount = rTableCount;
+
+    const uint chunkCount = (uint)CDiv( rTableCount, (int)chunks.size );
+    
+    chunks.prune    .Init( chunkCount, threadCount );
+    chunks.linePoint.Init( chunkCount, threadCount );
+    chunks.offsets.resize( chunkCount + 1 );
+
+    if constexpr ( !IsTable6 )
+    {
+        // Each chunk's pruned entries start at the rank of its first entry,
+        // so the chunks can be pruned in any order, without counting them first.
+        const uint32* ranks = cx.usedEntryRanks[(uint)tableId+1];
+
+        for( uint i = 0; i <= chunkCount; i++ )
+            chunks.offsets[i] = BitFieldRank( markedEntries, ranks, std::min( i * chunks.size, rTableCount ) );
+    }
+    else
     {
         // ConverToLinePointThread reads fron lpBuffer,
         // but since we haven't pruned rTable and moved it to lpBuffer,
         // we need to swap it here, so that we read/write from/to it in ConverToLinePointThread
         uint64* tmp = (uint64*)rTable;
-        rTable   = (Pair*)lpBuffer;
+        rTable   = (TPair*)lpBuffer;
         lpBuffer = tmp;
+
+        // Without prunning, the chunks stay where they are
+        for( uint i = 0; i <= chunkCount; i++ )
+            chunks.offsets[i] = std::min( i * chunks.size, rTableCount );
     }
 
-    uint32* map = (uint32*)cx.metaBuffer1;
+    uint32* map = cx.lookupMap;
 
-    std::atomic<uint> threadSignal = 0;
-    std::atomic<uint> releaseLock  = 0;
+    // The bucketed sort distributes the line points into the same
+    // temporary buffers the radix sort would use.
+    const bool bucketedSort = cx.bucketedLpSort && !cx.inPlaceSort;
+
+    LPBuckets buckets;
+    if( bucketedSort )
+    {
+        buckets.lpTmp  = IsTable6 ? (uint64*)rTable : cx.p3TmpBuffer;
+        buckets.mapTmp = map + rTableCount;
+        buckets.sort.Init( LP_SORT_BUCKETS, threadCount );
+        buckets.threads.resize( threadCount );
+    }
+
+    Barrier barrier;
+    barrier.Init( threadCount, *cx.threadPool );
     
-    LPJob jobs[MAX_THREADS];
+    std::vector<LPJob> jobs( threadCount );
 
     for( uint i = 0; i < threadCount; i++ )
     {
         auto& job = jobs[i];
-        job.Init( (uint)i, threadCount, threadSignal, releaseLock );
+        job.Init( (uint)i, threadCount, barrier );
 
         job.lTable        = lEntries;
         job.length        = entriesPerThread;
         job.offset        = i * entriesPerThread;
-        job.rTable        = (Pair*)rTable;
+        job.rTable        = IsTable6 ? nullptr : (PackedPair*)rTable;    // Only read when prunning
         job.lpBuffer      = lpBuffer;
-        job.jobs          = jobs;
+        job.chunks        = &chunks;
 
         job.markedEntries = markedEntries;
         job.map           = map;
+        job.fusedPrune    = cx.fusedPrune;
+        job.droppedXBits  = tableId == TableId::Table1 ? cx.droppedXBits : 0;
+        job.buckets       = bucketedSort ? &buckets : nullptr;
     }
 
     jobs[threadCount-1].length += trailingEntries;
 
     constexpr bool PruneTable = !IsTable6;
-    cx.threadPool->RunJob( ProcessTableThread<PruneTable>, jobs, threadCount );
+    {
+        ProfileScope scope( cx.profiler, "lp_convert" );
+        cx.threadPool->RunJob( ProcessTableThread<PruneTable>, jobs.data(), threadCount );
+    }
+
+    cx.threadPolicy->End( PlotKernel::LinePoints, threadCount, rTableCount );
+
+    // The sort runs on all of the pool's threads
+    EndParks();
 
 
     // Get the new total length after the prune
-    uint64 newLength;
-    if constexpr ( !IsTable6 )
+    // #NOTE: No prunning for table 6, so same length
+    uint64 newLength = chunks.offsets[chunkCount];
+    ASSERT( IsTable6 ? newLength == rTableCount : newLength <= rTableCount );
+
+    // Split the pruned entries evenly for writing the lookup table
+    for( uint i = 0; i < threadCount; i++ )
     {
-        newLength = jobs[0].length;
-        
-        for( uint i = 1; i < threadCount; i++ )
-            newLength += jobs[i].length;
+        jobs[i].offset = newLength * i       / threadCount;
+        jobs[i].length = newLength * (i + 1) / threadCount - jobs[i].offset;
     }
-    else
+
+
+    // Sort LinePoints, along with the map
+    // #NOTE: The packed rTable is too small to hold the line points,
+    //        so we use Phase 3's temporary buffer.
+    //        For table 6, rTable is lpBuffer0 here, so it can hold them.
+    //        When bucketed, the line points have already been sorted by ProcessTableThread.
+    if( bucketedSort )
     {
-        // No prunning for table 6, so same length
-        newLength = rTableCount;
+        ASSERT( buckets.starts[LP_SORT_BUCKETS] == newLength );
     }
+    else if( cx.inPlaceSort )
+    {
+        ProfileScope scope( cx.profiler, "lp_sort" );
+        RadixSortInPlace::SortWithKey<MAX_THREADS, _K*2>( *cx.threadPool, lpBuffer, map, newLength );
+    }
+    else
+    {
+        ProfileScope scope( cx.profiler, "lp_sort" );
 
+        uint64* lpSortTmp = IsTable6 ? (uint64*)rTable : cx.p3TmpBuffer;
 
-    // Sort LinePoints, along with the map
-    RadixSort256::SortWithKey<MAX_THREADS>( *cx.threadPool,
-        lpBuffer, (uint64*)rTable,
-        map,      map + newLength,  // This is meta1, so there's plenty of space to hold both buffers
-        newLength );
+        RadixSort256::SortBitsWithKey<MAX_THREADS, _K*2>( *cx.threadPool,
+            lpBuffer, lpSortTmp,
+            map,      map + newLength,  // The lookup map is sized to hold both buffers
+            newLength );
+    }
     
 
     // Write lookup table (map it based on sort key)
     // After this step lEntries will contain the new index map into the LP's
-    cx.threadPool->RunJob( WriteLookupTableThread, jobs, threadCount );
+    {
+        ProfileScope scope( cx.profiler, "lookup" );
+
+        if( cx.binnedLookup && !cx.inPlaceSort )
+        {
+            // Bin the (original index, new index) pairs by original index first,
+            // so that each thread writes only its own range of the lookup table.
+            // #NOTE: The temporary buffer is not used again in this table, so it holds the bins.
+            const uint32* sortedMap = map;
+            uint32*       lookup    = lEntries;
+
+            auto produce = [=]( const uint64 start, const uint64 end, const auto& emit ) {
+
+                for( uint64 i = start; i < end; i++ )
+                    emit( sortedMap[i], ( (uint64)sortedMap[i] << 32 ) | i );
+            };
+
+            auto write = [=]( const uint64* bin, const uint64 length ) {
+
+                for( uint64 i = 0; i < length; i++ )
+                    lookup[bin[i] >> 32] = (uint32)bin[i];
+            };
+
+            ParallelScatter::Scatter<uint64>( *cx.threadPool, threadCount,
+                newLength, 1ull << _K, 64 / sizeof( uint32 ),
+                cx.p3TmpBuffer, ENTRIES_PER_TABLE,
+                produce, write );
+        }
+        else
+            cx.threadPool->RunJob( WriteLookupTableThread, jobs.data(), threadCount );
+    }
 
 
     if constexpr ( IsTable6 )
     {
-        uint32* t7SortTmp       = (uint32*)cx.yBuffer0; // Don't need yBuffer0 at this point, safe to use
-        uint32* lEntriesSortTmp = (uint32*)cx.yBuffer1;
+        ProfileScope scope( cx.profiler, "f7_sort" );
 
         // We need to sort on f7 now, with lEntries with
         // contain now the index into table 6's LinePoints
-        RadixSort256::SortWithKey<MAX_THREADS>( *cx.threadPool,
-            cx.t7YBuffer, t7SortTmp,
-            lEntries,     lEntriesSortTmp,
-            newLength );
+        if( cx.inPlaceSort )
+        {
+            RadixSortInPlace::SortWithKey<MAX_THREADS, _K>( *cx.threadPool, cx.t7YBuffer, lEntries, newLength );
+        }
+        else
+        {
+            uint32* t7SortTmp       = (uint32*)cx.p3TmpBuffer;
+            uint32* lEntriesSortTmp = t7SortTmp + ENTRIES_PER_TABLE;
+
+            RadixSort256::SortBitsWithKey<MAX_THREADS, _K>( *cx.threadPool,
+                cx.t7YBuffer, t7SortTmp,
+                lEntries,     lEntriesSortTmp,
+                newLength );
+        }
 
         // #NOTE: Because the C2 table size is inferred by substracting table pointers
         //        in chiapos, we need to make sure we don't have any f7 entries with the
@@ -170,13 +324,17 @@ uint64 MemPhase3::ProcessTable( uint32* lEntries, uint64* lpBuffer, Pair* rTable
     #endif
 
     // Write park for table (re-use rTable for it)
-    // #NOTE: For table 6: rTable is meta0 here.
-    byte*  parkBuffer     = _context.plotWriter->AlignPointerToBlockSize<byte>( (void*)rTable );
-    size_t sizeTableParks = WriteParks<MAX_THREADS>( *cx.threadPool, newLength, lpBuffer, parkBuffer, tableId );
-    
-    // Send over the park for writing in the plot file in the background
-    if( !cx.plotWriter->WriteTable( parkBuffer, sizeTableParks ) )
-        Fatal( "Failed to write table %d to disk.", (int)tableId+1 );
+    // #NOTE: For table 6: rTable is lpBuffer0 here.
+    byte* parkBuffer = _context.plotWriter->AlignPointerToBlockSize<byte>( (void*)rTable );
+
+    // Table 6's parks are the last ones, so there's nothing to overlap them with
+    if( cx.parkPool && !cx.spill && !IsTable6 )
+        BeginParks( lpBuffer, newLength, parkBuffer, tableId );
+    else
+    {
+        ProfileScope scope( cx.profiler, "park_write" );
+        WriteTableParks( *cx.threadPool, lpBuffer, newLength, parkBuffer, tableId );
+    }
 
     if constexpr ( IsTable6 )
     {
@@ -186,17 +344,88 @@ uint64 MemPhase3::ProcessTable( uint32* lEntries, uint64* lpBuffer, Pair* rTable
             DbgWriteTableToFile( *cx.threadPool, DBG_TABLES_PATH "t7indices.tmp", newLength, lEntries, true );
         }
         #endif
+
+        // Build the checkpoint tables while the plot writer writes table 6's parks.
+        // This overwrites the f7 entries.
+        if( cx.fusedCheckpoints )
+        {
+            MemPhase4 phase4( cx );
+            phase4.BuildCTables();
+        }
     }
 
     return newLength;
 }
 
+//-----------------------------------------------------------
+void MemPhase3::WriteTableParks( ThreadPool& pool, uint64* lpBuffer, const uint64 length, byte* parkBuffer, const TableId tableId )
+{
+    MemPlotContext& cx = _context;
+
+    const uint droppedXBits = tableId == TableId::Table1 ? cx.droppedXBits : 0;
+    const auto timer        = TimerBegin();
+
+    if( cx.streamParks )
+    {
+        // The plot writer starts writing the parks as soon as their first blocks are encoded
+        if( !cx.plotWriter->BeginStreamedTable( parkBuffer ) )
+            Fatal( "Failed to write table %d to disk.", (int)tableId+1 );
+
+        size_t sizeTableParks = WriteParksStreamed<MAX_THREADS>( pool, length, lpBuffer, parkBuffer, tableId, *cx.plotWriter, droppedXBits );
+
+        if( !cx.plotWriter->EndStreamedTable( sizeTableParks ) )
+            Fatal( "Failed to write table %d to disk.", (int)tableId+1 );
+    }
+    else
+    {
+        size_t sizeTableParks = WriteParks<MAX_THREADS>( pool, length, lpBuffer, parkBuffer, tableId, droppedXBits );
+    
+        // Send over the park for writing in the plot file in the background
+        if( !cx.plotWriter->WriteTable( parkBuffer, sizeTableParks ) )
+            Fatal( "Failed to write table %d to disk.", (int)tableId+1 );
+    }
+
+    if( tableId == TableId::Table1 )
+        cx.table1ParkTime = TimerEnd( timer );
+}
+
+//-----------------------------------------------------------
+void MemPhase3::BeginParks( uint64* lpBuffer, const uint64 length, byte* parkBuffer, const TableId tableId )
+{
+    ASSERT( !_parkTask.IsValid() );
+    ASSERT( _context.parkPool );
+
+    _parkLinePoints = lpBuffer;
+    _parkLength     = length;
+    _parkBuffer     = parkBuffer;
+    _parkTableId    = tableId;
+
+    // The plot writer is only used by this task until EndParks(), so tables are still written in order.
+    // The task runs the encoding jobs on the rest of the park pool's threads.
+    _parkTask = _context.parkPool->Submit<MemPhase3>( []( MemPhase3* self ) {
+
+        self->WriteTableParks( *self->_context.parkPool, self->_parkLinePoints, self->_parkLength, self->_parkBuffer, self->_parkTableId );
+
+    }, this );
+}
+
+//-----------------------------------------------------------
+void MemPhase3::EndParks()
+{
+    if( !_parkTask.IsValid() )
+        return;
+
+    ProfileScope scope( _context.profiler, "park_wait" );
+
+    _context.parkPool->Wait( _parkTask );
+    _parkTask.Reset();
+}
+
 //-----------------------------------------------------------
 template<bool PruneTable>
 void ProcessTableThread( LPJob* job )
 {
-    // - Scan the table and determine how many valid entries we have
-    // - Now we know where to place them in the new table
+    // - The rank index built by Phase 2 tells where each chunk's valid entries go in the new table
     // - Prune the table by copying valid entries to the new buffer
     //  - Write the original index of the entry into a map
     // - Convert pruned entries to LinePoint using the 'left' table.
@@ -209,14 +438,47 @@ void ProcessTableThread( LPJob* job )
     //      Since the lookup table maps to the final indices, the 
     //      LinePoints can be generated from it.
 
+    // When sorting in buckets, each thread counts the line points
+    // it converts into each bucket, and remembers which chunks it converted.
+    LPBucketThread  bucketThreadState;
+    LPBucketThread* bucketThread = nullptr;
+
+    if( job->buckets )
+    {
+        bucketThread = &bucketThreadState;
+        memset( bucketThread->counts, 0, sizeof( bucketThread->counts ) );
+        bucketThread->chunks.resize( job->chunks->linePoint.ChunkCount() );
+        bucketThread->chunkCount = 0;
+
+        job->buckets->threads[job->_threadId] = bucketThread;
+    }
+
     if constexpr ( PruneTable )
     {
-        PruneAndMapThread( job );
+        // Fused: The line points are generated while pruning,
+        // so there's no pruned Pair pass left to convert.
+        if( job->fusedPrune )
+        {
+            PruneAndMapThread<true>( job, bucketThread );
+
+            if( bucketThread )
+                SortLinePointBucketsThread<PruneTable>( job, *bucketThread );
+            return;
+        }
+
+        PruneAndMapThread<false>( job, nullptr );
         job->WaitForThreads();
     }
 
     // Convert to LinePoint
-    ConverToLinePointThread( job );
+    ConverToLinePointThread( job, bucketThread );
+
+    // The bucketed sort writes the map along with the sorted line points
+    if( bucketThread )
+    {
+        SortLinePointBucketsThread<PruneTable>( job, *bucketThread );
+        return;
+    }
 
 
     // If it's the last table pair, perform a few things differently.
@@ -240,90 +502,308 @@ void ProcessTableThread( LPJob* job )
 }
 
 //-----------------------------------------------------------
-void PruneAndMapThread( LPJob* job )
+template<bool ToLinePoint>
+void PruneAndMapThread( LPJob* job, LPBucketThread* bucketThread )
 {
-    const byte*  markedEntries = job->markedEntries;
+    LPChunks&     chunks        = *job->chunks;
+    const uint64* markedEntries = job->markedEntries;
+    const uint    threadId      = job->_threadId;
 
-    uint64       length        = job->length;
+    const PackedPair* pairs = job->rTable;
 
-    const uint64 srcOffset     = job->offset; 
-    const uint64 end           = srcOffset + length;
+    uint   chunk;
+    uint64 start, end;
 
-    Pair* pairs = job->rTable;
+    ///
+    /// Prune to new buffer
+    /// #NOTE: Where each chunk goes was found from the rank index of the marks.
+    ///
+    uint32* map      = job->map;
+    Pair*   newPairs = (Pair*)job->lpBuffer;
 
-    // Scan entries
+    while( chunks.prune.Next( threadId, chunk ) )
     {
-        uint64 newLength = 0;
-        
-        for( uint64 i = srcOffset; i < end; i++ )
+        GetChunkRange( chunk, chunks.size, chunks.rTableCount, start, end );
+
+        if constexpr ( ToLinePoint )
+        {
+            // Walk only the marked entries, one bitfield word at a time,
+            // and write their line points straight to lpBuffer.
+            const uint32* lTable       = job->lTable;
+            uint64*       lpBuffer     = job->lpBuffer;
+            const uint    droppedXBits = job->droppedXBits;
+
+            uint64 dstI = chunks.offsets[chunk];
+
+            for( uint64 w = start >> 6; w < CDiv( end, 64 ); w++ )
+            {
+                uint64 bits = markedEntries[w];
+
+                if( ( w + 1 ) * 64 > end )
+                    bits &= ( 1ull << ( end & 63 ) ) - 1;
+
+                while( bits )
+                {
+                    const uint64 i = ( w << 6 ) | Ctz64( bits );
+                    bits &= bits - 1;
+
+                    const Pair   pair = UnpackPair( pairs[i] );
+                    const uint64 x    = lTable[pair.left ];
+                    const uint64 y    = lTable[pair.right];
+                    ASSERT( x || y );
+
+                    const uint64 lp = droppedXBits ? DroppedXLinePoint( x >> droppedXBits, y >> droppedXBits ) :
+                                                     SquareToLinePoint( x, y );
+                    ASSERT( ( lp >> LP_SORT_BUCKET_SHIFT ) < LP_SORT_BUCKETS );
+
+                    if( bucketThread )
+                        bucketThread->counts[lp >> LP_SORT_BUCKET_SHIFT]++;
+
+                    lpBuffer[dstI] = lp;
+                    map     [dstI] = (uint32)i;
+                    dstI++;
+                }
+            }
+
+            ASSERT( dstI == chunks.offsets[chunk+1] );
+
+            if( bucketThread )
+                bucketThread->chunks[bucketThread->chunkCount++] = chunk;
+            continue;
+        }
+
+        // Copy our valid entries to the new buffer
+        uint64 dstI = chunks.offsets[chunk];
+
+        for( uint64 i = start; i < end; i++ )
         {
-            if( markedEntries[i] )
-                newLength ++;
+            if( !BitFieldGet( markedEntries, i ) )
+                continue;
+            
+            newPairs[dstI] = UnpackPair( pairs[i] );  // Copy to new location
+            map     [dstI] = (uint32)i; // Map the entry back to its original location
+
+            dstI++; 
         }
 
-        length      = newLength;
-        job->length = newLength;
+        ASSERT( dstI == chunks.offsets[chunk+1] );
     }
+}
 
-    // Wait for other entries so that can determine
-    // the new position to copy to.
-    job->WaitForThreads();
+//-----------------------------------------------------------
+void ConverToLinePointThread( LPJob* job, LPBucketThread* bucketThread )
+{
+    LPChunks&     chunks = *job->chunks;
+    Pair*         rTable = (Pair*)job->lpBuffer;
+    const uint32* lTable = job->lTable;
 
-    ///
-    /// Prune to new buffer
-    ///
-     
-    // Get our new offset
-    uint64 dstOffset = 0;
+    // Table 1's x's may have their low bits dropped, in which case its line points may be 0
+    const uint droppedXBits = job->droppedXBits;
 
-    const uint  threadId = job->_threadId;
-    const auto* jobs     = job->jobs;
+    uint chunk;
+    while( chunks.linePoint.Next( job->_threadId, chunk ) )
+    {
+        const uint64 end = chunks.offsets[chunk+1];
 
-    for( uint i = 0; i < threadId; i++ )
-        dstOffset += jobs[i].length;
+        for( uint64 i = chunks.offsets[chunk]; i < end; i++ )
+        {
+            const Pair* rEntry = &rTable[i];
+            
+            const uint64 x = lTable[rEntry->left ];
+            const uint64 y = lTable[rEntry->right];
+            ASSERT( x || y );
 
-    // Store new offset
-    job->offset = dstOffset;
+            const uint64 lp = droppedXBits ? DroppedXLinePoint( x >> droppedXBits, y >> droppedXBits ) :
+                                             SquareToLinePoint( x, y );
+            ASSERT( lp || droppedXBits );
+            ASSERT( ( lp >> LP_SORT_BUCKET_SHIFT ) < LP_SORT_BUCKETS );
 
-    // Copy our valid entries to the new buffer
-    uint32* map      = job->map + dstOffset;
-    Pair*   newPairs = (Pair*)(job->lpBuffer + dstOffset);
+            if( bucketThread )
+                bucketThread->counts[lp >> LP_SORT_BUCKET_SHIFT]++;
 
-    uint64 dstI = 0;
+            *((uint64*)rEntry) = lp;//SquareToLinePoint( x, y );
+        }
 
-    for( uint64 i = srcOffset; i < end; i++ )
+        if( bucketThread )
+            bucketThread->chunks[bucketThread->chunkCount++] = chunk;
+    }
+}
+
+// Sorts a bucket of line points on the bits below the bucket bits, along with their map.
+// The bucket is read from lpSrc and mapSrc, which are also used as scratch,
+// and the sorted entries end up in lpDst and mapDst.
+//-----------------------------------------------------------
+static void SortLinePointBucket( uint64* lpSrc, uint32* mapSrc, uint64* lpDst, uint32* mapDst, const uint64 length )
+{
+    constexpr uint   Radix  = 1u << LP_SORT_DIGIT_BITS;
+    constexpr uint   Passes = CDiv( LP_SORT_BUCKET_SHIFT, LP_SORT_DIGIT_BITS );
+    constexpr uint64 Mask   = Radix - 1;
+
+    ASSERT( length && length <= 0xFFFFFFFF );
+
+    // Count the digits of all passes in a single read of the bucket
+    uint32 counts[Passes][Radix];
+    memset( counts, 0, sizeof( counts ) );
+
+    for( uint64 i = 0; i < length; i++ )
     {
-        if( !markedEntries[i] )
+        const uint64 lp = lpSrc[i];
+
+        for( uint p = 0; p < Passes; p++ )
+            counts[p][( lp >> ( p * LP_SORT_DIGIT_BITS ) ) & Mask]++;
+    }
+
+    uint64* lpIn   = lpSrc;
+    uint32* mapIn  = mapSrc;
+    uint64* lpOut  = lpDst;
+    uint32* mapOut = mapDst;
+
+    uint32 pfxSum[Radix];
+
+    for( uint p = 0; p < Passes; p++ )
+    {
+        const uint shift = p * LP_SORT_DIGIT_BITS;
+
+        // Skip digits which are the same for the whole bucket
+        if( counts[p][( lpIn[0] >> shift ) & Mask] == length )
             continue;
-        
-        newPairs[dstI] = pairs[i];  // Copy to new location
-        map     [dstI] = (uint32)i; // Map the entry back to its original location
 
-        dstI++; 
+        uint32 sum = 0;
+        for( uint r = 0; r < Radix; r++ )
+        {
+            pfxSum[r] = sum;
+            sum += counts[p][r];
+        }
+
+        for( uint64 i = 0; i < length; i++ )
+        {
+            const uint64 lp  = lpIn[i];
+            const uint32 dst = pfxSum[( lp >> shift ) & Mask]++;
+
+            lpOut [dst] = lp;
+            mapOut[dst] = mapIn[i];
+        }
+
+        std::swap( lpIn , lpOut  );
+        std::swap( mapIn, mapOut );
     }
 
-    ASSERT( dstI == length );
+    if( lpIn != lpDst )
+    {
+        memcpy( lpDst , lpIn , sizeof( uint64 ) * length );
+        memcpy( mapDst, mapIn, sizeof( uint32 ) * length );
+    }
+
+    // The entries were distributed into the buckets in the order in which the threads
+    // converted them, not in table order. Order equal line points by their map,
+    // which is what a stable sort of the whole table yields.
+    for( uint64 i = 1; i < length; i++ )
+    {
+        const uint64 lp = lpDst[i];
+        if( lp != lpDst[i-1] )
+            continue;
+
+        const uint32 m = mapDst[i];
+        uint64 j = i;
+
+        for( ; j > 0 && lpDst[j-1] == lp && mapDst[j-1] > m; j-- )
+            mapDst[j] = mapDst[j-1];
+
+        mapDst[j] = m;
+    }
 }
 
 //-----------------------------------------------------------
-void ConverToLinePointThread( LPJob* job )
+template<bool PruneTable>
+void SortLinePointBucketsThread( LPJob* job, LPBucketThread& bucketThread )
 {
-    const uint64  length = job->length;
+    LPBuckets&    buckets     = *job->buckets;
+    LPChunks&     chunks      = *job->chunks;
+    const uint    threadId    = job->_threadId;
+    const uint    threadCount = job->_threadCount;
 
-    Pair*         rTable = (Pair*)(job->lpBuffer + job->offset);
-    const uint32* lTable = job->lTable;
+    // Wait for all the line points to be converted and counted
+    job->WaitForThreads();
 
-    for( uint64 i = 0; i < length; i++ )
+    // Each thread calculates where each thread's entries go
+    // within its own slice of the buckets.
     {
-        const Pair* rEntry = &rTable[i];
-        
-        const uint64 x = lTable[rEntry->left ];
-        const uint64 y = lTable[rEntry->right];
-        ASSERT( x || y );
+        const uint bucketStart = (uint)( (uint64)LP_SORT_BUCKETS * threadId       / threadCount );
+        const uint bucketEnd   = (uint)( (uint64)LP_SORT_BUCKETS * (threadId + 1) / threadCount );
+
+        for( uint b = bucketStart; b < bucketEnd; b++ )
+        {
+            uint64 offset = 0;
+
+            for( uint t = 0; t < threadCount; t++ )
+            {
+                buckets.threads[t]->offsets[b] = offset;
+                offset += buckets.threads[t]->counts[b];
+            }
+
+            buckets.starts[b+1] = offset;   // Bucket length, for now
+        }
+    }
+
+    job->WaitForThreads();
+
+    if( threadId == 0 )
+    {
+        buckets.starts[0] = 0;
+        for( uint b = 0; b < LP_SORT_BUCKETS; b++ )
+            buckets.starts[b+1] += buckets.starts[b];
+
+        ASSERT( buckets.starts[LP_SORT_BUCKETS] == chunks.offsets[chunks.linePoint.ChunkCount()] );
+    }
+
+    job->WaitForThreads();
+
+    ///
+    /// Distribute our chunks into the buckets
+    ///
+    uint64* offsets = bucketThread.offsets;
+
+    for( uint b = 0; b < LP_SORT_BUCKETS; b++ )
+        offsets[b] += buckets.starts[b];
+
+    uint64* lpBuffer = job->lpBuffer;
+    uint32* map      = job->map;
+    uint64* lpTmp    = buckets.lpTmp;
+    uint32* mapTmp   = buckets.mapTmp;
+
+    for( uint c = 0; c < bucketThread.chunkCount; c++ )
+    {
+        const uint   chunk = bucketThread.chunks[c];
+        const uint64 end   = chunks.offsets[chunk+1];
+
+        for( uint64 i = chunks.offsets[chunk]; i < end; i++ )
+        {
+            const uint64 lp  = lpBuffer[i];
+            const uint64 dst = offsets[lp >> LP_SORT_BUCKET_SHIFT]++;
+
+            lpTmp [dst] = lp;
+
+            // Table 6 is not pruned, so its map is just the original index
+            if constexpr ( PruneTable )
+                mapTmp[dst] = map[i];
+            else
+                mapTmp[dst] = (uint32)i;
+        }
+    }
+
+    job->WaitForThreads();
+
+    ///
+    /// Sort each bucket back into lpBuffer and map
+    ///
+    uint bucket;
+    while( buckets.sort.Next( threadId, bucket ) )
+    {
+        const uint64 start  = buckets.starts[bucket];
+        const uint64 length = buckets.starts[bucket+1] - start;
 
-        const uint64 lp = SquareToLinePoint( x, y );
-        ASSERT( lp );
-        *((uint64*)rEntry) = lp;//SquareToLinePoint( x, y );
+        if( length )
+            SortLinePointBucket( lpTmp + start, mapTmp + start, lpBuffer + start, map + start, length );
     }
 }
 
@@ -1,21 +1,41 @@
 #pragma once
 #include "PlotContext.h"
 
+class Thread;
+
 class MemPhase3
 {
     friend class MemPlotter;
 public:
 
     MemPhase3( MemPlotContext& context );
+    ~MemPhase3();
 
     void Run();
 
 private:
-    template<bool IsTable6>
+    template<bool IsTable6, typename TPair>
     uint64 ProcessTable( uint32* lEntries, uint64* lpBuffer,
-                         Pair* rTable, const uint64 rTableCount, 
-                         const byte* markedEntries, TableId tableId );
+                         TPair* rTable, const uint64 rTableCount, 
+                         const uint64* markedEntries, TableId tableId );
+
+    // Encodes a table's sorted line points into parks, and sends them to the plot writer
+    void WriteTableParks( ThreadPool& pool, uint64* lpBuffer, uint64 length, byte* parkBuffer, TableId tableId );
+
+    // Encodes a table's parks on the park pool, in the background, while the next table is pruned and converted.
+    // The line points and the park buffer must not be touched until EndParks() returns.
+    void BeginParks( uint64* lpBuffer, uint64 length, byte* parkBuffer, TableId tableId );
+
+    // Waits for the parks started with BeginParks(), if any
+    void EndParks();
 
 private:
     MemPlotContext& _context;
+
+    // The table whose parks are being encoded in the background
+    TaskHandle      _parkTask;
+    uint64*         _parkLinePoints;
+    uint64          _parkLength;
+    byte*           _parkBuffer;
+    TableId         _parkTableId;
 };
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include "MemPhase4.h"
 #include "CTables.h"
 #include "util/Log.h"
+#include "util/Profiler.h"
 
 //-----------------------------------------------------------
 MemPhase4::MemPhase4( MemPlotContext& context )
@@ -10,18 +11,87 @@ MemPhase4::MemPhase4( MemPlotContext& context )
 //-----------------------------------------------------------
 void MemPhase4::Run()
 {
-    // Use meta0 to write the final tables to disk
+    // The final tables are written from their own buffer, which
+    // is held until the plot is written, along with table 6's parks.
     MemPlotContext& cx = _context;
     
-    // The first 32 GiB of meta0 are used by phase 3 to write the table 6 park,
-    // so we need to offset here to write the rest.
-    cx.p4WriteBuffer = ((byte*)cx.metaBuffer0) + 32ull GB;
+    cx.p4WriteBuffer       = cx.p4TableBuffer;
     cx.p4WriteBufferWriter = cx.p4WriteBuffer;
 
     WriteP7();
-    WriteC1();
-    WriteC2();
-    WriteC3();
+
+    if( cx.cTablesBuilt )
+    {
+        WriteBuiltCTable( 0, "C1" );
+        WriteBuiltCTable( 1, "C2" );
+        WriteBuiltCTable( 2, "C3" );
+
+        cx.cTablesBuilt = false;
+    }
+    else
+    {
+        WriteC1();
+        WriteC2();
+        WriteC3();
+    }
+
+    ASSERT( cx.p4WriteBufferWriter <= cx.p4TableBuffer + GetP4TableBufferSize( ENTRIES_PER_TABLE ) );
+}
+
+//-----------------------------------------------------------
+void MemPhase4::BuildCTables()
+{
+    MemPlotContext& cx = _context;
+
+    const uint64 entryCount = cx.entryCount[(int)TableId::Table7];
+    DiskPlotWriter& writer  = *cx.plotWriter;
+
+    // Lay out the tables as Run() does, after where P7 will be written
+    byte* p7Buffer = writer.AlignPointerToBlockSize<byte>( cx.p4TableBuffer );
+    
+    const size_t c1Size = ( CDiv( entryCount, kCheckpoint1Interval ) + 1 ) * sizeof( uint32 );
+    const size_t c2Size = ( CDiv( entryCount, kCheckpoint1Interval * kCheckpoint2Interval ) + 1 ) * sizeof( uint32 );
+    const size_t c3Size = GetC3ParkCount( entryCount ) * CalculateC3Size();
+
+    byte* c1Buffer = writer.AlignPointerToBlockSize<byte>( p7Buffer + GetP7Size( entryCount ) );
+    byte* c2Buffer = writer.AlignPointerToBlockSize<byte>( c1Buffer + c1Size );
+    byte* c3Buffer = writer.AlignPointerToBlockSize<byte>( c2Buffer + c2Size );
+
+    Log::Line( "  Building C1, C2 and C3 tables." );
+    auto timer = TimerBegin();
+    ProfileScope scope( cx.profiler, "c_tables" );
+
+    WriteCTablesParallel<MAX_THREADS>( *cx.threadPool, entryCount, cx.t7YBuffer,
+                                       (uint32*)c1Buffer, (uint32*)c2Buffer, c3Buffer );
+
+    cx.cTableBuffers[0] = c1Buffer;
+    cx.cTableBuffers[1] = c2Buffer;
+    cx.cTableBuffers[2] = c3Buffer;
+    cx.cTableSizes  [0] = c1Size;
+    cx.cTableSizes  [1] = c2Size;
+    cx.cTableSizes  [2] = c3Size;
+    cx.cTablesBuilt     = true;
+
+    double elapsed = TimerEnd( timer );
+    Log::Line( "  Finished building C1, C2 and C3 tables in %.2lf seconds.", elapsed );
+}
+
+//-----------------------------------------------------------
+void MemPhase4::WriteBuiltCTable( int index, const char* name )
+{
+    MemPlotContext& cx = _context;
+
+    byte*        buffer = cx.cTableBuffers[index];
+    const size_t size   = cx.cTableSizes[index];
+
+    // Must match the layout of WriteC1-3
+    ASSERT( buffer == cx.plotWriter->AlignPointerToBlockSize<byte>( cx.p4WriteBufferWriter ) );
+    cx.p4WriteBufferWriter = buffer + size;
+
+    Log::Line( "  Writing %s table.", name );
+
+    if( !cx.plotWriter->WriteTable( buffer, size ) )
+        Fatal( "Failed to write %s to disk.", name );
 }
 
 //-----------------------------------------------------------
@@ -38,6 +108,7 @@ void MemPhase4::WriteP7()
     
     Log::Line( "  Writing P7." );
     auto timer = TimerBegin();
+    ProfileScope scope( cx.profiler, "p7" );
 
     const size_t sizeWritten = WriteP7Parallel<MAX_THREADS>( *cx.threadPool, entryCount, lTable, p7Buffer );
     
@@ -60,6 +131,7 @@ void MemPhase4::WriteC1()
 
     Log::Line( "  Writing C1 table." );
     auto timer = TimerBegin();
+    ProfileScope scope( cx.profiler, "c1" );
 
     const size_t sizeWritten = WriteC12Parallel<MAX_THREADS, kCheckpoint1Interval>( 
         *cx.threadPool, entryCount, cx.t7YBuffer, writeBuffer );
@@ -83,6 +155,7 @@ void MemPhase4::WriteC2()
 
     Log::Line( "  Writing C2 table." );
     auto timer = TimerBegin();
+    ProfileScope scope( cx.profiler, "c2" );
 
     const size_t sizeWritten = WriteC12Parallel<MAX_THREADS, kCheckpoint1Interval*kCheckpoint2Interval>( 
         *cx.threadPool, entryCount, cx.t7YBuffer, writeBuffer );
@@ -106,6 +179,7 @@ void MemPhase4::WriteC3()
 
     Log::Line( "  Writing C3 table." );
     auto timer = TimerBegin();
+    ProfileScope scope( cx.profiler, "c3" );
 
     const size_t sizeWritten = WriteC3Parallel<MAX_THREADS>( 
          *cx.threadPool, entryCount, cx.t7YBuffer, writeBuffer );
@@ -1,6 +1,10 @@
 #pragma once
 #include "PlotContext.h"
 #include "CTables.h"
+#include <vector>
+
+// Largest plot file block size that Phase 4's tables are aligned to
+#define BB_P4_MAX_BLOCK_SIZE ( 1ull MB )
 
 class MemPhase4
 {
@@ -16,6 +20,14 @@ public:
     void WriteC2();
     void WriteC3();
 
+    // Builds the C1, C2 and C3 tables in a single pass over the sorted f7 entries,
+    // into the buffers Run() would write them to, so that Run() only has to submit them.
+    // #NOTE: The f7 entries are overwritten by the C3 deltas.
+    void BuildCTables();
+
+private:
+    void WriteBuiltCTable( int index, const char* name );
+
 private:
     MemPlotContext& _context;
 };
@@ -45,11 +57,24 @@ struct C3Job
     byte*   writeBuffer;
 };
 
+struct CTablesJob
+{
+    uint64  length;         // Total f7 entry count
+    uint64  parkStart;      // This thread's C3 parks (C1 entries): [parkStart, parkEnd)
+    uint64  parkEnd;
+    uint32* f7Entries;
+    uint32* c1Buffer;
+    uint32* c2Buffer;
+    byte*   c3Buffer;
+};
+
 // P7
 template<uint MAX_JOBS>
 size_t WriteP7Parallel( ThreadPool& pool, const uint64 length, 
                         const uint32* indices, byte* parkBuffer );
 
+size_t GetP7Size( const uint64 length );
+size_t GetP4TableBufferSize( const uint64 length );
 void WriteP7Parks( const uint64 parkCount, const uint32* indices, byte* parkBuffer );
 void WriteP7Entries( const uint64 length, const uint32* indices, byte* parkBuffer );
 
@@ -71,6 +96,11 @@ size_t WriteC3Parallel( ThreadPool& pool, const uint64 length, uint32* f7Entries
 void WriteC3Parks( const uint64 parkCount, uint32* f7Entries, byte* writeBuffer );
 void WriteC3Park( const uint64 length, uint32* f7Entries, byte* parkBuffer );
 
+// C1, C2 & C3 in a single pass
+template<uint MAX_JOBS>
+void WriteCTablesParallel( ThreadPool& pool, const uint64 length, uint32* f7Entries,
+                           uint32* c1Buffer, uint32* c2Buffer, byte* c3Buffer );
+
 
 ///
 /// P7
@@ -105,11 +135,12 @@ inline size_t WriteP7Parallel( ThreadPool& pool, const uint64 length, const uint
      *          = 67584 / 8
      *          = 8448 / 8
      *          = 1056 64-bit fields
+     *        This holds for any k, as kEntriesPerPark is a multiple of 64.
      */
     const size_t parkSize = CDiv( (_K + 1) * kEntriesPerPark, 8 );
-    static_assert( parkSize / 8 == 1056 );
+    static_assert( parkSize % 8 == 0 );
     
-    P7Job jobs[MAX_JOBS];
+    std::vector<P7Job> jobs( threadCount );
 
     const uint32* threadIndices    = indices;
     byte*         threadParkBuffer = parkBuffer;
@@ -134,7 +165,7 @@ inline size_t WriteP7Parallel( ThreadPool& pool, const uint64 length, const uint
     }
 
     // Run jobs
-    pool.RunJob( WriteP7Thread, jobs, threadCount );
+    pool.RunJob( WriteP7Thread, jobs.data(), threadCount );
 
     // Write trailing entries into a park, if we have any
     if( trailingEntries )
@@ -146,6 +177,26 @@ inline size_t WriteP7Parallel( ThreadPool& pool, const uint64 length, const uint
     return totalParksWritten * parkSize;
 }
 
+//-----------------------------------------------------------
+inline size_t GetP7Size( const uint64 length )
+{
+    const size_t parkSize = CDiv( (_K + 1) * kEntriesPerPark, 8 );
+    return CDiv( length, kEntriesPerPark ) * parkSize;
+}
+
+// Size of the buffer P7 and the C tables are written from, for up to length f7 entries.
+// Each table starts on a block of the plot file, so there's room to align each of them,
+// and one more block to round up the last one, as the Phase 3 snapshot does.
+//-----------------------------------------------------------
+inline size_t GetP4TableBufferSize( const uint64 length )
+{
+    const size_t c1Size = ( CDiv( length, kCheckpoint1Interval ) + 1 ) * sizeof( uint32 );
+    const size_t c2Size = ( CDiv( length, kCheckpoint1Interval * kCheckpoint2Interval ) + 1 ) * sizeof( uint32 );
+    const size_t c3Size = GetC3ParkCount( length ) * CalculateC3Size();
+
+    return GetP7Size( length ) + c1Size + c2Size + c3Size + 5 * BB_P4_MAX_BLOCK_SIZE;
+}
+
 //-----------------------------------------------------------
 inline void WriteP7Parks( const uint64 parkCount, const uint32* indices, byte* parkBuffer )
 {
@@ -219,6 +270,13 @@ inline void WriteP7Entries( const uint64 length, const uint32* indices, byte* pa
 ///
 /// C1 & C2
 ///
+// C1 and C2 entries are k bits, padded to 4 bytes at the end (big endian), as in chiapos
+//-----------------------------------------------------------
+inline uint32 ToCEntry( const uint32 f7 )
+{
+    return Swap32( f7 << ( 32 - _K ) );
+}
+
 //-----------------------------------------------------------
 template<uint CInterval>
 inline void WriteC12Thread( C12Job* job )
@@ -237,7 +295,7 @@ inline size_t WriteC12Parallel( ThreadPool& pool, const uint64 length,
     const uint64 entriesPerThread = parkEntries / threadCount;
     const uint64 trailingEntries  = parkEntries - (entriesPerThread * threadCount);
 
-    C12Job jobs[MAX_JOBS];
+    std::vector<C12Job> jobs( threadCount );
 
     const uint32* threadf7Entries = f7Entries;
     uint32*       parkWriter      = parkBuffer;
@@ -258,7 +316,7 @@ inline size_t WriteC12Parallel( ThreadPool& pool, const uint64 length,
         parkWriter      += entriesPerThread;
     }
 
-    pool.RunJob( WriteC12Thread<CInterval>, jobs, threadCount );
+    pool.RunJob( WriteC12Thread<CInterval>, jobs.data(), threadCount );
 
     // Write trailing entries, if any
     if( trailingEntries )
@@ -271,8 +329,8 @@ inline size_t WriteC12Parallel( ThreadPool& pool, const uint64 length,
         //  the C3 pointer by the C2 pointer. This does not work for us
         //  because since we do block-aligned writes we, our C2 size disk-occupied size
         //  will most likely be greater than the actual C2 size. 
-        //  To work around this, we can add a trailing entry with the maximum k32 value size.
-        //  This will force chiapos to stop at that point as the f7 is lesser than max k32 value.
+        //  To work around this, we can add a trailing entry with the maximum k-bit value.
+        //  This will force chiapos to stop at that point as the f7 is lesser than the max k-bit value.
         //  #IMPORTANT: This means that we can't have any f7's that are 0xFFFFFFFF!.
         parkWriter[trailingEntries] = 0xFFFFFFFF;
     }
@@ -292,7 +350,7 @@ inline void WriteC12Entries( const uint64 length, const uint32* f7Entries, uint3
 {
     uint64 f7Src = 0;
     for( uint64 i = 0; i < length; i++, f7Src += CInterval )
-        c1Buffer[i] = Swap32( f7Entries[f7Src] );
+        c1Buffer[i] = ToCEntry( f7Entries[f7Src] );
 }
 
 
@@ -351,7 +409,7 @@ inline size_t WriteC3Parallel( ThreadPool& pool, const uint64 length, uint32* f7
     
     const size_t c3Size = CalculateC3Size();
 
-    C3Job jobs[MAX_JOBS];
+    std::vector<C3Job> jobs( threadCount );
 
     uint32* threadF7Entries = f7Entries;
     byte*   threadC3Buffer  = c3Buffer;
@@ -376,7 +434,7 @@ inline size_t WriteC3Parallel( ThreadPool& pool, const uint64 length, uint32* f7
     }
 
     // Run jobs
-    pool.RunJob( WriteC3Thread, jobs, threadCount );
+    pool.RunJob( WriteC3Thread, jobs.data(), threadCount );
 
     // Write any trailing entries to a park
     if( hasTrailingEntries )
@@ -435,10 +493,91 @@ inline void WriteC3Park( const uint64 length, uint32* f7Entries, byte* parkBuffe
     // Store size in the first 2 bytes
     *((uint16*)parkBuffer) = Swap16( (uint16)compressedSize );
 
-    // Zero-out remainder (not necessarry, though...)
+    // Zero-out the remainder, so that the plot does not depend on what was left in the buffer
     const size_t remainder = c3Size - (compressedSize + 2);
     if( remainder )
-        memset( deltaWriter + compressedSize + 2, 0, remainder );
+        memset( parkBuffer + compressedSize + 2, 0, remainder );
+}
+
+
+
+
+///
+/// C1, C2 & C3
+///
+
+//-----------------------------------------------------------
+inline void WriteCTablesThread( CTablesJob* job )
+{
+    const uint64 length    = job->length;
+    uint32*      f7Entries = job->f7Entries;
+    uint32*      c1Buffer  = job->c1Buffer;
+    uint32*      c2Buffer  = job->c2Buffer;
+    byte*        c3Buffer  = job->c3Buffer;
+
+    const size_t c3Size    = CalculateC3Size();
+
+    for( uint64 park = job->parkStart; park < job->parkEnd; park++ )
+    {
+        uint32*      parkF7      = f7Entries + park * kCheckpoint1Interval;
+        const uint64 parkEntries = std::min( length - park * kCheckpoint1Interval, (uint64)kCheckpoint1Interval );
+        const uint32 c1          = ToCEntry( *parkF7 );
+
+        // Every C2 entry is also a C1 entry
+        c1Buffer[park] = c1;
+
+        if( park % kCheckpoint2Interval == 0 )
+            c2Buffer[park / kCheckpoint2Interval] = c1;
+
+        // The first entry is stored in C1, so a park needs at least 1 delta.
+        // The deltas only overwrite this park's own f7 entries.
+        if( parkEntries > 1 )
+            WriteC3Park( parkEntries-1, parkF7, c3Buffer + park * c3Size );
+    }
 }
 
+//-----------------------------------------------------------
+template<uint MAX_JOBS>
+inline void WriteCTablesParallel( ThreadPool& pool, const uint64 length, uint32* f7Entries,
+                                  uint32* c1Buffer, uint32* c2Buffer, byte* c3Buffer )
+{
+    const uint32 threadCount    = std::min( pool.ThreadCount(), MAX_JOBS );
+
+    // There's one C1 entry per C3 park, including the last one, which may not get a C3 park.
+    const uint64 parkCount      = CDiv( length, kCheckpoint1Interval );
+    const uint64 parksPerThread = parkCount / threadCount;
+
+    uint64 trailingParks = parkCount - ( parksPerThread * threadCount );
+    
+    std::vector<CTablesJob> jobs( threadCount );
+
+    uint64 parkStart = 0;
+
+    for( uint32 i = 0; i < threadCount; i++ )
+    {
+        auto& job = jobs[i];
+
+        job.length    = length;
+        job.parkStart = parkStart;
+        job.parkEnd   = parkStart + parksPerThread;
+        job.f7Entries = f7Entries;
+        job.c1Buffer  = c1Buffer;
+        job.c2Buffer  = c2Buffer;
+        job.c3Buffer  = c3Buffer;
+
+        // Distribute trailing parks accross threads
+        if( trailingParks )
+        {
+            job.parkEnd ++;
+            trailingParks --;
+        }
+
+        parkStart = job.parkEnd;
+    }
+
+    pool.RunJob( WriteCTablesThread, jobs.data(), threadCount );
 
+    // Trailing entries, as in WriteC12Parallel
+    c1Buffer[parkCount]                               = 0;
+    c2Buffer[CDiv( parkCount, kCheckpoint2Interval )] = 0xFFFFFFFF;
+}
@@ -1,5 +1,6 @@
 #include "MemPlotter.h"
 #include "threading/ThreadPool.h"
+#include "threading/Thread.h"
 #include "Util.h"
 #include "util/Log.h"
 #include "SysHost.h"
@@ -8,13 +9,60 @@
 #include "MemPhase2.h"
 #include "MemPhase3.h"
 #include "MemPhase4.h"
-
+#include "TableSpiller.h"
+#include "BufferPlanner.h"
+#include "io/NetSink.h"
+#include "PlotDigest.h"
+#include "PlotMover.h"
+#include "PlotPreparer.h"
+#include "ThreadPolicy.h"
+#include "util/Profiler.h"
+#include "util/Metrics.h"
+#include "util/Trace.h"
+#include "PhaseCache.h"
+#include "PlotCheckpoint.h"
+#include "util/Baseline.h"
+#include "gpu/GpuCompute.h"
+#include "KernelDispatch.h"
+#include "RankIndex.h"
+#include "PlotValidator.h"
+#include <algorithm>
+#include <vector>
+
+// Memory left for the stacks and smaller allocations when selecting a configuration
+#define BB_AUTO_MEMORY_HEADROOM ( 1ull GB )
+
+// Bytes copied to measure the memory copy rate
+#define BB_AUTO_PROBE_SIZE ( 1ull GB )
+
+// Memory traffic of a plot per entry, as seen by a memory copy of the same rate.
+// It only serves to predict the plot time, so it's a rough figure:
+// k32 plots take about 6 minutes on hosts that copy memory at 100 GB/s.
+#define BB_PLOT_TRAFFIC_PER_ENTRY 8400.0
+
+// Pages of each buffer whose node is queried when reporting the NUMA placement
+#define BB_NUMA_REPORT_SAMPLES 1024
 
 //----------------------------------------------------------
-MemPlotter::MemPlotter( const MemPlotConfig& cfg )
+MemPlotter::MemPlotter( const MemPlotConfig& inCfg )
 {
     ZeroMem( &_context );
 
+    // Select the kernels before any thread runs them
+    KernelDispatch::Resolve( inCfg.simdLevel );
+    KernelDispatch::LogSelected();
+
+    // Pick the fastest configuration that fits, before anything is set up from it
+    MemPlotConfig cfg = inCfg;
+
+    if( cfg.autoMode )
+        SelectMode( cfg );
+
+#if PLATFORM_IS_UNIX
+    if( !NetSink::LoadKey( cfg.netSecretPath, _netKey ) )
+        Fatal( "Failed to read a secret from '%s'.", cfg.netSecretPath );
+#endif
+
     const bool warmStart = cfg.warmStart;
 
     const NumaInfo* numa = nullptr;
@@ -30,10 +78,175 @@ MemPlotter::MemPlotter( const MemPlotConfig& cfg )
         //     Log::Error( "Warning: Failed to set NUMA interleaved mode." );
     }
 
-    _context.threadCount = cfg.threadCount;
+    // Memory-only nodes, such as CXL expanders, have less bandwidth than the local ones,
+    // so they get the tables that are written once and only read back by Phases 2 and 3.
+    // The other buffers are kept off them, even when interleaved.
+    if( cfg.farMemory )
+    {
+        const uint farNodeCount = SysHost::EnableFarMemoryTier();
+
+        if( farNodeCount )
+            Log::Line( "Placing tables 2-6 on %u far memory node(s).", farNodeCount );
+        else
+        {
+            Log::Line( "Warning: No far memory nodes found. Tables 2-6 are placed as usual." );
+            cfg.farMemory = false;
+        }
+    }
+
+    _context.threadCount    = cfg.threadCount;
+    _context.numa           = cfg.noCPUAffinity ? nullptr : numa;
+    _context.fusedF1        = cfg.fusedF1;
+    _context.bucketedFp     = cfg.bucketedFp;
+    _context.packedFxSort   = cfg.packedFxSort;
+    _context.blockedMap     = cfg.blockedMap;
+    _context.inPlaceSort    = cfg.inPlaceSort;
+    _context.fusedPrune     = cfg.fusedPrune;
+    _context.bucketedLpSort = cfg.bucketedLpSort;
+    _context.binnedLookup   = cfg.binnedLookup;
+    _context.streamParks    = cfg.streamParks;
+    _context.fusedCheckpoints = cfg.fusedCheckpoints;
+    _context.noAsyncIO      = cfg.noAsyncIO;
+    _context.pipeline       = cfg.pipeline;
+    _context.preallocatePlot = cfg.preallocatePlot;
+    _context.digestPlot = cfg.digestPlot;
+    _context.droppedXBits = cfg.droppedXBits;
+
+    if( cfg.droppedXBits )
+    {
+        FatalIf( cfg.droppedXBits > BB_MAX_DROPPED_X_BITS, "At most %u x bits may be dropped.", BB_MAX_DROPPED_X_BITS );
+
+        Log::Line( "Dropping %u bits from table 1's x's. The plots will be in the '%s%u' format, which chiapos does not read.",
+                   cfg.droppedXBits, kDroppedXFormatPrefix, cfg.droppedXBits );
+    }
+
+    if( cfg.moveDirCount > 0 )
+    {
+        Log::Line( "Moving finished plots to %u destination(s).", cfg.moveDirCount );
+        _context.plotMover = new PlotMover( cfg.moveDirs, cfg.moveDirCount, (uint64)cfg.moveBandwidth * 1024 * 1024 );
+    }
+
+    // The pipelined F1 is generated into the y buffers during Phases 3 and 4,
+    // so Phase 3 sorts in place rather than adding its temporary buffer to them.
+    if( cfg.pipeline && !cfg.inPlaceSort )
+    {
+        Log::Line( "Pipelining enables in-place sorting." );
+        cfg.inPlaceSort      = true;
+        _context.inPlaceSort = true;
+    }
+
+    FatalIf( cfg.outputDirCount > BB_MAX_OUTPUT_DIRS, 
+        "Too many output directories specified. A maximum of %u is supported.", BB_MAX_OUTPUT_DIRS );
+
+    _outputDirCount = cfg.outputDirCount;
+    for( uint i = 0; i < cfg.outputDirCount; i++ )
+        _outputDirs[i] = cfg.outputDirs[i];
+
+    if( _outputDirCount == 0 )
+    {
+        _outputDirs[0]  = "";
+        _outputDirCount = 1;
+    }
+
+    // Start from the first directory
+    _lastOutputDir = _outputDirCount - 1;
+
+    // Nothing is written when benchmarking
+    if( cfg.prepareOutput && !cfg.benchmark )
+    {
+        FileFlags flags = FileFlags::NoBuffering | FileFlags::LargeFile;
+        if( !cfg.noAsyncIO )
+            flags |= FileFlags::AsyncIO;
+
+        Log::Line( "Preparing each plot's file in the background." );
+        _preparer = new PlotPreparer( _outputDirs, _outputDirCount, flags );
+    }
     
     // Create a thread pool
-    _context.threadPool = new ThreadPool( cfg.threadCount, ThreadPool::Mode::Fixed, cfg.noCPUAffinity );
+    _context.threadPool     = new ThreadPool( cfg.threadCount, ThreadPool::Mode::Fixed, cfg.noCPUAffinity );
+    _context.threadPool->SetSpinTime( cfg.spinTime );
+
+    _context.threadPolicy = new ThreadPolicy( *_context.threadPool, cfg.kernelThreads, cfg.kernelThreadCount,
+                                              cfg.tuneThreads, cfg.threadCachePath );
+
+    // Without a usable GPU, F1 and Fx stay on the CPU
+    if( cfg.gpuDevice >= 0 )
+        _context.gpu = GpuCompute::Create( cfg.gpuDevice );
+
+    if( cfg.benchmark )
+    {
+        _benchmark       = true;
+        _benchFirstPhase = cfg.benchFirstPhase;
+        _benchLastPhase  = cfg.benchLastPhase;
+        _benchCacheDir   = cfg.benchCacheDir;
+        _benchBaseline   = cfg.benchBaseline;
+        _benchSaveBaseline = cfg.benchSaveBaseline;
+        _benchThreshold  = cfg.benchThreshold;
+
+        FatalIf( _benchFirstPhase < 1 || _benchFirstPhase > 4 || _benchLastPhase < _benchFirstPhase || _benchLastPhase > 4,
+                 "Invalid benchmark phase range %u-%u.", _benchFirstPhase, _benchLastPhase );
+        FatalIf( _benchFirstPhase > 1 && !_benchCacheDir, "Benchmarking from Phase %u needs a phase cache.", _benchFirstPhase );
+        FatalIf( _benchCacheDir && ( cfg.spillPathCount || cfg.compressTables ), "The phase cache can't be used with spilled or compressed tables." );
+        FatalIf( _benchFirstPhase > 1 && cfg.pipeline, "Pipelining needs Phase 1 to be benchmarked." );
+
+        Log::Line( "Benchmarking Phases %u-%u. Plots are not written.", _benchFirstPhase, _benchLastPhase );
+    }
+
+    if( cfg.checkpointDir )
+    {
+        FatalIf( cfg.benchmark, "Checkpoints can't be used when benchmarking." );
+        FatalIf( cfg.spillPathCount || cfg.compressTables, "Checkpoints can't be used with spilled or compressed tables." );
+
+        Log::Line( "Checkpointing plots to %s", cfg.checkpointDir );
+        _context.checkpoint = new PlotCheckpoint( cfg.checkpointDir );
+    }
+
+    FatalIf( cfg.memBandwidth && !cfg.profileDir, "Memory bandwidth is only counted for profiles. Use --profile." );
+
+    if( cfg.profileDir )
+    {
+        _profileDir       = cfg.profileDir;
+        _context.profiler = new Profiler( *_context.threadPool, cfg.perfCounters, cfg.memBandwidth );
+    }
+
+    if( cfg.traceDir )
+    {
+        _traceDir = cfg.traceDir;
+        Trace::Enable();
+        Trace::NameThread( "plotter" );
+    }
+
+    _selfCheckProofs = cfg.selfCheckProofs;
+    _hostCoordinator = cfg.coordinator;
+
+    if( cfg.metricsAddress )
+    {
+    #if PLATFORM_IS_UNIX
+        _context.metrics = new PlotMetrics();
+        _metricsServer   = new MetricsServer( *_context.metrics, *_context.threadPool );
+
+        if( !_metricsServer->Start( cfg.metricsAddress ) )
+            Fatal( "Failed to start the metrics server." );
+    #else
+        Log::Error( "Warning: The metrics server is not supported on this platform." );
+    #endif
+    }
+
+    // The next plot's F1 runs alongside Phases 3 and 4, so it gets half as many threads.
+    // It's submitted as a task, which then runs its jobs on the rest of the pool's threads.
+    // Task pools sleep when idle, instead of spinning, as they share the CPUs with the main pool.
+    if( cfg.pipeline )
+        _pipelinePool = new ThreadPool( std::max( 1u, cfg.threadCount / 2 ), ThreadPool::Mode::Stealing, true );
+
+    // A table's parks are encoded alongside the next table's line point conversion,
+    // which keeps the rest of the threads.
+    if( cfg.overlapParks )
+    {
+        _parkPool = new ThreadPool( std::max( 1u, cfg.threadCount / 4 ), ThreadPool::Mode::Stealing, true );
+        _context.parkPool = _parkPool;
+
+        Log::Line( "Encoding Phase 3's parks in the background with %u threads.", _parkPool->ThreadCount() );
+    }
 
     // Allocate buffers
     {
@@ -42,78 +255,432 @@ MemPlotter::MemPlotter( const MemPlotConfig& cfg )
 
         Log::Line( "System Memory: %llu/%llu GiB.", availMemory BtoGB , totalMemory BtoGB );
 
-        // YBuffers need to round up to chacha block size, so we just add an extra block always
-        const size_t chachaBlockSize  = kF1BlockSizeBits / 8;
-
-        const size_t t1XBuffer   = 16ull GB;
-        const size_t t2LRBuffer  = 32ull GB;
-        const size_t t3LRBuffer  = 32ull GB;
-        const size_t t4LRBuffer  = 32ull GB;
-        const size_t t5LRBuffer  = 32ull GB;
-        const size_t t6LRBuffer  = 32ull GB;
-        const size_t t7LRBuffer  = 32ull GB;
-        const size_t t7YBuffer   = 16ull GB;
-
-        const size_t yBuffer0    = 32ull GB + chachaBlockSize;
-        const size_t yBuffer1    = 32ull GB + chachaBlockSize;
-        const size_t metaBuffer0 = 64ull GB;
-        const size_t metaBuffer1 = 64ull GB;
-
-        const size_t reqMem = 
-            t1XBuffer   +
-            t2LRBuffer  +
-            t3LRBuffer  +
-            t4LRBuffer  +
-            t5LRBuffer  +
-            t6LRBuffer  +
-            t7LRBuffer  +
-            t7YBuffer   +
-            yBuffer0    +
-            yBuffer1    +
-            metaBuffer0 +
-            metaBuffer1;
+        BufferPlanner planner( SysHost::GetPageSize() );
+        const size_t  reqMem = PlanBuffers( planner, cfg, _context );
+
+        // The compressed tables are allocated as they're compressed
+        const size_t compressedMem = cfg.compressTables ? 5 * PairCodec::EstimateSize( ENTRIES_PER_TABLE ) : 0;
 
         Log::Line( "Memory required: %llu GiB.", reqMem BtoGB );
-        if( availMemory < reqMem  )
+        if( compressedMem )
+            Log::Line( " Plus about %.2lf GiB for the compressed tables.", (double)compressedMem BtoGB );
+
+        if( availMemory < reqMem + compressedMem && !cfg.autoMode )
             Log::Line( "Warning: Not enough memory available. Buffer allocation may fail." );
 
+        planner.PrintPlan();
+
         Log::Line( "Allocating buffers." );
-        _context.t1XBuffer   = SafeAlloc<uint32>( t1XBuffer  , warmStart, numa );
+        const PageBacking maxBacking = cfg.hugePages ? PageBacking::Huge : PageBacking::Regular;
+
+        // When placing by first-touch, don't interleave the pages, 
+        // each thread binds its slices to its own node instead.
+        // When placing per buffer, each buffer is bound by its own policy.
+        const bool firstTouch = numa && cfg.numaFirstTouch;
+        const bool perBuffer  = numa && cfg.numaPerBuffer && !firstTouch;
+
+        PageBacking backing;
+        byte* arena = SafeAlloc<byte>( reqMem, maxBacking, firstTouch || perBuffer ? nullptr : numa, backing );
+        planner.Assign( arena );
 
-        _context.t2LRBuffer  = SafeAlloc<Pair>  ( t2LRBuffer , warmStart, numa );
-        _context.t3LRBuffer  = SafeAlloc<Pair>  ( t3LRBuffer , warmStart, numa );
-        _context.t4LRBuffer  = SafeAlloc<Pair>  ( t4LRBuffer , warmStart, numa );
-        _context.t5LRBuffer  = SafeAlloc<Pair>  ( t5LRBuffer , warmStart, numa );
-        _context.t6LRBuffer  = SafeAlloc<Pair>  ( t6LRBuffer , warmStart, numa );
+        const size_t pageSize = backing == PageBacking::Huge  ? 1ull GB :
+                                backing == PageBacking::Large ? 2ull MB : SysHost::GetPageSize();
 
-        _context.t7YBuffer   = SafeAlloc<uint32>( t7YBuffer  , warmStart, numa );
-        _context.t7LRBuffer  = SafeAlloc<Pair>  ( t7LRBuffer , warmStart, numa );
+        if( numa )
+        {
+            _numa         = numa;
+            _numaMode     = firstTouch ? "first-touch" : perBuffer ? "per-buffer" : "interleaved";
+            _numaPageSize = pageSize;
+            _numaReport   = cfg.numaReport;
+
+            PlanNumaRegions( planner );
+
+            if( perBuffer )
+            {
+                Log::Line( "Placing buffers across NUMA nodes by their access pattern." );
+                PlaceNumaRegions();
+            }
+        }
+
+        // After the NUMA placement, which they override
+        if( cfg.farMemory )
+            PlaceFarBuffers( planner, pageSize );
+
+        if( cfg.releaseMemory )
+        {
+            _releaseMemory = true;
+            _backing       = backing;
+            PlanMemorySegments( planner );
+        }
+
+        if( warmStart || firstTouch )
+        {
+            Log::Line( "Faulting buffer pages%s.", firstTouch ? " with first-touch NUMA placement" : "" );
+            auto timer = TimerBegin();
 
-        _context.yBuffer0    = SafeAlloc<uint64>( yBuffer0   , warmStart, numa );
-        _context.yBuffer1    = SafeAlloc<uint64>( yBuffer1   , warmStart, numa );
-        _context.metaBuffer0 = SafeAlloc<uint64>( metaBuffer0, warmStart, numa );
-        _context.metaBuffer1 = SafeAlloc<uint64>( metaBuffer1, warmStart, numa );
+            for( uint i = 0; i < planner.BufferCount(); i++ )
+            {
+                if( planner.IsPart( i ) )
+                    continue;
+
+                void*  buffer;
+                size_t bufferSize;
+                planner.GetSpan( i, buffer, bufferSize );
+
+                // Far buffers are faulted on the far tier, not on the node of each thread
+                const bool bindSlices = firstTouch && planner.GetPolicy( i ) != NumaPolicy::Far;
+
+                WarmStartBuffer( buffer, bufferSize, backing, bindSlices ? numa : nullptr );
+            }
+
+            double elapsed = TimerEnd( timer );
+            Log::Line( "Faulted buffer pages in %.2lf seconds.", elapsed );
+        }
+
+        if( cfg.autoMode )
+            PredictPlotTime( cfg );
+
+        // Each mode keeps tables 2-6 in the staging buffer, so only one of them can be used
+        FatalIf( cfg.spillPathCount && cfg.compressTables, "Tables can't be both spilled and compressed. Use either spill paths or --compress-tables." );
+
+        if( cfg.spillPathCount > 0 )
+        {
+            Log::Line( "Spilling tables 2-6 to %u scratch path(s).", cfg.spillPathCount );
+            _context.spill = new TableSpiller( cfg.spillPaths, cfg.spillPathCount, _netKey );
+        }
+        else if( cfg.compressTables )
+        {
+            Log::Line( "Compressing tables 2-6 in memory." );
+            _context.spill = new TableSpiller();
+        }
+
+        if( _context.spill )
+        {
+            _context.t3LRBuffer = _context.t2LRBuffer;
+            _context.t4LRBuffer = _context.t2LRBuffer;
+            _context.t5LRBuffer = _context.t2LRBuffer;
+            _context.t6LRBuffer = _context.t2LRBuffer;
+        }
 
 
         // Some table's kBC group pairings yield more values than 2^k. 
         // Therefore, we need to have some overflow space for kBC pairs.
-        // We get an average of 236 entries per group.
-        // We use a yBuffer for to mark group boundaries, 
-        // so we fit as many as we can in it.
-        const size_t maxKbcGroups  = yBuffer0 / sizeof( uint32 );
-
         // Since we use a meta buffer (64GiB) for pairing,
         // we can just use all its space to fit pairs.
-        const size_t maxPairs      = metaBuffer0 / sizeof( Pair );
+        const size_t maxPairs      = ENTRIES_PER_TABLE * sizeof( Meta4 ) / sizeof( Pair );
 
-        _context.maxPairs     = maxPairs;
-        _context.maxKBCGroups = maxKbcGroups;
+        _context.maxPairs = maxPairs;
     }
 }
 
 //----------------------------------------------------------
 MemPlotter::~MemPlotter()
-{}
+{
+    // Don't let the next plot's F1 run on past the buffers
+    if( _pipelineTask.IsValid() )
+        _pipelinePool->Wait( _pipelineTask );
+
+    // Let the checkpoint finish writing from our buffers
+    delete _context.checkpoint;
+
+    // Remove spill files
+    if( _context.spill )
+        delete _context.spill;
+
+    // Remove the file of a plot that was never started
+    delete _preparer;
+
+    // Finish moving the plots we've made
+    if( _context.plotMover )
+        delete _context.plotMover;
+
+    if( _context.gpu )
+        delete _context.gpu;
+
+    #if PLATFORM_IS_UNIX
+        delete _metricsServer;
+    #endif
+    delete _context.metrics;
+
+    delete _context.threadPolicy;
+    delete _context.profiler;
+}
+
+//-----------------------------------------------------------
+void MemPlotter::SelectMode( MemPlotConfig& cfg )
+{
+    struct Mode
+    {
+        const char* name;
+        bool        pipeline;
+        bool        inPlaceSort;
+        bool        spill;
+    };
+
+    // From the fastest to the one needing the least memory.
+    // Pipelining is only kept if it was asked for, as it only pays off over several plots.
+    Mode modes[4];
+    uint modeCount = 0;
+
+    if( cfg.pipeline )
+        modes[modeCount++] = { "In memory, pipelined", true, true, false };
+
+    modes[modeCount++] = { "In memory", false, cfg.inPlaceSort, false };
+
+    if( !cfg.inPlaceSort )
+        modes[modeCount++] = { "In memory, sorting in place", false, true, false };
+
+    // The phase cache and checkpoints need all tables in memory
+    if( cfg.spillPathCount && !cfg.benchCacheDir && !cfg.checkpointDir )
+        modes[modeCount++] = { "Spilling tables 2-6", false, true, true };
+
+    const size_t availMemory = SysHost::GetAvailableSystemMemory();
+
+    Log::Line( "Selecting a configuration for %.2lf GiB of available memory:", (double)availMemory BtoGB );
+
+    const NumaInfo* numa = cfg.noNUMA ? nullptr : SysHost::GetNUMAInfo();
+    if( numa && numa->nodeCount > 1 )
+        Log::Line( " Buffers are interleaved across %u NUMA nodes.", numa->nodeCount );
+
+    int    selected     = -1;
+    int    smallest     = -1;
+    size_t smallestSize = 0;
+
+    for( uint i = 0; i < modeCount; i++ )
+    {
+        const Mode& mode = modes[i];
+
+        MemPlotConfig modeCfg = cfg;
+        modeCfg.pipeline       = mode.pipeline;
+        modeCfg.inPlaceSort    = mode.inPlaceSort;
+        modeCfg.spillPathCount = mode.spill ? cfg.spillPathCount : 0;
+
+        MemPlotContext scratch;
+        ZeroMem( &scratch );
+
+        BufferPlanner planner( SysHost::GetPageSize() );
+        const size_t  required = PlanBuffers( planner, modeCfg, scratch );
+
+        // A slower configuration is only worth it if it needs less memory
+        if( smallest >= 0 && required >= smallestSize )
+            continue;
+
+        smallest     = (int)i;
+        smallestSize = required;
+
+        // Leave room for the stacks and smaller allocations
+        const bool fits = required + BB_AUTO_MEMORY_HEADROOM <= availMemory;
+
+        Log::Line( "  %-28s: %7.2lf GiB%s", mode.name, (double)required BtoGB, fits ? "" : " (does not fit)" );
+
+        if( fits && selected < 0 )
+            selected = (int)i;
+    }
+
+    if( selected < 0 )
+    {
+        selected = smallest;
+
+        Log::Error( "Warning: No configuration fits in the available memory. Using the one that needs the least." );
+
+        if( !cfg.spillPathCount )
+            Log::Error( "         Give scratch paths with --spill to let tables 2-6 be spilled." );
+    }
+
+    const Mode& mode = modes[selected];
+    Log::Line( "Selected configuration: %s.", mode.name );
+
+    cfg.pipeline       = mode.pipeline;
+    cfg.inPlaceSort    = mode.inPlaceSort;
+    cfg.spillPathCount = mode.spill ? cfg.spillPathCount : 0;
+
+    // The largest pages available are used, down to regular pages if there are none
+    cfg.hugePages = true;
+}
+
+//-----------------------------------------------------------
+void MemPlotter::PredictPlotTime( const MemPlotConfig& cfg )
+{
+    struct ProbeJob
+    {
+        const byte* src;
+        byte*       dst;
+        size_t      size;
+
+        static void Fill( ProbeJob* job ) { memset( (void*)job->src, 0xBB, job->size ); }
+        static void Copy( ProbeJob* job ) { memcpy( job->dst, job->src, job->size ); }
+    };
+
+    // Copy between the meta buffers, which hold nothing yet
+    ThreadPool&  pool        = *_context.threadPool;
+    const uint   threadCount = pool.ThreadCount();
+    const size_t probeSize   = std::min( (size_t)BB_AUTO_PROBE_SIZE, (size_t)ENTRIES_PER_TABLE * sizeof( Meta4 ) );
+    const size_t threadSize  = probeSize / threadCount;
+
+    std::vector<ProbeJob> jobs( threadCount );
+
+    for( uint i = 0; i < threadCount; i++ )
+    {
+        jobs[i].src  = (const byte*)_context.metaBuffer0 + i * threadSize;
+        jobs[i].dst  = (byte*)_context.metaBuffer1 + i * threadSize;
+        jobs[i].size = threadSize;
+    }
+
+    // Fault the pages first, and write them, as unwritten pages are all backed by a shared zero page
+    pool.RunJob( ProbeJob::Fill, jobs.data(), threadCount );
+    pool.RunJob( ProbeJob::Copy, jobs.data(), threadCount );
+
+    double best = 0;
+    for( uint i = 0; i < 3; i++ )
+    {
+        auto timer = TimerBegin();
+        pool.RunJob( ProbeJob::Copy, jobs.data(), threadCount );
+
+        const double elapsed = TimerEnd( timer );
+        if( i == 0 || elapsed < best )
+            best = elapsed;
+    }
+
+    const double copyRate  = (double)( threadSize * threadCount ) / best;
+    const double predicted = (double)BB_PLOT_TRAFFIC_PER_ENTRY * ENTRIES_PER_TABLE / copyRate;
+
+    Log::Line( "Memory copy rate: %.2lf GB/s. Predicted plot time: %.1lf minutes.", copyRate / 1e9, predicted / 60.0 );
+
+    if( cfg.spillPathCount )
+    {
+        const size_t spilled = 5ull * ENTRIES_PER_TABLE * sizeof( PackedPair );
+        Log::Line( " Plus the time waiting on the spill paths, which write and read back %.2lf GiB per plot.", (double)spilled BtoGB );
+    }
+}
+
+//-----------------------------------------------------------
+size_t MemPlotter::PlanBuffers( BufferPlanner& planner, const MemPlotConfig& cfg, MemPlotContext& cx )
+{
+    // YBuffers need to round up to chacha block size, so we just add an extra block always
+    const size_t chachaBlockSize  = kF1BlockSizeBits / 8;
+
+    // When spilling or compressing them, tables 2-6 share the t2 buffer as a staging buffer
+    const bool   spill        = cfg.spillPathCount > 0 || cfg.compressTables;
+
+    // Tables 2-6 are stored as packed pairs
+    const size_t packedLRSize = ENTRIES_PER_TABLE * sizeof( PackedPair );
+
+    const size_t t1XBuffer   = ENTRIES_PER_TABLE * sizeof( uint32 );
+
+    const size_t t2LRBuffer  = packedLRSize;
+    const size_t t3LRBuffer  = spill ? 0 : packedLRSize;
+    const size_t t4LRBuffer  = spill ? 0 : packedLRSize;
+    const size_t t5LRBuffer  = spill ? 0 : packedLRSize;
+    const size_t t6LRBuffer  = spill ? 0 : packedLRSize;
+    const size_t t7LRBuffer  = ENTRIES_PER_TABLE * sizeof( Pair );
+    const size_t t7YBuffer   = ENTRIES_PER_TABLE * sizeof( uint32 );
+
+    const size_t yBuffer0    = ENTRIES_PER_TABLE * sizeof( uint64 ) + chachaBlockSize;
+    const size_t yBuffer1    = ENTRIES_PER_TABLE * sizeof( uint64 ) + chachaBlockSize;
+    // Sized for tables 3 and 4, whose Meta4 metadata takes 16 bytes per entry.
+    // Meta3 is stored packed in 12 bytes, so table 5's uses the first 3/4 only.
+    const size_t metaBuffer0 = ENTRIES_PER_TABLE * sizeof( Meta4 );
+    const size_t metaBuffer1 = ENTRIES_PER_TABLE * sizeof( Meta4 );
+
+    // Phase 2 bins the left and right indices of each pair before marking them
+    const size_t markingScratch = 2 * ENTRIES_PER_TABLE * sizeof( uint32 );
+
+    // Phase 3 and 4 buffers
+    const size_t usedEntries = USED_ENTRIES_BUFFER_SIZE;
+    const size_t lpBuffer    = ENTRIES_PER_TABLE * sizeof( uint64 );
+    const size_t lookupMap   = 2 * ENTRIES_PER_TABLE * sizeof( uint32 );
+    const size_t p3TmpBuffer = ENTRIES_PER_TABLE * sizeof( uint64 );
+    const size_t p4Tables    = GetP4TableBufferSize( ENTRIES_PER_TABLE );
+
+    // Describe the lifetime of each buffer across the plot stages,
+    // so that the planner can pack them into a single reservation.
+    // #NOTE: The L/R buffers for tables 2-6, lpBuffer0 (table 6's parks) and the Phase 4 table buffer
+    //        contain the previous plot's tables while they are being written to disk in the background.
+    //        This goes on until the next plot's table 2 is about to be sorted.
+    const StageMask allStages  = StageRange( PlotStage::F1, PlotStage::Phase4 );
+    const StageMask prevWrites = StageRange( PlotStage::F1, PlotStage::Table2 );
+
+    // Tables 2-6 are only written once, by their sort, and then read back by Phases 2 and 3,
+    // so they can go to the far memory tier. Not when staged, as each table then goes through the t2 buffer.
+    const NumaPolicy lrPolicy = cfg.farMemory && !spill ? NumaPolicy::Far : NumaPolicy::Interleave;
+
+    planner.Add( "t1XBuffer"  , t1XBuffer  , allStages, &cx.t1XBuffer  );
+    planner.Add( "t2LRBuffer" , t2LRBuffer , prevWrites | StageRange( PlotStage::Table2, PlotStage::Phase4 ), &cx.t2LRBuffer, lrPolicy );
+
+    if( !spill )
+    {
+        planner.Add( "t3LRBuffer", t3LRBuffer, prevWrites | StageRange( PlotStage::Table3, PlotStage::Phase4 ), &cx.t3LRBuffer, lrPolicy );
+        planner.Add( "t4LRBuffer", t4LRBuffer, prevWrites | StageRange( PlotStage::Table4, PlotStage::Phase4 ), &cx.t4LRBuffer, lrPolicy );
+        planner.Add( "t5LRBuffer", t5LRBuffer, prevWrites | StageRange( PlotStage::Table5, PlotStage::Phase4 ), &cx.t5LRBuffer, lrPolicy );
+        planner.Add( "t6LRBuffer", t6LRBuffer, prevWrites | StageRange( PlotStage::Table6, PlotStage::Phase4 ), &cx.t6LRBuffer, lrPolicy );
+    }
+
+    // Table 7's L/R buffer is used as the unsorted pair buffer for all tables,
+    // and its y buffer as the sort key.
+    // #NOTE: The sort and scatter targets are split by thread index, so they are partitioned
+    //        across the NUMA nodes. The tables, which Phases 2 and 3 access at random, are interleaved.
+    const NumaPolicy partitioned = NumaPolicy::Partitioned;
+
+    planner.Add( "t7LRBuffer" , t7LRBuffer , StageRange( PlotStage::Table2, PlotStage::Phase3 ), &cx.t7LRBuffer, partitioned );
+    planner.Add( "t7YBuffer"  , t7YBuffer  , StageRange( PlotStage::Table2, PlotStage::Phase4 ), &cx.t7YBuffer , partitioned );
+
+    // The y and metadata buffers are only used by Phase 1.
+    // F1 is generated into yBuffer0, sorted with metaBuffer1 as its temporary buffer.
+    // Table 7 reads only the y buffer table 6 was sorted into, which is yBuffer1
+    // when sorting packed, as the tables then alternate between them.
+    // When pipelining, both y buffers hold the next plot's F1 during Phases 3 and 4.
+    const StageMask pipelineStages = StageRange( PlotStage::Phase3, PlotStage::Phase4 );
+    const bool      t6InYBuffer1   = cfg.packedFxSort && !cfg.bucketedFp;
+
+    StageMask yBuffer0Stages = StageRange( PlotStage::F1    , t6InYBuffer1 ? PlotStage::Table6 : PlotStage::Table7 );
+    StageMask yBuffer1Stages = StageRange( PlotStage::Table2, t6InYBuffer1 ? PlotStage::Table7 : PlotStage::Table6 );
+
+    if( cfg.pipeline )
+    {
+        yBuffer0Stages |= pipelineStages;
+        yBuffer1Stages |= pipelineStages;
+    }
+
+    planner.Add( "yBuffer0"   , yBuffer0   , yBuffer0Stages, &cx.yBuffer0, partitioned );
+    planner.Add( "yBuffer1"   , yBuffer1   , yBuffer1Stages, &cx.yBuffer1, partitioned );
+
+    // metaBuffer0 holds the sorted metadata, which is written once the previous plot has been written.
+    // Its first 8 bytes per entry hold tables 2 and 6's Meta2, the next 4 table 5's Meta3
+    // (and FxSort's temporary sort key), and the last 4 are only used by tables 3 and 4's Meta4.
+    // metaBuffer1 holds the unsorted pairs, which may take all of it on any table.
+    const size_t metaQuarter = metaBuffer0 / 4;
+
+    planner.Add   ( "metaBuffer0", metaQuarter * 2, StageRange( PlotStage::Table2Sort, PlotStage::Table7 ), &cx.metaBuffer0, partitioned );
+    planner.Extend( "meta0Meta3" , metaQuarter    , StageRange( PlotStage::Table2Sort, PlotStage::Table6 ) );
+    planner.Extend( "meta0Meta4" , metaQuarter    , StageRange( PlotStage::Table3    , PlotStage::Table5 ) );
+    planner.Add   ( "metaBuffer1", metaBuffer1    , StageRange( PlotStage::F1        , PlotStage::Table7 ), &cx.metaBuffer1, partitioned );
+
+    planner.Add( "markScratch", markingScratch, StageBit( PlotStage::Phase2 ), &cx.markingScratch, partitioned );
+    planner.Add( "usedEntries", usedEntries   , StageRange( PlotStage::Phase2, PlotStage::Phase3 ), &cx.usedEntriesBuffer );
+
+    // Phase 3's buffers are accessed at random, so they are interleaved.
+    // Table 6's parks are written from lpBuffer0, and P7 and the C tables from the Phase 4
+    // table buffer, which the C tables may already be built into by Phase 3.
+    planner.Add( "lpBuffer0"  , lpBuffer , prevWrites | StageRange( PlotStage::Phase3, PlotStage::Phase4 ), &cx.lpBuffer0 );
+    planner.Add( "p4Tables"   , p4Tables , prevWrites | StageRange( PlotStage::Phase3, PlotStage::Phase4 ), &cx.p4TableBuffer );
+    planner.Add( "lookupMap"  , lookupMap, StageBit( PlotStage::Phase3 ), &cx.lookupMap );
+
+    if( cfg.overlapParks && !spill )
+        planner.Add( "lpBuffer1", lpBuffer, StageBit( PlotStage::Phase3 ), &cx.lpBuffer1 );
+
+    if( !cfg.inPlaceSort )
+        planner.Add( "p3TmpBuffer", p3TmpBuffer, StageBit( PlotStage::Phase3 ), &cx.p3TmpBuffer );
+
+    // The next plot's x values are swapped with t1XBuffer, so they live as long.
+    // Their sort buffer is only needed while they are generated.
+    if( cfg.pipeline )
+    {
+        planner.Add( "nextT1XBuffer", t1XBuffer  , allStages     , &cx.nextT1XBuffer );
+        planner.Add( "nextT1XTmp"   , t1XBuffer  , pipelineStages, &cx.nextT1XTmp, partitioned );
+    }
+
+    return planner.Plan();
+}
 
 //----------------------------------------------------------
 bool MemPlotter::Run( const PlotRequest& request )
@@ -124,104 +691,819 @@ bool MemPlotter::Run( const PlotRequest& request )
     cx.plotId       = request.plotId;
     cx.plotMemo     = request.memo;
     cx.plotMemoSize = request.memoSize;
+
+    // Pick up this plot's F1, if it was generated in the background
+    EndNextF1( request.plotId );
     
-    // Open the plot file for writing before we actually start plotting
+    // Pick where the plot goes, and build its path.
+    // Its file may have been prepared in the background, while the previous plot was made.
+    uint        outputDir = 0;
+    std::string plotPath;
+    FileStream* prepared  = nullptr;
+
+    if( !request.outputDir && _preparer )
+        prepared = _preparer->Take( request.fileName, outputDir, plotPath );
+
+    if( prepared )
+    {
+        _lastOutputDir = outputDir;
+        Log::Line( "Writing plot to %s (prepared).", *_outputDirs[outputDir] ? _outputDirs[outputDir] : "current directory" );
+    }
+    else if( !request.outputDir )
+        outputDir = SelectOutputDir();
+    else if( !GetRequestedDir( request.outputDir, outputDir ) )
+    {
+        Log::Error( "Error: Can't write to %s. Plots were written to too many directories.", request.outputDir );
+        return false;
+    }
+
+    const char*  dirPath   = _outputDirs[outputDir];
+    const size_t dirLength = strlen( dirPath );
+
+    if( !prepared )
+    {
+        plotPath = dirPath;
+
+        if( dirLength && dirPath[dirLength-1] != '/' && dirPath[dirLength-1] != '\\' )
+            plotPath += '/';
+
+        plotPath += request.fileName;
+    }
+
+    const char* outPath = plotPath.c_str();
+
+    // Plots to a receiver are streamed over the network instead
+    const bool remote = IsRemoteDir( dirPath );
+
+    // Open the plot file for writing before we actually start plotting.
+    // When benchmarking, the plot writer discards the plot, so no file is opened.
     const int PLOT_FILE_RETRIES = 16;
-    FileStream* plotfile = new FileStream();
+    FileStream* plotfile = prepared ? prepared : new FileStream();
     ASSERT( plotfile );
 
-    for( int i = 0; i < PLOT_FILE_RETRIES; i++ )
+    FileFlags plotFileFlags = FileFlags::NoBuffering | FileFlags::LargeFile;
+    if( !cx.noAsyncIO )
+        plotFileFlags |= FileFlags::AsyncIO;
+
+    for( int i = 0; i < PLOT_FILE_RETRIES && !_benchmark && !prepared; i++ )
+    {
+        const bool opened = remote ? plotfile->OpenRemote( dirPath + BB_NET_PATH_PREFIX_LEN, _netKey, request.fileName ) :
+                                     plotfile->Open( outPath, FileMode::Create, FileAccess::Write, plotFileFlags );
+        if( !opened )
+        {
+            if( i+1 >= PLOT_FILE_RETRIES )
+            {
+                Log::Error( "Error: Failed to open plot output file at %s for writing after %d tries.", outPath, PLOT_FILE_RETRIES );
+                delete plotfile;
+                return false;
+            }
+
+            continue;
+        }
+
+        break;
+    }
+    
+    // Start plotting
+    auto plotTimer = TimerBegin();
+
+    if( cx.profiler )
+        cx.profiler->BeginPlot( request.fileName );
+
+    if( cx.metrics )
+    {
+        cx.metrics->SetPlotName( request.fileName );
+        cx.metrics->plotsStarted.fetch_add( 1, std::memory_order_relaxed );
+
+        for( uint i = 0; i < 7; i++ )
+            cx.metrics->entryCount[i].store( 0, std::memory_order_relaxed );
+    }
+
+    // Seconds spent in each phase
+    double phaseTimes[4] = {};
+
+    // A plot killed after Phase 1 or 2 on the last run picks up from its checkpoint.
+    // Only the first plot can be resumed, later ones need Phase 1 to wait for the plot before them.
+    uint resumedPhase = cx.checkpoint && cx.plotCount == 0 ? cx.checkpoint->CompletedPhase( request.plotId ) : 0;
+
+    if( resumedPhase && !cx.checkpoint->Restore( cx ) )
+    {
+        Log::Error( "Error: Failed to load the plot's checkpoint. Plotting it from the start." );
+        resumedPhase = 0;
+    }
+
+    if( RunsPhase( 1 ) && resumedPhase < 1 )
+    {
+        PrepareMemory( PlotStage::F1, PlotStage::Table7 );
+
+        auto timeStart = plotTimer;
+        Log::Line( "Running Phase 1" );
+        MetricsSetPhase( cx.metrics, 1 );
+        ProfileScope scope( cx.profiler, "phase1" );
+
+        MemPhase1 phase1( cx );
+        phase1.Run();
+
+        double elapsed = TimerEnd( timeStart );
+        Log::Line( "Finished Phase 1 in %.2lf seconds.", elapsed );
+        phaseTimes[0] = elapsed;
+        MetricsEndPhase( cx.metrics, 1, elapsed );
+    }
+
+    // Phase 2 only reads the tables, so they're checkpointed while it runs
+    if( cx.checkpoint && resumedPhase < 1 )
+        cx.checkpoint->BeginPhase1( cx, request.fileName );
+
+    // The memory of each phase is prepared before any of its state is loaded,
+    // as the memory that is faulted back in is overwritten.
+    PrepareMemory( PlotStage::Phase2, PlotStage::Phase2 );
+
+    // Phases run in-place over the state the previous one left,
+    // so it is snapshotted once, and loaded back on every plot that needs it.
+    // Phase 3 replaces the state of Phases 1 and 2, so Phase 4 needs only its own.
+    if( _benchCacheDir )
+    {
+        if( _benchFirstPhase == 1 && cx.plotCount == 0 )
+            WritePhaseCache( cx, _benchCacheDir, 1 );
+        else if( _benchFirstPhase == 2 || _benchFirstPhase == 3 )
+            ReadPhaseCache( cx, _benchCacheDir, 1 );
+    }
+
+    if( RunsPhase( 2 ) && resumedPhase < 2 )
+    {
+        MemPhase2 phase2( cx );
+        auto timeStart = TimerBegin();
+        Log::Line( "Running Phase 2" );
+        MetricsSetPhase( cx.metrics, 2 );
+        ProfileScope scope( cx.profiler, "phase2" );
+
+        phase2.Run();
+
+        double elapsed = TimerEnd( timeStart );
+        Log::Line( "Finished Phase 2 in %.2lf seconds.", elapsed );
+        phaseTimes[1] = elapsed;
+        MetricsEndPhase( cx.metrics, 2, elapsed );
+    }
+
+    // Before the next plot's F1 starts in the background
+    PrepareMemory( PlotStage::Phase3, PlotStage::Phase3 );
+
+    if( _benchCacheDir )
+    {
+        if( _benchFirstPhase <= 2 && _benchLastPhase >= 2 && cx.plotCount == 0 )
+            WritePhaseCache( cx, _benchCacheDir, 2 );
+        else if( _benchFirstPhase == 3 )
+            ReadPhaseCache( cx, _benchCacheDir, 2 );
+    }
+
+    // Phase 3 converts the tables in-place, so they must be checkpointed by now
+    if( cx.checkpoint )
+    {
+        cx.checkpoint->EndPhase1();
+
+        if( resumedPhase < 2 )
+            cx.checkpoint->WritePhase2( cx );
+    }
+
+    // Verify a few proofs while the tables are still in memory,
+    // so that a plot corrupted by bad memory is not written
+    if( _selfCheckProofs && RunsPhase( 3 ) )
+    {
+        auto timeStart = TimerBegin();
+        Log::Line( "Self-checking %u proofs", _selfCheckProofs );
+        ProfileScope scope( cx.profiler, "self_check" );
+
+        const bool valid = SelfCheck( _selfCheckProofs );
+
+        if( !valid )
+        {
+            Log::Error( "Error: The plot failed its self-check, and was discarded. This host's memory may be faulty." );
+
+            if( cx.checkpoint )
+                cx.checkpoint->Remove();
+
+            if( plotfile->IsOpen() )
+            {
+                plotfile->Close();
+
+                if( !remote )
+                    remove( outPath );
+            }
+
+            delete plotfile;
+
+            MetricsSetPhase( cx.metrics, 0 );
+
+            cx.plotCount ++;
+            return false;
+        }
+
+        Log::Line( "Finished the self-check in %.2lf seconds.", TimerEnd( timeStart ) );
+    }
+
+    // The y buffers are free from here on, so start on the next plot
+    if( _pipelinePool && request.nextPlotId )
+        BeginNextF1( request.nextPlotId );
+
+    // Start writing the plot file.
+    // The previous plot has finished writing by now, as Phase 1 had to wait for
+    // its buffers, so whichever writer it used is no longer needed.
+    if( !_plotWriters[outputDir] )
+    {
+        _plotWriters[outputDir] = new DiskPlotWriter( _benchmark );
+        _plotWriters[outputDir]->SetMetrics( cx.metrics );
+        _plotWriters[outputDir]->SetHostCoordinator( _hostCoordinator );
+
+        if( cx.digestPlot && !_benchmark )
+            _plotWriters[outputDir]->EnableDigest( BB_DIGEST_THREADS );
+
+        if( cx.droppedXBits )
+        {
+            char formatDescription[32];
+            snprintf( formatDescription, sizeof( formatDescription ), "%s%u", kDroppedXFormatPrefix, cx.droppedXBits );
+
+            _plotWriters[outputDir]->SetFormatDescription( formatDescription );
+        }
+    }
+
+    cx.plotWriter = _plotWriters[outputDir];
+    
+    // The table sizes are known from the marked entries by now
+    size_t  predictedSizes[10];
+    size_t* tableSizes = nullptr;
+
+    if( cx.preallocatePlot && RunsPhase( 3 ) )
+    {
+        PredictTableSizes( predictedSizes, cx.droppedXBits );
+        tableSizes = predictedSizes;
+    }
+
+    cx.plotWriter->BeginPlot( outPath, *plotfile, request.plotId, request.memo, request.memoSize, tableSizes );
+
+    // Prepare the next plot's file while this one is made, as it should be about as large
+    if( _preparer && request.nextFileName && RunsPhase( 3 ) )
+    {
+        if( !tableSizes )
+            PredictTableSizes( predictedSizes, cx.droppedXBits );
+
+        uint64 plotSize = 0;
+        for( uint i = 0; i < 10; i++ )
+            plotSize += predictedSizes[i];
+
+        _preparer->Prepare( request.nextFileName, plotSize, outputDir );
+    }
+
+    // The plots are discarded when benchmarking, so their size is reported as predicted
+    if( _benchmark && RunsPhase( 3 ) )
+    {
+        size_t sizes[10], standardSizes[10];
+        PredictTableSizes( sizes        , cx.droppedXBits );
+        PredictTableSizes( standardSizes, 0 );
+
+        for( uint i = 0; i < 10; i++ )
+        {
+            _benchPlotBytes     += sizes[i];
+            _benchStandardBytes += standardSizes[i];
+        }
+    }
+
+    if( RunsPhase( 3 ) )
+    {
+        auto timeStart = TimerBegin();
+        Log::Line( "Running Phase 3" );
+        MetricsSetPhase( cx.metrics, 3 );
+        ProfileScope scope( cx.profiler, "phase3" );
+
+        MemPhase3 phase3( cx );
+        phase3.Run();
+
+        double elapsed = TimerEnd( timeStart );
+        Log::Line( "Finished Phase 3 in %.2lf seconds.", elapsed );
+        phaseTimes[2] = elapsed;
+        MetricsEndPhase( cx.metrics, 3, elapsed );
+    }
+
+    PrepareMemory( PlotStage::Phase4, PlotStage::Phase4 );
+
+    if( _benchCacheDir )
+    {
+        if( _benchFirstPhase <= 3 && _benchLastPhase >= 3 && cx.plotCount == 0 )
+            WritePhaseCache( cx, _benchCacheDir, 3 );
+        else if( _benchFirstPhase == 4 )
+            ReadPhaseCache( cx, _benchCacheDir, 3 );
+    }
+
+    if( RunsPhase( 4 ) )
+    {
+        auto timeStart = TimerBegin();
+        Log::Line( "Running Phase 4" );
+        MetricsSetPhase( cx.metrics, 4 );
+        ProfileScope scope( cx.profiler, "phase4" );
+
+        MemPhase4 phase4( cx );
+        phase4.Run();
+
+        double elapsed = TimerEnd( timeStart );
+        Log::Line( "Finished Phase 4 in %.2lf seconds.", elapsed );
+        phaseTimes[3] = elapsed;
+        MetricsEndPhase( cx.metrics, 4, elapsed );
+    }
+
+    // Wait flush writer, if this is the final plot
+    if( request.IsFinalPlot && !_benchmark )
+    {
+        auto timeStart = TimerBegin();
+        Log::Line( "Writing final plot tables to disk" );
+        ProfileScope scope( cx.profiler, "final_write" );
+
+        WaitPlotWriter();
+
+        // The next plot, if any, need not wait for it
+        cx.p4WriteBuffer = nullptr;
+
+        double elapsed = TimerEnd( timeStart );
+        Log::Line( "Finished writing tables to disk in %.2lf seconds.", elapsed );
+        Log::Flush();
+    }
+
+    double plotElapsed = TimerEnd( plotTimer );
+    Log::Line( "Finished plotting in %.2lf seconds (%.2lf minutes).", 
+        plotElapsed, plotElapsed / 60.0 );
+
+    // Every buffer has been touched by now
+    if( _numaReport )
+        ReportNumaPlacement();
+
+    if( cx.profiler )
+    {
+        std::string profilePath = _profileDir;
+
+        if( !profilePath.empty() && profilePath.back() != '/' && profilePath.back() != '\\' )
+            profilePath += '/';
+
+        profilePath += request.fileName;
+        profilePath += ".profile.json";
+
+        if( cx.profiler->WritePlot( profilePath.c_str() ) )
+            Log::Line( "Wrote plot profile to %s", profilePath.c_str() );
+    }
+
+    if( _traceDir )
+    {
+        std::string tracePath = _traceDir;
+
+        if( !tracePath.empty() && tracePath.back() != '/' && tracePath.back() != '\\' )
+            tracePath += '/';
+
+        tracePath += request.fileName;
+        tracePath += ".trace.json";
+
+        if( Trace::Write( tracePath.c_str() ) )
+            Log::Line( "Wrote plot trace to %s", tracePath.c_str() );
+    }
+
+    if( _benchmark )
+    {
+        if( RunsPhase( 3 ) )
+            _table1ParkTimes.push_back( cx.table1ParkTime );
+
+        double total = 0;
+        for( uint i = 0; i < 4; i++ )
+        {
+            if( RunsPhase( i+1 ) )
+                _phaseTimes[i].push_back( phaseTimes[i] );
+
+            total += phaseTimes[i];
+        }
+
+        _phaseTimes[4].push_back( total );
+
+        if( request.IsFinalPlot )
+        {
+            ReportBenchmark();
+
+            if( _benchBaseline )
+                _benchRegressed = CheckBaseline();
+        }
+    }
+
+    if( cx.metrics )
+    {
+        MetricsSetPhase( cx.metrics, 0 );
+        cx.metrics->plotsFinished.fetch_add( 1, std::memory_order_relaxed );
+    }
+
+    cx.plotCount ++;
+    return true;
+}
+
+//-----------------------------------------------------------
+void MemPlotter::ReportBenchmark()
+{
+    const uint plotCount = (uint)_phaseTimes[4].size();
+
+    Log::Line( "" );
+    Log::Line( "Benchmark of %u plot(s):", plotCount );
+    Log::Line( "             Median (s)    p95 (s)" );
+
+    for( uint i = 0; i < 5; i++ )
+    {
+        std::vector<double>& times = _phaseTimes[i];
+        if( times.empty() )
+            continue;
+
+        std::sort( times.begin(), times.end() );
+
+        // Nearest rank
+        const double median = times[(times.size()-1) / 2];
+        const double p95    = times[CDiv( times.size() * 95, 100 ) - 1];
+
+        if( i < 4 )
+            Log::Line( "  Phase %u   %10.2lf  %10.2lf", i+1, median, p95 );
+        else
+            Log::Line( "  Total     %10.2lf  %10.2lf", median, p95 );
+    }
+
+    if( !_table1ParkTimes.empty() )
+    {
+        std::vector<double>& times = _table1ParkTimes;
+        std::sort( times.begin(), times.end() );
+
+        Log::Line( "  T1 parks  %10.2lf  %10.2lf", times[(times.size()-1) / 2], times[CDiv( times.size() * 95, 100 ) - 1] );
+    }
+
+    if( _benchStandardBytes )
+    {
+        const double gib = 1024.0 * 1024.0 * 1024.0;
+
+        Log::Line( "" );
+        Log::Line( "Plot size: %.2lf GiB, %.2lf%% of the standard format's %.2lf GiB.",
+                   _benchPlotBytes / (double)plotCount / gib, _benchPlotBytes * 100.0 / _benchStandardBytes,
+                   _benchStandardBytes / (double)plotCount / gib );
+    }
+
+    Log::Line( "" );
+}
+
+// Phases are measured as 'phase<n>', and their sum as 'total'.
+// Baselines are only comparable for the same phases and thread count, on the same machine.
+//-----------------------------------------------------------
+bool MemPlotter::CheckBaseline()
+{
+    const auto& cx = _context;
+
+    char config[64];
+    sprintf( config, "plot-p%u-%u-t%u-cpus%u", _benchFirstPhase, _benchLastPhase, cx.threadCount, SysHost::GetLogicalCPUCount() );
+
+    // Plots of another format are not comparable
+    if( cx.droppedXBits )
+        sprintf( config + strlen( config ), "-dx%u", cx.droppedXBits );
+
+    Baseline   baseline( config );
+    const bool compare = !_benchSaveBaseline && baseline.Load( _benchBaseline );
+
+    if( compare )
+    {
+        Log::Line( "Comparing against the baseline '%s', with a %.1lf%% threshold:", _benchBaseline, _benchThreshold * 100.0 );
+        Baseline::LogHeader();
+    }
+
+    uint regressions = 0;
+
+    for( uint i = 0; i < 5; i++ )
+    {
+        const std::vector<double>& times = _phaseTimes[i];
+        if( times.empty() )
+            continue;
+
+        char name[16];
+        if( i < 4 )
+            sprintf( name, "phase%u", i+1 );
+        else
+            sprintf( name, "total" );
+
+        if( compare )
+        {
+            if( baseline.Compare( name, times, _benchThreshold ) == Baseline::Result::Slower )
+                regressions++;
+        }
+        else
+            baseline.Set( name, times );
+    }
+
+    if( !compare )
+    {
+        if( baseline.Save( _benchBaseline ) )
+            Log::Line( "Recorded the baseline '%s'.", _benchBaseline );
+
+        return false;
+    }
+
+    Log::Line( "" );
+    if( regressions )
+        Log::Error( "%u phase(s) regressed.", regressions );
+    else
+        Log::Line( "No regressions." );
+
+    Log::Line( "" );
+    return regressions > 0;
+}
+
+//-----------------------------------------------------------
+void MemPlotter::PredictTableSizes( size_t tableSizes[10], const uint droppedXBits )
+{
+    auto& cx = _context;
+
+    // Phase 3 writes each table's parks from the entries of the next table that are still in use.
+    // Those are the ones marked by Phase 2, and all of table 7's.
+    const uint64 f7Count = cx.entryCount[(uint)TableId::Table7];
+
+    uint64 parkEntries[6];
+
+    for( uint table = (uint)TableId::Table1; table < (uint)TableId::Table6; table++ )
+        parkEntries[table] = BitFieldRank( cx.usedEntries[table+1], cx.usedEntryRanks[table+1], cx.entryCount[table+1] );
+
+    parkEntries[(uint)TableId::Table6] = f7Count;
+
+    for( uint table = 0; table < 6; table++ )
+        tableSizes[table] = CDiv( parkEntries[table], kEntriesPerPark ) * CalculateParkSize( (TableId)table );
+
+    if( droppedXBits )
+        tableSizes[0] = CDiv( parkEntries[0], kEntriesPerPark ) * CalculateDroppedXParkSize( droppedXBits );
+
+    // Phase 3 may drop a few trailing f7 entries, so these may be slightly overestimated
+    const uint64 c3Parks = f7Count / kCheckpoint1Interval + ( f7Count % kCheckpoint1Interval > 1 ? 1 : 0 );
+
+    tableSizes[6] = GetP7Size( f7Count );
+    tableSizes[7] = ( CDiv( f7Count, kCheckpoint1Interval ) + 1 ) * sizeof( uint32 );
+    tableSizes[8] = ( CDiv( f7Count, kCheckpoint1Interval * kCheckpoint2Interval ) + 1 ) * sizeof( uint32 );
+    tableSizes[9] = c3Parks * CalculateC3Size();
+}
+
+// The proofs are walked back one table at a time, so that spilled tables are each loaded once.
+// Phase 2 leaves table 2 loaded, and it's the last one walked, so Phase 3 finds it still loaded.
+//-----------------------------------------------------------
+bool MemPlotter::SelfCheck( uint proofCount )
+{
+    auto& cx = _context;
+
+    const uint64 f7Count = cx.entryCount[(uint)TableId::Table7];
+
+    proofCount = (uint)std::min( (uint64)proofCount, f7Count );
+    if( proofCount == 0 )
+        return true;
+
+    // Spread the proofs over table 7, from an offset picked by the plot id,
+    // so that each plot checks different entries
+    const uint64 stride = f7Count / proofCount;
+
+    uint64 offset;
+    memcpy( &offset, cx.plotId, sizeof( offset ) );
+    offset %= stride;
+
+    // Entries of each proof in the table being walked, as each of them expands into a pair of the table before it.
+    // A proof ends up with the 64 table 1 entries of its x values.
+    std::vector<uint64> entries( (size_t)proofCount * 64 );
+
+    for( uint p = 0; p < proofCount; p++ )
+    {
+        const Pair& pair = cx.t7LRBuffer[offset + p * stride];
+
+        entries[p*64  ] = pair.left;
+        entries[p*64+1] = pair.right;
+    }
+
+    PackedPair* lrTables[7] = {
+        nullptr,
+        cx.t2LRBuffer,
+        cx.t3LRBuffer,
+        cx.t4LRBuffer,
+        cx.t5LRBuffer,
+        cx.t6LRBuffer,
+        nullptr
+    };
+
+    // Proofs that failed are not walked any further
+    std::vector<bool> failed( proofCount, false );
+
+    for( uint table = (uint)TableId::Table6, width = 2; table >= (uint)TableId::Table2; table--, width *= 2 )
+    {
+        const uint64 entryCount = cx.entryCount[table];
+
+        if( cx.spill )
+            cx.spill->Load( *cx.threadPool, (TableId)table, lrTables[table], entryCount );
+
+        const PackedPair* lrTable = lrTables[table];
+
+        for( uint p = 0; p < proofCount; p++ )
+        {
+            if( failed[p] )
+                continue;
+
+            uint64* proof = entries.data() + (size_t)p * 64;
+
+            // Expanded from the back, so that no entry is overwritten before it's read
+            for( int i = (int)width-1; i >= 0; i-- )
+            {
+                const uint64 entry = proof[i];
+
+                // Every entry of a proof must have been marked by Phase 2.
+                // The index is checked first, as a corrupt pair may point anywhere.
+                if( entry >= entryCount || !BitFieldGet( cx.usedEntries[table], entry ) )
+                {
+                    Log::Error( "Error: Proof %u goes through table %u entry %llu, which was not marked.",
+                                p, table+1, entry );
+                    failed[p] = true;
+                    break;
+                }
+
+                const Pair pair = UnpackPair( lrTable[entry] );
+
+                proof[i*2  ] = pair.left;
+                proof[i*2+1] = pair.right;
+            }
+        }
+    }
+
+    const uint64 t1Count = cx.entryCount[(uint)TableId::Table1];
+
+    bool valid = true;
+
+    for( uint p = 0; p < proofCount; p++ )
+    {
+        if( failed[p] )
+        {
+            valid = false;
+            continue;
+        }
+
+        const uint64* proof   = entries.data() + (size_t)p * 64;
+        const uint64  f7Index = offset + p * stride;
+
+        uint64 xs[64];
+        bool   inRange = true;
+
+        for( uint i = 0; i < 64; i++ )
+        {
+            inRange = inRange && proof[i] < t1Count;
+            xs[i]   = inRange ? cx.t1XBuffer[proof[i]] : 0;
+        }
+
+        if( !inRange || !PlotValidator::VerifyProof( cx.plotId, xs, cx.t7YBuffer[f7Index] ) )
+        {
+            Log::Error( "Error: Proof %u, of table 7 entry %llu, is invalid.", p, f7Index );
+            valid = false;
+        }
+    }
+
+    return valid;
+}
+
+//-----------------------------------------------------------
+bool MemPlotter::IsRemoteDir( const char* dir )
+{
+    return strncmp( dir, BB_NET_PATH_PREFIX, BB_NET_PATH_PREFIX_LEN ) == 0;
+}
+
+//-----------------------------------------------------------
+uint MemPlotter::SelectOutputDir()
+{
+    if( _outputDirCount == 1 )
+        return 0;
+
+    // Prefer directories whose writer is idle, as the previous plot may still be 
+    // being written to its directory. Then the one with the most free space.
+    // Ties go to the next directory after the last one used.
+    uint   selected     = 0;
+    bool   selectedIdle = false;
+    uint64 selectedFree = 0;
+
+    for( uint i = 1; i <= _outputDirCount; i++ )
     {
-        if( !plotfile->Open( request.outPath, FileMode::Create, FileAccess::Write, FileFlags::NoBuffering | FileFlags::LargeFile ) )
-        {
-            if( i+1 >= PLOT_FILE_RETRIES )
-            {
-                Log::Error( "Error: Failed to open plot output file at %s for writing after %d tries.", request.outPath, PLOT_FILE_RETRIES );
-                delete plotfile;
-                return false;
-            }
+        const uint dir = ( _lastOutputDir + i ) % _outputDirCount;
 
-            continue;
-        }
+        // The space left on a receiver is not known, so those are only picked by rotation.
+        // A directory found to be slow is not idle, for a while.
+        const bool   idle = ( !_plotWriters[dir] || _plotWriters[dir]->HasFinishedWriting() ) &&
+                            !( _preparer && _preparer->IsSlow( dir ) );
+        const uint64 free = IsRemoteDir( _outputDirs[dir] ) ? 0 : SysHost::GetFreeDiskSpace( _outputDirs[dir] );
 
-        break;
+        if( i == 1 || ( idle && !selectedIdle ) || ( idle == selectedIdle && free > selectedFree ) )
+        {
+            selected     = dir;
+            selectedIdle = idle;
+            selectedFree = free;
+        }
     }
-    
-    // Start plotting
-    auto plotTimer = TimerBegin();
 
-    #if DBG_READ_PHASE_1_TABLES
-    if( cx.plotCount > 0 )
-    #endif
-    {
-        auto timeStart = plotTimer;
-        Log::Line( "Running Phase 1" );
+    _lastOutputDir = selected;
 
-        MemPhase1 phase1( cx );
-        phase1.Run();
+    if( IsRemoteDir( _outputDirs[selected] ) )
+        Log::Line( "Streaming plot to %s.", _outputDirs[selected] );
+    else
+        Log::Line( "Writing plot to %s (%.2lf GiB free).", 
+            *_outputDirs[selected] ? _outputDirs[selected] : "current directory",
+            (double)selectedFree / (1ull << 30) );
 
-        double elapsed = TimerEnd( timeStart );
-        Log::Line( "Finished Phase 1 in %.2lf seconds.", elapsed );
-    }
+    return selected;
+}
 
-    {
-        MemPhase2 phase2( cx );
-        auto timeStart = TimerBegin();
-        Log::Line( "Running Phase 2" );
+//-----------------------------------------------------------
+bool MemPlotter::GetRequestedDir( const char* dir, uint& outSlot )
+{
+    uint i = 0;
+    while( i < _requestedDirCount && _requestedDirs[i] != dir )
+        i++;
 
-        phase2.Run();
+    if( i == _requestedDirCount )
+    {
+        if( _outputDirCount + _requestedDirCount >= BB_MAX_OUTPUT_DIRS )
+            return false;
 
-        double elapsed = TimerEnd( timeStart );
-        Log::Line( "Finished Phase 2 in %.2lf seconds.", elapsed );
+        _requestedDirs[_requestedDirCount++] = dir;
+        _outputDirs[_outputDirCount + i]     = _requestedDirs[i].c_str();
     }
 
-    // Start writing the plot file
-    if( !_context.plotWriter )
-        _context.plotWriter = new DiskPlotWriter();
-    
-    cx.plotWriter->BeginPlot( request.outPath, *plotfile, request.plotId, request.memo, request.memoSize );
+    outSlot = _outputDirCount + i;
 
-    {
-        auto timeStart = TimerBegin();
-        Log::Line( "Running Phase 3" );
+    if( IsRemoteDir( dir ) )
+        Log::Line( "Streaming plot to %s.", dir );
+    else
+        Log::Line( "Writing plot to %s.", dir );
 
-        MemPhase3 phase3( cx );
-        phase3.Run();
+    return true;
+}
 
-        double elapsed = TimerEnd( timeStart );
-        Log::Line( "Finished Phase 3 in %.2lf seconds.", elapsed );
-    }
+//-----------------------------------------------------------
+void MemPlotter::BeginNextF1( const byte* plotId )
+{
+    ASSERT( !_pipelineTask.IsValid() );
 
-    {
-        auto timeStart = TimerBegin();
-        Log::Line( "Running Phase 4" );
+    memcpy( _pipelinePlotId, plotId, sizeof( _pipelinePlotId ) );
 
-        MemPhase4 phase4( cx );
-        phase4.Run();
+    Log::Line( "Generating the next plot's F1 in the background with %u threads.", _pipelinePool->ThreadCount() );
 
-        double elapsed = TimerEnd( timeStart );
-        Log::Line( "Finished Phase 4 in %.2lf seconds.", elapsed );
-    }
+    // F1 runs its jobs on the pool from within the task, so it must be the pool's only task
+    _pipelineTask = _pipelinePool->Submit<MemPlotter>( []( MemPlotter* self ) {
 
-    // Wait flush writer, if this is the final plot
-    if( request.IsFinalPlot )
-    {
-        auto timeStart = TimerBegin();
-        Log::Line( "Writing final plot tables to disk" );
+        MemPhase1 phase1( self->_context );
+        phase1.GenerateNextF1( *self->_pipelinePool, self->_pipelinePlotId );
 
-        WaitPlotWriter();
+    }, this );
+}
 
-        double elapsed = TimerEnd( timeStart );
-        Log::Line( "Finished writing tables to disk in %.2lf seconds.", elapsed );
-        Log::Flush();
+//-----------------------------------------------------------
+void MemPlotter::EndNextF1( const byte* plotId )
+{
+    auto& cx = _context;
+    cx.t1Pregenerated = false;
+
+    if( !_pipelineTask.IsValid() )
+        return;
+
+    auto timer = TimerBegin();
+
+    _pipelinePool->Wait( _pipelineTask );
+    _pipelineTask.Reset();
+
+    // The requested plot may not be the one we expected
+    if( memcmp( plotId, _pipelinePlotId, sizeof( _pipelinePlotId ) ) != 0 )
+    {
+        Log::Line( "Discarding the F1 generated in the background, as it is for another plot." );
+        return;
     }
 
-    double plotElapsed = TimerEnd( plotTimer );
-    Log::Line( "Finished plotting in %.2lf seconds (%.2lf minutes).", 
-        plotElapsed, plotElapsed / 60.0 );
+    // The previous plot's x values are no longer needed
+    std::swap( cx.t1XBuffer, cx.nextT1XBuffer );
+    cx.t1Pregenerated = true;
 
-    cx.plotCount ++;
-    return true;
+    const double elapsed = TimerEnd( timer );
+    if( elapsed >= 0.01 )
+        Log::Line( "Waited %.2lf seconds for the background F1.", elapsed );
+}
+
+//-----------------------------------------------------------
+void MemPlotter::FinishWriting()
+{
+    // Phase 4 sets the write buffer, and it's cleared once the plot has been waited for
+    if( !_context.p4WriteBuffer || _benchmark )
+        return;
+
+    Log::Line( "Writing plot tables to disk" );
+    auto timeStart = TimerBegin();
+
+    WaitPlotWriter();
+    _context.p4WriteBuffer = nullptr;
+
+    double elapsed = TimerEnd( timeStart );
+    Log::Line( "Finished writing tables to disk in %.2lf seconds.", elapsed );
+    Log::Flush();
+}
+
+//-----------------------------------------------------------
+const PlotCheckpointInfo* MemPlotter::GetCheckpoint() const
+{
+    return _context.checkpoint ? _context.checkpoint->GetInfo() : nullptr;
 }
 
 //-----------------------------------------------------------
@@ -237,6 +1519,10 @@ void MemPlotter::WaitPlotWriter()
                 _context.plotWriter->FilePath().c_str(),
                 _context.plotWriter->GetError() );
 
+        // Nothing was written when benchmarking
+        if( _context.plotWriter->IsNullSink() )
+            return;
+
         // Rename plot file to final plot file name (remove .tmp suffix)
         const char*  tmpName       = _context.plotWriter->FilePath().c_str();
         const size_t tmpNameLength = strlen( tmpName );
@@ -246,7 +1532,12 @@ void MemPlotter::WaitPlotWriter()
         memcpy( plotName, tmpName, tmpNameLength - 4 );
         plotName[tmpNameLength-4] = 0;
 
-        int r = rename( tmpName, plotName );
+        // Remote plots are renamed by their receiver
+        int r = _context.plotWriter->IsRemote() ? 0 : rename( tmpName, plotName );
+
+        // The plot is on disk, so it won't be resumed
+        if( _context.checkpoint )
+            _context.checkpoint->Remove();
         
         if( r )
         {
@@ -257,6 +1548,9 @@ void MemPlotter::WaitPlotWriter()
         Log::Line( "" );
         Log::Line( "Plot %s finished writing to disk:", r ? tmpName : plotName );
 
+        if( r == 0 && _context.plotMover && !_context.plotWriter->IsRemote() )
+            _context.plotMover->Enqueue( plotName );
+
         delete[] plotName;
 
         // Print final pointer offsets
@@ -281,23 +1575,44 @@ void MemPlotter::WaitPlotWriter()
 ///
 //-----------------------------------------------------------
 template<typename T>
-T* MemPlotter::SafeAlloc( size_t size, bool warmStart, const NumaInfo* numa )
+T* MemPlotter::SafeAlloc( size_t size, PageBacking maxBacking, const NumaInfo* numa, PageBacking& outBacking )
 {
     #if DEBUG || BOUNDS_PROTECTION
     
-        const size_t originalSize = size;
         const size_t pageSize     = SysHost::GetPageSize();
         size = pageSize * 2 + RoundUpToNextBoundary( size, (int)pageSize );
 
+        // Guard pages can't be placed within explicit large pages
+        if( maxBacking > PageBacking::Transparent )
+        {
+            Log::Line( "Warning: Large pages are disabled when bounds protection is enabled." );
+            maxBacking = PageBacking::Transparent;
+        }
     #endif
 
-    T* ptr = (T*)SysHost::VirtualAlloc( size, false );
+    PageBacking backing   = PageBacking::Regular;
+    size_t      allocSize = 0;
+
+    T* ptr = maxBacking == PageBacking::Regular ? 
+        (T*)SysHost::VirtualAlloc( size, false ) :
+        (T*)SysHost::VirtualAllocLargePages( size, maxBacking, backing, allocSize );
 
     if( !ptr )
     {
         Fatal( "Error: Failed to allocate required buffers." );
     }
 
+    if( maxBacking != PageBacking::Regular )
+    {
+        Log::Line( "Buffers backed by %s pages.", PageBackingToString( backing ) );
+
+        // Ensure that NUMA binding covers whole large pages
+        if( backing > PageBacking::Transparent )
+            size = allocSize;
+    }
+
+    outBacking = backing;
+
     if( numa )
     {
         if( !SysHost::NumaSetMemoryInterleavedMode( ptr, size ) )
@@ -315,64 +1630,397 @@ T* MemPlotter::SafeAlloc( size_t size, bool warmStart, const NumaInfo* numa )
     }
     #endif
 
-    // Touch pages to initialize them, if specified
-    if( warmStart )
+    return ptr;
+}
+
+//-----------------------------------------------------------
+void MemPlotter::WarmStartBuffer( void* buffer, size_t size, PageBacking backing, const NumaInfo* firstTouchNuma )
+{
+    // Touch pages to fault them in. Each pool thread touches the same
+    // contiguous slice of the buffer that it owns when processing entries,
+    // (F1 generation and the sorts split work evenly by thread index).
+    // If NUMA first-touch placement is requested, each slice is
+    // also explicitly bound to the node of the thread that owns it.
+    struct InitJob
+    {
+        byte*  pages;
+        size_t pageSize;
+        uint64 pageCount;
+        int    node;
+
+        inline static void Run( InitJob* job )
+        {
+            if( job->pageCount < 1 )
+                return;
+
+            const size_t pageSize = job->pageSize;
+
+            byte*       page = job->pages;
+            const byte* end  = page + job->pageCount * pageSize;
+
+            if( job->node >= 0 )
+                SysHost::NumaAssignPages( page, job->pageCount * pageSize, (uint)job->node );
+
+            do {
+                *page = 0;
+                page += pageSize;
+                
+            } while ( page < end );
+        }
+    };
+
+    // Only need to touch one address per large page
+    const size_t pageSize       = backing == PageBacking::Huge  ? 1ull GB :
+                                  backing == PageBacking::Large ? 2ull MB : SysHost::GetPageSize();
+
+    // Align to whole pages, the partial page at the start belongs to the previous buffer
+    byte*       pages = (byte*)RoundUpToNextBoundary( (uintptr_t)buffer, (int)pageSize );
+    const byte* end   = (byte*)buffer + size;
+
+    if( pages >= end )
+        return;
+
+    const uint   threadCount    = _context.threadPool->ThreadCount();
+    const uint64 pageCount      = CDiv( (size_t)(end - pages), (int)pageSize );
+    const uint64 pagesPerThread = pageCount / threadCount;
+
+    uint64 numRemainderPages = pageCount - ( pagesPerThread * threadCount );
+
+    std::vector<InitJob> jobs( threadCount );
+
+    for( uint i = 0; i < threadCount; i++ )
+    {
+        InitJob& job = jobs[i];
+
+        job.pages     = pages;
+        job.pageSize  = pageSize;
+        job.pageCount = pagesPerThread;
+        job.node      = firstTouchNuma ? SysHost::NumaGetNodeFromCpu( *firstTouchNuma, _context.threadPool->ThreadCpuId( i ) ) : -1;
+
+        if( numRemainderPages )
+        {
+            job.pageCount ++;
+            numRemainderPages --;
+        }
+
+        pages += pageSize * job.pageCount;
+    }
+
+    _context.threadPool->RunJob( InitJob::Run, jobs.data(), threadCount );
+}
+
+// Partitioned regions are split in slices of whole pages per pool thread,
+// the first threads getting the remainder, as WarmStartBuffer splits them.
+//-----------------------------------------------------------
+static uint SliceThread( uint64 page, uint64 pageCount, uint threadCount )
+{
+    const uint64 pagesPerThread = pageCount / threadCount;
+    const uint64 remainder      = pageCount - pagesPerThread * threadCount;
+    const uint64 biggerSlices   = remainder * ( pagesPerThread + 1 );
+
+    return page < biggerSlices ? (uint)( page / ( pagesPerThread + 1 ) ) :
+                                 (uint)( remainder + ( page - biggerSlices ) / pagesPerThread );
+}
+
+//-----------------------------------------------------------
+void MemPlotter::PlanNumaRegions( const BufferPlanner& planner )
+{
+    _numaRegions.clear();
+
+    // A buffer's parts are split by thread index along with it
+    for( uint i = 0; i < planner.BufferCount(); i++ )
+    {
+        if( planner.IsPart( i ) )
+            continue;
+
+        void*  buffer;
+        size_t size;
+        planner.GetSpan( i, buffer, size );
+
+        if( size )
+            _numaRegions.push_back( { planner.GetName( i ), (byte*)buffer, size, planner.GetPolicy( i ) } );
+    }
+}
+
+//-----------------------------------------------------------
+void MemPlotter::PlanMemorySegments( const BufferPlanner& planner )
+{
+    std::vector<byte*> bounds;
+
+    for( uint i = 0; i < planner.BufferCount(); i++ )
+    {
+        void*  buffer;
+        size_t size;
+        planner.GetBuffer( i, buffer, size );
+
+        if( size )
+        {
+            bounds.push_back( (byte*)buffer );
+            bounds.push_back( (byte*)buffer + size );
+        }
+    }
+
+    std::sort( bounds.begin(), bounds.end() );
+    bounds.erase( std::unique( bounds.begin(), bounds.end() ), bounds.end() );
+
+    _memorySegments.clear();
+
+    for( size_t b = 1; b < bounds.size(); b++ )
+    {
+        MemorySegment segment = { bounds[b-1], bounds[b], 0, false };
+
+        for( uint i = 0; i < planner.BufferCount(); i++ )
+        {
+            void*  buffer;
+            size_t size;
+            planner.GetBuffer( i, buffer, size );
+
+            if( (byte*)buffer <= segment.start && (byte*)buffer + size >= segment.end )
+                segment.lifetime |= planner.GetLifetime( i );
+        }
+
+        _memorySegments.push_back( segment );
+    }
+}
+
+// A part of the reservation that is not used by a phase holds nothing that is needed after it,
+// as buffers that are alive at different stages share memory.
+// Only whole pages are released, the partial ones at either end may be in use by the segments next to them.
+//-----------------------------------------------------------
+void MemPlotter::PrepareMemory( const PlotStage firstStage, const PlotStage lastStage )
+{
+    if( !_releaseMemory )
+        return;
+
+    const StageMask stages   = StageRange( firstStage, lastStage );
+    const size_t    pageSize = _backing == PageBacking::Huge  ? 1ull GB :
+                               _backing == PageBacking::Large ? 2ull MB : SysHost::GetPageSize();
+
+    // The released segments that are used again are faulted back in before the phase writes to them
+    {
+        auto   timer   = TimerBegin();
+        size_t faulted = 0;
+
+        for( MemorySegment& segment : _memorySegments )
+        {
+            if( !segment.released || !( segment.lifetime & stages ) )
+                continue;
+
+            WarmStartBuffer( segment.start, (size_t)( segment.end - segment.start ), _backing, nullptr );
+
+            faulted         += (size_t)( segment.end - segment.start );
+            segment.released = false;
+        }
+
+        if( faulted )
+            Log::Line( "Faulted back %.2lf GiB of released memory in %.2lf seconds.", (double)faulted BtoGB, TimerEnd( timer ) );
+    }
+
+    // Release each run of adjacent segments that the phase does not use
+    size_t released = 0;
+
+    for( size_t i = 0; i < _memorySegments.size(); )
+    {
+        if( _memorySegments[i].lifetime & stages )
+        {
+            i++;
+            continue;
+        }
+
+        size_t end = i;
+        for( ; end < _memorySegments.size() && !( _memorySegments[end].lifetime & stages ); end++ )
+        {
+            if( !_memorySegments[end].released )
+                released += (size_t)( _memorySegments[end].end - _memorySegments[end].start );
+
+            _memorySegments[end].released = true;
+        }
+
+        byte*       pages    = (byte*)RoundUpToNextBoundary( (uintptr_t)_memorySegments[i].start, (int)pageSize );
+        const byte* pagesEnd = (byte*)( (uintptr_t)_memorySegments[end-1].end / pageSize * pageSize );
+
+        if( pages < pagesEnd && !SysHost::VirtualDiscard( pages, (size_t)( pagesEnd - pages ) ) )
+        {
+            Log::Error( "Warning: Failed to release unused buffer memory. Buffers will stay resident." );
+            _releaseMemory = false;
+
+            for( MemorySegment& segment : _memorySegments )
+                segment.released = false;
+
+            return;
+        }
+
+        i = end;
+    }
+
+    // Alignment padding alone is not worth logging
+    if( released >= 1ull MB )
+        Log::Line( "Released %.2lf GiB of unused buffer memory.", (double)released BtoGB );
+}
+
+// Only whole pages are placed, the partial ones at either end are shared with the buffers next to it
+//-----------------------------------------------------------
+void MemPlotter::PlaceFarBuffers( const BufferPlanner& planner, const size_t pageSize )
+{
+    for( uint i = 0; i < planner.BufferCount(); i++ )
+    {
+        if( planner.GetPolicy( i ) != NumaPolicy::Far )
+            continue;
+
+        void*  buffer;
+        size_t size;
+        planner.GetBuffer( i, buffer, size );
+
+        byte*       pages = (byte*)RoundUpToNextBoundary( (uintptr_t)buffer, (int)pageSize );
+        const byte* end   = (byte*)( ( (uintptr_t)buffer + size ) / pageSize * pageSize );
+
+        if( pages >= end )
+            continue;
+
+        if( !SysHost::NumaSetMemoryFarMode( pages, (size_t)( end - pages ) ) )
+            Log::Error( "Warning: Failed to place %s on the far memory tier.", planner.GetName( i ) );
+    }
+}
+
+//-----------------------------------------------------------
+void MemPlotter::PlaceNumaRegions()
+{
+    const size_t pageSize    = _numaPageSize;
+    const uint   threadCount = _context.threadPool->ThreadCount();
+
+    // The partitioned regions are bound first, so that the interleaved ones win where they share memory.
+    // A partitioned buffer on interleaved pages only loses its locality, but a buffer accessed
+    // at random on pages bound to a single node would be served by that node alone.
+    for( const NumaPolicy policy : { NumaPolicy::Partitioned, NumaPolicy::Interleave } )
     {
-        struct InitJob
+        for( const NumaRegion& region : _numaRegions )
         {
-            byte*  pages;
-            size_t pageSize;
-            uint64 pageCount;
+            if( region.policy != policy )
+                continue;
 
-            inline static void Run( InitJob* job )
+            // The partial page at the start belongs to the previous buffer
+            byte*       pages = (byte*)RoundUpToNextBoundary( (uintptr_t)region.start, (int)pageSize );
+            const byte* end   = region.start + region.size;
+
+            if( pages >= end )
+                continue;
+
+            const uint64 pageCount = CDiv( (size_t)( end - pages ), (int)pageSize );
+
+            if( policy == NumaPolicy::Interleave )
+            {
+                if( !SysHost::NumaSetMemoryInterleavedMode( pages, pageCount * pageSize ) )
+                    Log::Error( "Warning: Failed to interleave %s across NUMA nodes.", region.name );
+
+                continue;
+            }
+
+            for( uint64 page = 0; page < pageCount; )
             {
-                const size_t pageSize = job->pageSize;
+                const uint   thread     = SliceThread( page, pageCount, threadCount );
+                const uint64 sliceCount = pageCount / threadCount + ( thread < pageCount % threadCount ? 1 : 0 );
+                const int    node       = SysHost::NumaGetNodeFromCpu( *_numa, _context.threadPool->ThreadCpuId( thread ) );
 
-                byte*       page = job->pages;
-                const byte* end  = page + job->pageCount * pageSize;
+                if( node >= 0 )
+                    SysHost::NumaAssignPages( pages + page * pageSize, sliceCount * pageSize, (uint)node );
 
-                do {
-                    *page = 0;
-                    page += pageSize;
-                    
-                } while ( page < end );
+                page += sliceCount;
             }
-        };
+        }
+    }
+}
+
+//-----------------------------------------------------------
+void MemPlotter::ReportNumaPlacement()
+{
+    const size_t pageSize    = _numaPageSize;
+    const uint   threadCount = _context.threadPool->ThreadCount();
+    const uint   nodeCount   = _numa->nodeCount;
+    const bool   perBuffer   = strcmp( _numaMode, "per-buffer" ) == 0;
+    const bool   firstTouch  = strcmp( _numaMode, "first-touch" ) == 0;
+
+    Log::Line( "NUMA placement (%s), of %u sampled pages per buffer:", _numaMode, BB_NUMA_REPORT_SAMPLES );
+
+    void*             pages[BB_NUMA_REPORT_SAMPLES];
+    int               nodes[BB_NUMA_REPORT_SAMPLES];
+    uint64            pageIndices[BB_NUMA_REPORT_SAMPLES];
+    std::vector<uint> nodeCounts( nodeCount );
+
+    for( const NumaRegion& region : _numaRegions )
+    {
+        byte*       start = (byte*)RoundUpToNextBoundary( (uintptr_t)region.start, (int)pageSize );
+        const byte* end   = region.start + region.size;
+
+        if( start >= end )
+            continue;
+
+        const uint64 pageCount   = CDiv( (size_t)( end - start ), (int)pageSize );
+        const uint   sampleCount = (uint)std::min( pageCount, (uint64)BB_NUMA_REPORT_SAMPLES );
 
-        #if DEBUG || BOUNDS_PROTECTION
-            size = originalSize;
-        #endif
+        for( uint i = 0; i < sampleCount; i++ )
+        {
+            pageIndices[i] = i * pageCount / sampleCount;
+            pages[i]       = start + pageIndices[i] * pageSize;
+        }
 
-        InitJob jobs[MAX_THREADS];
+        if( !SysHost::NumaGetNodesFromPages( pages, sampleCount, nodes ) )
+        {
+            Log::Line( "  %-12s: Failed to query the nodes of its pages.", region.name );
+            continue;
+        }
 
-        const uint   threadCount    = _context.threadPool->ThreadCount();
-        const size_t pageSize       = SysHost::GetPageSize();
-        const uint64 pageCount      = CDiv( size, (int)pageSize );
-        const uint64 pagesPerThread = pageCount / threadCount;
+        // Partitioned pages are local if they are on the node of the thread whose slice they're in
+        const bool far    = region.policy == NumaPolicy::Far;
+        const bool sliced = !far && ( firstTouch || ( perBuffer && region.policy == NumaPolicy::Partitioned ) );
 
-        uint64 numRemainderPages = pageCount - ( pagesPerThread * threadCount );
+        uint unfaulted = 0;
+        uint local     = 0;
+        std::fill( nodeCounts.begin(), nodeCounts.end(), 0u );
 
-        byte* pages = (byte*)ptr;
-        for( uint i = 0; i < threadCount; i++ )
+        for( uint i = 0; i < sampleCount; i++ )
         {
-            InitJob& job = jobs[i];
+            if( nodes[i] < 0 || (uint)nodes[i] >= nodeCount )
+            {
+                unfaulted++;
+                continue;
+            }
 
-            job.pages     = pages;
-            job.pageSize  = pageSize;
-            job.pageCount = pagesPerThread;
+            nodeCounts[nodes[i]]++;
 
-            if( numRemainderPages )
+            if( sliced )
             {
-                job.pageCount ++;
-                numRemainderPages --;
+                const uint thread = SliceThread( pageIndices[i], pageCount, threadCount );
+
+                if( nodes[i] == SysHost::NumaGetNodeFromCpu( *_numa, _context.threadPool->ThreadCpuId( thread ) ) )
+                    local++;
             }
+        }
+
+        std::string distribution;
+        char        field[64];
 
-            pages += pageSize * job.pageCount;
+        for( uint node = 0; node < nodeCount; node++ )
+        {
+            snprintf( field, sizeof( field ), " node %u %5.1lf%%", node, nodeCounts[node] * 100.0 / sampleCount );
+            distribution += field;
         }
 
-        _context.threadPool->RunJob( InitJob::Run, jobs, threadCount );
-    }
+        if( sliced )
+        {
+            snprintf( field, sizeof( field ), " | %5.1lf%% local", local * 100.0 / sampleCount );
+            distribution += field;
+        }
 
-    return ptr;
+        if( unfaulted )
+        {
+            snprintf( field, sizeof( field ), " | %5.1lf%% not faulted", unfaulted * 100.0 / sampleCount );
+            distribution += field;
+        }
+
+        const char* policyName = far ? "far" : !perBuffer ? _numaMode :
+                                 region.policy == NumaPolicy::Partitioned ? "partitioned" : "interleaved";
+
+        Log::Line( "  %-12s: %-11s%s", region.name, policyName, distribution.c_str() );
+    }
 }
 
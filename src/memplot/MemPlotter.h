@@ -1,7 +1,23 @@
 #pragma once
 #include "PlotContext.h"
+#include "io/NetSink.h"
+#include <vector>
+#include <string>
 
 struct NumaInfo;
+enum class PageBacking : uint;
+enum class SimdLevel : uint;
+enum class NumaPolicy : uint32;
+enum class PlotStage : uint32;
+class DiskPlotWriter;
+class Thread;
+class MetricsServer;
+class HostCoordinator;
+class PlotPreparer;
+class BufferPlanner;
+struct PlotCheckpointInfo;
+
+#define BB_MAX_OUTPUT_DIRS 64
 
 struct MemPlotConfig
 {
@@ -9,6 +25,84 @@ struct MemPlotConfig
     bool warmStart;
     bool noNUMA;
     bool noCPUAffinity;
+    bool hugePages;         // Try to back buffers with explicit huge/large pages
+    bool numaFirstTouch;    // Place pages on the NUMA node of the thread that owns them, instead of interleaving
+    bool numaPerBuffer;     // Place each buffer by its own NUMA policy, binding the partitioned ones and interleaving the rest
+    bool numaReport;        // Log the actual NUMA node distribution of each buffer's pages after each plot
+    bool farMemory;         // Place tables 2-6 on the memory-only NUMA nodes (ex. CXL expanders), and keep the other buffers off them
+    bool releaseMemory;     // Release the memory of the buffers that each phase does not use while it runs, and fault it back before it's reused
+    bool fusedF1;           // Fuse F1 generation with the first pass of the F1 sort
+    bool bucketedFp;        // Sort forward propagated tables in cache-sized y buckets
+    bool packedFxSort;      // Sort forward propagated tables on y packed with its index
+    bool blockedMap;        // Map forward propagated metadata and pairs in cache-sized blocks
+    bool inPlaceSort;       // Sort Phase 3's line points and f7 in place
+    bool fusedPrune;        // Prune Phase 3's tables straight into line points
+    bool bucketedLpSort;    // Sort Phase 3's line points in buckets by their top bits
+    bool binnedLookup;      // Bin Phase 3's lookup table writes by destination range
+    bool streamParks;       // Stream Phase 3's parks to the plot writer as they are encoded
+    bool fusedCheckpoints;  // Build the C1, C2 and C3 tables in Phase 3, right after the f7 sort
+    bool overlapParks;      // Encode the parks of each table in Phase 3 while the next table is converted
+    bool noAsyncIO;         // Write the plot file synchronously, even if io_uring is available
+    bool pipeline;          // Generate the next plot's F1 in the background while the current plot is in Phases 3 and 4
+    bool preallocatePlot;   // Preallocate each plot file to its predicted size before writing it
+    bool prepareOutput;     // Create and preallocate the next plot's file in the background, in the directory with the most room
+    bool digestPlot;        // Write a BLAKE3 digest file next to each plot, hashed as it's written
+    uint droppedXBits;      // Drop this many low bits from table 1's x's, in a plot format chiapos does not read. 0 for the standard format.
+    uint selfCheckProofs;   // If > 0, this many proofs are verified in memory after Phase 2, and a plot with an invalid one is discarded
+    bool autoMode;          // Select the fastest configuration that fits in the available memory, spilling only if needed
+    int  gpuDevice;         // If >= 0, F1 and Fx are computed on this GPU, if it can be used
+    uint spinTime;          // Microseconds idle pool threads spin waiting for jobs before sleeping
+    SimdLevel simdLevel;    // Widest SIMD kernels to run. Must be supported by the CPU.
+
+    // Per-kernel thread counts, as "<kernel>=<count>". See ThreadPolicy.
+    const char** kernelThreads;
+    uint         kernelThreadCount;
+    bool         tuneThreads;       // Tune the thread count of the kernels without one
+    const char*  threadCachePath;   // File caching the tuned thread counts. May be null.
+
+    const char*  profileDir;        // If set, a JSON profile of each plot's phases and kernels is written to this directory
+    bool         perfCounters;      // Add hardware performance counters to the profiles
+    bool         memBandwidth;      // Add the DRAM bandwidth of each NUMA node to the profiles, and log it for each phase
+    const char*  metricsAddress;    // If set, progress metrics are served on this [host:]port (127.0.0.1 by default), or 'unix:<path>' socket
+    const char*  traceDir;          // If set, a Chrome trace of each plot's jobs is written to this directory
+
+    // Discard the plots instead of writing them, and report the time of each phase once the final plot is done.
+    // Only the phases from benchFirstPhase to benchLastPhase are run. The state left by the phases
+    // before the first one is loaded from benchCacheDir, where it is cached when Phase 1 is run.
+    bool         benchmark;
+    uint         benchFirstPhase;   // 1-3
+    uint         benchLastPhase;    // 1-4
+    const char*  benchCacheDir;     // May be null if the first phase is 1
+    const char*  benchBaseline;     // If set, the phase times are compared against this baseline, or recorded to it if it does not exist
+    bool         benchSaveBaseline; // Record the baseline even if it exists
+    double       benchThreshold;    // Relative slowdown over the baseline tolerated before a phase is flagged
+
+    // Directories to which plots are written. Each directory gets its own plot writer,
+    // and each plot goes to the idle directory with the most free space.
+    // If no directories are given, plots are written to the current directory.
+    const char** outputDirs;
+    uint         outputDirCount;
+
+    // Scratch paths to which tables 2-6 are spilled.
+    // If no paths are given, all tables are kept in memory.
+    const char** spillPaths;
+    uint         spillPathCount;
+    const char*  netSecretPath;     // File holding the secret of the receivers and memory servers of tcp:// paths. May be null.
+    bool         compressTables;    // Compress tables 2-6 in memory while they're not in use, instead of spilling them
+
+    // Destination directories to which finished plots are moved in the background.
+    // If no directories are given, plots stay in their output directory.
+    const char** moveDirs;
+    uint         moveDirCount;
+    uint         moveBandwidth;     // Cap on the total bandwidth of the moves, in MiB/s. 0 means unlimited.
+
+    // If set, the plot writers take turns with those of the other instances of the host,
+    // and share its write bandwidth budget. See HostCoordinator.
+    HostCoordinator* coordinator;
+
+    // If set, the state of each plot after Phases 1 and 2 is checkpointed to this directory,
+    // and a plot whose id matches its checkpoint is resumed from it.
+    const char*  checkpointDir;
 };
 
 // This plotter performs the whole plotting process in-memory.
@@ -21,15 +115,156 @@ public:
 
     bool Run( const PlotRequest& request );
 
+    // Waits for the last plot to be written, if it was not requested as the final plot.
+    // Used when the plotter goes idle, so that finished plots don't wait for the next one.
+    void FinishWriting();
+
+    // Returns the plot left in the checkpoint directory by a previous run, to be resumed, or null
+    const PlotCheckpointInfo* GetCheckpoint() const;
+
+    // True if the benchmark was slower than its baseline
+    inline bool BenchmarkRegressed() const { return _benchRegressed; }
+
 private:
 
+    // Adds the buffers needed by a configuration to the planner, and returns the memory they need
+    static size_t PlanBuffers( BufferPlanner& planner, const MemPlotConfig& cfg, MemPlotContext& cx );
+
+    // Picks the fastest of the configurations that fit in the available memory, and applies it to cfg
+    static void SelectMode( MemPlotConfig& cfg );
+
+    // Predicts the plot time from a measure of the memory copy rate
+    void PredictPlotTime( const MemPlotConfig& cfg );
+
     template<typename T>
-    T* SafeAlloc( size_t size, bool warmStart, const NumaInfo* numa );
+    T* SafeAlloc( size_t size, PageBacking maxBacking, const NumaInfo* numa, PageBacking& outBacking );
+
+    // Fault the pages of a buffer using the thread pool
+    void WarmStartBuffer( void* buffer, size_t size, PageBacking backing, const NumaInfo* firstTouchNuma );
+
+    // Records the regions of the buffers with their NUMA policy, once they are assigned.
+    void PlanNumaRegions( const BufferPlanner& planner );
+
+    // Binds the pages of each region by its policy. The pages must not be faulted yet.
+    void PlaceNumaRegions();
+
+    // Places the buffers planned on the far memory tier there. The pages must not be faulted yet.
+    static void PlaceFarBuffers( const BufferPlanner& planner, size_t pageSize );
+
+    // Splits the buffer reservation at the bounds of every buffer, so that it's known which parts of it are used at each stage
+    void PlanMemorySegments( const BufferPlanner& planner );
+
+    // Called before each phase, with its stages. Faults back in the released parts of the reservation that
+    // the phase uses, in parallel, then releases the memory of those that none of its buffers are in.
+    void PrepareMemory( PlotStage firstStage, PlotStage lastStage );
+
+    // Logs the node distribution of a sample of each region's pages
+    void ReportNumaPlacement();
 
     // Check if the background plot writer finished
     void WaitPlotWriter();
 
+    // Picks the output directory for the next plot
+    uint SelectOutputDir();
+
+    // Returns the slot of a directory requested by a plot, after the plotter's own directories.
+    // Returns false if there is no slot left for it.
+    bool GetRequestedDir( const char* dir, uint& outSlot );
+
+    // Returns true if the phase is run. When benchmarking, only a range of phases may be run.
+    inline bool RunsPhase( uint phase ) const { return !_benchmark || ( phase >= _benchFirstPhase && phase <= _benchLastPhase ); }
+
+    // Logs the median and 95th percentile time of each phase benchmarked,
+    // and the time spent encoding table 1's parks, which dropping x bits adds to
+    void ReportBenchmark();
+
+    // Compares the phase times against the baseline, or records them to it. Returns true if any phase regressed.
+    bool CheckBaseline();
+
+    // Predicts the size of each table in the plot file after Phase 2,
+    // with droppedXBits dropped from table 1's x's
+    void PredictTableSizes( size_t tableSizes[10], uint droppedXBits );
+
+    // Walks a few proofs back from table 7 to table 1's x values, and verifies them against their f7.
+    // Returns false if any of them is invalid, or goes through an entry that Phase 2 did not mark.
+    bool SelfCheck( uint proofCount );
+
+    // Returns true if the output directory is a plot receiver's address
+    static bool IsRemoteDir( const char* dir );
+
+    // Starts generating F1 for the next plot in the background
+    void BeginNextF1( const byte* plotId );
+
+    // Waits for the background F1 to finish. If it was generated for the given plot,
+    // it is swapped into the t1 buffers and the plot skips its own F1.
+    void EndNextF1( const byte* plotId );
+
 private:
 
     MemPlotContext _context;
+
+    const char*     _outputDirs [BB_MAX_OUTPUT_DIRS] = {};
+    DiskPlotWriter* _plotWriters[BB_MAX_OUTPUT_DIRS] = {};  // One per output directory, created on first use
+    uint            _outputDirCount = 0;
+    uint            _lastOutputDir  = 0;
+    std::string     _requestedDirs[BB_MAX_OUTPUT_DIRS];     // Directories requested by plots, in the slots after ours
+    uint            _requestedDirCount = 0;
+    const char*     _profileDir     = nullptr;   // Where each plot's profile is written
+    const char*     _traceDir       = nullptr;   // Where each plot's trace is written
+    uint            _selfCheckProofs = 0;        // Proofs verified in memory before each plot is written
+    PlotPreparer*   _preparer       = nullptr;   // Prepares the next plot's file in the background, if set
+    MetricsServer*  _metricsServer  = nullptr;
+    NetKey          _netKey         = {};        // Key of the secret shared with the receivers and memory servers
+
+    // NUMA placement of the buffers
+    struct NumaRegion
+    {
+        const char* name;
+        byte*       start;
+        size_t      size;
+        NumaPolicy  policy;
+    };
+
+    std::vector<NumaRegion> _numaRegions;
+    const NumaInfo* _numa           = nullptr;   // Set if the buffers are placed across NUMA nodes
+    const char*     _numaMode       = nullptr;   // How they are placed: "interleaved", "first-touch" or "per-buffer"
+    size_t          _numaPageSize   = 0;         // Unit of the placement, which is the backing page size
+    bool            _numaReport     = false;
+    HostCoordinator* _hostCoordinator = nullptr; // Shared with the other instances of the host, not owned
+
+    // Benchmark mode
+    bool            _benchmark       = false;
+    uint            _benchFirstPhase = 1;
+    uint            _benchLastPhase  = 4;
+    const char*     _benchCacheDir   = nullptr;
+    const char*     _benchBaseline   = nullptr;
+    bool            _benchSaveBaseline = false;
+    double          _benchThreshold  = 0.05;
+    bool            _benchRegressed  = false;
+    std::vector<double> _phaseTimes[5];          // Seconds each plot spent in phases 1-4, and in all of them
+    std::vector<double> _table1ParkTimes;        // Seconds each plot spent encoding table 1's parks
+    uint64          _benchPlotBytes     = 0;     // Predicted size of the plots, summed
+    uint64          _benchStandardBytes = 0;     // Same, in the standard format
+
+    // Pipelined F1 for the next plot
+    ThreadPool*     _pipelinePool   = nullptr;   // Unpinned, so that it shares the cpus with the main pool
+    TaskHandle      _pipelineTask;
+    byte            _pipelinePlotId[32] = {};
+
+    // Phase 3's parks, encoded in the background
+    ThreadPool*     _parkPool       = nullptr;   // Unpinned, like the pipeline pool
+
+    // Parts of the buffer reservation between the bounds of its buffers, with the stages any of them are used at.
+    // The memory of those that are not used by the running phase is released, if releaseMemory is set.
+    struct MemorySegment
+    {
+        byte*  start;
+        byte*  end;
+        uint32 lifetime;    // StageMask
+        bool   released;
+    };
+
+    std::vector<MemorySegment> _memorySegments;
+    PageBacking     _backing        = {};
+    bool            _releaseMemory  = false;
 };
\ No newline at end of file
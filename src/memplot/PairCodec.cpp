@@ -0,0 +1,204 @@
+#include "PairCodec.h"
+#include "SysHost.h"
+#include "Util.h"
+
+// Typical width of the largest right offset of a block
+#define BB_PAIR_CODEC_OFFSET_BITS 9
+
+//-----------------------------------------------------------
+inline static uint BitWidth( uint64 value )
+{
+    uint width = 1;
+    while( value >> width )
+        width++;
+
+    return width;
+}
+
+//-----------------------------------------------------------
+size_t CompressedPairTable::Size() const
+{
+    size_t size = 0;
+    for( uint64 s = 0; s < segmentCount; s++ )
+        size += (size_t)segmentWords[s] * sizeof( uint64 );
+
+    return size;
+}
+
+//-----------------------------------------------------------
+void PairCodec::Init( CompressedPairTable& table, uint64 entryCount )
+{
+    Free( table );
+
+    table.entryCount   = entryCount;
+    table.blockCount   = CDiv( entryCount, BB_PAIR_CODEC_BLOCK_SIZE );
+    table.segmentCount = CDiv( table.blockCount, BB_PAIR_CODEC_SEGMENT_BLOCKS );
+    table.segments     = (uint64**)calloc( table.segmentCount + 1, sizeof( uint64* ) );
+    table.segmentWords = (uint64*) calloc( table.segmentCount + 1, sizeof( uint64 ) );
+    table.blockOffsets = (uint32*) malloc( sizeof( uint32 ) * ( table.blockCount + 1 ) );
+    table.blockWidths  = (byte*)   malloc( table.blockCount * 2 + 1 );
+}
+
+//-----------------------------------------------------------
+void PairCodec::EncodeSegment( ThreadPool& pool, CompressedPairTable& table, uint64 segment, const PackedPair* pairs )
+{
+    ASSERT( segment < table.segmentCount && !table.segments[segment] );
+
+    const uint64 entryCount  = table.entryCount;
+    const uint64 firstBlock  = segment * BB_PAIR_CODEC_SEGMENT_BLOCKS;
+    const uint64 blockCount  = std::min( table.blockCount - firstBlock, (uint64)BB_PAIR_CODEC_SEGMENT_BLOCKS );
+
+    uint32* blockOffsets = table.blockOffsets + firstBlock;
+    byte*   blockWidths  = table.blockWidths  + firstBlock * 2;
+
+    // Find the widths of each block, and the number of words they pack into
+    pool.ParallelFor( blockCount, 0, [=]( uint64 begin, uint64 end, uint ) {
+
+        for( uint64 b = begin; b < end; b++ )
+        {
+            const uint64 start = ( firstBlock + b ) * BB_PAIR_CODEC_BLOCK_SIZE;
+            const uint64 count = std::min( entryCount - start, (uint64)BB_PAIR_CODEC_BLOCK_SIZE );
+
+            uint32 maxLeft   = 0;
+            uint32 maxOffset = 0;
+
+            for( uint64 i = start; i < start + count; i++ )
+            {
+                maxLeft   = std::max( maxLeft  , pairs[i].left );
+                maxOffset = std::max( maxOffset, (uint32)pairs[i].rightOffset );
+            }
+
+            const uint leftBits   = BitWidth( maxLeft   );
+            const uint offsetBits = BitWidth( maxOffset );
+
+            blockWidths[b*2]   = (byte)leftBits;
+            blockWidths[b*2+1] = (byte)offsetBits;
+            blockOffsets[b]    = (uint32)CDiv( count * ( leftBits + offsetBits ), 64 );
+        }
+    });
+
+    // Turn the word counts into offsets
+    uint64 wordCount = 0;
+    for( uint64 b = 0; b < blockCount; b++ )
+    {
+        const uint64 blockWords = blockOffsets[b];
+        blockOffsets[b] = (uint32)wordCount;
+        wordCount += blockWords;
+    }
+
+    uint64* words = (uint64*)SysHost::VirtualAlloc( wordCount * sizeof( uint64 ) );
+    FatalIf( !words, "Failed to allocate %.2lf MiB for a compressed table.", (double)( wordCount * sizeof( uint64 ) ) BtoMB );
+
+    table.segments    [segment] = words;
+    table.segmentWords[segment] = wordCount;
+
+    pool.ParallelFor( blockCount, 0, [=]( uint64 begin, uint64 end, uint ) {
+
+        for( uint64 b = begin; b < end; b++ )
+        {
+            const uint64 start    = ( firstBlock + b ) * BB_PAIR_CODEC_BLOCK_SIZE;
+            const uint64 count    = std::min( entryCount - start, (uint64)BB_PAIR_CODEC_BLOCK_SIZE );
+            const uint   leftBits = blockWidths[b*2];
+            const uint   bitCount = leftBits + blockWidths[b*2+1];
+
+            uint64* dst  = words + blockOffsets[b];
+            uint64  acc  = 0;
+            uint    bits = 0;
+
+            for( uint64 i = start; i < start + count; i++ )
+            {
+                const uint64 v = (uint64)pairs[i].left | ( (uint64)pairs[i].rightOffset << leftBits );
+
+                acc  |= v << bits;
+                bits += bitCount;
+
+                if( bits >= 64 )
+                {
+                    *dst++ = acc;
+                    bits  -= 64;
+
+                    // bits was not 0 before this entry, as an entry is at most 48 bits
+                    acc = bits ? v >> ( bitCount - bits ) : 0;
+                }
+            }
+
+            if( bits )
+                *dst++ = acc;
+
+            ASSERT( dst == words + ( b+1 < blockCount ? blockOffsets[b+1] : wordCount ) );
+        }
+    });
+}
+
+//-----------------------------------------------------------
+void PairCodec::DecodeSegment( ThreadPool& pool, CompressedPairTable& table, uint64 segment, PackedPair* pairs )
+{
+    ASSERT( segment < table.segmentCount && table.segments[segment] );
+
+    const uint64  entryCount   = table.entryCount;
+    const uint64  firstBlock   = segment * BB_PAIR_CODEC_SEGMENT_BLOCKS;
+    const uint64  blockCount   = std::min( table.blockCount - firstBlock, (uint64)BB_PAIR_CODEC_SEGMENT_BLOCKS );
+    const uint64* words        = table.segments[segment];
+    const uint32* blockOffsets = table.blockOffsets + firstBlock;
+    const byte*   blockWidths  = table.blockWidths  + firstBlock * 2;
+
+    pool.ParallelFor( blockCount, 0, [=]( uint64 begin, uint64 end, uint ) {
+
+        for( uint64 b = begin; b < end; b++ )
+        {
+            const uint64  start     = ( firstBlock + b ) * BB_PAIR_CODEC_BLOCK_SIZE;
+            const uint64  count     = std::min( entryCount - start, (uint64)BB_PAIR_CODEC_BLOCK_SIZE );
+            const uint    leftBits  = blockWidths[b*2];
+            const uint    bitCount  = leftBits + blockWidths[b*2+1];
+            const uint64  leftMask  = ( 1ull << leftBits ) - 1;
+            const uint64  entryMask = ( 1ull << bitCount ) - 1;
+            const uint64* src       = words + blockOffsets[b];
+
+            uint64 bit = 0;
+
+            for( uint64 i = start; i < start + count; i++ )
+            {
+                const uint64 word  = bit >> 6;
+                const uint   shift = (uint)( bit & 63 );
+
+                uint64 v = src[word] >> shift;
+                if( shift + bitCount > 64 )
+                    v |= src[word+1] << ( 64 - shift );
+
+                v   &= entryMask;
+                bit += bitCount;
+
+                pairs[i].left        = (uint32)( v & leftMask );
+                pairs[i].rightOffset = (uint16)( v >> leftBits );
+            }
+        }
+    });
+
+    SysHost::VirtualFree( table.segments[segment] );
+    table.segments    [segment] = nullptr;
+    table.segmentWords[segment] = 0;
+}
+
+//-----------------------------------------------------------
+size_t PairCodec::EstimateSize( uint64 entryCount )
+{
+    // Left indices take k bits, and the right offsets of a block rarely exceed BB_PAIR_CODEC_OFFSET_BITS
+    return (size_t)CDiv( entryCount * ( _K + BB_PAIR_CODEC_OFFSET_BITS ), 8 );
+}
+
+//-----------------------------------------------------------
+void PairCodec::Free( CompressedPairTable& table )
+{
+    for( uint64 s = 0; s < table.segmentCount; s++ )
+    {
+        if( table.segments[s] )
+            SysHost::VirtualFree( table.segments[s] );
+    }
+
+    free( table.segments     );
+    free( table.segmentWords );
+    free( table.blockOffsets );
+    free( table.blockWidths  );
+
+    table = CompressedPairTable();
+}
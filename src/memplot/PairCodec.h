@@ -0,0 +1,52 @@
+#pragma once
+#include "PlotContext.h"
+
+// Entries per block. Each block is packed with its own bit widths.
+#define BB_PAIR_CODEC_BLOCK_SIZE    4096
+
+// Blocks per segment. Segments are allocated and freed on their own,
+// so that a table can be decompressed while another is compressed in its place.
+#define BB_PAIR_CODEC_SEGMENT_BLOCKS 1024
+#define BB_PAIR_CODEC_SEGMENT_SIZE  ( (uint64)BB_PAIR_CODEC_BLOCK_SIZE * BB_PAIR_CODEC_SEGMENT_BLOCKS )
+
+// A table of packed pairs, compressed by PairCodec
+struct CompressedPairTable
+{
+    uint64   entryCount   = 0;
+    uint64   blockCount   = 0;
+    uint64   segmentCount = 0;
+    uint64** segments     = nullptr;    // The blocks of each segment, each starting on a word boundary. Null until encoded.
+    uint64*  segmentWords = nullptr;    // Size of each segment, in words
+    uint32*  blockOffsets = nullptr;    // Word offset of each block in its segment
+    byte*    blockWidths  = nullptr;    // Bit widths of the left index and right offset, per block
+
+    // Size of the segments currently held, in bytes
+    size_t Size() const;
+};
+
+/**
+ * Compresses tables of packed pairs in memory.
+ *
+ * The tables are sorted on y, so their left indices are in no particular order and take
+ * close to k bits each, but their right offsets are small, as both sides of a pair
+ * are in adjacent kBC groups. Each block of entries is bit-packed with the
+ * smallest widths that fit its largest left index and right offset.
+ * The blocks of a segment are encoded and decoded in parallel.
+ */
+class PairCodec
+{
+public:
+    // Sets up an empty table for the given number of entries
+    static void Init( CompressedPairTable& table, uint64 entryCount );
+
+    // Compresses a segment of the table's pairs
+    static void EncodeSegment( ThreadPool& pool, CompressedPairTable& table, uint64 segment, const PackedPair* pairs );
+
+    // Decompresses a segment of the table's pairs, then frees it
+    static void DecodeSegment( ThreadPool& pool, CompressedPairTable& table, uint64 segment, PackedPair* pairs );
+
+    static void Free( CompressedPairTable& table );
+
+    // Typical size of a compressed table of the given number of entries
+    static size_t EstimateSize( uint64 entryCount );
+};
@@ -0,0 +1,463 @@
+#include "ParkWriter.h"
+#include "FseTables.h"
+#include "KernelDispatch.h"
+
+#define FSE_STATIC_LINKING_ONLY
+#include "fse/fse.h"
+
+#if defined( __x86_64__ ) || defined( _M_X64 )
+    #define PARK_X86 1
+    #include <immintrin.h>
+
+    #if defined( _MSC_VER ) && !defined( __clang__ )
+        #include <intrin.h>
+        #define PARK_TARGET( t )
+    #else
+        #define PARK_TARGET( t ) __attribute__((target( t )))
+    #endif
+#else
+    #define PARK_X86 0
+#endif
+
+#if defined( __aarch64__ ) || defined( _M_ARM64 )
+    #define PARK_NEON 1
+    #include <arm_neon.h>
+#else
+    #define PARK_NEON 0
+#endif
+
+// Stubs are packed in groups of 8, which take exactly StubBits bytes.
+// The 8 stubs of a group are first combined into 4 pairs of 2 * StubBits bits each:
+//  p[j] = s[2j] << StubBits | s[2j+1]
+// Pair j starts at bit j * PairGap of 64-bit word j, so each word
+// holds the tail of its own pair, followed by the head of the next one:
+//  w[j] = p[j] << ( j+1 ) * PairGap | p[j+1] >> ( 2 * StubBits - ( j+1 ) * PairGap )
+// The words are stored big-endian, as 32 bytes, of which only StubBits bytes are valid.
+// The next group overwrites the rest.
+//
+// Stubs of 24 bits or less (k < 28) don't fit this, and are written one by one instead.
+static constexpr uint   kStubBits    = PARK_STUB_BITS;
+static constexpr uint   kPairGap     = 64 - 2 * kStubBits;
+static constexpr uint64 kStubMask    = ( 1ull << kStubBits ) - 1;
+static constexpr bool   kPackPairs   = kStubBits > 24;
+
+static_assert( kStubBits <= 32, "The stub group packing needs every pair to reach into its own word." );
+static_assert( !kPackPairs || 32 - kStubBits <= PARK_STUB_OVERRUN, "Packing a group of stubs writes past the end of the group." );
+
+//-----------------------------------------------------------
+static inline void PackStubGroupScalar( const uint64* deltas, byte* dst )
+{
+    uint64 p[5];
+
+    for( uint j = 0; j < 4; j++ )
+        p[j] = ( ( deltas[j*2] & kStubMask ) << kStubBits ) | ( deltas[j*2+1] & kStubMask );
+
+    p[4] = 0;
+
+    uint64 w[4];
+
+    for( uint j = 0; j < 4; j++ )
+    {
+        const uint lShift = ( j + 1 ) * kPairGap;
+        const uint rShift = 2 * kStubBits - lShift;
+
+        // Without a gap, each word holds exactly one pair
+        const uint64 next = rShift < 64 ? p[j+1] >> rShift : 0;
+
+        w[j] = Swap64( ( p[j] << lShift ) | next );
+    }
+
+    memcpy( dst, w, sizeof( w ) );
+}
+
+// Writes the stubs of a group one by one, most significant bit first, into its exact kStubBits bytes
+//-----------------------------------------------------------
+static inline void PackStubGroupBits( const uint64* deltas, byte* dst )
+{
+    uint64 w[4] = {};
+    uint   bit  = 0;
+
+    for( uint i = 0; i < PARK_STUB_GROUP; i++, bit += kStubBits )
+    {
+        const uint64 stub  = deltas[i] & kStubMask;
+        const uint   word  = bit / 64;
+        const uint   shift = bit % 64;
+
+        w[word] |= ( stub << ( 64 - kStubBits ) ) >> shift;
+
+        if( shift + kStubBits > 64 )
+            w[word+1] |= stub << ( 128 - shift - kStubBits );
+    }
+
+    for( uint j = 0; j < 4; j++ )
+        w[j] = Swap64( w[j] );
+
+    memcpy( dst, w, kStubBits );
+}
+
+//-----------------------------------------------------------
+static void PackStubGroupsScalar( const uint64* deltas, uint64 groupCount, byte* dst )
+{
+    for( uint64 g = 0; g < groupCount; g++ )
+    {
+        if constexpr( kPackPairs )
+            PackStubGroupScalar( deltas, dst );
+        else
+            PackStubGroupBits( deltas, dst );
+
+        deltas += PARK_STUB_GROUP;
+        dst    += kStubBits;
+    }
+}
+
+#if PARK_X86
+
+//-----------------------------------------------------------
+PARK_TARGET( "avx2" )
+static void PackStubGroupsAVX2( const uint64* deltas, uint64 groupCount, byte* dst )
+{
+    const __m256i stubMask = _mm256_set1_epi64x( (long long)kStubMask );
+    const __m256i lShift   = _mm256_setr_epi64x( kPairGap, kPairGap * 2, kPairGap * 3, kPairGap * 4 );
+
+    // The last lane has no next pair. Shifting by 64 yields 0.
+    const __m256i rShift   = _mm256_setr_epi64x( 2 * kStubBits - kPairGap    , 2 * kStubBits - kPairGap * 2,
+                                                 2 * kStubBits - kPairGap * 3, 64 );
+    const __m256i bswap    = _mm256_setr_epi8( 7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+                                               7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8 );
+
+    for( uint64 g = 0; g < groupCount; g++ )
+    {
+        const __m256i a = _mm256_and_si256( _mm256_loadu_si256( (const __m256i*)deltas       ), stubMask );
+        const __m256i b = _mm256_and_si256( _mm256_loadu_si256( (const __m256i*)( deltas+4 ) ), stubMask );
+
+        // Unpacking gives [s0 s4 s2 s6] and [s1 s5 s3 s7], so swap the middle lanes
+        const __m256i even = _mm256_permute4x64_epi64( _mm256_unpacklo_epi64( a, b ), _MM_SHUFFLE( 3, 1, 2, 0 ) );
+        const __m256i odd  = _mm256_permute4x64_epi64( _mm256_unpackhi_epi64( a, b ), _MM_SHUFFLE( 3, 1, 2, 0 ) );
+
+        const __m256i pairs     = _mm256_or_si256( _mm256_slli_epi64( even, kStubBits ), odd );
+        const __m256i nextPairs = _mm256_permute4x64_epi64( pairs, _MM_SHUFFLE( 3, 3, 2, 1 ) );
+
+        __m256i words = _mm256_or_si256( _mm256_sllv_epi64( pairs, lShift ), _mm256_srlv_epi64( nextPairs, rShift ) );
+        words = _mm256_shuffle_epi8( words, bswap );
+
+        _mm256_storeu_si256( (__m256i*)dst, words );
+
+        deltas += PARK_STUB_GROUP;
+        dst    += kStubBits;
+    }
+}
+
+#endif // PARK_X86
+
+#if PARK_NEON
+
+//-----------------------------------------------------------
+static void PackStubGroupsNEON( const uint64* deltas, uint64 groupCount, byte* dst )
+{
+    const uint64x2_t stubMask = vdupq_n_u64( kStubMask );
+    const uint64x2_t zero     = vdupq_n_u64( 0 );
+
+    // vshlq shifts right on negative counts
+    const int64 lShiftValues[4] = { kPairGap, kPairGap * 2, kPairGap * 3, kPairGap * 4 };
+    const int64 rShiftValues[4] = { -(int64)( 2 * kStubBits - kPairGap     ), -(int64)( 2 * kStubBits - kPairGap * 2 ),
+                                    -(int64)( 2 * kStubBits - kPairGap * 3 ), 0 };
+
+    const int64x2_t lShift01 = vld1q_s64( lShiftValues     );
+    const int64x2_t lShift23 = vld1q_s64( lShiftValues + 2 );
+    const int64x2_t rShift01 = vld1q_s64( rShiftValues     );
+    const int64x2_t rShift23 = vld1q_s64( rShiftValues + 2 );
+
+    for( uint64 g = 0; g < groupCount; g++ )
+    {
+        // De-interleaving loads give the even and odd stubs of each half of the group
+        const uint64x2x2_t lo = vld2q_u64( deltas     );
+        const uint64x2x2_t hi = vld2q_u64( deltas + 4 );
+
+        const uint64x2_t pairs01 = vorrq_u64( vshlq_n_u64( vandq_u64( lo.val[0], stubMask ), kStubBits ), vandq_u64( lo.val[1], stubMask ) );
+        const uint64x2_t pairs23 = vorrq_u64( vshlq_n_u64( vandq_u64( hi.val[0], stubMask ), kStubBits ), vandq_u64( hi.val[1], stubMask ) );
+
+        const uint64x2_t next01  = vextq_u64( pairs01, pairs23, 1 );
+        const uint64x2_t next23  = vextq_u64( pairs23, zero   , 1 );
+
+        const uint64x2_t words01 = vorrq_u64( vshlq_u64( pairs01, lShift01 ), vshlq_u64( next01, rShift01 ) );
+        const uint64x2_t words23 = vorrq_u64( vshlq_u64( pairs23, lShift23 ), vshlq_u64( next23, rShift23 ) );
+
+        vst1q_u8( dst     , vrev64q_u8( vreinterpretq_u8_u64( words01 ) ) );
+        vst1q_u8( dst + 16, vrev64q_u8( vreinterpretq_u8_u64( words23 ) ) );
+
+        deltas += PARK_STUB_GROUP;
+        dst    += kStubBits;
+    }
+}
+
+#endif // PARK_NEON
+
+typedef void (*PackStubGroupsFn)( const uint64* deltas, uint64 groupCount, byte* dst );
+
+static PackStubGroupsFn _packStubGroups = nullptr;
+
+// The SIMD kernels pack the stubs in pairs, which the stubs of small k don't fit
+//-----------------------------------------------------------
+SimdLevel SelectParkStubsKernel( SimdLevel maxLevel )
+{
+#if PARK_X86
+    if( kPackPairs && maxLevel >= SimdLevel::AVX2 )
+    {
+        _packStubGroups = PackStubGroupsAVX2;
+        return SimdLevel::AVX2;
+    }
+#elif PARK_NEON
+    if( kPackPairs && maxLevel == SimdLevel::NEON )
+    {
+        _packStubGroups = PackStubGroupsNEON;
+        return SimdLevel::NEON;
+    }
+#endif
+
+    _packStubGroups = PackStubGroupsScalar;
+    return SimdLevel::Scalar;
+}
+
+static const SimdLevel _defaultLevel = SelectParkStubsKernel( KernelDispatch::Detect() );
+
+//-----------------------------------------------------------
+void PackParkStubs( const uint64* deltas, const uint64 count, byte* dst )
+{
+    const uint64 groupCount = count / PARK_STUB_GROUP;
+
+    _packStubGroups( deltas, groupCount, dst );
+
+    // Pad the trailing stubs with 0s to a whole group.
+    // Reading past them could go past the end of the line point buffer.
+    const uint64 trailing = count - groupCount * PARK_STUB_GROUP;
+
+    if( trailing )
+    {
+        uint64 group[PARK_STUB_GROUP] = {};
+        memcpy( group, deltas + groupCount * PARK_STUB_GROUP, trailing * sizeof( uint64 ) );
+
+        if constexpr( kPackPairs )
+            PackStubGroupScalar( group, dst + groupCount * kStubBits );
+        else
+            PackStubGroupBits( group, dst + groupCount * kStubBits );
+    }
+}
+
+// ORs value's bitCount low bits into dst at bit, most significant first. dst must be zeroed.
+//-----------------------------------------------------------
+static inline void WriteBitsBE( byte* dst, uint64 bit, const uint64 value, uint bitCount )
+{
+    while( bitCount )
+    {
+        const uint   byteBits = 8 - (uint)( bit & 7 );
+        const uint   n        = std::min( byteBits, bitCount );
+        const uint64 chunk    = ( value >> ( bitCount - n ) ) & ( ( 1u << n ) - 1 );
+
+        dst[bit >> 3] |= (byte)( chunk << ( byteBits - n ) );
+
+        bit      += n;
+        bitCount -= n;
+    }
+}
+
+//-----------------------------------------------------------
+void WriteDroppedXPark( const size_t parkSize, const uint64 count, uint64* linePoints, byte* parkBuffer, const uint droppedBits )
+{
+    ASSERT( count && count <= kEntriesPerPark );
+    ASSERT( droppedBits && droppedBits <= BB_MAX_DROPPED_X_BITS );
+
+    const uint   lpBits           = ( _K - droppedBits ) * 2;
+    const uint   stubBits         = DroppedXStubBits( droppedBits );
+    const uint64 stubMask         = ( 1ull << stubBits ) - 1;
+    const size_t lpBytes          = CDiv( lpBits, 8 );
+    const size_t stubSectionBytes = CDiv( (kEntriesPerPark - 1) * stubBits, 8 );
+
+    // The first line point and the stubs are OR'd in bit by bit
+    memset( parkBuffer, 0, lpBytes + stubSectionBytes );
+
+    uint64 prevLinePoint = linePoints[0];
+    WriteBitsBE( parkBuffer, 0, prevLinePoint, lpBits );
+
+    // Convert to deltas
+    for( uint64 i = 1; i < count; i++ )
+    {
+        uint64 linePoint = linePoints[i];
+        linePoints[i]    = linePoint - prevLinePoint;
+
+        prevLinePoint = linePoint;
+    }
+
+    // Write stubs
+    byte* stubWriter = parkBuffer + lpBytes;
+
+    for( uint64 i = 1; i < count; i++ )
+        WriteBitsBE( stubWriter, ( i - 1 ) * stubBits, linePoints[i] & stubMask, stubBits );
+
+    // Convert to small deltas, in place, as WritePark does
+    byte* smallDeltas = (byte*)&linePoints[1];
+
+    for( uint64 i = 1; i < count; i++ )
+    {
+        smallDeltas[i-1] = (byte)( linePoints[i] >> stubBits );
+        ASSERT( ( linePoints[i] >> stubBits ) < 256 );
+    }
+
+    // Write small deltas
+    byte*   deltaBytesWriter = stubWriter + stubSectionBytes;
+    uint16* deltaSizeWriter  = (uint16*)deltaBytesWriter;
+    deltaBytesWriter += 2;
+
+    size_t deltasSize = count > 1 ? 
+                        FSE_compress_usingCTable( deltaBytesWriter, (count-1) * 8, smallDeltas, count-1, GetDroppedXCTable() )
+                        : 0;
+
+    if( !deltasSize )
+    {
+        // Deltas were NOT compressed, we have to copy them raw
+        deltasSize = (count-1);
+        *deltaSizeWriter = (uint16)(deltasSize | 0x8000);
+        memcpy( deltaBytesWriter, smallDeltas, count-1 );
+    }
+    else
+        *deltaSizeWriter = (uint16)deltasSize;
+
+    deltaBytesWriter += deltasSize;
+
+    const size_t parkSizeWritten = deltaBytesWriter - parkBuffer;
+
+    if( parkSizeWritten > parkSize )
+        Fatal( "Overran park buffer for table 1." );
+
+    memset( deltaBytesWriter, 0, parkSize - parkSizeWritten );
+}
+
+// Small deltas of a full park, and the room they are given to be encoded, as FSE_compress_usingCTable gets them
+static constexpr size_t kParkDeltaCount    = kEntriesPerPark - 1;
+static constexpr size_t kParkDeltaDstBytes = kParkDeltaCount * 8;
+
+static_assert( kParkDeltaCount & 1, "EncodeDeltaLanes expects an odd count of small deltas." );
+static_assert( kParkDeltaDstBytes >= FSE_BLOCKBOUND( kParkDeltaCount ), "EncodeDeltaLanes expects FSE's fast flushing." );
+
+// Encodes the small deltas of PARK_ENCODE_LANES full parks, each as its own stream.
+// Each stream is the exact one FSE_compress_usingCTable writes in its fast mode, from the last symbol back,
+// alternating between 2 states. Interleaving the streams lets their state transitions, which each depend on
+// the one before, run alongside each other.
+// Each lane's result is as FSE_compress_usingCTable's: the encoded size, or 0 if it did not fit.
+//-----------------------------------------------------------
+static void EncodeDeltaLanes( byte* dst[PARK_ENCODE_LANES], const byte* src[PARK_ENCODE_LANES],
+                              const FSE_CTable* ct, size_t outSizes[PARK_ENCODE_LANES] )
+{
+    constexpr uint lanes = PARK_ENCODE_LANES;
+
+    // 4 symbols go between flushes when the bit container holds their bits
+    constexpr bool fourPerFlush = sizeof( size_t ) * 8 > FSE_MAX_TABLELOG * 4 + 7;
+    constexpr bool twoPerFlush  = sizeof( size_t ) * 8 < FSE_MAX_TABLELOG * 2 + 7;
+
+    BIT_CStream_t bitC  [lanes];
+    FSE_CState_t  state1[lanes];
+    FSE_CState_t  state2[lanes];
+
+    for( uint l = 0; l < lanes; l++ )
+    {
+        if( FSE_isError( BIT_initCStream( &bitC[l], dst[l], kParkDeltaDstBytes ) ) )
+            Fatal( "Failed to initialize the deltas bit stream." );
+
+        const byte* ip = src[l] + kParkDeltaCount;
+
+        FSE_initCState2( &state1[l], ct, ip[-1] );
+        FSE_initCState2( &state2[l], ct, ip[-2] );
+        FSE_encodeSymbol( &bitC[l], &state1[l], ip[-3] );
+        BIT_flushBitsFast( &bitC[l] );
+    }
+
+    size_t i = kParkDeltaCount - 3;
+
+    // Join to a multiple of 4
+    if( fourPerFlush && ( ( kParkDeltaCount - 2 ) & 2 ) )
+    {
+        for( uint l = 0; l < lanes; l++ )
+        {
+            FSE_encodeSymbol( &bitC[l], &state2[l], src[l][i-1] );
+            FSE_encodeSymbol( &bitC[l], &state1[l], src[l][i-2] );
+            BIT_flushBitsFast( &bitC[l] );
+        }
+
+        i -= 2;
+    }
+
+    while( i > 0 )
+    {
+        for( uint l = 0; l < lanes; l++ )
+        {
+            const byte* ip = src[l] + i;
+
+            FSE_encodeSymbol( &bitC[l], &state2[l], ip[-1] );
+
+            if( twoPerFlush )
+                BIT_flushBitsFast( &bitC[l] );
+
+            FSE_encodeSymbol( &bitC[l], &state1[l], ip[-2] );
+
+            if( fourPerFlush )
+            {
+                FSE_encodeSymbol( &bitC[l], &state2[l], ip[-3] );
+                FSE_encodeSymbol( &bitC[l], &state1[l], ip[-4] );
+            }
+
+            BIT_flushBitsFast( &bitC[l] );
+        }
+
+        i -= fourPerFlush ? 4 : 2;
+    }
+
+    for( uint l = 0; l < lanes; l++ )
+    {
+        FSE_flushCState( &bitC[l], &state2[l] );
+        FSE_flushCState( &bitC[l], &state1[l] );
+
+        // 0 if the stream overflowed its room, and the deltas are stored raw
+        outSizes[l] = BIT_closeCStream( &bitC[l] );
+    }
+}
+
+//-----------------------------------------------------------
+void WriteFullParks( const size_t parkSize, const uint64 parkCount, uint64* linePoints, byte* parkBuffer, TableId tableId,
+                     const uint droppedXBits )
+{
+    uint64 p = 0;
+
+    // Parks of dropped x bits are encoded one by one with their own table
+    if( !droppedXBits )
+    {
+        const FSE_CTable* ct = CTables[(int)tableId];
+
+        for( ; p + PARK_ENCODE_LANES <= parkCount; p += PARK_ENCODE_LANES )
+        {
+            byte*       deltaWriters[PARK_ENCODE_LANES];
+            byte*       dst         [PARK_ENCODE_LANES];
+            const byte* smallDeltas [PARK_ENCODE_LANES];
+            size_t      deltasSizes [PARK_ENCODE_LANES];
+
+            for( uint l = 0; l < PARK_ENCODE_LANES; l++ )
+            {
+                byte* deltas;
+
+                deltaWriters[l] = BeginPark( kEntriesPerPark, linePoints + ( p + l ) * kEntriesPerPark,
+                                             parkBuffer + ( p + l ) * parkSize, deltas );
+                dst[l]          = deltaWriters[l] + 2;
+                smallDeltas[l]  = deltas;
+            }
+
+            EncodeDeltaLanes( dst, smallDeltas, ct, deltasSizes );
+
+            for( uint l = 0; l < PARK_ENCODE_LANES; l++ )
+            {
+                EndPark( parkSize, kEntriesPerPark, parkBuffer + ( p + l ) * parkSize, smallDeltas[l],
+                         deltaWriters[l], deltasSizes[l], tableId );
+            }
+        }
+    }
+
+    for( ; p < parkCount; p++ )
+        WritePark( parkSize, kEntriesPerPark, linePoints + p * kEntriesPerPark, parkBuffer + p * parkSize, tableId, droppedXBits );
+}
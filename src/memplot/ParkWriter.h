@@ -1,7 +1,26 @@
 #pragma once
 #include "memplot/CTables.h"
 #include "ChiaConsts.h"
+#include "Config.h"
 #include "threading/ThreadPool.h"
+#include "PlotWriter.h"
+#include <atomic>
+#include <vector>
+
+// Stub size of each line point delta. It is 29 bits at k32.
+#define PARK_STUB_BITS    ( _K - kStubMinusBits )
+
+// Stubs are packed in groups of this many stubs, which take exactly PARK_STUB_BITS bytes
+#define PARK_STUB_GROUP   8
+
+// Max bytes PackParkStubs writes past the end of the packed stubs
+#define PARK_STUB_OVERRUN 7
+
+// Parks per chunk when streaming parks to the plot writer
+#define PARK_STREAM_CHUNK_PARKS 64
+
+// Full parks whose small deltas are encoded at once by a thread, each as its own FSE stream (see WriteFullParks)
+#define PARK_ENCODE_LANES 4
 
 struct WriteParkJob
 {
@@ -10,25 +29,91 @@ struct WriteParkJob
     uint64* linePoints;     // Sorted line points to write to the park
     byte*   parkBuffer;     // Buffer into which the parks will be written
     TableId tableId;        // What table are we writing this park to?
+    uint    droppedXBits;   // Low bits dropped from the x's of table 1's line points, or 0
+};
+
+// State shared by all threads streaming a table's parks
+struct StreamParksState
+{
+    size_t          parkSize;
+    uint64          parkCount;          // Including the trailing park, if any
+    uint64          trailingEntries;    // Entries in the last park, if it's not full
+    uint64          chunkCount;
+    uint64*         linePoints;
+    byte*           parkBuffer;
+    TableId         tableId;
+    uint            droppedXBits;
+    DiskPlotWriter* writer;
+
+    std::atomic<uint64> nextChunk;
+
+    // Chunk each thread is encoding, or a lower one while it's taking its next one.
+    // All chunks below the lowest of them are finished.
+    std::vector<std::atomic<uint64>> threadChunks;
+};
+
+struct StreamParksJob
+{
+    StreamParksState* state;
+    uint              threadId;
+    uint              threadCount;
 };
 
 // Write parks in parallel
-// Returns the total size written
+// Returns the total size written.
+// If droppedXBits is set, table 1's line points are of x's with that many low bits dropped (see WriteDroppedXPark).
+template<uint MaxJobs>
+size_t WriteParks( ThreadPool& pool, const uint64 length, uint64* linePoints, byte* parkBuffer, TableId tableId,
+                   uint droppedXBits = 0 );
+
+// Same as WriteParks, but the parks are encoded in chunks, in park order, and the plot writer's
+// streamed table progress is reported as each prefix of the parks is finished.
+// The writer must have begun a streamed table on parkBuffer.
 template<uint MaxJobs>
-size_t WriteParks( ThreadPool& pool, const uint64 length, uint64* linePoints, byte* parkBuffer, TableId tableId );
+size_t WriteParksStreamed( ThreadPool& pool, const uint64 length, uint64* linePoints, byte* parkBuffer, 
+                           TableId tableId, DiskPlotWriter& writer, uint droppedXBits = 0 );
 
 // Write a single park.
 // Returns the offset to the next park buffer
-void WritePark( const size_t parkSize, const uint64 count, uint64* linePoints, byte* parkBuffer, TableId tableId );
+void WritePark( const size_t parkSize, const uint64 count, uint64* linePoints, byte* parkBuffer, TableId tableId,
+                uint droppedXBits = 0 );
+
+// Writes parkCount consecutive full parks, of kEntriesPerPark line points each.
+// Their small deltas are FSE-encoded PARK_ENCODE_LANES parks at a time, interleaved, as separate streams,
+// so that each stream's chain of state transitions runs alongside the others', instead of one after the other.
+// The parks are the same as if they were written one by one with WritePark.
+void WriteFullParks( const size_t parkSize, const uint64 parkCount, uint64* linePoints, byte* parkBuffer, TableId tableId,
+                     uint droppedXBits = 0 );
+
+// Writes the first line point and the stubs of a park, and converts its deltas to small deltas, in place.
+// Returns where the size of the small deltas goes, followed by their encoding.
+byte* BeginPark( const uint64 count, uint64* linePoints, byte* parkBuffer, byte*& outSmallDeltas );
+
+// Writes the size of the encoded small deltas, or copies them raw if they were not compressed (deltasSize is 0),
+// and zeroes the rest of the park.
+void EndPark( const size_t parkSize, const uint64 count, byte* parkBuffer, const byte* smallDeltas,
+              byte* deltaBytesWriter, size_t deltasSize, TableId tableId );
+
+// Writes a park of table 1 line points whose x's had droppedBits low bits dropped.
+// It's laid out as any other park, with line points of 2 * (k - droppedBits) bits, stubs of DroppedXStubBits(),
+// and small deltas encoded with GetDroppedXCTable(). The stubs are packed without the SIMD kernels, as their size varies.
+void WriteDroppedXPark( const size_t parkSize, const uint64 count, uint64* linePoints, byte* parkBuffer, uint droppedBits );
 
 void WriteParkThread( WriteParkJob* job );
+void StreamParksThread( StreamParksJob* job );
+
+// Packs the stubs of count line point deltas as a big-endian bitstream, for the stub section of a park.
+// Unused bits of the last byte are 0, but up to PARK_STUB_OVERRUN bytes are written after it.
+// The widest SIMD kernel the CPU supports is selected at runtime. See KernelDispatch.
+void PackParkStubs( const uint64* deltas, uint64 count, byte* dst );
 
 //-----------------------------------------------------------
 template<uint MaxJobs>
-inline size_t WriteParks( ThreadPool& pool, const uint64 length, uint64* linePoints, byte* parkBuffer, TableId tableId )
+inline size_t WriteParks( ThreadPool& pool, const uint64 length, uint64* linePoints, byte* parkBuffer, TableId tableId,
+                          const uint droppedXBits )
 {
     const uint   threadCount    = MaxJobs > pool.ThreadCount() ? pool.ThreadCount() : MaxJobs;
-    const size_t parkSize       = CalculateParkSize( tableId );
+    const size_t parkSize       = droppedXBits ? CalculateDroppedXParkSize( droppedXBits ) : CalculateParkSize( tableId );
     const uint64 parkCount      = length / kEntriesPerPark;
     const uint64 parksPerThread = parkCount / threadCount;
     
@@ -39,7 +124,7 @@ inline size_t WriteParks( ThreadPool& pool, const uint64 length, uint64* linePoi
     const uint64 trailingEntries    = length - parkEntriesWritten;
     ASSERT( trailingEntries <= kEntriesPerPark );
 
-    WriteParkJob jobs[MaxJobs];
+    std::vector<WriteParkJob> jobs( threadCount );
     
     uint64* threadLinePoints = linePoints;
     byte*   threadParkBuffer = parkBuffer;
@@ -53,6 +138,7 @@ inline size_t WriteParks( ThreadPool& pool, const uint64 length, uint64* linePoi
         job.linePoints = threadLinePoints;
         job.parkBuffer = threadParkBuffer;
         job.tableId    = tableId;
+        job.droppedXBits = droppedXBits;
 
         // Assign trailer parks accross threads. hehe
         if( trailingParks )
@@ -66,11 +152,11 @@ inline size_t WriteParks( ThreadPool& pool, const uint64 length, uint64* linePoi
     }
 
     ASSERT( !trailingParks );
-    pool.RunJob( WriteParkThread, jobs, threadCount );
+    pool.RunJob( WriteParkThread, jobs.data(), threadCount );
 
     // Write trailing entries if any
     if( trailingEntries )
-        WritePark( parkSize, trailingEntries, threadLinePoints, threadParkBuffer, tableId );
+        WritePark( parkSize, trailingEntries, threadLinePoints, threadParkBuffer, tableId, droppedXBits );
     
     
     const size_t sizeWritten = parkSize * ( parkCount + (trailingEntries ? 1 : 0) );
@@ -79,16 +165,75 @@ inline size_t WriteParks( ThreadPool& pool, const uint64 length, uint64* linePoi
 }
 
 //-----------------------------------------------------------
-inline void WritePark( const size_t parkSize, const uint64 count, uint64* linePoints, byte* parkBuffer, TableId tableId )
+template<uint MaxJobs>
+inline size_t WriteParksStreamed( ThreadPool& pool, const uint64 length, uint64* linePoints, byte* parkBuffer, 
+                                  TableId tableId, DiskPlotWriter& writer, const uint droppedXBits )
+{
+    const uint   threadCount     = MaxJobs > pool.ThreadCount() ? pool.ThreadCount() : MaxJobs;
+    const uint64 fullParks       = length / kEntriesPerPark;
+    const uint64 trailingEntries = length - fullParks * kEntriesPerPark;
+
+    StreamParksState state;
+    state.parkSize        = droppedXBits ? CalculateDroppedXParkSize( droppedXBits ) : CalculateParkSize( tableId );
+    state.parkCount       = fullParks + ( trailingEntries ? 1 : 0 );
+    state.trailingEntries = trailingEntries;
+    state.chunkCount      = CDiv( state.parkCount, PARK_STREAM_CHUNK_PARKS );
+    state.linePoints      = linePoints;
+    state.parkBuffer      = parkBuffer;
+    state.tableId         = tableId;
+    state.droppedXBits    = droppedXBits;
+    state.writer          = &writer;
+    state.nextChunk       = 0;
+    state.threadChunks    = std::vector<std::atomic<uint64>>( threadCount );
+
+    std::vector<StreamParksJob> jobs( threadCount );
+
+    for( uint i = 0; i < threadCount; i++ )
+    {
+        state.threadChunks[i] = 0;
+
+        jobs[i].state       = &state;
+        jobs[i].threadId    = i;
+        jobs[i].threadCount = threadCount;
+    }
+
+    pool.RunJob( StreamParksThread, jobs.data(), threadCount );
+
+    return state.parkSize * state.parkCount;
+}
+
+//-----------------------------------------------------------
+inline void WritePark( const size_t parkSize, const uint64 count, uint64* linePoints, byte* parkBuffer, TableId tableId,
+                       const uint droppedXBits )
 {
     ASSERT( count <= kEntriesPerPark );
 
-    uint64* writer = (uint64*)parkBuffer;
+    if( droppedXBits )
+    {
+        WriteDroppedXPark( parkSize, count, linePoints, parkBuffer, droppedXBits );
+        return;
+    }
+
+    byte* smallDeltas;
+    byte* deltaBytesWriter = BeginPark( count, linePoints, parkBuffer, smallDeltas );
+
+    const size_t deltasSize = FSE_compress_usingCTable( 
+                                deltaBytesWriter + 2, (count-1) * 8,
+                                smallDeltas, count-1, CTables[(int)tableId] );
 
-    // Write the first LinePoint as a full LinePoint
+    EndPark( parkSize, count, parkBuffer, smallDeltas, deltaBytesWriter, deltasSize, tableId );
+}
+
+//-----------------------------------------------------------
+inline byte* BeginPark( const uint64 count, uint64* linePoints, byte* parkBuffer, byte*& outSmallDeltas )
+{
+    // Write the first LinePoint as a full LinePoint, of 2k bits, left-aligned.
+    // Below k32, the stubs overwrite the bytes past its CDiv( 2k, 8 ) bytes.
     uint64 prevLinePoint = linePoints[0];
 
-    *writer++ = Swap64( prevLinePoint );
+    *(uint64*)parkBuffer = Swap64( prevLinePoint << ( 64 - _K * 2 ) );
+
+    byte* writer = parkBuffer + CDiv( _K * 2, 8 );
 
     // Convert to deltas
     for( uint64 i = 1; i < count; i++ )
@@ -100,66 +245,16 @@ inline void WritePark( const size_t parkSize, const uint64 count, uint64* linePo
     }
 
     // Grab the writing location after the stubs
-    const uint64 stubBitSize      = (_K - kStubMinusBits);       // For us, it is 29 bits since K = 32
+    const uint64 stubBitSize      = PARK_STUB_BITS;
     const size_t stubSectionBytes = CDiv( (kEntriesPerPark - 1) * stubBitSize, 8 );
 
-    byte* deltaBytesWriter = ((byte*)writer) + stubSectionBytes;
+    byte* deltaBytesWriter = writer + stubSectionBytes;
 
     // Write stubs
+    // #NOTE: PackParkStubs writes past the stubs, into the start of the deltas section,
+    //        which is written afterwards.
     {
-        const uint64 stubMask = ((1ULL << stubBitSize) - 1);
-
-        uint64 field = 0;   // Current field to write
-        uint   bits  = 0;   // Bits occupying the current field (always shifted to the leftmost bits)
-
-        for( uint64 i = 1; i < count; i++ )
-        {
-            const uint64 lpDelta = linePoints[i];
-            const uint64 stub    = lpDelta & stubMask;
-
-            // Serialize into bits, one uint64 field at a time
-            // Always store it all the way to the MSbits
-            const uint freeBits = 64 - bits;
-            if( freeBits <= stubBitSize )
-            {
-                // Update the next field bits to what the stub bits that were not written into the current field
-                bits = stubBitSize - freeBits;
-
-                // Write what we can (which may be nothing) into the free bits of the current field
-                field |= stub >> bits;
-
-                // Store field
-                *writer++ = Swap64( field );
-
-                // Write the remaining stub bits (which may be none) into the next field
-                // if( bits )
-                //     field = stub << ( 64 - bits );
-                // else
-                //     field = 0;
-
-                // #NOTE: I benchmarked both branching and non-branching
-                //        versions and they pretty much run the same in arm CPUs.
-                //        Perhaps we should go with the branching method with no undefined behavior.
-
-                // Add a mask to avoid branching here.
-                // If the bits is 0, we will shift by 64 bits, which
-                // is undefined behavior. Therefore, we mask it so that in the
-                // case that bits is 0, we will mask it out to 0.
-                const uint remainder = 64 - bits;
-                uint64 mask = ( ( 1ull << bits ) - 1 ) << (remainder & 63);
-                field = ( stub << remainder ) & mask;
-            }
-            else
-            {
-                // The stub completely fits into the current field with room to spare
-                field |= stub << (freeBits - stubBitSize);
-                bits += stubBitSize;
-            }
-        }
-
-        // Write any trailing fields
-        if( bits > 0 )
-            *writer++ = Swap64( field );
+        PackParkStubs( linePoints + 1, count - 1, writer );
 
         // Zero-out any remaining unused bytes
         const size_t stubUsedBytes  = CDiv( (count - 1) * stubBitSize, 8 );
@@ -200,60 +295,101 @@ inline void WritePark( const size_t parkSize, const uint64 count, uint64* linePo
         ASSERT( averageDeltaBits <= kMaxAverageDeltaTable1 );
     #endif
 
-    // Write small deltas
-    {
-        uint16* deltaSizeWriter = (uint16*)deltaBytesWriter;
-        deltaBytesWriter += 2;
-
-        const FSE_CTable* ct = CTables[(int)tableId];
+    outSmallDeltas = smallDeltas;
+    return deltaBytesWriter;
+}
 
-        size_t deltasSize = FSE_compress_usingCTable( 
-                                deltaBytesWriter, (count-1) * 8,
-                                smallDeltas, count-1, ct );
+//-----------------------------------------------------------
+inline void EndPark( const size_t parkSize, const uint64 count, byte* parkBuffer, const byte* smallDeltas,
+                     byte* deltaBytesWriter, size_t deltasSize, const TableId tableId )
+{
+    uint16* deltaSizeWriter = (uint16*)deltaBytesWriter;
+    deltaBytesWriter += 2;
 
-        if( !deltasSize )
-        {
-            // Deltas were NOT compressed, we have to copy them raw
-            deltasSize = (count-1);
-            *deltaSizeWriter = (uint16)(deltasSize | 0x8000);
-            memcpy( deltaBytesWriter, smallDeltas, count-1 );
-        }
-        else
-        {
-            // Deltas were compressed
-            *deltaSizeWriter = (uint16)deltasSize;
-        }
+    if( !deltasSize )
+    {
+        // Deltas were NOT compressed, we have to copy them raw
+        deltasSize = (count-1);
+        *deltaSizeWriter = (uint16)(deltasSize | 0x8000);
+        memcpy( deltaBytesWriter, smallDeltas, count-1 );
+    }
+    else
+    {
+        // Deltas were compressed
+        *deltaSizeWriter = (uint16)deltasSize;
+    }
 
-        deltaBytesWriter += deltasSize;
+    deltaBytesWriter += deltasSize;
 
-        const size_t parkSizeWritten = deltaBytesWriter - parkBuffer;
+    const size_t parkSizeWritten = deltaBytesWriter - parkBuffer;
 
-        if( parkSizeWritten > parkSize )
-            Fatal( "Overran park buffer for table %d.", (int)tableId + 1 );
-        
-        // Zero-out any remaining bytes in the deltas section
-        const size_t parkSizeRemainder = parkSize - parkSizeWritten;
+    if( parkSizeWritten > parkSize )
+        Fatal( "Overran park buffer for table %d.", (int)tableId + 1 );
+    
+    // Zero-out any remaining bytes in the deltas section
+    const size_t parkSizeRemainder = parkSize - parkSizeWritten;
 
-        memset( deltaBytesWriter, 0, parkSizeRemainder );
-    }
+    memset( deltaBytesWriter, 0, parkSizeRemainder );
 }
 
 //-----------------------------------------------------------
 inline void WriteParkThread( WriteParkJob* job )
 {
-    const size_t  parkSize  = job->parkSize;
-    const uint64  parkCount = job->parkCount;
-    const TableId tableId   = job->tableId;
+    WriteFullParks( job->parkSize, job->parkCount, job->linePoints, job->parkBuffer, job->tableId, job->droppedXBits );
+}
+
+//-----------------------------------------------------------
+inline void StreamParksThread( StreamParksJob* job )
+{
+    StreamParksState& state       = *job->state;
+    const uint        threadCount = job->threadCount;
+    const size_t      parkSize    = state.parkSize;
 
-    uint64* linePoints = job->linePoints;
-    byte*   parkBuffer = job->parkBuffer;
+    std::atomic<uint64>& threadChunk = state.threadChunks[job->threadId];
 
-    for( uint64 i = 0; i < parkCount; i++ )
+    for( ;; )
     {
-        WritePark( parkSize, kEntriesPerPark, linePoints, parkBuffer, tableId );
+        // Never let our chunk go above the one we take, so that the
+        // other threads don't see it as finished before we've taken it.
+        threadChunk.store( state.nextChunk.load( std::memory_order_acquire ), std::memory_order_release );
+
+        const uint64 chunk = state.nextChunk.fetch_add( 1, std::memory_order_acq_rel );
+
+        if( chunk >= state.chunkCount )
+            break;
+
+        threadChunk.store( chunk, std::memory_order_release );
+
+        const uint64 parkStart = chunk * PARK_STREAM_CHUNK_PARKS;
+        const uint64 parkEnd   = std::min( parkStart + PARK_STREAM_CHUNK_PARKS, state.parkCount );
+
+        // Only the last park may not be full
+        const bool   hasTrailing = parkEnd == state.parkCount && state.trailingEntries;
+        const uint64 fullEnd     = hasTrailing ? parkEnd - 1 : parkEnd;
+
+        WriteFullParks( parkSize, fullEnd - parkStart, state.linePoints + parkStart * kEntriesPerPark,
+                        state.parkBuffer + parkStart * parkSize, state.tableId, state.droppedXBits );
+
+        if( hasTrailing )
+        {
+            WritePark( parkSize, state.trailingEntries, state.linePoints + fullEnd * kEntriesPerPark,
+                       state.parkBuffer + fullEnd * parkSize, state.tableId, state.droppedXBits );
+        }
+
+        // Report the parks before the lowest chunk still being encoded as ready
+        uint64 finished = state.nextChunk.load( std::memory_order_acquire );
         
-        linePoints += kEntriesPerPark;
-        parkBuffer += parkSize;
+        threadChunk.store( finished, std::memory_order_release );
+
+        for( uint i = 0; i < threadCount; i++ )
+            finished = std::min( finished, state.threadChunks[i].load( std::memory_order_acquire ) );
+
+        finished = std::min( finished, state.chunkCount );
+
+        if( finished )
+            state.writer->StreamTableProgress( std::min( finished * PARK_STREAM_CHUNK_PARKS, state.parkCount ) * parkSize );
     }
-}
 
+    // We have no chunks left
+    threadChunk.store( UINT64_MAX, std::memory_order_release );
+}
@@ -0,0 +1,372 @@
+#include "PhaseCache.h"
+#include "io/FileStream.h"
+#include "SysHost.h"
+#include "Util.h"
+#include "util/Log.h"
+#include "RankIndex.h"
+#include <vector>
+
+#define BB_SNAPSHOT_MAGIC        0x50414E5342424242ull    // "BBBBSNAP"
+#define BB_SNAPSHOT_VERSION      3
+#define BB_SNAPSHOT_MAX_SECTIONS 8
+
+struct SnapshotSection
+{
+    uint64 offset;      // In the file, block-aligned
+    uint64 size;
+};
+
+struct SnapshotHeader
+{
+    uint64          magic;
+    uint32          version;
+    uint32          k;
+    uint32          phase;
+    uint32          sectionCount;
+    byte            plotId[32];
+    uint64          entryCount[7];
+    uint64          alignment;              // Block size the sections are aligned to
+
+    // The C tables built by Phase 3, as offsets into the Phase 4 table buffer
+    uint32          cTablesBuilt;
+    uint32          reserved;
+    uint64          cTableOffsets[3];
+    uint64          cTableSizes  [3];
+
+    SnapshotSection sections[BB_SNAPSHOT_MAX_SECTIONS];
+};
+
+struct SnapshotIOJob
+{
+    const char* path;
+    byte*       buffer;
+    uint64      offset;
+    size_t      size;
+    bool        write;
+    bool        success;
+};
+
+static std::string SnapshotPath( const char* dir, uint phase );
+static uint        GetSections( MemPlotContext& cx, const SnapshotHeader& header, byte* outBuffers[BB_SNAPSHOT_MAX_SECTIONS], uint64 outSizes[BB_SNAPSHOT_MAX_SECTIONS] );
+static void        RunSectionIO( ThreadPool& pool, const char* path, byte* buffer, const SnapshotSection& section, size_t alignment, bool write );
+static void        SnapshotIOThread( SnapshotIOJob* job );
+
+//-----------------------------------------------------------
+void WritePhaseCache( MemPlotContext& cx, const char* dir, uint phase )
+{
+    ASSERT( phase >= 1 && phase <= 3 );
+    ASSERT( !cx.spill );
+
+    const std::string path = SnapshotPath( dir, phase );
+
+    Log::Line( "Writing the Phase %u snapshot to %s", phase, path.c_str() );
+    auto timer = TimerBegin();
+
+    // Created empty, and written to by each thread through its own handle
+    FileStream file;
+    if( !file.Open( path.c_str(), FileMode::Create, FileAccess::Write, FileFlags::NoBuffering | FileFlags::LargeFile ) )
+        Fatal( "Failed to create snapshot file %s with error %d.", path.c_str(), file.GetError() );
+
+    const size_t alignment = file.BlockSize();
+
+    SnapshotHeader* header = (SnapshotHeader*)SysHost::VirtualAlloc( RoundUpToNextBoundary( sizeof( SnapshotHeader ), (int)alignment ) );
+    memset( header, 0, sizeof( SnapshotHeader ) );
+
+    header->version   = BB_SNAPSHOT_VERSION;
+    header->k         = _K;
+    header->phase     = phase;
+    header->alignment = alignment;
+    memcpy( header->plotId    , cx.plotId    , sizeof( header->plotId ) );
+    memcpy( header->entryCount, cx.entryCount, sizeof( header->entryCount ) );
+
+    if( phase == 3 && cx.cTablesBuilt )
+    {
+        header->cTablesBuilt = 1;
+
+        for( uint i = 0; i < 3; i++ )
+        {
+            header->cTableOffsets[i] = (uint64)( cx.cTableBuffers[i] - cx.p4TableBuffer );
+            header->cTableSizes  [i] = cx.cTableSizes[i];
+        }
+    }
+
+    byte*  buffers[BB_SNAPSHOT_MAX_SECTIONS];
+    uint64 sizes  [BB_SNAPSHOT_MAX_SECTIONS];
+    const uint sectionCount = GetSections( cx, *header, buffers, sizes );
+
+    header->sectionCount = sectionCount;
+
+    uint64 offset    = RoundUpToNextBoundary( sizeof( SnapshotHeader ), (int)alignment );
+    uint64 totalSize = 0;
+
+    for( uint i = 0; i < sectionCount; i++ )
+    {
+        SnapshotSection& section = header->sections[i];
+        section.offset = offset;
+        section.size   = sizes[i];
+
+        RunSectionIO( *cx.threadPool, path.c_str(), buffers[i], section, alignment, true );
+
+        offset    += RoundUpToNextBoundary( section.size, (int)alignment );
+        totalSize += section.size;
+    }
+
+    // The header goes in last, once the sections are on disk
+    header->magic = BB_SNAPSHOT_MAGIC;
+
+    if( !file.Seek( 0, SeekOrigin::Begin ) ||
+        file.Write( header, RoundUpToNextBoundary( sizeof( SnapshotHeader ), (int)alignment ) ) < (ssize_t)sizeof( SnapshotHeader ) ||
+        !file.Flush() )
+        Fatal( "Failed to write snapshot file %s with error %d.", path.c_str(), file.GetError() );
+
+    SysHost::VirtualFree( header );
+
+    const double elapsed = TimerEnd( timer );
+    Log::Line( "Wrote %.2lf GiB in %.2lf seconds.", (double)totalSize BtoGB, elapsed );
+}
+
+//-----------------------------------------------------------
+void ReadPhaseCache( MemPlotContext& cx, const char* dir, uint phase )
+{
+    ASSERT( phase >= 1 && phase <= 3 );
+    ASSERT( !cx.spill );
+
+    const std::string path = SnapshotPath( dir, phase );
+
+    Log::Line( "Loading the Phase %u snapshot from %s", phase, path.c_str() );
+    auto timer = TimerBegin();
+
+    FileStream file;
+    if( !file.Open( path.c_str(), FileMode::Open, FileAccess::Read, FileFlags::NoBuffering | FileFlags::LargeFile ) )
+        Fatal( "Failed to open snapshot file %s. Run Phase %u with the same --bench-cache first.", path.c_str(), phase );
+
+    const size_t    headerSize = RoundUpToNextBoundary( sizeof( SnapshotHeader ), (int)file.BlockSize() );
+    SnapshotHeader* header     = (SnapshotHeader*)SysHost::VirtualAlloc( headerSize );
+
+    if( file.Read( header, headerSize ) < (ssize_t)sizeof( SnapshotHeader ) ||
+        header->magic != BB_SNAPSHOT_MAGIC || header->version != BB_SNAPSHOT_VERSION || header->phase != phase ||
+        header->sectionCount < 1 || header->sectionCount > BB_SNAPSHOT_MAX_SECTIONS )
+        Fatal( "Snapshot file %s is invalid, or was not fully written.", path.c_str() );
+
+    if( header->k != _K )
+        Fatal( "Snapshot file %s was written for k%u plots.", path.c_str(), header->k );
+
+    if( memcmp( header->plotId, cx.plotId, sizeof( header->plotId ) ) != 0 )
+        Fatal( "Snapshot file %s was written for another plot id.", path.c_str() );
+
+    if( header->alignment % file.BlockSize() != 0 )
+        Fatal( "Snapshot file %s can't be read on this device.", path.c_str() );
+
+    const SnapshotSection& last = header->sections[header->sectionCount-1];
+    if( file.Size() < (int64)RoundUpToNextBoundary( last.offset + last.size, (int)header->alignment ) )
+        Fatal( "Snapshot file %s is truncated.", path.c_str() );
+
+    file.Close();
+
+    // The sections must be the ones this build would write for the same state
+    byte*  buffers[BB_SNAPSHOT_MAX_SECTIONS];
+    uint64 sizes  [BB_SNAPSHOT_MAX_SECTIONS];
+    const uint sectionCount = GetSections( cx, *header, buffers, sizes );
+
+    bool valid = sectionCount == header->sectionCount;
+    for( uint i = 0; i < sectionCount && valid; i++ )
+        valid = sizes[i] == header->sections[i].size && header->sections[i].offset % header->alignment == 0;
+
+    FatalIf( !valid, "Snapshot file %s is invalid.", path.c_str() );
+
+    uint64 totalSize = 0;
+
+    for( uint i = 0; i < sectionCount; i++ )
+    {
+        RunSectionIO( *cx.threadPool, path.c_str(), buffers[i], header->sections[i], header->alignment, false );
+        totalSize += header->sections[i].size;
+    }
+
+    // Restore the state that isn't in the buffers
+    if( phase != 2 )
+        memcpy( cx.entryCount, header->entryCount, sizeof( cx.entryCount ) );
+
+    if( phase == 2 )
+    {
+        const uint64 fieldWords = ( 1ull << _K ) / 64;
+
+        uint32* ranks = (uint32*)( cx.usedEntriesBuffer + 5 * fieldWords );
+
+        cx.usedEntries   [0] = nullptr;
+        cx.usedEntryRanks[0] = nullptr;
+
+        for( uint i = 1; i < 6; i++ )
+        {
+            cx.usedEntries   [i] = cx.usedEntriesBuffer + (i-1) * fieldWords;
+            cx.usedEntryRanks[i] = ranks + (i-1) * ( RANK_INDEX_BLOCKS + 1 );
+        }
+    }
+
+    if( phase == 3 )
+    {
+        cx.cTablesBuilt = header->cTablesBuilt != 0;
+
+        for( uint i = 0; i < 3 && cx.cTablesBuilt; i++ )
+        {
+            cx.cTableBuffers[i] = cx.p4TableBuffer + header->cTableOffsets[i];
+            cx.cTableSizes  [i] = (size_t)header->cTableSizes[i];
+        }
+    }
+
+    SysHost::VirtualFree( header );
+
+    const double elapsed = TimerEnd( timer );
+    Log::Line( "Loaded %.2lf GiB in %.2lf seconds.", (double)totalSize BtoGB, elapsed );
+}
+
+//-----------------------------------------------------------
+uint GetSections( MemPlotContext& cx, const SnapshotHeader& header, byte* outBuffers[BB_SNAPSHOT_MAX_SECTIONS], uint64 outSizes[BB_SNAPSHOT_MAX_SECTIONS] )
+{
+    const uint64* entryCount   = header.entryCount;
+    uint          sectionCount = 0;
+
+    auto add = [&]( void* buffer, uint64 size ) {
+        ASSERT( sectionCount < BB_SNAPSHOT_MAX_SECTIONS );
+        outBuffers[sectionCount] = (byte*)buffer;
+        outSizes  [sectionCount] = size;
+        sectionCount++;
+    };
+
+    switch( header.phase )
+    {
+        case 1:
+            add( cx.t1XBuffer , entryCount[0] * sizeof( *cx.t1XBuffer ) );
+            add( cx.t2LRBuffer, entryCount[1] * sizeof( PackedPair ) );
+            add( cx.t3LRBuffer, entryCount[2] * sizeof( PackedPair ) );
+            add( cx.t4LRBuffer, entryCount[3] * sizeof( PackedPair ) );
+            add( cx.t5LRBuffer, entryCount[4] * sizeof( PackedPair ) );
+            add( cx.t6LRBuffer, entryCount[5] * sizeof( PackedPair ) );
+            add( cx.t7LRBuffer, entryCount[6] * sizeof( *cx.t7LRBuffer ) );
+            add( cx.t7YBuffer , entryCount[6] * sizeof( *cx.t7YBuffer  ) );
+            break;
+
+        // The marks of tables 2-6 are contiguous, and followed by their rank indices
+        case 2:
+            add( cx.usedEntriesBuffer, USED_ENTRIES_BUFFER_SIZE );
+            break;
+
+        // Table 7's L indices are left in t1XBuffer by Phase 3. The C tables,
+        // if they were built, are contiguous, each starting on a block boundary.
+        case 3:
+            add( cx.t1XBuffer, entryCount[6] * sizeof( *cx.t1XBuffer ) );
+
+            if( header.cTablesBuilt )
+                add( cx.p4TableBuffer + header.cTableOffsets[0],
+                     header.cTableOffsets[2] + header.cTableSizes[2] - header.cTableOffsets[0] );
+            else
+                add( cx.t7YBuffer, entryCount[6] * sizeof( *cx.t7YBuffer ) );
+            break;
+
+        default:
+            ASSERT( 0 );
+            break;
+    }
+
+    return sectionCount;
+}
+
+//-----------------------------------------------------------
+void RunSectionIO( ThreadPool& pool, const char* path, byte* buffer, const SnapshotSection& section, size_t alignment, bool write )
+{
+    if( section.size == 0 )
+        return;
+
+    const uint threadCount = pool.ThreadCount();
+
+    // Split the section in block-aligned chunks, one per thread.
+    // #NOTE: The last chunk is rounded up to the block size. This is safe because the buffers
+    //        are sized for the largest tables, and sections are block-aligned in the file.
+    const size_t chunkSize  = RoundUpToNextBoundary( CDiv( (size_t)section.size, (int)threadCount ), (int)alignment );
+    const uint   chunkCount = (uint)CDiv( (size_t)section.size, (int)chunkSize );
+    ASSERT( chunkCount <= threadCount );
+
+    std::vector<SnapshotIOJob> jobs( chunkCount );
+
+    for( uint i = 0; i < chunkCount; i++ )
+    {
+        SnapshotIOJob& job = jobs[i];
+
+        const size_t offset = i * chunkSize;
+
+        job.path    = path;
+        job.buffer  = buffer + offset;
+        job.offset  = section.offset + offset;
+        job.size    = RoundUpToNextBoundary( std::min( chunkSize, (size_t)section.size - offset ), (int)alignment );
+        job.write   = write;
+        job.success = false;
+    }
+
+    pool.RunJob( SnapshotIOThread, jobs.data(), chunkCount );
+
+    for( uint i = 0; i < chunkCount; i++ )
+    {
+        if( !jobs[i].success )
+            Fatal( "Failed to %s snapshot file %s.", write ? "write" : "read", path );
+    }
+}
+
+//-----------------------------------------------------------
+void SnapshotIOThread( SnapshotIOJob* job )
+{
+    FileStream file;
+
+    const FileAccess access = job->write ? FileAccess::Write : FileAccess::Read;
+
+    if( !file.Open( job->path, FileMode::Open, access, FileFlags::NoBuffering | FileFlags::LargeFile ) )
+    {
+        Log::Error( "Error: Failed to open snapshot file %s with error %d.", job->path, file.GetError() );
+        return;
+    }
+
+    if( !file.Seek( (int64)job->offset, SeekOrigin::Begin ) )
+    {
+        Log::Error( "Error: Failed to seek snapshot file %s with error %d.", job->path, file.GetError() );
+        return;
+    }
+
+    byte*  buffer = job->buffer;
+    size_t size   = job->size;
+
+    while( size )
+    {
+        const ssize_t r = job->write ? file.Write( buffer, size ) : file.Read( buffer, size );
+
+        if( r < 1 )
+        {
+            Log::Error( "Error: Snapshot file I/O failed on %s with error %d.", job->path, file.GetError() );
+            return;
+        }
+
+        ASSERT( (size_t)r <= size );
+
+        buffer += r;
+        size   -= (size_t)r;
+    }
+
+    if( job->write && !file.Flush() )
+    {
+        Log::Error( "Error: Failed to flush snapshot file %s with error %d.", job->path, file.GetError() );
+        return;
+    }
+
+    job->success = true;
+}
+
+//-----------------------------------------------------------
+std::string SnapshotPath( const char* dir, uint phase )
+{
+    std::string path = dir;
+
+    if( !path.empty() && path.back() != '/' && path.back() != '\\' )
+        path += '/';
+
+    char fileName[32];
+    sprintf( fileName, "phase%u.snapshot", phase );
+
+    return path + fileName;
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include "PlotContext.h"
+
+/**
+ * Snapshots the state of a plot between phases to a directory, so that a benchmark
+ * can run a range of phases on the state the phases before it left, without rebuilding.
+ *
+ * Each phase's snapshot is a single file: a header naming the plot, its k and entry counts,
+ * and where each of its sections is, followed by the sections, block-aligned.
+ * Sections are written and read with parallel direct I/O, straight from and into the
+ * plot's own buffers, so a snapshot loads at close to the drive's sequential speed.
+ *
+ * Phase 1's snapshot holds the tables it generated, Phase 2's the entries it marked,
+ * and Phase 3's what Phase 4 needs: table 7's L indices, and the sorted f7 entries
+ * or the C tables built from them. The header is written last, so a snapshot
+ * that was not fully written is never loaded. Tables 2-6 must be in memory, not spilled.
+ */
+
+// Writes the state left by the given phase to the snapshot directory
+void WritePhaseCache( MemPlotContext& cx, const char* dir, uint phase );
+
+// Reads the state left by the given phase back from the snapshot directory.
+// Fails if the snapshot does not exist, or was written for another plot id or k.
+void ReadPhaseCache( MemPlotContext& cx, const char* dir, uint phase );
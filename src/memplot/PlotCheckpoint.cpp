@@ -0,0 +1,442 @@
+#include "PlotCheckpoint.h"
+#include "threading/Thread.h"
+#include "io/FileStream.h"
+#include "Util.h"
+#include "util/Log.h"
+#include "RankIndex.h"
+
+#define BB_CHECKPOINT_MAGIC   0x54504B4342424242ull     // "BBBBCKPT"
+#define BB_CHECKPOINT_VERSION 1
+
+// Size of each direct write or read to a table file
+#define BB_CHECKPOINT_IO_SIZE ( 64ull MB )
+
+struct CheckpointManifest
+{
+    uint64             magic;
+    uint32             version;
+    uint32             k;
+    PlotCheckpointInfo info;
+};
+
+static const char* TABLE_FILES[8] = {
+    "p1.t1.x.tmp", "p1.t2.tmp", "p1.t3.tmp", "p1.t4.tmp",
+    "p1.t5.tmp"  , "p1.t6.tmp", "p1.t7.tmp", "p1.t7.y.tmp"
+};
+
+static void GetTables( const MemPlotContext& cx, const uint64 entryCount[7], void* outTables[8], size_t outSizes[8] );
+
+//-----------------------------------------------------------
+PlotCheckpoint::PlotCheckpoint( const char* dir )
+    : _dir( dir )
+{
+    ZeroMem( &_info );
+
+    if( !_dir.empty() && _dir.back() != '/' && _dir.back() != '\\' )
+        _dir += '/';
+
+    _valid = ReadInfo();
+}
+
+//-----------------------------------------------------------
+PlotCheckpoint::~PlotCheckpoint()
+{
+    if( _thread )
+    {
+        _thread->WaitForExit();
+        delete _thread;
+    }
+}
+
+//-----------------------------------------------------------
+bool PlotCheckpoint::ReadInfo()
+{
+    const std::string path = Path( "checkpoint" );
+
+    FILE* file = fopen( path.c_str(), "rb" );
+    if( !file )
+        return false;
+
+    CheckpointManifest manifest;
+    const bool read = fread( &manifest, sizeof( manifest ), 1, file ) == 1;
+    fclose( file );
+
+    if( !read || manifest.magic != BB_CHECKPOINT_MAGIC || manifest.version != BB_CHECKPOINT_VERSION )
+    {
+        Log::Error( "Warning: Ignoring invalid checkpoint %s.", path.c_str() );
+        return false;
+    }
+
+    if( manifest.k != _K )
+    {
+        Log::Error( "Warning: Ignoring checkpoint %s, which is for a k%u plot.", path.c_str(), manifest.k );
+        return false;
+    }
+
+    PlotCheckpointInfo& info = manifest.info;
+    info.fileName[BB_CHECKPOINT_MAX_FILE_NAME] = 0;
+
+    if( info.completedPhase < 1 || info.completedPhase > 2 || info.memoSize > sizeof( info.memo ) || !info.fileName[0] )
+    {
+        Log::Error( "Warning: Ignoring invalid checkpoint %s.", path.c_str() );
+        return false;
+    }
+
+    for( uint i = 0; i < 7; i++ )
+    {
+        if( info.entryCount[i] > ENTRIES_PER_TABLE )
+        {
+            Log::Error( "Warning: Ignoring invalid checkpoint %s.", path.c_str() );
+            return false;
+        }
+    }
+
+    _info = info;
+    return true;
+}
+
+//-----------------------------------------------------------
+uint PlotCheckpoint::CompletedPhase( const byte plotId[32] ) const
+{
+    if( !_valid || memcmp( plotId, _info.plotId, 32 ) != 0 )
+        return 0;
+
+    return _info.completedPhase;
+}
+
+//-----------------------------------------------------------
+bool PlotCheckpoint::Restore( MemPlotContext& cx )
+{
+    ASSERT( _valid );
+    ASSERT( !cx.spill );
+
+    Log::Line( "Resuming the plot from its Phase %u checkpoint in %s", _info.completedPhase, _dir.c_str() );
+    auto timer = TimerBegin();
+
+    void*  tables[8];
+    size_t sizes [8];
+    GetTables( cx, _info.entryCount, tables, sizes );
+
+    for( uint i = 0; i < 8; i++ )
+    {
+        if( !ReadFile( Path( TABLE_FILES[i] ).c_str(), tables[i], sizes[i] ) )
+            return false;
+    }
+
+    memcpy( cx.entryCount, _info.entryCount, sizeof( cx.entryCount ) );
+
+    // Same layout as Phase 2 marks them in
+    const uint64 fieldWords = ( 1ull << _K ) / 64;
+
+    cx.usedEntries   [0] = nullptr;
+    cx.usedEntryRanks[0] = nullptr;
+
+    // Only the marks are saved, their rank indices are built again
+    if( _info.completedPhase >= 2 )
+    {
+        uint32* ranks = (uint32*)( cx.usedEntriesBuffer + 5 * fieldWords );
+
+        for( uint i = 1; i < 6; i++ )
+        {
+            char fileName[32];
+            sprintf( fileName, "p2.t%u.tmp", i+1 );
+
+            cx.usedEntries   [i] = cx.usedEntriesBuffer + (i-1) * fieldWords;
+            cx.usedEntryRanks[i] = ranks + (i-1) * ( RANK_INDEX_BLOCKS + 1 );
+
+            if( !ReadFile( Path( fileName ).c_str(), cx.usedEntries[i], fieldWords * sizeof( uint64 ) ) )
+                return false;
+
+            BuildRankIndex( *cx.threadPool, cx.usedEntries[i], cx.usedEntryRanks[i] );
+        }
+    }
+
+    const double elapsed = TimerEnd( timer );
+    Log::Line( "Loaded the checkpoint in %.2lf seconds.", elapsed );
+
+    return true;
+}
+
+//-----------------------------------------------------------
+void PlotCheckpoint::BeginPhase1( const MemPlotContext& cx, const char* fileName )
+{
+    ASSERT( !_thread );
+    ASSERT( !cx.spill );
+
+    // The previous plot's checkpoint is no longer needed, but it must stop
+    // describing its files before they're overwritten
+    Remove();
+
+    ZeroMem( &_info );
+    memcpy( _info.plotId, cx.plotId, 32 );
+    memcpy( _info.memo, cx.plotMemo, std::min( (size_t)cx.plotMemoSize, sizeof( _info.memo ) ) );
+    memcpy( _info.entryCount, cx.entryCount, sizeof( _info.entryCount ) );
+
+    _info.memoSize       = (uint32)std::min( (size_t)cx.plotMemoSize, sizeof( _info.memo ) );
+    _info.completedPhase = 1;
+
+    strncpy( _info.fileName, fileName, BB_CHECKPOINT_MAX_FILE_NAME );
+    _info.fileName[BB_CHECKPOINT_MAX_FILE_NAME] = 0;
+
+    GetTables( cx, _info.entryCount, _tables, _sizes );
+
+    _writeFailed  = false;
+    _writeElapsed = 0;
+
+    _thread = new Thread();
+    _thread->Run( []( void* param ) {
+        ((PlotCheckpoint*)param)->WriteTables();
+    }, this );
+}
+
+//-----------------------------------------------------------
+void PlotCheckpoint::EndPhase1()
+{
+    if( !_thread )
+        return;
+
+    auto timer = TimerBegin();
+
+    _thread->WaitForExit();
+    delete _thread;
+    _thread = nullptr;
+
+    const double waited = TimerEnd( timer );
+
+    if( _writeFailed )
+        return;
+
+    if( !WriteInfo() )
+        return;
+
+    _valid = true;
+
+    Log::Line( "Checkpointed Phase 1 in %.2lf seconds, of which %.2lf were waited for.", _writeElapsed, waited );
+}
+
+//-----------------------------------------------------------
+void PlotCheckpoint::WritePhase2( const MemPlotContext& cx )
+{
+    ASSERT( !_thread );
+
+    // Without Phase 1's checkpoint, the marks are of no use
+    if( !_valid || memcmp( cx.plotId, _info.plotId, 32 ) != 0 )
+        return;
+
+    auto timer = TimerBegin();
+
+    const uint64 fieldWords = ( 1ull << _K ) / 64;
+
+    for( uint i = 1; i < 6; i++ )
+    {
+        char fileName[32];
+        sprintf( fileName, "p2.t%u.tmp", i+1 );
+
+        const std::string path = Path( fileName );
+
+        int error = 0;
+        if( !WriteFile( path.c_str(), cx.usedEntries[i], fieldWords * sizeof( uint64 ), error ) )
+        {
+            Log::Error( "Warning: Failed to write checkpoint file %s with error %d. The plot will resume from Phase 1.", path.c_str(), error );
+            return;
+        }
+    }
+
+    _info.completedPhase = 2;
+
+    if( !WriteInfo() )
+    {
+        // The manifest is in an unknown state
+        _valid = false;
+        return;
+    }
+
+    const double elapsed = TimerEnd( timer );
+    Log::Line( "Checkpointed Phase 2 in %.2lf seconds.", elapsed );
+}
+
+//-----------------------------------------------------------
+void PlotCheckpoint::Remove()
+{
+    ASSERT( !_thread );
+
+    // The manifest goes first, so that no checkpoint is left with missing files
+    remove( Path( "checkpoint" ).c_str() );
+    _valid = false;
+
+    for( uint i = 0; i < 8; i++ )
+        remove( Path( TABLE_FILES[i] ).c_str() );
+
+    for( uint i = 2; i <= 6; i++ )
+    {
+        char fileName[32];
+        sprintf( fileName, "p2.t%u.tmp", i );
+        remove( Path( fileName ).c_str() );
+    }
+}
+
+//-----------------------------------------------------------
+void PlotCheckpoint::WriteTables()
+{
+    auto timer = TimerBegin();
+
+    for( uint i = 0; i < 8; i++ )
+    {
+        const std::string path = Path( TABLE_FILES[i] );
+
+        int error = 0;
+        if( !WriteFile( path.c_str(), _tables[i], _sizes[i], error ) )
+        {
+            Log::Error( "Warning: Failed to write checkpoint file %s with error %d. The plot won't be checkpointed.", path.c_str(), error );
+            _writeFailed = true;
+            return;
+        }
+    }
+
+    _writeElapsed = TimerEnd( timer );
+}
+
+//-----------------------------------------------------------
+bool PlotCheckpoint::WriteInfo()
+{
+    const std::string path    = Path( "checkpoint" );
+    const std::string tmpPath = Path( "checkpoint.tmp" );
+
+    CheckpointManifest manifest;
+    ZeroMem( &manifest );
+    manifest.magic   = BB_CHECKPOINT_MAGIC;
+    manifest.version = BB_CHECKPOINT_VERSION;
+    manifest.k       = _K;
+    manifest.info    = _info;
+
+    // Written aside, and renamed over the previous one once it's on disk
+    FileStream file;
+    if( !file.Open( tmpPath.c_str(), FileMode::Create, FileAccess::Write ) ||
+        file.Write( &manifest, sizeof( manifest ) ) != (ssize_t)sizeof( manifest ) ||
+        !file.Flush() )
+    {
+        Log::Error( "Warning: Failed to write checkpoint file %s with error %d.", tmpPath.c_str(), file.GetError() );
+        return false;
+    }
+
+    file.Close();
+
+    #if PLATFORM_IS_WINDOWS
+        remove( path.c_str() );
+    #endif
+
+    if( rename( tmpPath.c_str(), path.c_str() ) != 0 )
+    {
+        Log::Error( "Warning: Failed to rename checkpoint file %s with error %d.", tmpPath.c_str(), errno );
+        return false;
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------
+bool PlotCheckpoint::WriteFile( const char* path, const void* data, const size_t size, int& error )
+{
+    FileStream file;
+    if( !file.Open( path, FileMode::Create, FileAccess::Write, FileFlags::NoBuffering | FileFlags::LargeFile ) )
+    {
+        error = file.GetError();
+        return false;
+    }
+
+    const size_t blockSize = file.BlockSize();
+
+    // The buffers are page-aligned, and sized for the largest table, so the last write
+    // may be rounded up to the block size. The file is truncated back to the table's size.
+    const byte* src       = (const byte*)data;
+    size_t      remaining = RoundUpToNextBoundary( size, (int)blockSize );
+
+    while( remaining )
+    {
+        const size_t  writeSize = std::min( remaining, (size_t)BB_CHECKPOINT_IO_SIZE );
+        const ssize_t written   = file.Write( src, writeSize );
+
+        if( written <= 0 )
+        {
+            error = file.GetError();
+            return false;
+        }
+
+        src       += written;
+        remaining -= (size_t)written;
+    }
+
+    if( !file.Truncate( (int64)size ) || !file.Flush() )
+    {
+        error = file.GetError();
+        return false;
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------
+bool PlotCheckpoint::ReadFile( const char* path, void* data, const size_t size )
+{
+    FileStream file;
+    if( !file.Open( path, FileMode::Open, FileAccess::Read, FileFlags::NoBuffering | FileFlags::LargeFile ) )
+    {
+        Log::Error( "Error: Failed to open checkpoint file %s with error %d.", path, file.GetError() );
+        return false;
+    }
+
+    if( file.Size() != (int64)size )
+    {
+        Log::Error( "Error: Checkpoint file %s has an unexpected size.", path );
+        return false;
+    }
+
+    // As when written, the last read is rounded up to the block size,
+    // and stops short at the end of the file
+    byte*  dst       = (byte*)data;
+    size_t remaining = size;
+
+    while( remaining )
+    {
+        const size_t  readSize = RoundUpToNextBoundary( std::min( remaining, (size_t)BB_CHECKPOINT_IO_SIZE ), (int)file.BlockSize() );
+        const ssize_t read     = file.Read( dst, readSize );
+
+        if( read <= 0 )
+        {
+            Log::Error( "Error: Failed to read checkpoint file %s with error %d.", path, file.GetError() );
+            return false;
+        }
+
+        dst       += read;
+        remaining -= std::min( remaining, (size_t)read );
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------
+std::string PlotCheckpoint::Path( const char* fileName ) const
+{
+    return _dir + fileName;
+}
+
+//-----------------------------------------------------------
+void GetTables( const MemPlotContext& cx, const uint64 entryCount[7], void* outTables[8], size_t outSizes[8] )
+{
+    outTables[0] = cx.t1XBuffer;
+    outTables[1] = cx.t2LRBuffer;
+    outTables[2] = cx.t3LRBuffer;
+    outTables[3] = cx.t4LRBuffer;
+    outTables[4] = cx.t5LRBuffer;
+    outTables[5] = cx.t6LRBuffer;
+    outTables[6] = cx.t7LRBuffer;
+    outTables[7] = cx.t7YBuffer;
+
+    outSizes[0] = (size_t)entryCount[0] * sizeof( *cx.t1XBuffer );
+
+    for( uint i = 1; i < 6; i++ )
+        outSizes[i] = (size_t)entryCount[i] * sizeof( PackedPair );
+
+    outSizes[6] = (size_t)entryCount[6] * sizeof( *cx.t7LRBuffer );
+    outSizes[7] = (size_t)entryCount[6] * sizeof( *cx.t7YBuffer  );
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include "PlotContext.h"
+#include <string>
+
+class Thread;
+
+#define BB_CHECKPOINT_MAX_FILE_NAME 255
+
+// The plot a checkpoint belongs to, and how far it got
+struct PlotCheckpointInfo
+{
+    byte   plotId[32];
+    byte   memo[128];
+    uint32 memoSize;
+    uint32 completedPhase;                          // 1 or 2
+    uint64 entryCount[7];
+    char   fileName[BB_CHECKPOINT_MAX_FILE_NAME+1];
+};
+
+/**
+ * Checkpoints the state of a plot after Phases 1 and 2 to a directory,
+ * so that a plot killed afterwards can be resumed from the last completed phase.
+ *
+ * Phase 1's checkpoint holds the tables it generated, which Phase 2 only reads, so they
+ * are written by a background thread while Phase 2 runs, and need only be waited for
+ * before Phase 3 converts them in-place. Phase 2's checkpoint holds the entries it marked,
+ * which are much smaller, and are written right after it.
+ *
+ * Tables are written with large sequential direct I/O, straight from their buffers.
+ * A manifest naming the plot and its completed phase is written last, so a checkpoint
+ * is only ever resumed once all of its files are on disk.
+ * Tables 2-6 must be in memory, not spilled.
+ */
+class PlotCheckpoint
+{
+public:
+    PlotCheckpoint( const char* dir );
+    ~PlotCheckpoint();
+
+    // Returns the plot whose checkpoint was found in the directory, or null if there is none
+    inline const PlotCheckpointInfo* GetInfo() const { return _valid ? &_info : nullptr; }
+
+    // Returns the last phase checkpointed for the given plot, or 0 if it has no checkpoint
+    uint CompletedPhase( const byte plotId[32] ) const;
+
+    // Loads the state left by the plot's last checkpointed phase. Returns false if it could not be read.
+    bool Restore( MemPlotContext& cx );
+
+    // Starts writing Phase 1's tables in the background.
+    // They must not be modified until EndPhase1() returns.
+    void BeginPhase1( const MemPlotContext& cx, const char* fileName );
+
+    // Waits for Phase 1's tables to be written, and commits them if they were
+    void EndPhase1();
+
+    // Writes the entries marked by Phase 2, and commits them
+    void WritePhase2( const MemPlotContext& cx );
+
+    // Deletes the checkpoint, once its plot is written
+    void Remove();
+
+private:
+    std::string Path( const char* fileName ) const;
+
+    // Reads the manifest of the checkpoint. Returns false if there is none,
+    // or it was written by a build for another k.
+    bool ReadInfo();
+    bool WriteInfo();
+    void WriteTables();
+
+    static bool WriteFile( const char* path, const void* data, size_t size, int& error );
+    static bool ReadFile ( const char* path, void* data, size_t size );
+
+private:
+    std::string        _dir;
+    PlotCheckpointInfo _info;
+    bool               _valid  = false;     // _info describes the files on disk
+    Thread*            _thread = nullptr;   // Writes Phase 1's tables
+    bool               _writeFailed = false;
+    double             _writeElapsed = 0;
+
+    // Phase 1's tables, as they're being written
+    void*              _tables[8] = {};
+    size_t             _sizes [8] = {};
+};
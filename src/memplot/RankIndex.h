@@ -0,0 +1,70 @@
+#pragma once
+#include "ChiaConsts.h"
+#include "Util.h"
+#include "threading/ThreadPool.h"
+
+// Rank index over a table's bitfield of marked entries.
+// It holds the count of marked entries before each block of RANK_BLOCK_WORDS words,
+// so that the rank of any entry, which is its index once the table is pruned,
+// is found with a lookup and at most RANK_BLOCK_WORDS popcounts.
+#define RANK_BLOCK_WORDS 8
+#define RANK_BLOCK_BITS  ( RANK_BLOCK_WORDS * 64 )
+
+// Blocks in a table's bitfield. The index has an extra entry
+// past the last block, with the table's total marked count.
+#define RANK_INDEX_BLOCKS ( ENTRIES_PER_TABLE / RANK_BLOCK_BITS )
+#define RANK_INDEX_SIZE   ( ( RANK_INDEX_BLOCKS + 1 ) * sizeof( uint32 ) )
+
+// Size of the bitfields of tables 2-6, followed by their rank indices
+#define USED_ENTRIES_BUFFER_SIZE ( 5 * ( ENTRIES_PER_TABLE / 8 + RANK_INDEX_SIZE ) )
+
+// #NOTE: Ranks fit in 32 bits, as an entry's rank is never greater than its index.
+
+// Counts the marked entries of a block
+//-----------------------------------------------------------
+inline uint32 CountRankBlock( const uint64* bits, const uint64 block )
+{
+    const uint64* words = bits + block * RANK_BLOCK_WORDS;
+
+    uint32 count = 0;
+    for( uint w = 0; w < RANK_BLOCK_WORDS; w++ )
+        count += Popcnt64( words[w] );
+
+    return count;
+}
+
+// Marked entries before index
+//-----------------------------------------------------------
+inline uint64 BitFieldRank( const uint64* bits, const uint32* ranks, const uint64 index )
+{
+    const uint64 word = index >> 6;
+    uint64       rank = ranks[index / RANK_BLOCK_BITS];
+
+    for( uint64 w = word & ~(uint64)( RANK_BLOCK_WORDS - 1 ); w < word; w++ )
+        rank += Popcnt64( bits[w] );
+
+    if( index & 63 )
+        rank += Popcnt64( bits[word] & ( ( 1ull << ( index & 63 ) ) - 1 ) );
+
+    return rank;
+}
+
+// Turns the block counts of an index into ranks
+//-----------------------------------------------------------
+inline void FinishRankIndex( ThreadPool& pool, uint32* ranks )
+{
+    ranks[RANK_INDEX_BLOCKS] = 0;
+    pool.ParallelPrefixSum( ranks, ranks, RANK_INDEX_BLOCKS + 1 );
+}
+
+// Builds the index of a bitfield that was marked without counting its blocks
+//-----------------------------------------------------------
+inline void BuildRankIndex( ThreadPool& pool, const uint64* bits, uint32* ranks )
+{
+    pool.ParallelFor( RANK_INDEX_BLOCKS, 0, [=]( uint64 begin, uint64 end, uint ) {
+        for( uint64 b = begin; b < end; b++ )
+            ranks[b] = CountRankBlock( bits, b );
+    });
+
+    FinishRankIndex( pool, ranks );
+}
@@ -0,0 +1,372 @@
+#include "TableSpiller.h"
+#include "io/FileStream.h"
+#include "io/NetSink.h"
+#include "io/RemoteMemory.h"
+#include "SysHost.h"
+#include "util/Log.h"
+#include "Util.h"
+#include <vector>
+
+struct SpillIOJob
+{
+    const char* path;
+    const char* address;    // Memory server of a remote path
+    const NetKey* key;      // Key of the memory server
+    size_t      regionSize; // Size of the remote region
+    byte*       buffer;
+    size_t      offset;     // File offset
+    size_t      size;
+    bool        write;
+    bool        success;
+};
+
+static void SpillIOThread( SpillIOJob* job );
+static void RemoteSpillIO( SpillIOJob* job );
+
+//-----------------------------------------------------------
+TableSpiller::TableSpiller( const char** paths, uint pathCount, const NetKey& key )
+    : _remoteKey( key )
+    , _pathCount( pathCount )
+{
+    FatalIf( pathCount < 1 || pathCount > BB_MAX_SPILL_PATHS,
+        "Invalid spill path count %u. Up to %u spill paths are supported.", pathCount, BB_MAX_SPILL_PATHS );
+
+    // Tables spilled to remote memory are named uniquely, as a memory server may serve multiple plotters
+    uint64 sessionId = 0;
+    SysHost::Random( (byte*)&sessionId, sizeof( sessionId ) );
+
+    for( uint p = 0; p < pathCount; p++ )
+    {
+        const char*  dir    = paths[p];
+
+        if( strncmp( dir, BB_NET_PATH_PREFIX, BB_NET_PATH_PREFIX_LEN ) == 0 )
+        {
+        #if PLATFORM_IS_UNIX
+            const char* address = dir + BB_NET_PATH_PREFIX_LEN;
+            _remoteAddress[p] = address;
+
+            for( uint t = (uint)TableId::Table2; t <= (uint)TableId::Table6; t++ )
+            {
+                char* regionName = new char[BB_MEM_MAX_NAME+1];
+
+                snprintf( regionName, BB_MEM_MAX_NAME+1, "bladebit.%016llx.t%u.%u", (unsigned long long)sessionId, t+1, p );
+                _filePaths[t][p] = regionName;
+
+                // Fail early if the server can't be reached
+                int error = 0;
+                if( !RemoteMemory::Free( address, _remoteKey, regionName, error ) )
+                    Fatal( "Failed to reach the memory server at '%s' with error %d.", address, error );
+            }
+
+            // Remote I/O has no alignment requirements, but the chunks are still page-aligned
+            if( SysHost::GetPageSize() > _blockSize )
+                _blockSize = SysHost::GetPageSize();
+        #else
+            Fatal( "Spilling to remote memory is not supported on this platform." );
+        #endif
+            continue;
+        }
+
+        const size_t dirLen = strlen( dir );
+        const char*  sep    = ( dirLen && dir[dirLen-1] != '/' ) ? "/" : "";
+
+        // Spill files are only needed for tables 2-6
+        for( uint t = (uint)TableId::Table2; t <= (uint)TableId::Table6; t++ )
+        {
+            const size_t len = dirLen + 64;
+            char* filePath = new char[len];
+
+            snprintf( filePath, len, "%s%sbladebit.t%u.%u.spill", dir, sep, t+1, p );
+            _filePaths[t][p] = filePath;
+
+            // Create the file now so that we fail early if the path is not writable,
+            // and so that we can obtain the block size for direct I/O
+            FileStream file;
+            if( !file.Open( filePath, FileMode::Create, FileAccess::Write, FileFlags::NoBuffering | FileFlags::LargeFile ) )
+                Fatal( "Failed to create spill file '%s'.", filePath );
+
+            if( file.BlockSize() > _blockSize )
+                _blockSize = file.BlockSize();
+        }
+    }
+
+    ASSERT( _blockSize );
+}
+
+//-----------------------------------------------------------
+TableSpiller::TableSpiller()
+    : _compress( true )
+{
+}
+
+//-----------------------------------------------------------
+TableSpiller::~TableSpiller()
+{
+    for( uint t = 0; t < (uint)TableId::_Count; t++ )
+        PairCodec::Free( _compressed[t] );
+
+    for( uint t = 0; t < (uint)TableId::_Count; t++ )
+    {
+        for( uint p = 0; p < _pathCount; p++ )
+        {
+            char* filePath = _filePaths[t][p];
+            if( !filePath )
+                continue;
+
+            if( _remoteAddress[p] )
+            {
+            #if PLATFORM_IS_UNIX
+                int error = 0;
+                if( !RemoteMemory::Free( _remoteAddress[p], _remoteKey, filePath, error ) )
+                    Log::Error( "Warning: Failed to free spilled table %s on memory server '%s' with error %d.",
+                        filePath, _remoteAddress[p], error );
+            #endif
+            }
+            else
+                remove( filePath );
+
+            delete[] filePath;
+        }
+    }
+}
+
+//-----------------------------------------------------------
+void TableSpiller::Spill( ThreadPool& pool, TableId tableId, const PackedPair* buffer, uint64 entryCount )
+{
+    if( _compress )
+    {
+        _residentTable = tableId;
+        _residentCount = entryCount;
+        _residentSaved = false;
+        return;
+    }
+
+    Log::Line( "  Spilling table %d...", (int)tableId+1 );
+    auto timer = TimerBegin();
+
+    RunIO( pool, tableId, (PackedPair*)buffer, entryCount, true );
+    _residentTable = tableId;
+
+    double elapsed = TimerEnd( timer );
+    Log::Line( "  Finished spilling table %d in %.2lf seconds.", (int)tableId+1, elapsed );
+}
+
+//-----------------------------------------------------------
+void TableSpiller::Load( ThreadPool& pool, TableId tableId, PackedPair* buffer, uint64 entryCount )
+{
+    if( _residentTable == tableId )
+        return;
+
+    if( _compress )
+    {
+        LoadCompressed( pool, tableId, buffer, entryCount );
+        return;
+    }
+
+    Log::Line( "  Loading spilled table %d...", (int)tableId+1 );
+    auto timer = TimerBegin();
+
+    RunIO( pool, tableId, buffer, entryCount, false );
+    _residentTable = tableId;
+
+    double elapsed = TimerEnd( timer );
+    Log::Line( "  Finished loading table %d in %.2lf seconds.", (int)tableId+1, elapsed );
+}
+
+//-----------------------------------------------------------
+void TableSpiller::Evict( ThreadPool& pool, const PackedPair* buffer )
+{
+    if( !_compress || _residentTable == TableId::_Count || _residentSaved )
+        return;
+
+    const TableId tableId = _residentTable;
+
+    Log::Line( "  Compressing table %d...", (int)tableId+1 );
+    auto timer = TimerBegin();
+
+    CompressedPairTable& table = _compressed[(int)tableId];
+    PairCodec::Init( table, _residentCount );
+
+    for( uint64 s = 0; s < table.segmentCount; s++ )
+        PairCodec::EncodeSegment( pool, table, s, buffer );
+
+    _residentSaved = true;
+
+    double elapsed = TimerEnd( timer );
+    Log::Line( "  Compressed table %d to %.2lf MiB (%.1lf%%) in %.2lf seconds.", (int)tableId+1, (double)table.Size() BtoMB,
+        100.0 * (double)table.Size() / (double)std::max( _residentCount * sizeof( PackedPair ), (uint64)1 ), elapsed );
+}
+
+//-----------------------------------------------------------
+void TableSpiller::LoadCompressed( ThreadPool& pool, TableId tableId, PackedPair* buffer, uint64 entryCount )
+{
+    CompressedPairTable& table = _compressed[(int)tableId];
+    ASSERT( table.entryCount == entryCount );
+
+    // Compress the resident table segment by segment, right before the same
+    // segment of the loaded table is decompressed over it, and freed.
+    CompressedPairTable* evicted = nullptr;
+
+    if( _residentTable != TableId::_Count && !_residentSaved )
+    {
+        evicted = &_compressed[(int)_residentTable];
+        PairCodec::Init( *evicted, _residentCount );
+
+        Log::Line( "  Decompressing table %d, and compressing table %d...", (int)tableId+1, (int)_residentTable+1 );
+    }
+    else
+        Log::Line( "  Decompressing table %d...", (int)tableId+1 );
+
+    auto timer = TimerBegin();
+
+    const uint64 segmentCount = std::max( table.segmentCount, evicted ? evicted->segmentCount : 0 );
+
+    for( uint64 s = 0; s < segmentCount; s++ )
+    {
+        if( evicted && s < evicted->segmentCount )
+            PairCodec::EncodeSegment( pool, *evicted, s, buffer );
+
+        if( s < table.segmentCount )
+            PairCodec::DecodeSegment( pool, table, s, buffer );
+    }
+
+    PairCodec::Free( table );
+
+    _residentTable = tableId;
+    _residentCount = entryCount;
+    _residentSaved = false;
+
+    double elapsed = TimerEnd( timer );
+    Log::Line( "  Finished decompressing table %d in %.2lf seconds.", (int)tableId+1, elapsed );
+}
+
+//-----------------------------------------------------------
+void TableSpiller::RunIO( ThreadPool& pool, TableId tableId, PackedPair* buffer, uint64 entryCount, bool write )
+{
+    ASSERT( tableId >= TableId::Table2 && tableId <= TableId::Table6 );
+    ASSERT( buffer );
+
+    const size_t totalSize = (size_t)entryCount * sizeof( PackedPair );
+    if( totalSize == 0 )
+        return;
+
+    const uint threadCount = pool.ThreadCount();
+
+    // Split the table in block-aligned chunks and distribute them
+    // round-robin accross the spill paths.
+    // #NOTE: The last chunk is rounded up to the block size. This is safe
+    //        because the staging buffer is sized to hold 2^k packed pairs,
+    //        which is always block-aligned.
+    const size_t chunkSize  = RoundUpToNextBoundary( CDiv( totalSize, (int)threadCount ), (int)_blockSize );
+    const uint   chunkCount = (uint)CDiv( totalSize, (int)chunkSize );
+    ASSERT( chunkCount <= threadCount );
+
+    // Size of the stripe of each path, to which remote regions are sized
+    const size_t stripeSize = CDiv( chunkCount, (int)_pathCount ) * chunkSize;
+
+    byte* bytes = (byte*)buffer;
+
+    std::vector<SpillIOJob> jobs( chunkCount );
+
+    for( uint i = 0; i < chunkCount; i++ )
+    {
+        SpillIOJob& job = jobs[i];
+
+        const size_t offset = i * chunkSize;
+
+        job.path       = _filePaths[(int)tableId][i % _pathCount];
+        job.address    = _remoteAddress[i % _pathCount];
+        job.key        = &_remoteKey;
+        job.regionSize = stripeSize;
+        job.buffer     = bytes + offset;
+        job.offset     = ( i / _pathCount ) * chunkSize;
+        job.size       = RoundUpToNextBoundary( std::min( chunkSize, totalSize - offset ), (int)_blockSize );
+        job.write      = write;
+        job.success    = false;
+    }
+
+    pool.RunJob( SpillIOThread, jobs.data(), chunkCount );
+
+    for( uint i = 0; i < chunkCount; i++ )
+    {
+        if( !jobs[i].success )
+            Fatal( "Failed to %s spill file '%s'.", write ? "write" : "read", jobs[i].path );
+    }
+}
+
+//-----------------------------------------------------------
+void SpillIOThread( SpillIOJob* job )
+{
+    if( job->address )
+    {
+        RemoteSpillIO( job );
+        return;
+    }
+
+    FileStream file;
+
+    const FileAccess access = job->write ? FileAccess::Write : FileAccess::Read;
+
+    if( !file.Open( job->path, FileMode::Open, access, FileFlags::NoBuffering | FileFlags::LargeFile ) )
+    {
+        Log::Error( "Error: Failed to open spill file '%s'.", job->path );
+        return;
+    }
+
+    if( !file.Seek( (int64)job->offset, SeekOrigin::Begin ) )
+    {
+        Log::Error( "Error: Failed to seek spill file '%s' with error %d.", job->path, file.GetError() );
+        return;
+    }
+
+    byte*  buffer = job->buffer;
+    size_t size   = job->size;
+
+    while( size )
+    {
+        const ssize_t r = job->write ? file.Write( buffer, size ) : file.Read( buffer, size );
+
+        if( r < 1 )
+        {
+            Log::Error( "Error: Spill file I/O failed on '%s' with error %d.", job->path, file.GetError() );
+            return;
+        }
+
+        ASSERT( (size_t)r <= size );
+
+        buffer += r;
+        size   -= (size_t)r;
+    }
+
+    job->success = true;
+}
+
+//-----------------------------------------------------------
+void RemoteSpillIO( SpillIOJob* job )
+{
+#if PLATFORM_IS_UNIX
+    RemoteMemory mem;
+
+    if( !mem.Open( job->address, *job->key, job->path, job->regionSize ) )
+    {
+        Log::Error( "Error: Failed to open spilled table %s on memory server '%s' with error %d.",
+            job->path, job->address, mem.GetError() );
+        return;
+    }
+
+    const bool ok = job->write ? mem.Write( job->buffer, job->size, job->offset ) :
+                                 mem.Read ( job->buffer, job->size, job->offset );
+
+    // Close() confirms that the writes were stored
+    if( !ok || !mem.Close() )
+    {
+        Log::Error( "Error: Spilled table I/O failed on %s on memory server '%s' with error %d.",
+            job->path, job->address, mem.GetError() );
+        return;
+    }
+
+    job->success = true;
+#else
+    (void)job;
+#endif
+}
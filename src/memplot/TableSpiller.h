@@ -0,0 +1,74 @@
+#pragma once
+#include "PlotContext.h"
+#include "PairCodec.h"
+#include "io/NetSink.h"
+
+#define BB_MAX_SPILL_PATHS 16
+
+/**
+ * Spills L/R tables that are not needed for a while to scratch disk
+ * and reads them back when they are needed again.
+ *
+ * When spilling is enabled, tables 2-6 share a single in-memory staging
+ * buffer. Phase 1 writes each table out after it's been generated,
+ * and Phase 2 and 3 load them back before they're read.
+ * Each table is striped accross all the scratch paths given, so that the
+ * aggregate bandwidth of multiple devices can be used.
+ *
+ * A path of the form tcp://<host>:<port> spills to the memory of another
+ * host running a MemoryServer instead of a disk (see RemoteMemory),
+ * which shares the secret of key.
+ *
+ * Without paths, tables are compressed in memory instead (see PairCodec).
+ * A table is then only compressed once the staging buffer is needed for another
+ * one, segment by segment, as the other one is decompressed in its place,
+ * and its compressed copy is freed as it's loaded, so that at most 4 tables
+ * are held compressed alongside the staging buffer.
+ */
+class TableSpiller
+{
+public:
+    TableSpiller( const char** paths, uint pathCount, const NetKey& key );
+
+    // Compresses the tables in memory
+    TableSpiller();
+    ~TableSpiller();
+
+    // Writes the table's entries currently in the staging buffer to disk.
+    // When compressing, the table is only compressed by Evict() or Load().
+    void Spill( ThreadPool& pool, TableId tableId, const PackedPair* buffer, uint64 entryCount );
+
+    // Saves the table in the staging buffer, if it was not saved yet, before the buffer is overwritten
+    void Evict( ThreadPool& pool, const PackedPair* buffer );
+
+    // Reads a previously spilled table back into the staging buffer.
+    // If the staging buffer already contains the table, no read is performed.
+    void Load( ThreadPool& pool, TableId tableId, PackedPair* buffer, uint64 entryCount );
+
+    // The table that is currently resident in the staging buffer, if any
+    inline TableId ResidentTable() const { return _residentTable; }
+
+    // Marks the staging buffer as no longer holding a valid table.
+    // (Ex. when it gets re-used for something else.)
+    // A table that was not saved yet is lost.
+    inline void Invalidate() { _residentTable = TableId::_Count; }
+
+private:
+    void RunIO( ThreadPool& pool, TableId tableId, PackedPair* buffer, uint64 entryCount, bool write );
+    void LoadCompressed( ThreadPool& pool, TableId tableId, PackedPair* buffer, uint64 entryCount );
+
+private:
+    // Spill files, or remote region names, for each table for each path
+    char*   _filePaths[(int)TableId::_Count][BB_MAX_SPILL_PATHS] = {};
+    // Memory server address of remote paths, or nullptr for local ones
+    const char* _remoteAddress[BB_MAX_SPILL_PATHS] = {};
+    NetKey  _remoteKey     = {};
+    uint    _pathCount     = 0;
+    size_t  _blockSize     = 0;
+    TableId _residentTable = TableId::_Count;
+
+    bool                _compress      = false;
+    bool                _residentSaved = false;     // The resident table was compressed
+    uint64              _residentCount = 0;
+    CompressedPairTable _compressed[(int)TableId::_Count];
+};
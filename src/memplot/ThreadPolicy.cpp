@@ -0,0 +1,199 @@
+#include "ThreadPolicy.h"
+#include "threading/ThreadPool.h"
+#include "util/Log.h"
+#include "Util.h"
+#include <algorithm>
+
+static const char* KernelNames[(uint)PlotKernel::_Count] = {
+    "pair",
+    "fx",
+    "clear",
+    "mark",
+    "lp"
+};
+
+//-----------------------------------------------------------
+const char* ThreadPolicy::KernelName( PlotKernel kernel )
+{
+    ASSERT( kernel < PlotKernel::_Count );
+    return KernelNames[(uint)kernel];
+}
+
+//-----------------------------------------------------------
+ThreadPolicy::ThreadPolicy( const ThreadPool& pool, const char** settings, uint settingCount, bool tune, const char* cachePath )
+    : _poolThreadCount( pool.ThreadCount() )
+    , _cachePath      ( cachePath )
+{
+    const uint threadCount = _poolThreadCount;
+    const uint coreThreads = std::max( 1u, pool.CoreThreadCount() );
+
+    // Candidates to try when tuning: The whole pool, one thread per physical core, and fractions of the pool
+    const uint tryCounts[5] = {
+        threadCount,
+        coreThreads,
+        threadCount * 3 / 4,
+        threadCount / 2,
+        threadCount / 4
+    };
+
+    for( uint k = 0; k < (uint)PlotKernel::_Count; k++ )
+    {
+        KernelState& state = _kernels[k];
+        state.threadCount = threadCount;
+        state.tuning      = tune;
+
+        for( uint i = 0; i < 5; i++ )
+        {
+            const uint count = tryCounts[i];
+            if( count < 1 || std::find( state.candidates, state.candidates + state.candidateCount, count ) != state.candidates + state.candidateCount )
+                continue;
+
+            state.candidates[state.candidateCount++] = count;
+        }
+    }
+
+    for( uint i = 0; i < settingCount; i++ )
+    {
+        const char* setting = settings[i];
+        const char* value   = strchr( setting, '=' );
+
+        FatalIf( !value, "Invalid kernel thread setting '%s'. Expected <kernel>=<count>.", setting );
+
+        const size_t nameLength = (size_t)( value - setting );
+        value++;
+
+        uint k = 0;
+        for( ; k < (uint)PlotKernel::_Count; k++ )
+        {
+            if( strlen( KernelNames[k] ) == nameLength && strncmp( KernelNames[k], setting, nameLength ) == 0 )
+                break;
+        }
+
+        FatalIf( k == (uint)PlotKernel::_Count, "Unknown kernel in thread setting '%s'.", setting );
+
+        KernelState& state = _kernels[k];
+
+        if( strcmp( value, "auto" ) == 0 )
+        {
+            state.tuning = true;
+        }
+        else if( strcmp( value, "cores" ) == 0 )
+        {
+            state.tuning      = false;
+            state.threadCount = coreThreads;
+        }
+        else
+        {
+            char* end = nullptr;
+            const unsigned long count = strtoul( value, &end, 10 );
+
+            FatalIf( end == value || *end != '\0' || count < 1, "Invalid thread count in kernel thread setting '%s'.", setting );
+
+            state.tuning      = false;
+            state.threadCount = (uint)std::min( count, (unsigned long)threadCount );
+        }
+    }
+
+    if( _cachePath )
+        LoadCache();
+}
+
+//-----------------------------------------------------------
+uint ThreadPolicy::Begin( PlotKernel kernel )
+{
+    ASSERT( kernel < PlotKernel::_Count );
+    KernelState& state = _kernels[(uint)kernel];
+
+    if( !state.tuning )
+        return state.threadCount;
+
+    state.startTime = TimerBegin();
+    return state.candidates[state.trial];
+}
+
+//-----------------------------------------------------------
+void ThreadPolicy::End( PlotKernel kernel, uint threadCount, uint64 workCount )
+{
+    ASSERT( kernel < PlotKernel::_Count );
+    KernelState& state = _kernels[(uint)kernel];
+
+    if( !state.tuning )
+        return;
+
+    ASSERT( threadCount == state.candidates[state.trial] );
+
+    const double elapsed = std::chrono::duration<double>( std::chrono::steady_clock::now() - state.startTime ).count();
+    const double time    = elapsed / (double)std::max( workCount, (uint64)1 );
+
+    if( state.trial == 0 || time < state.bestTime )
+    {
+        state.bestTime    = time;
+        state.threadCount = threadCount;
+    }
+
+    if( ++state.trial < state.candidateCount )
+        return;
+
+    state.tuning = false;
+    state.tuned  = true;
+    Log::Line( "Tuned kernel '%s' to %u threads.", KernelNames[(uint)kernel], state.threadCount );
+
+    if( _cachePath )
+        SaveCache();
+}
+
+// The cache has a line per tuned kernel: <kernel> <pool thread count> <thread count>.
+// Kernels tuned for a pool of a different size are tuned again.
+//-----------------------------------------------------------
+void ThreadPolicy::LoadCache()
+{
+    FILE* file = fopen( _cachePath, "r" );
+    if( !file )
+        return;
+
+    char name[32];
+    uint poolThreads, threadCount;
+
+    while( fscanf( file, "%31s %u %u", name, &poolThreads, &threadCount ) == 3 )
+    {
+        if( poolThreads != _poolThreadCount || threadCount < 1 || threadCount > _poolThreadCount )
+            continue;
+
+        for( uint k = 0; k < (uint)PlotKernel::_Count; k++ )
+        {
+            KernelState& state = _kernels[k];
+
+            // Explicit thread counts take precedence over the cache
+            if( state.tuning && strcmp( KernelNames[k], name ) == 0 )
+            {
+                state.tuning      = false;
+                state.tuned       = true;
+                state.threadCount = threadCount;
+            }
+        }
+    }
+
+    fclose( file );
+}
+
+//-----------------------------------------------------------
+void ThreadPolicy::SaveCache()
+{
+    FILE* file = fopen( _cachePath, "w" );
+    if( !file )
+    {
+        const int err = errno;
+        Log::Error( "Warning: Failed to write the thread tuning cache '%s' with error %d.", _cachePath, err );
+        return;
+    }
+
+    for( uint k = 0; k < (uint)PlotKernel::_Count; k++ )
+    {
+        const KernelState& state = _kernels[k];
+
+        if( state.tuned )
+            fprintf( file, "%s %u %u\n", KernelNames[k], _poolThreadCount, state.threadCount );
+    }
+
+    fclose( file );
+}
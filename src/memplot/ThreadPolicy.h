@@ -0,0 +1,69 @@
+#pragma once
+#include "Platform.h"
+
+class ThreadPool;
+
+#define BB_MAX_KERNEL_THREAD_SETTINGS 16
+
+// Parallel kernels whose worker count can be chosen independently of the pool's size
+enum class PlotKernel : uint
+{
+    FxPair = 0,     // Phase 1: Matching the pairs of each kBC group
+    ComputeFx,      // Phase 1: Hashing the pairs into the next table's y and metadata
+    ClearMarks,     // Phase 2: Clearing the marking bitfields
+    MarkEntries,    // Phase 2: Marking the left table's entries used by the right table
+    LinePoints,     // Phase 3: Pruning and converting the tables to line points
+
+    _Count
+};
+
+/**
+ * Picks how many threads each kernel runs with.
+ *
+ * Compute-bound kernels scale with every thread in the pool, but memory-bound ones
+ * saturate the memory bandwidth well before that, and only get slower with more threads.
+ * By default every kernel uses the whole pool. Kernels may instead be given a fixed
+ * thread count, or the policy may tune them: each call to a kernel is then timed with the next of
+ * a handful of candidate thread counts, and once all have been tried the fastest is kept.
+ * The tuned counts can be cached to a file, so that they are only tuned on the first run.
+ *
+ * Kernels are run from the plotting thread only, so the policy is not thread-safe.
+ */
+class ThreadPolicy
+{
+public:
+    // settings are "<kernel>=<count>" strings, where count may be "cores" for ThreadPool::CoreThreadCount(),
+    // or "auto" to have the kernel tuned. If tune is set, all the kernels without a setting are tuned.
+    // If cachePath is not null, tuned counts are loaded from it, and saved to it once tuned.
+    ThreadPolicy( const ThreadPool& pool, const char** settings, uint settingCount, bool tune, const char* cachePath );
+
+    // Thread count with which the next call to the kernel should be run
+    uint Begin( PlotKernel kernel );
+
+    // Reports that the kernel call that started with Begin() has finished,
+    // having processed workCount units of work, ie. entries.
+    void End( PlotKernel kernel, uint threadCount, uint64 workCount );
+
+    static const char* KernelName( PlotKernel kernel );
+
+private:
+    void LoadCache();
+    void SaveCache();
+
+private:
+    struct KernelState
+    {
+        uint   threadCount;         // Thread count to use once tuned
+        bool   tuning;
+        bool   tuned;               // Tuned now, or loaded from the cache
+        uint   candidates[5];
+        uint   candidateCount;
+        uint   trial;               // Next candidate to try
+        double bestTime;            // Best time per unit of work so far, in seconds
+        std::chrono::steady_clock::time_point startTime;
+    };
+
+    KernelState _kernels[(uint)PlotKernel::_Count] = {};
+    uint        _poolThreadCount = 0;
+    const char* _cachePath       = nullptr;
+};
@@ -0,0 +1,436 @@
+#include "io/IOUring.h"
+#include "Util.h"
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/sysmacros.h>
+
+// We use the raw system calls, so that we don't depend on liburing
+//-----------------------------------------------------------
+static inline int SysIOUringSetup( uint entries, io_uring_params* params )
+{
+    return (int)syscall( __NR_io_uring_setup, entries, params );
+}
+
+//-----------------------------------------------------------
+static inline int SysIOUringEnter( int ringFd, uint toSubmit, uint minComplete, uint flags )
+{
+    return (int)syscall( __NR_io_uring_enter, ringFd, toSubmit, minComplete, flags, nullptr, 0 );
+}
+
+//-----------------------------------------------------------
+static inline int SysIOUringRegister( int ringFd, uint opcode, const void* arg, uint argCount )
+{
+    return (int)syscall( __NR_io_uring_register, ringFd, opcode, arg, argCount );
+}
+
+//-----------------------------------------------------------
+template<typename T>
+inline T LoadAcquire( const T* p )
+{
+    return __atomic_load_n( p, __ATOMIC_ACQUIRE );
+}
+
+//-----------------------------------------------------------
+template<typename T>
+inline void StoreRelease( T* p, T value )
+{
+    __atomic_store_n( p, value, __ATOMIC_RELEASE );
+}
+
+// Queue depth of the device backing the file
+//-----------------------------------------------------------
+static uint GetDeviceQueueDepth( int fd )
+{
+    const uint defaultDepth = BB_IO_URING_MAX_DEPTH;
+
+    struct stat fs;
+    if( fstat( fd, &fs ) != 0 )
+        return defaultDepth;
+
+    const uint devMajor = major( fs.st_dev );
+    const uint devMinor = minor( fs.st_dev );
+
+    // Partitions don't have a queue, their parent device does
+    const char* paths[] = {
+        "/sys/dev/block/%u:%u/queue/nr_requests",
+        "/sys/dev/block/%u:%u/../queue/nr_requests"
+    };
+
+    for( const char* pathFmt : paths )
+    {
+        char path[128];
+        snprintf( path, sizeof( path ), pathFmt, devMajor, devMinor );
+
+        FILE* f = fopen( path, "r" );
+        if( !f )
+            continue;
+
+        uint depth = 0;
+        const int r = fscanf( f, "%u", &depth );
+        fclose( f );
+
+        if( r == 1 && depth > 0 )
+            return std::min( std::max( depth, 2u ), (uint)BB_IO_URING_MAX_DEPTH );
+    }
+
+    return defaultDepth;
+}
+
+//-----------------------------------------------------------
+IOUring::IOUring()
+{}
+
+//-----------------------------------------------------------
+IOUring::~IOUring()
+{
+    if( _ringFd >= 0 )
+        WaitForWrites();
+
+    Destroy();
+}
+
+//-----------------------------------------------------------
+bool IOUring::IsSupported()
+{
+    static int supported = -1;
+
+    if( supported < 0 )
+    {
+        io_uring_params params;
+        memset( &params, 0, sizeof( params ) );
+
+        const int ringFd = SysIOUringSetup( 2, &params );
+        supported = ringFd >= 0 ? 1 : 0;
+
+        if( ringFd >= 0 )
+            close( ringFd );
+    }
+
+    return supported == 1;
+}
+
+//-----------------------------------------------------------
+bool IOUring::Init( int fd, uint queueDepth )
+{
+    ASSERT( _ringFd < 0 );
+    ASSERT( fd >= 0 );
+
+    if( queueDepth == 0 )
+        queueDepth = GetDeviceQueueDepth( fd );
+
+    queueDepth = std::min( queueDepth, (uint)BB_IO_URING_MAX_DEPTH );
+
+    io_uring_params params;
+    memset( &params, 0, sizeof( params ) );
+
+    _ringFd = SysIOUringSetup( queueDepth, &params );
+    if( _ringFd < 0 )
+    {
+        _error = errno;
+        return false;
+    }
+
+    if( !MapRings( &params ) )
+    {
+        _error = errno;
+        Destroy();
+        return false;
+    }
+
+    // Register the file, so that the kernel doesn't have to look it up on every write
+    if( SysIOUringRegister( _ringFd, IORING_REGISTER_FILES, &fd, 1 ) != 0 )
+    {
+        _error = errno;
+        Destroy();
+        return false;
+    }
+
+    // The kernel may have rounded up our entry count
+    _depth     = std::min( params.sq_entries, (uint)BB_IO_URING_MAX_DEPTH );
+    _freeCount = _depth;
+
+    for( uint i = 0; i < _depth; i++ )
+        _freeSlots[i] = _depth - i - 1;
+
+    return true;
+}
+
+//-----------------------------------------------------------
+bool IOUring::MapRings( const void* ringParams )
+{
+    const io_uring_params& params = *(const io_uring_params*)ringParams;
+
+    _sqRingSize = params.sq_off.array + params.sq_entries * sizeof( uint );
+    _cqRingSize = params.cq_off.cqes  + params.cq_entries * sizeof( io_uring_cqe );
+
+    const bool singleMap = ( params.features & IORING_FEAT_SINGLE_MMAP ) != 0;
+
+    if( singleMap )
+        _sqRingSize = _cqRingSize = std::max( _sqRingSize, _cqRingSize );
+
+    _sqRing = mmap( nullptr, _sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_SQ_RING );
+    if( _sqRing == MAP_FAILED )
+    {
+        _sqRing = nullptr;
+        return false;
+    }
+
+    if( singleMap )
+        _cqRing = _sqRing;
+    else
+    {
+        _cqRing = mmap( nullptr, _cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_CQ_RING );
+        if( _cqRing == MAP_FAILED )
+        {
+            _cqRing = nullptr;
+            return false;
+        }
+    }
+
+    _sqesSize = params.sq_entries * sizeof( io_uring_sqe );
+    _sqes     = mmap( nullptr, _sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_SQES );
+    if( _sqes == MAP_FAILED )
+    {
+        _sqes = nullptr;
+        return false;
+    }
+
+    _sqHead  = (uint*)( (byte*)_sqRing + params.sq_off.head       );
+    _sqTail  = (uint*)( (byte*)_sqRing + params.sq_off.tail       );
+    _sqMask  = *(uint*)( (byte*)_sqRing + params.sq_off.ring_mask );
+    _sqArray = (uint*)( (byte*)_sqRing + params.sq_off.array      );
+
+    _cqHead  = (uint*)( (byte*)_cqRing + params.cq_off.head       );
+    _cqTail  = (uint*)( (byte*)_cqRing + params.cq_off.tail       );
+    _cqMask  = *(uint*)( (byte*)_cqRing + params.cq_off.ring_mask );
+    _cqes    = (byte*)_cqRing + params.cq_off.cqes;
+
+    return true;
+}
+
+//-----------------------------------------------------------
+void IOUring::Destroy()
+{
+    if( _sqes )
+        munmap( _sqes, _sqesSize );
+
+    if( _cqRing && _cqRing != _sqRing )
+        munmap( _cqRing, _cqRingSize );
+
+    if( _sqRing )
+        munmap( _sqRing, _sqRingSize );
+
+    if( _ringFd >= 0 )
+        close( _ringFd );
+
+    _sqes        = nullptr;
+    _sqRing      = nullptr;
+    _cqRing      = nullptr;
+    _ringFd      = -1;
+    _depth       = 0;
+    _freeCount   = 0;
+    _fixedBuffer = nullptr;
+    _fixedSize   = 0;
+}
+
+//-----------------------------------------------------------
+bool IOUring::RegisterBuffer( const void* buffer, size_t size )
+{
+    ASSERT( _ringFd >= 0 );
+    ASSERT( buffer && size );
+
+    // Can't swap the buffer while writes from it are in flight
+    if( !WaitForWrites() )
+        return false;
+
+    if( _fixedBuffer )
+    {
+        SysIOUringRegister( _ringFd, IORING_UNREGISTER_BUFFERS, nullptr, 0 );
+        _fixedBuffer = nullptr;
+        _fixedSize   = 0;
+    }
+
+    iovec iov;
+    iov.iov_base = (void*)buffer;
+    iov.iov_len  = size;
+
+    // This pins the buffer's pages, so it may fail with a low RLIMIT_MEMLOCK.
+    // Writes then just don't use the fixed buffer.
+    if( SysIOUringRegister( _ringFd, IORING_REGISTER_BUFFERS, &iov, 1 ) != 0 )
+        return false;
+
+    _fixedBuffer = (const byte*)buffer;
+    _fixedSize   = size;
+
+    return true;
+}
+
+//-----------------------------------------------------------
+bool IOUring::Write( const void* buffer, size_t size, uint64 offset )
+{
+    ASSERT( _ringFd >= 0 );
+    ASSERT( buffer );
+
+    const byte* src = (const byte*)buffer;
+
+    const bool fixed = _fixedBuffer && src >= _fixedBuffer && src + size <= _fixedBuffer + _fixedSize;
+
+    while( size )
+    {
+        if( _error )
+            return false;
+
+        // Wait for a free slot
+        while( _freeCount == 0 )
+        {
+            if( !WaitForCompletion() )
+                return false;
+
+            Reap();
+        }
+
+        const uint32 chunkSize = (uint32)std::min( size, (size_t)BB_IO_URING_CHUNK_SIZE );
+        const uint   slot      = _freeSlots[--_freeCount];
+
+        Request& req = _requests[slot];
+        req.buffer = src;
+        req.offset = offset;
+        req.size   = chunkSize;
+        req.fixed  = fixed;
+
+        if( !Queue( slot ) )
+            return false;
+
+        src    += chunkSize;
+        offset += chunkSize;
+        size   -= chunkSize;
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------
+bool IOUring::Queue( uint slot )
+{
+    const Request& req = _requests[slot];
+
+    // We only have one thread submitting, and never more entries than slots,
+    // so there's always room in the submission ring.
+    const uint tail  = *_sqTail;
+    const uint index = tail & _sqMask;
+    ASSERT( tail - LoadAcquire( _sqHead ) <= _sqMask );
+
+    io_uring_sqe* sqe = ((io_uring_sqe*)_sqes) + index;
+    memset( sqe, 0, sizeof( io_uring_sqe ) );
+
+    sqe->opcode    = req.fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+    sqe->flags     = IOSQE_FIXED_FILE;
+    sqe->fd        = 0;     // Index into the registered files
+    sqe->addr      = (uint64)(uintptr_t)req.buffer;
+    sqe->len       = req.size;
+    sqe->off       = req.offset;
+    sqe->buf_index = 0;
+    sqe->user_data = slot;
+
+    _sqArray[index] = index;
+    StoreRelease( _sqTail, tail + 1 );
+
+    for( ;; )
+    {
+        const int r = SysIOUringEnter( _ringFd, 1, 0, 0 );
+
+        if( r >= 0 )
+            break;
+
+        if( errno != EINTR && errno != EAGAIN )
+        {
+            _error = errno;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------
+bool IOUring::WaitForCompletion()
+{
+    const int r = SysIOUringEnter( _ringFd, 0, 1, IORING_ENTER_GETEVENTS );
+
+    if( r < 0 && errno != EINTR && errno != EAGAIN )
+    {
+        if( !_error )
+            _error = errno;
+
+        return false;
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------
+void IOUring::Reap()
+{
+    uint       head = *_cqHead;
+    const uint tail = LoadAcquire( _cqTail );
+
+    for( ; head != tail; head++ )
+    {
+        const io_uring_cqe* cqe = ((const io_uring_cqe*)_cqes) + ( head & _cqMask );
+
+        const uint slot   = (uint)cqe->user_data;
+        const int  result = cqe->res;
+
+        ASSERT( slot < _depth );
+        Request& req = _requests[slot];
+
+        if( result < 0 && result != -EINTR && result != -EAGAIN )
+        {
+            // Keep the first error
+            if( !_error )
+                _error = -result;
+
+            _freeSlots[_freeCount++] = slot;
+            continue;
+        }
+
+        const uint32 written = result < 0 ? 0 : (uint32)result;
+        ASSERT( written <= req.size );
+
+        // Short write, or interrupted: queue the remainder in the same slot.
+        // Once we've had an error, we just let the pending writes drain.
+        if( written < req.size && !_error )
+        {
+            req.buffer += written;
+            req.offset += written;
+            req.size   -= written;
+
+            if( Queue( slot ) )
+                continue;
+        }
+
+        _freeSlots[_freeCount++] = slot;
+    }
+
+    StoreRelease( _cqHead, head );
+}
+
+//-----------------------------------------------------------
+bool IOUring::WaitForWrites()
+{
+    if( _ringFd < 0 )
+        return true;
+
+    while( _freeCount < _depth )
+    {
+        if( !WaitForCompletion() )
+            break;
+
+        Reap();
+    }
+
+    return _error == 0;
+}
@@ -0,0 +1,370 @@
+#include "util/MemBandwidth.h"
+#include "Util.h"
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <dirent.h>
+#include <string>
+
+#define PMU_DEVICES_PATH "/sys/bus/event_source/devices"
+
+// Each data beat of an AMD data fabric DRAM channel event moves a cache line
+#define AMD_DF_BYTES_PER_COUNT 64.0
+
+// DRAM channel data events of the Zen 2 and Zen 3 data fabric, channels 0-7
+static const char* AMD_DF_CHANNEL_EVENTS[] = {
+    "event=0x007,umask=0x38",
+    "event=0x047,umask=0x38",
+    "event=0x087,umask=0x38",
+    "event=0x0c7,umask=0x38",
+    "event=0x107,umask=0x38",
+    "event=0x147,umask=0x38",
+    "event=0x187,umask=0x38",
+    "event=0x1c7,umask=0x38",
+};
+
+//-----------------------------------------------------------
+static bool ReadTextFile( const std::string& path, std::string& outText )
+{
+    FILE* file = fopen( path.c_str(), "r" );
+    if( !file )
+        return false;
+
+    char   buffer[256];
+    size_t size = fread( buffer, 1, sizeof( buffer ) - 1, file );
+    fclose( file );
+
+    while( size && ( buffer[size-1] == '\n' || buffer[size-1] == ' ' ) )
+        size--;
+
+    outText.assign( buffer, size );
+    return true;
+}
+
+// Packs value into the config bits of an event's format, ie. "config:0-7,32-35", least significant bits first
+//-----------------------------------------------------------
+static bool ApplyFormat( const std::string& format, uint64 value, uint64& config )
+{
+    if( format.compare( 0, 7, "config:" ) != 0 )
+        return false;
+
+    const char* ranges = format.c_str() + 7;
+
+    for( ;; )
+    {
+        uint first, last;
+        int  read = 0;
+
+        if( sscanf( ranges, "%u%n", &first, &read ) != 1 )
+            return false;
+
+        ranges += read;
+        last    = first;
+
+        if( *ranges == '-' && sscanf( ranges + 1, "%u%n", &last, &read ) == 1 )
+            ranges += 1 + read;
+
+        if( last < first || last > 63 )
+            return false;
+
+        for( uint bit = first; bit <= last; bit++, value >>= 1 )
+            config |= ( value & 1 ) << bit;
+
+        if( *ranges != ',' )
+            break;
+
+        ranges++;
+    }
+
+    return true;
+}
+
+// Encodes an event description, ie. "event=0x04,umask=0x03", with the formats of its PMU
+//-----------------------------------------------------------
+static bool EncodeEvent( const std::string& pmuPath, const std::string& event, uint64& outConfig )
+{
+    outConfig = 0;
+
+    size_t start = 0;
+
+    while( start < event.size() )
+    {
+        size_t end = event.find( ',', start );
+        if( end == std::string::npos )
+            end = event.size();
+
+        const std::string term   = event.substr( start, end - start );
+        const size_t      equals = term.find( '=' );
+        const std::string name   = term.substr( 0, equals );
+        const uint64      value  = equals == std::string::npos ? 1 : strtoull( term.c_str() + equals + 1, nullptr, 0 );
+
+        std::string format;
+        if( !ReadTextFile( pmuPath + "/format/" + name, format ) || !ApplyFormat( format, value, outConfig ) )
+            return false;
+
+        start = end + 1;
+    }
+
+    return true;
+}
+
+// Bytes per count of a named event, from its scale and unit, ie. 6.103515625e-5 MiB
+//-----------------------------------------------------------
+static double EventBytesPerCount( const std::string& eventPath )
+{
+    std::string scale, unit;
+
+    if( !ReadTextFile( eventPath + ".scale", scale ) || !ReadTextFile( eventPath + ".unit", unit ) )
+        return 64.0;    // A cache line per count, as the CAS events count
+
+    const double multiplier = unit == "MiB" ? 1024.0 * 1024.0 :
+                              unit == "KiB" ? 1024.0 :
+                              unit == "GiB" ? 1024.0 * 1024.0 * 1024.0 : 1.0;
+
+    return strtod( scale.c_str(), nullptr ) * multiplier;
+}
+
+// NUMA node of an OS cpu id, or 0 if the system is not NUMA
+//-----------------------------------------------------------
+static uint CpuNode( uint cpu )
+{
+    char path[64];
+    snprintf( path, sizeof( path ), "/sys/devices/system/cpu/cpu%u", cpu );
+
+    DIR* dir = opendir( path );
+    if( !dir )
+        return 0;
+
+    uint node = 0;
+
+    for( dirent* entry = readdir( dir ); entry; entry = readdir( dir ) )
+    {
+        if( sscanf( entry->d_name, "node%u", &node ) == 1 )
+            break;
+    }
+
+    closedir( dir );
+    return node;
+}
+
+// Cpus of a cpu list, ie. "0,28" or "0-1"
+//-----------------------------------------------------------
+static std::vector<uint> ParseCpuList( const std::string& list )
+{
+    std::vector<uint> cpus;
+    const char*       cur = list.c_str();
+
+    uint first, last;
+    int  read = 0;
+
+    while( sscanf( cur, "%u%n", &first, &read ) == 1 )
+    {
+        cur += read;
+        last = first;
+
+        if( *cur == '-' && sscanf( cur + 1, "%u%n", &last, &read ) == 1 )
+            cur += 1 + read;
+
+        for( uint cpu = first; cpu <= last; cpu++ )
+            cpus.push_back( cpu );
+
+        if( *cur != ',' )
+            break;
+
+        cur++;
+    }
+
+    return cpus;
+}
+
+// Whether the CPU is a Zen 2 or Zen 3, whose data fabric events are known
+//-----------------------------------------------------------
+static bool IsZen2Or3()
+{
+    FILE* file = fopen( "/proc/cpuinfo", "r" );
+    if( !file )
+        return false;
+
+    char line[256];
+    bool amd    = false;
+    int  family = -1;
+    int  model  = -1;
+
+    while( fgets( line, sizeof( line ), file ) && ( family < 0 || model < 0 ) )
+    {
+        if( strncmp( line, "vendor_id", 9 ) == 0 )
+            amd = strstr( line, "AuthenticAMD" ) != nullptr;
+        else if( strncmp( line, "cpu family", 10 ) == 0 )
+            sscanf( strchr( line, ':' ) + 1, "%d", &family );
+        else if( strncmp( line, "model\t", 6 ) == 0 || strncmp( line, "model ", 6 ) == 0 )
+            sscanf( strchr( line, ':' ) + 1, "%d", &model );
+    }
+
+    fclose( file );
+
+    if( !amd )
+        return false;
+
+    // Family 19h models 10h-1Fh and 60h and up are Zen 4 and later
+    return family == 0x17 || ( family == 0x19 && ( model < 0x10 || ( model >= 0x20 && model < 0x60 ) ) );
+}
+
+//-----------------------------------------------------------
+MemBandwidthCounters::MemBandwidthCounters()
+{}
+
+//-----------------------------------------------------------
+MemBandwidthCounters::~MemBandwidthCounters()
+{
+    Close();
+}
+
+//-----------------------------------------------------------
+bool MemBandwidthCounters::Open()
+{
+    Close();
+
+    std::vector<std::string> imcPmus;
+
+    DIR* dir = opendir( PMU_DEVICES_PATH );
+    if( !dir )
+        return false;
+
+    for( dirent* entry = readdir( dir ); entry; entry = readdir( dir ) )
+    {
+        // The free-running counters count the same traffic as the others
+        if( strncmp( entry->d_name, "uncore_imc", 10 ) == 0 && !strstr( entry->d_name, "free_running" ) )
+            imcPmus.push_back( entry->d_name );
+    }
+
+    closedir( dir );
+
+    if( !imcPmus.empty() )
+    {
+        // Server parts count CAS commands, client parts count data requests
+        const char* eventNames[2][2] = {
+            { "cas_count_read", "cas_count_write" },
+            { "data_reads"    , "data_writes"     }
+        };
+
+        for( const std::string& pmu : imcPmus )
+        {
+            const std::string eventsPath = std::string( PMU_DEVICES_PATH "/" ) + pmu + "/events/";
+
+            for( uint i = 0; i < 2; i++ )
+            {
+                std::string readEvent, writeEvent;
+
+                if( !ReadTextFile( eventsPath + eventNames[i][0], readEvent ) ||
+                    !ReadTextFile( eventsPath + eventNames[i][1], writeEvent ) )
+                    continue;
+
+                OpenPmuEvent( pmu.c_str(), readEvent.c_str() , false, EventBytesPerCount( eventsPath + eventNames[i][0] ) );
+                OpenPmuEvent( pmu.c_str(), writeEvent.c_str(), true , EventBytesPerCount( eventsPath + eventNames[i][1] ) );
+                break;
+            }
+        }
+
+        _source          = "uncore_imc";
+        _splitsReadWrite = true;
+    }
+    else if( IsZen2Or3() )
+    {
+        for( const char* event : AMD_DF_CHANNEL_EVENTS )
+            OpenPmuEvent( "amd_df", event, false, AMD_DF_BYTES_PER_COUNT );
+
+        _source          = "amd_df";
+        _splitsReadWrite = false;
+    }
+
+    if( _counters.empty() )
+    {
+        Close();
+        return false;
+    }
+
+    for( const Counter& counter : _counters )
+        _nodeCount = std::max( _nodeCount, counter.node + 1 );
+
+    return true;
+}
+
+//-----------------------------------------------------------
+bool MemBandwidthCounters::OpenPmuEvent( const char* pmu, const char* event, bool write, double bytesPerCount )
+{
+    const std::string pmuPath = std::string( PMU_DEVICES_PATH "/" ) + pmu;
+
+    std::string type, cpuMask;
+    uint64      config;
+
+    if( !ReadTextFile( pmuPath + "/type", type ) || !EncodeEvent( pmuPath, event, config ) )
+        return false;
+
+    // Uncore PMUs are counted from a single cpu of each package
+    if( !ReadTextFile( pmuPath + "/cpumask", cpuMask ) )
+        cpuMask = "0";
+
+    bool opened = false;
+
+    for( const uint cpu : ParseCpuList( cpuMask ) )
+    {
+        perf_event_attr attr;
+        memset( &attr, 0, sizeof( attr ) );
+
+        attr.size        = sizeof( attr );
+        attr.type        = (uint32)strtoul( type.c_str(), nullptr, 10 );
+        attr.config      = config;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        // Every process, on this cpu
+        const int fd = (int)syscall( SYS_perf_event_open, &attr, -1, (int)cpu, -1, 0 );
+        if( fd < 0 )
+            continue;
+
+        Counter counter;
+        counter.fd            = fd;
+        counter.node          = CpuNode( cpu );
+        counter.write         = write;
+        counter.bytesPerCount = bytesPerCount;
+
+        _counters.push_back( counter );
+        opened = true;
+    }
+
+    return opened;
+}
+
+//-----------------------------------------------------------
+void MemBandwidthCounters::Close()
+{
+    for( const Counter& counter : _counters )
+        close( counter.fd );
+
+    _counters.clear();
+    _nodeCount = 0;
+    _source    = "none";
+}
+
+//-----------------------------------------------------------
+void MemBandwidthCounters::Read( MemNodeTraffic* outNodes ) const
+{
+    for( uint i = 0; i < _nodeCount; i++ )
+        outNodes[i] = {};
+
+    for( const Counter& counter : _counters )
+    {
+        // value, time enabled, time running
+        uint64 values[3];
+        if( read( counter.fd, values, sizeof( values ) ) != (ssize_t)sizeof( values ) || values[2] == 0 )
+            continue;
+
+        // The data fabric has fewer counters than channels, so they are multiplexed
+        const double count = values[2] < values[1] ? (double)values[0] * values[1] / values[2] : (double)values[0];
+        const uint64 bytes = (uint64)( count * counter.bytesPerCount );
+
+        MemNodeTraffic& node = outNodes[counter.node];
+        node.bytes += bytes;
+
+        if( _splitsReadWrite )
+            ( counter.write ? node.writeBytes : node.readBytes ) += bytes;
+    }
+}
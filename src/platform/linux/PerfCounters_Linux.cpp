@@ -0,0 +1,130 @@
+#include "util/PerfCounters.h"
+#include "Util.h"
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+
+//-----------------------------------------------------------
+static int PerfEventOpen( perf_event_attr& attr )
+{
+    // Calling thread, on any cpu
+    return (int)syscall( SYS_perf_event_open, &attr, 0, -1, -1, 0 );
+}
+
+//-----------------------------------------------------------
+PerfCounters::PerfCounters()
+{
+    for( uint i = 0; i < (uint)PerfEvent::_Count; i++ )
+        _fds[i] = -1;
+}
+
+//-----------------------------------------------------------
+PerfCounters::~PerfCounters()
+{
+    Close();
+}
+
+//-----------------------------------------------------------
+bool PerfCounters::Open()
+{
+    Close();
+
+    const uint64 cacheReadMiss   = ( (uint64)PERF_COUNT_HW_CACHE_OP_READ << 8 ) | ( (uint64)PERF_COUNT_HW_CACHE_RESULT_MISS   << 16 );
+    const uint64 cacheReadAccess = ( (uint64)PERF_COUNT_HW_CACHE_OP_READ << 8 ) | ( (uint64)PERF_COUNT_HW_CACHE_RESULT_ACCESS << 16 );
+
+    const struct { uint32 type; uint64 config; } events[(uint)PerfEvent::_Count] = {
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL   | cacheReadMiss },
+        { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | cacheReadMiss },
+        { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_NODE | cacheReadAccess },
+        { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_NODE | cacheReadMiss }
+    };
+
+    bool opened = false;
+
+    for( uint i = 0; i < (uint)PerfEvent::_Count; i++ )
+    {
+        perf_event_attr attr;
+        memset( &attr, 0, sizeof( attr ) );
+
+        attr.size           = sizeof( attr );
+        attr.type           = events[i].type;
+        attr.config         = events[i].config;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv     = 1;
+        attr.read_format    = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        _fds[i] = PerfEventOpen( attr );
+        opened |= _fds[i] >= 0;
+    }
+
+    return opened;
+}
+
+//-----------------------------------------------------------
+void PerfCounters::Close()
+{
+    for( uint i = 0; i < (uint)PerfEvent::_Count; i++ )
+    {
+        if( _fds[i] >= 0 )
+            close( _fds[i] );
+
+        _fds[i] = -1;
+    }
+}
+
+//-----------------------------------------------------------
+void PerfCounters::Read( uint64 counts[(uint)PerfEvent::_Count] ) const
+{
+    for( uint i = 0; i < (uint)PerfEvent::_Count; i++ )
+    {
+        counts[i] = 0;
+
+        // value, time enabled, time running
+        uint64 values[3];
+        if( _fds[i] < 0 || read( _fds[i], values, sizeof( values ) ) != (ssize_t)sizeof( values ) || values[2] == 0 )
+            continue;
+
+        counts[i] = values[2] < values[1] ? (uint64)( (double)values[0] * values[1] / values[2] ) : values[0];
+    }
+}
+
+//-----------------------------------------------------------
+uint64 PerfCounters::ProcessBytesWritten()
+{
+    FILE* file = fopen( "/proc/self/io", "r" );
+    if( !file )
+        return 0;
+
+    char               name[32];
+    unsigned long long value;
+    uint64             bytes = 0;
+
+    while( fscanf( file, "%31s %llu", name, &value ) == 2 )
+    {
+        if( strcmp( name, "write_bytes:" ) == 0 )
+        {
+            bytes = (uint64)value;
+            break;
+        }
+    }
+
+    fclose( file );
+    return bytes;
+}
+
+//-----------------------------------------------------------
+const char* PerfCounters::EventName( PerfEvent event )
+{
+    switch( event )
+    {
+        case PerfEvent::Cycles        : return "cycles";
+        case PerfEvent::Instructions  : return "instructions";
+        case PerfEvent::LLCMisses     : return "llc_misses";
+        case PerfEvent::DTLBMisses    : return "dtlb_misses";
+        case PerfEvent::NodeLoads     : return "node_loads";
+        case PerfEvent::NodeLoadMisses: return "node_load_misses";
+        default                       : return "unknown";
+    }
+}
@@ -8,6 +8,25 @@
 #include <atomic>
 #include <numa.h>
 #include <numaif.h>
+#include <sys/mman.h>
+#include <sys/statvfs.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/sysinfo.h>
+#include <cmath>
+#include <sched.h>
+#include <unistd.h>
+#include <mutex>
+
+#ifndef MAP_HUGE_SHIFT
+    #define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+    #define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+    #define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
 
 // #if _DEBUG
     #include "util/Log.h"
@@ -15,31 +34,443 @@
 
 std::atomic<bool> _crashed = false;
 
+// Explicit huge page allocations can't store their size on a
+// leading regular page, so we keep track of them here instead.
+struct LargePageAlloc
+{
+    void*  ptr;
+    size_t size;
+};
+
+static std::mutex     _largeAllocLock;
+static LargePageAlloc _largeAllocs[64] = {};
+
+#define CGROUP_ROOT "/sys/fs/cgroup"
+
+// The cpus this process may run on, which a container's cpuset, or taskset, may limit.
+// The cpu ids SysHost takes and returns are indices into them, so that
+// they are always 0 to GetLogicalCPUCount()-1, as on an unrestricted system.
+struct AllowedCpus
+{
+    uint  count;
+    uint* osIds;        // OS cpu id of each cpu index
+    int*  indices;      // Cpu index of each OS cpu id, or -1 if the cpu is not allowed
+    uint  osIdCount;    // Size of indices
+};
+
+// Bumped when the process is restricted to fewer cpus, so that
+// the cpus, their topology and their nodes are queried again.
+static uint _cpuGeneration = 0;
+
+// Nodes the process was restricted to, with its cpus. Null if it was not.
+static bitmask* _restrictedMemNodes = nullptr;
+
+// Nodes of the far memory tier, once it's enabled
+static bitmask* _farMemNodes = nullptr;
+
+// #NOTE: This is not thread-safe on the first time is called
+//-----------------------------------------------------------
+static const AllowedCpus& GetAllowedCpus()
+{
+    static AllowedCpus _cpus;
+    static bool        initialized = false;
+    static uint        generation  = 0;
+
+    if( initialized && generation == _cpuGeneration )
+        return _cpus;
+
+    if( initialized )
+    {
+        free( _cpus.osIds   );
+        free( _cpus.indices );
+    }
+
+    const uint osIdCount = (uint)std::max( get_nprocs_conf(), 1 );
+
+    _cpus.osIdCount = osIdCount;
+    _cpus.osIds     = (uint*)malloc( sizeof( uint ) * osIdCount );
+    _cpus.indices   = (int*) malloc( sizeof( int )  * osIdCount );
+    _cpus.count     = 0;
+
+    if( !_cpus.osIds || !_cpus.indices )
+        Fatal( "Failed to allocate CPU id buffers." );
+
+    // Read the process' affinity, not the calling thread's, which may have been pinned already
+    cpu_set_t* cpuSet  = CPU_ALLOC( osIdCount );
+    const size_t setSize = CPU_ALLOC_SIZE( osIdCount );
+
+    const bool hasAffinity = cpuSet && sched_getaffinity( getpid(), setSize, cpuSet ) == 0;
+
+    for( uint i = 0; i < osIdCount; i++ )
+    {
+        const bool allowed = hasAffinity ? CPU_ISSET_S( i, setSize, cpuSet ) : i < (uint)get_nprocs();
+
+        _cpus.indices[i] = allowed ? (int)_cpus.count : -1;
+        if( allowed )
+            _cpus.osIds[_cpus.count++] = i;
+    }
+
+    if( cpuSet )
+        CPU_FREE( cpuSet );
+
+    FatalIf( _cpus.count == 0, "No CPUs are available to the process." );
+
+    initialized = true;
+    generation  = _cpuGeneration;
+    return _cpus;
+}
+
+// Translates an OS cpu id to a cpu index. Returns -1 if the cpu is not allowed.
+//-----------------------------------------------------------
+inline static int OsCpuToIndex( uint osId )
+{
+    const AllowedCpus& cpus = GetAllowedCpus();
+    return osId < cpus.osIdCount ? cpus.indices[osId] : -1;
+}
+
+// Gets the directory of the process' cgroup, for the given v1 controller,
+// or for the unified v2 hierarchy if controller is null.
+// Falls back to the controller's root, which is the container's own cgroup
+// when the cgroup namespace is not shared with the host.
+//-----------------------------------------------------------
+static bool GetCgroupDir( const char* controller, char* dir, size_t dirSize )
+{
+    char root[64];
+    if( controller )
+        snprintf( root, sizeof( root ), CGROUP_ROOT "/%s", controller );
+    else
+        snprintf( root, sizeof( root ), CGROUP_ROOT );
+
+    // On hybrid systems, the v2 hierarchy is mounted elsewhere, with no controllers
+    if( !controller && access( CGROUP_ROOT "/cgroup.controllers", F_OK ) != 0 )
+        return false;
+
+    FILE* file = fopen( "/proc/self/cgroup", "r" );
+    if( !file )
+        return false;
+
+    bool found = false;
+    char line[1024];
+
+    while( !found && fgets( line, sizeof( line ), file ) )
+    {
+        // id:controller,controller:path
+        char* controllers = strchr( line, ':' );
+        char* path        = controllers ? strchr( controllers + 1, ':' ) : nullptr;
+        if( !path )
+            continue;
+
+        *path++        = 0;
+        *controllers++ = 0;
+        path[strcspn( path, "\n" )] = 0;
+
+        if( controller )
+        {
+            for( char* c = strtok( controllers, "," ); c; c = strtok( nullptr, "," ) )
+                found = found || strcmp( c, controller ) == 0;
+        }
+        else
+            found = strcmp( line, "0" ) == 0 && *controllers == 0;
+
+        if( found )
+        {
+            snprintf( dir, dirSize, "%s%s", root, path );
+
+            if( access( dir, F_OK ) != 0 )
+                snprintf( dir, dirSize, "%s", root );
+        }
+    }
+
+    fclose( file );
+
+    return found && access( dir, F_OK ) == 0;
+}
+
+// Reads a cgroup file holding a single value. "max" reads as no limit.
+//-----------------------------------------------------------
+static bool ReadCgroupValue( const char* dir, const char* name, uint64& outValue )
+{
+    char path[1200];
+    snprintf( path, sizeof( path ), "%s/%s", dir, name );
+
+    FILE* file = fopen( path, "r" );
+    if( !file )
+        return false;
+
+    char text[64] = {};
+    const bool read = fgets( text, sizeof( text ), file ) != nullptr;
+    fclose( file );
+
+    if( !read )
+        return false;
+
+    outValue = strncmp( text, "max", 3 ) == 0 ? std::numeric_limits<uint64>::max() : (uint64)strtoull( text, nullptr, 10 );
+    return true;
+}
+
+// Reads a field of a cgroup memory.stat file
+//-----------------------------------------------------------
+static uint64 ReadCgroupStat( const char* dir, const char* field )
+{
+    char path[1200];
+    snprintf( path, sizeof( path ), "%s/memory.stat", dir );
+
+    FILE* file = fopen( path, "r" );
+    if( !file )
+        return 0;
+
+    uint64 value = 0;
+    char   name[64];
+    unsigned long long v;
+
+    while( fscanf( file, "%63s %llu", name, &v ) == 2 )
+    {
+        if( strcmp( name, field ) == 0 )
+        {
+            value = (uint64)v;
+            break;
+        }
+    }
+
+    fclose( file );
+    return value;
+}
+
+// Gets the lowest memory limit of the process' cgroup and its ancestors, and the usage of the cgroup
+// that has it, less the page cache that can be reclaimed. Returns false if there is no limit.
+//-----------------------------------------------------------
+static bool GetCgroupMemory( uint64& outLimit, uint64& outUsage )
+{
+    static bool   queried  = false;
+    static bool   hasLimit = false;
+    static char   limitDir[1024];
+    static bool   isV2;
+
+    // Which cgroup has the limit does not change, only its usage does
+    if( !queried )
+    {
+        queried = true;
+
+        char dir[1024];
+        isV2 = GetCgroupDir( nullptr, dir, sizeof( dir ) );
+
+        if( isV2 || GetCgroupDir( "memory", dir, sizeof( dir ) ) )
+        {
+            const char* limitFile = isV2 ? "memory.max" : "memory.limit_in_bytes";
+            const size_t rootLength = strlen( isV2 ? CGROUP_ROOT : CGROUP_ROOT "/memory" );
+
+            uint64 lowest = std::numeric_limits<uint64>::max();
+
+            for( ;; )
+            {
+                uint64 limit;
+                if( ReadCgroupValue( dir, limitFile, limit ) && limit < lowest )
+                {
+                    lowest = limit;
+                    strcpy( limitDir, dir );
+                }
+
+                char* parent = strrchr( dir, '/' );
+                if( strlen( dir ) <= rootLength || !parent )
+                    break;
+
+                *parent = 0;
+            }
+
+            // v1 reports no limit as a huge page-aligned value
+            hasLimit = lowest < (uint64)get_phys_pages() * (uint64)getpagesize();
+        }
+    }
+
+    if( !hasLimit )
+        return false;
+
+    uint64 usage = 0;
+    if( !ReadCgroupValue( limitDir, isV2 ? "memory.max" : "memory.limit_in_bytes", outLimit ) ||
+        !ReadCgroupValue( limitDir, isV2 ? "memory.current" : "memory.usage_in_bytes", usage ) )
+        return false;
+
+    const uint64 reclaimable = ReadCgroupStat( limitDir, isV2 ? "inactive_file" : "total_inactive_file" );
+
+    outUsage = usage > reclaimable ? usage - reclaimable : 0;
+    return true;
+}
+
 //-----------------------------------------------------------
 size_t SysHost::GetPageSize()
 {
     return (size_t)getpagesize();
 }
 
+// Capped by the memory limit of the process' cgroup, if it has one
 //-----------------------------------------------------------
 size_t SysHost::GetTotalSystemMemory()
 {
     const size_t pageSize = GetPageSize();
-    return (size_t)get_phys_pages() * pageSize;
+    const size_t physical = (size_t)get_phys_pages() * pageSize;
+
+    uint64 limit, usage;
+    if( GetCgroupMemory( limit, usage ) )
+        return (size_t)std::min( (uint64)physical, limit );
+
+    return physical;
 }
 
+// Capped by what is left of the memory limit of the process' cgroup, if it has one
 //-----------------------------------------------------------
 size_t SysHost::GetAvailableSystemMemory()
 {
-    const size_t pageSize = GetPageSize();
-    return (size_t)get_avphys_pages() * pageSize;
+    const size_t pageSize  = GetPageSize();
+    const size_t available = (size_t)get_avphys_pages() * pageSize;
+
+    uint64 limit, usage;
+    if( GetCgroupMemory( limit, usage ) )
+        return (size_t)std::min( (uint64)available, limit > usage ? limit - usage : 0 );
+
+    return available;
+}
+
+// The cpus the process may run on, not all of the system's
+//-----------------------------------------------------------
+uint SysHost::GetLogicalCPUCount()
+{
+    return GetAllowedCpus().count;
+}
+
+// Threads are pinned to the performance cores first
+//-----------------------------------------------------------
+uint SysHost::GetPerformanceCPUCount()
+{
+    return GetLogicalCPUCount();
+}
+
+//-----------------------------------------------------------
+uint SysHost::GetCpuQuotaCount()
+{
+    static uint quotaCount = 0;
+    static uint generation = 0;
+
+    if( quotaCount && generation == _cpuGeneration )
+        return quotaCount;
+
+    generation = _cpuGeneration;
+
+    const uint cpuCount = GetLogicalCPUCount();
+
+    // The quota is the cpu time the cgroup may use per period, in microseconds.
+    // Only the lowest one of the cgroup and its ancestors applies.
+    double lowest = (double)cpuCount;
+    char   dir[1024];
+
+    const bool isV2 = GetCgroupDir( nullptr, dir, sizeof( dir ) );
+
+    if( isV2 || GetCgroupDir( "cpu", dir, sizeof( dir ) ) )
+    {
+        const size_t rootLength = strlen( isV2 ? CGROUP_ROOT : CGROUP_ROOT "/cpu" );
+
+        for( ;; )
+        {
+            uint64 quota = 0, period = 0;
+            bool   read  = false;
+
+            if( isV2 )
+            {
+                // "<quota> <period>", or "max <period>"
+                char path[1200];
+                snprintf( path, sizeof( path ), "%s/cpu.max", dir );
+
+                FILE* file = fopen( path, "r" );
+                if( file )
+                {
+                    unsigned long long q, p;
+                    read = fscanf( file, "%llu %llu", &q, &p ) == 2;
+                    fclose( file );
+
+                    quota  = (uint64)q;
+                    period = (uint64)p;
+                }
+            }
+            else
+            {
+                // A quota of -1 is no limit, which fails to read as an unsigned value
+                char path[1200];
+                snprintf( path, sizeof( path ), "%s/cpu.cfs_quota_us", dir );
+
+                FILE* file = fopen( path, "r" );
+                if( file )
+                {
+                    long long q;
+                    read = fscanf( file, "%lld", &q ) == 1 && q > 0 && ReadCgroupValue( dir, "cpu.cfs_period_us", period );
+                    fclose( file );
+
+                    quota = read ? (uint64)q : 0;
+                }
+            }
+
+            if( read && period > 0 )
+                lowest = std::min( lowest, (double)quota / (double)period );
+
+            char* parent = strrchr( dir, '/' );
+            if( strlen( dir ) <= rootLength || !parent )
+                break;
+
+            *parent = 0;
+        }
+    }
+
+    // A partial cpu still gets a thread
+    quotaCount = (uint)std::min( (double)cpuCount, std::max( 1.0, std::ceil( lowest ) ) );
+    return quotaCount;
+}
+
+//-----------------------------------------------------------
+uint64 SysHost::GetFreeDiskSpace( const char* path )
+{
+    struct statvfs fs;
+    if( statvfs( path && *path ? path : ".", &fs ) != 0 )
+        return 0;
+
+    return (uint64)fs.f_bavail * (uint64)fs.f_frsize;
 }
 
+// The block device of the path is found in sysfs by its device number.
+// Its numa_node is that of the nearest of its parents that has one, which is its PCI device.
 //-----------------------------------------------------------
- uint SysHost::GetLogicalCPUCount()
- {
-    return (uint)get_nprocs();
- }
+int SysHost::GetPathNumaNode( const char* path )
+{
+    struct stat st;
+    if( stat( path && *path ? path : ".", &st ) != 0 )
+        return -1;
+
+    char devPath[64];
+    snprintf( devPath, sizeof( devPath ), "/sys/dev/block/%u:%u", major( st.st_dev ), minor( st.st_dev ) );
+
+    char* realDevPath = realpath( devPath, nullptr );
+    if( !realDevPath )
+        return -1;
+
+    std::string dir = realDevPath;
+    free( realDevPath );
+
+    for( size_t end = dir.size(); end != std::string::npos && end > sizeof( "/sys/devices" ) - 1; end = dir.rfind( '/', end - 1 ) )
+    {
+        const std::string nodePath = dir.substr( 0, end ) + "/numa_node";
+
+        FILE* file = fopen( nodePath.c_str(), "r" );
+        if( !file )
+            continue;
+
+        // The node is -1 if the device doesn't know it
+        int node = -1;
+        if( fscanf( file, "%d", &node ) != 1 )
+            node = -1;
+
+        fclose( file );
+        return node;
+    }
+
+    return -1;
+}
 
 //-----------------------------------------------------------
 void* SysHost::VirtualAlloc( size_t size, bool initialize )
@@ -89,6 +520,85 @@ void* SysHost::VirtualAlloc( size_t size, bool initialize )
     return ((byte*)ptr)+pageSize;
 }
 
+//-----------------------------------------------------------
+void* SysHost::VirtualAllocLargePages( size_t size, PageBacking maxBacking, PageBacking& outBacking, size_t& outSize )
+{
+    struct HugeMode
+    {
+        PageBacking backing;
+        size_t      pageSize;
+        int         flags;
+    };
+
+    const HugeMode modes[] = {
+        { PageBacking::Huge , 1ull GB, MAP_HUGETLB | MAP_HUGE_1GB },
+        { PageBacking::Large, 2ull MB, MAP_HUGETLB | MAP_HUGE_2MB },
+    };
+
+    for( const HugeMode& mode : modes )
+    {
+        if( mode.backing > maxBacking )
+            continue;
+
+        const size_t allocSize = RoundUpToNextBoundary( size, (int)mode.pageSize );
+
+        void* ptr = mmap( NULL, allocSize,
+            PROT_READ | PROT_WRITE,
+            MAP_ANONYMOUS | MAP_PRIVATE | mode.flags,
+            -1, 0
+        );
+
+        // Not enough huge pages reserved, or not supported. Try the next size.
+        if( ptr == MAP_FAILED )
+            continue;
+
+        {
+            std::lock_guard<std::mutex> lock( _largeAllocLock );
+
+            LargePageAlloc* slot = nullptr;
+            for( LargePageAlloc& a : _largeAllocs )
+            {
+                if( !a.ptr )
+                {
+                    slot = &a;
+                    break;
+                }
+            }
+
+            if( !slot )
+            {
+                munmap( ptr, allocSize );
+                break;
+            }
+
+            slot->ptr  = ptr;
+            slot->size = allocSize;
+        }
+
+        outBacking = mode.backing;
+        outSize    = allocSize;
+        return ptr;
+    }
+
+    // Fallback to regular pages, but ask for transparent huge pages, if allowed
+    const size_t pageSize = GetPageSize();
+
+    void* ptr = VirtualAlloc( size, false );
+    if( !ptr )
+        return nullptr;
+
+    outBacking = PageBacking::Regular;
+    outSize    = RoundUpToNextBoundary( size, (int)pageSize );
+
+    if( maxBacking >= PageBacking::Transparent )
+    {
+        if( madvise( ptr, outSize, MADV_HUGEPAGE ) == 0 )
+            outBacking = PageBacking::Transparent;
+    }
+
+    return ptr;
+}
+
 //-----------------------------------------------------------
 void SysHost::VirtualFree( void* ptr )
 {
@@ -96,6 +606,22 @@ void SysHost::VirtualFree( void* ptr )
     if( !ptr )
         return;
 
+    // Check if it's an explicit huge page allocation
+    {
+        std::lock_guard<std::mutex> lock( _largeAllocLock );
+
+        for( LargePageAlloc& a : _largeAllocs )
+        {
+            if( a.ptr == ptr )
+            {
+                munmap( a.ptr, a.size );
+                a.ptr  = nullptr;
+                a.size = 0;
+                return;
+            }
+        }
+    }
+
     const size_t pageSize = GetPageSize();
 
     byte* realPtr    = ((byte*)ptr) - pageSize;
@@ -104,6 +630,16 @@ void SysHost::VirtualFree( void* ptr )
     munmap( realPtr, size );
 }
 
+// Older kernels can't release explicit huge pages
+//-----------------------------------------------------------
+bool SysHost::VirtualDiscard( void* ptr, size_t size )
+{
+    ASSERT( ptr );
+
+    // MADV_FREE would only release the pages under memory pressure
+    return madvise( ptr, size, MADV_DONTNEED ) == 0;
+}
+
 //-----------------------------------------------------------
 bool SysHost::VirtualProtect( void* ptr, size_t size, VProtect flags )
 {
@@ -174,16 +710,293 @@ bool SysHost::VirtualProtect( void* ptr, size_t size, VProtect flags )
 //-----------------------------------------------------------
 bool SysHost::SetCurrentThreadAffinityCpuId( uint32 cpuId )
 {
+    const AllowedCpus& cpus = GetAllowedCpus();
+    ASSERT( cpuId < cpus.count );
+
     pthread_t thread = pthread_self();
     
     cpu_set_t cpuSet;
     CPU_ZERO( &cpuSet );
-    CPU_SET( cpuId, &cpuSet );
+    CPU_SET( cpus.osIds[cpuId], &cpuSet );
 
     int r = pthread_setaffinity_np( thread, sizeof(cpu_set_t), &cpuSet );
     return r == 0;
 }
 
+//-----------------------------------------------------------
+bool SysHost::RestrictCpus( const uint* cpuIds, uint count )
+{
+    const AllowedCpus& cpus = GetAllowedCpus();
+
+    cpu_set_t*   cpuSet  = CPU_ALLOC( cpus.osIdCount );
+    const size_t setSize = CPU_ALLOC_SIZE( cpus.osIdCount );
+
+    if( !cpuSet )
+        return false;
+
+    CPU_ZERO_S( setSize, cpuSet );
+
+    // Memory is only allocated from the nodes of the cpus
+    bitmask* nodes = numa_available() != -1 ? numa_allocate_nodemask() : nullptr;
+
+    for( uint i = 0; i < count; i++ )
+    {
+        ASSERT( cpuIds[i] < cpus.count );
+        const uint osId = cpus.osIds[cpuIds[i]];
+
+        CPU_SET_S( osId, setSize, cpuSet );
+
+        const int node = nodes ? numa_node_of_cpu( (int)osId ) : -1;
+        if( node >= 0 )
+            numa_bitmask_setbit( nodes, (uint)node );
+    }
+
+    // Threads started from here on inherit the main thread's affinity and memory policy
+    const bool restricted = sched_setaffinity( 0, setSize, cpuSet ) == 0;
+    CPU_FREE( cpuSet );
+
+    if( !restricted )
+    {
+        if( nodes )
+            numa_free_nodemask( nodes );
+
+        return false;
+    }
+
+    if( nodes )
+    {
+        numa_set_membind( nodes );
+
+        if( _restrictedMemNodes )
+            numa_free_nodemask( _restrictedMemNodes );
+
+        _restrictedMemNodes = nodes;
+    }
+
+    _cpuGeneration++;
+    return true;
+}
+
+//-----------------------------------------------------------
+bool SysHost::SetCurrentThreadProcessorGroup( uint32 cpuId )
+{
+    // No processor groups on Linux
+    return true;
+}
+
+// Threads are placed by their affinity on Linux
+//-----------------------------------------------------------
+bool SysHost::SetCurrentThreadQoS( ThreadQoS qos )
+{
+    return false;
+}
+
+// Reads a single unsigned integer from a sysfs file
+//-----------------------------------------------------------
+static bool ReadSysFsUInt( const char* path, uint64& outValue )
+{
+    FILE* file = fopen( path, "r" );
+    if( !file )
+        return false;
+
+    unsigned long long value = 0;
+    const bool read = fscanf( file, "%llu", &value ) == 1;
+    fclose( file );
+
+    outValue = (uint64)value;
+    return read;
+}
+
+// Reads a cpu list, such as "0-3,8,10-11", from a sysfs file,
+// and sets the flag of each listed cpu below cpuCount.
+//-----------------------------------------------------------
+static bool ReadSysFsCpuList( const char* path, bool* cpuFlags )
+{
+    FILE* file = fopen( path, "r" );
+    if( !file )
+        return false;
+
+    bool any = false;
+    unsigned first, last;
+
+    while( fscanf( file, "%u", &first ) == 1 )
+    {
+        last = first;
+
+        int c = fgetc( file );
+        if( c == '-' )
+        {
+            if( fscanf( file, "%u", &last ) != 1 )
+                break;
+
+            c = fgetc( file );
+        }
+
+        for( unsigned i = first; i <= last; i++ )
+        {
+            const int cpu = OsCpuToIndex( i );
+            if( cpu >= 0 )
+                cpuFlags[cpu] = true;
+        }
+
+        any = true;
+
+        if( c != ',' )
+            break;
+    }
+
+    fclose( file );
+    return any;
+}
+
+// Returns the dense index of key in keys, adding it if it's not there yet
+//-----------------------------------------------------------
+static uint DenseIndex( uint64* keys, uint& keyCount, uint64 key )
+{
+    for( uint i = 0; i < keyCount; i++ )
+        if( keys[i] == key )
+            return i;
+
+    keys[keyCount] = key;
+    return keyCount++;
+}
+
+// #NOTE: This is not thread-safe
+//-----------------------------------------------------------
+const CpuTopology* SysHost::GetCpuTopology()
+{
+    static CpuTopology  _topo;
+    static CpuTopology* topo       = nullptr;
+    static uint         generation = 0;
+
+    if( topo && generation == _cpuGeneration )
+        return topo;
+
+    if( topo )
+        free( _topo.cpus );
+
+    generation = _cpuGeneration;
+
+    const uint cpuCount = GetLogicalCPUCount();
+
+    CpuInfo* cpus     = (CpuInfo*)malloc( sizeof( CpuInfo ) * cpuCount );
+    uint64*  coreKeys = (uint64*) malloc( sizeof( uint64 )  * cpuCount );
+    uint64*  l3Keys   = (uint64*) malloc( sizeof( uint64 )  * cpuCount );
+    uint64*  capacity = (uint64*) malloc( sizeof( uint64 )  * cpuCount );
+    bool*    eCores   = (bool*)   calloc( cpuCount, sizeof( bool ) );
+    bool*    pCores   = (bool*)   calloc( cpuCount, sizeof( bool ) );
+
+    if( !cpus || !coreKeys || !l3Keys || !capacity || !eCores || !pCores )
+        Fatal( "Failed to allocate CPU topology buffers." );
+
+    uint coreCount = 0;
+    uint l3Count   = 0;
+    char path[128];
+
+    for( uint i = 0; i < cpuCount; i++ )
+    {
+        CpuInfo&   cpu  = cpus[i];
+        const uint osId = GetAllowedCpus().osIds[i];   // sysfs is by OS cpu id
+
+        // Physical core, which is only unique within its package.
+        // If it can't be read, the cpu is its own core.
+        uint64 package = 0, core = 0;
+
+        snprintf( path, sizeof( path ), "/sys/devices/system/cpu/cpu%u/topology/physical_package_id", osId );
+        const bool hasPackage = ReadSysFsUInt( path, package );
+
+        snprintf( path, sizeof( path ), "/sys/devices/system/cpu/cpu%u/topology/core_id", osId );
+        if( hasPackage && ReadSysFsUInt( path, core ) )
+            cpu.coreId = DenseIndex( coreKeys, coreCount, ( package << 32 ) | ( core & 0xFFFFFFFF ) );
+        else
+            cpu.coreId = DenseIndex( coreKeys, coreCount, ( 1ull << 63 ) | i );
+
+        // SMT siblings are ranked by cpu id
+        cpu.smtIndex = 0;
+        for( uint j = 0; j < i; j++ )
+            if( cpus[j].coreId == cpu.coreId )
+                cpu.smtIndex++;
+
+        // Level 3 cache. Falls back to the package if there is none.
+        uint64 l3Key = ( 1ull << 63 ) | package;
+
+        for( uint index = 0; index < 8; index++ )
+        {
+            uint64 level = 0, cacheId = 0;
+
+            snprintf( path, sizeof( path ), "/sys/devices/system/cpu/cpu%u/cache/index%u/level", osId, index );
+            if( !ReadSysFsUInt( path, level ) )
+                break;
+
+            if( level != 3 )
+                continue;
+
+            snprintf( path, sizeof( path ), "/sys/devices/system/cpu/cpu%u/cache/index%u/id", osId, index );
+            if( ReadSysFsUInt( path, cacheId ) )
+                l3Key = cacheId;
+
+            break;
+        }
+
+        cpu.l3Id = DenseIndex( l3Keys, l3Count, l3Key );
+        cpu.type = CpuCoreType::Unknown;
+
+        snprintf( path, sizeof( path ), "/sys/devices/system/cpu/cpu%u/cpu_capacity", osId );
+        if( !ReadSysFsUInt( path, capacity[i] ) )
+            capacity[i] = 0;
+    }
+
+    // Core types. Intel hybrid CPUs have a PMU for each kind of core, listing their cpus.
+    // Otherwise, on ARM big.LITTLE, the little cores are those with less than the maximum capacity.
+    bool isHybrid = false;
+
+    if( ReadSysFsCpuList( "/sys/devices/cpu_atom/cpus", eCores ) &&
+        ReadSysFsCpuList( "/sys/devices/cpu_core/cpus", pCores ) )
+    {
+        isHybrid = true;
+
+        for( uint i = 0; i < cpuCount; i++ )
+        {
+            if( eCores[i] )
+                cpus[i].type = CpuCoreType::Efficiency;
+            else if( pCores[i] )
+                cpus[i].type = CpuCoreType::Performance;
+        }
+    }
+    else
+    {
+        uint64 minCapacity = capacity[0], maxCapacity = capacity[0];
+        for( uint i = 1; i < cpuCount; i++ )
+        {
+            minCapacity = std::min( minCapacity, capacity[i] );
+            maxCapacity = std::max( maxCapacity, capacity[i] );
+        }
+
+        if( minCapacity > 0 && minCapacity < maxCapacity )
+        {
+            isHybrid = true;
+
+            for( uint i = 0; i < cpuCount; i++ )
+                cpus[i].type = capacity[i] < maxCapacity ? CpuCoreType::Efficiency : CpuCoreType::Performance;
+        }
+    }
+
+    free( coreKeys );
+    free( l3Keys   );
+    free( capacity );
+    free( eCores   );
+    free( pCores   );
+
+    _topo.cpuCount  = cpuCount;
+    _topo.coreCount = coreCount;
+    _topo.l3Count   = l3Count;
+    _topo.isHybrid  = isHybrid;
+    _topo.cpus      = cpus;
+    topo = &_topo;
+
+    return topo;
+}
+
 //-----------------------------------------------------------
 void CrashHandler( int signal )
 {
@@ -241,6 +1054,33 @@ void SysHost::Random( byte* buffer, size_t size )
     }
 }
 
+// Whether the process' cpuset lets it allocate memory from the given node
+//-----------------------------------------------------------
+static bool IsNumaNodeMemAllowed( uint node )
+{
+    static bitmask* mems = numa_get_mems_allowed();
+
+    if( _restrictedMemNodes && !numa_bitmask_isbitset( _restrictedMemNodes, node ) )
+        return false;
+
+    return !mems || numa_bitmask_isbitset( mems, node );
+}
+
+// Fills an interleaving node mask with the nodes the process may allocate from
+//-----------------------------------------------------------
+static void GetNumaInterleaveMask( unsigned long* mask, size_t maskWords, int maxPossibleNodes )
+{
+    memset( mask, 0, maskWords * sizeof( unsigned long ) );
+
+    for( int node = 0; node < maxPossibleNodes && (size_t)node < maskWords * 64; node++ )
+    {
+        const bool far = _farMemNodes && numa_bitmask_isbitset( _farMemNodes, (uint)node );
+
+        if( IsNumaNodeMemAllowed( (uint)node ) && !far )
+            mask[node / 64] |= 1ul << ( node % 64 );
+    }
+}
+
 // #NOTE: This is not thread-safe
 //-----------------------------------------------------------
 const NumaInfo* SysHost::GetNUMAInfo()
@@ -249,17 +1089,23 @@ const NumaInfo* SysHost::GetNUMAInfo()
         return nullptr;
 
     static NumaInfo _info;
-    static NumaInfo* info = nullptr;
+    static NumaInfo* info       = nullptr;
+    static bool      queried    = false;
+    static uint      generation = 0;
 
-    // Initialize if not initialized
-    if( !info )
+    // Initialize if not initialized, or if the process' cpus changed since
+    if( !queried || generation != _cpuGeneration )
     {
+        queried    = true;
+        generation = _cpuGeneration;
+        info       = nullptr;
         memset( &_info, 0, sizeof( NumaInfo ) );
         
         const uint nodeCount = (uint)numa_num_configured_nodes();
    
-        uint totalCpuCount = 0;
-        Span<uint>* cpuIds = (Span<uint>*)malloc( sizeof( uint* ) * nodeCount );
+        uint totalCpuCount   = 0;
+        uint usableNodeCount = 0;
+        Span<uint>* cpuIds = (Span<uint>*)malloc( sizeof( Span<uint> ) * nodeCount );
 
 
         for( uint i = 0; i < nodeCount; i++ )
@@ -276,27 +1122,33 @@ const NumaInfo* SysHost::GetNUMAInfo()
                 Fatal( "Failed to get cpus from NUMA node %u with error: %d (0x%x)", i, err, err );
             }
 
-            // Count how many CPUs in this node
+            // Count how many of the CPUs in this node the process may run on,
+            // if the node's memory may be used as well.
+            const bool memAllowed = IsNumaNodeMemAllowed( i );
+
             uint cpuCount = 0;
-            for( uint64 j = 0; j < cpuMask->size; j++ )
-                if( numa_bitmask_isbitset( cpuMask, (uint)j ) )
+            for( uint64 j = 0; j < cpuMask->size && memAllowed; j++ )
+                if( numa_bitmask_isbitset( cpuMask, (uint)j ) && OsCpuToIndex( (uint)j ) >= 0 )
                     cpuCount ++;
 
             // Allocate a buffer for this cpu
-            cpuIds[i].values = (uint*)malloc( sizeof( uint ) * cpuCount );
+            cpuIds[i].values = (uint*)malloc( sizeof( uint ) * std::max( cpuCount, 1u ) );
             cpuIds[i].length = cpuCount;
 
-            // Assign CPUs
+            // Assign CPUs, by their index in the allowed CPUs
             uint cpuI = 0;
-            for( uint64 j = 0; j < cpuMask->size; j++ )
+            for( uint64 j = 0; j < cpuMask->size && memAllowed; j++ )
             {
-                int s = numa_bitmask_isbitset( cpuMask, (uint)j );
-                if( s )
-                    cpuIds[i].values[cpuI++] = (uint)j;
+                const int cpu = numa_bitmask_isbitset( cpuMask, (uint)j ) ? OsCpuToIndex( (uint)j ) : -1;
+                if( cpu >= 0 )
+                    cpuIds[i].values[cpuI++] = (uint)cpu;
 
                 ASSERT( cpuI <= cpuCount );
             }
 
+            if( cpuCount )
+                usableNodeCount++;
+
             totalCpuCount += cpuCount;
 
             // #TODO BUG: This is a memory leak,
@@ -307,6 +1159,12 @@ const NumaInfo* SysHost::GetNUMAInfo()
             // numa_free_cpumask( cpuMask );
         }
 
+        // Nodes keep their OS numbers, as memory is bound by them, but those the process
+        // can't run on, or allocate from, have no cpus. With fewer than 2 usable ones,
+        // as in a container confined to a single node, the system is treated as not NUMA.
+        if( usableNodeCount < 2 )
+            return nullptr;
+
         // Save instance
         _info.nodeCount = nodeCount;
         _info.cpuCount  = totalCpuCount;
@@ -323,6 +1181,67 @@ void SysHost::NumaAssignPages( void* ptr, size_t size, uint node )
     numa_tonode_memory( ptr, size, (int)node );
 }
 
+//-----------------------------------------------------------
+uint SysHost::EnableFarMemoryTier()
+{
+    if( numa_available() == -1 )
+        return 0;
+
+    if( _farMemNodes )
+        return (uint)numa_bitmask_weight( _farMemNodes );
+
+    bitmask* nodes   = numa_allocate_nodemask();
+    bitmask* cpuMask = numa_allocate_cpumask();
+
+    if( !nodes || !cpuMask )
+        Fatal( "Failed to allocate NUMA node mask." );
+
+    uint nodeCount = 0;
+
+    // Node numbers may be sparse, those that don't exist have no memory
+    for( int node = 0; node <= numa_max_node(); node++ )
+    {
+        if( !IsNumaNodeMemAllowed( (uint)node ) || numa_node_size64( node, nullptr ) <= 0 )
+            continue;
+
+        if( numa_node_to_cpus( node, cpuMask ) != 0 || numa_bitmask_weight( cpuMask ) > 0 )
+            continue;
+
+        numa_bitmask_setbit( nodes, (uint)node );
+        nodeCount++;
+    }
+
+    numa_free_cpumask( cpuMask );
+
+    if( nodeCount == 0 )
+    {
+        numa_free_nodemask( nodes );
+        return 0;
+    }
+
+    _farMemNodes = nodes;
+    return nodeCount;
+}
+
+//-----------------------------------------------------------
+bool SysHost::NumaSetMemoryFarMode( void* ptr, size_t size )
+{
+    if( !_farMemNodes )
+        return false;
+
+    long r = mbind( ptr, size, MPOL_INTERLEAVE, _farMemNodes->maskp, _farMemNodes->size + 1, 0 );
+
+    #if _DEBUG
+    if( r )
+    {
+        int err = errno;
+        Log::Error( "Warning: mbind() failed with error %d (0x%x).", err, err );
+    }
+    #endif
+
+    return r == 0;
+}
+
 //-----------------------------------------------------------
 bool SysHost::NumaSetThreadInterleavedMode()
 {
@@ -332,11 +1251,12 @@ bool SysHost::NumaSetThreadInterleavedMode()
     
     const size_t MASK_SIZE = 128;
     unsigned long mask[MASK_SIZE];
-    memset( mask, 0xFF, sizeof( mask ) );
     
     const int maxPossibleNodes = numa_num_possible_nodes();
     ASSERT( (MASK_SIZE * 64) >= (size_t)maxPossibleNodes );
 
+    GetNumaInterleaveMask( mask, MASK_SIZE, maxPossibleNodes );
+
     long r = set_mempolicy( MPOL_INTERLEAVE, mask, maxPossibleNodes );
 
     #if _DEBUG
@@ -359,11 +1279,12 @@ bool SysHost::NumaSetMemoryInterleavedMode( void* ptr, size_t size )
 
     const size_t MASK_SIZE = 128;
     unsigned long mask[MASK_SIZE];
-    memset( mask, 0xFF, sizeof( mask ) );
 
     const int maxPossibleNodes = numa_num_possible_nodes();
     ASSERT( (MASK_SIZE * 64) >= (size_t)maxPossibleNodes );
 
+    GetNumaInterleaveMask( mask, MASK_SIZE, maxPossibleNodes );
+
     long r = mbind( ptr, size, MPOL_INTERLEAVE, mask, maxPossibleNodes, 0 ); 
     
     #if _DEBUG
@@ -399,4 +1320,13 @@ int SysHost::NumaGetNodeFromPage( void* ptr )
     }
 
     return node;
+}
+
+//-----------------------------------------------------------
+bool SysHost::NumaGetNodesFromPages( void** pages, uint count, int* outNodes )
+{
+    if( !GetNUMAInfo() )
+        return false;
+
+    return numa_move_pages( 0, count, pages, nullptr, outNodes, 0 ) == 0;
 }
\ No newline at end of file
@@ -2,6 +2,11 @@
 #include "Platform.h"
 #include "Util.h"
 
+#include <sys/statvfs.h>
+#include <sys/mman.h>
+#include <sys/sysctl.h>
+#include <pthread/qos.h>
+
 #if _DEBUG
     #include "util/Log.h"
 #endif
@@ -47,6 +52,76 @@ size_t SysHost::GetAvailableSystemMemory()
              vmstat->inactive_count ) * pageSize;
 }
 
+// Returns 0 if the value is not known
+//-----------------------------------------------------------
+static uint GetSysCtlUInt( const char* name )
+{
+    int    value = 0;
+    size_t size  = sizeof( value );
+
+    if( sysctlbyname( name, &value, &size, NULL, 0 ) != 0 || value < 0 )
+        return 0;
+
+    return (uint)value;
+}
+
+//-----------------------------------------------------------
+uint SysHost::GetLogicalCPUCount()
+{
+    const uint count = GetSysCtlUInt( "hw.logicalcpu" );
+    return count ? count : 1;
+}
+
+// macOS has no CPU quota
+//-----------------------------------------------------------
+uint SysHost::GetCpuQuotaCount()
+{
+    return GetLogicalCPUCount();
+}
+
+// Apple Silicon has a performance level per kind of core, the performance cores first.
+// Intel Macs don't report any.
+//-----------------------------------------------------------
+uint SysHost::GetPerformanceCPUCount()
+{
+    const uint cpuCount = GetLogicalCPUCount();
+
+    if( GetSysCtlUInt( "hw.nperflevels" ) < 2 )
+        return cpuCount;
+
+    const uint count = GetSysCtlUInt( "hw.perflevel0.logicalcpu" );
+    return count && count < cpuCount ? count : cpuCount;
+}
+
+//-----------------------------------------------------------
+uint64 SysHost::GetFreeDiskSpace( const char* path )
+{
+    struct statvfs fs;
+    if( statvfs( path && *path ? path : ".", &fs ) != 0 )
+        return 0;
+
+    return (uint64)fs.f_bavail * (uint64)fs.f_frsize;
+}
+
+// macOS systems are not NUMA
+//-----------------------------------------------------------
+int SysHost::GetPathNumaNode( const char* path )
+{
+    return -1;
+}
+
+//-----------------------------------------------------------
+uint SysHost::EnableFarMemoryTier()
+{
+    return 0;
+}
+
+//-----------------------------------------------------------
+bool SysHost::NumaSetMemoryFarMode( void* ptr, size_t size )
+{
+    return false;
+}
+
 //-----------------------------------------------------------
 void* SysHost::VirtualAlloc( size_t size, bool initialize )
 {
@@ -94,12 +169,30 @@ void* SysHost::VirtualAlloc( size_t size, bool initialize )
     return ptr;
 }
 
+//-----------------------------------------------------------
+void* SysHost::VirtualAllocLargePages( size_t size, PageBacking maxBacking, PageBacking& outBacking, size_t& outSize )
+{
+    // #TODO: Use VM_FLAGS_SUPERPAGE_SIZE_2MB on x86
+    (void)maxBacking;
+
+    outBacking = PageBacking::Regular;
+    outSize    = RoundUpToNextBoundary( size, (int)getpagesize() );
+
+    return VirtualAlloc( size, false );
+}
+
 //-----------------------------------------------------------
 void SysHost::VirtualFree( void* ptr )
 {
     // #TODO: Implement
 }
 
+//-----------------------------------------------------------
+bool SysHost::VirtualDiscard( void* ptr, size_t size )
+{
+    return madvise( ptr, size, MADV_FREE ) == 0;
+}
+
 //-----------------------------------------------------------
 uint64 SysHost::SetCurrentProcessAffinityMask( uint64 mask )
 {
@@ -125,4 +218,58 @@ uint64 SysHost::SetCurrentThreadAffinityMask( uint64 mask )
         return (uint64)(integer_t)mask;
 
     return 0;
-}
\ No newline at end of file
+}
+// Threads are kept on the performance cores by their QoS class instead of their affinity.
+// User-initiated threads run on them, when they are free. Utility ones are preferably
+// given the efficiency cores, and their I/O may be throttled behind that of higher classes,
+// which the plotter's compute threads don't do.
+//-----------------------------------------------------------
+bool SysHost::SetCurrentThreadQoS( ThreadQoS qos )
+{
+    const qos_class_t qosClass = qos == ThreadQoS::Compute ? QOS_CLASS_USER_INITIATED : QOS_CLASS_UTILITY;
+
+    return pthread_set_qos_class_self_np( qosClass, 0 ) == 0;
+}
+
+// Threads can't be pinned to a cpu on macOS, let alone the whole process
+//-----------------------------------------------------------
+bool SysHost::RestrictCpus( const uint* cpuIds, uint count )
+{
+    return false;
+}
+
+// macOS does not tell which logical cpus share a core or a cache,
+// and threads can't be pinned to a cpu anyway, so each cpu is reported as its own core.
+// #NOTE: This is not thread-safe
+//-----------------------------------------------------------
+const CpuTopology* SysHost::GetCpuTopology()
+{
+    static CpuTopology  _topo;
+    static CpuTopology* topo = nullptr;
+
+    if( topo )
+        return topo;
+
+    const uint cpuCount = GetLogicalCPUCount();
+
+    CpuInfo* cpus = (CpuInfo*)malloc( sizeof( CpuInfo ) * cpuCount );
+    if( !cpus )
+        Fatal( "Failed to allocate CPU topology buffer." );
+
+    for( uint i = 0; i < cpuCount; i++ )
+    {
+        cpus[i].coreId   = i;
+        cpus[i].smtIndex = 0;
+        cpus[i].l3Id     = 0;
+        cpus[i].type     = CpuCoreType::Unknown;
+    }
+
+    _topo.cpuCount  = cpuCount;
+    _topo.coreCount = cpuCount;
+    _topo.l3Count   = 1;
+    _topo.isHybrid  = false;
+    _topo.cpus      = cpus;
+    topo = &_topo;
+
+    return topo;
+}
@@ -6,6 +6,12 @@
 #include <fcntl.h>
 #include <unistd.h>
 
+#include "io/NetSink.h"
+
+#if PLATFORM_IS_LINUX
+    #include "io/IOUring.h"
+#endif
+
 //----------------------------------------------------------
 bool FileStream::Open( const char* path, FileMode mode, FileAccess access, FileFlags flags )
 {
@@ -29,18 +35,24 @@ bool FileStream::Open( const char* path, FileStream& file, FileMode mode, FileAc
     int fdFlags = access == FileAccess::Read  ? O_RDONLY :
                   access == FileAccess::Write ? O_WRONLY : O_RDWR;
         
-    fdFlags |= mode == FileMode::Create ? O_CREAT  :
-               mode == FileMode::Append ? O_APPEND : 0;
+    fdFlags |= mode == FileMode::Create    ? O_CREAT          :
+               mode == FileMode::CreateNew ? O_CREAT | O_EXCL :
+               mode == FileMode::Append    ? O_APPEND         : 0;
 
     #if PLATFORM_IS_LINUX
+        // Positional async writes don't mix with O_APPEND
+        const bool asyncIO = IsFlagSet( flags, FileFlags::AsyncIO ) && mode != FileMode::Append && IOUring::IsSupported();
+
+        // With async I/O, we don't want every write to wait on the device,
+        // or we can't have more than one in flight. Flush() makes them durable instead.
         if( IsFlagSet( flags, FileFlags::NoBuffering ) )
-            fdFlags |= O_DIRECT | O_SYNC;
+            fdFlags |= asyncIO ? O_DIRECT : O_DIRECT | O_SYNC;
 
         if( IsFlagSet( flags, FileFlags::LargeFile )  )
             fdFlags |= O_LARGEFILE;
     #endif
 
-    if( mode == FileMode::Create )
+    if( mode == FileMode::Create || mode == FileMode::CreateNew )
         fmode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH;
 
     int fd = open( path, fdFlags, fmode );
@@ -80,6 +92,20 @@ bool FileStream::Open( const char* path, FileStream& file, FileMode mode, FileAc
 
         ASSERT( blockSize > 0 );
     }
+
+    #if PLATFORM_IS_LINUX
+        if( asyncIO )
+        {
+            // If we fail to create the ring, writes are just done synchronously
+            file._uring = new IOUring();
+
+            if( !file._uring->Init( fd ) )
+            {
+                delete file._uring;
+                file._uring = nullptr;
+            }
+        }
+    #endif
     
     file._fd            = fd;
     file._blockSize     = (size_t)blockSize;
@@ -92,12 +118,66 @@ bool FileStream::Open( const char* path, FileStream& file, FileMode mode, FileAc
     return true;
 }
 
+//----------------------------------------------------------
+bool FileStream::OpenRemote( const char* address, const NetKey& key, const char* fileName )
+{
+    if( IsOpen() )
+        return false;
+
+    NetSink* net = new NetSink();
+
+    if( !net->Connect( address, key, fileName ) )
+    {
+        _error = net->GetError();
+        delete net;
+        return false;
+    }
+
+    _net           = net;
+    _blockSize     = net->BlockSize();
+    _writePosition = 0;
+    _readPosition  = 0;
+    _access        = FileAccess::Write;
+    _flags         = FileFlags::None;
+    _error         = 0;
+
+    return true;
+}
+
+//----------------------------------------------------------
+bool FileStream::IsRemote() const
+{
+    return _net != nullptr;
+}
+
 //-----------------------------------------------------------
 void FileStream::Close()
 {
+    if( _net )
+    {
+        _net->Close();
+        delete _net;
+        _net = nullptr;
+
+        _writePosition = 0;
+        _access        = FileAccess::None;
+        _error         = 0;
+        _blockSize     = 0;
+        return;
+    }
+
     if( _fd <= 0 )
         return;
 
+    #if PLATFORM_IS_LINUX
+        if( _uring )
+        {
+            _uring->WaitForWrites();
+            delete _uring;
+            _uring = nullptr;
+        }
+    #endif
+
     #if _DEBUG
     int r =
     #endif
@@ -139,6 +219,26 @@ ssize_t FileStream::Read( void* buffer, size_t size )
     return sizeRead;
 }
 
+//-----------------------------------------------------------
+ssize_t FileStream::ReadAt( void* buffer, size_t size, int64 offset )
+{
+    ASSERT( buffer );
+
+    if( buffer == nullptr || offset < 0 )
+        return -1;
+
+    if( ! IsFlagSet( _access, FileAccess::Read ) )
+        return -1;
+
+    if( _fd < 0 )
+        return -1;
+
+    if( size < 1 )
+        return 0;
+
+    return pread( _fd, buffer, size, (off_t)offset );
+}
+
 //-----------------------------------------------------------
 ssize_t FileStream::Write( const void* buffer, size_t size )
 {
@@ -152,14 +252,33 @@ ssize_t FileStream::Write( const void* buffer, size_t size )
     if( ! IsFlagSet( _access, FileAccess::Write ) )
         return -1;
 
-    if( _fd < 0 )
-        return -1;
-
     if( size < 1 )
         return 0;
 
+    // The caller may re-use the buffer right away, so it can't be sent zero-copy
+    if( _net )
+    {
+        if( !_net->Write( buffer, size, _writePosition, true ) )
+        {
+            _error = _net->GetError();
+            return -1;
+        }
+
+        _writePosition += size;
+        return (ssize_t)size;
+    }
+
+    if( _fd < 0 )
+        return -1;
+
     // Note that this can return less than size if size > SSIZE_MAX
-    ssize_t written = write( _fd, buffer, size );
+    #if PLATFORM_IS_LINUX
+        // Async writes don't move the file offset, so write at our own position
+        ssize_t written = _uring ? pwrite( _fd, buffer, size, (off_t)_writePosition ) :
+                                   write( _fd, buffer, size );
+    #else
+        ssize_t written = write( _fd, buffer, size );
+    #endif
     
     if( written >= 0 )
         _writePosition += (size_t)written;
@@ -173,10 +292,11 @@ ssize_t FileStream::Write( const void* buffer, size_t size )
 bool FileStream::Reserve( ssize_t size )
 {
     #if PLATFORM_IS_LINUX
+        // posix_fallocate() returns the error instead of setting errno
         int r = posix_fallocate( _fd, 0, (off_t)size );
         if( r != 0 )
         {
-            _error = errno;
+            _error = r;
             return false;
         }
     #else
@@ -188,6 +308,37 @@ bool FileStream::Reserve( ssize_t size )
     return true;
 }
 
+//----------------------------------------------------------
+int64 FileStream::Size()
+{
+    if( _fd < 0 )
+        return -1;
+
+    struct stat fileStat;
+    if( fstat( _fd, &fileStat ) != 0 )
+    {
+        _error = errno;
+        return -1;
+    }
+
+    return (int64)fileStat.st_size;
+}
+
+//----------------------------------------------------------
+bool FileStream::Truncate( int64 size )
+{
+    if( _fd < 0 )
+        return false;
+
+    if( ftruncate( _fd, (off_t)size ) != 0 )
+    {
+        _error = errno;
+        return false;
+    }
+
+    return true;
+}
+
 //----------------------------------------------------------
 bool FileStream::Seek( int64 offset, SeekOrigin origin )
 {
@@ -203,6 +354,28 @@ bool FileStream::Seek( int64 offset, SeekOrigin origin )
         default: return false;
     }
 
+    // The receiver writes at the position sent with every write, there's no end to seek from
+    if( _net )
+    {
+        if( origin == SeekOrigin::End )
+        {
+            _error = ENOTSUP;
+            return false;
+        }
+
+        _writePosition = (size_t)( origin == SeekOrigin::Current ? (int64)_writePosition + offset : offset );
+        return true;
+    }
+
+    #if PLATFORM_IS_LINUX
+        // Async writes don't move the file offset
+        if( _uring && origin == SeekOrigin::Current )
+        {
+            offset += (int64)_writePosition;
+            whence  = SEEK_SET;
+        }
+    #endif
+
     off_t r = lseek( _fd, (off_t)offset, whence );
     if( r == -1 )
     {
@@ -210,6 +383,9 @@ bool FileStream::Seek( int64 offset, SeekOrigin origin )
         return false;
     }
 
+    _writePosition = (size_t)r;
+    _readPosition  = (size_t)r;
+
     return true;
 }
 
@@ -219,6 +395,20 @@ bool FileStream::Flush()
     if( !IsOpen() )
         return false;
 
+    if( !WaitForWrites() )
+        return false;
+
+    if( _net )
+    {
+        if( !_net->Sync() )
+        {
+            _error = _net->GetError();
+            return false;
+        }
+
+        return true;
+    }
+
     int r = fsync( _fd );
 
     if( r )
@@ -230,10 +420,125 @@ bool FileStream::Flush()
     return true;
 }
 
+//-----------------------------------------------------------
+bool FileStream::EvictCache()
+{
+    if( !IsOpen() || _net )
+        return false;
+
+    #if PLATFORM_IS_LINUX
+        const int r = posix_fadvise( _fd, 0, 0, POSIX_FADV_DONTNEED );
+        if( r )
+        {
+            _error = r;
+            return false;
+        }
+
+        return true;
+    #else
+        return false;
+    #endif
+}
+
+//-----------------------------------------------------------
+bool FileStream::WriteAsync( const void* buffer, size_t size )
+{
+    ASSERT( buffer );
+    ASSERT( size   );
+
+    if( !IsFlagSet( _access, FileAccess::Write ) || !IsOpen() )
+        return false;
+
+    if( _net )
+    {
+        if( !_net->Write( buffer, size, _writePosition, false ) )
+        {
+            _error = _net->GetError();
+            return false;
+        }
+
+        _writePosition += size;
+        return true;
+    }
+
+    #if PLATFORM_IS_LINUX
+        if( _uring )
+        {
+            if( !_uring->Write( buffer, size, _writePosition ) )
+            {
+                _error = _uring->GetError();
+                return false;
+            }
+
+            _writePosition += size;
+            return true;
+        }
+    #endif
+
+    const byte* src = (const byte*)buffer;
+
+    while( size )
+    {
+        const ssize_t written = Write( src, size );
+        if( written < 1 )
+            return false;
+
+        src  += written;
+        size -= (size_t)written;
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------
+bool FileStream::WaitForWrites()
+{
+    if( _net && !_net->WaitForWrites() )
+    {
+        _error = _net->GetError();
+        return false;
+    }
+
+    #if PLATFORM_IS_LINUX
+        if( _uring && !_uring->WaitForWrites() )
+        {
+            _error = _uring->GetError();
+            return false;
+        }
+    #endif
+
+    return true;
+}
+
+//-----------------------------------------------------------
+bool FileStream::RegisterBuffer( const void* buffer, size_t size )
+{
+    #if PLATFORM_IS_LINUX
+        if( _uring )
+            return _uring->RegisterBuffer( buffer, size );
+    #endif
+
+    return false;
+}
+
+//-----------------------------------------------------------
+bool FileStream::IsAsync() const
+{
+    // Zero-copy sends hold on to their buffers until WaitForWrites()
+    if( _net )
+        return true;
+
+    #if PLATFORM_IS_LINUX
+        return _uring != nullptr;
+    #else
+        return false;
+    #endif
+}
+
 //-----------------------------------------------------------
 bool FileStream::IsOpen() const
 {
-    return _fd >= 0;
+    return _fd >= 0 || _net;
 }
 
 //-----------------------------------------------------------
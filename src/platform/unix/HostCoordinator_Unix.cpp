@@ -0,0 +1,354 @@
+#include "HostCoordinator.h"
+#include "SysHost.h"
+#include "threading/Thread.h"
+#include "Util.h"
+#include "util/Log.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#define BB_HOST_COORDINATOR_MAGIC   0x4242484F53543031ull   // "BBHOST01"
+
+// How long a joining instance waits for the group's creator to set it up
+#define BB_HOST_COORDINATOR_TIMEOUT_MS 5000
+
+struct HostCoordinatorShared
+{
+    uint64               magic;
+    std::atomic<uint32>  ready;                 // Set once the segment was set up by its creator
+    uint32               instanceCount;         // Slot count
+    uint64               writeBandwidth;        // Bytes per second, 0 if unlimited
+    pthread_mutex_t      lock;                  // Guards the slots' assignment and the bandwidth budget
+    pthread_mutex_t      writeLock;             // Held by the instance whose turn it is to write
+    int64                nextWriteTime;         // When the next throttled chunk may be written, in monotonic ns
+    std::atomic<int32>   pids[BB_MAX_HOST_INSTANCES];    // Process of each slot, or 0 if it's free
+};
+
+static HostCoordinatorShared* _exitShared = nullptr;
+static uint                   _exitSlot   = 0;
+
+//-----------------------------------------------------------
+static int64 MonotonicNs()
+{
+    timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+
+    return (int64)ts.tv_sec * 1000000000ll + (int64)ts.tv_nsec;
+}
+
+// The processes of the group share the mutexes. If one dies while holding one,
+// on Linux, the next one to lock it gets it, and makes it consistent again.
+//-----------------------------------------------------------
+static void InitSharedMutex( pthread_mutex_t* mutex )
+{
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init( &attr );
+    pthread_mutexattr_setpshared( &attr, PTHREAD_PROCESS_SHARED );
+
+#if PLATFORM_IS_LINUX
+    pthread_mutexattr_setrobust( &attr, PTHREAD_MUTEX_ROBUST );
+#endif
+
+    pthread_mutex_init( mutex, &attr );
+    pthread_mutexattr_destroy( &attr );
+}
+
+//-----------------------------------------------------------
+static void LockSharedMutex( pthread_mutex_t* mutex )
+{
+    const int r = pthread_mutex_lock( mutex );
+
+#if PLATFORM_IS_LINUX
+    if( r == EOWNERDEAD )
+        pthread_mutex_consistent( mutex );
+#else
+    (void)r;
+#endif
+}
+
+//-----------------------------------------------------------
+static bool IsProcessAlive( int32 pid )
+{
+    return pid > 0 && ( kill( (pid_t)pid, 0 ) == 0 || errno != ESRCH );
+}
+
+// The slot is freed on exit without the lock, which may be held by one of our own threads
+//-----------------------------------------------------------
+static void LeaveAtExit()
+{
+    if( _exitShared )
+        _exitShared->pids[_exitSlot].store( 0, std::memory_order_release );
+}
+
+//-----------------------------------------------------------
+HostCoordinator* HostCoordinator::Join( const char* group, uint instanceCount, uint64 writeBandwidth )
+{
+    ASSERT( group );
+    ASSERT( instanceCount > 0 && instanceCount <= BB_MAX_HOST_INSTANCES );
+
+    const std::string name = std::string( "/bladebit-" ) + group;
+    const size_t      size = sizeof( HostCoordinatorShared );
+
+    // The first instance creates the segment, the others wait for it to be set up
+    bool created = true;
+    int  fd      = shm_open( name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0660 );
+
+    if( fd < 0 && errno == EEXIST )
+    {
+        created = false;
+        fd      = shm_open( name.c_str(), O_RDWR, 0660 );
+    }
+
+    if( fd < 0 )
+    {
+        Log::Error( "Error: Failed to open shared memory segment %s with error %d.", name.c_str(), errno );
+        return nullptr;
+    }
+
+    if( created && ftruncate( fd, (off_t)size ) != 0 )
+    {
+        Log::Error( "Error: Failed to size shared memory segment %s with error %d.", name.c_str(), errno );
+        close( fd );
+        shm_unlink( name.c_str() );
+        return nullptr;
+    }
+
+    if( !created )
+    {
+        struct stat st;
+        for( int waited = 0; fstat( fd, &st ) == 0 && (size_t)st.st_size < size; waited += 10 )
+        {
+            if( waited >= BB_HOST_COORDINATOR_TIMEOUT_MS )
+            {
+                Log::Error( "Error: Shared memory segment %s was not set up.", name.c_str() );
+                close( fd );
+                return nullptr;
+            }
+
+            Thread::Sleep( 10 );
+        }
+    }
+
+    void* mapping = mmap( nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    close( fd );
+
+    if( mapping == MAP_FAILED )
+    {
+        Log::Error( "Error: Failed to map shared memory segment %s with error %d.", name.c_str(), errno );
+        return nullptr;
+    }
+
+    HostCoordinatorShared* shared = (HostCoordinatorShared*)mapping;
+
+    if( created )
+    {
+        shared->magic          = BB_HOST_COORDINATOR_MAGIC;
+        shared->instanceCount  = instanceCount;
+        shared->writeBandwidth = writeBandwidth;
+        shared->nextWriteTime  = 0;
+
+        InitSharedMutex( &shared->lock      );
+        InitSharedMutex( &shared->writeLock );
+
+        for( uint i = 0; i < BB_MAX_HOST_INSTANCES; i++ )
+            shared->pids[i].store( 0, std::memory_order_relaxed );
+
+        shared->ready.store( 1, std::memory_order_release );
+    }
+    else
+    {
+        for( int waited = 0; shared->ready.load( std::memory_order_acquire ) == 0; waited += 10 )
+        {
+            if( waited >= BB_HOST_COORDINATOR_TIMEOUT_MS )
+            {
+                Log::Error( "Error: Shared memory segment %s was not set up.", name.c_str() );
+                munmap( mapping, size );
+                return nullptr;
+            }
+
+            Thread::Sleep( 10 );
+        }
+
+        if( shared->magic != BB_HOST_COORDINATOR_MAGIC )
+        {
+            Log::Error( "Error: Shared memory segment %s is not a bladebit instance group.", name.c_str() );
+            munmap( mapping, size );
+            return nullptr;
+        }
+    }
+
+    // Take the first free slot, freeing those of the instances that exited
+    const int32 pid  = (int32)getpid();
+    int         slot = -1;
+
+    LockSharedMutex( &shared->lock );
+    {
+        bool empty = true;
+
+        for( uint i = 0; i < BB_MAX_HOST_INSTANCES; i++ )
+        {
+            const int32 slotPid = shared->pids[i].load( std::memory_order_acquire );
+
+            if( slotPid && !IsProcessAlive( slotPid ) )
+                shared->pids[i].store( 0, std::memory_order_release );
+            else if( slotPid )
+                empty = false;
+        }
+
+        // The group is set up again by the first instance to join it once all of its instances left
+        if( empty )
+        {
+            shared->instanceCount  = instanceCount;
+            shared->writeBandwidth = writeBandwidth;
+        }
+
+        for( uint i = 0; i < shared->instanceCount && slot < 0; i++ )
+        {
+            if( shared->pids[i].load( std::memory_order_acquire ) == 0 )
+            {
+                shared->pids[i].store( pid, std::memory_order_release );
+                slot = (int)i;
+            }
+        }
+    }
+    pthread_mutex_unlock( &shared->lock );
+
+    if( slot < 0 )
+    {
+        Log::Error( "Error: All %u instances of group '%s' are already running.", shared->instanceCount, group );
+        munmap( mapping, size );
+        return nullptr;
+    }
+
+    HostCoordinator* coordinator = new HostCoordinator();
+    coordinator->_shared         = shared;
+    coordinator->_slot           = (uint)slot;
+    coordinator->_instanceCount  = shared->instanceCount;
+    coordinator->_writeBandwidth = shared->writeBandwidth;
+
+    _exitShared = shared;
+    _exitSlot   = (uint)slot;
+    atexit( LeaveAtExit );
+
+    return coordinator;
+}
+
+//-----------------------------------------------------------
+bool HostCoordinator::TakeCpuShare()
+{
+    const uint         cpuCount = SysHost::GetLogicalCPUCount();
+    const CpuTopology& topo     = *SysHost::GetCpuTopology();
+    const NumaInfo*    numa     = SysHost::GetNUMAInfo();
+
+    // The cpus to split, and in how many parts.
+    // Whole nodes if each slot can have at least one, otherwise the slots on the same node split it.
+    std::vector<uint> cpus;
+    uint parts = _instanceCount;
+    uint part  = _slot;
+
+    if( numa )
+    {
+        std::vector<uint> nodes;
+        for( uint node = 0; node < numa->nodeCount; node++ )
+        {
+            if( numa->cpuIds[node].length )
+                nodes.push_back( node );
+        }
+
+        const uint nodeCount = (uint)nodes.size();
+
+        auto addNode = [&]( uint node ) {
+            const Span<uint>& nodeCpus = numa->cpuIds[node];
+            cpus.insert( cpus.end(), nodeCpus.values, nodeCpus.values + nodeCpus.length );
+        };
+
+        if( nodeCount >= _instanceCount )
+        {
+            for( uint i = _slot; i < nodeCount; i += _instanceCount )
+                addNode( nodes[i] );
+
+            parts = 1;
+            part  = 0;
+        }
+        else
+        {
+            addNode( nodes[_slot % nodeCount] );
+
+            parts = _instanceCount / nodeCount + ( _slot % nodeCount < _instanceCount % nodeCount ? 1 : 0 );
+            part  = _slot / nodeCount;
+        }
+    }
+    else
+    {
+        for( uint i = 0; i < cpuCount; i++ )
+            cpus.push_back( i );
+    }
+
+    // Split by whole cores, so that SMT siblings stay together
+    std::vector<uint> cores;
+    for( const uint cpu : cpus )
+    {
+        if( std::find( cores.begin(), cores.end(), topo.cpus[cpu].coreId ) == cores.end() )
+            cores.push_back( topo.cpus[cpu].coreId );
+    }
+
+    FatalIf( cores.size() < parts, "Too few cores for %u instances.", _instanceCount );
+
+    const size_t coreBegin = cores.size() * part       / parts;
+    const size_t coreEnd   = cores.size() * ( part+1 ) / parts;
+
+    std::vector<uint> share;
+    for( const uint cpu : cpus )
+    {
+        const size_t core = (size_t)( std::find( cores.begin(), cores.end(), topo.cpus[cpu].coreId ) - cores.begin() );
+
+        if( core >= coreBegin && core < coreEnd )
+            share.push_back( cpu );
+    }
+
+    return SysHost::RestrictCpus( share.data(), (uint)share.size() );
+}
+
+//-----------------------------------------------------------
+void HostCoordinator::BeginWrite()
+{
+    LockSharedMutex( &_shared->writeLock );
+}
+
+//-----------------------------------------------------------
+void HostCoordinator::EndWrite()
+{
+    pthread_mutex_unlock( &_shared->writeLock );
+}
+
+//-----------------------------------------------------------
+void HostCoordinator::Throttle( size_t size )
+{
+    if( !_writeBandwidth )
+        return;
+
+    const int64 chunkTime = (int64)( (double)size / (double)_writeBandwidth * 1e9 );
+
+    // Each chunk gets the next slot of the host's budget, in turn
+    int64 writeTime;
+
+    LockSharedMutex( &_shared->lock );
+    {
+        writeTime = std::max( MonotonicNs(), _shared->nextWriteTime );
+        _shared->nextWriteTime = writeTime + chunkTime;
+    }
+    pthread_mutex_unlock( &_shared->lock );
+
+    const int64 wait = ( writeTime - MonotonicNs() ) / 1000000;
+
+    if( wait > 0 )
+        Thread::Sleep( (long)wait );
+}
@@ -0,0 +1,374 @@
+#include "io/RemoteMemory.h"
+#include "io/NetSink.h"
+#include "threading/Thread.h"
+#include "SysHost.h"
+#include "Util.h"
+#include "util/Log.h"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#include <errno.h>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <map>
+
+struct MemRegion
+{
+    byte*  data;
+    uint64 size;
+    uint32 users;       // Connections that have it open
+};
+
+// Regions are shared by all connections
+struct MemStore
+{
+    std::mutex                        lock;
+    std::map<std::string, MemRegion*> regions;
+    uint64                            totalSize;
+    uint64                            maxSize;
+    NetKey                            key;
+};
+
+struct MemConnection
+{
+    int          socket;
+    std::string  peer;
+    MemStore*    store;
+    Thread*      thread;
+};
+
+static void ServeConnection( MemConnection* conn );
+static bool ServeRegion( MemConnection* conn, MemRegion* region );
+static int  OpenRegion( MemStore& store, const std::string& name, uint64 size, MemRegion*& outRegion );
+static void CloseRegion( MemStore& store, MemRegion* region );
+static int  FreeRegion( MemStore& store, const std::string& name );
+static bool SendReply( int socket, int error );
+
+//-----------------------------------------------------------
+bool MemoryServer::Run( const MemoryServerConfig& cfg )
+{
+    ASSERT( cfg.bindAddress );
+
+    MemStore store;
+    store.totalSize = 0;
+
+    // Don't hand out more than we have, regions are backed as they're written to
+    store.maxSize = cfg.maxSize ? cfg.maxSize : SysHost::GetAvailableSystemMemory();
+
+    if( !NetSink::LoadKey( cfg.secretPath, store.key ) )
+    {
+        Log::Error( "Error: Failed to read a secret from '%s'.", cfg.secretPath );
+        return false;
+    }
+
+    int  error    = 0;
+    bool loopback = false;
+
+    const int listener = NetSink::ListenSocket( cfg.bindAddress, cfg.port, 64, error, &loopback );
+    if( listener < 0 )
+    {
+        Log::Error( "Error: Failed to listen on %s port %u with error %d.", cfg.bindAddress, (uint)cfg.port, error );
+        return false;
+    }
+
+    // Anyone who can reach the port could read and overwrite the regions
+    if( !cfg.secretPath && !loopback )
+    {
+        Log::Error( "Error: A secret is needed to serve memory on '%s', which is not a loopback address.", cfg.bindAddress );
+        close( listener );
+        return false;
+    }
+
+    Log::Line( "Serving up to %.2lf GiB of memory on %s port %u.", (double)store.maxSize BtoGB, cfg.bindAddress, (uint)cfg.port );
+
+    std::vector<MemConnection*> connections;
+
+    for( ;; )
+    {
+        std::string peer;
+
+        const int s = NetSink::Accept( listener, peer );
+
+        if( s < 0 )
+        {
+            if( errno == EINTR || errno == ECONNABORTED )
+                continue;
+
+            Log::Error( "Error: Failed to accept a connection with error %d.", errno );
+            break;
+        }
+
+        // Clean up finished connections
+        for( size_t i = 0; i < connections.size(); )
+        {
+            if( connections[i]->thread->HasExited() )
+            {
+                connections[i]->thread->WaitForExit();
+                delete connections[i]->thread;
+                delete connections[i];
+
+                connections[i] = connections.back();
+                connections.pop_back();
+            }
+            else
+                i++;
+        }
+
+        int one = 1;
+        setsockopt( s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof( one ) );
+
+        MemConnection* conn = new MemConnection();
+        conn->socket = s;
+        conn->peer   = peer;
+        conn->store  = &store;
+        conn->thread = new Thread();
+
+        connections.push_back( conn );
+
+        conn->thread->Run( []( void* param ) {
+            ServeConnection( (MemConnection*)param );
+        }, conn );
+    }
+
+    close( listener );
+
+    for( MemConnection* conn : connections )
+    {
+        conn->thread->WaitForExit();
+        delete conn->thread;
+        delete conn;
+    }
+
+    for( auto& r : store.regions )
+    {
+        SysHost::VirtualFree( r.second->data );
+        delete r.second;
+    }
+
+    return false;
+}
+
+//-----------------------------------------------------------
+void ServeConnection( MemConnection* conn )
+{
+    const int s = conn->socket;
+
+    byte     nonce[BB_NET_KEY_SIZE];
+    MemFrame frame;
+    char     name[BB_MEM_MAX_NAME+1];
+    byte     proof[BB_NET_KEY_SIZE];
+
+    if( !NetSink::SendChallenge( s, BB_MEM_MAGIC, BB_MEM_VERSION, nonce ) ||
+        !NetSink::RecvAll( s, &frame, sizeof( frame ) ) || frame.magic != BB_MEM_MAGIC ||
+        ( frame.type != MemFrameType::Open && frame.type != MemFrameType::Free ) ||
+        frame.size == 0 || frame.size > BB_MEM_MAX_NAME ||
+        !NetSink::RecvAll( s, name, (size_t)frame.size ) ||
+        !NetSink::RecvAll( s, proof, sizeof( proof ) ) )
+    {
+        Log::Error( "Error: Invalid memory request from %s.", conn->peer.c_str() );
+        close( s );
+        return;
+    }
+
+    name[frame.size] = 0;
+
+    if( !NetSink::CheckProof( conn->store->key, nonce, proof ) )
+    {
+        Log::Error( "Error: Rejected a memory request from %s, which does not know the secret.", conn->peer.c_str() );
+        SendReply( s, EACCES );
+        close( s );
+        return;
+    }
+
+    if( frame.type == MemFrameType::Free )
+    {
+        SendReply( s, FreeRegion( *conn->store, name ) );
+        close( s );
+        return;
+    }
+
+    MemRegion* region = nullptr;
+
+    const int error = OpenRegion( *conn->store, name, frame.offset, region );
+    if( error )
+    {
+        Log::Error( "Error: Failed to open memory region %s of %.2lf GiB for %s with error %d.",
+            name, (double)frame.offset BtoGB, conn->peer.c_str(), error );
+
+        SendReply( s, error );
+        close( s );
+        return;
+    }
+
+    if( SendReply( s, 0 ) && !ServeRegion( conn, region ) )
+        Log::Error( "Error: Connection from %s to memory region %s was lost.", conn->peer.c_str(), name );
+
+    CloseRegion( *conn->store, region );
+    close( s );
+}
+
+//-----------------------------------------------------------
+bool ServeRegion( MemConnection* conn, MemRegion* region )
+{
+    const int s = conn->socket;
+
+    // Out of range writes are reported on End. We keep reading, to stay in sync with the client.
+    int writeError = 0;
+
+    for( ;; )
+    {
+        MemFrame frame;
+
+        if( !NetSink::RecvAll( s, &frame, sizeof( frame ) ) || frame.magic != BB_MEM_MAGIC )
+            return false;
+
+        const bool inRange = frame.offset <= region->size && frame.size <= region->size - frame.offset;
+
+        if( frame.type == MemFrameType::Write )
+        {
+            if( inRange )
+            {
+                if( !NetSink::RecvAll( s, region->data + frame.offset, (size_t)frame.size ) )
+                    return false;
+
+                continue;
+            }
+
+            writeError = ERANGE;
+
+            // Drain the payload
+            byte   discard[4096];
+            uint64 remaining = frame.size;
+
+            while( remaining )
+            {
+                const size_t size = (size_t)std::min( remaining, (uint64)sizeof( discard ) );
+
+                if( !NetSink::RecvAll( s, discard, size ) )
+                    return false;
+
+                remaining -= size;
+            }
+        }
+        else if( frame.type == MemFrameType::Read )
+        {
+            if( !SendReply( s, inRange ? 0 : ERANGE ) )
+                return false;
+
+            if( inRange && !NetSink::SendAll( s, region->data + frame.offset, (size_t)frame.size ) )
+                return false;
+        }
+        else if( frame.type == MemFrameType::End )
+        {
+            // Writes land in the region as they are received, so they're all stored by now
+            SendReply( s, writeError );
+            return true;
+        }
+        else
+        {
+            Log::Error( "Error: Unexpected frame from %s.", conn->peer.c_str() );
+            return false;
+        }
+    }
+}
+
+//-----------------------------------------------------------
+int OpenRegion( MemStore& store, const std::string& name, const uint64 size, MemRegion*& outRegion )
+{
+    std::lock_guard<std::mutex> lock( store.lock );
+
+    MemRegion*& region = store.regions[name];
+
+    if( region && region->size >= size )
+    {
+        region->users++;
+        outRegion = region;
+        return 0;
+    }
+
+    // A region in use by other connections can't be moved
+    if( region && region->users )
+        return EBUSY;
+
+    const uint64 oldSize = region ? region->size : 0;
+
+    if( store.totalSize - oldSize + size > store.maxSize )
+    {
+        if( !region )
+            store.regions.erase( name );
+
+        return ENOMEM;
+    }
+
+    // Pages are only backed once they're written to
+    byte* data = (byte*)SysHost::VirtualAlloc( (size_t)size );
+    if( !data )
+    {
+        if( !region )
+            store.regions.erase( name );
+
+        return ENOMEM;
+    }
+
+    if( region )
+    {
+        // Grow it, keeping its contents
+        memcpy( data, region->data, (size_t)region->size );
+        SysHost::VirtualFree( region->data );
+    }
+    else
+        region = new MemRegion();
+
+    region->data  = data;
+    region->size  = size;
+    region->users = 1;
+
+    store.totalSize = store.totalSize - oldSize + size;
+
+    outRegion = region;
+    return 0;
+}
+
+//-----------------------------------------------------------
+void CloseRegion( MemStore& store, MemRegion* region )
+{
+    std::lock_guard<std::mutex> lock( store.lock );
+
+    ASSERT( region->users );
+    region->users--;
+}
+
+//-----------------------------------------------------------
+int FreeRegion( MemStore& store, const std::string& name )
+{
+    std::lock_guard<std::mutex> lock( store.lock );
+
+    auto it = store.regions.find( name );
+    if( it == store.regions.end() )
+        return 0;
+
+    MemRegion* region = it->second;
+    if( region->users )
+        return EBUSY;
+
+    store.totalSize -= region->size;
+
+    SysHost::VirtualFree( region->data );
+    delete region;
+
+    store.regions.erase( it );
+    return 0;
+}
+
+//-----------------------------------------------------------
+bool SendReply( int socket, int error )
+{
+    MemReply reply;
+    reply.error    = error;
+    reply.reserved = 0;
+
+    return NetSink::SendAll( socket, &reply, sizeof( reply ) );
+}
@@ -0,0 +1,166 @@
+#include "util/Metrics.h"
+#include "threading/Thread.h"
+#include "threading/ThreadPool.h"
+#include "Util.h"
+#include "util/Log.h"
+#include "io/NetSink.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <errno.h>
+
+//-----------------------------------------------------------
+MetricsServer::MetricsServer( const PlotMetrics& metrics, ThreadPool& pool )
+    : _metrics  ( metrics )
+    , _pool     ( pool )
+    , _startTime( std::chrono::steady_clock::now() )
+{
+    _pool.SetJobTiming( true );
+}
+
+//-----------------------------------------------------------
+MetricsServer::~MetricsServer()
+{
+    if( _thread )
+    {
+        // Wake the thread up from accept()
+        _stop.store( true, std::memory_order_release );
+        shutdown( _listener, SHUT_RDWR );
+
+        _thread->WaitForExit();
+        delete _thread;
+    }
+
+    if( _listener >= 0 )
+        close( _listener );
+
+    if( !_unixPath.empty() )
+        unlink( _unixPath.c_str() );
+}
+
+//-----------------------------------------------------------
+bool MetricsServer::Start( const char* address )
+{
+    ASSERT( !_thread );
+
+    if( strncmp( address, "unix:", 5 ) == 0 )
+    {
+        const char* path = address + 5;
+
+        sockaddr_un addr;
+        ZeroMem( &addr );
+        addr.sun_family = AF_UNIX;
+
+        if( !*path || strlen( path ) >= sizeof( addr.sun_path ) )
+        {
+            Log::Error( "Error: Invalid metrics socket path '%s'.", path );
+            return false;
+        }
+
+        strcpy( addr.sun_path, path );
+
+        // Replace the socket of a previous run
+        unlink( path );
+
+        _listener = socket( AF_UNIX, SOCK_STREAM, 0 );
+        if( _listener < 0 || bind( _listener, (const sockaddr*)&addr, sizeof( addr ) ) != 0 || listen( _listener, 4 ) != 0 )
+        {
+            Log::Error( "Error: Failed to listen on metrics socket %s with error %d.", path, errno );
+            return false;
+        }
+
+        _unixPath = path;
+    }
+    else
+    {
+        // "[host:]port". IPv6 hosts are enclosed in brackets.
+        const char* portSep = strrchr( address, ':' );
+        const char* portStr = portSep ? portSep + 1 : address;
+
+        std::string host = portSep ? std::string( address, portSep ) : "127.0.0.1";
+
+        if( host.size() > 1 && host.front() == '[' && host.back() == ']' )
+            host = host.substr( 1, host.size() - 2 );
+
+        char* end = nullptr;
+        const unsigned long port = strtoul( portStr, &end, 10 );
+
+        if( host.empty() || end == portStr || *end != '\0' || port == 0 || port > 0xFFFF )
+        {
+            Log::Error( "Error: Invalid metrics address '%s'.", address );
+            return false;
+        }
+
+        // Only local clients get the metrics, unless a host is given
+        int error = 0;
+        _listener = NetSink::ListenSocket( host.c_str(), (uint16)port, 4, error );
+        if( _listener < 0 )
+        {
+            Log::Error( "Error: Failed to listen on metrics address %s port %lu with error %d.", host.c_str(), port, error );
+            return false;
+        }
+    }
+
+    _thread = new Thread();
+    _thread->Run( []( void* param ) {
+        ((MetricsServer*)param)->Serve();
+    }, this );
+
+    Log::Line( "Serving metrics on %s.", address );
+    return true;
+}
+
+//-----------------------------------------------------------
+void MetricsServer::Serve()
+{
+    char request[4096];
+
+    while( !_stop.load( std::memory_order_acquire ) )
+    {
+        const int s = accept( _listener, nullptr, nullptr );
+
+        if( s < 0 )
+        {
+            if( errno == EINTR || errno == ECONNABORTED )
+                continue;
+
+            // The listener was shut down
+            break;
+        }
+
+        // Don't let a stalled client hold up the next scrape
+        timeval timeout = { 2, 0 };
+        setsockopt( s, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof( timeout ) );
+        setsockopt( s, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof( timeout ) );
+
+        // Any request gets the metrics, so only read until the end of its headers
+        size_t received = 0;
+        while( received < sizeof( request ) - 1 )
+        {
+            const ssize_t r = recv( s, request + received, sizeof( request ) - 1 - received, 0 );
+            if( r <= 0 )
+                break;
+
+            received += (size_t)r;
+            request[received] = 0;
+
+            if( strstr( request, "\r\n\r\n" ) || strstr( request, "\n\n" ) )
+                break;
+        }
+
+        const std::string body = Format();
+
+        char header[256];
+        const int headerSize = snprintf( header, sizeof( header ),
+            "HTTP/1.1 200 OK\r\n"
+            "Content-Type: text/plain; version=0.0.4\r\n"
+            "Content-Length: %llu\r\n"
+            "Connection: close\r\n\r\n", (unsigned long long)body.size() );
+
+        if( send( s, header, (size_t)headerSize, MSG_NOSIGNAL ) == headerSize )
+            send( s, body.data(), body.size(), MSG_NOSIGNAL );
+
+        close( s );
+    }
+}
@@ -0,0 +1,598 @@
+#include "io/NetSink.h"
+#include "SysHost.h"
+#include "Util.h"
+#include "util/Log.h"
+#include "b3/blake3.h"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <ctype.h>
+#include <string>
+
+#if defined( __linux__ ) && defined( SO_ZEROCOPY ) && defined( MSG_ZEROCOPY )
+    #define BB_NET_ZEROCOPY 1
+    #include <linux/errqueue.h>
+#else
+    #define BB_NET_ZEROCOPY 0
+#endif
+
+#ifndef MSG_MORE
+    #define MSG_MORE 0
+#endif
+
+#ifndef MSG_NOSIGNAL
+    #define MSG_NOSIGNAL 0
+#endif
+
+// Longest secret read from a secret file
+#define BB_NET_MAX_SECRET 4096
+
+static void ProveKey( const NetKey& key, const byte nonce[BB_NET_KEY_SIZE], byte outProof[BB_NET_KEY_SIZE] );
+static bool IsLoopback( const sockaddr* addr );
+
+//-----------------------------------------------------------
+NetSink::NetSink()
+{
+}
+
+//-----------------------------------------------------------
+NetSink::~NetSink()
+{
+    Close();
+}
+
+//-----------------------------------------------------------
+bool NetSink::Connect( const char* address, const NetKey& key, const char* fileName )
+{
+    ASSERT( address  );
+    ASSERT( fileName );
+
+    if( _socket >= 0 )
+        return false;
+
+    _socket = ConnectSocket( address, _error );
+    if( _socket < 0 )
+        return false;
+
+    // Our frame headers are sent with MSG_MORE, so that they don't go out on their own
+    int one = 1;
+    setsockopt( _socket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof( one ) );
+
+    #if BB_NET_ZEROCOPY
+        _zeroCopy = setsockopt( _socket, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof( one ) ) == 0;
+    #endif
+
+    byte proof[BB_NET_KEY_SIZE];
+
+    if( !RecvChallenge( _socket, BB_NET_MAGIC, BB_NET_VERSION, key, proof, _error ) )
+    {
+        Close();
+        return false;
+    }
+
+    // Ask the receiver to create the file
+    const size_t nameLength = strlen( fileName );
+
+    NetReply reply;
+
+    if( !SendFrame( NetFrameType::Hello, 0, nameLength, true ) ||
+        !SendAll( _socket, fileName, nameLength, MSG_MORE ) ||
+        !SendAll( _socket, proof, sizeof( proof ) ) ||
+        !RecvAll( _socket, &reply, sizeof( reply ) ) )
+    {
+        _error = errno ? errno : ECONNRESET;
+        Close();
+        return false;
+    }
+
+    if( reply.error || reply.blockSize == 0 )
+    {
+        _error = reply.error ? reply.error : EPROTO;
+        Close();
+        return false;
+    }
+
+    _blockSize = reply.blockSize;
+    return true;
+}
+
+//-----------------------------------------------------------
+int NetSink::ConnectSocket( const char* address, int& error )
+{
+    ASSERT( address );
+
+    // Split host and port. IPv6 hosts are enclosed in brackets.
+    const char* portSep = strrchr( address, ':' );
+    if( !portSep || portSep == address )
+    {
+        error = EINVAL;
+        return -1;
+    }
+
+    std::string host( address, portSep );
+
+    if( host.size() > 1 && host.front() == '[' && host.back() == ']' )
+        host = host.substr( 1, host.size() - 2 );
+
+    // Anything after the port is ignored
+    std::string port( portSep + 1 );
+    port = port.substr( 0, port.find( '/' ) );
+
+    addrinfo hints;
+    ZeroMem( &hints );
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    addrinfo* addresses = nullptr;
+    if( getaddrinfo( host.c_str(), port.c_str(), &hints, &addresses ) != 0 )
+    {
+        error = EHOSTUNREACH;
+        return -1;
+    }
+
+    int sock = -1;
+
+    for( const addrinfo* a = addresses; a; a = a->ai_next )
+    {
+        const int s = socket( a->ai_family, a->ai_socktype, a->ai_protocol );
+        if( s < 0 )
+        {
+            error = errno;
+            continue;
+        }
+
+        if( connect( s, a->ai_addr, a->ai_addrlen ) == 0 )
+        {
+            sock = s;
+            break;
+        }
+
+        error = errno;
+        close( s );
+    }
+
+    freeaddrinfo( addresses );
+
+    if( sock >= 0 )
+        error = 0;
+
+    return sock;
+}
+
+//-----------------------------------------------------------
+int NetSink::ListenSocket( const char* host, const uint16 port, const int backlog, int& error, bool* outLoopback )
+{
+    ASSERT( host );
+
+    addrinfo hints;
+    ZeroMem( &hints );
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags    = AI_PASSIVE;
+
+    const std::string portStr = std::to_string( (uint)port );
+
+    addrinfo* addresses = nullptr;
+    if( getaddrinfo( host, portStr.c_str(), &hints, &addresses ) != 0 || !addresses )
+    {
+        error = EADDRNOTAVAIL;
+        return -1;
+    }
+
+    // Only the first address is listened on, so that a name doesn't open more than what it was asked for
+    const addrinfo* a = addresses;
+
+    if( outLoopback )
+        *outLoopback = IsLoopback( a->ai_addr );
+
+    const int s = socket( a->ai_family, a->ai_socktype, a->ai_protocol );
+    if( s < 0 )
+    {
+        error = errno;
+        freeaddrinfo( addresses );
+        return -1;
+    }
+
+    int one  = 1;
+    int zero = 0;
+    setsockopt( s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof( one ) );
+
+    // The IPv6 any address takes IPv4 connections too
+    if( a->ai_family == AF_INET6 )
+        setsockopt( s, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof( zero ) );
+
+    const bool listening = bind( s, a->ai_addr, a->ai_addrlen ) == 0 && listen( s, backlog ) == 0;
+    error = listening ? 0 : errno;
+
+    freeaddrinfo( addresses );
+
+    if( !listening )
+    {
+        close( s );
+        return -1;
+    }
+
+    return s;
+}
+
+//-----------------------------------------------------------
+int NetSink::Accept( const int listener, std::string& peer )
+{
+    sockaddr_storage peerAddr;
+    socklen_t        peerAddrLen = sizeof( peerAddr );
+
+    const int s = accept( listener, (sockaddr*)&peerAddr, &peerAddrLen );
+    if( s < 0 )
+        return -1;
+
+    char name[NI_MAXHOST] = { 0 };
+    getnameinfo( (const sockaddr*)&peerAddr, peerAddrLen, name, sizeof( name ), nullptr, 0, NI_NUMERICHOST );
+
+    peer = name;
+    return s;
+}
+
+//-----------------------------------------------------------
+bool NetSink::LoadKey( const char* secretPath, NetKey& outKey )
+{
+    char   secret[BB_NET_MAX_SECRET+1];
+    size_t length = 0;
+
+    if( secretPath )
+    {
+        FILE* file = fopen( secretPath, "rb" );
+        if( !file )
+            return false;
+
+        // Reading one byte past the limit tells us if the secret is too long
+        length = fread( secret, 1, sizeof( secret ), file );
+        fclose( file );
+
+        while( length && isspace( (unsigned char)secret[length-1] ) )
+            length--;
+
+        if( length == 0 || length > BB_NET_MAX_SECRET )
+            return false;
+    }
+
+    blake3_hasher hasher;
+    blake3_hasher_init( &hasher );
+    blake3_hasher_update( &hasher, secret, length );
+    blake3_hasher_finalize( &hasher, outKey.bytes, sizeof( outKey.bytes ) );
+
+    memset( secret, 0, sizeof( secret ) );
+    return true;
+}
+
+//-----------------------------------------------------------
+bool NetSink::SendChallenge( const int socket, const uint32 magic, const uint32 version, byte outNonce[BB_NET_KEY_SIZE] )
+{
+    NetChallenge challenge;
+    challenge.magic   = magic;
+    challenge.version = version;
+    SysHost::Random( challenge.nonce, sizeof( challenge.nonce ) );
+
+    memcpy( outNonce, challenge.nonce, sizeof( challenge.nonce ) );
+
+    return SendAll( socket, &challenge, sizeof( challenge ) );
+}
+
+//-----------------------------------------------------------
+bool NetSink::RecvChallenge( const int socket, const uint32 magic, const uint32 version, const NetKey& key,
+                             byte outProof[BB_NET_KEY_SIZE], int& error )
+{
+    NetChallenge challenge;
+
+    if( !RecvAll( socket, &challenge, sizeof( challenge ) ) )
+    {
+        error = errno ? errno : ECONNRESET;
+        return false;
+    }
+
+    if( challenge.magic != magic || challenge.version != version )
+    {
+        error = EPROTO;
+        return false;
+    }
+
+    ProveKey( key, challenge.nonce, outProof );
+    return true;
+}
+
+//-----------------------------------------------------------
+bool NetSink::CheckProof( const NetKey& key, const byte nonce[BB_NET_KEY_SIZE], const byte proof[BB_NET_KEY_SIZE] )
+{
+    byte expected[BB_NET_KEY_SIZE];
+    ProveKey( key, nonce, expected );
+
+    // Compared in constant time, so that the timing does not tell how much of it matched
+    byte mismatch = 0;
+    for( uint i = 0; i < BB_NET_KEY_SIZE; i++ )
+        mismatch |= proof[i] ^ expected[i];
+
+    return mismatch == 0;
+}
+
+//-----------------------------------------------------------
+void ProveKey( const NetKey& key, const byte nonce[BB_NET_KEY_SIZE], byte outProof[BB_NET_KEY_SIZE] )
+{
+    blake3_hasher hasher;
+    blake3_hasher_init_keyed( &hasher, key.bytes );
+    blake3_hasher_update( &hasher, nonce, BB_NET_KEY_SIZE );
+    blake3_hasher_finalize( &hasher, outProof, BB_NET_KEY_SIZE );
+}
+
+//-----------------------------------------------------------
+bool IsLoopback( const sockaddr* addr )
+{
+    if( addr->sa_family == AF_INET )
+        return ( ntohl( ((const sockaddr_in*)addr)->sin_addr.s_addr ) >> 24 ) == 127;
+
+    if( addr->sa_family == AF_INET6 )
+    {
+        const in6_addr& a = ((const sockaddr_in6*)addr)->sin6_addr;
+
+        return IN6_IS_ADDR_LOOPBACK( &a ) || ( IN6_IS_ADDR_V4MAPPED( &a ) && a.s6_addr[12] == 127 );
+    }
+
+    return false;
+}
+
+//-----------------------------------------------------------
+bool NetSink::Write( const void* buffer, size_t size, uint64 offset, bool copy )
+{
+    ASSERT( buffer );
+    ASSERT( size   );
+
+    if( _socket < 0 )
+        return false;
+
+    if( !SendFrame( NetFrameType::Data, offset, size, true ) )
+        return false;
+
+    const bool zeroCopy = _zeroCopy && !copy && size >= BB_NET_ZEROCOPY_MIN;
+
+    const byte* src = (const byte*)buffer;
+
+    while( size )
+    {
+        int flags = MSG_NOSIGNAL;
+
+        #if BB_NET_ZEROCOPY
+            if( zeroCopy )
+                flags |= MSG_ZEROCOPY;
+        #endif
+
+        const ssize_t sent = send( _socket, src, size, flags );
+
+        if( sent < 0 )
+        {
+            if( errno == EINTR )
+                continue;
+
+            // Too many pages pinned, wait for some to be released
+            if( zeroCopy && errno == ENOBUFS && _zcPending )
+            {
+                if( !ReapZeroCopy( true ) )
+                    return false;
+
+                continue;
+            }
+
+            _error = errno;
+            return false;
+        }
+
+        // Every send that succeeded, even partially, gets its own completion
+        if( zeroCopy )
+        {
+            _zcPending++;
+
+            if( !ReapZeroCopy( false ) )
+                return false;
+        }
+
+        src  += sent;
+        size -= (size_t)sent;
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------
+bool NetSink::WaitForWrites()
+{
+    return ReapZeroCopy( true );
+}
+
+//-----------------------------------------------------------
+bool NetSink::Sync()
+{
+    if( _socket < 0 || !WaitForWrites() )
+        return false;
+
+    NetReply reply;
+
+    if( !SendFrame( NetFrameType::Sync, 0, 0, false ) )
+        return false;
+
+    if( !RecvAll( _socket, &reply, sizeof( reply ) ) )
+    {
+        _error = errno ? errno : ECONNRESET;
+        return false;
+    }
+
+    if( reply.error )
+    {
+        _error = reply.error;
+        return false;
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------
+void NetSink::Close()
+{
+    if( _socket < 0 )
+        return;
+
+    // Buffers can't be released while the stack still uses them
+    ReapZeroCopy( true );
+
+    SendFrame( NetFrameType::End, 0, 0, false );
+
+    shutdown( _socket, SHUT_WR );
+    close( _socket );
+
+    _socket    = -1;
+    _zeroCopy  = false;
+    _zcPending = 0;
+}
+
+//-----------------------------------------------------------
+bool NetSink::SendFrame( NetFrameType type, uint64 offset, uint64 size, bool more )
+{
+    NetFrame frame;
+    frame.magic  = BB_NET_MAGIC;
+    frame.type   = type;
+    frame.offset = offset;
+    frame.size   = size;
+
+    if( !SendAll( _socket, &frame, sizeof( frame ), more ? MSG_MORE : 0 ) )
+    {
+        _error = errno ? errno : ECONNRESET;
+        return false;
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------
+bool NetSink::ReapZeroCopy( bool wait )
+{
+#if BB_NET_ZEROCOPY
+    while( _zcPending )
+    {
+        if( wait )
+        {
+            // Completions are reported as errors on the socket
+            pollfd pfd = { _socket, 0, 0 };
+
+            if( poll( &pfd, 1, -1 ) < 0 && errno != EINTR )
+            {
+                _error = errno;
+                return false;
+            }
+        }
+
+        byte   control[128];
+        msghdr msg;
+        ZeroMem( &msg );
+        msg.msg_control    = control;
+        msg.msg_controllen = sizeof( control );
+
+        if( recvmsg( _socket, &msg, MSG_ERRQUEUE | MSG_DONTWAIT ) < 0 )
+        {
+            if( errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR )
+            {
+                if( !wait )
+                    break;
+
+                continue;
+            }
+
+            _error = errno;
+            return false;
+        }
+
+        for( cmsghdr* cm = CMSG_FIRSTHDR( &msg ); cm; cm = CMSG_NXTHDR( &msg, cm ) )
+        {
+            const bool isRecvErr = ( cm->cmsg_level == SOL_IP   && cm->cmsg_type == IP_RECVERR   ) ||
+                                   ( cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR );
+            if( !isRecvErr )
+                continue;
+
+            const sock_extended_err* err = (const sock_extended_err*)CMSG_DATA( cm );
+
+            if( err->ee_origin != SO_EE_ORIGIN_ZEROCOPY )
+            {
+                _error = err->ee_errno ? (int)err->ee_errno : EIO;
+                return false;
+            }
+
+            // Each notification covers a range of sends (ids wrap around at 32 bits)
+            const uint32 completed = err->ee_data - err->ee_info + 1;
+
+            ASSERT( completed <= _zcPending );
+            _zcPending -= std::min( completed, _zcPending );
+
+            // The stack had to copy the data anyway (ie. on loopback), so pinning is just overhead
+            if( err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED )
+                _zeroCopy = false;
+        }
+    }
+#else
+    (void)wait;
+#endif
+
+    return true;
+}
+
+//-----------------------------------------------------------
+bool NetSink::SendAll( int socket, const void* buffer, size_t size, int flags )
+{
+    const byte* src = (const byte*)buffer;
+
+    while( size )
+    {
+        const ssize_t sent = send( socket, src, size, flags | MSG_NOSIGNAL );
+
+        if( sent < 0 )
+        {
+            if( errno == EINTR )
+                continue;
+
+            return false;
+        }
+
+        src  += sent;
+        size -= (size_t)sent;
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------
+bool NetSink::RecvAll( int socket, void* buffer, size_t size )
+{
+    byte* dst = (byte*)buffer;
+
+    while( size )
+    {
+        const ssize_t received = recv( socket, dst, size, 0 );
+
+        if( received < 0 && errno == EINTR )
+            continue;
+
+        // Disconnected
+        if( received <= 0 )
+        {
+            if( received == 0 )
+                errno = ECONNRESET;
+
+            return false;
+        }
+
+        dst  += received;
+        size -= (size_t)received;
+    }
+
+    return true;
+}
@@ -0,0 +1,338 @@
+#include "PlotJobServer.h"
+#include "threading/Thread.h"
+#include "Util.h"
+#include "util/Log.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <errno.h>
+#include <algorithm>
+
+//-----------------------------------------------------------
+PlotJobServer::PlotJobServer( const PlotJobValidator& validator )
+    : _validator( validator )
+{
+}
+
+//-----------------------------------------------------------
+PlotJobServer::~PlotJobServer()
+{
+    if( _thread )
+    {
+        // Wake the thread up from accept()
+        _stop.store( true, std::memory_order_release );
+        shutdown( _listener, SHUT_RDWR );
+
+        _thread->WaitForExit();
+        delete _thread;
+    }
+
+    if( _listener >= 0 )
+        close( _listener );
+
+    if( !_socketPath.empty() )
+        unlink( _socketPath.c_str() );
+}
+
+//-----------------------------------------------------------
+bool PlotJobServer::Start( const char* socketPath )
+{
+    ASSERT( !_thread );
+
+    sockaddr_un addr;
+    ZeroMem( &addr );
+    addr.sun_family = AF_UNIX;
+
+    if( !*socketPath || strlen( socketPath ) >= sizeof( addr.sun_path ) )
+    {
+        Log::Error( "Error: Invalid daemon socket path '%s'.", socketPath );
+        return false;
+    }
+
+    strcpy( addr.sun_path, socketPath );
+
+    // Replace the socket of a previous run
+    unlink( socketPath );
+
+    _listener = socket( AF_UNIX, SOCK_STREAM, 0 );
+    if( _listener < 0 || bind( _listener, (const sockaddr*)&addr, sizeof( addr ) ) != 0 || listen( _listener, 16 ) != 0 )
+    {
+        Log::Error( "Error: Failed to listen on daemon socket %s with error %d.", socketPath, errno );
+        return false;
+    }
+
+    _socketPath = socketPath;
+
+    _thread = new Thread();
+    _thread->Run( []( void* param ) {
+        ((PlotJobServer*)param)->Serve();
+    }, this );
+
+    Log::Line( "Accepting plot jobs on %s.", socketPath );
+    return true;
+}
+
+//-----------------------------------------------------------
+bool PlotJobServer::NextJob( PlotJob& job )
+{
+    std::unique_lock<std::mutex> lock( _lock );
+
+    _running = false;
+
+    _queueSignal.wait( lock, [this]() { return _stopRequested || !_queue.empty(); } );
+
+    if( _stopRequested )
+        return false;
+
+    // The queue is kept in the order jobs will run
+    job = _queue.front();
+    _queue.erase( _queue.begin() );
+
+    _runningJob = job;
+    _running    = true;
+    _plotsDone  = 0;
+
+    return true;
+}
+
+//-----------------------------------------------------------
+bool PlotJobServer::HasQueuedJobs()
+{
+    std::lock_guard<std::mutex> lock( _lock );
+    return !_queue.empty() && !_stopRequested;
+}
+
+//-----------------------------------------------------------
+bool PlotJobServer::StopRequested()
+{
+    std::lock_guard<std::mutex> lock( _lock );
+    return _stopRequested;
+}
+
+//-----------------------------------------------------------
+void PlotJobServer::SetProgress( const PlotJob* job, uint32 plotsDone )
+{
+    std::lock_guard<std::mutex> lock( _lock );
+
+    ASSERT( _running && _runningJob.id == job->id );
+    (void)job;
+
+    _plotsDone = plotsDone;
+}
+
+//-----------------------------------------------------------
+void PlotJobServer::Serve()
+{
+    char request[4096];
+
+    while( !_stop.load( std::memory_order_acquire ) )
+    {
+        const int s = accept( _listener, nullptr, nullptr );
+
+        if( s < 0 )
+        {
+            if( errno == EINTR || errno == ECONNABORTED )
+                continue;
+
+            // The listener was shut down
+            break;
+        }
+
+        // Don't let a stalled client hold up the others
+        timeval timeout = { 2, 0 };
+        setsockopt( s, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof( timeout ) );
+        setsockopt( s, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof( timeout ) );
+
+        // Read a single line
+        size_t received = 0;
+        while( received < sizeof( request ) - 1 )
+        {
+            const ssize_t r = recv( s, request + received, sizeof( request ) - 1 - received, 0 );
+            if( r <= 0 )
+                break;
+
+            received += (size_t)r;
+            request[received] = 0;
+
+            if( strchr( request, '\n' ) )
+                break;
+        }
+
+        request[received] = 0;
+
+        char* end = strpbrk( request, "\r\n" );
+        if( end )
+            *end = 0;
+
+        const std::string reply = RunCommand( request );
+
+        send( s, reply.data(), reply.size(), MSG_NOSIGNAL );
+        close( s );
+    }
+}
+
+//-----------------------------------------------------------
+std::string PlotJobServer::RunCommand( const char* line )
+{
+    // Split the line in whitespace-separated arguments
+    std::vector<std::string> args;
+    {
+        const char* c = line;
+        for( ;; )
+        {
+            while( *c == ' ' || *c == '\t' )
+                c++;
+
+            if( !*c )
+                break;
+
+            const char* start = c;
+            while( *c && *c != ' ' && *c != '\t' )
+                c++;
+
+            args.emplace_back( start, c );
+        }
+    }
+
+    if( args.empty() )
+        return "error empty command\n";
+
+    const std::string& cmd = args[0];
+
+    auto parseInt = []( const std::string& s, int64 min, int64 max, int64& out ) {
+
+        char* end = nullptr;
+        const long long v = strtoll( s.c_str(), &end, 10 );
+
+        if( s.empty() || *end || v < min || v > max )
+            return false;
+
+        out = v;
+        return true;
+    };
+
+    if( cmd == "plot" )
+    {
+        PlotJob job;
+        job.id        = 0;
+        job.priority  = 0;
+        job.plotCount = 1;
+
+        for( size_t i = 1; i < args.size(); i++ )
+        {
+            const std::string& arg = args[i];
+            const size_t       sep = arg.find( '=' );
+
+            if( sep == std::string::npos )
+                return "error expected <name>=<value>, got '" + arg + "'\n";
+
+            const std::string name  = arg.substr( 0, sep );
+            const std::string value = arg.substr( sep + 1 );
+
+            int64 v = 0;
+
+            if( name == "farmer" )
+                job.farmerKey = value;
+            else if( name == "pool" )
+                job.poolKey = value;
+            else if( name == "contract" )
+                job.contractAddress = value;
+            else if( name == "dir" )
+                job.outputDir = value;
+            else if( name == "count" )
+            {
+                if( !parseInt( value, 1, 0xFFFFFFFF, v ) )
+                    return "error invalid count '" + value + "'\n";
+
+                job.plotCount = (uint32)v;
+            }
+            else if( name == "priority" )
+            {
+                if( !parseInt( value, -0x7FFFFFFF, 0x7FFFFFFF, v ) )
+                    return "error invalid priority '" + value + "'\n";
+
+                job.priority = (int32)v;
+            }
+            else
+                return "error unknown argument '" + name + "'\n";
+        }
+
+        if( !job.poolKey.empty() && !job.contractAddress.empty() )
+            return "error only one of a pool key or a contract address can be given\n";
+
+        std::string error;
+        if( !_validator( job, error ) )
+            return "error " + error + "\n";
+
+        std::lock_guard<std::mutex> lock( _lock );
+
+        if( _stopRequested )
+            return "error the daemon is stopping\n";
+
+        job.id = _nextJobId++;
+
+        // Insert it after the jobs of the same or higher priority
+        auto it = std::find_if( _queue.begin(), _queue.end(), [&]( const PlotJob& j ) {
+            return j.priority < job.priority;
+        });
+
+        _queue.insert( it, job );
+        _queueSignal.notify_one();
+
+        Log::Line( "Queued plot job %u: %u plot(s), priority %d.", job.id, job.plotCount, job.priority );
+        return "queued " + std::to_string( job.id ) + "\n";
+    }
+    else if( cmd == "status" )
+    {
+        std::lock_guard<std::mutex> lock( _lock );
+
+        std::string reply;
+
+        if( _running )
+        {
+            reply += "running " + std::to_string( _runningJob.id ) + " plots=" + std::to_string( _plotsDone ) +
+                     "/" + std::to_string( _runningJob.plotCount ) + " priority=" + std::to_string( _runningJob.priority ) + "\n";
+        }
+
+        for( const PlotJob& job : _queue )
+        {
+            reply += "queued " + std::to_string( job.id ) + " plots=" + std::to_string( job.plotCount ) +
+                     " priority=" + std::to_string( job.priority ) + "\n";
+        }
+
+        if( _stopRequested )
+            reply += "stopping\n";
+
+        return reply.empty() ? "idle\n" : reply;
+    }
+    else if( cmd == "cancel" )
+    {
+        int64 id = 0;
+        if( args.size() != 2 || !parseInt( args[1], 1, 0xFFFFFFFF, id ) )
+            return "error expected cancel <id>\n";
+
+        std::lock_guard<std::mutex> lock( _lock );
+
+        auto it = std::find_if( _queue.begin(), _queue.end(), [&]( const PlotJob& j ) { return j.id == (uint32)id; } );
+        if( it == _queue.end() )
+            return "error no queued job " + args[1] + "\n";
+
+        _queue.erase( it );
+
+        Log::Line( "Cancelled plot job %u.", (uint32)id );
+        return "cancelled " + args[1] + "\n";
+    }
+    else if( cmd == "stop" )
+    {
+        std::lock_guard<std::mutex> lock( _lock );
+
+        _stopRequested = true;
+        _queueSignal.notify_one();
+
+        Log::Line( "Stop requested. Exiting once the current plot is finished." );
+        return "stopping\n";
+    }
+
+    return "error unknown command '" + cmd + "'\n";
+}
@@ -0,0 +1,418 @@
+#include "io/PlotReceiver.h"
+#include "io/NetSink.h"
+#include "io/FileStream.h"
+#include "threading/Thread.h"
+#include "SysHost.h"
+#include "Util.h"
+#include "util/Log.h"
+#include "ChiaConsts.h"
+
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string>
+#include <vector>
+
+#ifndef RENAME_NOREPLACE
+    #define RENAME_NOREPLACE ( 1 << 0 )
+#endif
+
+struct ReceiverConnection
+{
+    int           socket;
+    std::string   peer;
+    const char**  dirs;
+    uint          dirCount;
+    const NetKey* key;
+    Thread*       thread;
+};
+
+static void ServeConnection( ReceiverConnection* conn );
+static bool ReceiveFile( ReceiverConnection* conn, FileStream& file, size_t blockSize, byte* buffer, size_t bufferSize );
+static bool IsValidPlotFileName( const char* name );
+static const char* SelectDir( const char** dirs, uint dirCount );
+static bool RenameNoReplace( const char* from, const char* to );
+
+//-----------------------------------------------------------
+bool PlotReceiver::Run( const PlotReceiverConfig& cfg )
+{
+    ASSERT( cfg.bindAddress );
+
+    static const char* currentDir = "";
+
+    const char** dirs     = cfg.dirs;
+    uint         dirCount = cfg.dirCount;
+
+    if( dirCount == 0 )
+    {
+        dirs     = &currentDir;
+        dirCount = 1;
+    }
+
+    NetKey key;
+    if( !NetSink::LoadKey( cfg.secretPath, key ) )
+    {
+        Log::Error( "Error: Failed to read a secret from '%s'.", cfg.secretPath );
+        return false;
+    }
+
+    int  error    = 0;
+    bool loopback = false;
+
+    const int listener = NetSink::ListenSocket( cfg.bindAddress, cfg.port, 16, error, &loopback );
+    if( listener < 0 )
+    {
+        Log::Error( "Error: Failed to listen on %s port %u with error %d.", cfg.bindAddress, (uint)cfg.port, error );
+        return false;
+    }
+
+    // Anyone who can reach the port could fill the directories
+    if( !cfg.secretPath && !loopback )
+    {
+        Log::Error( "Error: A secret is needed to receive plots on '%s', which is not a loopback address.", cfg.bindAddress );
+        close( listener );
+        return false;
+    }
+
+    Log::Line( "Receiving plots on %s port %u.", cfg.bindAddress, (uint)cfg.port );
+    for( uint i = 0; i < dirCount; i++ )
+        Log::Line( " Output path : %s", *dirs[i] ? dirs[i] : "Current directory." );
+
+    std::vector<ReceiverConnection*> connections;
+
+    for( ;; )
+    {
+        std::string peer;
+
+        const int s = NetSink::Accept( listener, peer );
+
+        if( s < 0 )
+        {
+            if( errno == EINTR || errno == ECONNABORTED )
+                continue;
+
+            Log::Error( "Error: Failed to accept a connection with error %d.", errno );
+            break;
+        }
+
+        // Clean up finished connections
+        for( size_t i = 0; i < connections.size(); )
+        {
+            if( connections[i]->thread->HasExited() )
+            {
+                connections[i]->thread->WaitForExit();
+                delete connections[i]->thread;
+                delete connections[i];
+
+                connections[i] = connections.back();
+                connections.pop_back();
+            }
+            else
+                i++;
+        }
+
+        if( connections.size() >= BB_NET_RECV_MAX_CONNECTIONS )
+        {
+            Log::Error( "Warning: Refused a connection from %s, as %u plots are being received already.",
+                peer.c_str(), (uint)BB_NET_RECV_MAX_CONNECTIONS );
+            close( s );
+            continue;
+        }
+
+        ReceiverConnection* conn = new ReceiverConnection();
+        conn->socket   = s;
+        conn->peer     = peer;
+        conn->dirs     = dirs;
+        conn->dirCount = dirCount;
+        conn->key      = &key;
+        conn->thread   = new Thread();
+
+        connections.push_back( conn );
+
+        conn->thread->Run( []( void* param ) {
+            ServeConnection( (ReceiverConnection*)param );
+        }, conn );
+    }
+
+    close( listener );
+
+    for( ReceiverConnection* conn : connections )
+    {
+        conn->thread->WaitForExit();
+        delete conn->thread;
+        delete conn;
+    }
+
+    return false;
+}
+
+//-----------------------------------------------------------
+void ServeConnection( ReceiverConnection* conn )
+{
+    const int s = conn->socket;
+
+    byte     nonce[BB_NET_KEY_SIZE];
+    NetFrame frame;
+    char     fileName[256];
+    byte     proof[BB_NET_KEY_SIZE];
+
+    if( !NetSink::SendChallenge( s, BB_NET_MAGIC, BB_NET_VERSION, nonce ) ||
+        !NetSink::RecvAll( s, &frame, sizeof( frame ) ) || frame.magic != BB_NET_MAGIC ||
+        frame.type != NetFrameType::Hello || frame.size == 0 || frame.size >= sizeof( fileName ) ||
+        !NetSink::RecvAll( s, fileName, (size_t)frame.size ) ||
+        !NetSink::RecvAll( s, proof, sizeof( proof ) ) )
+    {
+        Log::Error( "Error: Invalid plot request from %s.", conn->peer.c_str() );
+        close( s );
+        return;
+    }
+
+    fileName[frame.size] = 0;
+
+    NetReply reply;
+    ZeroMem( &reply );
+
+    if( !NetSink::CheckProof( *conn->key, nonce, proof ) )
+    {
+        Log::Error( "Error: Rejected a plot from %s, which does not know the secret.", conn->peer.c_str() );
+
+        reply.error = EACCES;
+        NetSink::SendAll( s, &reply, sizeof( reply ) );
+        close( s );
+        return;
+    }
+
+    if( !IsValidPlotFileName( fileName ) )
+    {
+        Log::Error( "Error: Invalid plot file name '%s' from %s.", fileName, conn->peer.c_str() );
+
+        reply.error = EINVAL;
+        NetSink::SendAll( s, &reply, sizeof( reply ) );
+        close( s );
+        return;
+    }
+
+    // Pick where the plot goes
+    const char*  dirPath   = SelectDir( conn->dirs, conn->dirCount );
+    const size_t dirLength = strlen( dirPath );
+
+    std::string path = dirPath;
+    if( dirLength && dirPath[dirLength-1] != '/' )
+        path += '/';
+    path += fileName;
+
+    // Without its .tmp suffix
+    const std::string plotPath = path.substr( 0, path.size() - 4 );
+
+    // Don't let a plot be replaced, or received for nothing
+    if( access( plotPath.c_str(), F_OK ) == 0 )
+    {
+        Log::Error( "Error: Plot %s from %s already exists.", plotPath.c_str(), conn->peer.c_str() );
+
+        reply.error = EEXIST;
+        NetSink::SendAll( s, &reply, sizeof( reply ) );
+        close( s );
+        return;
+    }
+
+    // The file is made durable when the plotter syncs it.
+    // An existing one, which may be another connection's, is not touched.
+    FileStream file;
+    if( !file.Open( path.c_str(), FileMode::CreateNew, FileAccess::Write,
+                    FileFlags::NoBuffering | FileFlags::LargeFile | FileFlags::AsyncIO ) )
+    {
+        Log::Error( "Error: Failed to create plot file %s with error %d.", path.c_str(), errno );
+
+        reply.error = errno ? errno : EIO;
+        NetSink::SendAll( s, &reply, sizeof( reply ) );
+        close( s );
+        return;
+    }
+
+    const size_t blockSize  = file.BlockSize();
+    const size_t bufferSize = RoundUpToNextBoundary( BB_NET_RECV_BUFFER_SIZE, (int)blockSize );
+    byte*        buffer     = (byte*)SysHost::VirtualAlloc( bufferSize );
+
+    if( !buffer )
+        Fatal( "Failed to allocate the receive buffer." );
+
+    reply.blockSize = (uint32)blockSize;
+
+    bool complete = false;
+
+    if( NetSink::SendAll( s, &reply, sizeof( reply ) ) )
+    {
+        Log::Line( "Receiving plot %s from %s.", path.c_str(), conn->peer.c_str() );
+        complete = ReceiveFile( conn, file, blockSize, buffer, bufferSize );
+    }
+
+    SysHost::VirtualFree( buffer );
+    file.Close();
+    close( s );
+
+    if( !complete )
+    {
+        Log::Error( "Error: Plot %s from %s was not completed. Keeping it as a temporary file.",
+            path.c_str(), conn->peer.c_str() );
+        return;
+    }
+
+    // Remove the .tmp suffix
+    if( !RenameNoReplace( path.c_str(), plotPath.c_str() ) )
+    {
+        Log::Error( "Error: Failed to rename plot file %s with error %d. Keeping it as a temporary file.", path.c_str(), errno );
+        return;
+    }
+
+    Log::Line( "Received plot %s.", plotPath.c_str() );
+}
+
+//-----------------------------------------------------------
+bool ReceiveFile( ReceiverConnection* conn, FileStream& file, size_t blockSize, byte* buffer, size_t bufferSize )
+{
+    const int s = conn->socket;
+
+    bool synced        = false;
+    bool headerWritten = false;
+    int  writeError    = 0;      // Reported on the next sync. We keep reading, to stay in sync with the sender.
+
+    for( ;; )
+    {
+        NetFrame frame;
+
+        if( !NetSink::RecvAll( s, &frame, sizeof( frame ) ) || frame.magic != BB_NET_MAGIC )
+            return false;
+
+        if( frame.type == NetFrameType::Data )
+        {
+            // Writes must be block-aligned, as the file is unbuffered
+            if( frame.offset % blockSize || frame.size % blockSize )
+                return false;
+
+            if( frame.offset > BB_NET_RECV_MAX_FILE_SIZE || frame.size > BB_NET_RECV_MAX_FILE_SIZE - frame.offset )
+            {
+                Log::Error( "Error: Write past %.2lf GiB from %s, which is larger than any plot.",
+                    (double)BB_NET_RECV_MAX_FILE_SIZE BtoGB, conn->peer.c_str() );
+                return false;
+            }
+
+            if( !writeError && !file.Seek( (int64)frame.offset, SeekOrigin::Begin ) )
+                writeError = file.GetError();
+
+            uint64 remaining = frame.size;
+
+            while( remaining )
+            {
+                const size_t size = (size_t)std::min( remaining, (uint64)bufferSize );
+
+                if( !NetSink::RecvAll( s, buffer, size ) )
+                    return false;
+
+                remaining -= size;
+
+                if( writeError )
+                    continue;
+
+                const byte* src  = buffer;
+                size_t      left = size;
+
+                while( left )
+                {
+                    const ssize_t written = file.Write( src, left );
+                    if( written < 1 )
+                    {
+                        writeError = file.GetError();
+                        if( !writeError )
+                            writeError = EIO;
+                        break;
+                    }
+
+                    src  += written;
+                    left -= (size_t)written;
+                }
+            }
+
+            headerWritten |= frame.offset == 0;
+            synced         = false;
+        }
+        else if( frame.type == NetFrameType::Sync )
+        {
+            NetReply reply;
+            ZeroMem( &reply );
+
+            if( !writeError && !file.Flush() )
+                writeError = file.GetError();
+
+            reply.error = writeError;
+            synced      = writeError == 0;
+
+            if( !NetSink::SendAll( s, &reply, sizeof( reply ) ) )
+                return false;
+        }
+        else if( frame.type == NetFrameType::End )
+        {
+            // The header is written last, so a synced header means the whole plot is there
+            return synced && headerWritten && !writeError;
+        }
+        else
+        {
+            Log::Error( "Error: Unexpected frame from %s.", conn->peer.c_str() );
+            return false;
+        }
+    }
+}
+
+//-----------------------------------------------------------
+bool IsValidPlotFileName( const char* name )
+{
+    const size_t length = strlen( name );
+
+    // Don't allow writing outside of our directories
+    if( name[0] == '.' || strchr( name, '/' ) || strchr( name, '\\' ) )
+        return false;
+
+    return length > 4 && strcmp( name + length - 4, ".tmp" ) == 0;
+}
+
+//-----------------------------------------------------------
+const char* SelectDir( const char** dirs, uint dirCount )
+{
+    uint   selected     = 0;
+    uint64 selectedFree = 0;
+
+    for( uint i = 0; i < dirCount; i++ )
+    {
+        const uint64 free = SysHost::GetFreeDiskSpace( dirs[i] );
+
+        if( i == 0 || free > selectedFree )
+        {
+            selected     = i;
+            selectedFree = free;
+        }
+    }
+
+    return dirs[selected];
+}
+
+//-----------------------------------------------------------
+bool RenameNoReplace( const char* from, const char* to )
+{
+#if PLATFORM_IS_LINUX && defined( SYS_renameat2 )
+    if( syscall( SYS_renameat2, AT_FDCWD, from, AT_FDCWD, to, RENAME_NOREPLACE ) == 0 )
+        return true;
+
+    // Not every file system supports it
+    if( errno != EINVAL && errno != ENOSYS )
+        return false;
+#endif
+
+    // Linking fails if the target exists
+    if( link( from, to ) != 0 )
+        return false;
+
+    unlink( from );
+    return true;
+}
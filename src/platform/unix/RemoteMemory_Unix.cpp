@@ -0,0 +1,204 @@
+#include "io/RemoteMemory.h"
+#include "io/NetSink.h"
+#include "Util.h"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#include <errno.h>
+
+#ifndef MSG_MORE
+    #define MSG_MORE 0
+#endif
+
+//-----------------------------------------------------------
+RemoteMemory::RemoteMemory()
+{
+}
+
+//-----------------------------------------------------------
+RemoteMemory::~RemoteMemory()
+{
+    if( _socket >= 0 )
+        close( _socket );
+}
+
+//-----------------------------------------------------------
+bool RemoteMemory::Open( const char* address, const NetKey& key, const char* regionName, const uint64 size )
+{
+    ASSERT( regionName );
+
+    if( _socket >= 0 )
+        return false;
+
+    const size_t nameLength = strlen( regionName );
+    if( nameLength == 0 || nameLength > BB_MEM_MAX_NAME )
+    {
+        _error = EINVAL;
+        return false;
+    }
+
+    if( !Connect( address, key ) )
+        return false;
+
+    if( !SendRequest( MemFrameType::Open, size, regionName ) || !RecvReply() )
+    {
+        close( _socket );
+        _socket = -1;
+        return false;
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------
+bool RemoteMemory::Write( const void* buffer, const size_t size, const uint64 offset )
+{
+    ASSERT( buffer );
+    ASSERT( size   );
+
+    if( _socket < 0 )
+        return false;
+
+    // Writes are not replied to, errors are reported on Close()
+    if( !SendFrame( MemFrameType::Write, offset, size ) ||
+        !NetSink::SendAll( _socket, buffer, size ) )
+    {
+        _error = errno ? errno : ECONNRESET;
+        return false;
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------
+bool RemoteMemory::Read( void* buffer, const size_t size, const uint64 offset )
+{
+    ASSERT( buffer );
+    ASSERT( size   );
+
+    if( _socket < 0 )
+        return false;
+
+    if( !SendFrame( MemFrameType::Read, offset, size ) || !RecvReply() )
+        return false;
+
+    if( !NetSink::RecvAll( _socket, buffer, size ) )
+    {
+        _error = errno ? errno : ECONNRESET;
+        return false;
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------
+bool RemoteMemory::Close()
+{
+    if( _socket < 0 )
+        return false;
+
+    const bool stored = SendFrame( MemFrameType::End, 0, 0 ) && RecvReply();
+
+    close( _socket );
+    _socket = -1;
+
+    return stored;
+}
+
+//-----------------------------------------------------------
+bool RemoteMemory::Free( const char* address, const NetKey& key, const char* regionName, int& error )
+{
+    RemoteMemory mem;
+
+    const size_t nameLength = strlen( regionName );
+    if( nameLength == 0 || nameLength > BB_MEM_MAX_NAME )
+    {
+        error = EINVAL;
+        return false;
+    }
+
+    const bool freed = mem.Connect( address, key ) &&
+                       mem.SendRequest( MemFrameType::Free, 0, regionName ) &&
+                       mem.RecvReply();
+
+    error = mem._error;
+    return freed;
+}
+
+//-----------------------------------------------------------
+bool RemoteMemory::Connect( const char* address, const NetKey& key )
+{
+    _socket = NetSink::ConnectSocket( address, _error );
+    if( _socket < 0 )
+        return false;
+
+    int one = 1;
+    setsockopt( _socket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof( one ) );
+
+    // Proves that we know the secret, without sending it
+    if( NetSink::RecvChallenge( _socket, BB_MEM_MAGIC, BB_MEM_VERSION, key, _proof, _error ) )
+        return true;
+
+    close( _socket );
+    _socket = -1;
+    return false;
+}
+
+//-----------------------------------------------------------
+bool RemoteMemory::SendRequest( const MemFrameType type, const uint64 size, const char* regionName )
+{
+    const size_t nameLength = strlen( regionName );
+
+    if( !SendFrame( type, size, nameLength ) ||
+        !NetSink::SendAll( _socket, regionName, nameLength, MSG_MORE ) ||
+        !NetSink::SendAll( _socket, _proof, sizeof( _proof ) ) )
+    {
+        _error = errno ? errno : ECONNRESET;
+        return false;
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------
+bool RemoteMemory::SendFrame( const MemFrameType type, const uint64 offset, const uint64 size )
+{
+    MemFrame frame;
+    frame.magic  = BB_MEM_MAGIC;
+    frame.type   = type;
+    frame.offset = offset;
+    frame.size   = size;
+
+    // Frames with a payload go out with it
+    const int flags = type == MemFrameType::Write || type == MemFrameType::Open || type == MemFrameType::Free ? MSG_MORE : 0;
+
+    if( !NetSink::SendAll( _socket, &frame, sizeof( frame ), flags ) )
+    {
+        _error = errno ? errno : ECONNRESET;
+        return false;
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------
+bool RemoteMemory::RecvReply()
+{
+    MemReply reply;
+
+    if( !NetSink::RecvAll( _socket, &reply, sizeof( reply ) ) )
+    {
+        _error = errno ? errno : ECONNRESET;
+        return false;
+    }
+
+    if( reply.error )
+    {
+        _error = reply.error;
+        return false;
+    }
+
+    return true;
+}
@@ -4,6 +4,10 @@
 #include "SysHost.h"
 #include "util/Log.h"
 
+#if PLATFORM_IS_MACOS
+    #include <pthread/qos.h>
+#endif
+
 typedef void* (*PthreadFunc)( void* param );
 
 //-----------------------------------------------------------
@@ -28,6 +32,13 @@ Thread::Thread( size_t stackSize )
     r = pthread_attr_setstacksize( &attr, stackSize );
     if( r ) Fatal( "pthread_attr_setstacksize() failed." );
 
+    #if PLATFORM_IS_MACOS
+        // Threads can't be pinned, so they are kept off the efficiency cores by their class instead.
+        // Those that don't compute lower it themselves (see SysHost::SetCurrentThreadQoS()).
+        r = pthread_attr_set_qos_class_np( &attr, QOS_CLASS_USER_INITIATED, 0 );
+        if( r ) Fatal( "pthread_attr_set_qos_class_np() failed." );
+    #endif
+
     // Initialize suspended mode signal
     r = pthread_cond_init(  &_launchCond,  NULL );
     if( r ) Fatal( "pthread_cond_init() failed." );
@@ -1,4 +1,5 @@
 #include "io/FileStream.h"
+#include "io/OverlappedIO.h"
 #include "Util.h"
 #include "util/Log.h"
 
@@ -40,14 +41,21 @@ bool FileStream::Open( const char* path, FileStream& file, FileMode mode, FileAc
         access = FileAccess::Read;
 
     const DWORD dwShareMode           = 0;
-    const DWORD dwCreationDisposition = mode == FileMode::Create ? CREATE_ALWAYS : 
-                                        mode == FileMode::Open   ? OPEN_ALWAYS   :
-                                                                   OPEN_EXISTING;
+    const DWORD dwCreationDisposition = mode == FileMode::Create    ? CREATE_ALWAYS : 
+                                        mode == FileMode::CreateNew ? CREATE_NEW    :
+                                        mode == FileMode::Open      ? OPEN_ALWAYS   :
+                                                                      OPEN_EXISTING;
     DWORD dwFlags  = FILE_ATTRIBUTE_NORMAL;
     DWORD dwAccess = 0;
 
+    // Overlapped writes are made durable with Flush(), so they don't need to write through
+    const bool asyncIO = IsFlagSet( flags, FileFlags::AsyncIO ) && mode != FileMode::Append;
+
     if( IsFlagSet( flags, FileFlags::NoBuffering ) )
-        dwFlags = FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH;
+        dwFlags = asyncIO ? FILE_FLAG_NO_BUFFERING : FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH;
+
+    if( asyncIO )
+        dwFlags |= FILE_FLAG_OVERLAPPED;
 
     if( IsFlagSet( access, FileAccess::Read ) )
         dwAccess = GENERIC_READ;
@@ -74,6 +82,22 @@ bool FileStream::Open( const char* path, FileStream& file, FileMode mode, FileAc
         file._flags         = flags;
         file._error         = 0;
 
+        // The handle is overlapped regardless, synchronous calls then just wait on their own
+        if( asyncIO )
+        {
+            file._overlapped = new OverlappedIO();
+
+            if( !file._overlapped->Init( fd ) )
+            {
+                file._error = file._overlapped->GetError();
+                delete file._overlapped;
+                file._overlapped = nullptr;
+
+                CloseHandle( fd );
+                file._fd = fd = INVALID_HANDLE_VALUE;
+            }
+        }
+
         // #TODO: Seek to end if appending?
     }
     else
@@ -94,6 +118,13 @@ void FileStream::Close()
     if( !HasValidFD() )
         return;
 
+    if( _overlapped )
+    {
+        _overlapped->WaitForWrites();
+        delete _overlapped;
+        _overlapped = nullptr;
+    }
+
     #if _DEBUG
         BOOL r = 
     #endif
@@ -142,7 +173,9 @@ ssize_t FileStream::Read( void* buffer, size_t size )
     DWORD bytesRead = 0;
 
     // Cap size to 32-bit range
-    const BOOL r = ReadFile( _fd, buffer, bytesToRead, &bytesRead, NULL );
+    // (Overlapped handles don't use the file pointer, so we read at our own position.)
+    const BOOL r = _overlapped ? OverlappedIO::TransferSync( _fd, false, buffer, bytesToRead, _readPosition, bytesRead ) :
+                                 ReadFile( _fd, buffer, bytesToRead, &bytesRead, NULL );
     
     if( r )
         _readPosition += (size_t)bytesRead;
@@ -155,6 +188,43 @@ ssize_t FileStream::Read( void* buffer, size_t size )
     return (ssize_t)bytesRead;
 }
 
+//-----------------------------------------------------------
+ssize_t FileStream::ReadAt( void* buffer, size_t size, int64 offset )
+{
+    ASSERT( buffer );
+
+    if( buffer == nullptr || offset < 0 )
+        return -1;
+
+    if( !IsFlagSet( _access, FileAccess::Read ) )
+        return -1;
+
+    if( !HasValidFD() )
+        return -1;
+
+    if( size < 1 )
+        return 0;
+
+    const DWORD bytesToRead = size > std::numeric_limits<DWORD>::max() ?
+                                     std::numeric_limits<DWORD>::max() : 
+                                     (DWORD)size;
+    DWORD bytesRead = 0;
+
+    if( _overlapped )
+        return OverlappedIO::TransferSync( _fd, false, buffer, bytesToRead, (uint64)offset, bytesRead ) ? (ssize_t)bytesRead : -1;
+
+    // On a synchronous handle, the offset of an OVERLAPPED is used as the read position
+    OVERLAPPED ov;
+    ZeroMem( &ov );
+    ov.Offset     = (DWORD)( (uint64)offset );
+    ov.OffsetHigh = (DWORD)( (uint64)offset >> 32 );
+
+    if( !ReadFile( _fd, buffer, bytesToRead, &bytesRead, &ov ) )
+        return -1;
+
+    return (ssize_t)bytesRead;
+}
+
 //-----------------------------------------------------------
 ssize_t FileStream::Write( const void* buffer, size_t size )
 {
@@ -189,7 +259,8 @@ ssize_t FileStream::Write( const void* buffer, size_t size )
     }
 
     DWORD bytesWritten = 0;
-    BOOL r = WriteFile( _fd, buffer, bytesToWrite, &bytesWritten, NULL );
+    BOOL r = _overlapped ? OverlappedIO::TransferSync( _fd, true, (void*)buffer, bytesToWrite, _writePosition, bytesWritten ) :
+                           WriteFile( _fd, buffer, bytesToWrite, &bytesWritten, NULL );
 
     if( r )
         _writePosition += (size_t)bytesWritten;
@@ -205,10 +276,61 @@ ssize_t FileStream::Write( const void* buffer, size_t size )
 //----------------------------------------------------------
 bool FileStream::Reserve( ssize_t size )
 {
-    // #TODO: Use SetFileValidData()?
+    if( !IsOpen() || !HasValidFD() )
+        return false;
+
+    // Allocates the clusters without moving the end of the file, so the file is laid out contiguously.
+    // #NOTE: Writes past the valid data length are still synchronous, even when overlapped.
+    //        SetFileValidData() would avoid that, but it requires SE_MANAGE_VOLUME_NAME,
+    //        and exposes whatever was on disk before.
     // #See: https://docs.microsoft.com/en-us/windows/win32/api/fileapi/nf-fileapi-setfilevaliddata
-    
-    return false;
+    FILE_ALLOCATION_INFO info;
+    info.AllocationSize.QuadPart = (LONGLONG)size;
+
+    if( !SetFileInformationByHandle( _fd, FileAllocationInfo, &info, (DWORD)sizeof( info ) ) )
+    {
+        _error = (int)GetLastError();
+        return false;
+    }
+
+    return true;
+}
+
+//----------------------------------------------------------
+int64 FileStream::Size()
+{
+    if( !IsOpen() || !HasValidFD() )
+        return -1;
+
+    LARGE_INTEGER size;
+    if( !::GetFileSizeEx( _fd, &size ) )
+    {
+        _error = GetLastError();
+        return -1;
+    }
+
+    return (int64)size.QuadPart;
+}
+
+//----------------------------------------------------------
+bool FileStream::Truncate( int64 size )
+{
+    if( !IsOpen() || !HasValidFD() )
+        return false;
+
+    // SetEndOfFile() truncates at the file pointer, so restore it afterwards
+    LARGE_INTEGER distanceToMove, position;
+    distanceToMove.QuadPart = size;
+    position.QuadPart       = (LONGLONG)_writePosition;
+
+    if( !::SetFilePointerEx( _fd, distanceToMove, NULL, FILE_BEGIN ) || !::SetEndOfFile( _fd ) ||
+        !::SetFilePointerEx( _fd, position, NULL, FILE_BEGIN ) )
+    {
+        _error = GetLastError();
+        return false;
+    }
+
+    return true;
 }
 
 //----------------------------------------------------------
@@ -226,6 +348,13 @@ bool FileStream::Seek( int64 offset, SeekOrigin origin )
         default: return false;
     }
 
+    // Overlapped writes don't move the file pointer
+    if( _overlapped && origin == SeekOrigin::Current )
+    {
+        offset += (int64)_writePosition;
+        whence  = FILE_BEGIN;
+    }
+
     LARGE_INTEGER distanceToMove, newPosition;
     distanceToMove.QuadPart = offset;
 
@@ -254,6 +383,84 @@ bool FileStream::Flush()
     return (bool)r;
 }
 
+//-----------------------------------------------------------
+bool FileStream::EvictCache()
+{
+    // #TODO: Windows has no per-file eviction. Unbuffered handles bypass the cache instead.
+    return false;
+}
+
+//-----------------------------------------------------------
+bool FileStream::WriteAsync( const void* buffer, size_t size )
+{
+    ASSERT( buffer );
+    ASSERT( size   );
+
+    if( _overlapped )
+    {
+        if( !_overlapped->Write( buffer, size, _writePosition ) )
+        {
+            _error = _overlapped->GetError();
+            return false;
+        }
+
+        _writePosition += size;
+        return true;
+    }
+
+    const byte* src = (const byte*)buffer;
+
+    while( size )
+    {
+        const ssize_t written = Write( src, size );
+        if( written < 1 )
+            return false;
+
+        src  += written;
+        size -= (size_t)written;
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------
+bool FileStream::WaitForWrites()
+{
+    if( _overlapped && !_overlapped->WaitForWrites() )
+    {
+        _error = _overlapped->GetError();
+        return false;
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------
+bool FileStream::RegisterBuffer( const void* buffer, size_t size )
+{
+    return false;
+}
+
+//-----------------------------------------------------------
+bool FileStream::IsAsync() const
+{
+    return _overlapped != nullptr;
+}
+
+//-----------------------------------------------------------
+bool FileStream::OpenRemote( const char* address, const NetKey& key, const char* fileName )
+{
+    // Remote output directories are rejected when the command line is parsed
+    _error = ERROR_NOT_SUPPORTED;
+    return false;
+}
+
+//-----------------------------------------------------------
+bool FileStream::IsRemote() const
+{
+    return false;
+}
+
 //-----------------------------------------------------------
 bool FileStream::IsOpen() const
 {
@@ -0,0 +1,33 @@
+#include "HostCoordinator.h"
+#include "util/Log.h"
+
+// Instance groups are not supported on Windows yet.
+// The plot writers only use a coordinator when they were given one.
+
+//-----------------------------------------------------------
+HostCoordinator* HostCoordinator::Join( const char* group, uint instanceCount, uint64 writeBandwidth )
+{
+    Log::Error( "Error: Instance groups are not supported on this platform." );
+    return nullptr;
+}
+
+//-----------------------------------------------------------
+bool HostCoordinator::TakeCpuShare()
+{
+    return false;
+}
+
+//-----------------------------------------------------------
+void HostCoordinator::BeginWrite()
+{
+}
+
+//-----------------------------------------------------------
+void HostCoordinator::EndWrite()
+{
+}
+
+//-----------------------------------------------------------
+void HostCoordinator::Throttle( size_t size )
+{
+}
@@ -0,0 +1,256 @@
+#include "io/OverlappedIO.h"
+#include "Util.h"
+
+//-----------------------------------------------------------
+OverlappedIO::OverlappedIO()
+{}
+
+//-----------------------------------------------------------
+OverlappedIO::~OverlappedIO()
+{
+    if( _depth )
+        WaitForWrites();
+
+    Destroy();
+}
+
+//-----------------------------------------------------------
+bool OverlappedIO::Init( HANDLE file, uint queueDepth )
+{
+    ASSERT( _depth == 0 );
+    ASSERT( file != INVALID_HANDLE_VALUE );
+
+    queueDepth = std::min( std::max( queueDepth, 1u ), (uint)BB_OVERLAPPED_MAX_DEPTH );
+
+    for( uint i = 0; i < queueDepth; i++ )
+    {
+        // Manual-reset, as WriteFile() resets it when the write begins
+        _events[i] = CreateEventW( NULL, TRUE, FALSE, NULL );
+
+        if( !_events[i] )
+        {
+            _error = (int)GetLastError();
+            _depth = i;
+            Destroy();
+            return false;
+        }
+
+        _pending[i] = false;
+    }
+
+    // Completed writes don't need to signal the file handle, we wait on the events.
+    SetFileCompletionNotificationModes( file, FILE_SKIP_SET_EVENT_ON_HANDLE );
+
+    _file      = file;
+    _depth     = queueDepth;
+    _freeCount = _depth;
+
+    for( uint i = 0; i < _depth; i++ )
+        _freeSlots[i] = _depth - i - 1;
+
+    return true;
+}
+
+//-----------------------------------------------------------
+void OverlappedIO::Destroy()
+{
+    for( uint i = 0; i < _depth; i++ )
+        CloseHandle( _events[i] );
+
+    _file      = INVALID_HANDLE_VALUE;
+    _depth     = 0;
+    _freeCount = 0;
+}
+
+//-----------------------------------------------------------
+bool OverlappedIO::Write( const void* buffer, size_t size, uint64 offset )
+{
+    ASSERT( _depth );
+    ASSERT( buffer );
+
+    const byte* src = (const byte*)buffer;
+
+    while( size )
+    {
+        if( _error )
+            return false;
+
+        // Wait for a free slot
+        while( _freeCount == 0 )
+        {
+            if( !WaitForCompletion() )
+                return false;
+        }
+
+        const uint32 chunkSize = (uint32)std::min( size, (size_t)BB_OVERLAPPED_CHUNK_SIZE );
+        const uint   slot      = _freeSlots[--_freeCount];
+
+        Request& req = _requests[slot];
+        req.buffer = src;
+        req.offset = offset;
+        req.size   = chunkSize;
+
+        if( !Queue( slot ) )
+            return false;
+
+        src    += chunkSize;
+        offset += chunkSize;
+        size   -= chunkSize;
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------
+bool OverlappedIO::Queue( uint slot )
+{
+    Request& req = _requests[slot];
+
+    ZeroMem( &req.overlapped );
+    req.overlapped.Offset     = (DWORD)( req.offset & 0xFFFFFFFFull );
+    req.overlapped.OffsetHigh = (DWORD)( req.offset >> 32 );
+    req.overlapped.hEvent     = _events[slot];
+
+    // The write may also complete right away, in which case its event is set as well
+    if( !WriteFile( _file, req.buffer, (DWORD)req.size, NULL, &req.overlapped ) )
+    {
+        const DWORD err = GetLastError();
+
+        if( err != ERROR_IO_PENDING )
+        {
+            if( !_error )
+                _error = (int)err;
+
+            _freeSlots[_freeCount++] = slot;
+            return false;
+        }
+    }
+
+    _pending[slot] = true;
+    return true;
+}
+
+//-----------------------------------------------------------
+bool OverlappedIO::WaitForCompletion()
+{
+    HANDLE events[BB_OVERLAPPED_MAX_DEPTH];
+    uint   slots [BB_OVERLAPPED_MAX_DEPTH];
+    uint   count = 0;
+
+    for( uint i = 0; i < _depth; i++ )
+    {
+        if( _pending[i] )
+        {
+            events[count] = _events[i];
+            slots [count] = i;
+            count++;
+        }
+    }
+
+    if( count == 0 )
+        return true;
+
+    const DWORD r = WaitForMultipleObjects( (DWORD)count, events, FALSE, INFINITE );
+
+    if( r >= WAIT_OBJECT_0 + count )
+    {
+        if( !_error )
+            _error = (int)GetLastError();
+
+        return false;
+    }
+
+    // Reap every write that has completed by now, not just the one that woke us
+    for( uint i = r - WAIT_OBJECT_0; i < count; i++ )
+    {
+        if( i == r - WAIT_OBJECT_0 || WaitForSingleObject( events[i], 0 ) == WAIT_OBJECT_0 )
+            Complete( slots[i] );
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------
+void OverlappedIO::Complete( uint slot )
+{
+    ASSERT( slot < _depth );
+    ASSERT( _pending[slot] );
+
+    Request& req = _requests[slot];
+    _pending[slot] = false;
+
+    DWORD written = 0;
+
+    if( !GetOverlappedResult( _file, &req.overlapped, &written, FALSE ) )
+    {
+        // Keep the first error
+        if( !_error )
+            _error = (int)GetLastError();
+
+        _freeSlots[_freeCount++] = slot;
+        return;
+    }
+
+    ASSERT( written <= req.size );
+
+    // Short write: queue the remainder in the same slot.
+    // Once we've had an error, we just let the pending writes drain.
+    if( written < req.size && !_error )
+    {
+        req.buffer += written;
+        req.offset += written;
+        req.size   -= written;
+
+        // On failure, Queue() releases the slot
+        Queue( slot );
+        return;
+    }
+
+    _freeSlots[_freeCount++] = slot;
+}
+
+//-----------------------------------------------------------
+bool OverlappedIO::WaitForWrites()
+{
+    while( _freeCount < _depth )
+    {
+        if( !WaitForCompletion() )
+            return false;
+    }
+
+    return _error == 0;
+}
+
+//-----------------------------------------------------------
+bool OverlappedIO::TransferSync( HANDLE file, bool write, void* buffer, DWORD size, uint64 offset, DWORD& transferred )
+{
+    transferred = 0;
+
+    // The file handle can't tell us which of its operations completed, so this one gets its own event
+    OVERLAPPED overlapped;
+    ZeroMem( &overlapped );
+    overlapped.Offset     = (DWORD)( offset & 0xFFFFFFFFull );
+    overlapped.OffsetHigh = (DWORD)( offset >> 32 );
+    overlapped.hEvent     = CreateEventW( NULL, TRUE, FALSE, NULL );
+
+    if( !overlapped.hEvent )
+        return false;
+
+    BOOL r = write ? WriteFile( file, buffer, size, NULL, &overlapped ) :
+                     ReadFile ( file, buffer, size, NULL, &overlapped );
+
+    if( r || GetLastError() == ERROR_IO_PENDING )
+        r = GetOverlappedResult( file, &overlapped, &transferred, TRUE );
+
+    // Keep the error across CloseHandle()
+    const DWORD err = GetLastError();
+
+    // Reading at the end of the file is not an error, as with a synchronous handle
+    if( !r && !write && err == ERROR_HANDLE_EOF )
+        r = TRUE;
+
+    CloseHandle( overlapped.hEvent );
+    SetLastError( err );
+
+    return (bool)r;
+}
@@ -53,8 +53,6 @@ public:
     }
 };
 
-static GROUP_RELATIONSHIP* _procGroupInfo = nullptr;
-
 
 //-----------------------------------------------------------
 size_t SysHost::GetPageSize()
@@ -100,6 +98,39 @@ uint SysHost::GetLogicalCPUCount()
     return (uint)GetActiveProcessorCount( ALL_PROCESSOR_GROUPS );
 }
 
+// Threads are pinned to the performance cores first
+//-----------------------------------------------------------
+uint SysHost::GetPerformanceCPUCount()
+{
+    return GetLogicalCPUCount();
+}
+
+//-----------------------------------------------------------
+uint SysHost::GetCpuQuotaCount()
+{
+    // #TODO: Read the CPU rate limit of the job object the process may be in
+    return GetLogicalCPUCount();
+}
+
+//-----------------------------------------------------------
+uint64 SysHost::GetFreeDiskSpace( const char* path )
+{
+    ULARGE_INTEGER freeBytes;
+
+    // #TODO: Convert to utf-16
+    if( !GetDiskFreeSpaceExA( path && *path ? path : nullptr, &freeBytes, nullptr, nullptr ) )
+        return 0;
+
+    return (uint64)freeBytes.QuadPart;
+}
+
+// #TODO: Query the volume's disk and its adapter's node
+//-----------------------------------------------------------
+int SysHost::GetPathNumaNode( const char* path )
+{
+    return -1;
+}
+
 //-----------------------------------------------------------
 void* SysHost::VirtualAlloc( size_t size, bool initialize )
 {
@@ -130,6 +161,68 @@ void* SysHost::VirtualAlloc( size_t size, bool initialize )
     return ptr;
 }
 
+//-----------------------------------------------------------
+static bool EnableLockMemoryPrivilege()
+{
+    static int _enabled = -1;
+
+    if( _enabled >= 0 )
+        return _enabled == 1;
+
+    _enabled = 0;
+
+    HANDLE hToken = NULL;
+    if( !::OpenProcessToken( ::GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &hToken ) )
+        return false;
+
+    TOKEN_PRIVILEGES tp;
+    tp.PrivilegeCount           = 1;
+    tp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+
+    if( ::LookupPrivilegeValueA( NULL, "SeLockMemoryPrivilege", &tp.Privileges[0].Luid ) )
+    {
+        // AdjustTokenPrivileges succeeds even if not all privileges were assigned,
+        // so we must check the last error as well.
+        if( ::AdjustTokenPrivileges( hToken, FALSE, &tp, 0, NULL, NULL ) && ::GetLastError() == ERROR_SUCCESS )
+            _enabled = 1;
+    }
+
+    ::CloseHandle( hToken );
+    return _enabled == 1;
+}
+
+//-----------------------------------------------------------
+void* SysHost::VirtualAllocLargePages( size_t size, PageBacking maxBacking, PageBacking& outBacking, size_t& outSize )
+{
+    // #NOTE: 1 GiB pages require VirtualAlloc2 with extended parameters,
+    //        so we only use the minimum large page size here.
+    if( maxBacking >= PageBacking::Large && EnableLockMemoryPrivilege() )
+    {
+        const size_t largePageSize = (size_t)::GetLargePageMinimum();
+
+        if( largePageSize )
+        {
+            const size_t allocSize = CeildDiv( size, largePageSize );
+
+            void* ptr = ::VirtualAlloc( NULL, allocSize, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE );
+            if( ptr )
+            {
+                outBacking = PageBacking::Large;
+                outSize    = allocSize;
+                return ptr;
+            }
+        }
+    }
+
+    void* ptr = VirtualAlloc( size, false );
+    if( !ptr )
+        return nullptr;
+
+    outBacking = PageBacking::Regular;
+    outSize    = CeildDiv( size, GetPageSize() );
+    return ptr;
+}
+
 //-----------------------------------------------------------
 void SysHost::VirtualFree( void* ptr )
 {
@@ -145,6 +238,15 @@ void SysHost::VirtualFree( void* ptr )
     }
 }
 
+// Large pages can't be discarded, as they are always resident
+//-----------------------------------------------------------
+bool SysHost::VirtualDiscard( void* ptr, size_t size )
+{
+    ASSERT( ptr );
+
+    return ::DiscardVirtualMemory( (PVOID)ptr, (SIZE_T)size ) == ERROR_SUCCESS;
+}
+
 //-----------------------------------------------------------
 bool SysHost::VirtualProtect( void* ptr, size_t size, VProtect flags )
 {
@@ -178,59 +280,277 @@ bool SysHost::VirtualProtect( void* ptr, size_t size, VProtect flags )
 //     return mask;
 // }
 
+// Cpu ids are numbered across all processor groups: the active processors of group 0 first,
+// then those of group 1, and so on, so that the cpus of a group are at its base id plus their index in it.
+// Returns the first cpu id of each of the active processor groups. There are GetActiveProcessorGroupCount() of them.
+// #NOTE: This is not thread-safe on the first time is called
+//-----------------------------------------------------------
+static const uint* GetProcessorGroupBases()
+{
+    static uint* groupBases = nullptr;
+
+    if( !groupBases )
+    {
+        const WORD groupCount = GetActiveProcessorGroupCount();
+        if( groupCount == 0 )
+        {
+            const DWORD err = GetLastError();
+            Fatal( "GetActiveProcessorGroupCount() failed with error: %d (0x%x).", err, err );
+        }
+
+        uint* bases = (uint*)malloc( sizeof( uint ) * groupCount );
+        FatalIf( !bases, "Failed to allocate processor group buffer." );
+
+        uint groupBase = 0;
+        for( WORD i = 0; i < groupCount; i++ )
+        {
+            bases[i] = groupBase;
+            groupBase += (uint)GetActiveProcessorCount( i );
+        }
+
+        groupBases = bases;
+    }
+
+    return groupBases;
+}
+
+// Gets the processor group of a cpu id, and the cpu's index in it
+//-----------------------------------------------------------
+static void CpuIdToProcessorGroup( const uint32 cpuId, WORD& outGroup, uint& outIndex )
+{
+    const uint* groupBases = GetProcessorGroupBases();
+    const WORD  groupCount = GetActiveProcessorGroupCount();
+
+    WORD group = 0;
+    while( group + 1 < groupCount && cpuId >= groupBases[group+1] )
+        group++;
+
+    outGroup = group;
+    outIndex = cpuId - groupBases[group];
+}
+
+// #NOTE: Threads run only within their process' primary processor group
+//        unless they are assigned to another one. So even on single-node systems,
+//        threads beyond the first 64 cpus must be moved to their cpu's group.
 //-----------------------------------------------------------
 bool SysHost::SetCurrentThreadAffinityCpuId( uint32 cpuId )
 {
     ASSERT( cpuId < (uint)GetActiveProcessorCount( ALL_PROCESSOR_GROUPS ) );
 
-    HANDLE hThread = ::GetCurrentThread();
+    WORD group;
+    uint index;
+    CpuIdToProcessorGroup( cpuId, group, index );
+
+    GROUP_AFFINITY grpAffinity;
+    ZeroMem( &grpAffinity );
+    grpAffinity.Mask  = (KAFFINITY)1 << index;
+    grpAffinity.Group = group;
+
+    if( !SetThreadGroupAffinity( ::GetCurrentThread(), &grpAffinity, nullptr ) )
+    {
+        const DWORD err = GetLastError();
+        Log::Error( "Error: Failed to set thread group affinity with error: %d (0x%x).", err, err );
+        return false;
+    }
+
+    return true;
+}
+
+// #TODO: Restrict the process to a subset of its processor groups
+//-----------------------------------------------------------
+bool SysHost::RestrictCpus( const uint* cpuIds, uint count )
+{
+    return false;
+}
+
+// Threads are placed by their affinity on Windows
+//-----------------------------------------------------------
+bool SysHost::SetCurrentThreadQoS( ThreadQoS qos )
+{
+    return false;
+}
+
+//-----------------------------------------------------------
+bool SysHost::SetCurrentThreadProcessorGroup( uint32 cpuId )
+{
+    cpuId %= GetLogicalCPUCount();
+
+    WORD group;
+    uint index;
+    CpuIdToProcessorGroup( cpuId, group, index );
+
+    // Only move threads that are not in the group already,
+    // so that affinity set elsewhere is left as it is on single-group systems.
+    GROUP_AFFINITY current;
+    if( GetThreadGroupAffinity( ::GetCurrentThread(), &current ) && current.Group == group )
+        return true;
+
+    const KAFFINITY groupMask = GetActiveProcessorCount( group ) >= 64 ? ~(KAFFINITY)0 :
+                                ( (KAFFINITY)1 << GetActiveProcessorCount( group ) ) - 1;
+
+    GROUP_AFFINITY grpAffinity;
+    ZeroMem( &grpAffinity );
+    grpAffinity.Mask  = groupMask;
+    grpAffinity.Group = group;
+
+    if( !SetThreadGroupAffinity( ::GetCurrentThread(), &grpAffinity, nullptr ) )
+    {
+        const DWORD err = GetLastError();
+        Log::Error( "Error: Failed to set thread processor group with error: %d (0x%x).", err, err );
+        return false;
+    }
+
+    return true;
+}
+
+// Calls fn( cpuId ) for each cpu in a group mask,
+// with cpu ids offset by the group as in SetCurrentThreadAffinityCpuId().
+//-----------------------------------------------------------
+template<typename TFunc>
+static void ForEachGroupMaskCpu( const GROUP_AFFINITY& mask, const uint* groupBases, uint cpuCount, TFunc fn )
+{
+    for( uint i = 0; i < 64; i++ )
+    {
+        if( !( mask.Mask & ( 1ull << i ) ) )
+            continue;
+
+        const uint cpuId = groupBases[mask.Group] + i;
+        if( cpuId < cpuCount )
+            fn( cpuId );
+    }
+}
+
+// Returns the relationship entries of the given kind, and their size.
+// Returns null if they could not be queried.
+//-----------------------------------------------------------
+static SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX* GetProcessorRelationInfo( LOGICAL_PROCESSOR_RELATIONSHIP relation, DWORD& outSize )
+{
+    outSize = 0;
+    if( GetLogicalProcessorInformationEx( relation, nullptr, &outSize ) || GetLastError() != ERROR_INSUFFICIENT_BUFFER )
+        return nullptr;
+
+    auto* info = (SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*)malloc( outSize );
+    if( !info )
+        Fatal( "Failed to allocate processor info buffer." );
+
+    if( !GetLogicalProcessorInformationEx( relation, info, &outSize ) )
+    {
+        const DWORD err = GetLastError();
+        Log::Error( "Warning: GetLogicalProcessorInformationEx( %d ) failed with error: %d (0x%x).", (int)relation, err, err );
+        free( info );
+        return nullptr;
+    }
+
+    return info;
+}
+
+// #NOTE: This is not thread-safe
+//-----------------------------------------------------------
+const CpuTopology* SysHost::GetCpuTopology()
+{
+    static CpuTopology  _topo;
+    static CpuTopology* topo = nullptr;
 
-    // #TODO: We might have to check for single-node system with more than 64 threads.
-    // If in NUMA, we need to find the correct process group given a cpuId
-    const NumaInfo* numa = GetNUMAInfo();
-    if( numa )
+    if( topo )
+        return topo;
+
+    const uint cpuCount = GetLogicalCPUCount();
+
+    CpuInfo* cpus = (CpuInfo*)malloc( sizeof( CpuInfo ) * cpuCount );
+    if( !cpus )
+        Fatal( "Failed to allocate CPU topology buffer." );
+
+    // Until we know better, each cpu is its own core
+    for( uint i = 0; i < cpuCount; i++ )
+    {
+        cpus[i].coreId   = i;
+        cpus[i].smtIndex = 0;
+        cpus[i].l3Id     = 0;
+        cpus[i].type     = CpuCoreType::Unknown;
+    }
+
+    uint coreCount = cpuCount;
+    uint l3Count   = 1;
+    bool isHybrid  = false;
+
+    // First cpu id of each processor group
+    const uint* groupBases = GetProcessorGroupBases();
+
+    DWORD coreInfoSize  = 0;
+    DWORD cacheInfoSize = 0;
+    auto* coreInfo  = GetProcessorRelationInfo( RelationProcessorCore, coreInfoSize  );
+    auto* cacheInfo = GetProcessorRelationInfo( RelationCache        , cacheInfoSize );
+
+    if( coreInfo )
     {
-        ASSERT( _procGroupInfo );
+        // Efficiency classes are only reported on hybrid CPUs,
+        // where the highest class holds the performance cores.
+        BYTE minClass = 0xFF, maxClass = 0;
 
-        WORD processGroupId = 0;
+        for( PocessorInfoIter<PROCESSOR_RELATIONSHIP> iter( coreInfo, coreInfoSize ); iter.HasNext(); )
+        {
+            const PROCESSOR_RELATIONSHIP& core = iter.Next();
+            minClass = std::min( minClass, core.EfficiencyClass );
+            maxClass = std::max( maxClass, core.EfficiencyClass );
+        }
 
-        // Shave-out any process groups below the requested one
-        for( WORD i = 0; i < _procGroupInfo->ActiveGroupCount; i++ )
+        isHybrid  = minClass < maxClass;
+        coreCount = 0;
+
+        for( PocessorInfoIter<PROCESSOR_RELATIONSHIP> iter( coreInfo, coreInfoSize ); iter.HasNext(); )
         {
-            const uint groupProcCount = _procGroupInfo->GroupInfo[i].ActiveProcessorCount;
-            if( cpuId < groupProcCount )
+            const PROCESSOR_RELATIONSHIP& core   = iter.Next();
+            const uint                    coreId = coreCount++;
+            uint                          smt    = 0;
+
+            const CpuCoreType type = !isHybrid ? CpuCoreType::Unknown :
+                                     core.EfficiencyClass == maxClass ? CpuCoreType::Performance : CpuCoreType::Efficiency;
+
+            for( WORD g = 0; g < core.GroupCount; g++ )
             {
-                processGroupId = i;
-                break;
+                ForEachGroupMaskCpu( core.GroupMask[g], groupBases, cpuCount, [&]( uint cpuId ) {
+                    cpus[cpuId].coreId   = coreId;
+                    cpus[cpuId].smtIndex = smt++;
+                    cpus[cpuId].type     = type;
+                });
             }
-
-            cpuId -= groupProcCount;
         }
-        
-        // Move this thread to the target process group
-        GROUP_AFFINITY grpAffinity, prevGprAffinity;
 
-        ZeroMem( &grpAffinity );
-        grpAffinity.Mask  = 1ull << cpuId;
-        grpAffinity.Group = processGroupId;
-        if( !SetThreadGroupAffinity( hThread, &grpAffinity, &prevGprAffinity ) )
+        free( coreInfo );
+    }
+
+    if( cacheInfo )
+    {
+        l3Count = 0;
+
+        for( PocessorInfoIter<CACHE_RELATIONSHIP> iter( cacheInfo, cacheInfoSize ); iter.HasNext(); )
         {
-            const DWORD err = GetLastError();
-            Log::Error( "Error: Failed to set thread group affinity with error: %d (0x%x).", err, err );
-            return false;
+            const CACHE_RELATIONSHIP& cache = iter.Next();
+            if( cache.Level != 3 )
+                continue;
+
+            const uint l3Id = l3Count++;
+
+            ForEachGroupMaskCpu( cache.GroupMask, groupBases, cpuCount, [&]( uint cpuId ) {
+                cpus[cpuId].l3Id = l3Id;
+            });
         }
-    }
 
-    const uint64 mask    = 1ull << cpuId;
-    const uint64 oldMask = (uint64)::SetThreadAffinityMask( hThread, mask );
+        // No L3 on this system
+        if( l3Count == 0 )
+            l3Count = 1;
 
-    if( oldMask == 0 )
-    {
-        const DWORD err = GetLastError();
-        Log::Error( "Error: Failed to set thread affinity with error: %d (0x%x).", err, err );
+        free( cacheInfo );
     }
 
-    return oldMask != 0;
+    _topo.cpuCount  = cpuCount;
+    _topo.coreCount = coreCount;
+    _topo.l3Count   = l3Count;
+    _topo.isHybrid  = isHybrid;
+    _topo.cpus      = cpus;
+    topo = &_topo;
+
+    return topo;
 }
 
 //-----------------------------------------------------------
@@ -280,19 +600,8 @@ const NumaInfo* SysHost::GetNUMAInfo()
 
         ZeroMem( &_info );
 
-        uint procGroupCount = 0;
-        uint totalCpuCount  = 0;
-
-        // Get number of processor groups in this system
-        procGroupCount = (uint)GetActiveProcessorGroupCount();
-        if( procGroupCount == 0 )
-        {
-            const DWORD err = GetLastError();
-            Fatal( "GetActiveProcessorGroupCount() failed with error: %d (0x%x).", err, err );
-        }
-
         // Get the total number of active CPUs
-        totalCpuCount = (uint)GetActiveProcessorCount( ALL_PROCESSOR_GROUPS );
+        const uint totalCpuCount = (uint)GetActiveProcessorCount( ALL_PROCESSOR_GROUPS );
         if( totalCpuCount == 0 )
         {
             const DWORD err = GetLastError();
@@ -308,95 +617,40 @@ const NumaInfo* SysHost::GetNUMAInfo()
         FatalIf( !cpuIds, "Failed to allocate CPU id buffer." );
         memset( cpuIds, 0, sizeof( uint ) * totalCpuCount );
 
-
-        // Get nodes & process group information
-        DWORD nodeInfoLength = 0, procInfoLength = 0;
-        DWORD result = 0;
-
-        SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX* nodeInfo = nullptr, *procInfo = nullptr;
-
-        // Get node info size
-        if( GetLogicalProcessorInformationEx( RelationNumaNode, nullptr, &nodeInfoLength ) )
-            Fatal( "Unexpected result from GetLogicalProcessorInformationEx( RelationNumaNode )." );
-
-        result = GetLastError();
-        if( result != ERROR_INSUFFICIENT_BUFFER )
-            Fatal( "GetLogicalProcessorInformationEx( RelationNumaNode, null ) with error: %d (0x%x).", result, result );
-        
-        ASSERT( nodeInfoLength >= ( sizeof( DWORD ) + sizeof( LOGICAL_PROCESSOR_RELATIONSHIP ) ) );
-
-
-        // Get process info size
-        if( GetLogicalProcessorInformationEx( RelationGroup, nullptr, &procInfoLength ) )
-            Fatal( "Unexpected result from GetLogicalProcessorInformationEx( RelationGroup )." );
-
-        result = GetLastError();
-        if( result != ERROR_INSUFFICIENT_BUFFER )
-            Fatal( "GetLogicalProcessorInformationEx( RelationGroup, null  ) with error: %d (0x%x).", result, result );
-
-        ASSERT( procInfoLength >= ( sizeof( DWORD ) + sizeof( LOGICAL_PROCESSOR_RELATIONSHIP ) ) );
-
-        // Allocate the buffers and fetch the actual info now
-        nodeInfo = (SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*)malloc( nodeInfoLength );
-        procInfo = (SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*)malloc( procInfoLength );
-
+        // Get nodes information
+        DWORD nodeInfoLength = 0;
+        SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX* nodeInfo = GetProcessorRelationInfo( RelationNumaNode, nodeInfoLength );
         if( !nodeInfo )
-            Fatal( "Failed to allocate node info buffer." );
-        if( !procInfo )
-            Fatal( "Failed to allocate processor info buffer." );
-        
-        if( !GetLogicalProcessorInformationEx( RelationNumaNode, nodeInfo, &nodeInfoLength ) )
-        {
-            const DWORD err = GetLastError();
-            Fatal( "GetLogicalProcessorInformationEx( RelationNumaNode ) failed with error: %d (0x%x).", err, err );
-        }
-
-        if( !GetLogicalProcessorInformationEx( RelationGroup, procInfo, &procInfoLength ) )
-        {
-            const DWORD err = GetLastError();
-            Fatal( "GetLogicalProcessorInformationEx( RelationGroup ) failed with error: %d (0x%x).", err, err );
-        }
+            Fatal( "Failed to get the NUMA nodes' processors." );
 
-        ASSERT( procInfo->Size == procInfoLength ); // Only expect a single instance here
+        const uint* groupBases = GetProcessorGroupBases();
 
+        // Get info from each node. A group may hold several nodes,
+        // so only the cpus in the node's mask belong to it.
+        // #TODO: Nodes that span several groups report only their primary group here.
+        //        Use RelationNumaNodeEx when building for Windows 11/Server 2022.
+        uint* nodeCpus = cpuIds;
 
-        // Save an instance of process group info as we need to refer to it when setting thread affinity
-        _procGroupInfo = &procInfo->Group;
-        
-        // Get info from each node
         for( PocessorInfoIter<NUMA_NODE_RELATIONSHIP> numaIter( nodeInfo, nodeInfoLength ); numaIter.HasNext(); )
         {
             const NUMA_NODE_RELATIONSHIP& node = numaIter.Next();
             ASSERT( node.NodeNumber < nodeCount );
-            ASSERT( node.GroupMask.Group < procInfo->Group.ActiveGroupCount );
+            ASSERT( node.GroupMask.Group < GetActiveProcessorGroupCount() );
 
-            const WORD                  targetGroupId = node.GroupMask.Group;
-            const PROCESSOR_GROUP_INFO& targetGroup   = procInfo->Group.GroupInfo[targetGroupId];
+            uint* firstCpu = nodeCpus;
 
-            // Find the starting cpuId for this group by 
-            // adding all the active processors on the groups before ours
-            uint cpuBase = 0;
-            for( WORD i = 0; i < targetGroupId; i++ )
-                cpuBase += procInfo->Group.GroupInfo[i].ActiveProcessorCount;
-
-            // Save CPUids for this node
-            uint* nodeCpus = cpuIds;
-            for( BYTE i = 0; i < targetGroup.MaximumProcessorCount; i++ )
-            {
-                if( targetGroup.ActiveProcessorMask & ( 1ull << i ) )
-                    *nodeCpus++ = cpuBase + i;
-            }
-
-            ASSERT( (intptr_t)( nodeCpus - cpuIds ) == (intptr_t)targetGroup.ActiveProcessorCount );
+            ForEachGroupMaskCpu( node.GroupMask, groupBases, totalCpuCount, [&]( uint cpuId ) {
+                FatalIf( nodeCpus >= cpuIds + totalCpuCount, "NUMA nodes have more CPUs than the system." );
+                *nodeCpus++ = cpuId;
+            });
 
             // Save node info
-            _info.cpuIds[node.NodeNumber].length = targetGroup.ActiveProcessorCount;
-            _info.cpuIds[node.NodeNumber].values = cpuIds;
-
-            cpuIds += targetGroup.ActiveProcessorCount;
-            ASSERT( cpuIds == nodeCpus );
+            _info.cpuIds[node.NodeNumber].length = (size_t)( nodeCpus - firstCpu );
+            _info.cpuIds[node.NodeNumber].values = firstCpu;
         }
 
+        free( nodeInfo );
+
         // All done
         _info.nodeCount = nodeCount;
         _info.cpuCount  = totalCpuCount;
@@ -409,7 +663,29 @@ const NumaInfo* SysHost::GetNUMAInfo()
 //-----------------------------------------------------------
 void SysHost::NumaAssignPages( void* ptr, size_t size, uint node )
 {
-    // #TODO: Implement me
+    ASSERT( ptr && size );
+
+    // Commit the range again with the node as its preferred one.
+    // As with interleaving, it only applies to the pages that have not been touched yet.
+    if( !VirtualAllocExNuma( GetCurrentProcess(), ptr, size, MEM_COMMIT, PAGE_READWRITE, (DWORD)node ) )
+    {
+        const DWORD err = GetLastError();
+        Log::Error( "Failed to assign memory to NUMA node %u with error: %d (0x%x).", node, err, err );
+    }
+}
+
+// #TODO: Find the memory-only nodes, those with no processors in GetNumaNodeProcessorMaskEx(),
+//        and commit far memory to them with VirtualAllocExNuma(), as NumaAssignPages() does.
+//-----------------------------------------------------------
+uint SysHost::EnableFarMemoryTier()
+{
+    return 0;
+}
+
+//-----------------------------------------------------------
+bool SysHost::NumaSetMemoryFarMode( void* ptr, size_t size )
+{
+    return false;
 }
 
 //-----------------------------------------------------------
@@ -508,4 +784,11 @@ int SysHost::NumaGetNodeFromPage( void* ptr )
     // }
 
     return -1;
+}
+
+//-----------------------------------------------------------
+bool SysHost::NumaGetNodesFromPages( void** pages, uint count, int* outNodes )
+{
+    // #TODO: Implement me, along with NumaGetNodeFromPage
+    return false;
 }
\ No newline at end of file
@@ -0,0 +1,247 @@
+#include "blake3_lanes.h"
+#include "KernelDispatch.h"
+#include "b3/blake3_impl.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+    #define B3L_X86 1
+    #if defined(_MSC_VER) && !defined(__clang__)
+        #define B3L_TARGET(t)
+    #else
+        #define B3L_TARGET(t) __attribute__((target(t)))
+    #endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+    #define B3L_NEON 1
+    #include <arm_neon.h>
+#endif
+
+// Each vector lane hashes a different message, so the state is kept as
+// 16 vectors each holding the same word for N messages.
+
+#define VG(a, b, c, d, mx, my)    \
+    a = VADD(VADD(a, b), mx);     \
+    d = VROTR(VXOR(d, a), 16);    \
+    c = VADD(c, d);               \
+    b = VROTR(VXOR(b, c), 12);    \
+    a = VADD(VADD(a, b), my);     \
+    d = VROTR(VXOR(d, a), 8);     \
+    c = VADD(c, d);               \
+    b = VROTR(VXOR(b, c), 7)
+
+#define VROUND(v, m, r)                                                                       \
+    {                                                                                         \
+        const uint8_t *s = MSG_SCHEDULE[r];                                                   \
+        VG(v[0], v[4], v[ 8], v[12], m[s[ 0]], m[s[ 1]]);                                     \
+        VG(v[1], v[5], v[ 9], v[13], m[s[ 2]], m[s[ 3]]);                                     \
+        VG(v[2], v[6], v[10], v[14], m[s[ 4]], m[s[ 5]]);                                     \
+        VG(v[3], v[7], v[11], v[15], m[s[ 6]], m[s[ 7]]);                                     \
+        VG(v[0], v[5], v[10], v[15], m[s[ 8]], m[s[ 9]]);                                     \
+        VG(v[1], v[6], v[11], v[12], m[s[10]], m[s[11]]);                                     \
+        VG(v[2], v[7], v[ 8], v[13], m[s[12]], m[s[13]]);                                     \
+        VG(v[3], v[4], v[ 9], v[14], m[s[14]], m[s[15]]);                                     \
+    }
+
+// Hashes N lanes starting at lane as the root, single block of a single chunk
+#define VHASH_LANES(N, VTYPE)                                                                 \
+    {                                                                                         \
+        VTYPE m[16], v[16];                                                                   \
+        for (int w = 0; w < 16; w++)                                                          \
+            m[w] = VLOAD(&msg->words[w][lane]);                                               \
+                                                                                              \
+        for (int w = 0; w < 8; w++)                                                           \
+            v[w] = VSET1(IV[w]);                                                              \
+        v[ 8] = VSET1(IV[0]);                                                                 \
+        v[ 9] = VSET1(IV[1]);                                                                 \
+        v[10] = VSET1(IV[2]);                                                                 \
+        v[11] = VSET1(IV[3]);                                                                 \
+        v[12] = VSET1(0);                                                                     \
+        v[13] = VSET1(0);                                                                     \
+        v[14] = VSET1(block_len);                                                             \
+        v[15] = VSET1(CHUNK_START | CHUNK_END | ROOT);                                        \
+                                                                                              \
+        for (int r = 0; r < 7; r++)                                                           \
+            VROUND(v, m, r);                                                                  \
+                                                                                              \
+        for (int w = 0; w < 8; w++)                                                           \
+            VSTORE(&out->words[w][lane], VXOR(v[w], v[w + 8]));                               \
+    }
+
+//-----------------------------------------------------------
+static void blake3_hash_lanes_portable(const struct blake3_lanes_msg *msg, uint32_t count, uint8_t block_len,
+                                       struct blake3_lanes_out *out)
+{
+    #define VADD(a, b)   ((a) + (b))
+    #define VXOR(a, b)   ((a) ^ (b))
+    #define VROTR(v, n)  (((v) >> (n)) | ((v) << (32 - (n))))
+    #define VSET1(w)     ((uint32_t)(w))
+    #define VLOAD(p)     (*(p))
+    #define VSTORE(p, v) (*(p) = (v))
+
+    for (uint32_t lane = 0; lane < count; lane++)
+        VHASH_LANES(1, uint32_t)
+
+    #undef VADD
+    #undef VXOR
+    #undef VROTR
+    #undef VSET1
+    #undef VLOAD
+    #undef VSTORE
+}
+
+#if B3L_X86
+
+//-----------------------------------------------------------
+static void blake3_hash_lanes_sse2(const struct blake3_lanes_msg *msg, uint32_t count, uint8_t block_len,
+                                   struct blake3_lanes_out *out)
+{
+    #define VADD(a, b)   _mm_add_epi32(a, b)
+    #define VXOR(a, b)   _mm_xor_si128(a, b)
+    #define VROTR(v, n)  _mm_or_si128(_mm_srli_epi32(v, n), _mm_slli_epi32(v, 32 - (n)))
+    #define VSET1(w)     _mm_set1_epi32((int)(w))
+    #define VLOAD(p)     _mm_loadu_si128((const __m128i *)(p))
+    #define VSTORE(p, v) _mm_storeu_si128((__m128i *)(p), v)
+
+    for (uint32_t lane = 0; lane < count; lane += 4)
+        VHASH_LANES(4, __m128i)
+
+    #undef VADD
+    #undef VXOR
+    #undef VROTR
+    #undef VSET1
+    #undef VLOAD
+    #undef VSTORE
+}
+
+//-----------------------------------------------------------
+B3L_TARGET("avx2")
+static void blake3_hash_lanes_avx2(const struct blake3_lanes_msg *msg, uint32_t count, uint8_t block_len,
+                                   struct blake3_lanes_out *out)
+{
+    const __m256i rot16 = _mm256_setr_epi8(2,3,0,1, 6,7,4,5, 10,11,8,9, 14,15,12,13,
+                                            2,3,0,1, 6,7,4,5, 10,11,8,9, 14,15,12,13);
+    const __m256i rot8  = _mm256_setr_epi8(1,2,3,0, 5,6,7,4, 9,10,11,8, 13,14,15,12,
+                                            1,2,3,0, 5,6,7,4, 9,10,11,8, 13,14,15,12);
+
+    #define VADD(a, b)   _mm256_add_epi32(a, b)
+    #define VXOR(a, b)   _mm256_xor_si256(a, b)
+    #define VROTR(v, n)  ( (n) == 16 ? _mm256_shuffle_epi8(v, rot16) :                            \
+                           (n) == 8  ? _mm256_shuffle_epi8(v, rot8 ) :                            \
+                           _mm256_or_si256(_mm256_srli_epi32(v, n), _mm256_slli_epi32(v, 32 - (n))) )
+    #define VSET1(w)     _mm256_set1_epi32((int)(w))
+    #define VLOAD(p)     _mm256_loadu_si256((const __m256i *)(p))
+    #define VSTORE(p, v) _mm256_storeu_si256((__m256i *)(p), v)
+
+    for (uint32_t lane = 0; lane < count; lane += 8)
+        VHASH_LANES(8, __m256i)
+
+    #undef VADD
+    #undef VXOR
+    #undef VROTR
+    #undef VSET1
+    #undef VLOAD
+    #undef VSTORE
+}
+
+// #NOTE: GCC reports a spurious uninitialized warning in _mm512_ror_epi32
+#if defined(__GNUC__) && !defined(__clang__)
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wuninitialized"
+    #pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+//-----------------------------------------------------------
+B3L_TARGET("avx512f")
+static void blake3_hash_lanes_avx512(const struct blake3_lanes_msg *msg, uint32_t count, uint8_t block_len,
+                                     struct blake3_lanes_out *out)
+{
+    (void)count;
+    const uint32_t lane = 0;
+
+    #define VADD(a, b)   _mm512_add_epi32(a, b)
+    #define VXOR(a, b)   _mm512_xor_si512(a, b)
+    #define VROTR(v, n)  _mm512_ror_epi32(v, n)
+    #define VSET1(w)     _mm512_set1_epi32((int)(w))
+    #define VLOAD(p)     _mm512_loadu_si512((const void *)(p))
+    #define VSTORE(p, v) _mm512_storeu_si512((void *)(p), v)
+
+    VHASH_LANES(16, __m512i)
+
+    #undef VADD
+    #undef VXOR
+    #undef VROTR
+    #undef VSET1
+    #undef VLOAD
+    #undef VSTORE
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+    #pragma GCC diagnostic pop
+#endif
+
+#elif B3L_NEON
+
+//-----------------------------------------------------------
+static void blake3_hash_lanes_neon(const struct blake3_lanes_msg *msg, uint32_t count, uint8_t block_len,
+                                   struct blake3_lanes_out *out)
+{
+    #define VADD(a, b)   vaddq_u32(a, b)
+    #define VXOR(a, b)   veorq_u32(a, b)
+    #define VROTR(v, n)  vsriq_n_u32(vshlq_n_u32(v, 32 - (n)), v, n)
+    #define VSET1(w)     vdupq_n_u32(w)
+    #define VLOAD(p)     vld1q_u32(p)
+    #define VSTORE(p, v) vst1q_u32(p, v)
+
+    for (uint32_t lane = 0; lane < count; lane += 4)
+        VHASH_LANES(4, uint32x4_t)
+
+    #undef VADD
+    #undef VXOR
+    #undef VROTR
+    #undef VSET1
+    #undef VLOAD
+    #undef VSTORE
+}
+
+#endif
+
+typedef void (*blake3_hash_lanes_fn)(const struct blake3_lanes_msg *msg, uint32_t count, uint8_t block_len,
+                                     struct blake3_lanes_out *out);
+
+static blake3_hash_lanes_fn b3l_hash_lanes = nullptr;
+
+// SSE2 is the x86-64 baseline, so it's the narrowest kernel there
+//-----------------------------------------------------------
+SimdLevel SelectBlake3LanesKernel(SimdLevel max_level)
+{
+#if B3L_X86
+    if (max_level == SimdLevel::AVX512) {
+        b3l_hash_lanes = blake3_hash_lanes_avx512;
+        return SimdLevel::AVX512;
+    }
+    if (max_level == SimdLevel::AVX2) {
+        b3l_hash_lanes = blake3_hash_lanes_avx2;
+        return SimdLevel::AVX2;
+    }
+    if (max_level == SimdLevel::SSE2) {
+        b3l_hash_lanes = blake3_hash_lanes_sse2;
+        return SimdLevel::SSE2;
+    }
+#elif B3L_NEON
+    if (max_level == SimdLevel::NEON) {
+        b3l_hash_lanes = blake3_hash_lanes_neon;
+        return SimdLevel::NEON;
+    }
+#endif
+
+    b3l_hash_lanes = blake3_hash_lanes_portable;
+    return SimdLevel::Scalar;
+}
+
+static const SimdLevel b3l_default_simd = SelectBlake3LanesKernel(KernelDispatch::Detect());
+
+//-----------------------------------------------------------
+void blake3_hash_lanes(const struct blake3_lanes_msg *msg, uint32_t count, uint8_t block_len,
+                       struct blake3_lanes_out *out)
+{
+    // #NOTE: The SIMD kernels hash whole vectors, so lanes past count hold garbage.
+    b3l_hash_lanes(msg, count, block_len, out);
+}
@@ -0,0 +1,28 @@
+#ifndef SRC_BLAKE3_LANES_H_
+#define SRC_BLAKE3_LANES_H_
+
+#include <stdint.h>
+
+// Number of messages hashed together in a single call
+#define BLAKE3_LANES 16
+
+// Input messages, stored word-major: words[w][lane]
+struct blake3_lanes_msg {
+    uint32_t words[16][BLAKE3_LANES];
+};
+
+// Output hashes (first 32 bytes), stored word-major: words[w][lane]
+struct blake3_lanes_out {
+    uint32_t words[8][BLAKE3_LANES];
+};
+
+/**
+ * Hashes up to BLAKE3_LANES messages together, each of which fits in a single
+ * BLAKE3 block and all of which have the same length.
+ * Any message words past block_len must be zero.
+ * The widest SIMD kernel the CPU supports is selected at runtime. See KernelDispatch.
+ */
+void blake3_hash_lanes(const struct blake3_lanes_msg *msg, uint32_t count, uint8_t block_len,
+                       struct blake3_lanes_out *out);
+
+#endif  // SRC_BLAKE3_LANES_H_
@@ -1,4 +1,19 @@
 #include "chacha8.h"
+#include "KernelDispatch.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+    #define CHACHA8_X86 1
+    #include <immintrin.h>
+    #if defined(_MSC_VER) && !defined(__clang__)
+        #include <intrin.h>
+        #define CHACHA8_TARGET(t)
+    #else
+        #define CHACHA8_TARGET(t) __attribute__((target(t)))
+    #endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+    #define CHACHA8_NEON 1
+    #include <arm_neon.h>
+#endif
 
 #define U32TO32_LITTLE(v) (v)
 #define U8TO32_LITTLE(p) (*(const uint32_t *)(p))
@@ -54,7 +69,7 @@ void chacha8_keysetup(struct chacha8_ctx *x, const uint8_t *k, uint32_t kbits, c
     }
 }
 
-void chacha8_get_keystream(const struct chacha8_ctx *x, uint64_t pos, uint32_t n_blocks, uint8_t *c)
+static void chacha8_get_keystream_scalar(const struct chacha8_ctx *x, uint64_t pos, uint32_t n_blocks, uint8_t *c)
 {
     uint32_t x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15;
     uint32_t j0, j1, j2, j3, j4, j5, j6, j7, j8, j9, j10, j11, j12, j13, j14, j15;
@@ -147,3 +162,213 @@ void chacha8_get_keystream(const struct chacha8_ctx *x, uint64_t pos, uint32_t n
         c += 64;
     }
 }
+
+// Multi-block SIMD kernels.
+// Each vector lane computes a different block, so the state is kept as
+// 16 vectors each holding the same word for N consecutive blocks.
+// The results are then transposed back to block order in the output.
+
+// Transpose N blocks in word-major order into the output
+//-----------------------------------------------------------
+static inline void chacha8_store_blocks(const uint32_t *words, uint32_t n, uint8_t *c)
+{
+    uint32_t *out = (uint32_t *)c;
+
+    for (uint32_t b = 0; b < n; b++)
+        for (uint32_t w = 0; w < 16; w++)
+            out[b * 16 + w] = U32TO32_LITTLE(words[w * n + b]);
+}
+
+// Block counters for N consecutive blocks, with the carry into the high word
+//-----------------------------------------------------------
+static inline void chacha8_block_counters(uint64_t pos, uint32_t n, uint32_t *lo, uint32_t *hi)
+{
+    for (uint32_t i = 0; i < n; i++) {
+        lo[i] = (uint32_t)(pos + i);
+        hi[i] = (uint32_t)((pos + i) >> 32);
+    }
+}
+
+#define VQUARTERROUND(a, b, c, d) \
+    a = VADD(a, b);               \
+    d = VROT16(VXOR(d, a));       \
+    c = VADD(c, d);               \
+    b = VROTL(VXOR(b, c), 12);    \
+    a = VADD(a, b);               \
+    d = VROT8(VXOR(d, a));        \
+    c = VADD(c, d);               \
+    b = VROTL(VXOR(b, c), 7)
+
+#define VCHACHA8_BLOCKS(N, VTYPE, VSET1, VLOAD, VSTORE) \
+    {                                                                           \
+        uint32_t lo[N], hi[N];                                                  \
+        chacha8_block_counters(pos, N, lo, hi);                                 \
+                                                                                \
+        VTYPE j[16], v[16];                                                     \
+        for (int w = 0; w < 16; w++)                                            \
+            j[w] = VSET1(x->input[w]);                                          \
+        j[12] = VLOAD(lo);                                                      \
+        j[13] = VLOAD(hi);                                                      \
+                                                                                \
+        for (int w = 0; w < 16; w++)                                            \
+            v[w] = j[w];                                                        \
+                                                                                \
+        for (int i = 8; i > 0; i -= 2) {                                        \
+            VQUARTERROUND(v[0], v[4], v[ 8], v[12]);                            \
+            VQUARTERROUND(v[1], v[5], v[ 9], v[13]);                            \
+            VQUARTERROUND(v[2], v[6], v[10], v[14]);                            \
+            VQUARTERROUND(v[3], v[7], v[11], v[15]);                            \
+            VQUARTERROUND(v[0], v[5], v[10], v[15]);                            \
+            VQUARTERROUND(v[1], v[6], v[11], v[12]);                            \
+            VQUARTERROUND(v[2], v[7], v[ 8], v[13]);                            \
+            VQUARTERROUND(v[3], v[4], v[ 9], v[14]);                            \
+        }                                                                       \
+                                                                                \
+        uint32_t words[16 * N];                                                 \
+        for (int w = 0; w < 16; w++)                                            \
+            VSTORE(words + w * N, VADD(v[w], j[w]));                            \
+                                                                                \
+        chacha8_store_blocks(words, N, c);                                      \
+    }
+
+#if CHACHA8_X86
+
+//-----------------------------------------------------------
+CHACHA8_TARGET("avx2")
+static void chacha8_blocks_avx2(const struct chacha8_ctx *x, uint64_t pos, uint8_t *c)
+{
+    const __m256i rot16 = _mm256_setr_epi8(2,3,0,1, 6,7,4,5, 10,11,8,9, 14,15,12,13,
+                                            2,3,0,1, 6,7,4,5, 10,11,8,9, 14,15,12,13);
+    const __m256i rot8  = _mm256_setr_epi8(3,0,1,2, 7,4,5,6, 11,8,9,10, 15,12,13,14,
+                                            3,0,1,2, 7,4,5,6, 11,8,9,10, 15,12,13,14);
+
+    #define VADD(a, b)   _mm256_add_epi32(a, b)
+    #define VXOR(a, b)   _mm256_xor_si256(a, b)
+    #define VROTL(v, n)  _mm256_or_si256(_mm256_slli_epi32(v, n), _mm256_srli_epi32(v, 32 - (n)))
+    #define VROT16(v)    _mm256_shuffle_epi8(v, rot16)
+    #define VROT8(v)     _mm256_shuffle_epi8(v, rot8)
+    #define VSET1(w)     _mm256_set1_epi32((int)(w))
+    #define VLOAD(p)     _mm256_loadu_si256((const __m256i *)(p))
+    #define VSTORE(p, v) _mm256_storeu_si256((__m256i *)(p), v)
+
+    VCHACHA8_BLOCKS(8, __m256i, VSET1, VLOAD, VSTORE)
+
+    #undef VADD
+    #undef VXOR
+    #undef VROTL
+    #undef VROT16
+    #undef VROT8
+    #undef VSET1
+    #undef VLOAD
+    #undef VSTORE
+}
+
+// #NOTE: GCC reports a spurious uninitialized warning in _mm512_rol_epi32
+#if defined(__GNUC__) && !defined(__clang__)
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wuninitialized"
+    #pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+//-----------------------------------------------------------
+CHACHA8_TARGET("avx512f")
+static void chacha8_blocks_avx512(const struct chacha8_ctx *x, uint64_t pos, uint8_t *c)
+{
+    #define VADD(a, b)   _mm512_add_epi32(a, b)
+    #define VXOR(a, b)   _mm512_xor_si512(a, b)
+    #define VROTL(v, n)  _mm512_rol_epi32(v, n)
+    #define VROT16(v)    _mm512_rol_epi32(v, 16)
+    #define VROT8(v)     _mm512_rol_epi32(v, 8)
+    #define VSET1(w)     _mm512_set1_epi32((int)(w))
+    #define VLOAD(p)     _mm512_loadu_si512((const void *)(p))
+    #define VSTORE(p, v) _mm512_storeu_si512((void *)(p), v)
+
+    VCHACHA8_BLOCKS(16, __m512i, VSET1, VLOAD, VSTORE)
+
+    #undef VADD
+    #undef VXOR
+    #undef VROTL
+    #undef VROT16
+    #undef VROT8
+    #undef VSET1
+    #undef VLOAD
+    #undef VSTORE
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+    #pragma GCC diagnostic pop
+#endif
+
+#elif CHACHA8_NEON
+
+//-----------------------------------------------------------
+static void chacha8_blocks_neon(const struct chacha8_ctx *x, uint64_t pos, uint8_t *c)
+{
+    #define VADD(a, b)   vaddq_u32(a, b)
+    #define VXOR(a, b)   veorq_u32(a, b)
+    #define VROTL(v, n)  vsriq_n_u32(vshlq_n_u32(v, n), v, 32 - (n))
+    #define VROT16(v)    vreinterpretq_u32_u16(vrev32q_u16(vreinterpretq_u16_u32(v)))
+    #define VROT8(v)     VROTL(v, 8)
+    #define VSET1(w)     vdupq_n_u32(w)
+    #define VLOAD(p)     vld1q_u32(p)
+    #define VSTORE(p, v) vst1q_u32(p, v)
+
+    VCHACHA8_BLOCKS(4, uint32x4_t, VSET1, VLOAD, VSTORE)
+
+    #undef VADD
+    #undef VXOR
+    #undef VROTL
+    #undef VROT16
+    #undef VROT8
+    #undef VSET1
+    #undef VLOAD
+    #undef VSTORE
+}
+
+#endif
+
+// The kernels cascade from the widest down to the scalar one for the remaining blocks,
+// so the level is kept instead of a single kernel.
+static SimdLevel chacha8_simd = SimdLevel::Scalar;
+
+//-----------------------------------------------------------
+SimdLevel SelectChaCha8Kernel(SimdLevel max_level)
+{
+#if CHACHA8_X86
+    chacha8_simd = max_level == SimdLevel::SSE2 ? SimdLevel::Scalar : max_level;
+#elif CHACHA8_NEON
+    chacha8_simd = max_level;
+#else
+    chacha8_simd = SimdLevel::Scalar;
+#endif
+    return chacha8_simd;
+}
+
+static const SimdLevel chacha8_default_simd = SelectChaCha8Kernel(KernelDispatch::Detect());
+
+// Generates the keystream using the widest selected SIMD kernel,
+// falling back to the scalar implementation for the remaining blocks.
+//-----------------------------------------------------------
+void chacha8_get_keystream(const struct chacha8_ctx *x, uint64_t pos, uint32_t n_blocks, uint8_t *c)
+{
+#if CHACHA8_X86
+    const SimdLevel simd = chacha8_simd;
+
+    if (simd >= SimdLevel::AVX512) {
+        for (; n_blocks >= 16; n_blocks -= 16, pos += 16, c += 16 * 64)
+            chacha8_blocks_avx512(x, pos, c);
+    }
+
+    if (simd >= SimdLevel::AVX2) {
+        for (; n_blocks >= 8; n_blocks -= 8, pos += 8, c += 8 * 64)
+            chacha8_blocks_avx2(x, pos, c);
+    }
+#elif CHACHA8_NEON
+    if (chacha8_simd == SimdLevel::NEON) {
+        for (; n_blocks >= 4; n_blocks -= 4, pos += 4, c += 4 * 64)
+            chacha8_blocks_neon(x, pos, c);
+    }
+#endif
+
+    chacha8_get_keystream_scalar(x, pos, n_blocks, c);
+}
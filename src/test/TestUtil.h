@@ -0,0 +1,28 @@
+#pragma once
+#include "Platform.h"
+
+// Deterministic pseudo-random numbers for the tests (splitmix64),
+// so that a failure can be reproduced from its seed.
+struct TestRandom
+{
+    uint64 state;
+
+    //-----------------------------------------------------------
+    inline TestRandom( uint64 seed ) : state( seed ) {}
+
+    //-----------------------------------------------------------
+    inline uint64 Next()
+    {
+        uint64 z = ( state += 0x9E3779B97F4A7C15ull );
+        z = ( z ^ ( z >> 30 ) ) * 0xBF58476D1CE4E5B9ull;
+        z = ( z ^ ( z >> 27 ) ) * 0x94D049BB133111EBull;
+        return z ^ ( z >> 31 );
+    }
+
+    // Uniform in [0, range)
+    //-----------------------------------------------------------
+    inline uint64 Next( uint64 range )
+    {
+        return Next() % range;
+    }
+};
@@ -0,0 +1,103 @@
+#include "TestUtil.h"
+#include "KernelDispatch.h"
+#include "memplot/KBCMatch.h"
+#include "Util.h"
+#include "util/Log.h"
+
+// Levels with a kBC matching kernel, narrowest first
+static const SimdLevel KBC_TEST_LEVELS[] = {
+    SimdLevel::Scalar,
+    SimdLevel::AVX2,
+    SimdLevel::AVX512,
+    SimdLevel::NEON
+};
+
+//-----------------------------------------------------------
+static bool TestKBCMatchLevel( SimdLevel level, uint groupCount )
+{
+    TestRandom rng( 0x6B4243ull + (uint64)level );
+
+    uint64 rMap    [KBC_MAP_WORDS];
+    uint64 yL      [KBC_MATCH_BATCH];
+    uint64 masks   [KBC_MATCH_BATCH];
+    uint64 refMasks[KBC_MATCH_BATCH];
+
+    for( uint g = 0; g < groupCount; g++ )
+    {
+        const uint64 groupL           = rng.Next( 1ull << 20 );
+        const uint64 groupLRangeStart = groupL * kBC;
+        const uint32 parity           = (uint32)( groupL & 1 );
+
+        // Fill the R group with about as many y values as a real one holds,
+        // and sometimes with a lot more, to test dense bitmaps as well.
+        const uint32 rCount = (uint32)( g % 8 == 0 ? rng.Next( kBC ) : rng.Next( 2 * kBC / kExtraBitsPow ) );
+
+        memset( rMap, 0, sizeof( rMap ) );
+
+        for( uint32 i = 0; i < rCount; i++ )
+            BitFieldSet( rMap, rng.Next( kBC ) );
+
+        const uint32 count = 1 + (uint32)rng.Next( KBC_MATCH_BATCH );
+
+        for( uint32 i = 0; i < count; i++ )
+            yL[i] = groupLRangeStart + rng.Next( kBC );
+
+        MatchKBCGroup( yL, count, groupLRangeStart, parity, rMap, masks );
+
+        // What the scalar matcher finds with L_targets
+        for( uint32 i = 0; i < count; i++ )
+        {
+            const uint32 localL = (uint32)( yL[i] - groupLRangeStart );
+            uint64 mask = 0;
+
+            for( uint32 m = 0; m < kExtraBitsPow; m++ )
+            {
+                if( BitFieldGet( rMap, L_targets[parity][localL][m] ) )
+                    mask |= 1ull << m;
+            }
+
+            refMasks[i] = mask;
+        }
+
+        for( uint32 i = 0; i < count; i++ )
+        {
+            if( masks[i] != refMasks[i] )
+            {
+                Log::Error( "%s: Group %u entry %u (y %llu) matched 0x%016llx instead of 0x%016llx.",
+                    KernelDispatch::LevelName( level ), g, i, yL[i], masks[i], refMasks[i] );
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+// Tests each kBC matching kernel the CPU supports against L_targets on random groups.
+// Optional argument: the number of groups.
+//-----------------------------------------------------------
+bool TestKBCMatch( int argc, const char* argv[] )
+{
+    const uint groupCount = argc > 0 ? (uint)strtoul( argv[0], nullptr, 10 ) : 100000;
+
+    LoadLTargets();
+
+    bool ok = true;
+
+    for( const SimdLevel level : KBC_TEST_LEVELS )
+    {
+        if( !KernelDispatch::IsSupported( level ) || SelectKBCMatchKernel( level ) != level )
+            continue;
+
+        Log::Write( "Matching %u kBC groups with the %s kernel... ", groupCount, KernelDispatch::LevelName( level ) );
+        Log::Flush();
+
+        const bool levelOk = TestKBCMatchLevel( level, groupCount );
+        Log::Line( "%s", levelOk ? "OK" : "Failed" );
+
+        ok = ok && levelOk;
+    }
+
+    SelectKBCMatchKernel( KernelDispatch::Detect() );
+    return ok;
+}
@@ -1,12 +1,38 @@
+#include <cstring>
 
 void TestNuma( int argc, const char* argv[] );
 void TestNumaSort( int argc, const char* argv[] );
+bool TestKBCMatch( int argc, const char* argv[] );
+bool TestRadixSortInPlace( int argc, const char* argv[] );
+bool TestWriteFullParks( int argc, const char* argv[] );
+
+struct DevTest
+{
+    const char* name;
+    bool (*run)( int argc, const char* argv[] );
+};
+
+// Tests that check a kernel against a reference, run as 'bladebit_dev <test> [args]'
+static const DevTest DevTests[] = {
+    { "kbc"  , TestKBCMatch         },
+    { "radix", TestRadixSortInPlace },
+    { "parks", TestWriteFullParks   }
+};
 
 //-----------------------------------------------------------
 int main( int argc, const char* argv[] )
 {
+    if( argc > 1 )
+    {
+        for( const DevTest& test : DevTests )
+        {
+            if( strcmp( argv[1], test.name ) == 0 )
+                return test.run( argc-2, argv+2 ) ? 0 : 1;
+        }
+    }
+
     // TestNuma( argc-1, argv+1 );
     TestNumaSort( argc-1, argv+1 );
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,104 @@
+#include "TestUtil.h"
+#include "memplot/ParkWriter.h"
+#include "Util.h"
+#include "util/Log.h"
+#include <vector>
+#include <cmath>
+
+// Tables written as parks
+static const TableId PARK_TEST_TABLES[] = {
+    TableId::Table1,
+    TableId::Table2,
+    TableId::Table3,
+    TableId::Table4,
+    TableId::Table5,
+    TableId::Table6
+};
+
+// Writes 1 to maxParkCount full parks of random sorted line points with WriteFullParks,
+// and checks them byte for byte against the same parks written one by one with WritePark.
+//-----------------------------------------------------------
+static bool TestWriteFullParksTable( TableId tableId, uint64 maxParkCount )
+{
+    TestRandom rng( 0x5041524Bull + (uint64)tableId );
+
+    const size_t parkSize   = CalculateParkSize( tableId );
+    const uint64 entryCount = maxParkCount * kEntriesPerPark;
+
+    // Sorted random line points have exponentially distributed gaps. A mean gap of 2^(k-2)
+    // gives small deltas of 2 on average, which encode to about 2.8 bits, so they fit in every table's park.
+    std::vector<uint64> linePoints( entryCount );
+
+    uint64 linePoint = rng.Next( 1ull << _K );
+
+    for( uint64 i = 0; i < entryCount; i++ )
+    {
+        const double u = (double)( rng.Next() >> 11 ) / (double)( 1ull << 53 );
+
+        linePoint    += (uint64)( -std::log( 1.0 - u ) * (double)( 1ull << ( _K - 2 ) ) );
+        linePoints[i] = linePoint;
+    }
+
+    // Both writers turn the line points into deltas in place, so each gets its own copy.
+    // The park buffers are filled with garbage, to check that every byte of each park is written.
+    std::vector<uint64> fullLinePoints;
+    std::vector<uint64> refLinePoints;
+    std::vector<byte>   fullParks( maxParkCount * parkSize );
+    std::vector<byte>   refParks ( maxParkCount * parkSize );
+
+    for( uint64 parkCount = 1; parkCount <= maxParkCount; parkCount++ )
+    {
+        fullLinePoints = linePoints;
+        refLinePoints  = linePoints;
+
+        memset( fullParks.data(), 0xA5, fullParks.size() );
+        memset( refParks .data(), 0x5A, refParks .size() );
+
+        WriteFullParks( parkSize, parkCount, fullLinePoints.data(), fullParks.data(), tableId );
+
+        for( uint64 p = 0; p < parkCount; p++ )
+            WritePark( parkSize, kEntriesPerPark, refLinePoints.data() + p * kEntriesPerPark, refParks.data() + p * parkSize, tableId );
+
+        for( uint64 i = 0; i < parkCount * parkSize; i++ )
+        {
+            if( fullParks[i] != refParks[i] )
+            {
+                Log::Error( "Table %u: Of %llu parks, park %llu differs at byte %llu: 0x%02x instead of 0x%02x.",
+                    (uint)tableId + 1, parkCount, i / parkSize, i % parkSize, (uint)fullParks[i], (uint)refParks[i] );
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+// Tests WriteFullParks, which encodes PARK_ENCODE_LANES parks at a time, against WritePark,
+// on park counts that take the interleaved lanes, the trailing parks, or both.
+// Optional argument: the most parks written at once.
+//-----------------------------------------------------------
+bool TestWriteFullParks( int argc, const char* argv[] )
+{
+    const uint64 maxParkCount = argc > 0 ? strtoull( argv[0], nullptr, 10 ) : 2 * PARK_ENCODE_LANES + 1;
+
+    if( maxParkCount < 1 )
+    {
+        Log::Error( "At least 1 park must be written." );
+        return false;
+    }
+
+    bool ok = true;
+
+    for( const TableId tableId : PARK_TEST_TABLES )
+    {
+        Log::Write( "Writing up to %llu parks of table %u... ", maxParkCount, (uint)tableId + 1 );
+        Log::Flush();
+
+        const bool tableOk = TestWriteFullParksTable( tableId, maxParkCount );
+        Log::Line( "%s", tableOk ? "OK" : "Failed" );
+
+        ok = ok && tableOk;
+    }
+
+    return ok;
+}
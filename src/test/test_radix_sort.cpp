@@ -0,0 +1,101 @@
+#include "TestUtil.h"
+#include "algorithm/RadixSortInPlace.h"
+#include "threading/ThreadPool.h"
+#include "SysHost.h"
+#include "Util.h"
+#include "util/Log.h"
+#include "Config.h"
+#include <vector>
+#include <algorithm>
+
+// Sorts random values of KeyBits bits below maxValue, with and without an index key,
+// and checks them against std::sort and std::stable_sort.
+//-----------------------------------------------------------
+template<uint32 KeyBits, typename T1>
+static bool TestRadixSortInPlaceCase( ThreadPool& pool, uint64 length, uint64 maxValue, uint64 seed )
+{
+    TestRandom rng( seed );
+
+    std::vector<T1>     values( length );
+    std::vector<uint32> keys  ( length );
+
+    for( uint64 i = 0; i < length; i++ )
+    {
+        values[i] = (T1)rng.Next( maxValue );
+        keys  [i] = (uint32)i;
+    }
+
+    // Unkeyed
+    {
+        std::vector<T1> sorted( values );
+        std::vector<T1> expected( values );
+
+        RadixSortInPlace::Sort<MAX_THREADS, KeyBits>( pool, sorted.data(), length );
+        std::sort( expected.begin(), expected.end() );
+
+        if( sorted != expected )
+        {
+            Log::Error( "Sort of %llu %u-bit values (max %llu) does not match std::sort.", length, KeyBits, maxValue );
+            return false;
+        }
+    }
+
+    // Keyed by the original index: equal values are ordered by it, as with a stable sort
+    {
+        std::vector<T1>     sorted( values );
+        std::vector<uint32> sortedKeys( keys );
+        std::vector<uint32> expectedKeys( keys );
+
+        RadixSortInPlace::SortWithKey<MAX_THREADS, KeyBits>( pool, sorted.data(), sortedKeys.data(), length );
+
+        std::stable_sort( expectedKeys.begin(), expectedKeys.end(), [&]( uint32 a, uint32 b ) {
+            return values[a] < values[b];
+        });
+
+        for( uint64 i = 0; i < length; i++ )
+        {
+            if( sortedKeys[i] != expectedKeys[i] || sorted[i] != values[expectedKeys[i]] )
+            {
+                Log::Error( "Keyed sort of %llu %u-bit values (max %llu) does not match std::stable_sort at entry %llu.",
+                    length, KeyBits, maxValue, i );
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+// Tests RadixSortInPlace against the standard sorts, on lengths that take the single-threaded,
+// the insertion sort and the parallel partitioning paths, and on values with many duplicates.
+// Optional argument: the thread count.
+//-----------------------------------------------------------
+bool TestRadixSortInPlace( int argc, const char* argv[] )
+{
+    const uint threadCount = argc > 0 ? (uint)strtoul( argv[0], nullptr, 10 ) : SysHost::GetLogicalCPUCount();
+
+    ThreadPool pool( threadCount, ThreadPool::Mode::Fixed );
+
+    const uint64 lengths[] = { 0, 1, 2, RADIX_IN_PLACE_SMALL_SORT, RADIX_IN_PLACE_SMALL_SORT + 1, 1000, 100000, 1ull << 22 };
+
+    bool ok = true;
+
+    Log::Write( "Sorting in place with %u threads... ", threadCount );
+    Log::Flush();
+
+    for( const uint64 length : lengths )
+    {
+        const uint64 seed = length * 31;
+
+        // Line points and y values, as in Phase 3
+        ok = ok && TestRadixSortInPlaceCase<50, uint64>( pool, length, 1ull << 50, seed     );
+        ok = ok && TestRadixSortInPlaceCase<25, uint32>( pool, length, 1ull << 25, seed + 1 );
+
+        // Many duplicates, and a top digit with few buckets in use
+        ok = ok && TestRadixSortInPlaceCase<32, uint32>( pool, length, 100        , seed + 2 );
+        ok = ok && TestRadixSortInPlaceCase<20, uint32>( pool, length, 1ull << 13 , seed + 3 );
+    }
+
+    Log::Line( "%s", ok ? "OK" : "Failed" );
+    return ok;
+}
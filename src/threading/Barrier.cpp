@@ -0,0 +1,193 @@
+#include "Barrier.h"
+#include "ThreadPool.h"
+#include "Util.h"
+#include "util/Trace.h"
+#include <thread>
+
+//-----------------------------------------------------------
+Barrier::Barrier()
+{}
+
+//-----------------------------------------------------------
+Barrier::~Barrier()
+{
+    Destroy();
+}
+
+//-----------------------------------------------------------
+void Barrier::Destroy()
+{
+    delete[] _nodes;
+    delete[] _leaves;
+
+    _nodes       = nullptr;
+    _leaves      = nullptr;
+    _threadCount = 0;
+}
+
+//-----------------------------------------------------------
+void Barrier::Init( uint threadCount )
+{
+    Init( threadCount, nullptr );
+}
+
+//-----------------------------------------------------------
+void Barrier::Init( uint threadCount, const ThreadPool& pool )
+{
+    if( pool.NodeCount() < 2 || threadCount > pool.ThreadCount() )
+    {
+        Init( threadCount, nullptr );
+        return;
+    }
+
+    uint* groups = new uint[threadCount];
+
+    for( uint i = 0; i < threadCount; i++ )
+        groups[i] = pool.ThreadNode( i );
+
+    Init( threadCount, groups );
+
+    delete[] groups;
+}
+
+//-----------------------------------------------------------
+void Barrier::Init( uint threadCount, const uint* threadGroups )
+{
+    ASSERT( threadCount );
+
+    Destroy();
+
+    // A tree with a leaf per thread, at worst, has fewer internal nodes than leaves
+    _nodes       = new Node [threadCount * 2];
+    _leaves      = new Node*[threadCount];
+    _threadCount = threadCount;
+    _generation.store( 0, std::memory_order_relaxed );
+
+    uint groupCount = 1;
+    if( threadGroups )
+    {
+        for( uint i = 0; i < threadCount; i++ )
+            groupCount = std::max( groupCount, threadGroups[i] + 1 );
+    }
+
+    uint* children   = new uint[threadCount];
+    uint* groupRoots = new uint[groupCount];
+    uint  rootCount  = 0;
+    uint  nodeCount  = 0;
+
+    // Build the subtree of each group, from leaves of up to BB_BARRIER_FAN_IN threads
+    for( uint group = 0; group < groupCount; group++ )
+    {
+        uint leafCount   = 0;
+        uint leafThreads = BB_BARRIER_FAN_IN;
+
+        for( uint i = 0; i < threadCount; i++ )
+        {
+            if( threadGroups && threadGroups[i] != group )
+                continue;
+
+            if( leafThreads == BB_BARRIER_FAN_IN )
+            {
+                Node& leaf = _nodes[nodeCount];
+                leaf.arrived.store( 0, std::memory_order_relaxed );
+                leaf.count  = 0;
+                leaf.parent = nullptr;
+
+                children[leafCount++] = nodeCount++;
+                leafThreads = 0;
+            }
+
+            Node& leaf = _nodes[children[leafCount-1]];
+            leaf.count++;
+            leafThreads++;
+
+            _leaves[i] = &leaf;
+        }
+
+        if( leafCount )
+            groupRoots[rootCount++] = BuildTree( children, leafCount, nodeCount );
+    }
+
+    // Then join the groups
+    BuildTree( groupRoots, rootCount, nodeCount );
+    ASSERT( nodeCount <= threadCount * 2 );
+
+    delete[] children;
+    delete[] groupRoots;
+
+    std::atomic_thread_fence( std::memory_order_release );
+}
+
+// Builds the levels above the given nodes, and returns the root.
+// children is overwritten.
+//-----------------------------------------------------------
+uint Barrier::BuildTree( uint* children, uint childCount, uint& nodeCount )
+{
+    ASSERT( childCount );
+
+    while( childCount > 1 )
+    {
+        const uint parentCount = CDiv( childCount, BB_BARRIER_FAN_IN );
+
+        for( uint p = 0; p < parentCount; p++ )
+        {
+            const uint first = p * BB_BARRIER_FAN_IN;
+            const uint end   = std::min( first + BB_BARRIER_FAN_IN, childCount );
+
+            Node& parent = _nodes[nodeCount];
+            parent.arrived.store( 0, std::memory_order_relaxed );
+            parent.count  = end - first;
+            parent.parent = nullptr;
+
+            for( uint c = first; c < end; c++ )
+                _nodes[children[c]].parent = &parent;
+
+            // p <= first, so this doesn't overwrite children we have yet to visit
+            children[p] = nodeCount++;
+        }
+
+        childCount = parentCount;
+    }
+
+    return children[0];
+}
+
+//-----------------------------------------------------------
+void Barrier::Wait( uint threadId )
+{
+    ASSERT( threadId < _threadCount );
+
+    TraceScope trace( "barrier" );
+
+    // Read before arriving, as the last thread moves it on
+    const uint generation = _generation.load( std::memory_order_acquire );
+
+    Node* node = _leaves[threadId];
+
+    for( ;; )
+    {
+        // Not the last one here, wait for the release
+        if( node->arrived.fetch_add( 1, std::memory_order_acq_rel ) + 1 < node->count )
+            break;
+
+        // Last one: reset the node for the next generation, and arrive at its parent.
+        // The reset is published to the other threads by the release below.
+        node->arrived.store( 0, std::memory_order_relaxed );
+        node = node->parent;
+
+        if( !node )
+        {
+            // Arrived at the root, release everyone
+            _generation.store( generation + 1, std::memory_order_release );
+            return;
+        }
+    }
+
+    for( uint spin = 0; _generation.load( std::memory_order_acquire ) == generation; spin++ )
+    {
+        if( spin < BB_BARRIER_SPIN_COUNT )
+            CpuPause();
+        else
+            std::this_thread::yield();
+    }
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include "Platform.h"
+#include <atomic>
+
+class ThreadPool;
+
+// Threads arriving at each node of the combining tree
+#define BB_BARRIER_FAN_IN       8
+
+// Times a waiting thread polls the barrier before it starts yielding its CPU
+#define BB_BARRIER_SPIN_COUNT   4096
+
+/**
+ * Reusable barrier for the threads of a job.
+ *
+ * Threads arrive at the leaves of a combining tree, at most BB_BARRIER_FAN_IN per node,
+ * so no counter is contended by more than a handful of threads. The last thread
+ * to arrive at a node arrives at its parent, and the last one at the root releases
+ * everyone by bumping the barrier's generation, on which all the threads wait.
+ * As each wait is for a new generation, the barrier can be reused right away,
+ * without having to reset it.
+ *
+ * When the threads are grouped, ie. by NUMA node, each group has its own subtree,
+ * so that only the roots of the groups arrive across nodes.
+ *
+ * Waiting threads spin for a while, then yield their CPU between polls.
+ */
+class Barrier
+{
+public:
+    Barrier();
+    ~Barrier();
+
+    // Barrier for threadCount threads, with ids [0, threadCount).
+    void Init( uint threadCount );
+
+    // Barrier whose threads are grouped. threadGroups[i] is the group of thread i.
+    void Init( uint threadCount, const uint* threadGroups );
+
+    // Barrier for the jobs of a Fixed pool, where job i runs on thread i,
+    // grouped by the NUMA node of the threads.
+    void Init( uint threadCount, const ThreadPool& pool );
+
+    // Returns once all the threads have called it.
+    void Wait( uint threadId );
+
+    inline uint ThreadCount() const { return _threadCount; }
+
+private:
+    struct alignas( 64 ) Node
+    {
+        std::atomic<uint> arrived;
+        uint              count;    // Arrivals expected
+        Node*             parent;
+    };
+
+    void  Destroy();
+    uint  BuildTree( uint* children, uint childCount, uint& nodeCount );
+
+private:
+    Node*              _nodes       = nullptr;
+    Node**             _leaves      = nullptr; // Leaf of each thread
+    uint               _threadCount = 0;
+
+    alignas( 64 )
+    std::atomic<uint>  _generation  = 0;
+};
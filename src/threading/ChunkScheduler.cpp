@@ -0,0 +1,82 @@
+#include "ChunkScheduler.h"
+#include "Util.h"
+
+//-----------------------------------------------------------
+void ChunkScheduler::Init( uint chunkCount, uint threadCount )
+{
+    ASSERT( threadCount );
+
+    _chunkCount  = chunkCount;
+    _threadCount = threadCount;
+
+    if( _shares.size() != threadCount )
+        _shares = std::vector<Share>( threadCount );
+
+    for( uint i = 0; i < threadCount; i++ )
+    {
+        const uint64 begin = (uint64)chunkCount * i       / threadCount;
+        const uint64 end   = (uint64)chunkCount * (i + 1) / threadCount;
+
+        _shares[i].range.store( ( begin << 32 ) | end, std::memory_order_relaxed );
+    }
+
+    std::atomic_thread_fence( std::memory_order_release );
+}
+
+//-----------------------------------------------------------
+bool ChunkScheduler::Next( uint threadId, uint& outChunk )
+{
+    ASSERT( threadId < _threadCount );
+
+    // Take from the front of our own share
+    std::atomic<uint64>& range = _shares[threadId].range;
+    uint64 r = range.load( std::memory_order_acquire );
+
+    for( ;; )
+    {
+        const uint32 begin = (uint32)( r >> 32 );
+        const uint32 end   = (uint32)r;
+
+        if( begin >= end )
+            break;
+
+        if( range.compare_exchange_weak( r, ( (uint64)( begin + 1 ) << 32 ) | end,
+                                         std::memory_order_acq_rel, std::memory_order_acquire ) )
+        {
+            outChunk = begin;
+            return true;
+        }
+    }
+
+    return Steal( threadId, outChunk );
+}
+
+//-----------------------------------------------------------
+bool ChunkScheduler::Steal( uint threadId, uint& outChunk )
+{
+    // Take from the back of the first other share that has any chunks left,
+    // starting from our neighbour so that thieves spread out.
+    for( uint i = 1; i < _threadCount; i++ )
+    {
+        std::atomic<uint64>& range = _shares[( threadId + i ) % _threadCount].range;
+        uint64 r = range.load( std::memory_order_acquire );
+
+        for( ;; )
+        {
+            const uint32 begin = (uint32)( r >> 32 );
+            const uint32 end   = (uint32)r;
+
+            if( begin >= end )
+                break;
+
+            if( range.compare_exchange_weak( r, ( (uint64)begin << 32 ) | ( end - 1 ),
+                                             std::memory_order_acq_rel, std::memory_order_acquire ) )
+            {
+                outChunk = end - 1;
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <atomic>
+#include <algorithm>
+#include <vector>
+
+// Chunks each thread gets when running a chunked job.
+// More chunks balance better, but add a little overhead per chunk.
+#define BB_CHUNKS_PER_THREAD 16
+
+/**
+ * Dynamically schedules the chunks of a job between the threads that run it.
+ *
+ * Each thread owns a contiguous share of the chunks and takes them from the
+ * front of it, in order. Threads that run out of chunks steal from the back
+ * of the other threads' shares, so that slower threads
+ * (ex. SMT siblings or efficiency cores) don't determine when a job finishes.
+ *
+ * Usage:
+ *  - Init() on the control thread before running the job
+ *  - Each job thread calls Next() with its id until it returns false
+ */
+class ChunkScheduler
+{
+public:
+    void Init( uint chunkCount, uint threadCount );
+
+    // Gets the next chunk to process for the given thread.
+    // Returns false once all chunks have been taken.
+    bool Next( uint threadId, uint& outChunk );
+
+    inline uint ChunkCount() const { return _chunkCount; }
+
+private:
+    bool Steal( uint threadId, uint& outChunk );
+
+    // Remaining chunks of a thread's share: [begin, end),
+    // packed as begin << 32 | end so both ends can be updated atomically.
+    struct alignas( 64 ) Share
+    {
+        std::atomic<uint64> range;
+    };
+
+private:
+    std::vector<Share> _shares;
+    uint  _chunkCount  = 0;
+    uint  _threadCount = 0;
+};
+
+// Range of chunk <chunk> when splitting <count> items in chunks of <chunkSize>
+//-----------------------------------------------------------
+inline void GetChunkRange( uint chunk, uint64 chunkSize, uint64 count, uint64& outStart, uint64& outEnd )
+{
+    outStart = std::min( (uint64)chunk * chunkSize, count );
+    outEnd   = std::min( outStart + chunkSize, count );
+}
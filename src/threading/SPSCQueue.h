@@ -0,0 +1,62 @@
+#pragma once
+#include "Platform.h"
+#include <atomic>
+
+/**
+ * Bounded lock-free queue with a single producer and a single consumer thread.
+ *
+ * Capacity must be a power of 2. Entries are copied in and out,
+ * so T should be small and trivially copyable.
+ * Neither end blocks: a full or empty queue is reported by TryPush() or TryPop(),
+ * and it's up to the caller to wait, ie. on a Semaphore.
+ */
+template<typename T, uint32 Capacity>
+class SPSCQueue
+{
+    static_assert( Capacity >= 2 && ( Capacity & ( Capacity - 1 ) ) == 0, "Capacity must be a power of 2." );
+
+public:
+    // Producer only. Returns false if the queue is full.
+    inline bool TryPush( const T& value )
+    {
+        const uint32 tail = _tail.load( std::memory_order_relaxed );
+
+        if( tail - _head.load( std::memory_order_acquire ) >= Capacity )
+            return false;
+
+        _entries[tail & ( Capacity - 1 )] = value;
+        _tail.store( tail + 1, std::memory_order_release );
+
+        return true;
+    }
+
+    // Consumer only. Returns false if the queue is empty.
+    inline bool TryPop( T& value )
+    {
+        const uint32 head = _head.load( std::memory_order_relaxed );
+
+        if( head == _tail.load( std::memory_order_acquire ) )
+            return false;
+
+        value = _entries[head & ( Capacity - 1 )];
+        _head.store( head + 1, std::memory_order_release );
+
+        return true;
+    }
+
+    // Approximate, unless called from a thread that owns both ends.
+    inline uint32 Count() const
+    {
+        return _tail.load( std::memory_order_acquire ) - _head.load( std::memory_order_acquire );
+    }
+
+    inline bool IsFull() const { return Count() >= Capacity; }
+
+    static constexpr uint32 CAPACITY = Capacity;
+
+private:
+    // Each end lives in its own cache line, to avoid false sharing between the threads
+    alignas( 64 ) std::atomic<uint32> _head = 0;    // Next entry to pop. (Written by consumer.)
+    alignas( 64 ) std::atomic<uint32> _tail = 0;    // Next entry to push. (Written by producer.)
+    alignas( 64 ) T                   _entries[Capacity];
+};
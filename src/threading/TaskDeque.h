@@ -0,0 +1,105 @@
+#pragma once
+#include "Platform.h"
+#include <atomic>
+
+/**
+ * Bounded Chase-Lev work-stealing deque.
+ *
+ * The owner thread pushes and pops at the bottom, in LIFO order,
+ * while any other thread may steal from the top, in FIFO order.
+ * Capacity must be a power of 2. Entries are pointers, so that they
+ * can be loaded and stored atomically. Push() fails when the deque is full,
+ * and it's up to the caller to put the entry somewhere else.
+ *
+ * See: Lê, Pop, Cohen & Zappa Nardelli,
+ *      "Correct and Efficient Work-Stealing for Weak Memory Models" (2013)
+ */
+template<typename T, uint32 Capacity>
+class TaskDeque
+{
+    static_assert( Capacity >= 2 && ( Capacity & ( Capacity - 1 ) ) == 0, "Capacity must be a power of 2." );
+
+public:
+    TaskDeque()
+    {
+        for( uint32 i = 0; i < Capacity; i++ )
+            _entries[i].store( nullptr, std::memory_order_relaxed );
+    }
+
+    // Owner only. Returns false if the deque is full.
+    inline bool Push( T* value )
+    {
+        const int64 b = _bottom.load( std::memory_order_relaxed );
+        const int64 t = _top   .load( std::memory_order_acquire );
+
+        if( b - t >= (int64)Capacity )
+            return false;
+
+        // Release, so that a thief which reads the entry sees what it points to
+        _entries[b & ( Capacity - 1 )].store( value, std::memory_order_release );
+        _bottom.store( b + 1, std::memory_order_release );
+
+        return true;
+    }
+
+    // Owner only. Returns nullptr if the deque is empty.
+    inline T* Pop()
+    {
+        const int64 b = _bottom.load( std::memory_order_relaxed ) - 1;
+        _bottom.store( b, std::memory_order_relaxed );
+
+        std::atomic_thread_fence( std::memory_order_seq_cst );
+        int64 t = _top.load( std::memory_order_relaxed );
+
+        if( t > b )
+        {
+            // Empty
+            _bottom.store( b + 1, std::memory_order_relaxed );
+            return nullptr;
+        }
+
+        T* value = _entries[b & ( Capacity - 1 )].load( std::memory_order_relaxed );
+
+        if( t == b )
+        {
+            // Last entry: race the thieves for it
+            if( !_top.compare_exchange_strong( t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed ) )
+                value = nullptr;
+
+            _bottom.store( b + 1, std::memory_order_relaxed );
+        }
+
+        return value;
+    }
+
+    // Any thread. Returns nullptr if the deque is empty,
+    // or if another thread took the entry first.
+    inline T* Steal()
+    {
+        int64 t = _top.load( std::memory_order_acquire );
+        std::atomic_thread_fence( std::memory_order_seq_cst );
+        const int64 b = _bottom.load( std::memory_order_acquire );
+
+        if( t >= b )
+            return nullptr;
+
+        T* value = _entries[t & ( Capacity - 1 )].load( std::memory_order_acquire );
+
+        if( !_top.compare_exchange_strong( t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed ) )
+            return nullptr;
+
+        return value;
+    }
+
+    // Approximate, unless called from the owner with no thieves about.
+    inline bool IsEmpty() const
+    {
+        return _bottom.load( std::memory_order_acquire ) <= _top.load( std::memory_order_acquire );
+    }
+
+private:
+    // Each end lives in its own cache line, to avoid false sharing between the owner and the thieves
+    alignas( 64 ) std::atomic<int64> _top    = 0;  // Next entry to steal. (Written by thieves, and by the owner for the last entry.)
+    alignas( 64 ) std::atomic<int64> _bottom = 0;  // Next entry to push. (Written by owner.)
+    alignas( 64 ) std::atomic<T*>    _entries[Capacity];
+};
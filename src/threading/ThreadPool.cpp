@@ -2,6 +2,70 @@
 #include "Util.h"
 #include "util/Log.h"
 #include "SysHost.h"
+#include "TaskDeque.h"
+#include "util/Trace.h"
+#include <thread>
+#include <chrono>
+
+struct TaskEdge
+{
+    PoolTask* successor;
+    TaskEdge* next;
+};
+
+struct PoolTask
+{
+    JobFunc                 func;
+    void*                   data;
+    std::atomic<int>        refCount;
+    std::atomic<uint>       pendingDeps;    // Dependencies not yet done, +1 while the task is being submitted
+    std::atomic<TaskEdge*>  successors;     // Tasks waiting on this one. Set to TASK_DONE_EDGE once done.
+    std::atomic<Semaphore*> waiter;         // Thread blocked until this task is done. Set to TASK_DONE_WAITER once done.
+    std::atomic<bool>       done;
+    TaskEdge                edges[BB_TASK_MAX_DEPS];    // Links this task into the successor lists of its dependencies
+};
+
+#define TASK_DONE_EDGE      ((TaskEdge*)(uintptr_t)1)
+#define TASK_DONE_WAITER    ((Semaphore*)(uintptr_t)1)
+
+static thread_local void* _currentWorker = nullptr;
+
+// Spins until done() returns true, or for up to the given number of microseconds.
+// Returns what done() last returned.
+//-----------------------------------------------------------
+template<typename TDone>
+inline static bool SpinUntil( uint microseconds, TDone done )
+{
+    if( done() )
+        return true;
+
+    if( microseconds == 0 )
+        return false;
+
+    const auto end = std::chrono::steady_clock::now() + std::chrono::microseconds( microseconds );
+
+    for( ;; )
+    {
+        // Don't read the clock on every iteration
+        for( uint i = 0; i < 64; i++ )
+        {
+            CpuPause();
+
+            if( done() )
+                return true;
+        }
+
+        if( std::chrono::steady_clock::now() >= end )
+            return done();
+    }
+}
+
+//-----------------------------------------------------------
+inline static void ReleaseTask( PoolTask* task )
+{
+    if( task->refCount.fetch_sub( 1, std::memory_order_acq_rel ) == 1 )
+        delete task;
+}
 
 
 //-----------------------------------------------------------
@@ -11,20 +75,81 @@ ThreadPool::ThreadPool( uint threadCount, Mode mode, bool disableAffinity )
     , _disableAffinity( disableAffinity )
     , _jobSignal      ( 0 )
     , _poolSignal     ( 0 )
+    , _taskSignal     ( 0 )
 {
     if( threadCount < 1 )
         Fatal( "threadCount must be greater than 0." );
     
+    // Spinning only makes sense if every thread has its own CPU
+    if( threadCount > SysHost::GetLogicalCPUCount() - SysHost::GetIoCpuCount() )
+        _spinTime.store( 0, std::memory_order_relaxed );
+
     _threads    = new Thread    [threadCount];
     _threadData = new ThreadData[threadCount];
 
-    auto threadRunner = mode == Mode::Fixed ? FixedThreadRunner : GreedyThreadRunner;
+    auto threadRunner = mode == Mode::Fixed  ? FixedThreadRunner  :
+                        mode == Mode::Greedy ? GreedyThreadRunner : StealingThreadRunner;
+
+    // Create all the deques before any thread may steal from them
+    for( uint i = 0; i < threadCount; i++ )
+        _threadData[i].tasks = mode == Mode::Stealing ? new WorkerDeque() : nullptr;
+
+    // Pin the threads to the primary thread of each performance core first,
+    // then to efficiency cores, and only then to SMT siblings.
+    // Threads beyond the CPU count wrap around. The cpus reserved for I/O are left alone.
+    const CpuTopology& topo     = *SysHost::GetCpuTopology();
+    const uint         cpuCount = SysHost::GetLogicalCPUCount();
+
+    if( disableAffinity )
+    {
+        // Unpinned threads are still spread over the processor groups by these ids
+        for( uint i = 0; i < threadCount; i++ )
+            _threadData[i].cpuId = i;
+
+        _coreThreadCount = std::min( threadCount, topo.coreCount );
+    }
+    else
+    {
+        uint* cpuOrder = new uint[cpuCount];
+        const uint orderCount = SysHost::GetCpuAffinityOrder( cpuOrder );
+
+        for( uint i = 0; i < threadCount; i++ )
+            _threadData[i].cpuId = cpuOrder[i % orderCount];
+
+        delete[] cpuOrder;
+
+        // Leading threads pinned to cores of their own
+        _coreThreadCount = 0;
+        while( _coreThreadCount < threadCount && _coreThreadCount < orderCount )
+        {
+            const uint cpuId = _threadData[_coreThreadCount].cpuId;
+            if( cpuId < topo.cpuCount && topo.cpus[cpuId].smtIndex > 0 )
+                break;
+
+            _coreThreadCount++;
+        }
+    }
+
+    // Group the threads by the node of their CPU
+    const NumaInfo* numa = disableAffinity ? nullptr : SysHost::GetNUMAInfo();
+
+    if( numa && numa->nodeCount > 1 )
+        _nodeCount = numa->nodeCount;
+
+    for( uint i = 0; i < threadCount; i++ )
+    {
+        const int node = _nodeCount > 1 ? SysHost::NumaGetNodeFromCpu( *numa, _threadData[i].cpuId ) : 0;
+        _threadData[i].node = node < 0 ? 0 : (uint)node;
+    }
 
     for( uint i = 0; i < threadCount; i++ )
     {
         _threadData[i].index = (int)i;
-        _threadData[i].cpuId = i;
         _threadData[i].pool  = this;
+        _threadData[i].rng   = i * 2654435761u + 1;
+        _threadData[i].jobEpoch.store( 0, std::memory_order_relaxed );
+        _threadData[i].parked  .store( false, std::memory_order_relaxed );
+        _threadData[i].busyTime.store( 0, std::memory_order_relaxed );
         
         Thread& t = _threads[i];
 
@@ -40,19 +165,37 @@ ThreadPool::~ThreadPool()
 
     if( _mode == Mode::Fixed )
     {
+        // Spinning threads see the exit signal, sleeping ones need to be woken up
         for( uint i = 0; i < _threadCount; i++ )
-            _threadData[i].jobSignal.Release();
+        {
+            if( _threadData[i].parked.exchange( false, std::memory_order_seq_cst ) )
+                _threadData[i].jobSignal.Release();
+        }
     }
-    else
+    else if( _mode == Mode::Greedy )
     {
         for( uint i = 0; i < _threadCount; i++ )
             _jobSignal.Release();
     }
+    else
+    {
+        for( uint i = 0; i < _threadCount; i++ )
+            _taskSignal.Release();
+    }
 
-    // #TODO: Wait for all threads to finish
-    
-    // #TODO: Signal thread for exit.
-    // #TODO: Wait for all threads to exit
+    // The threads may still be looking at their data, ie. spinning on it
+    for( uint i = 0; i < _threadCount; i++ )
+        _threads[i].WaitForExit();
+
+    if( _mode == Mode::Stealing )
+    {
+        for( uint i = 0; i < _threadCount; i++ )
+            delete _threadData[i].tasks;
+
+        // Tasks still queued never run
+        for( PoolTask* task : _sharedTasks )
+            ReleaseTask( task );
+    }
 
     delete[] _threads;
     delete[] _threadData;
@@ -71,33 +214,62 @@ void ThreadPool::RunJob( JobFunc func, void* data, uint count, size_t dataSize )
     // #TODO: Should lock here to prevent re-entrancy and wait
     //        until current jobs are finished, but that is not the intended usage.
     if( _mode == Mode::Fixed )
-        DispatchFixed( func, (byte*)data, count, dataSize );
-    else
+        DispatchFixed( _poolGroup, func, (byte*)data, count, dataSize );
+    else if( _mode == Mode::Greedy )
         DispatchGreedy( func, (byte*)data, count, dataSize );
+    else
+        DispatchStealing( func, (byte*)data, count, dataSize );
 }
 
 //-----------------------------------------------------------
-void ThreadPool::DispatchFixed( JobFunc func, byte* data, uint count, size_t dataSize )
+void ThreadPool::DispatchFixed( JobGroup& group, JobFunc func, byte* data, uint count, size_t dataSize )
 {
-    _jobFunc     = func;
-    _jobData     = (byte*)data;
-    _jobDataSize = dataSize;
+    group.func     = func;
+    group.data     = (byte*)data;
+    group.dataSize = dataSize;
+
+    if( Trace::Enabled() )
+    {
+        group.traceName  = Trace::CurrentScope() ? Trace::CurrentScope() : "job";
+        group.traceIndex = Trace::CurrentScopeIndex();
+    }
 
     ASSERT( count <= _threadCount );
 
     if( count > _threadCount )
         count = _threadCount;
 
+    group.remaining.store( count, std::memory_order_relaxed );
+
+    const uint64 epoch = _jobEpoch.fetch_add( 1, std::memory_order_relaxed ) + 1;
+
+    // Threads that are still spinning pick up the job by themselves,
+    // only the ones that have gone to sleep need to be woken up.
     for( uint i = 0; i < count; i++ )
-        _threadData[i].jobSignal.Release();
+    {
+        ThreadData& d = _threadData[i];
+
+        d.group    = &group;
+        d.jobIndex = i;
+        d.jobEpoch.store( epoch, std::memory_order_seq_cst );
+
+        if( d.parked.load( std::memory_order_seq_cst ) && d.parked.exchange( false, std::memory_order_seq_cst ) )
+            d.jobSignal.Release();
+    }
 
     // Wait until all running jobs finish
-    uint releaseCount = 0;
-    while( releaseCount < count )
+    const uint spinTime = _spinTime.load( std::memory_order_relaxed );
+
+    if( !SpinUntil( spinTime, [&group]() { return group.remaining.load( std::memory_order_acquire ) == 0; } ) )
     {
-        _poolSignal.Wait();
-        releaseCount++;
+        group.parked.store( true, std::memory_order_seq_cst );
+
+        // If the jobs finished in the meantime, take back our parked flag, unless the last thread took it first
+        if( group.remaining.load( std::memory_order_seq_cst ) != 0 || !group.parked.exchange( false, std::memory_order_seq_cst ) )
+            group.signal.Wait();
     }
+
+    ASSERT( group.remaining.load( std::memory_order_acquire ) == 0 );
 }
 
 //-----------------------------------------------------------
@@ -111,6 +283,13 @@ void ThreadPool::DispatchGreedy( JobFunc func, byte* data, uint count, size_t da
     _jobFunc     = func;
     _jobData     = (byte*)data;
     _jobDataSize = dataSize;
+
+    if( Trace::Enabled() )
+    {
+        _jobTraceName  = Trace::CurrentScope() ? Trace::CurrentScope() : "job";
+        _jobTraceIndex = Trace::CurrentScopeIndex();
+    }
+
     _jobIndex.store( 0, std::memory_order_release );
 
     ASSERT( _poolSignal.GetCount() == 0 );
@@ -146,33 +325,81 @@ void ThreadPool::FixedThreadRunner( void* tParam )
 
     if( !pool._disableAffinity )
         SysHost::SetCurrentThreadAffinityCpuId( d.cpuId );
+    else
+        SysHost::SetCurrentThreadProcessorGroup( d.cpuId );
 
-    const uint index = (uint)d.index;
+    Trace::NameThread( "pool", d.index );
 
     std::atomic<bool>& exitSignal = pool._exitSignal;
-    Semaphore&         poolSignal = pool._poolSignal;
     Semaphore&         jobSignal  = d.jobSignal;
 
+    // Epochs start at 0, so we can't miss a job dispatched before we got here
+    uint64 epoch = 0;
+
+    auto hasJob = [&]() {
+        return d.jobEpoch.load( std::memory_order_acquire ) != epoch ||
+               exitSignal.load( std::memory_order_acquire );
+    };
+
     for( ;; )
     {
-        if( exitSignal.load( std::memory_order::memory_order_acquire ) )
-            return;
+        // Spin for a while waiting for a job, then go to sleep until signalled to go
+        if( !SpinUntil( pool._spinTime.load( std::memory_order_relaxed ), hasJob ) )
+        {
+            d.parked.store( true, std::memory_order_seq_cst );
 
-        // Wait until we are signalled to go
-        jobSignal.Wait();
+            // If a job came in the meantime, take back our parked flag,
+            // unless the dispatcher took it first, in which case it's signalling us.
+            const bool jobArrived = d.jobEpoch.load( std::memory_order_seq_cst ) != epoch ||
+                                    exitSignal.load( std::memory_order_seq_cst );
+
+            if( !jobArrived || !d.parked.exchange( false, std::memory_order_seq_cst ) )
+                jobSignal.Wait();
+        }
 
         // We may have been signalled to exit
         if( exitSignal.load( std::memory_order_acquire ) )
             return;
+
+        epoch = d.jobEpoch.load( std::memory_order_acquire );
+
+        JobGroup& group = *d.group;
         
         // Run job
-        pool._jobFunc( pool._jobData + pool._jobDataSize * index );
-
-        // Finished job
-        poolSignal.Release();
+        if( pool._timeJobs.load( std::memory_order_relaxed ) || Trace::Enabled() )
+            RunTimedJob( d, group.func, group.data + group.dataSize * d.jobIndex, group.traceName, group.traceIndex );
+        else
+            group.func( group.data + group.dataSize * d.jobIndex );
+
+        // Finished job. The last one wakes the dispatcher, if it's gone to sleep.
+        if( group.remaining.fetch_sub( 1, std::memory_order_seq_cst ) == 1 &&
+            group.parked.load( std::memory_order_seq_cst ) &&
+            group.parked.exchange( false, std::memory_order_seq_cst ) )
+        {
+            group.signal.Release();
+        }
     }
 }
 
+//-----------------------------------------------------------
+void ThreadPool::RunTimedJob( ThreadData& d, JobFunc func, void* data, const char* traceName, int traceIndex )
+{
+    const auto start = std::chrono::steady_clock::now();
+
+    func( data );
+
+    const auto   end     = std::chrono::steady_clock::now();
+    const uint64 elapsed = (uint64)std::chrono::duration_cast<std::chrono::nanoseconds>( end - start ).count();
+
+    // Only this thread writes it
+    if( d.pool->_timeJobs.load( std::memory_order_relaxed ) )
+        d.busyTime.store( d.busyTime.load( std::memory_order_relaxed ) + elapsed, std::memory_order_relaxed );
+
+    // The job may have been dispatched before tracing was enabled
+    if( Trace::Enabled() && traceName )
+        Trace::Record( traceName, traceIndex, start, end );
+}
+
 //-----------------------------------------------------------
 void ThreadPool::GreedyThreadRunner( void* tParam )
 {
@@ -183,6 +410,10 @@ void ThreadPool::GreedyThreadRunner( void* tParam )
 
     if( !pool._disableAffinity )
         SysHost::SetCurrentThreadAffinityCpuId( d.cpuId );
+    else
+        SysHost::SetCurrentThreadProcessorGroup( d.cpuId );
+
+    Trace::NameThread( "pool", d.index );
 
     for( ;; )
     {
@@ -210,11 +441,363 @@ void ThreadPool::GreedyThreadRunner( void* tParam )
                 ASSERT( pool._jobFunc );
 
                 // We acquired the job, run it
-                pool._jobFunc( pool._jobData + pool._jobDataSize * jobIndex );
+                if( pool._timeJobs.load( std::memory_order_relaxed ) || Trace::Enabled() )
+                    RunTimedJob( d, pool._jobFunc, pool._jobData + pool._jobDataSize * jobIndex, pool._jobTraceName, pool._jobTraceIndex );
+                else
+                    pool._jobFunc( pool._jobData + pool._jobDataSize * jobIndex );
             }
         }
 
         // Finished jobs, or there were no jobs to run,
         pool._poolSignal.Release();
     }
-}
\ No newline at end of file
+}
+
+//-----------------------------------------------------------
+void ThreadPool::DispatchStealing( JobFunc func, byte* data, uint count, size_t dataSize )
+{
+    ASSERT( count );
+
+    TaskHandle* tasks = new TaskHandle[count];
+
+    for( uint i = 0; i < count; i++ )
+        tasks[i] = Submit( func, data + dataSize * i );
+
+    WaitAll( tasks, count );
+
+    delete[] tasks;
+}
+
+//-----------------------------------------------------------
+TaskHandle ThreadPool::Submit( JobFunc func, void* data, const TaskHandle* deps, uint depCount )
+{
+    ASSERT( func );
+    ASSERT( _mode == Mode::Stealing );
+    ASSERT( depCount == 0 || deps );
+
+    if( depCount > BB_TASK_MAX_DEPS )
+        Fatal( "A task may only have up to %u dependencies.", BB_TASK_MAX_DEPS );
+
+    PoolTask* task = new PoolTask();
+    task->func = func;
+    task->data = data;
+    task->refCount   .store( 2, std::memory_order_relaxed );    // One for the handle, one until it has run
+    task->pendingDeps.store( depCount + 1, std::memory_order_relaxed );
+    task->successors .store( nullptr, std::memory_order_relaxed );
+    task->waiter     .store( nullptr, std::memory_order_relaxed );
+    task->done       .store( false, std::memory_order_relaxed );
+
+    for( uint i = 0; i < depCount; i++ )
+    {
+        PoolTask* dep = deps[i]._task;
+        ASSERT( dep );
+
+        TaskEdge& edge = task->edges[i];
+        edge.successor = task;
+
+        TaskEdge* head = dep->successors.load( std::memory_order_acquire );
+
+        for( ;; )
+        {
+            // Already done, so there's nothing to wait on
+            if( head == TASK_DONE_EDGE )
+            {
+                task->pendingDeps.fetch_sub( 1, std::memory_order_acq_rel );
+                break;
+            }
+
+            edge.next = head;
+
+            if( dep->successors.compare_exchange_weak( head, &edge, std::memory_order_acq_rel, std::memory_order_acquire ) )
+                break;
+        }
+    }
+
+    // Drop the submission's own count. If all dependencies are already done, the task is ready.
+    if( task->pendingDeps.fetch_sub( 1, std::memory_order_acq_rel ) == 1 )
+        Schedule( task );
+
+    return TaskHandle( task );
+}
+
+//-----------------------------------------------------------
+void ThreadPool::Wait( const TaskHandle& handle )
+{
+    PoolTask* task = handle._task;
+    ASSERT( task );
+
+    if( task->done.load( std::memory_order_acquire ) )
+        return;
+
+    // Our threads help out with other tasks, so that they can't deadlock waiting on each other
+    ThreadData* worker = CurrentWorker();
+
+    if( worker )
+    {
+        while( !task->done.load( std::memory_order_acquire ) )
+        {
+            PoolTask* other = FindTask( worker );
+
+            if( other )
+                RunTask( other );
+            else
+                std::this_thread::yield();
+        }
+
+        return;
+    }
+
+    // Other threads block. Only one of them at a time can register as the task's waiter, the others yield.
+    Semaphore  signal;
+    Semaphore* expected = nullptr;
+
+    if( task->waiter.compare_exchange_strong( expected, &signal, std::memory_order_acq_rel, std::memory_order_acquire ) )
+    {
+        signal.Wait();
+        ASSERT( task->done.load( std::memory_order_acquire ) );
+        return;
+    }
+
+    while( !task->done.load( std::memory_order_acquire ) )
+        std::this_thread::yield();
+}
+
+//-----------------------------------------------------------
+void ThreadPool::WaitAll( const TaskHandle* tasks, uint count )
+{
+    for( uint i = 0; i < count; i++ )
+        Wait( tasks[i] );
+}
+
+//-----------------------------------------------------------
+ThreadPool::ThreadData* ThreadPool::CurrentWorker()
+{
+    ThreadData* worker = (ThreadData*)_currentWorker;
+    return worker && worker->pool == this ? worker : nullptr;
+}
+
+//-----------------------------------------------------------
+void ThreadPool::Schedule( PoolTask* task )
+{
+    ThreadData* worker = CurrentWorker();
+
+    if( !worker || !worker->tasks->Push( task ) )
+    {
+        std::lock_guard<std::mutex> lock( _sharedLock );
+        _sharedTasks.push_back( task );
+        _sharedTaskCount.fetch_add( 1, std::memory_order_seq_cst );
+    }
+
+    WakeThread();
+}
+
+//-----------------------------------------------------------
+void ThreadPool::WakeThread()
+{
+    // Pairs with the fence in StealingThreadRunner(), so that either
+    // the thread sees the new task before sleeping, or we see it sleeping.
+    std::atomic_thread_fence( std::memory_order_seq_cst );
+
+    if( _sleepingThreads.load( std::memory_order_seq_cst ) > 0 )
+        _taskSignal.Release();
+}
+
+//-----------------------------------------------------------
+void ThreadPool::RunTask( PoolTask* task )
+{
+    task->func( task->data );
+
+    task->done.store( true, std::memory_order_release );
+
+    // Schedule the successors that no longer wait on anything
+    TaskEdge* edge = task->successors.exchange( TASK_DONE_EDGE, std::memory_order_acq_rel );
+
+    while( edge )
+    {
+        // The successor may run, and free its edges, as soon as its count reaches 0
+        TaskEdge* next      = edge->next;
+        PoolTask* successor = edge->successor;
+
+        if( successor->pendingDeps.fetch_sub( 1, std::memory_order_acq_rel ) == 1 )
+            Schedule( successor );
+
+        edge = next;
+    }
+
+    Semaphore* waiter = task->waiter.exchange( TASK_DONE_WAITER, std::memory_order_acq_rel );
+    if( waiter )
+        waiter->Release();
+
+    ReleaseTask( task );
+}
+
+//-----------------------------------------------------------
+PoolTask* ThreadPool::PopSharedTask()
+{
+    if( _sharedTaskCount.load( std::memory_order_acquire ) == 0 )
+        return nullptr;
+
+    std::lock_guard<std::mutex> lock( _sharedLock );
+
+    if( _sharedTasks.empty() )
+        return nullptr;
+
+    PoolTask* task = _sharedTasks.front();
+    _sharedTasks.pop_front();
+    _sharedTaskCount.fetch_sub( 1, std::memory_order_release );
+
+    return task;
+}
+
+//-----------------------------------------------------------
+PoolTask* ThreadPool::FindTask( ThreadData* worker )
+{
+    // Our own newest task first, as its data is likely still in cache
+    PoolTask* task = worker->tasks->Pop();
+    if( task )
+        return task;
+
+    task = PopSharedTask();
+    if( task )
+        return task;
+
+    // Steal the oldest task of another thread, starting from a random one
+    uint32 r = worker->rng;
+    r ^= r << 13; r ^= r >> 17; r ^= r << 5;
+    worker->rng = r;
+
+    const uint start = r % _threadCount;
+
+    for( uint i = 0; i < _threadCount; i++ )
+    {
+        const uint victim = ( start + i ) % _threadCount;
+
+        if( victim == (uint)worker->index )
+            continue;
+
+        task = _threadData[victim].tasks->Steal();
+        if( task )
+            return task;
+    }
+
+    return nullptr;
+}
+
+//-----------------------------------------------------------
+bool ThreadPool::HasTasks()
+{
+    if( _sharedTaskCount.load( std::memory_order_seq_cst ) > 0 )
+        return true;
+
+    for( uint i = 0; i < _threadCount; i++ )
+    {
+        if( !_threadData[i].tasks->IsEmpty() )
+            return true;
+    }
+
+    return false;
+}
+
+//-----------------------------------------------------------
+void ThreadPool::StealingThreadRunner( void* tParam )
+{
+    ASSERT( tParam );
+
+    ThreadData& d    = *(ThreadData*)tParam;
+    ThreadPool& pool = *d.pool;
+
+    if( !pool._disableAffinity )
+        SysHost::SetCurrentThreadAffinityCpuId( d.cpuId );
+    else
+        SysHost::SetCurrentThreadProcessorGroup( d.cpuId );
+
+    Trace::NameThread( "pool", d.index );
+
+    _currentWorker = &d;
+
+    for( ;; )
+    {
+        if( pool._exitSignal.load( std::memory_order_acquire ) )
+            return;
+
+        PoolTask* task = pool.FindTask( &d );
+
+        if( task )
+        {
+            pool.RunTask( task );
+            continue;
+        }
+
+        // Nothing to do, go to sleep. But check once more after announcing
+        // it, as a task may have been scheduled while we were looking.
+        pool._sleepingThreads.fetch_add( 1, std::memory_order_seq_cst );
+        std::atomic_thread_fence( std::memory_order_seq_cst );
+
+        if( !pool.HasTasks() && !pool._exitSignal.load( std::memory_order_acquire ) )
+            pool._taskSignal.Wait();
+
+        pool._sleepingThreads.fetch_sub( 1, std::memory_order_seq_cst );
+    }
+}
+
+//-----------------------------------------------------------
+TaskHandle::TaskHandle( const TaskHandle& other )
+    : _task( other._task )
+{
+    if( _task )
+        _task->refCount.fetch_add( 1, std::memory_order_relaxed );
+}
+
+//-----------------------------------------------------------
+TaskHandle::TaskHandle( TaskHandle&& other )
+    : _task( other._task )
+{
+    other._task = nullptr;
+}
+
+//-----------------------------------------------------------
+TaskHandle::~TaskHandle()
+{
+    Reset();
+}
+
+//-----------------------------------------------------------
+TaskHandle& TaskHandle::operator=( const TaskHandle& other )
+{
+    if( other._task )
+        other._task->refCount.fetch_add( 1, std::memory_order_relaxed );
+
+    Reset();
+    _task = other._task;
+
+    return *this;
+}
+
+//-----------------------------------------------------------
+TaskHandle& TaskHandle::operator=( TaskHandle&& other )
+{
+    if( this != &other )
+    {
+        Reset();
+        _task       = other._task;
+        other._task = nullptr;
+    }
+
+    return *this;
+}
+
+//-----------------------------------------------------------
+bool TaskHandle::IsDone() const
+{
+    return _task && _task->done.load( std::memory_order_acquire );
+}
+
+//-----------------------------------------------------------
+void TaskHandle::Reset()
+{
+    if( _task )
+    {
+        ReleaseTask( _task );
+        _task = nullptr;
+    }
+}
@@ -3,9 +3,57 @@
 #include "./Semaphore.h"
 #include "Thread.h"
 #include <atomic>
+#include <mutex>
+#include <deque>
+#include <algorithm>
 
 typedef void (*JobFunc)( void* data );
 
+// Default time, in microseconds, that idle threads of a Fixed pool spin waiting
+// for the next job before they go to sleep. Also how long RunJob() spins
+// waiting for the jobs to finish. Pools with more threads than there are CPUs don't spin.
+#define BB_THREAD_POOL_SPIN_TIME_US 50
+
+// Maximum number of tasks a task may depend on
+#define BB_TASK_MAX_DEPS    8
+
+// Tasks each worker can hold in its own deque.
+// Tasks that don't fit go to the pool's shared queue.
+#define BB_TASK_DEQUE_SIZE  4096
+
+struct PoolTask;
+template<typename T, uint32 Capacity> class TaskDeque;
+
+///
+/// Waitable reference to a task submitted to a ThreadPool.
+/// The task is freed once it has run and its last handle is gone.
+///
+class TaskHandle
+{
+    friend class ThreadPool;
+public:
+    inline TaskHandle() {}
+    TaskHandle( const TaskHandle& other );
+    TaskHandle( TaskHandle&& other );
+    ~TaskHandle();
+
+    TaskHandle& operator=( const TaskHandle& other );
+    TaskHandle& operator=( TaskHandle&& other );
+
+    inline bool IsValid() const { return _task != nullptr; }
+
+    // True once the task has run, and its continuations have been scheduled.
+    bool IsDone() const;
+
+    void Reset();
+
+private:
+    inline explicit TaskHandle( PoolTask* task ) : _task( task ) {}
+
+private:
+    PoolTask* _task = nullptr;
+};
+
 ///
 /// Used for running parallel jobs.
 ///
@@ -15,9 +63,16 @@ public:
     enum class Mode
     {
         Fixed  = 0, // Only can run as many jobs as we have threads.
-        Greedy = 1  // Can run more jobs that we have threads.
+                    // Idle threads spin for a while before sleeping, so that
+                    // back-to-back jobs are dispatched without a kernel round trip.
+        Greedy = 1, // Can run more jobs that we have threads.
                     // Threads will continue to process jobs as long 
                     // as there are jobs available.
+        Stealing = 2 // Runs tasks, which may depend on each other.
+                     // Each thread has its own deque of tasks, and idle
+                     // threads steal from the others. RunJob() works as in Greedy mode,
+                     // so jobs that wait on each other (ie. at a barrier) may only
+                     // be run while no other task holds any of the pool's threads.
     };
 
     ThreadPool( uint threadCount, Mode mode = Mode::Fixed, bool disableAffinity = false );
@@ -28,32 +83,162 @@ public:
     template<typename T>
     inline void RunJob( void (*TJobFunc)( T* ), T* data, uint count );
 
-    inline uint ThreadCount() { return _threadCount; }
+    inline uint ThreadCount() const { return _threadCount; }
+
+    // Sets how long idle threads spin waiting for jobs, in microseconds. 0 disables spinning.
+    // Only used in Fixed mode.
+    inline void SetSpinTime( uint microseconds ) { _spinTime.store( microseconds, std::memory_order_relaxed ); }
+
+    // When enabled, each thread adds up the time it spends running jobs, which ThreadBusyTime() returns.
+    // Only used in Fixed and Greedy modes, which also trace their jobs when tracing is enabled (see Trace),
+    // named after the trace scope of the thread that dispatched them.
+    inline void SetJobTiming( bool enabled ) { _timeJobs.store( enabled, std::memory_order_relaxed ); }
+
+    // Nanoseconds the given thread has spent running jobs while job timing was enabled
+    inline uint64 ThreadBusyTime( uint threadIndex ) const { ASSERT( threadIndex < _threadCount ); return _threadData[threadIndex].busyTime.load( std::memory_order_relaxed ); }
+
+    // CPU the given thread is pinned to, unless affinity is disabled
+    inline uint ThreadCpuId( uint threadIndex ) const { ASSERT( threadIndex < _threadCount ); return _threadData[threadIndex].cpuId; }
+
+    // Number of leading threads, [0, CoreThreadCount()), that run on physical cores of their own,
+    // rather than sharing them with SMT siblings. Memory-bound jobs may not want any more threads.
+    inline uint CoreThreadCount() const { return _coreThreadCount; }
+
+    ///
+    /// NUMA. Threads are grouped by the node of the CPU they are pinned to.
+    /// Pools without CPU affinity, or on single-node systems, have a single node.
+    /// In Fixed mode job i runs on thread i, so jobs that split their work by index
+    /// work over the slices of NumaPolicy::Partitioned buffers placed on their own node.
+    ///
+    inline uint NodeCount() const { return _nodeCount; }
+
+    // Node of the given thread
+    inline uint ThreadNode( uint threadIndex ) const { ASSERT( threadIndex < _threadCount ); return _threadData[threadIndex].node; }
+
+    ///
+    /// Parallel algorithms. These have no bound on the thread count,
+    /// and split the work themselves, so that jobs don't have to.
+    ///
+    // Runs body( begin, end, threadId ) over the ranges of [0, count).
+    // With a chunkSize of 0, each thread gets a single contiguous range, ordered by thread id.
+    // Otherwise the range is split in chunks of chunkSize, handed out to the threads as they are free.
+    template<typename TBody>
+    inline void ParallelFor( uint64 count, uint64 chunkSize, TBody body );
+
+    // Runs body( begin, end, T& acc ) over the ranges of [0, count), as with ParallelFor().
+    // Each thread's accumulator starts out as identity. They are then combined
+    // with combine( T& acc, const T& other ), in thread order. When using chunks,
+    // combine must be commutative, as the ranges of each thread are not contiguous.
+    template<typename T, typename TBody, typename TCombine>
+    inline T ParallelReduce( uint64 count, uint64 chunkSize, const T& identity, TBody body, TCombine combine );
+
+    // Exclusive prefix sum: out[i] is the sum of in[0..i-1]. Returns the sum of all of in.
+    // in and out may be the same buffer.
+    template<typename T>
+    inline T ParallelPrefixSum( const T* in, T* out, uint64 count );
+
+    ///
+    /// Task API. Only for pools in Stealing mode.
+    ///
+    // Queues a task, which runs once all of its dependencies are done, and returns right away.
+    // Tasks submitted from within a task go to the front of its thread's deque.
+    TaskHandle Submit( JobFunc func, void* data, const TaskHandle* deps = nullptr, uint depCount = 0 );
+
+    template<typename T>
+    inline TaskHandle Submit( void (*TJobFunc)( T* ), T* data, const TaskHandle* deps = nullptr, uint depCount = 0 );
+
+    // Queues a continuation, which runs once the given task is done.
+    inline TaskHandle Then( const TaskHandle& task, JobFunc func, void* data ) { return Submit( func, data, &task, 1 ); }
+
+    // Waits until the task is done.
+    // When called from within a task, the thread runs other tasks while it waits.
+    void Wait( const TaskHandle& task );
+
+    void WaitAll( const TaskHandle* tasks, uint count );
+
 private:
 
-    void DispatchFixed( JobFunc func, byte* data, uint count, size_t dataSize );
+    template<typename TBody>
+    struct ParallelForJob
+    {
+        TBody*               body;
+        std::atomic<uint64>* nextChunk;
+        uint64               count;
+        uint64               chunkSize;
+        uint                 id;
+        uint                 threadCount;
+
+        static void Run( ParallelForJob* job );
+    };
+
+    // Fixed mode job dispatched to the pool
+    struct JobGroup
+    {
+        JobFunc           func;
+        byte*             data;
+        size_t            dataSize;
+        const char*       traceName  = nullptr; // Names the jobs when tracing
+        int               traceIndex = -1;
+
+        alignas( 64 )
+        std::atomic<uint> remaining = 0;        // Jobs still running
+        std::atomic<bool> parked    = false;    // Set while the dispatching thread sleeps on signal
+        Semaphore         signal;
+    };
+
+    void DispatchFixed( JobGroup& group, JobFunc func, byte* data, uint count, size_t dataSize );
     void DispatchGreedy( JobFunc func, byte* data, uint count, size_t dataSize );
+    void DispatchStealing( JobFunc func, byte* data, uint count, size_t dataSize );
 
     static void FixedThreadRunner( void* tParam );
     static void GreedyThreadRunner( void* tParam );
+    static void StealingThreadRunner( void* tParam );
+
+    typedef TaskDeque<PoolTask, BB_TASK_DEQUE_SIZE> WorkerDeque;
 
     struct ThreadData
     {
-        ThreadPool* pool;
-        int         index;
-        uint        cpuId;     // CPU Id affinity
-        Semaphore   jobSignal; // Used for fixed mode
+        // Fixed mode. Each thread waits on its own cache line.
+        alignas( 64 )
+        std::atomic<uint64> jobEpoch;   // Set to the pool's job epoch when the thread has a job to run
+        std::atomic<bool>   parked;     // Set while the thread sleeps on jobSignal
+        JobGroup*           group;      // Job group of the job to run, and the job's index in it.
+        uint                jobIndex;   // (Set before jobEpoch.)
+
+        ThreadPool*  pool;
+        int          index;
+        uint         cpuId;     // CPU Id affinity
+        uint         node;      // NUMA node of cpuId
+        Semaphore    jobSignal; // Used for fixed mode
+        WorkerDeque* tasks;     // Used for stealing mode
+        uint32       rng;       // Picks the first thread to steal from
+        std::atomic<uint64> busyTime;   // Nanoseconds spent running jobs, if timed
     };
 
+    // Runs a job while its time is added to the thread's busy time, and/or traced
+    static void RunTimedJob( ThreadData& d, JobFunc func, void* data, const char* traceName, int traceIndex );
+
+    void      Schedule( PoolTask* task );
+    void      RunTask( PoolTask* task );
+    PoolTask* FindTask( ThreadData* worker );
+    PoolTask* PopSharedTask();
+    bool      HasTasks();
+    void      WakeThread();
+
+    // The calling thread's data, if it's one of this pool's threads
+    ThreadData* CurrentWorker();
+
 private:
     uint              _threadCount;         // Reserved number of thread running jobs
     Mode              _mode;
     bool              _disableAffinity;
+    uint              _coreThreadCount = 0;     // Leading threads with a physical core to themselves
     Thread*           _threads;
     ThreadData*       _threadData;
     Semaphore         _jobSignal;           // Used to signal threads that there's a new job
     Semaphore         _poolSignal;          // Used to signal the pool that a thread has finished its job
     std::atomic<bool> _exitSignal = false;  // Used to signal threads to exit
+    std::atomic<bool> _timeJobs   = false;  // Threads add up their job times
 
 
     // Current job group
@@ -62,6 +247,22 @@ private:
     JobFunc           _jobFunc     = nullptr;
     byte*             _jobData     = nullptr;
     size_t            _jobDataSize = 0;
+    const char*       _jobTraceName  = nullptr;
+    int               _jobTraceIndex = -1;
+
+    // Fixed mode
+    std::atomic<uint64> _jobEpoch  = 0;            // Incremented by each dispatch
+    std::atomic<uint>   _spinTime  = BB_THREAD_POOL_SPIN_TIME_US;
+    JobGroup            _poolGroup;                // Used by RunJob()
+
+    uint              _nodeCount = 1;              // Nodes the threads are grouped by
+
+    // Stealing mode
+    std::mutex             _sharedLock;             // Guards _sharedTasks
+    std::deque<PoolTask*>  _sharedTasks;            // Tasks submitted from outside the pool, or overflowing a deque
+    std::atomic<uint>      _sharedTaskCount = 0;
+    std::atomic<uint>      _sleepingThreads = 0;
+    Semaphore              _taskSignal;             // Wakes sleeping threads when tasks are scheduled
 };
 
 
@@ -70,4 +271,138 @@ template<typename T>
 inline void ThreadPool::RunJob( void (*TJobFunc)( T* ), T* data, uint count )
 {
     RunJob( (JobFunc)TJobFunc, data, count, sizeof( T ) );
-}
\ No newline at end of file
+}
+
+//-----------------------------------------------------------
+template<typename T>
+inline TaskHandle ThreadPool::Submit( void (*TJobFunc)( T* ), T* data, const TaskHandle* deps, uint depCount )
+{
+    return Submit( (JobFunc)TJobFunc, data, deps, depCount );
+}
+
+//-----------------------------------------------------------
+template<typename TBody>
+void ThreadPool::ParallelForJob<TBody>::Run( ParallelForJob* job )
+{
+    const uint64 count = job->count;
+
+    if( job->chunkSize == 0 )
+    {
+        const uint64 begin = count * job->id       / job->threadCount;
+        const uint64 end   = count * (job->id + 1) / job->threadCount;
+
+        if( begin < end )
+            (*job->body)( begin, end, job->id );
+
+        return;
+    }
+
+    const uint64 chunkSize = job->chunkSize;
+
+    for( ;; )
+    {
+        const uint64 chunk = job->nextChunk->fetch_add( 1, std::memory_order_relaxed );
+        const uint64 begin = chunk * chunkSize;
+
+        if( begin >= count )
+            break;
+
+        (*job->body)( begin, std::min( begin + chunkSize, count ), job->id );
+    }
+}
+
+//-----------------------------------------------------------
+template<typename TBody>
+inline void ThreadPool::ParallelFor( uint64 count, uint64 chunkSize, TBody body )
+{
+    if( count == 0 )
+        return;
+
+    // No more threads than there are ranges to run
+    const uint64 rangeCount  = chunkSize ? ( count + chunkSize - 1 ) / chunkSize : count;
+    const uint   threadCount = (uint)std::min( (uint64)_threadCount, rangeCount );
+
+    ParallelForJob<TBody>* jobs = new ParallelForJob<TBody>[threadCount];
+    std::atomic<uint64> nextChunk = 0;
+
+    for( uint i = 0; i < threadCount; i++ )
+    {
+        auto& job = jobs[i];
+
+        job.body        = &body;
+        job.nextChunk   = &nextChunk;
+        job.count       = count;
+        job.chunkSize   = chunkSize;
+        job.id          = i;
+        job.threadCount = threadCount;
+    }
+
+    RunJob( ParallelForJob<TBody>::Run, jobs, threadCount );
+
+    delete[] jobs;
+}
+
+//-----------------------------------------------------------
+template<typename T, typename TBody, typename TCombine>
+inline T ThreadPool::ParallelReduce( uint64 count, uint64 chunkSize, const T& identity, TBody body, TCombine combine )
+{
+    T* accumulators = new T[_threadCount];
+
+    for( uint i = 0; i < _threadCount; i++ )
+        accumulators[i] = identity;
+
+    ParallelFor( count, chunkSize, [&]( uint64 begin, uint64 end, uint id ) {
+        body( begin, end, accumulators[id] );
+    });
+
+    T result = identity;
+
+    for( uint i = 0; i < _threadCount; i++ )
+        combine( result, (const T&)accumulators[i] );
+
+    delete[] accumulators;
+    return result;
+}
+
+//-----------------------------------------------------------
+template<typename T>
+inline T ThreadPool::ParallelPrefixSum( const T* in, T* out, uint64 count )
+{
+    if( count == 0 )
+        return T( 0 );
+
+    const uint threadCount = (uint)std::min( (uint64)_threadCount, count );
+
+    // Sum each thread's range, then scan the sums to get where each range starts
+    T* offsets = new T[threadCount+1];
+
+    ParallelFor( count, 0, [=]( uint64 begin, uint64 end, uint id ) {
+        T sum = T( 0 );
+
+        for( uint64 i = begin; i < end; i++ )
+            sum += in[i];
+
+        offsets[id+1] = sum;
+    });
+
+    offsets[0] = T( 0 );
+    for( uint i = 0; i < threadCount; i++ )
+        offsets[i+1] += offsets[i];
+
+    // Same ranges, as they are split the same way
+    ParallelFor( count, 0, [=]( uint64 begin, uint64 end, uint id ) {
+        T sum = offsets[id];
+
+        for( uint64 i = begin; i < end; i++ )
+        {
+            const T v = in[i];
+            out[i] = sum;
+            sum += v;
+        }
+    });
+
+    const T total = offsets[threadCount];
+
+    delete[] offsets;
+    return total;
+}
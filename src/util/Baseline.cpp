@@ -0,0 +1,192 @@
+#include "Baseline.h"
+#include "util/Log.h"
+#include "Util.h"
+#include <cmath>
+
+// Two-sided 95% critical values of Student's t distribution, by degrees of freedom
+static const double TCritical95[] = {
+    0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+       2.201,  2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+       2.080,  2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+};
+
+//-----------------------------------------------------------
+static double TCritical( double degreesOfFreedom )
+{
+    const uint df = (uint)degreesOfFreedom;
+
+    if( df < 1 )
+        return TCritical95[1];
+
+    // Beyond 30, the normal distribution's is close enough
+    return df < sizeof( TCritical95 ) / sizeof( double ) ? TCritical95[df] : 1.960;
+}
+
+//-----------------------------------------------------------
+Baseline::Baseline( const char* config )
+    : _config( config )
+{}
+
+//-----------------------------------------------------------
+Baseline::Measurement Baseline::Measure( const char* name, const std::vector<double>& times )
+{
+    ASSERT( !times.empty() );
+
+    Measurement m;
+    m.name   = name;
+    m.runs   = (uint)times.size();
+    m.mean   = 0;
+    m.stdDev = 0;
+
+    for( const double t : times )
+        m.mean += t;
+
+    m.mean /= m.runs;
+
+    if( m.runs > 1 )
+    {
+        double sq = 0;
+        for( const double t : times )
+            sq += ( t - m.mean ) * ( t - m.mean );
+
+        m.stdDev = std::sqrt( sq / ( m.runs - 1 ) );
+    }
+
+    return m;
+}
+
+//-----------------------------------------------------------
+void Baseline::Set( const char* name, const std::vector<double>& times )
+{
+    const Measurement m = Measure( name, times );
+
+    for( Measurement& other : _measurements )
+    {
+        if( other.name == name )
+        {
+            other = m;
+            return;
+        }
+    }
+
+    _measurements.push_back( m );
+}
+
+//-----------------------------------------------------------
+const Baseline::Measurement* Baseline::Find( const char* name ) const
+{
+    for( const Measurement& m : _measurements )
+    {
+        if( m.name == name )
+            return &m;
+    }
+
+    return nullptr;
+}
+
+//-----------------------------------------------------------
+void Baseline::LogHeader()
+{
+    Log::Line( "  %-16s  %10s  %10s  %8s  %10s", "", "Base (s)", "Now (s)", "Change", "95% CI" );
+}
+
+//-----------------------------------------------------------
+Baseline::Result Baseline::Compare( const char* name, const std::vector<double>& times, double threshold ) const
+{
+    const Measurement* base = Find( name );
+
+    if( !base )
+    {
+        Log::Line( "  %-16s  not in the baseline", name );
+        return Result::Missing;
+    }
+
+    const Measurement cur = Measure( name, times );
+
+    // Welch's confidence interval of the difference of the means.
+    // Measurements of a single run have no variance, and are only compared to the threshold.
+    const double var0   = base->stdDev * base->stdDev / base->runs;
+    const double var1   = cur.stdDev   * cur.stdDev   / cur.runs;
+    const double stdErr = std::sqrt( var0 + var1 );
+
+    double margin = 0;
+    if( stdErr > 0 && base->runs > 1 && cur.runs > 1 )
+    {
+        const double df = ( var0 + var1 ) * ( var0 + var1 ) /
+                          ( var0 * var0 / ( base->runs - 1 ) + var1 * var1 / ( cur.runs - 1 ) );
+
+        margin = TCritical( df ) * stdErr;
+    }
+
+    const double diff     = cur.mean - base->mean;
+    const double relative = diff / base->mean;
+
+    Result result = Result::Same;
+
+    if( std::abs( relative ) > threshold && std::abs( diff ) > margin )
+        result = diff > 0 ? Result::Slower : Result::Faster;
+
+    const char* verdict = result == Result::Slower ? "REGRESSED" :
+                          result == Result::Faster ? "faster"    : "ok";
+
+    Log::Line( "  %-16s  %10.4lf  %10.4lf  %+7.2lf%%  +/-%6.2lf%%  %s",
+               name, base->mean, cur.mean, relative * 100.0, margin / base->mean * 100.0, verdict );
+
+    return result;
+}
+
+//-----------------------------------------------------------
+bool Baseline::Load( const char* path )
+{
+    FILE* file = fopen( path, "r" );
+    if( !file )
+        return false;
+
+    char config[256];
+    if( fscanf( file, "config %255s", config ) != 1 )
+    {
+        fclose( file );
+        Log::Error( "Warning: Invalid baseline file '%s'.", path );
+        return false;
+    }
+
+    FatalIf( _config != config, "The baseline '%s' was recorded with '%s', but this run is '%s'.",
+             path, config, _config.c_str() );
+
+    _measurements.clear();
+
+    char        name[64];
+    Measurement m;
+
+    while( fscanf( file, "%63s %u %lf %lf", name, &m.runs, &m.mean, &m.stdDev ) == 4 )
+    {
+        if( m.runs < 1 || !( m.mean > 0 ) )
+            continue;
+
+        m.name = name;
+        _measurements.push_back( m );
+    }
+
+    fclose( file );
+    return true;
+}
+
+//-----------------------------------------------------------
+bool Baseline::Save( const char* path ) const
+{
+    FILE* file = fopen( path, "w" );
+    if( !file )
+    {
+        const int err = errno;
+        Log::Error( "Warning: Failed to write the baseline '%s' with error %d.", path, err );
+        return false;
+    }
+
+    fprintf( file, "config %s\n", _config.c_str() );
+
+    for( const Measurement& m : _measurements )
+        fprintf( file, "%s %u %.9lf %.9lf\n", m.name.c_str(), m.runs, m.mean, m.stdDev );
+
+    fclose( file );
+    return true;
+}
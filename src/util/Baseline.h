@@ -0,0 +1,65 @@
+#pragma once
+#include <vector>
+#include <string>
+
+/**
+ * A per-machine file of benchmark timings, against which later runs are compared to catch
+ * performance regressions, ie. after a compiler or kernel upgrade.
+ *
+ * Each measurement is the times of its repeated runs, kept as their count, mean and standard deviation.
+ * A measurement regresses if its mean is slower than the baseline's by more than the threshold,
+ * and the 95% confidence interval of the difference of the means (Welch) is above zero, so that
+ * noisy measurements are not flagged on a single slow run.
+ *
+ * The file is text, with a line per measurement: <name> <runs> <mean> <stddev>, in seconds.
+ * Its first line holds the configuration the timings were taken with, ie. the scale and thread counts,
+ * as the timings of different configurations can't be compared.
+ */
+class Baseline
+{
+public:
+    struct Measurement
+    {
+        std::string name;
+        uint        runs;
+        double      mean;       // Seconds
+        double      stdDev;     // Sample standard deviation, in seconds
+    };
+
+    enum class Result
+    {
+        Missing = 0,    // Not in the baseline
+        Same,           // Within the threshold, or not significant
+        Faster,
+        Slower          // Regressed
+    };
+
+    // The configuration must have no whitespace
+    Baseline( const char* config );
+
+    // Returns false if the file does not exist or can't be read.
+    // Fatal if it was recorded with a different configuration.
+    bool Load( const char* path );
+    bool Save( const char* path ) const;
+
+    // Adds or replaces a measurement with the times of its runs
+    void Set( const char* name, const std::vector<double>& times );
+
+    // Compares the times of the runs of a measurement against the baseline, and logs the result.
+    // threshold is the relative slowdown tolerated, ie. 0.05 for 5%.
+    Result Compare( const char* name, const std::vector<double>& times, double threshold ) const;
+
+    // Logs the header of the lines logged by Compare()
+    static void LogHeader();
+
+    inline bool Empty() const { return _measurements.empty(); }
+
+    static Measurement Measure( const char* name, const std::vector<double>& times );
+
+private:
+    const Measurement* Find( const char* name ) const;
+
+private:
+    std::string              _config;
+    std::vector<Measurement> _measurements;
+};
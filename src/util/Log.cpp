@@ -1,4 +1,19 @@
 #include "Log.h"
+#include "threading/Thread.h"
+#include "SysHost.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <vector>
+
+// Size of each thread's ring. Lines that don't fit in half of it are written synchronously.
+#define BB_LOG_RING_SIZE        ( 64ull * 1024 )
+
+// How often the background thread drains the rings, if no ring fills up before
+#define BB_LOG_DRAIN_INTERVAL   10
 
 
 FILE* Log::_outStream = nullptr;
@@ -6,6 +21,170 @@ FILE* Log::_errStream = nullptr;
 
 bool Log::_verbose = false;
 
+namespace {
+
+struct LogRecord
+{
+    uint64 sequence;        // Orders the records of all threads
+    int64  time;            // Microseconds since the epoch
+    uint32 size;            // Of the text following the record
+    uint32 kind;
+};
+
+// Written by its thread only, and read by whoever holds the drain lock
+struct LogRing
+{
+    byte                buffer[BB_LOG_RING_SIZE];
+    std::atomic<uint64> head     = 0;           // Written up to, by its thread
+    std::atomic<uint64> tail     = 0;           // Read up to
+    std::atomic<uint64> dropped  = 0;           // Lines that did not fit
+    std::atomic<bool>   orphaned = false;       // Its thread has exited
+    uint32              id       = 0;
+
+    std::string         pendingLine[2];         // Partial lines written without a new line, for JSON output
+};
+
+// Marks its thread's ring as orphaned when the thread exits, so it's freed once drained
+struct LogRingOwner
+{
+    LogRing* ring = nullptr;
+
+    ~LogRingOwner()
+    {
+        if( ring )
+            ring->orphaned.store( true, std::memory_order_release );
+
+        ring = nullptr;
+    }
+};
+
+struct LogBatchEntry
+{
+    uint64   sequence;
+    int64    time;
+    LogRing* ring;
+    size_t   offset;        // Into the batch's text
+    uint32   size;
+    uint32   kind;
+};
+
+std::atomic<bool>          _async    = false;
+bool                       _json     = false;
+bool                       _running  = false;
+Thread*                    _thread   = nullptr;
+std::atomic<uint64>        _sequence = 0;
+
+std::mutex                 _ringsLock;  // Guards the list of rings, only taken when a thread first logs
+std::vector<LogRing*>      _rings;
+uint32                     _nextRingId = 0;
+
+std::mutex                 _drainLock;  // Taken by whoever drains the rings
+std::vector<LogBatchEntry> _batch;
+std::string                _batchText;
+std::string                _output;
+
+std::mutex                 _wakeLock;
+std::condition_variable    _wakeSignal;
+
+thread_local LogRingOwner  _threadRing;
+
+//-----------------------------------------------------------
+LogRing* GetThreadRing()
+{
+    if( !_threadRing.ring )
+    {
+        LogRing* ring = new LogRing();
+
+        std::lock_guard<std::mutex> lock( _ringsLock );
+        ring->id = _nextRingId++;
+        _rings.push_back( ring );
+
+        _threadRing.ring = ring;
+    }
+
+    return _threadRing.ring;
+}
+
+//-----------------------------------------------------------
+void CopyToRing( LogRing& ring, uint64 position, const void* src, size_t size )
+{
+    const size_t offset = (size_t)( position % BB_LOG_RING_SIZE );
+    const size_t first  = std::min( size, (size_t)BB_LOG_RING_SIZE - offset );
+
+    memcpy( ring.buffer + offset, src, first );
+    memcpy( ring.buffer, (const byte*)src + first, size - first );
+}
+
+//-----------------------------------------------------------
+void CopyFromRing( const LogRing& ring, uint64 position, void* dst, size_t size )
+{
+    const size_t offset = (size_t)( position % BB_LOG_RING_SIZE );
+    const size_t first  = std::min( size, (size_t)BB_LOG_RING_SIZE - offset );
+
+    memcpy( dst, ring.buffer + offset, first );
+    memcpy( (byte*)dst + first, ring.buffer, size - first );
+}
+
+//-----------------------------------------------------------
+inline uint64 RecordSize( size_t textSize )
+{
+    return ( sizeof( LogRecord ) + textSize + 7 ) & ~7ull;
+}
+
+//-----------------------------------------------------------
+int64 NowMicroseconds()
+{
+    return (int64)std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch() ).count();
+}
+
+//-----------------------------------------------------------
+void AppendJsonLine( std::string& out, const LogBatchEntry& entry, const char* text, size_t size )
+{
+    // Blank lines only space out the text output
+    if( size == 0 )
+        return;
+
+    static const char* Levels[] = { "info", "error", "verbose" };
+
+    const time_t seconds = (time_t)( entry.time / 1000000 );
+    const tm*    utc     = gmtime( &seconds );
+
+    char prefix[128];
+    snprintf( prefix, sizeof( prefix ), "{\"time\":\"%04d-%02d-%02dT%02d:%02d:%02d.%03dZ\",\"level\":\"%s\",\"thread\":%u,\"msg\":\"",
+        utc->tm_year + 1900, utc->tm_mon + 1, utc->tm_mday, utc->tm_hour, utc->tm_min, utc->tm_sec,
+        (int)( entry.time % 1000000 / 1000 ), Levels[entry.kind], entry.ring ? entry.ring->id : 0 );
+
+    out += prefix;
+
+    for( size_t i = 0; i < size; i++ )
+    {
+        const char c = text[i];
+
+        if( c == '"' || c == '\\' )
+        {
+            out += '\\';
+            out += c;
+        }
+        else if( c == '\t' )
+            out += "\\t";
+        else if( c == '\r' )
+            out += "\\r";
+        else if( (unsigned char)c < 0x20 )
+        {
+            char escaped[8];
+            snprintf( escaped, sizeof( escaped ), "\\u%04x", (unsigned)c );
+            out += escaped;
+        }
+        else
+            out += c;
+    }
+
+    out += "\"}\n";
+}
+
+}
+
 //-----------------------------------------------------------
 inline FILE* Log::GetOutStream()
 {
@@ -35,7 +214,7 @@ void Log::Write( const char* msg, ... )
 {
     va_list args;
     va_start( args, msg );
-    
+
     Write( msg, args );
 
     va_end( args );
@@ -46,7 +225,7 @@ void Log::WriteLine( const char* msg, ... )
 {
     va_list args;
     va_start( args, msg );
-    
+
     WriteLine( msg, args );
 
     va_end( args );
@@ -57,7 +236,7 @@ void Log::Line( const char* msg, ... )
 {
     va_list args;
     va_start( args, msg );
-    
+
     WriteLine( msg, args );
 
     va_end( args );
@@ -66,15 +245,13 @@ void Log::Line( const char* msg, ... )
 //-----------------------------------------------------------
 void Log::Write( const char* msg, va_list args )
 {
-    vfprintf( GetOutStream(), msg, args );
+    Append( Kind::Out, false, msg, args );
 }
 
 //-----------------------------------------------------------
 void Log::WriteLine( const char* msg, va_list args )
 {
-    FILE* stream = GetOutStream();
-    vfprintf( stream, msg, args );
-    fputc( '\n', stream );
+    Append( Kind::Out, true, msg, args );
 }
 
 //-----------------------------------------------------------
@@ -82,7 +259,7 @@ void Log::Error( const char* msg, ... )
 {
     va_list args;
     va_start( args, msg );
-    
+
     Error( msg, args );
 
     va_end( args );
@@ -93,7 +270,7 @@ void Log::WriteError( const char* msg, ... )
 {
     va_list args;
     va_start( args, msg );
-    
+
     WriteError( msg, args );
 
     va_end( args );
@@ -102,14 +279,13 @@ void Log::WriteError( const char* msg, ... )
 //-----------------------------------------------------------
 void Log::Error( const char* msg, va_list args )
 {
-    WriteError( msg, args );
-    fputc( '\n', GetErrStream() );
+    Append( Kind::Error, true, msg, args );
 }
 
 //-----------------------------------------------------------
 void Log::WriteError( const char* msg, va_list args )
 {
-    vfprintf( GetErrStream(), msg, args );
+    Append( Kind::Error, false, msg, args );
 }
 
 //-----------------------------------------------------------
@@ -117,13 +293,11 @@ void Log::Verbose( const char* msg, ...  )
 {
     if( !_verbose )
         return;
-    
+
     va_list args;
     va_start( args, msg );
-    
-    FILE* stream = GetErrStream();
-    vfprintf( stream, msg, args );
-    fputc( '\n', stream );
+
+    Append( Kind::Verbose, true, msg, args );
 
     va_end( args );
 }
@@ -136,16 +310,293 @@ void Log::VerboseWrite( const char* msg, ...  )
 
     va_list args;
     va_start( args, msg );
-    
-    vfprintf( GetErrStream(), msg, args );
+
+    Append( Kind::Verbose, false, msg, args );
 
     va_end( args );
 }
 
+//-----------------------------------------------------------
+void Log::Append( Kind kind, bool newLine, const char* msg, va_list args )
+{
+    if( !_async.load( std::memory_order_acquire ) )
+    {
+        FILE* stream = kind == Kind::Out ? GetOutStream() : GetErrStream();
+        vfprintf( stream, msg, args );
+
+        if( newLine )
+            fputc( '\n', stream );
+
+        return;
+    }
+
+    // Format it on the calling thread, on the stack if it fits
+    char        stackText[1024];
+    std::string heapText;
+    char*       text = stackText;
+
+    va_list argsCopy;
+    va_copy( argsCopy, args );
+    int length = vsnprintf( stackText, sizeof( stackText ) - 1, msg, argsCopy );
+    va_end( argsCopy );
+
+    if( length < 0 )
+        return;
+
+    if( (size_t)length >= sizeof( stackText ) - 1 )
+    {
+        heapText.resize( (size_t)length + 2 );
+        vsnprintf( &heapText[0], heapText.size() - 1, msg, args );
+        text = &heapText[0];
+    }
+
+    if( newLine )
+        text[length++] = '\n';
+
+    const uint64 recordSize = RecordSize( (size_t)length );
+
+    if( recordSize > BB_LOG_RING_SIZE / 2 )
+    {
+        // Too large for the ring: write it in order with what's already queued
+        std::lock_guard<std::mutex> lock( _drainLock );
+        fwrite( text, 1, (size_t)length, kind == Kind::Out ? GetOutStream() : GetErrStream() );
+        return;
+    }
+
+    LogRing& ring = *GetThreadRing();
+
+    const uint64 head = ring.head.load( std::memory_order_relaxed );
+    const uint64 tail = ring.tail.load( std::memory_order_acquire );
+
+    if( BB_LOG_RING_SIZE - ( head - tail ) < recordSize )
+    {
+        // Don't wait on the output, report the lines lost instead
+        ring.dropped.fetch_add( 1, std::memory_order_relaxed );
+        _wakeSignal.notify_one();
+        return;
+    }
+
+    LogRecord record;
+    record.sequence = _sequence.fetch_add( 1, std::memory_order_relaxed );
+    record.time     = NowMicroseconds();
+    record.size     = (uint32)length;
+    record.kind     = (uint32)kind;
+
+    CopyToRing( ring, head, &record, sizeof( record ) );
+    CopyToRing( ring, head + sizeof( record ), text, (size_t)length );
+
+    ring.head.store( head + recordSize, std::memory_order_release );
+
+    // Drain it early if it's filling up
+    if( head + recordSize - tail > BB_LOG_RING_SIZE / 2 )
+        _wakeSignal.notify_one();
+}
+
+//-----------------------------------------------------------
+void Log::Drain()
+{
+    std::lock_guard<std::mutex> lock( _drainLock );
+
+    std::vector<LogRing*> rings;
+    {
+        std::lock_guard<std::mutex> ringsLock( _ringsLock );
+        rings = _rings;
+    }
+
+    _batch.clear();
+    _batchText.clear();
+
+    std::vector<LogRing*> orphans;
+
+    for( LogRing* ring : rings )
+    {
+        // Read the orphaned flag first, as its last lines are written before it's set
+        const bool   orphaned = ring->orphaned.load( std::memory_order_acquire );
+        const uint64 head     = ring->head.load( std::memory_order_acquire );
+        uint64       tail     = ring->tail.load( std::memory_order_relaxed );
+
+        while( tail < head )
+        {
+            LogRecord record;
+            CopyFromRing( *ring, tail, &record, sizeof( record ) );
+
+            LogBatchEntry entry;
+            entry.sequence = record.sequence;
+            entry.time     = record.time;
+            entry.ring     = ring;
+            entry.offset   = _batchText.size();
+            entry.size     = record.size;
+            entry.kind     = record.kind;
+
+            _batchText.resize( entry.offset + record.size );
+            CopyFromRing( *ring, tail + sizeof( record ), &_batchText[entry.offset], record.size );
+
+            _batch.push_back( entry );
+            tail += RecordSize( record.size );
+        }
+
+        ring->tail.store( tail, std::memory_order_release );
+
+        const uint64 dropped = ring->dropped.exchange( 0, std::memory_order_relaxed );
+        if( dropped )
+        {
+            char text[128];
+            const int length = snprintf( text, sizeof( text ), "Warning: %llu log lines were dropped.\n", (unsigned long long)dropped );
+
+            LogBatchEntry entry;
+            entry.sequence = _sequence.fetch_add( 1, std::memory_order_relaxed );
+            entry.time     = NowMicroseconds();
+            entry.ring     = ring;
+            entry.offset   = _batchText.size();
+            entry.size     = (uint32)length;
+            entry.kind     = (uint32)Kind::Error;
+
+            _batchText.append( text, (size_t)length );
+            _batch.push_back( entry );
+        }
+
+        if( orphaned )
+            orphans.push_back( ring );
+    }
+
+    // Write them in the order they were logged, across threads
+    std::sort( _batch.begin(), _batch.end(), []( const LogBatchEntry& a, const LogBatchEntry& b ) {
+        return a.sequence < b.sequence;
+    });
+
+    FILE* stream = nullptr;
+    _output.clear();
+
+    for( const LogBatchEntry& entry : _batch )
+    {
+        FILE* entryStream = entry.kind == (uint32)Kind::Out ? GetOutStream() : GetErrStream();
+
+        // Write out runs of the same stream at once
+        if( entryStream != stream )
+        {
+            if( stream && !_output.empty() )
+                fwrite( _output.data(), 1, _output.size(), stream );
+
+            _output.clear();
+            stream = entryStream;
+        }
+
+        const char* text = _batchText.data() + entry.offset;
+
+        if( !_json )
+        {
+            _output.append( text, entry.size );
+            continue;
+        }
+
+        // Split it in lines, keeping the last partial line for the next entry of its thread
+        std::string& pending = entry.ring->pendingLine[entry.kind == (uint32)Kind::Out ? 0 : 1];
+
+        size_t start = 0;
+        for( size_t i = 0; i < entry.size; i++ )
+        {
+            if( text[i] != '\n' )
+                continue;
+
+            pending.append( text + start, i - start );
+            AppendJsonLine( _output, entry, pending.data(), pending.size() );
+            pending.clear();
+
+            start = i + 1;
+        }
+
+        pending.append( text + start, entry.size - start );
+    }
+
+    if( stream && !_output.empty() )
+        fwrite( _output.data(), 1, _output.size(), stream );
+
+    // Free the rings of threads that have exited, now that they're drained
+    if( !orphans.empty() )
+    {
+        std::lock_guard<std::mutex> ringsLock( _ringsLock );
+
+        for( LogRing* ring : orphans )
+        {
+            _rings.erase( std::find( _rings.begin(), _rings.end(), ring ) );
+            delete ring;
+        }
+    }
+}
+
+//-----------------------------------------------------------
+void Log::StartAsync( bool json )
+{
+    if( _async.load( std::memory_order_acquire ) )
+        return;
+
+    _json    = json;
+    _running = true;
+
+    _thread = new Thread();
+    _thread->Run( []( void* param ) {
+
+        (void)param;
+
+        SysHost::SetCurrentThreadQoS( ThreadQoS::IO );
+
+        // The I/O cores are reserved after the thread is started,
+        // so it moves to them once they are.
+        bool onIoCpu = false;
+
+        for( ;; )
+        {
+            if( !onIoCpu && SysHost::GetIoCpuCount() )
+                onIoCpu = SysHost::SetCurrentThreadIoAffinity();
+
+            {
+                std::unique_lock<std::mutex> lock( _wakeLock );
+                if( !_running )
+                    break;
+
+                _wakeSignal.wait_for( lock, std::chrono::milliseconds( BB_LOG_DRAIN_INTERVAL ) );
+            }
+
+            Log::Drain();
+        }
+    }, nullptr );
+
+    _async.store( true, std::memory_order_release );
+
+    static bool registered = false;
+    if( !registered )
+    {
+        registered = true;
+        atexit( Log::StopAsync );
+    }
+}
+
+//-----------------------------------------------------------
+void Log::StopAsync()
+{
+    if( !_async.exchange( false, std::memory_order_acq_rel ) )
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock( _wakeLock );
+        _running = false;
+        _wakeSignal.notify_one();
+    }
+
+    _thread->WaitForExit();
+    delete _thread;
+    _thread = nullptr;
+
+    // Lines queued while it was stopping
+    Drain();
+}
 
 //-----------------------------------------------------------
 void Log::Flush()
 {
+    if( _async.load( std::memory_order_acquire ) )
+        Drain();
+
     fflush( GetOutStream() );
 }
 
@@ -153,5 +604,8 @@ void Log::Flush()
 //-----------------------------------------------------------
 void Log::FlushError()
 {
+    if( _async.load( std::memory_order_acquire ) )
+        Drain();
+
     fflush( GetErrStream() );
 }
@@ -1,5 +1,13 @@
 #pragma once
 
+/**
+ * Lines are written straight to stdout/stderr, until StartAsync() is called.
+ * From then on, each thread formats its lines into its own lock-free ring buffer,
+ * and a background thread drains the rings in batches, in the order they were written,
+ * so that logging never waits on the terminal or on other threads.
+ * If a thread's ring is full, its lines are dropped and their count is reported instead.
+ * Flush() drains the rings on the calling thread, and must be called on fatal paths.
+ */
 class Log
 {
     static bool _verbose;
@@ -18,13 +26,28 @@ public:
     static void WriteError( const char* msg, va_list args );
 
     inline static void SetVerbose( bool enabled ) { _verbose = enabled; }
-    
+
     static void Verbose( const char* msg, ...  );
     static void VerboseWrite( const char* msg, ...  );
 
     static void Flush();
     static void FlushError();
+
+    // Starts the background thread, and formats lines as JSON objects, one per line, if json is set.
+    // It is stopped, with its lines drained, at exit.
+    static void StartAsync( bool json );
+    static void StopAsync();
+
 private:
+    enum class Kind : unsigned int
+    {
+        Out     = 0,
+        Error   = 1,
+        Verbose = 2     // Written to the error stream
+    };
+
+    static void Append( Kind kind, bool newLine, const char* msg, va_list args );
+    static void Drain();
 
     static FILE* GetOutStream();
     static FILE* GetErrStream();
@@ -32,4 +55,4 @@ private:
 private:
     static FILE* _outStream;
     static FILE* _errStream;
-};
\ No newline at end of file
+};
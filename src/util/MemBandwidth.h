@@ -0,0 +1,66 @@
+#pragma once
+#include "Platform.h"
+#include <vector>
+
+// Bytes moved to and from the DRAM of a NUMA node
+struct MemNodeTraffic
+{
+    uint64 bytes;       // Read and written
+    uint64 readBytes;   // 0 if the counters don't tell reads from writes
+    uint64 writeBytes;
+};
+
+/**
+ * Counts the DRAM traffic of each NUMA node, with the memory controllers'
+ * uncore counters, through perf_event (Linux only).
+ *
+ * Intel's integrated memory controllers (uncore_imc PMUs) count the reads and writes
+ * of their channels. AMD's data fabric (amd_df PMU) counts the data beats of each DRAM channel,
+ * read or written. Only the Zen 2 and Zen 3 encoding of those events is known, so other AMD CPUs are not supported.
+ *
+ * The controllers are counted system-wide, from the CPU the kernel designates for each package's PMU,
+ * so they count the traffic of every process, and are attributed to that CPU's node.
+ * With sub-NUMA clustering, all of a package's traffic is attributed to one of its nodes.
+ * Counting system-wide needs perf_event_paranoid at 0 or lower, or CAP_PERFMON.
+ */
+class MemBandwidthCounters
+{
+public:
+    MemBandwidthCounters();
+    ~MemBandwidthCounters();
+
+    // Opens the counters of every memory controller.
+    // Fails if the CPU has no known ones, or none could be opened.
+    bool Open();
+
+    void Close();
+
+    // Nodes that traffic is reported for: the highest node with a counted controller, plus 1
+    inline uint NodeCount() const { return _nodeCount; }
+
+    // Whether the counters tell reads from writes
+    inline bool SplitsReadWrite() const { return _splitsReadWrite; }
+
+    // Name of the PMUs counted
+    inline const char* Source() const { return _source; }
+
+    // Traffic of each node since Open(), for NodeCount() nodes
+    void Read( MemNodeTraffic* outNodes ) const;
+
+private:
+    struct Counter
+    {
+        int    fd;
+        uint   node;
+        bool   write;           // Counts writes only. Otherwise reads, or both if they are not split.
+        double bytesPerCount;
+    };
+
+    bool OpenPmuEvent( const char* pmu, const char* event, bool write, double bytesPerCount );
+
+private:
+    std::vector<Counter> _counters;
+    uint                 _nodeCount       = 0;
+    bool                 _splitsReadWrite = false;
+    const char*          _source          = "none";
+};
@@ -0,0 +1,104 @@
+#include "Metrics.h"
+#include "threading/ThreadPool.h"
+#include "Util.h"
+
+//-----------------------------------------------------------
+void PlotMetrics::SetPlotName( const char* name )
+{
+    const uint32 seq = plotNameSeq.load( std::memory_order_relaxed );
+
+    plotNameSeq.store( seq + 1, std::memory_order_relaxed );
+    std::atomic_thread_fence( std::memory_order_release );
+
+    strncpy( plotName, name, BB_METRICS_PLOT_NAME_LEN - 1 );
+    plotName[BB_METRICS_PLOT_NAME_LEN-1] = 0;
+
+    plotNameSeq.store( seq + 2, std::memory_order_release );
+}
+
+//-----------------------------------------------------------
+std::string PlotMetrics::PlotName() const
+{
+    char name[BB_METRICS_PLOT_NAME_LEN];
+
+    for( ;; )
+    {
+        const uint32 seq = plotNameSeq.load( std::memory_order_acquire );
+
+        if( seq & 1 )
+            continue;
+
+        memcpy( name, plotName, sizeof( name ) );
+        std::atomic_thread_fence( std::memory_order_acquire );
+
+        if( plotNameSeq.load( std::memory_order_relaxed ) == seq )
+            break;
+    }
+
+    name[BB_METRICS_PLOT_NAME_LEN-1] = 0;
+    return name;
+}
+
+//-----------------------------------------------------------
+std::string MetricsServer::Format() const
+{
+    std::string out;
+    char line[256];
+
+    auto metric = [&]( const char* name, const char* type, const char* help ) {
+        snprintf( line, sizeof( line ), "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type );
+        out += line;
+    };
+
+    auto value = [&]( const char* fmt, auto... args ) {
+        snprintf( line, sizeof( line ), fmt, args... );
+        out += line;
+    };
+
+    const auto   relaxed = std::memory_order_relaxed;
+    const double uptime  = std::chrono::duration<double>( std::chrono::steady_clock::now() - _startTime ).count();
+
+    const uint32 finished = _metrics.plotsFinished.load( relaxed );
+
+    metric( "bladebit_uptime_seconds", "gauge", "Seconds since the plotter started." );
+    value ( "bladebit_uptime_seconds %.3lf\n", uptime );
+
+    metric( "bladebit_plots_started_total", "counter", "Plots started." );
+    value ( "bladebit_plots_started_total %u\n", _metrics.plotsStarted.load( relaxed ) );
+
+    metric( "bladebit_plots_finished_total", "counter", "Plots finished." );
+    value ( "bladebit_plots_finished_total %u\n", finished );
+
+    metric( "bladebit_plots_per_hour", "gauge", "Plots finished per hour since the plotter started." );
+    value ( "bladebit_plots_per_hour %.3lf\n", uptime > 0 ? finished * 3600.0 / uptime : 0.0 );
+
+    // The plot name is a hex id with a fixed prefix and suffix, so it needs no escaping
+    metric( "bladebit_plot_info", "gauge", "The plot being plotted." );
+    value ( "bladebit_plot_info{plot=\"%s\"} 1\n", _metrics.PlotName().c_str() );
+
+    metric( "bladebit_phase", "gauge", "Phase being run, or 0 between plots." );
+    value ( "bladebit_phase %u\n", _metrics.phase.load( relaxed ) );
+
+    metric( "bladebit_table", "gauge", "Table being processed by the current phase, or 0." );
+    value ( "bladebit_table %u\n", _metrics.table.load( relaxed ) );
+
+    metric( "bladebit_table_entries", "gauge", "Entries of each table of the current plot." );
+    for( uint i = 0; i < 7; i++ )
+        value( "bladebit_table_entries{table=\"%u\"} %llu\n", i+1, _metrics.entryCount[i].load( relaxed ) );
+
+    metric( "bladebit_phase_duration_seconds", "gauge", "Time the last plot that ran each phase spent in it." );
+    for( uint i = 0; i < 4; i++ )
+        value( "bladebit_phase_duration_seconds{phase=\"%u\"} %.3lf\n", i+1, _metrics.phaseTime[i].load( relaxed ) / 1e6 );
+
+    metric( "bladebit_writer_queue_depth", "gauge", "Write commands queued in the plot writer." );
+    value ( "bladebit_writer_queue_depth %u\n", _metrics.writerQueueDepth.load( relaxed ) );
+
+    metric( "bladebit_written_bytes_total", "counter", "Bytes written to plot files." );
+    value ( "bladebit_written_bytes_total %llu\n", _metrics.bytesWritten.load( relaxed ) );
+
+    metric( "bladebit_thread_busy_seconds_total", "counter", "Time each pool thread spent running jobs." );
+    for( uint i = 0; i < _pool.ThreadCount(); i++ )
+        value( "bladebit_thread_busy_seconds_total{thread=\"%u\"} %.3lf\n", i, _pool.ThreadBusyTime( i ) / 1e9 );
+
+    return out;
+}
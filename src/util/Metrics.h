@@ -0,0 +1,105 @@
+#pragma once
+#include "Platform.h"
+#include <atomic>
+#include <chrono>
+#include <string>
+
+class ThreadPool;
+class Thread;
+
+#define BB_METRICS_PLOT_NAME_LEN 128
+
+/**
+ * Progress of the plotter, published to the metrics server.
+ *
+ * Fields are only updated once per phase, table, or write, never per entry,
+ * and with relaxed stores, so publishing them costs nothing measurable.
+ * The server may read them at any time from its own thread.
+ */
+struct PlotMetrics
+{
+    std::atomic<uint32> plotsStarted;
+    std::atomic<uint32> plotsFinished;
+    std::atomic<uint32> phase;              // Phase being run, 1-4, or 0 between plots
+    std::atomic<uint32> table;              // Table being processed by the phase, 1-7, or 0
+    std::atomic<uint64> entryCount[7];      // Entries of each table of the current plot, once known
+    std::atomic<uint64> phaseTime[4];       // Microseconds the last plot that ran each phase spent in it
+    std::atomic<uint64> bytesWritten;       // Bytes written to plot files
+    std::atomic<uint32> writerQueueDepth;   // Write commands queued in the plot writer last used
+
+    // Name of the current plot, behind a sequence lock:
+    // odd while it's being written, incremented once before and once after.
+    std::atomic<uint32> plotNameSeq;
+    char                plotName[BB_METRICS_PLOT_NAME_LEN];
+
+    // Sets the name of the plot being plotted. Only called from the plotting thread.
+    void SetPlotName( const char* name );
+
+    // Returns the name of the current plot
+    std::string PlotName() const;
+};
+
+// Updates the metrics, if they are enabled (not null)
+//-----------------------------------------------------------
+inline void MetricsSetPhase( PlotMetrics* metrics, uint phase )
+{
+    if( metrics )
+    {
+        metrics->phase.store( phase, std::memory_order_relaxed );
+        metrics->table.store( 0, std::memory_order_relaxed );
+    }
+}
+
+//-----------------------------------------------------------
+inline void MetricsEndPhase( PlotMetrics* metrics, uint phase, double seconds )
+{
+    if( metrics )
+        metrics->phaseTime[phase-1].store( (uint64)( seconds * 1e6 ), std::memory_order_relaxed );
+}
+
+//-----------------------------------------------------------
+inline void MetricsSetTable( PlotMetrics* metrics, uint table )
+{
+    if( metrics )
+        metrics->table.store( table, std::memory_order_relaxed );
+}
+
+//-----------------------------------------------------------
+inline void MetricsSetEntries( PlotMetrics* metrics, uint table, uint64 entryCount )
+{
+    if( metrics )
+        metrics->entryCount[table-1].store( entryCount, std::memory_order_relaxed );
+}
+
+/**
+ * Serves the plot metrics over HTTP in the Prometheus text format,
+ * to any request, on a TCP port or on a Unix socket.
+ *
+ * Requests are served one at a time by a single background thread.
+ * The per-thread busy time of the pool is served as well, for which
+ * the pool's job timing is enabled.
+ */
+class MetricsServer
+{
+public:
+    MetricsServer( const PlotMetrics& metrics, ThreadPool& pool );
+    ~MetricsServer();
+
+    // Listens on the given address: a [host:]port, on 127.0.0.1 if no host is given, or 'unix:<path>' for a Unix socket.
+    bool Start( const char* address );
+
+    // Formats the metrics as Prometheus text
+    std::string Format() const;
+
+private:
+    void Serve();
+
+private:
+    const PlotMetrics&  _metrics;
+    ThreadPool&         _pool;
+    Thread*             _thread   = nullptr;
+    int                 _listener = -1;
+    std::string         _unixPath;              // Removed when the server stops
+    std::atomic<bool>   _stop     = false;
+    std::chrono::steady_clock::time_point _startTime;
+};
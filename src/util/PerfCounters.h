@@ -0,0 +1,47 @@
+#pragma once
+#include "Platform.h"
+
+// Hardware events counted by PerfCounters
+enum class PerfEvent : uint
+{
+    Cycles = 0,
+    Instructions,
+    LLCMisses,      // Last-level cache read misses
+    DTLBMisses,     // Data TLB read misses
+    NodeLoads,      // Loads served by DRAM, local or remote
+    NodeLoadMisses, // Loads served by the DRAM of another NUMA node
+
+    _Count
+};
+
+/**
+ * Counts hardware events for a single thread, with perf_event (Linux only).
+ *
+ * The counters are opened by the thread to be counted, but may be read from any thread.
+ * Counts are scaled up for the time the events were not scheduled on the PMU,
+ * as the kernel multiplexes them when there are more events than counters.
+ * Events the CPU or the kernel don't support read as 0.
+ */
+class PerfCounters
+{
+public:
+    PerfCounters();
+    ~PerfCounters();
+
+    // Opens the counters for the calling thread.
+    // Fails if none of the events could be opened, ie. if perf_event_paranoid forbids it.
+    bool Open();
+
+    void Close();
+
+    // Current counts since Open().
+    void Read( uint64 counts[(uint)PerfEvent::_Count] ) const;
+
+    // Bytes this process has written to storage so far, or 0 if unknown
+    static uint64 ProcessBytesWritten();
+
+    static const char* EventName( PerfEvent event );
+
+private:
+    int _fds[(uint)PerfEvent::_Count];
+};
@@ -0,0 +1,362 @@
+#include "Profiler.h"
+#include "threading/ThreadPool.h"
+#include "util/Log.h"
+#include "Util.h"
+
+struct OpenCountersJob
+{
+    PerfCounters* counters;
+    bool          opened;
+};
+
+//-----------------------------------------------------------
+Profiler::Profiler( ThreadPool& pool, bool perfCounters, bool memBandwidth )
+    : _pool( pool )
+{
+    _pool.SetJobTiming( true );
+
+    if( memBandwidth )
+    {
+        #if __linux__
+            _bandwidth = new MemBandwidthCounters();
+
+            if( _bandwidth->Open() )
+            {
+                Log::Line( "Counting the memory bandwidth of %u NUMA node(s) with %s.", _bandwidth->NodeCount(), _bandwidth->Source() );
+            }
+            else
+            {
+                Log::Error( "Warning: Failed to open memory controller counters. They need an Intel uncore IMC or a Zen 2/3 data fabric, "
+                            "and /proc/sys/kernel/perf_event_paranoid at 0 or lower." );
+                delete _bandwidth;
+                _bandwidth = nullptr;
+            }
+        #else
+            Log::Error( "Warning: Memory bandwidth counters are only supported on Linux." );
+        #endif
+
+        perfCounters = true;
+    }
+
+    if( !perfCounters )
+        return;
+
+    #if __linux__
+        const uint threadCount = pool.ThreadCount();
+
+        _counters = new PerfCounters[threadCount+1];
+
+        // The counters count the thread that opens them, so each pool thread opens its own
+        OpenCountersJob* jobs = new OpenCountersJob[threadCount];
+
+        for( uint i = 0; i < threadCount; i++ )
+        {
+            jobs[i].counters = &_counters[i];
+            jobs[i].opened   = false;
+        }
+
+        pool.RunJob( (JobFunc)[]( void* pdata ) {
+
+            auto* job = (OpenCountersJob*)pdata;
+            job->opened = job->counters->Open();
+
+        }, jobs, threadCount, sizeof( OpenCountersJob ) );
+
+        bool opened = _counters[threadCount].Open();
+        for( uint i = 0; i < threadCount; i++ )
+            opened &= jobs[i].opened;
+
+        delete[] jobs;
+
+        if( !opened )
+        {
+            Log::Error( "Warning: Failed to open hardware performance counters. Check /proc/sys/kernel/perf_event_paranoid." );
+            delete[] _counters;
+            _counters = nullptr;
+        }
+    #else
+        Log::Error( "Warning: Hardware performance counters are only supported on Linux." );
+    #endif
+}
+
+//-----------------------------------------------------------
+Profiler::~Profiler()
+{
+    _pool.SetJobTiming( false );
+    delete[] _counters;
+    delete _bandwidth;
+}
+
+//-----------------------------------------------------------
+void Profiler::BeginPlot( const char* plotName )
+{
+    ASSERT( _current == NoScope );
+
+    _plotName  = plotName;
+    _plotStart = std::chrono::steady_clock::now();
+    _scopes.clear();
+}
+
+//-----------------------------------------------------------
+uint Profiler::BeginScope( const char* name, int index )
+{
+    const uint threadCount = _pool.ThreadCount();
+    const uint id          = (uint)_scopes.size();
+
+    _scopes.emplace_back();
+    Scope& scope = _scopes.back();
+
+    scope.name   = name;
+    scope.index  = index;
+    scope.parent = _current;
+    scope.threadTimes.resize( threadCount );
+
+    // Start values, replaced by the deltas when the scope ends
+    for( uint i = 0; i < threadCount; i++ )
+        scope.threadTimes[i] = _pool.ThreadBusyTime( i );
+
+    ReadCounts( scope.counts );
+
+    if( _bandwidth )
+    {
+        scope.nodeTraffic.resize( _bandwidth->NodeCount() );
+        _bandwidth->Read( scope.nodeTraffic.data() );
+    }
+
+    #if __linux__
+        scope.bytesWritten = PerfCounters::ProcessBytesWritten();
+    #else
+        scope.bytesWritten = 0;
+    #endif
+
+    scope.start = std::chrono::duration<double>( std::chrono::steady_clock::now() - _plotStart ).count();
+
+    _current = id;
+    return id;
+}
+
+//-----------------------------------------------------------
+void Profiler::EndScope( uint id )
+{
+    ASSERT( id == _current );
+    Scope& scope = _scopes[id];
+
+    scope.elapsed = std::chrono::duration<double>( std::chrono::steady_clock::now() - _plotStart ).count() - scope.start;
+
+    for( uint i = 0; i < (uint)scope.threadTimes.size(); i++ )
+        scope.threadTimes[i] = _pool.ThreadBusyTime( i ) - scope.threadTimes[i];
+
+    uint64 counts[(uint)PerfEvent::_Count];
+    ReadCounts( counts );
+
+    for( uint i = 0; i < (uint)PerfEvent::_Count; i++ )
+        scope.counts[i] = counts[i] - scope.counts[i];
+
+    if( _bandwidth )
+    {
+        std::vector<MemNodeTraffic> traffic( scope.nodeTraffic.size() );
+        _bandwidth->Read( traffic.data() );
+
+        for( size_t n = 0; n < traffic.size(); n++ )
+        {
+            MemNodeTraffic& node = scope.nodeTraffic[n];
+
+            node.bytes      = traffic[n].bytes      - node.bytes;
+            node.readBytes  = traffic[n].readBytes  - node.readBytes;
+            node.writeBytes = traffic[n].writeBytes - node.writeBytes;
+        }
+
+        // Phases
+        if( scope.parent == NoScope )
+            LogBandwidth( scope );
+    }
+
+    #if __linux__
+        scope.bytesWritten = PerfCounters::ProcessBytesWritten() - scope.bytesWritten;
+    #endif
+
+    _current = scope.parent;
+}
+
+//-----------------------------------------------------------
+void Profiler::LogBandwidth( const Scope& scope ) const
+{
+    std::string line;
+    char        buffer[128];
+
+    for( size_t n = 0; n < scope.nodeTraffic.size(); n++ )
+    {
+        const MemNodeTraffic& node = scope.nodeTraffic[n];
+
+        if( _bandwidth->SplitsReadWrite() )
+        {
+            snprintf( buffer, sizeof( buffer ), "%s node %u %.1lf GB/s (read %.1lf, write %.1lf)", n ? "," : "", (uint)n,
+                      node.bytes / scope.elapsed / 1e9, node.readBytes / scope.elapsed / 1e9, node.writeBytes / scope.elapsed / 1e9 );
+        }
+        else
+            snprintf( buffer, sizeof( buffer ), "%s node %u %.1lf GB/s", n ? "," : "", (uint)n, node.bytes / scope.elapsed / 1e9 );
+
+        line += buffer;
+    }
+
+    const double remote = RemoteLoadRatio( scope );
+    if( remote >= 0 )
+    {
+        snprintf( buffer, sizeof( buffer ), "; %.1lf%% of DRAM loads remote", remote * 100.0 );
+        line += buffer;
+    }
+
+    Log::Line( " Memory bandwidth of %s:%s", scope.name, line.c_str() );
+}
+
+//-----------------------------------------------------------
+double Profiler::RemoteLoadRatio( const Scope& scope )
+{
+    const uint64 loads  = scope.counts[(uint)PerfEvent::NodeLoads];
+    const uint64 misses = scope.counts[(uint)PerfEvent::NodeLoadMisses];
+
+    return loads ? std::min( 1.0, (double)misses / loads ) : -1.0;
+}
+
+//-----------------------------------------------------------
+void Profiler::ReadCounts( uint64 counts[(uint)PerfEvent::_Count] ) const
+{
+    for( uint e = 0; e < (uint)PerfEvent::_Count; e++ )
+        counts[e] = 0;
+
+    #if __linux__
+        if( !_counters )
+            return;
+
+        for( uint i = 0; i <= _pool.ThreadCount(); i++ )
+        {
+            uint64 threadCounts[(uint)PerfEvent::_Count];
+            _counters[i].Read( threadCounts );
+
+            for( uint e = 0; e < (uint)PerfEvent::_Count; e++ )
+                counts[e] += threadCounts[e];
+        }
+    #endif
+}
+
+//-----------------------------------------------------------
+bool Profiler::WritePlot( const char* path )
+{
+    ASSERT( _current == NoScope );
+
+    FILE* file = fopen( path, "w" );
+    if( !file )
+    {
+        const int err = errno;
+        Log::Error( "Warning: Failed to open profile file '%s' with error %d.", path, err );
+        return false;
+    }
+
+    fprintf( file, "{\n  \"plot\": \"" );
+    for( const char c : _plotName )
+    {
+        if( c == '"' || c == '\\' )
+            fputc( '\\', file );
+        fputc( c, file );
+    }
+
+    fprintf( file, "\",\n  \"threads\": %u,\n  \"perf_counters\": %s,\n  \"mem_bandwidth\": \"%s\",\n  \"scopes\": [",
+             _pool.ThreadCount(), _counters ? "true" : "false", _bandwidth ? _bandwidth->Source() : "none" );
+
+    bool first = true;
+    for( uint i = 0; i < (uint)_scopes.size(); i++ )
+    {
+        if( _scopes[i].parent != NoScope )
+            continue;
+
+        fprintf( file, first ? "\n" : ",\n" );
+        WriteScope( file, i, 2 );
+        first = false;
+    }
+
+    fprintf( file, "\n  ]\n}\n" );
+
+    const bool written = ferror( file ) == 0;
+    fclose( file );
+
+    return written;
+}
+
+//-----------------------------------------------------------
+void Profiler::WriteScope( FILE* file, uint id, int depth ) const
+{
+    const Scope& scope  = _scopes[id];
+    const int    indent = depth * 2;
+
+    fprintf( file, "%*s{ \"name\": \"%s\"", indent, "", scope.name );
+
+    if( scope.index >= 0 )
+        fprintf( file, ", \"index\": %d", scope.index );
+
+    fprintf( file, ", \"start\": %.6lf, \"time\": %.6lf, \"bytes_written\": %llu",
+             scope.start, scope.elapsed, scope.bytesWritten );
+
+    #if __linux__
+        if( _counters )
+        {
+            for( uint e = 0; e < (uint)PerfEvent::_Count; e++ )
+                fprintf( file, ", \"%s\": %llu", PerfCounters::EventName( (PerfEvent)e ), scope.counts[e] );
+
+            const double remote = RemoteLoadRatio( scope );
+            if( remote >= 0 )
+                fprintf( file, ", \"remote_load_ratio\": %.4lf", remote );
+        }
+    #endif
+
+    // GB/s of each node's DRAM
+    if( !scope.nodeTraffic.empty() )
+    {
+        const double elapsed = scope.elapsed > 0 ? scope.elapsed : 1.0;
+
+        fprintf( file, ",\n%*s  \"memory\": [", indent, "" );
+
+        for( size_t n = 0; n < scope.nodeTraffic.size(); n++ )
+        {
+            const MemNodeTraffic& node = scope.nodeTraffic[n];
+
+            fprintf( file, "%s{ \"node\": %u, \"bytes\": %llu, \"gbps\": %.3lf", n ? ", " : "", (uint)n,
+                     node.bytes, node.bytes / elapsed / 1e9 );
+
+            if( _bandwidth->SplitsReadWrite() )
+                fprintf( file, ", \"read_gbps\": %.3lf, \"write_gbps\": %.3lf", node.readBytes / elapsed / 1e9, node.writeBytes / elapsed / 1e9 );
+
+            fprintf( file, " }" );
+        }
+
+        fprintf( file, "]" );
+    }
+
+    fprintf( file, ",\n%*s  \"thread_times\": [", indent, "" );
+
+    for( uint i = 0; i < (uint)scope.threadTimes.size(); i++ )
+        fprintf( file, i ? ", %.6lf" : "%.6lf", scope.threadTimes[i] / 1e9 );
+
+    fprintf( file, "]" );
+
+    // Children
+    bool hasChildren = false;
+
+    for( uint i = id + 1; i < (uint)_scopes.size(); i++ )
+    {
+        if( _scopes[i].parent != id )
+            continue;
+
+        if( hasChildren )
+            fprintf( file, ",\n" );
+        else
+            fprintf( file, ",\n%*s  \"scopes\": [\n", indent, "" );
+
+        WriteScope( file, i, depth + 2 );
+        hasChildren = true;
+    }
+
+    if( hasChildren )
+        fprintf( file, "\n%*s  ]", indent, "" );
+
+    fprintf( file, " }" );
+}
@@ -0,0 +1,104 @@
+#pragma once
+#include "Platform.h"
+#include "util/PerfCounters.h"
+#include "util/MemBandwidth.h"
+#include "util/Trace.h"
+#include <vector>
+#include <chrono>
+
+class ThreadPool;
+
+/**
+ * Records a tree of timed scopes for each plot, ie. phase, table and kernel,
+ * and writes it out as JSON once the plot is done.
+ *
+ * Each scope records its wall time and, for each thread of the pool,
+ * the time it spent running jobs during the scope. If hardware counters
+ * are enabled (Linux only), each scope also records the events counted
+ * by the pool's threads and the plotting thread, and the bytes the process wrote to storage.
+ * If memory bandwidth counters are enabled (Linux only), each scope also records the DRAM traffic
+ * of each NUMA node, from which its bandwidth is reported, along with the share of the threads' DRAM loads
+ * that were served by a remote node. The bandwidth of each phase is logged as well.
+ *
+ * Scopes are only opened and closed from the plotting thread.
+ */
+class Profiler
+{
+public:
+    // The pool must be in Fixed mode, as the counters of each of its threads
+    // are opened by a job running on that thread.
+    // memBandwidth implies perfCounters, for the remote loads.
+    Profiler( ThreadPool& pool, bool perfCounters, bool memBandwidth = false );
+    ~Profiler();
+
+    // Discards the scopes of the previous plot
+    void BeginPlot( const char* plotName );
+
+    // Writes the plot's scopes as JSON to the given file
+    bool WritePlot( const char* path );
+
+    // Opens a scope nested in the current one, and returns its id.
+    // index distinguishes instances of the same scope, ie. the table. -1 if unused.
+    uint BeginScope( const char* name, int index = -1 );
+
+    // Closes the given scope, which must be the current one
+    void EndScope( uint scope );
+
+    inline bool HasPerfCounters() const { return _counters != nullptr; }
+    inline bool HasMemBandwidth() const { return _bandwidth != nullptr; }
+
+private:
+    struct Scope
+    {
+        const char*         name;
+        int                 index;
+        uint                parent;
+        double              start;          // Seconds since the plot began
+        double              elapsed;        // Seconds
+        uint64              bytesWritten;
+        uint64              counts[(uint)PerfEvent::_Count];
+        std::vector<uint64> threadTimes;    // Nanoseconds each pool thread spent running jobs
+        std::vector<MemNodeTraffic> nodeTraffic;    // DRAM traffic of each node, if its counters are enabled
+    };
+
+    void ReadCounts( uint64 counts[(uint)PerfEvent::_Count] ) const;
+    void WriteScope( FILE* file, uint scope, int depth ) const;
+    void LogBandwidth( const Scope& scope ) const;
+
+    // Share of the DRAM loads that were served by a remote node, or negative if unknown
+    static double RemoteLoadRatio( const Scope& scope );
+
+private:
+    ThreadPool&         _pool;
+    PerfCounters*       _counters     = nullptr;    // One per pool thread, followed by the plotting thread's
+    MemBandwidthCounters* _bandwidth  = nullptr;
+    std::string         _plotName;
+    std::vector<Scope>  _scopes;
+    uint                _current      = NoScope;
+    std::chrono::steady_clock::time_point _plotStart;
+
+    static constexpr uint NoScope = 0xFFFFFFFF;
+};
+
+/// Opens a profiler scope for its lifetime. The profiler may be null.
+/// The scope is traced as well, if tracing is enabled.
+class ProfileScope
+{
+public:
+    inline ProfileScope( Profiler* profiler, const char* name, int index = -1 )
+        : _profiler( profiler )
+        , _scope   ( profiler ? profiler->BeginScope( name, index ) : 0 )
+        , _trace   ( name, index )
+    {}
+
+    inline ~ProfileScope()
+    {
+        if( _profiler )
+            _profiler->EndScope( _scope );
+    }
+
+private:
+    Profiler*  _profiler;
+    uint       _scope;
+    TraceScope _trace;
+};
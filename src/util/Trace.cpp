@@ -0,0 +1,172 @@
+#include "Trace.h"
+#include "util/Log.h"
+#include <mutex>
+#include <vector>
+
+struct TraceEvent
+{
+    const char* name;
+    int         index;
+    uint64      start;      // Nanoseconds since tracing was enabled
+    uint64      duration;
+};
+
+struct TraceRing
+{
+    const char*         name;
+    int                 index;
+    uint                tid;
+    std::atomic<uint64> head     = 0;   // Events ever recorded. (Only written by the owning thread.)
+    uint64              written  = 0;   // Events already written out. (Only used when writing.)
+    TraceEvent          events[BB_TRACE_EVENTS_PER_THREAD];
+};
+
+std::atomic<bool> Trace::_enabled = false;
+
+static Trace::TimePoint         _traceStart;
+static std::mutex               _ringsLock;     // Only taken when a thread records its first event, and when writing
+static std::vector<TraceRing*>  _rings;
+
+static thread_local TraceRing*  _threadRing     = nullptr;
+static thread_local const char* _threadName     = nullptr;
+static thread_local int         _threadIndex    = -1;
+static thread_local const char* _scopeName      = nullptr;
+static thread_local int         _scopeIndex     = -1;
+
+//-----------------------------------------------------------
+void Trace::Enable()
+{
+    _traceStart = Now();
+    _enabled.store( true, std::memory_order_release );
+}
+
+//-----------------------------------------------------------
+void Trace::NameThread( const char* name, int index )
+{
+    _threadName  = name;
+    _threadIndex = index;
+}
+
+//-----------------------------------------------------------
+const char* Trace::CurrentScope()
+{
+    return _scopeName;
+}
+
+//-----------------------------------------------------------
+int Trace::CurrentScopeIndex()
+{
+    return _scopeIndex;
+}
+
+//-----------------------------------------------------------
+void Trace::SetCurrentScope( const char* name, int index )
+{
+    _scopeName  = name;
+    _scopeIndex = index;
+}
+
+//-----------------------------------------------------------
+void Trace::Record( const char* name, int index, TimePoint start, TimePoint end )
+{
+    TraceRing* ring = _threadRing;
+
+    if( !ring )
+    {
+        ring = new TraceRing();
+        ring->name  = _threadName ? _threadName : "thread";
+        ring->index = _threadIndex;
+
+        std::lock_guard<std::mutex> lock( _ringsLock );
+        ring->tid = (uint)_rings.size() + 1;
+        _rings.push_back( ring );
+
+        _threadRing = ring;
+    }
+
+    const uint64 head = ring->head.load( std::memory_order_relaxed );
+    TraceEvent&  e    = ring->events[head % BB_TRACE_EVENTS_PER_THREAD];
+
+    e.name     = name;
+    e.index    = index;
+    e.start    = start > _traceStart ? (uint64)std::chrono::duration_cast<std::chrono::nanoseconds>( start - _traceStart ).count() : 0;
+    e.duration = (uint64)std::chrono::duration_cast<std::chrono::nanoseconds>( end - start ).count();
+
+    ring->head.store( head + 1, std::memory_order_release );
+}
+
+//-----------------------------------------------------------
+bool Trace::Write( const char* path )
+{
+    FILE* file = fopen( path, "w" );
+    if( !file )
+    {
+        const int err = errno;
+        Log::Error( "Warning: Failed to open trace file '%s' with error %d.", path, err );
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock( _ringsLock );
+
+    fprintf( file, "{\n  \"displayTimeUnit\": \"ms\",\n  \"traceEvents\": [" );
+    bool first = true;
+
+    std::vector<TraceEvent> events;
+    uint64 dropped = 0;
+
+    for( TraceRing* ring : _rings )
+    {
+        // Name the thread's track
+        char name[64];
+        if( ring->index >= 0 )
+            snprintf( name, sizeof( name ), "%s %d", ring->name, ring->index );
+        else
+            snprintf( name, sizeof( name ), "%s", ring->name );
+
+        fprintf( file, "%s\n    { \"ph\": \"M\", \"name\": \"thread_name\", \"pid\": 1, \"tid\": %u, \"args\": { \"name\": \"%s\" } }",
+                 first ? "" : ",", ring->tid, name );
+        first = false;
+
+        // Copy the events recorded since the last write, dropping the ones that were
+        // overwritten, either before we got here, or while we were copying them.
+        const uint64 head  = ring->head.load( std::memory_order_acquire );
+        uint64       begin = std::max( ring->written, head > BB_TRACE_EVENTS_PER_THREAD ? head - BB_TRACE_EVENTS_PER_THREAD : 0 );
+
+        dropped += begin - ring->written;
+
+        events.clear();
+        for( uint64 i = begin; i < head; i++ )
+            events.push_back( ring->events[i % BB_TRACE_EVENTS_PER_THREAD] );
+
+        const uint64 newHead = ring->head.load( std::memory_order_acquire );
+        const uint64 valid   = newHead > BB_TRACE_EVENTS_PER_THREAD ? newHead - BB_TRACE_EVENTS_PER_THREAD : 0;
+        const uint64 skip    = valid > begin ? std::min( valid - begin, head - begin ) : 0;
+
+        dropped      += skip;
+        ring->written = head;
+
+        for( uint64 i = skip; i < (uint64)events.size(); i++ )
+        {
+            const TraceEvent& e = events[i];
+
+            fprintf( file, ",\n    { \"ph\": \"X\", \"name\": \"%s\", \"pid\": 1, \"tid\": %u, \"ts\": %.3lf, \"dur\": %.3lf",
+                     e.name, ring->tid, e.start / 1e3, e.duration / 1e3 );
+
+            if( e.index >= 0 )
+                fprintf( file, ", \"args\": { \"index\": %d }", e.index );
+
+            fprintf( file, " }" );
+        }
+    }
+
+    fprintf( file, "\n  ]\n}\n" );
+
+    const bool written = ferror( file ) == 0;
+    fclose( file );
+
+    if( dropped )
+        Log::Line( "Warning: %llu trace events were dropped, as their threads produced more than %u between traces.",
+                   dropped, BB_TRACE_EVENTS_PER_THREAD );
+
+    return written;
+}
@@ -0,0 +1,87 @@
+#pragma once
+#include "Platform.h"
+#include <atomic>
+#include <chrono>
+
+// Events each thread keeps. Older ones are overwritten once a thread's ring is full.
+#define BB_TRACE_EVENTS_PER_THREAD ( 1u << 15 )
+
+/**
+ * Records a timeline of what each thread does, ie. the pool's jobs, the scopes of the
+ * plotting thread, barrier waits and the plot writer's writes, and writes it out
+ * as a Chrome trace (JSON), which can be opened with chrome://tracing or Perfetto.
+ *
+ * Each thread records its events into its own ring, which it alone writes to,
+ * so recording takes no locks. When tracing is disabled, recording costs a single
+ * relaxed load, as callers check Enabled() before they even read the time.
+ *
+ * Events are only written out once, so each trace holds the events since the previous one.
+ */
+class Trace
+{
+public:
+    typedef std::chrono::steady_clock::time_point TimePoint;
+
+    static void Enable();
+
+    inline static bool Enabled() { return _enabled.load( std::memory_order_relaxed ); }
+
+    inline static TimePoint Now() { return std::chrono::steady_clock::now(); }
+
+    // Names the calling thread's track, as '<name> <index>', or just the name if index is negative.
+    // Can be called whether tracing is enabled or not. The name must outlive the thread.
+    static void NameThread( const char* name, int index = -1 );
+
+    // Records a complete event on the calling thread. The name must be a string literal, or outlive the trace.
+    // index distinguishes instances of the same event, ie. the table. -1 if unused.
+    static void Record( const char* name, int index, TimePoint start, TimePoint end );
+
+    // The scope the calling thread is in, which names the jobs it dispatches to a pool
+    static const char* CurrentScope();
+    static int         CurrentScopeIndex();
+
+    // Writes the events recorded by all threads since the previous call.
+    // Threads may keep recording meanwhile.
+    static bool Write( const char* path );
+
+private:
+    friend class TraceScope;
+    static void SetCurrentScope( const char* name, int index );
+
+private:
+    static std::atomic<bool> _enabled;
+};
+
+/// Records a trace event for its lifetime, naming the jobs dispatched within it
+class TraceScope
+{
+public:
+    inline TraceScope( const char* name, int index = -1 )
+        : _name( Trace::Enabled() ? name : nullptr )
+    {
+        if( _name )
+        {
+            _parent      = Trace::CurrentScope();
+            _parentIndex = Trace::CurrentScopeIndex();
+            _index       = index;
+            _start       = Trace::Now();
+            Trace::SetCurrentScope( name, index );
+        }
+    }
+
+    inline ~TraceScope()
+    {
+        if( _name )
+        {
+            Trace::Record( _name, _index, _start, Trace::Now() );
+            Trace::SetCurrentScope( _parent, _parentIndex );
+        }
+    }
+
+private:
+    const char*      _name;
+    const char*      _parent      = nullptr;
+    int              _parentIndex = -1;
+    int              _index       = -1;
+    Trace::TimePoint _start;
+};